@@ -716,5 +716,311 @@ namespace UnitTest
 
 			Assert::AreEqual(ret, 0);
 		}
+
+		TEST_METHOD(source_index) {
+			int ret = quicrq_source_index_test();
+
+			Assert::AreEqual(ret, 0);
+		}
+
+		TEST_METHOD(media_id) {
+			int ret = quicrq_media_id_test();
+
+			Assert::AreEqual(ret, 0);
+		}
+
+		TEST_METHOD(fragment_buffer) {
+			int ret = quicrq_fragment_buffer_test();
+
+			Assert::AreEqual(ret, 0);
+		}
+
+		TEST_METHOD(memory_pool) {
+			int ret = quicrq_pool_test();
+
+			Assert::AreEqual(ret, 0);
+		}
+
+		TEST_METHOD(fragment_object_index) {
+			int ret = quicrq_fragment_object_index_test();
+
+			Assert::AreEqual(ret, 0);
+		}
+
+		TEST_METHOD(subscribe_trie) {
+			int ret = quicrq_subscribe_trie_test();
+
+			Assert::AreEqual(ret, 0);
+		}
+
+		TEST_METHOD(datagram_scheduler) {
+			int ret = quicrq_datagram_scheduler_test();
+
+			Assert::AreEqual(ret, 0);
+		}
+
+		TEST_METHOD(datagram_coalescing) {
+			int ret = quicrq_datagram_coalescing_test();
+
+			Assert::AreEqual(ret, 0);
+		}
+
+		TEST_METHOD(source_wakeup) {
+			int ret = quicrq_source_wakeup_test();
+
+			Assert::AreEqual(ret, 0);
+		}
+
+		TEST_METHOD(congestion_rate_epoch) {
+			int ret = quicrq_congestion_rate_epoch_test();
+
+			Assert::AreEqual(ret, 0);
+		}
+
+		TEST_METHOD(timer) {
+			int ret = quicrq_timer_test();
+
+			Assert::AreEqual(ret, 0);
+		}
+
+		TEST_METHOD(cache_memory_limit) {
+			int ret = quicrq_cache_memory_limit_test();
+
+			Assert::AreEqual(ret, 0);
+		}
+
+		TEST_METHOD(shard) {
+			int ret = quicrq_shard_test();
+
+			Assert::AreEqual(ret, 0);
+		}
+
+		TEST_METHOD(publish_queue) {
+			int ret = quicrq_publish_queue_test();
+
+			Assert::AreEqual(ret, 0);
+		}
+
+		TEST_METHOD(publish_object_ex) {
+			int ret = quicrq_publish_object_ex_test();
+
+			Assert::AreEqual(ret, 0);
+		}
+
+		TEST_METHOD(fragment_views) {
+			int ret = quicrq_fragment_views_test();
+
+			Assert::AreEqual(ret, 0);
+		}
+
+		TEST_METHOD(reassembly_in_place) {
+			int ret = quicrq_reassembly_in_place_test();
+
+			Assert::AreEqual(ret, 0);
+		}
+
+		TEST_METHOD(datagram_ack_ring) {
+			int ret = quicrq_datagram_ack_ring_test();
+
+			Assert::AreEqual(ret, 0);
+		}
+
+		TEST_METHOD(datagram_fec) {
+			int ret = quicrq_datagram_fec_test();
+
+			Assert::AreEqual(ret, 0);
+		}
+
+		TEST_METHOD(fragment_publisher_next) {
+			int ret = quicrq_fragment_publisher_next_test();
+
+			Assert::AreEqual(ret, 0);
+		}
+
+		TEST_METHOD(uni_stream_pool) {
+			int ret = quicrq_uni_stream_pool_test();
+
+			Assert::AreEqual(ret, 0);
+		}
+
+		TEST_METHOD(bench_fanout) {
+			int ret = quicrq_bench_fanout_test();
+
+			Assert::AreEqual(ret, 0);
+		}
+
+		TEST_METHOD(delay_histogram) {
+			int ret = quicrq_delay_histogram_test();
+
+			Assert::AreEqual(ret, 0);
+		}
+
+		TEST_METHOD(stats) {
+			int ret = quicrq_stats_test();
+
+			Assert::AreEqual(ret, 0);
+		}
+
+		TEST_METHOD(relay_failover) {
+			int ret = quicrq_relay_failover_test();
+
+			Assert::AreEqual(ret, 0);
+		}
+
+		TEST_METHOD(fragment_group_index) {
+			int ret = quicrq_fragment_group_index_test();
+
+			Assert::AreEqual(ret, 0);
+		}
+
+		TEST_METHOD(fragment_catch_up) {
+			int ret = quicrq_fragment_catch_up_test();
+
+			Assert::AreEqual(ret, 0);
+		}
+
+		TEST_METHOD(cache_spill) {
+			int ret = quicrq_cache_spill_test();
+
+			Assert::AreEqual(ret, 0);
+		}
+
+		TEST_METHOD(datagram_compact_header) {
+			int ret = quicrq_datagram_compact_header_test();
+
+			Assert::AreEqual(ret, 0);
+		}
+
+		TEST_METHOD(batch_msg) {
+			int ret = quicrq_batch_msg_test();
+
+			Assert::AreEqual(ret, 0);
+		}
+
+		TEST_METHOD(twomedia_datagram_batch) {
+			int ret = quicrq_twomedia_datagram_batch_test();
+
+			Assert::AreEqual(ret, 0);
+		}
+
+		TEST_METHOD(cnx_count) {
+			int ret = quicrq_cnx_count_test();
+
+			Assert::AreEqual(ret, 0);
+		}
+
+		TEST_METHOD(feedback) {
+			int ret = quicrq_feedback_test();
+
+			Assert::AreEqual(ret, 0);
+		}
+
+		TEST_METHOD(relay_warm) {
+			int ret = quicrq_relay_warm_test();
+
+			Assert::AreEqual(ret, 0);
+		}
+
+		TEST_METHOD(fragment_size) {
+			int ret = quicrq_fragment_size_test();
+
+			Assert::AreEqual(ret, 0);
+		}
+
+		TEST_METHOD(arrival_cursor) {
+			int ret = quicrq_arrival_cursor_test();
+
+			Assert::AreEqual(ret, 0);
+		}
+
+		TEST_METHOD(publish_object_ex_null) {
+			int ret = quicrq_publish_object_ex_null_test();
+
+			Assert::AreEqual(ret, 0);
+		}
+
+		TEST_METHOD(shard_thread) {
+			int ret = quicrq_shard_thread_test();
+
+			Assert::AreEqual(ret, 0);
+		}
+
+		TEST_METHOD(shard_peers) {
+			int ret = quicrq_shard_peers_test();
+
+			Assert::AreEqual(ret, 0);
+		}
+
+		TEST_METHOD(twomedia_batch_partial) {
+			int ret = quicrq_twomedia_batch_partial_test();
+
+			Assert::AreEqual(ret, 0);
+		}
+
+		TEST_METHOD(twomedia_batch_unsubscribe) {
+			int ret = quicrq_twomedia_batch_unsubscribe_test();
+
+			Assert::AreEqual(ret, 0);
+		}
+
+		TEST_METHOD(relay_failover_post) {
+			int ret = quicrq_relay_failover_post_test();
+
+			Assert::AreEqual(ret, 0);
+		}
+
+		TEST_METHOD(cache_spill_retry) {
+			int ret = quicrq_cache_spill_retry_test();
+
+			Assert::AreEqual(ret, 0);
+		}
+
+		TEST_METHOD(relay_warm_resume) {
+			int ret = quicrq_relay_warm_resume_test();
+
+			Assert::AreEqual(ret, 0);
+		}
+
+		TEST_METHOD(relay_feedback) {
+			int ret = quicrq_relay_feedback_test();
+
+			Assert::AreEqual(ret, 0);
+		}
+
+		TEST_METHOD(consumer_stats) {
+			int ret = quicrq_consumer_stats_test();
+
+			Assert::AreEqual(ret, 0);
+		}
+
+		TEST_METHOD(track_warp_header) {
+			int ret = quicrq_track_warp_header_test();
+
+			Assert::AreEqual(ret, 0);
+		}
+
+		TEST_METHOD(congestion_basic_r) {
+			int ret = quicrq_congestion_basic_r_test();
+
+			Assert::AreEqual(ret, 0);
+		}
+
+		TEST_METHOD(congestion_datagram_r) {
+			int ret = quicrq_congestion_datagram_r_test();
+
+			Assert::AreEqual(ret, 0);
+		}
+
+		TEST_METHOD(reassembly_in_place_budget) {
+			int ret = quicrq_reassembly_in_place_budget_test();
+
+			Assert::AreEqual(ret, 0);
+		}
+
+		TEST_METHOD(datagram_compact_ack_lag) {
+			int ret = quicrq_datagram_compact_ack_lag_test();
+
+			Assert::AreEqual(ret, 0);
+		}
     };
 }
@@ -69,7 +69,15 @@ quicrq_ctx_t* quicrq_create(char const* alpn,
     char const* ticket_store_file_name, char const* token_store_file_name,
     const uint8_t* ticket_encryption_key, size_t ticket_encryption_key_length,
     uint64_t* simulated_time);
+/* Same as quicrq_create, with a maximum number of connections. Relays serving
+ * many subscribers should set it, the default is 256. */
+quicrq_ctx_t* quicrq_create_ex(char const* alpn,
+    char const* cert_file_name, char const* key_file_name, char const* cert_root_file_name,
+    char const* ticket_store_file_name, char const* token_store_file_name,
+    const uint8_t* ticket_encryption_key, size_t ticket_encryption_key_length,
+    uint64_t* simulated_time, uint32_t max_nb_connections);
 void quicrq_delete(quicrq_ctx_t* ctx);
+size_t quicrq_get_nb_connections(quicrq_ctx_t* ctx);
 picoquic_quic_t* quicrq_get_quic_ctx(quicrq_ctx_t* ctx);
 void quicrq_init_transport_parameters(picoquic_tp_t* tp, int client_mode);
 
@@ -92,6 +100,224 @@ void quicrq_init_transport_parameters(picoquic_tp_t* tp, int client_mode);
 void quicrq_set_cache_duration(quicrq_ctx_t* qr_ctx, uint64_t cache_duration_max);
 uint64_t quicrq_time_check(quicrq_ctx_t* qr_ctx, uint64_t current_time);
 
+/* Cache memory limit.
+ * The time based management does not bound the size of caches that are not
+ * "real time", which keep all objects until the feed is closed. The function
+ * `quicrq_set_cache_memory_limit` sets a budget, in bytes of fragment data,
+ * for all the caches in the context. If the value is zero, the default, the
+ * memory is not limited.
+ *
+ * When the budget is exceeded, `quicrq_time_check` evicts whole groups,
+ * oldest group first, from the least recently read caches. The groups that
+ * subscribed streams are still reading, and the groups not yet completely
+ * received, are never evicted, so the memory may remain above the budget
+ * if all readers are lagging. New subscribers start at the first group
+ * remaining in the cache.
+ *
+ * The function `quicrq_get_cache_memory_stats` reports the memory used by
+ * the caches and the amount of data evicted so far.
+ */
+typedef struct st_quicrq_cache_memory_stats_t {
+    size_t memory_limit; /* Budget set by quicrq_set_cache_memory_limit, or 0 */
+    size_t cache_bytes; /* Data bytes currently held in all caches */
+    uint64_t evicted_bytes; /* Data bytes evicted to meet the budget */
+    uint64_t evicted_groups; /* Number of groups evicted to meet the budget */
+    size_t spilled_bytes; /* Data bytes currently held in spill segments, see quicrq_set_cache_spill */
+    uint64_t spilled_groups; /* Number of groups moved to spill segments */
+} quicrq_cache_memory_stats_t;
+
+void quicrq_set_cache_memory_limit(quicrq_ctx_t* qr_ctx, size_t memory_limit);
+void quicrq_get_cache_memory_stats(quicrq_ctx_t* qr_ctx, quicrq_cache_memory_stats_t* stats);
+
+/* Catch up pacing.
+ * A subscriber joining a media in progress starts with the objects already in
+ * the cache. By default, these objects are sent as fast as the connection
+ * allows, which may congest the path and cause the newest objects to be dropped.
+ * The function `quicrq_set_catch_up_speed` paces the cached objects at
+ * `speed_percent` percent of the rate at which they were received, e.g., 200 to send
+ * them twice as fast, until the subscriber reaches the live edge. The objects
+ * are then forwarded as soon as they arrive. The value shall be larger than 100
+ * for the subscriber to ever catch up. Smaller values, and zero, the default,
+ * disable the pacing.
+ */
+#define QUICRQ_CATCH_UP_SPEED_MIN 101
+
+void quicrq_set_catch_up_speed(quicrq_ctx_t* qr_ctx, uint32_t speed_percent);
+
+/* Cache spill to disk.
+ * Caches that are not "real time" keep all objects until the feed is closed,
+ * which for long events may require gigabytes per media. The function
+ * `quicrq_set_cache_spill` enables a second cache tier. When the fragment data
+ * held in memory by all caches exceeds `hot_limit` bytes, `quicrq_time_check`
+ * moves the oldest complete groups to a segment file created in `spill_directory`.
+ * The data is appended to the segment, which is memory mapped, and then served
+ * from the mapping by the regular cache functions. It stays in the page cache
+ * of the system, but no longer counts against the heap or against the budget
+ * set by `quicrq_set_cache_memory_limit`. If that budget is still exceeded,
+ * groups are evicted oldest first as before, whether spilled or not.
+ *
+ * Each segment holds up to `segment_size` bytes, or QUICRQ_SPILL_SEGMENT_SIZE_DEFAULT
+ * if the value is zero. Segment files are removed from the directory as soon as
+ * created, and their space is reclaimed when the data they hold leaves the caches.
+ * Groups are spilled in order, and only if complete: a group that misses objects
+ * stays in memory, and so do the groups after it in the same cache.
+ *
+ * Setting `spill_directory` to NULL disables the spill. The function returns 0,
+ * or -1 if the directory name could not be copied.
+ */
+#define QUICRQ_SPILL_SEGMENT_SIZE_DEFAULT 0x4000000
+
+int quicrq_set_cache_spill(quicrq_ctx_t* qr_ctx, const char* spill_directory, size_t hot_limit, size_t segment_size);
+
+/* Media statistics.
+ * Streams maintain counters of the media sent and received, and a histogram
+ * of the queue delays carried by the datagrams received. The counters are
+ * updated as fragments are sent or received, and only cost a few additions.
+ * The functions below return a snapshot:
+ * - `quicrq_get_stream_stats` for one media stream,
+ * - `quicrq_get_cnx_stats` for a connection, summing the counters of the streams
+ *   that are open and of those that were closed since the connection started,
+ * - `quicrq_get_cache_stats` for the cache of the local source with that URL.
+ *   It returns -1 if there is no such source.
+ * The streams of a connection can be enumerated with `quicrq_first_stream` and
+ * `quicrq_next_stream`.
+ *
+ * Dropped objects are those skipped by the sender because of congestion. On the
+ * receiver, they are the placeholders of objects skipped upstream. Repaired
+ * fragments are those sent again after a datagram was declared lost, and
+ * recovered fragments are those rebuilt by the receiver from FEC datagrams.
+ * Delays are in microseconds, including the queue delays that datagrams carry
+ * in milliseconds. The percentiles are the upper bound of the histogram
+ * bucket, which is within 1/8th of the measured value.
+ */
+typedef struct st_quicrq_delay_stats_t {
+    uint64_t nb_samples;
+    uint64_t delay_p50;
+    uint64_t delay_p90;
+    uint64_t delay_p99;
+    uint64_t delay_max;
+} quicrq_delay_stats_t;
+
+typedef struct st_quicrq_media_stats_t {
+    uint64_t objects_sent;
+    uint64_t fragments_sent;
+    uint64_t bytes_sent;
+    uint64_t objects_received;
+    uint64_t fragments_received;
+    uint64_t bytes_received;
+    uint64_t objects_dropped;
+    uint64_t fragments_repaired;
+    uint64_t fragments_extra_sent; /* Extra repeats, see quicrq_set_extra_repeat */
+    uint64_t fragments_recovered;
+    quicrq_delay_stats_t queue_delay; /* Only datagrams carry the queue delay */
+} quicrq_media_stats_t;
+
+typedef struct st_quicrq_stream_stats_t {
+    uint64_t stream_id;
+    quicrq_transport_mode_enum transport_mode;
+    int is_sender;
+    quicrq_media_stats_t media;
+} quicrq_stream_stats_t;
+
+typedef struct st_quicrq_cnx_stats_t {
+    size_t nb_streams; /* Streams currently open */
+    int is_congested;
+    uint8_t priority_threshold; /* Highest priority level that may be dropped */
+    quicrq_media_stats_t media;
+} quicrq_cnx_stats_t;
+
+/* Per hop latency.
+ * Each cache keeps histograms of the delays added at this hop, and the
+ * context keeps the same histograms for all of its caches, i.e., for the
+ * whole relay:
+ * - upstream_queue_delay: queue delay carried by the fragments added to the
+ *   cache, as accumulated by the upstream nodes,
+ * - receive_to_cache: delay between the arrival of the first fragment of
+ *   an object and the object being complete in the cache, which grows when
+ *   fragments are lost or reordered on the upstream link,
+ * - cache_to_send: delay between the arrival of a fragment in the cache and
+ *   its transmission on a connection, for each transmission.
+ * Comparing these values across the relays of a pyramid shows which tier
+ * adds latency. The relay wide values are returned by
+ * `quicrq_get_hop_latency_stats`, the per source values are part of the
+ * cache stats.
+ */
+typedef struct st_quicrq_hop_latency_stats_t {
+    quicrq_delay_stats_t upstream_queue_delay;
+    quicrq_delay_stats_t receive_to_cache;
+    quicrq_delay_stats_t cache_to_send;
+} quicrq_hop_latency_stats_t;
+
+typedef struct st_quicrq_cache_stats_t {
+    size_t cache_bytes; /* Data bytes held in the fragments of the cache */
+    uint64_t evicted_bytes; /* Data bytes evicted to meet the cache memory limit */
+    size_t spilled_bytes; /* Data bytes of the cache held in spill segments */
+    size_t nb_fragments;
+    size_t nb_objects;
+    uint64_t nb_object_received;
+    uint64_t first_group_id;
+    uint64_t first_object_id;
+    uint64_t highest_group_id;
+    uint64_t highest_object_id;
+    size_t nb_readers; /* Streams reading from the cache */
+    int is_feed_closed;
+    quicrq_hop_latency_stats_t latency;
+} quicrq_cache_stats_t;
+
+quicrq_stream_ctx_t* quicrq_first_stream(quicrq_cnx_ctx_t* cnx_ctx);
+quicrq_stream_ctx_t* quicrq_next_stream(quicrq_stream_ctx_t* stream_ctx);
+void quicrq_get_stream_stats(quicrq_stream_ctx_t* stream_ctx, quicrq_stream_stats_t* stats);
+void quicrq_get_cnx_stats(quicrq_cnx_ctx_t* cnx_ctx, quicrq_cnx_stats_t* stats);
+int quicrq_get_cache_stats(quicrq_ctx_t* qr_ctx, const uint8_t* url, size_t url_length, quicrq_cache_stats_t* stats);
+void quicrq_get_hop_latency_stats(quicrq_ctx_t* qr_ctx, quicrq_hop_latency_stats_t* stats);
+
+/* Relay shards.
+ * A quicrq context and its picoquic context are single threaded. To use several
+ * cores, a relay can run several contexts, each with its own packet loop thread,
+ * its own socket and its own connections. The distribution of connections
+ * between the shards is done by the application, for example by steering
+ * packets by connection ID, or by sharing the server port with SO_REUSEPORT.
+ *
+ * The function `quicrq_shard_feed_create` mirrors a source of the source context,
+ * identified by URL, to a cache in the shard context, from which the connections of
+ * the shard are served. The source is written only by the source thread. Each
+ * new fragment is copied to the shards through a lock free ring, and the shard
+ * threads add it to their mirror cache when they call `quicrq_time_check`.
+ * Each thread only ever accesses its own context. The ring size is rounded up
+ * to a power of 2, or set to QUICRQ_SHARD_RING_SIZE_DEFAULT if zero.
+ *
+ * Feeds are created and deleted in the thread of the source context, while the
+ * threads of the relay run. The content already in the source cache is queued when
+ * the feed is created, and the mirror is created by the shard thread at its next
+ * time check. If the shard already has a source with the same URL, the shard refuses
+ * the feed, and the source thread stops feeding it. Deleting a feed closes the mirror,
+ * which is then deleted like a relay cache. The publish wakeup function of the shard
+ * context, see `quicrq_set_publish_wakeup_fn`, is called when new entries are ready;
+ * shards without it poll their feeds every millisecond. The shard context shall exist
+ * until the threads that create feeds to it have stopped. Remaining feeds are released
+ * by `quicrq_delete`; the other side finds them detached.
+ */
+#define QUICRQ_SHARD_RING_SIZE_DEFAULT 1024
+
+typedef struct st_quicrq_shard_feed_t quicrq_shard_feed_t;
+
+quicrq_shard_feed_t* quicrq_shard_feed_create(quicrq_ctx_t* source_ctx, const uint8_t* url, size_t url_length,
+    quicrq_ctx_t* shard_ctx, size_t ring_size);
+void quicrq_shard_feed_delete(quicrq_shard_feed_t* feed);
+
+/* Shard peers.
+ * The function `quicrq_set_shard_peers` mirrors the sources of a context to all
+ * the peer contexts in the list, which may include the context itself. The local
+ * sources already published are fed at once, and the media posted later by clients
+ * of an origin context are fed when the post arrives. These feeds are deleted by the
+ * library when the source is deleted. When a peer already has a source of the same
+ * URL that a subscriber created before the media was posted, and that source is still
+ * empty, the mirror feeds that source, as an origin does for a post. Mirrors are not
+ * mirrored again. The function is called before the threads start, once the publish
+ * wakeup functions of the peers are set.
+ */
+int quicrq_set_shard_peers(quicrq_ctx_t* qr_ctx, quicrq_ctx_t** peers, size_t nb_peers, size_t ring_size);
+
 quicrq_cnx_ctx_t* quicrq_create_cnx_context(quicrq_ctx_t* qr_ctx, picoquic_cnx_t* cnx);
 quicrq_cnx_ctx_t* quicrq_create_client_cnx(quicrq_ctx_t* qr_ctx,
     const char* sni, struct sockaddr* addr);
@@ -149,6 +375,9 @@ typedef struct st_quicrq_media_object_source_properties_t {
     unsigned int use_real_time_caching : 1;
     uint64_t start_group_id;
     uint64_t start_object_id;
+    /* Size of the fragments in which published objects are cut in the cache,
+     * or 0 to use the fragment size of the context, see quicrq_set_fragment_size. */
+    size_t fragment_size;
 } quicrq_media_object_source_properties_t;
 
 typedef struct st_quicrq_media_object_properties_t {
@@ -168,10 +397,64 @@ int quicrq_publish_object(
     uint64_t group_id,
     uint64_t object_id);
 
+/* Publishing without copy.
+ * `quicrq_publish_object_ex` follows the same rules as `quicrq_publish_object`, but
+ * the cache keeps a reference to the object instead of copying it. The ownership of
+ * the object is transferred to quicrq: the application shall not modify or free it,
+ * and `release_fn` is called once the object is purged from the cache and no longer
+ * used by the connections. If the object cannot be published, the function returns
+ * an error and `release_fn` is called before it returns. The release function is
+ * always called in the thread of the context. It shall not be NULL: if it is, the
+ * function returns -1 and the object remains owned by the application.
+ */
+typedef void (*quicrq_object_release_fn)(void* release_ctx, uint8_t* object, size_t object_length);
+
+int quicrq_publish_object_ex(
+    quicrq_media_object_source_ctx_t* object_source_ctx,
+    uint8_t* object,
+    size_t object_length,
+    quicrq_media_object_properties_t* properties,
+    uint64_t group_id,
+    uint64_t object_id,
+    quicrq_object_release_fn release_fn,
+    void* release_ctx);
+
 void quicrq_publish_object_fin(quicrq_media_object_source_ctx_t* object_source_ctx);
 
 void quicrq_delete_object_source(quicrq_media_object_source_ctx_t* object_source_ctx);
 
+/* Publishing from other threads.
+ * The functions above shall be called in the thread that runs the quicrq context.
+ * Encoders running in other threads can use `quicrq_publish_object_queued` and
+ * `quicrq_publish_object_fin_queued` instead. The object is copied into a lock free
+ * queue attached to the media object source, and published when the thread of the
+ * context calls `quicrq_time_check`. Several threads may publish to the same source,
+ * but the group_id and object_id still have to follow the rules described above in
+ * the order in which the objects are queued. Objects that break the rules are
+ * dropped when the queue is drained, and counted by `quicrq_get_publish_queue_errors`.
+ *
+ * The function set by `quicrq_set_publish_wakeup_fn` is called, in the publishing thread,
+ * when objects are queued while the queue was idle. The application can use it to
+ * wake up its packet loop, for example by calling `picoquic_wake_up_network_thread`.
+ * Without it, queued objects are published at the next time check of the packet loop.
+ * The callback shall be set, and the sources created, before the publishing threads start,
+ * and the publishing threads shall stop before the source is deleted.
+ */
+typedef void (*quicrq_publish_wakeup_fn)(void* publish_wakeup_ctx);
+void quicrq_set_publish_wakeup_fn(quicrq_ctx_t* qr_ctx, quicrq_publish_wakeup_fn publish_wakeup_fn, void* publish_wakeup_ctx);
+
+int quicrq_publish_object_queued(
+    quicrq_media_object_source_ctx_t* object_source_ctx,
+    const uint8_t* object,
+    size_t object_length,
+    quicrq_media_object_properties_t* properties,
+    uint64_t group_id,
+    uint64_t object_id);
+
+int quicrq_publish_object_fin_queued(quicrq_media_object_source_ctx_t* object_source_ctx);
+
+uint64_t quicrq_get_publish_queue_errors(quicrq_media_object_source_ctx_t* object_source_ctx);
+
 /* Management of default sources, used for example by proxies or relays.
  * The callback creates a context for the specified URL, returning the parameters that would be otherwise
  * specified in the function "quicrq_publish_source".
@@ -208,8 +491,24 @@ typedef enum {
     quicrq_media_close
 } quicrq_media_consumer_enum;
 
+/* Fragment views.
+ * By default, objects received in several fragments are copied into a contiguous
+ * buffer before being passed to the consumer. After a call to
+ * `quicrq_object_stream_set_fragment_views`, the consumer instead receives the
+ * fragments of the object in place, as an array of views in the properties. The
+ * views are only valid until the consumer function returns. The `data` argument
+ * then points to the object only if it was received in a single fragment, and is
+ * NULL otherwise; `data_length` is always the length of the object.
+ */
+typedef struct st_quicrq_object_fragment_view_t {
+    const uint8_t* data;
+    size_t data_length;
+} quicrq_object_fragment_view_t;
+
 typedef struct st_quicrq_object_stream_consumer_properties_t {
     uint8_t flags;
+    size_t nb_fragments; /* Only set if fragment views are enabled */
+    const quicrq_object_fragment_view_t* fragments;
 } quicrq_object_stream_consumer_properties_t;
 
 typedef int (*quicrq_object_stream_consumer_fn)(
@@ -233,10 +532,18 @@ typedef enum {
     quicrq_subscribe_order_max
 } quicrq_subscribe_order_enum;
 
+/* Subscribe intents.
+ * The current group intent joins at the live edge: the newest group whose
+ * first object is available in the relay cache, or the group in progress.
+ * The latest complete group intent joins at the newest group whose objects
+ * are all available, trading some latency for an immediate start.
+ */
 typedef enum {
     quicrq_subscribe_intent_current_group = 0,
     quicrq_subscribe_intent_next_group = 1,
-    quicrq_subscribe_intent_start_point = 2
+    quicrq_subscribe_intent_start_point = 2,
+    quicrq_subscribe_intent_latest_complete_group = 3,
+    quicrq_subscribe_intent_max
 } quicrq_subscribe_intent_enum;
 
 typedef struct st_quicrq_subscribe_intent_t {
@@ -250,8 +557,30 @@ quicrq_object_stream_consumer_ctx* quicrq_subscribe_object_stream(quicrq_cnx_ctx
     quicrq_subscribe_order_enum order_required, quicrq_subscribe_intent_t * intent,
     quicrq_object_stream_consumer_fn media_object_consumer_fn, void* media_object_ctx);
 
+/* Subscribe to several media on a single control stream. The media are
+ * received as datagrams, with the same order and intent. One consumer
+ * context is passed for each media in media_object_ctx, and the subscribe
+ * contexts are returned in subscribe_ctx. Each of them can be unsubscribed
+ * separately. Returns 0 on success, -1 on failure.
+ */
+int quicrq_subscribe_object_stream_batch(quicrq_cnx_ctx_t* cnx_ctx, size_t nb_media,
+    const uint8_t** url, const size_t* url_length,
+    quicrq_subscribe_order_enum order_required, quicrq_subscribe_intent_t* intent,
+    quicrq_object_stream_consumer_fn media_object_consumer_fn, void** media_object_ctx,
+    quicrq_object_stream_consumer_ctx** subscribe_ctx);
+
 void quicrq_unsubscribe_object_stream(quicrq_object_stream_consumer_ctx* subscribe_ctx);
 
+void quicrq_object_stream_set_fragment_views(quicrq_object_stream_consumer_ctx* subscribe_ctx, int use_fragment_views);
+
+/* Feedback to the sender of a layered media: only the objects whose flags are
+ * at most max_flags are wanted, and the receiver can absorb at most target_bitrate
+ * bits per second, or any rate if target_bitrate is 0. The sender, or the relay,
+ * skips the higher layers. Not supported for subscriptions made in a batch.
+ * Returns 0 on success, -1 on failure.
+ */
+int quicrq_object_stream_set_feedback(quicrq_object_stream_consumer_ctx* subscribe_ctx, uint8_t max_flags, uint64_t target_bitrate);
+
 int quicrq_cnx_post_media(quicrq_cnx_ctx_t* cnx_ctx, const uint8_t* url, size_t url_length,
     quicrq_transport_mode_enum transport_mode);
 
@@ -312,24 +641,65 @@ int quicrq_cnx_subscribe_pattern_close(quicrq_cnx_ctx_t* cnx_ctx, quicrq_stream_
  * for example when processing the network loop time check callback
  * `picoquic_packet_loop_time_check`. The function returns the time
  * at will the next extra copy should be scheduled, or UINT64_MAX if no
- * such copy is currently planned.
+ * such copy is currently planned. The extra copies share a timer heap
+ * with the cache management deadlines, which are also processed by this
+ * call and by `quicrq_time_check`.
  */
 
 void quicrq_set_extra_repeat(quicrq_ctx_t* qr, int on_nack, int after_delayed);
 void quicrq_set_extra_repeat_delay(quicrq_ctx_t* qr, uint64_t delay_in_microseconds);
 uint64_t quicrq_handle_extra_repeat(quicrq_ctx_t* qr, uint64_t current_time);
 
+/* Memory pools
+ *
+ * The per fragment and per datagram structures are allocated from memory
+ * pools attached to the quicrq context. There is one pool per structure type,
+ * plus a set of pools for the fragment data, organized by size class. Data
+ * larger than the largest size class is allocated directly, and accounted in
+ * the last "oversize" pool, for which the item size is reported as 0.
+ *
+ * Freed items are kept in the pool for reuse, up to the "max free" limit per
+ * pool. Items above that limit are returned to the system, so that memory
+ * is released after the cache is purged. The default limit is set by
+ * QUICRQ_POOL_MAX_FREE_DEFAULT. The function "quicrq_set_pool_max_free"
+ * changes the limit for all pools.
+ *
+ * The function "quicrq_get_pool_stats" returns the statistics of the pool
+ * at the specified index, from 0 to "quicrq_get_nb_pools() - 1". It returns
+ * -1 if the index is out of range.
+ */
+#define QUICRQ_POOL_MAX_FREE_DEFAULT 1024
+
+typedef struct st_quicrq_pool_stats_t {
+    size_t item_size; /* Size of items in pool, or 0 for oversize allocations */
+    uint64_t nb_alloc; /* Number of allocations */
+    uint64_t nb_reused; /* Number of allocations served from the free list */
+    uint64_t nb_released; /* Number of items returned to the system */
+    size_t nb_in_use; /* Number of items currently allocated */
+    size_t max_in_use; /* Highest number of items allocated at the same time */
+    size_t nb_free; /* Number of items currently in the free list */
+} quicrq_pool_stats_t;
+
+size_t quicrq_get_nb_pools();
+int quicrq_get_pool_stats(quicrq_ctx_t* qr, size_t pool_index, quicrq_pool_stats_t* stats);
+void quicrq_set_pool_max_free(quicrq_ctx_t* qr, size_t max_free);
+
 /* Different modes of congestion control:
  * - None(0)
  * - Delay based(1): skip packets if a queue of more than 5 packets is detected.
  * - Group based(2): skip packets at the tail of the group if the new group is already there
- * - Group based + priorities(3): same as group based, but in WARP transport mode, also mark
- *   down the priorities of all but the last group.
+ * - Group based + priorities(3): same as group based, but in WARP and RUSH transport modes,
+ *   also mark down the priorities of the streams of all but the last group, by one level
+ *   per group of age up to 3 levels, so that the newest group preempts the older ones.
  * The combination of group based + priorities will actually degrade performance, unless
  * the receiver selects the option "quicrq_subscribe_in_order_skip_to_group_ahead", which
  * cause receivers to process the next group as soon as reception begins, ignoring the tail
  * of the previous group. If that option is selected, performance is actually better than
  * the simple group based option.
+ * - Rate based(4): same principle as delay based, but the congestion epochs last one
+ *   smoothed RTT of the connection instead of a fixed 50ms, and at the end of each epoch
+ *   the priority threshold is set directly to the lowest priority level whose traffic fits
+ *   in the pacing rate of the connection, instead of moving one level at a time.
  * 
  * The congestion options work for all transport modes (stream, datagram, warp), but in
  * stream mode or datagram mode the "group based" and "Group based + priorities" options
@@ -341,11 +711,104 @@ typedef enum {
     quicrq_congestion_control_delay = 1,
     quicrq_congestion_control_group = 2,
     quicrq_congestion_control_group_p = 3,
+    quicrq_congestion_control_rate = 4,
     quicrq_congestion_control_max
 } quicrq_congestion_control_enum;
 
 void quicrq_enable_congestion_control(quicrq_ctx_t* qr, quicrq_congestion_control_enum congestion_control_mode);
 
+/* Scheduling of datagrams between the media streams sharing a connection:
+ * - Round robin(0): each stream with data ready sends in turn.
+ * - Deficit(1): deficit round robin, weighted by the flags of the objects.
+ *   Each increment of flags above 0x80 halves the share of the stream, so
+ *   for example audio marked 0x80 stays ahead of video marked 0x81 or 0x82.
+ *   When the connection is congested, streams at or above the congestion
+ *   priority threshold are limited to one datagram per round.
+ * The default is round robin.
+ */
+typedef enum {
+    quicrq_datagram_scheduler_round_robin = 0,
+    quicrq_datagram_scheduler_deficit = 1,
+    quicrq_datagram_scheduler_max
+} quicrq_datagram_scheduler_enum;
+
+void quicrq_set_datagram_scheduler(quicrq_ctx_t* qr, quicrq_datagram_scheduler_enum scheduler_mode);
+
+/* Datagram coalescing.
+ * Small objects, such as audio frames, would each use a full datagram.
+ * When coalescing is enabled, the sender packs several fragments, from one
+ * or several media streams of the same connection, in a single datagram.
+ * The fragments are still acknowledged and repaired one by one. Receivers
+ * always accept coalesced datagrams; the option only controls sending.
+ * Coalescing is disabled by default.
+ */
+void quicrq_set_datagram_coalescing(quicrq_ctx_t* qr, int is_enabled);
+
+/* Datagram FEC.
+ * The extra repeat process protects a fragment by sending a duplicate,
+ * which doubles the bandwidth. When FEC is enabled, the sender adds one
+ * parity datagram after each window of "fec_window" fragments of the same
+ * group, containing the XOR of the fragments. A receiver that lost exactly
+ * one fragment of the window rebuilds it when the parity arrives, without
+ * waiting for a repair. A window of 8 fragments costs 12.5% of overhead.
+ * Windows are closed early at the end of a group, or of the media. The
+ * window is capped at QUICRQ_FEC_WINDOW_MAX. The window is negotiated in
+ * the REQUEST and ACCEPT messages: a node that enables FEC asks its peers
+ * to send parity datagrams, and a sender only adds them if the receiver
+ * asked, using the smaller of the two windows. Both ends of a media stream
+ * must thus enable FEC. Setting a window of 0 disables FEC, which is the
+ * default.
+ */
+#define QUICRQ_FEC_WINDOW_MAX 16
+void quicrq_set_datagram_fec(quicrq_ctx_t* qr, size_t fec_window);
+
+/* Compact datagram headers.
+ * By default, each datagram header carries the full media ID, group ID,
+ * object ID, offset, object length, queue delay and flags, which is a large
+ * overhead for small audio objects. When compact headers are enabled, the
+ * node asks the senders of the datagrams that it receives to omit the fields
+ * that are zero or implied, such as the length of single fragment objects,
+ * and to shorten the group ID to one byte when it is close to the previous
+ * groups of the stream. The choice is made for each media stream when the
+ * node sends the subscribe request or accepts a post, so the option should
+ * be set before creating connections. It is off by default.
+ */
+void quicrq_set_compact_datagram_headers(quicrq_ctx_t* qr, int is_enabled);
+
+/* Fragment size.
+ * By default, objects are cut in fragments that fill the space available in
+ * each datagram, so the fragments cached by a relay do not match the space
+ * available on the next hop, and the relay has to cut them again. When a
+ * fragment size is set, the node asks the senders of the datagrams that it
+ * receives to cut the objects in fragments of at most that size, starting at
+ * the beginning of each object, and the local object sources cut the objects
+ * that they publish in the same way. The sender uses the smaller of its own
+ * size and the size asked by the receiver. If all the nodes use the same
+ * size, and the size with the datagram header fits in a datagram, relays
+ * forward the cached fragments without cutting them. As for compact headers,
+ * the size is asked when sending the subscribe request or accepting a post,
+ * so it should be set before creating connections and sources. Setting 0,
+ * the default, disables the option. The size is capped at
+ * QUICRQ_FRAGMENT_SIZE_MAX.
+ */
+#define QUICRQ_FRAGMENT_SIZE_MAX 16383
+void quicrq_set_fragment_size(quicrq_ctx_t* qr, size_t fragment_size);
+
+/* Arrival cursor.
+ * When a relay or origin serves the same media to many subscribers in datagram
+ * mode, each subscriber normally keeps the state of every object it is
+ * sending until that object and all the previous ones are done. When the
+ * arrival cursor is enabled, the subscribers that send every object in order
+ * are attached to a cursor on the arrival order of the cache. They share the
+ * object states that the cache documents once for each fragment, and only keep
+ * their position in the arrival order, since each connection sends at its own
+ * pace. A subscriber that drops an object because of congestion detaches and
+ * falls back to its own object states, and attaches again once it is caught up
+ * with the cache. The option applies to the subscriptions created after it is
+ * set. It is disabled by default.
+ */
+void quicrq_set_arrival_cursor(quicrq_ctx_t* qr, int is_enabled);
+
 #ifdef __cplusplus
 }
 #endif
@@ -19,11 +19,20 @@ extern "C" {
 
 typedef struct st_quicrq_reassembly_context_t {
     picosplay_tree_t object_tree;
+    quicrq_ctx_t* qr_ctx; /* Optional, provides the memory pools */
     uint64_t next_group_id;
     uint64_t next_object_id;
     uint64_t final_group_id;
     uint64_t final_object_id;
     unsigned int is_finished : 1;
+    unsigned int use_fragment_views : 1; /* Do not copy the fragments, see below */
+    size_t in_place_bytes; /* Bytes allocated for the objects reassembled in place */
+    size_t in_place_budget; /* Limit of in_place_bytes, set by quicrq_reassembly_init */
+    /* Views of the fragments of the object passed to the ready function,
+     * only valid during the call. */
+    quicrq_object_fragment_view_t* views;
+    size_t nb_views;
+    size_t views_alloc;
 } quicrq_reassembly_context_t;
 
 typedef enum {
@@ -44,6 +53,9 @@ typedef int (*quicrq_reassembly_object_ready_fn)(
 
 /* Submit a received packet for reassembly.
  * For each reassembled object, the function will call ()
+ * If use_fragment_views is set, objects received in several packets are not copied:
+ * the data passed to the ready function only points to the first packet, and the
+ * fragments of the object are described by the views of the reassembly context.
  */
 int quicrq_reassembly_input(
     quicrq_reassembly_context_t* reassembly_ctx,
@@ -77,6 +89,7 @@ uint64_t quicrq_reassembly_object_id_last(quicrq_reassembly_context_t* reassembl
 uint64_t quicrq_reassembly_get_object_count(quicrq_reassembly_context_t* object_list, uint64_t group_id);
 
 /* Initialize the reassembly context, supposedly zero on input.
+ * The budget of the objects reassembled in place is set to its default value.
  */
 void quicrq_reassembly_init(quicrq_reassembly_context_t* reassembly_ctx);
 
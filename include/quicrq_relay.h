@@ -12,6 +12,26 @@ extern "C" {
     /* Enable the relay */
     int quicrq_enable_relay(quicrq_ctx_t* qr_ctx, const char * sni, const struct sockaddr * addr, quicrq_transport_mode_enum transport_mode);
 
+    /* Enable the relay with several upstream servers.
+     * Subscriptions and posts are spread between the upstreams by hashing the
+     * URL, and over up to nb_cnx_per_upstream connections per upstream (at most 8).
+     * If the connection to an upstream is lost, the subscriptions in progress
+     * are moved to the next available upstream, starting at the next object
+     * expected in the relay cache. The upstream is then avoided for 2 seconds.
+     */
+    int quicrq_enable_relay_ex(quicrq_ctx_t* qr_ctx, size_t nb_upstreams, const char** sni, const struct sockaddr** addr,
+        size_t nb_cnx_per_upstream, quicrq_transport_mode_enum transport_mode);
+
+    /* Keep the upstream connections warm. The connections to all the upstreams
+     * are opened when this is enabled, instead of waiting for the first subscribe
+     * or post, and opened again when they close, after the retry delay if the
+     * upstream was lost. If the quic context was created with a ticket store,
+     * the new connections resume the previous sessions, and the first requests
+     * are sent as 0-RTT data. Must be called after enabling the relay.
+     * Returns 0 on success, -1 if the relay is not enabled.
+     */
+    int quicrq_relay_set_warm_upstreams(quicrq_ctx_t* qr_ctx, int is_enabled);
+
     /* Enable origin */
     int quicrq_enable_origin(quicrq_ctx_t* qr_ctx, quicrq_transport_mode_enum transport_mode);
 
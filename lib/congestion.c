@@ -93,6 +93,199 @@ int quicrq_congestion_check_per_cnx(quicrq_cnx_ctx_t* cnx_ctx, uint8_t flags, in
     }
     return should_skip;
 }
+/* Handle rate based congestion.
+ * This follows the same principle as the delay based congestion, with two changes.
+ *
+ * The epochs last one smoothed RTT of the connection, instead of a fixed delay,
+ * within the bounds QUICRQ_CONGESTION_EPOCH_MIN and QUICRQ_CONGESTION_EPOCH_MAX,
+ * so that the reaction speed matches the path.
+ *
+ * During each epoch, we count the bytes offered at each priority level, from
+ * 0x80 (or lower) to 0x80 + QUICRQ_CONGESTION_RATE_LEVELS - 1 (or higher). At
+ * the end of an epoch in which backlog was reported, we compute the number of
+ * bytes that the pacing rate of the connection allows during the epoch, and
+ * set the threshold directly to the first level that does not fit, instead of
+ * moving one level per epoch. The most urgent level is never skipped. If all
+ * levels fit, the least urgent level is skipped until the backlog is drained.
+ * If there is no backlog and all levels fit, the congestion ends.
+ */
+#define QUICRQ_CONGESTION_EPOCH_DEFAULT 50000
+#define QUICRQ_CONGESTION_EPOCH_MIN 10000
+#define QUICRQ_CONGESTION_EPOCH_MAX 1000000
+
+static int quicrq_congestion_rate_level(uint8_t flags)
+{
+    int level = 0;
+
+    if (flags > 0x80) {
+        level = flags - 0x80;
+        if (level >= QUICRQ_CONGESTION_RATE_LEVELS) {
+            level = QUICRQ_CONGESTION_RATE_LEVELS - 1;
+        }
+    }
+    return level;
+}
+
+void quicrq_congestion_rate_epoch(quicrq_cnx_congestion_state_t* congestion, uint64_t rtt, uint64_t pacing_rate, uint64_t current_time)
+{
+    uint64_t epoch_duration = current_time - congestion->epoch_start_time;
+
+    if (congestion->has_backlog || congestion->is_congested) {
+        uint8_t max_threshold = (congestion->max_flags > 0x80) ? congestion->max_flags : 0x81;
+        uint8_t priority_threshold = max_threshold;
+        int all_levels_fit = 0;
+
+        if (pacing_rate > 0 && epoch_duration > 0) {
+            uint64_t budget = (pacing_rate * epoch_duration) / 1000000;
+            uint64_t offered = congestion->bytes_per_level[0];
+            int level = 1;
+
+            while (level < QUICRQ_CONGESTION_RATE_LEVELS) {
+                offered += congestion->bytes_per_level[level];
+                if (offered > budget) {
+                    break;
+                }
+                level++;
+            }
+            if (level >= QUICRQ_CONGESTION_RATE_LEVELS) {
+                all_levels_fit = 1;
+            }
+            else if (0x80 + level < priority_threshold) {
+                priority_threshold = (uint8_t)(0x80 + level);
+            }
+        }
+        if (all_levels_fit && !congestion->has_backlog) {
+            congestion->is_congested = 0;
+        }
+        else {
+            congestion->is_congested = 1;
+        }
+        congestion->old_priority_threshold = congestion->priority_threshold;
+        congestion->priority_threshold = priority_threshold;
+    }
+    /* Reset the values to prepare the next epoch */
+    congestion->has_backlog = 0;
+    memset(congestion->bytes_per_level, 0, sizeof(congestion->bytes_per_level));
+    if (rtt == 0) {
+        rtt = QUICRQ_CONGESTION_EPOCH_DEFAULT;
+    }
+    else if (rtt < QUICRQ_CONGESTION_EPOCH_MIN) {
+        rtt = QUICRQ_CONGESTION_EPOCH_MIN;
+    }
+    else if (rtt > QUICRQ_CONGESTION_EPOCH_MAX) {
+        rtt = QUICRQ_CONGESTION_EPOCH_MAX;
+    }
+    congestion->epoch_start_time = current_time;
+    congestion->congestion_check_time = current_time + rtt;
+}
+
+int quicrq_congestion_check_rate_per_cnx(quicrq_cnx_ctx_t* cnx_ctx, uint8_t flags, uint64_t length, int has_backlog, uint64_t current_time)
+{
+    int should_skip = 0;
+    quicrq_cnx_congestion_state_t* congestion = &cnx_ctx->congestion;
+
+    /* Update the 'worst flag for the connection' */
+    if (flags > congestion->max_flags && flags != 0xff) {
+        congestion->max_flags = flags;
+    }
+    congestion->has_backlog |= has_backlog;
+    congestion->bytes_per_level[quicrq_congestion_rate_level(flags)] += length;
+
+    if (congestion->congestion_check_time == 0) {
+        /* First call on this connection, start the first epoch */
+        congestion->epoch_start_time = current_time;
+        congestion->congestion_check_time = current_time + QUICRQ_CONGESTION_EPOCH_DEFAULT;
+    }
+    else if (current_time >= congestion->congestion_check_time || (has_backlog && !congestion->is_congested)) {
+        uint64_t rtt = 0;
+        uint64_t pacing_rate = 0;
+
+        if (cnx_ctx->cnx != NULL) {
+            rtt = picoquic_get_rtt(cnx_ctx->cnx);
+            pacing_rate = picoquic_get_pacing_rate(cnx_ctx->cnx);
+        }
+        quicrq_congestion_rate_epoch(congestion, rtt, pacing_rate, current_time);
+    }
+    /* Evaluate whether this packet should be skipped */
+    if (congestion->is_congested && flags >= congestion->priority_threshold) {
+        should_skip = 1;
+    }
+    return should_skip;
+}
+
+/* Handle the feedback of the receiver of a media.
+ *
+ * The receiver may ask for a maximum value of the object flags, i.e., the
+ * highest layer of a layered media, and for a target bitrate. Objects with
+ * flags above the maximum are always skipped. If a target bitrate is set,
+ * we count the bytes offered per layer during epochs of QUICRQ_FEEDBACK_EPOCH,
+ * as in the rate based congestion control, and at the end of each epoch
+ * set the threshold to the first layer that does not fit in the target.
+ * The first object of a group, the most urgent layer, and the objects already
+ * marked skipped upstream (flags 0xff) are never skipped.
+ */
+#define QUICRQ_FEEDBACK_EPOCH 100000
+
+int quicrq_feedback_should_skip(quicrq_stream_ctx_t* stream_ctx, uint64_t object_id, uint8_t flags, uint64_t length, uint64_t current_time)
+{
+    int should_skip = 0;
+    quicrq_stream_feedback_t* feedback = &stream_ctx->feedback;
+
+    if (stream_ctx->is_feedback_set && object_id != 0 && flags != 0xff) {
+        if (flags > feedback->max_flags) {
+            should_skip = 1;
+        }
+        else if (feedback->target_bitrate > 0) {
+            feedback->bytes_per_level[quicrq_congestion_rate_level(flags)] += length;
+            if (current_time >= feedback->epoch_start_time + QUICRQ_FEEDBACK_EPOCH) {
+                uint64_t budget = (feedback->target_bitrate * (current_time - feedback->epoch_start_time)) / 8000000;
+                uint64_t offered = feedback->bytes_per_level[0];
+                int level = 1;
+
+                while (level < QUICRQ_CONGESTION_RATE_LEVELS) {
+                    offered += feedback->bytes_per_level[level];
+                    if (offered > budget) {
+                        break;
+                    }
+                    level++;
+                }
+                feedback->rate_threshold = (level < QUICRQ_CONGESTION_RATE_LEVELS) ? (uint8_t)(0x80 + level) : 0;
+                memset(feedback->bytes_per_level, 0, sizeof(feedback->bytes_per_level));
+                feedback->epoch_start_time = current_time;
+            }
+            if (feedback->rate_threshold != 0 && flags >= feedback->rate_threshold) {
+                should_skip = 1;
+            }
+        }
+    }
+    return should_skip;
+}
+
+/* Set the feedback received from the peer on a sender stream.
+ * The rate threshold is only computed at the end of the first epoch.
+ * If the stream is subscribed to a source, the running counts of the source
+ * are updated; the aggregate is forwarded by quicrq_source_feedback_update.
+ */
+void quicrq_feedback_set(quicrq_stream_ctx_t* stream_ctx, uint8_t max_flags, uint64_t target_bitrate, uint64_t current_time)
+{
+    quicrq_stream_feedback_t* feedback = &stream_ctx->feedback;
+
+    if (stream_ctx->media_source != NULL) {
+        quicrq_source_feedback_count(stream_ctx->media_source, stream_ctx, 0);
+    }
+    if (!stream_ctx->is_feedback_set || feedback->target_bitrate != target_bitrate) {
+        memset(feedback->bytes_per_level, 0, sizeof(feedback->bytes_per_level));
+        feedback->rate_threshold = 0;
+        feedback->epoch_start_time = current_time;
+    }
+    feedback->max_flags = max_flags;
+    feedback->target_bitrate = target_bitrate;
+    stream_ctx->is_feedback_set = 1;
+    if (stream_ctx->media_source != NULL) {
+        quicrq_source_feedback_count(stream_ctx->media_source, stream_ctx, 1);
+    }
+}
+
 /* Handle Group Based congestion:
  * 
  * When congestion is experienced, group based congestion drops the packets
@@ -168,7 +361,12 @@ int quicrq_evaluate_stream_congestion(quicrq_fragment_publisher_context_t* media
     int should_skip = 0;
     int has_backlog = 0;
 
-    switch (media_ctx->congestion_control_mode) {
+    if (media_ctx->current_offset == 0 && media_ctx->length_sent == 0 &&
+        quicrq_feedback_should_skip(media_ctx->stream_ctx, media_ctx->current_object_id,
+            media_ctx->current_fragment->flags, media_ctx->current_fragment->object_length, current_time)) {
+        should_skip = 1;
+    }
+    else switch (media_ctx->congestion_control_mode) {
     case quicrq_congestion_control_none:
         break;
     case quicrq_congestion_control_group:
@@ -181,6 +379,7 @@ int quicrq_evaluate_stream_congestion(quicrq_fragment_publisher_context_t* media
         }
         break;
     case quicrq_congestion_control_delay:
+    case quicrq_congestion_control_rate:
     default:
         if (media_ctx->current_offset > 0 || media_ctx->length_sent > 0) {
             has_backlog = media_ctx->has_backlog;
@@ -196,8 +395,15 @@ int quicrq_evaluate_stream_congestion(quicrq_fragment_publisher_context_t* media
             media_ctx->has_backlog = 0;
         }
         /* Check the cache time, compare to current time, determine congestion */
-        should_skip = quicrq_congestion_check_per_cnx(media_ctx->stream_ctx->cnx_ctx,
-            media_ctx->current_fragment->flags, has_backlog, current_time);
+        if (media_ctx->congestion_control_mode == quicrq_congestion_control_rate) {
+            should_skip = quicrq_congestion_check_rate_per_cnx(media_ctx->stream_ctx->cnx_ctx,
+                media_ctx->current_fragment->flags, (media_ctx->current_offset > 0 || media_ctx->length_sent > 0) ? 0 :
+                media_ctx->current_fragment->object_length, has_backlog, current_time);
+        }
+        else {
+            should_skip = quicrq_congestion_check_per_cnx(media_ctx->stream_ctx->cnx_ctx,
+                media_ctx->current_fragment->flags, has_backlog, current_time);
+        }
         break;
     }
     return should_skip;
@@ -215,6 +421,11 @@ int quicrq_evaluate_warp_congestion(quicrq_uni_stream_ctx_t* uni_stream_ctx, qui
         /* This object was marked skipped at a previous relay */
         should_skip = 1;
     }
+    else if (quicrq_feedback_should_skip(uni_stream_ctx->control_stream_ctx, uni_stream_ctx->current_object_id,
+        uni_stream_ctx->current_object_flags, next_object_size, current_time)) {
+        /* The receiver asked for a lower layer or a lower bitrate */
+        should_skip = 1;
+    }
     else {
         switch (media_ctx->congestion_control_mode) {
         case quicrq_congestion_control_none:
@@ -225,6 +436,7 @@ int quicrq_evaluate_warp_congestion(quicrq_uni_stream_ctx_t* uni_stream_ctx, qui
             should_skip = quicrq_compute_group_mode_congestion(media_ctx, uni_stream_ctx->current_group_id, uni_stream_ctx->current_object_id);
             break;
         case quicrq_congestion_control_delay:
+        case quicrq_congestion_control_rate:
         default:
             /* Check whether there is ongoing congestion */
             if (uni_stream_ctx->current_group_id < cache_ctx->next_group_id ||
@@ -233,8 +445,14 @@ int quicrq_evaluate_warp_congestion(quicrq_uni_stream_ctx_t* uni_stream_ctx, qui
                 has_backlog = 1;
             } 
             if (uni_stream_ctx->current_object_id > 0 && flags != 0xff) {
-                should_skip = quicrq_congestion_check_per_cnx(uni_stream_ctx->control_stream_ctx->cnx_ctx,
-                    flags, has_backlog, current_time);
+                if (media_ctx->congestion_control_mode == quicrq_congestion_control_rate) {
+                    should_skip = quicrq_congestion_check_rate_per_cnx(uni_stream_ctx->control_stream_ctx->cnx_ctx,
+                        flags, next_object_size, has_backlog, current_time);
+                }
+                else {
+                    should_skip = quicrq_congestion_check_per_cnx(uni_stream_ctx->control_stream_ctx->cnx_ctx,
+                        flags, has_backlog, current_time);
+                }
             }
             break;
         }
@@ -252,7 +470,11 @@ int quicrq_evaluate_datagram_congestion(quicrq_stream_ctx_t * stream_ctx, quicrq
 
     if (media_ctx->current_fragment->object_id != 0 &&
         media_ctx->current_fragment->data_length > 0) {
-        switch (media_ctx->congestion_control_mode) {
+        if (quicrq_feedback_should_skip(stream_ctx, media_ctx->current_fragment->object_id,
+            media_ctx->current_fragment->flags, media_ctx->current_fragment->object_length, current_time)) {
+            should_skip = 1;
+        }
+        else switch (media_ctx->congestion_control_mode) {
         case quicrq_congestion_control_none:
             break;
         case quicrq_congestion_control_group:
@@ -261,6 +483,11 @@ int quicrq_evaluate_datagram_congestion(quicrq_stream_ctx_t * stream_ctx, quicrq
             should_skip = quicrq_compute_group_mode_congestion(media_ctx, media_ctx->current_fragment->group_id,
                 media_ctx->current_fragment->object_id);
             break;
+        case quicrq_congestion_control_rate:
+            has_backlog = (int64_t)(current_time - media_ctx->current_fragment->cache_time) > delta_t_max;
+            should_skip = quicrq_congestion_check_rate_per_cnx(stream_ctx->cnx_ctx,
+                media_ctx->current_fragment->flags, media_ctx->current_fragment->object_length, has_backlog, current_time);
+            break;
         case quicrq_congestion_control_delay:
         default:
             has_backlog = (int64_t)(current_time - media_ctx->current_fragment->cache_time) > delta_t_max;
@@ -272,3 +499,152 @@ int quicrq_evaluate_datagram_congestion(quicrq_stream_ctx_t * stream_ctx, quicrq
 
     return should_skip;
 }
+
+/* Scheduling of datagrams between the media streams of a connection.
+ *
+ * The scheduler visits the streams of the connection in a circular order,
+ * starting at the cursor left by the previous call, so that the first
+ * streams of the list cannot take all the datagram slots.
+ *
+ * In round robin mode, the cursor moves to the stream after the one that
+ * just sent.
+ *
+ * In deficit mode, each stream receives a credit of QUICRQ_DATAGRAM_QUANTUM
+ * at each round, and each datagram sent costs 1 << (flags - 0x80), capped
+ * to QUICRQ_DATAGRAM_QUANTUM. A stream keeps sending until its credit is
+ * exhausted. When all the active streams have exhausted their credit, all
+ * of them are replenished. If the connection is congested, the streams
+ * whose flags are at or above the priority threshold of the congestion
+ * control only receive the credit of one datagram per round, which
+ * favors the most urgent streams while the threshold logic drops the
+ * least urgent objects.
+ */
+#define QUICRQ_DATAGRAM_QUANTUM 16
+
+static int quicrq_datagram_scheduler_is_eligible(quicrq_stream_ctx_t* stream_ctx)
+{
+    return (stream_ctx->transport_mode == quicrq_transport_mode_datagram && stream_ctx->is_sender &&
+        stream_ctx->is_active_datagram && stream_ctx->media_id < UINT64_MAX);
+}
+
+static int64_t quicrq_datagram_scheduler_cost(uint8_t flags)
+{
+    int64_t cost = 1;
+
+    if (flags > 0x80) {
+        int shift = flags - 0x80;
+        cost = (shift >= 4) ? QUICRQ_DATAGRAM_QUANTUM : ((int64_t)1 << shift);
+    }
+    return cost;
+}
+
+static quicrq_stream_ctx_t* quicrq_datagram_scheduler_wrap(quicrq_cnx_ctx_t* cnx_ctx, quicrq_stream_ctx_t* stream_ctx)
+{
+    return (stream_ctx->next_stream == NULL) ? cnx_ctx->first_stream : stream_ctx->next_stream;
+}
+
+static void quicrq_datagram_scheduler_replenish(quicrq_cnx_ctx_t* cnx_ctx)
+{
+    quicrq_stream_ctx_t* stream_ctx = cnx_ctx->first_stream;
+
+    while (stream_ctx != NULL) {
+        if (quicrq_datagram_scheduler_is_eligible(stream_ctx)) {
+            int64_t quantum = QUICRQ_DATAGRAM_QUANTUM;
+            if (cnx_ctx->congestion.is_congested && stream_ctx->datagram_flags >= cnx_ctx->congestion.priority_threshold) {
+                quantum = quicrq_datagram_scheduler_cost(stream_ctx->datagram_flags);
+            }
+            stream_ctx->datagram_deficit += quantum;
+            if (stream_ctx->datagram_deficit > QUICRQ_DATAGRAM_QUANTUM) {
+                stream_ctx->datagram_deficit = QUICRQ_DATAGRAM_QUANTUM;
+            }
+        }
+        stream_ctx = stream_ctx->next_stream;
+    }
+    cnx_ctx->datagram_scheduler.nb_waiting = 0;
+    cnx_ctx->datagram_scheduler.is_replenished = 1;
+}
+
+/* Find the next stream allowed to send, starting from the specified stream
+ * or from the one after it. Returns NULL after a full round without finding one.
+ */
+static quicrq_stream_ctx_t* quicrq_datagram_scheduler_find(quicrq_cnx_ctx_t* cnx_ctx, quicrq_stream_ctx_t* stream_ctx, int should_advance)
+{
+    quicrq_datagram_scheduler_t* scheduler = &cnx_ctx->datagram_scheduler;
+    int is_deficit = (cnx_ctx->qr_ctx->datagram_scheduler_mode == quicrq_datagram_scheduler_deficit);
+    quicrq_stream_ctx_t* found = NULL;
+
+    while (stream_ctx != NULL && found == NULL) {
+        if (should_advance) {
+            stream_ctx = quicrq_datagram_scheduler_wrap(cnx_ctx, stream_ctx);
+            if (stream_ctx == scheduler->scan_start) {
+                if (is_deficit && !scheduler->is_replenished && scheduler->nb_waiting > 0) {
+                    /* All the active streams are out of credit, start a new round */
+                    quicrq_datagram_scheduler_replenish(cnx_ctx);
+                }
+                else {
+                    break;
+                }
+            }
+        }
+        should_advance = 1;
+        if (quicrq_datagram_scheduler_is_eligible(stream_ctx)) {
+            if (is_deficit && stream_ctx->datagram_deficit <= 0) {
+                scheduler->nb_waiting++;
+            }
+            else {
+                found = stream_ctx;
+            }
+        }
+    }
+    return found;
+}
+
+quicrq_stream_ctx_t* quicrq_datagram_scheduler_first(quicrq_cnx_ctx_t* cnx_ctx)
+{
+    quicrq_datagram_scheduler_t* scheduler = &cnx_ctx->datagram_scheduler;
+
+    if (scheduler->next_stream == NULL) {
+        scheduler->next_stream = cnx_ctx->first_stream;
+    }
+    scheduler->scan_start = scheduler->next_stream;
+    scheduler->nb_waiting = 0;
+    scheduler->is_replenished = 0;
+
+    return quicrq_datagram_scheduler_find(cnx_ctx, scheduler->scan_start, 0);
+}
+
+/* Update the scheduler after a stream was offered the chance to send.
+ * Returns the next stream to try, or NULL if a datagram was sent or if
+ * no stream is ready.
+ */
+quicrq_stream_ctx_t* quicrq_datagram_scheduler_next(quicrq_cnx_ctx_t* cnx_ctx, quicrq_stream_ctx_t* stream_ctx, int media_was_sent)
+{
+    quicrq_datagram_scheduler_t* scheduler = &cnx_ctx->datagram_scheduler;
+    quicrq_stream_ctx_t* next_stream = NULL;
+
+    if (media_was_sent) {
+        if (cnx_ctx->qr_ctx->datagram_scheduler_mode == quicrq_datagram_scheduler_deficit) {
+            stream_ctx->datagram_deficit -= quicrq_datagram_scheduler_cost(stream_ctx->datagram_flags);
+            scheduler->next_stream = (stream_ctx->datagram_deficit > 0) ? stream_ctx :
+                quicrq_datagram_scheduler_wrap(cnx_ctx, stream_ctx);
+        }
+        else {
+            scheduler->next_stream = quicrq_datagram_scheduler_wrap(cnx_ctx, stream_ctx);
+        }
+    }
+    else {
+        /* Nothing to send on this stream until it is woken up again */
+        stream_ctx->is_active_datagram = 0;
+        stream_ctx->datagram_deficit = 0;
+        next_stream = quicrq_datagram_scheduler_find(cnx_ctx, stream_ctx, 1);
+    }
+    return next_stream;
+}
+
+/* Make sure that the cursor does not point to a deleted stream */
+void quicrq_datagram_scheduler_remove(quicrq_cnx_ctx_t* cnx_ctx, quicrq_stream_ctx_t* stream_ctx)
+{
+    if (cnx_ctx->datagram_scheduler.next_stream == stream_ctx) {
+        cnx_ctx->datagram_scheduler.next_stream = stream_ctx->next_stream;
+    }
+}
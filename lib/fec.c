@@ -0,0 +1,281 @@
+/* Parity based FEC for media sent as datagrams */
+#include <stdlib.h>
+#include <string.h>
+#include "picoquic_utils.h"
+#include "quicrq.h"
+#include "quicrq_internal.h"
+
+/* The sender computes the XOR of the records of the fragments sent on a
+ * stream, and sends it in a FEC datagram when the window is full, when the
+ * group changes, or when the media ends. The receiver keeps copies of the
+ * records of the last fragments received. When a FEC datagram arrives, and
+ * exactly one of the fragments of its window is missing, the XOR of the
+ * parity and of the other records is the record of the missing fragment.
+ * Recovered fragments are passed to the consumer as if they had been
+ * received. The sender is not informed, and may still repair the fragment
+ * after it is declared lost; the receiver handles the duplicate.
+ */
+
+int quicrq_datagram_is_fec(const uint8_t* bytes, size_t length)
+{
+    return (length >= QUICRQ_DATAGRAM_FEC_MARKER_LENGTH && bytes[0] == 0x40 && bytes[1] == 1);
+}
+
+uint8_t* quicrq_fec_parity_encode(uint8_t* bytes, uint8_t* bytes_max, uint64_t media_id, const quicrq_fec_encoder_t* encoder)
+{
+    if (bytes + QUICRQ_DATAGRAM_FEC_MARKER_LENGTH > bytes_max) {
+        bytes = NULL;
+    }
+    else {
+        *bytes++ = 0x40;
+        *bytes++ = 1;
+        if ((bytes = picoquic_frames_varint_encode(bytes, bytes_max, media_id)) != NULL &&
+            (bytes = picoquic_frames_varint_encode(bytes, bytes_max, encoder->group_id)) != NULL) {
+            bytes = picoquic_frames_varint_encode(bytes, bytes_max, encoder->nb_fragments);
+            for (size_t i = 0; bytes != NULL && i < encoder->nb_fragments; i++) {
+                if ((bytes = picoquic_frames_varint_encode(bytes, bytes_max, encoder->object_id[i])) != NULL) {
+                    bytes = picoquic_frames_varint_encode(bytes, bytes_max, encoder->object_offset[i]);
+                }
+            }
+            if (bytes != NULL &&
+                (bytes = picoquic_frames_varint_encode(bytes, bytes_max, encoder->length_xor)) != NULL) {
+                if (bytes + encoder->parity_length > bytes_max) {
+                    bytes = NULL;
+                }
+                else {
+                    memcpy(bytes, encoder->parity, encoder->parity_length);
+                    bytes += encoder->parity_length;
+                }
+            }
+        }
+    }
+    return bytes;
+}
+
+/* Decode a FEC datagram. The parity extends to the end of the datagram. */
+const uint8_t* quicrq_fec_parity_decode(const uint8_t* bytes, const uint8_t* bytes_max, quicrq_fec_parity_t* parity)
+{
+    uint64_t nb_fragments = 0;
+
+    if (!quicrq_datagram_is_fec(bytes, bytes_max - bytes)) {
+        bytes = NULL;
+    }
+    else if ((bytes = picoquic_frames_varint_decode(bytes + QUICRQ_DATAGRAM_FEC_MARKER_LENGTH, bytes_max, &parity->media_id)) != NULL &&
+        (bytes = picoquic_frames_varint_decode(bytes, bytes_max, &parity->group_id)) != NULL &&
+        (bytes = picoquic_frames_varint_decode(bytes, bytes_max, &nb_fragments)) != NULL) {
+        if (nb_fragments == 0 || nb_fragments > QUICRQ_FEC_WINDOW_MAX) {
+            bytes = NULL;
+        }
+        else {
+            parity->nb_fragments = (size_t)nb_fragments;
+            for (size_t i = 0; bytes != NULL && i < parity->nb_fragments; i++) {
+                if ((bytes = picoquic_frames_varint_decode(bytes, bytes_max, &parity->object_id[i])) != NULL) {
+                    bytes = picoquic_frames_varint_decode(bytes, bytes_max, &parity->object_offset[i]);
+                }
+            }
+            if (bytes != NULL &&
+                (bytes = picoquic_frames_varint_decode(bytes, bytes_max, &parity->length_xor)) != NULL) {
+                parity->parity = bytes;
+                parity->parity_length = bytes_max - bytes;
+                if (parity->parity_length > QUICRQ_FEC_RECORD_MAX) {
+                    bytes = NULL;
+                }
+                else {
+                    bytes = bytes_max;
+                }
+            }
+        }
+    }
+    return bytes;
+}
+
+/* Encode the record of a fragment. Returns the record length, or 0 if the
+ * fragment does not fit in a record. */
+static size_t quicrq_fec_record_encode(uint8_t* record, uint64_t media_id, uint64_t group_id, uint64_t object_id,
+    uint64_t object_offset, uint8_t flags, uint64_t nb_objects_previous_group, uint64_t object_length,
+    const uint8_t* data, size_t data_length)
+{
+    size_t length = 0;
+    uint8_t* bytes = quicrq_datagram_header_encode(record, record + QUICRQ_FEC_RECORD_MAX, media_id, group_id, object_id,
+        object_offset, 0, flags, nb_objects_previous_group, object_length);
+
+    if (bytes != NULL && data_length <= (size_t)(record + QUICRQ_FEC_RECORD_MAX - bytes)) {
+        if (data_length > 0) {
+            memcpy(bytes, data, data_length);
+        }
+        length = (bytes - record) + data_length;
+    }
+    return length;
+}
+
+/* Queue the FEC datagram of the current window, and start a new window */
+int quicrq_fec_encoder_flush(quicrq_stream_ctx_t* stream_ctx)
+{
+    int ret = 0;
+    quicrq_fec_encoder_t* encoder = stream_ctx->fec_encoder;
+
+    if (encoder != NULL && encoder->nb_fragments > 0) {
+        uint8_t datagram[PICOQUIC_DATAGRAM_QUEUE_MAX_LENGTH];
+        uint8_t* bytes = quicrq_fec_parity_encode(datagram, datagram + sizeof(datagram), stream_ctx->media_id, encoder);
+
+        if (bytes == NULL || stream_ctx->cnx_ctx->cnx == NULL) {
+            ret = -1;
+        }
+        else if ((ret = picoquic_queue_datagram_frame(stream_ctx->cnx_ctx->cnx, bytes - datagram, datagram)) == 0) {
+            encoder->nb_parity_sent++;
+        }
+        encoder->nb_fragments = 0;
+        encoder->length_xor = 0;
+        memset(encoder->parity, 0, encoder->parity_length);
+        encoder->parity_length = 0;
+    }
+    return ret;
+}
+
+/* Window of the FEC sent on a media stream. The sender only adds parity
+ * datagrams if the receiver asked for them, and uses the smaller of the
+ * window of the context and the one asked by the receiver.
+ */
+size_t quicrq_fec_window(quicrq_stream_ctx_t* stream_ctx)
+{
+    size_t fec_window = stream_ctx->cnx_ctx->qr_ctx->datagram_fec_window;
+
+    if (stream_ctx->fec_window < fec_window) {
+        fec_window = stream_ctx->fec_window;
+    }
+    return fec_window;
+}
+
+/* Add a fragment sent on the stream to the protected window */
+int quicrq_fec_encoder_add(quicrq_stream_ctx_t* stream_ctx, uint64_t group_id, uint64_t object_id, uint64_t object_offset,
+    uint8_t flags, uint64_t nb_objects_previous_group, uint64_t object_length, const uint8_t* data, size_t data_length)
+{
+    int ret = 0;
+    quicrq_fec_encoder_t* encoder = stream_ctx->fec_encoder;
+    size_t fec_window = quicrq_fec_window(stream_ctx);
+    uint8_t record[QUICRQ_FEC_RECORD_MAX];
+    size_t record_length = 0;
+
+    if (encoder == NULL) {
+        encoder = (quicrq_fec_encoder_t*)malloc(sizeof(quicrq_fec_encoder_t));
+        if (encoder == NULL) {
+            ret = -1;
+        }
+        else {
+            memset(encoder, 0, sizeof(quicrq_fec_encoder_t));
+            stream_ctx->fec_encoder = encoder;
+        }
+    }
+    else if (encoder->nb_fragments > 0 && encoder->group_id != group_id) {
+        /* Windows do not span groups, so that receivers joining at a group boundary can use them */
+        ret = quicrq_fec_encoder_flush(stream_ctx);
+    }
+
+    if (ret == 0 && (record_length = quicrq_fec_record_encode(record, stream_ctx->media_id, group_id, object_id, object_offset,
+        flags, nb_objects_previous_group, object_length, data, data_length)) > 0) {
+        encoder->group_id = group_id;
+        encoder->object_id[encoder->nb_fragments] = object_id;
+        encoder->object_offset[encoder->nb_fragments] = object_offset;
+        encoder->nb_fragments++;
+        encoder->length_xor ^= record_length;
+        for (size_t i = 0; i < record_length; i++) {
+            encoder->parity[i] ^= record[i];
+        }
+        if (record_length > encoder->parity_length) {
+            encoder->parity_length = record_length;
+        }
+        if (encoder->nb_fragments >= fec_window || encoder->nb_fragments >= QUICRQ_FEC_WINDOW_MAX) {
+            ret = quicrq_fec_encoder_flush(stream_ctx);
+        }
+    }
+    return ret;
+}
+
+/* Keep a copy of the record of a received fragment. The ring holds two windows,
+ * so that fragments of the next window can arrive before the parity. */
+void quicrq_fec_decoder_add(quicrq_fec_decoder_t* decoder, uint64_t media_id, uint64_t group_id, uint64_t object_id,
+    uint64_t object_offset, uint8_t flags, uint64_t nb_objects_previous_group, uint64_t object_length,
+    const uint8_t* data, size_t data_length)
+{
+    quicrq_fec_record_t* fec_record = &decoder->records[decoder->next_record];
+
+    fec_record->length = quicrq_fec_record_encode(fec_record->bytes, media_id, group_id, object_id, object_offset,
+        flags, nb_objects_previous_group, object_length, data, data_length);
+    if (fec_record->length > 0) {
+        fec_record->group_id = group_id;
+        fec_record->object_id = object_id;
+        fec_record->object_offset = object_offset;
+        decoder->next_record = (decoder->next_record + 1) % QUICRQ_FEC_DECODER_RECORDS;
+        if (decoder->nb_records < QUICRQ_FEC_DECODER_RECORDS) {
+            decoder->nb_records++;
+        }
+    }
+}
+
+static quicrq_fec_record_t* quicrq_fec_decoder_find(quicrq_fec_decoder_t* decoder, uint64_t group_id, uint64_t object_id, uint64_t object_offset)
+{
+    quicrq_fec_record_t* found = NULL;
+
+    for (size_t i = 0; found == NULL && i < decoder->nb_records; i++) {
+        quicrq_fec_record_t* fec_record = &decoder->records[i];
+        if (fec_record->length > 0 && fec_record->group_id == group_id &&
+            fec_record->object_id == object_id && fec_record->object_offset == object_offset) {
+            found = fec_record;
+        }
+    }
+    return found;
+}
+
+/* Rebuild the record of the missing fragment of a window. Returns 1 if a record
+ * was recovered, 0 if no fragment or more than one is missing, or if the parity
+ * is inconsistent.
+ */
+int quicrq_fec_decoder_recover(quicrq_fec_decoder_t* decoder, const quicrq_fec_parity_t* parity, uint8_t* record, size_t* record_length)
+{
+    int is_recovered = 0;
+    size_t nb_missing = 0;
+    size_t missing_index = 0;
+    uint64_t length = parity->length_xor;
+
+    memcpy(record, parity->parity, parity->parity_length);
+    for (size_t i = 0; nb_missing <= 1 && i < parity->nb_fragments; i++) {
+        quicrq_fec_record_t* fec_record = quicrq_fec_decoder_find(decoder, parity->group_id, parity->object_id[i], parity->object_offset[i]);
+        if (fec_record == NULL) {
+            missing_index = i;
+            nb_missing++;
+        }
+        else if (fec_record->length > parity->parity_length) {
+            /* The copy does not match the fragment that was protected */
+            nb_missing = 2;
+        }
+        else {
+            length ^= fec_record->length;
+            for (size_t j = 0; j < fec_record->length; j++) {
+                record[j] ^= fec_record->bytes[j];
+            }
+        }
+    }
+    if (nb_missing == 1 && length > 0 && length <= parity->parity_length) {
+        /* Only deliver the record if its header is the one of the missing fragment */
+        uint64_t media_id;
+        uint64_t group_id;
+        uint64_t object_id;
+        uint64_t object_offset;
+        uint64_t queue_delay;
+        uint8_t flags;
+        uint64_t nb_objects_previous_group;
+        uint64_t object_length;
+        const uint8_t* data = NULL;
+        size_t data_length = 0;
+
+        if (quicrq_datagram_fragment_decode(record, record + length, 0, &media_id, &group_id, &object_id, &object_offset,
+            &queue_delay, &flags, &nb_objects_previous_group, &object_length, &data, &data_length) != NULL &&
+            media_id == parity->media_id && group_id == parity->group_id &&
+            object_id == parity->object_id[missing_index] && object_offset == parity->object_offset[missing_index]) {
+            *record_length = (size_t)length;
+            decoder->nb_recovered++;
+            is_recovered = 1;
+        }
+    }
+    return is_recovered;
+}
@@ -68,7 +68,42 @@ static void quicrq_fragment_cache_node_delete(void* tree, picosplay_node_t* node
         fragment->next_in_order->previous_in_order = fragment->previous_in_order;
     }
 
-    free(quicrq_fragment_cache_node_value(node));
+    if (fragment->object != NULL) {
+        /* Update the object index, delete the object after its last fragment */
+        quicrq_cached_object_t* object = fragment->object;
+        if (object->group->first_fragment == fragment) {
+            /* The next fragment in arrival order is the first of the group only if it belongs to it */
+            object->group->first_fragment = (fragment->next_in_order != NULL &&
+                fragment->next_in_order->group_id == fragment->group_id) ? fragment->next_in_order : NULL;
+        }
+        if (object->first_fragment == fragment) {
+            object->first_fragment = NULL;
+        }
+        if (fragment->offset < object->contiguous_length) {
+            object->contiguous_length = fragment->offset;
+        }
+        object->nb_fragments--;
+        if (object->nb_fragments == 0) {
+            picosplay_delete_hint(&cached_media->object_tree, &object->object_node);
+        }
+    }
+    cached_media->nb_fragments_deleted++;
+    if (fragment->is_spilled) {
+        cached_media->spilled_bytes -= fragment->data_length;
+        if (cached_media->qr_ctx != NULL) {
+            cached_media->qr_ctx->cache_spilled_bytes -= fragment->data_length;
+        }
+    }
+    else {
+        cached_media->cache_bytes -= fragment->data_length;
+        if (cached_media->qr_ctx != NULL) {
+            cached_media->qr_ctx->cache_bytes -= fragment->data_length;
+        }
+    }
+
+    /* The data may still be referenced by datagrams waiting for acknowledgement */
+    quicrq_fragment_buffer_release(fragment->buffer);
+    quicrq_pool_free(cached_media->qr_ctx, quicrq_pool_cached_fragment, fragment);
 }
 
 quicrq_cached_fragment_t* quicrq_fragment_cache_get_fragment(quicrq_fragment_cache_t* cache_ctx,
@@ -82,11 +117,317 @@ quicrq_cached_fragment_t* quicrq_fragment_cache_get_fragment(quicrq_fragment_cac
     return (quicrq_cached_fragment_t*)quicrq_fragment_cache_node_value(fragment_node);
 }
 
+/* Manage the group index.
+ * Groups are created with their first object, and deleted with their
+ * last object. The group is complete when all its objects are received,
+ * which requires knowing the number of objects in the group, documented
+ * in the start object of the next group, or by the end point of the media.
+ */
+static void* quicrq_fragment_group_node_value(picosplay_node_t* group_node)
+{
+    return (group_node == NULL) ? NULL : (void*)((char*)group_node - offsetof(struct st_quicrq_cached_group_t, group_node));
+}
+
+static int64_t quicrq_fragment_group_node_compare(void* l, void* r) {
+    quicrq_cached_group_t* ls = (quicrq_cached_group_t*)l;
+    quicrq_cached_group_t* rs = (quicrq_cached_group_t*)r;
+
+    return ls->group_id - rs->group_id;
+}
+
+static picosplay_node_t* quicrq_fragment_group_node_create(void* v_group)
+{
+    return &((quicrq_cached_group_t*)v_group)->group_node;
+}
+
+static void quicrq_fragment_group_node_delete(void* tree, picosplay_node_t* node)
+{
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(tree);
+#endif
+    free(quicrq_fragment_group_node_value(node));
+}
+
+quicrq_cached_group_t* quicrq_fragment_cache_get_group(quicrq_fragment_cache_t* cache_ctx, uint64_t group_id)
+{
+    quicrq_cached_group_t key = { 0 };
+    key.group_id = group_id;
+    picosplay_node_t* group_node = picosplay_find(&cache_ctx->group_tree, &key);
+    return (quicrq_cached_group_t*)quicrq_fragment_group_node_value(group_node);
+}
+
+static void quicrq_fragment_cache_group_check_complete(quicrq_fragment_cache_t* cache_ctx, quicrq_cached_group_t* group)
+{
+    uint64_t nb_objects = group->nb_objects;
+
+    if (nb_objects == 0 && (cache_ctx->final_group_id > 0 || cache_ctx->final_object_id > 0) &&
+        group->group_id == cache_ctx->final_group_id) {
+        nb_objects = cache_ctx->final_object_id;
+    }
+    group->is_complete = (nb_objects > 0 && group->nb_objects_complete >= nb_objects);
+}
+
+static quicrq_cached_group_t* quicrq_fragment_cache_group_add(quicrq_fragment_cache_t* cache_ctx,
+    quicrq_cached_fragment_t* fragment)
+{
+    quicrq_cached_group_t* group = quicrq_fragment_cache_get_group(cache_ctx, fragment->group_id);
+
+    if (group == NULL) {
+        group = (quicrq_cached_group_t*)malloc(sizeof(quicrq_cached_group_t));
+        if (group != NULL) {
+            quicrq_cached_group_t* next_group = quicrq_fragment_cache_get_group(cache_ctx, fragment->group_id + 1);
+
+            memset(group, 0, sizeof(quicrq_cached_group_t));
+            group->group_id = fragment->group_id;
+            group->first_fragment = fragment;
+            if (next_group != NULL && next_group->start_object != NULL) {
+                group->nb_objects = next_group->start_object->nb_objects_previous_group;
+            }
+            picosplay_insert(&cache_ctx->group_tree, group);
+        }
+    }
+    return group;
+}
+
+uint64_t quicrq_fragment_cache_join_group_id(quicrq_fragment_cache_t* cache_ctx, int is_complete_group_required)
+{
+    uint64_t join_group_id = cache_ctx->next_group_id;
+    int is_found = 0;
+    picosplay_node_t* group_node = picosplay_last(&cache_ctx->group_tree);
+
+    while (group_node != NULL && !is_found) {
+        quicrq_cached_group_t* group = (quicrq_cached_group_t*)quicrq_fragment_group_node_value(group_node);
+
+        if (is_complete_group_required) {
+            if (group->is_complete && group->start_object != NULL) {
+                join_group_id = group->group_id;
+                is_found = 1;
+            }
+        }
+        else if (group->group_id < cache_ctx->next_group_id) {
+            /* The group in progress is more recent */
+            is_found = 1;
+        }
+        else if (group->start_object != NULL && group->start_object->is_complete) {
+            join_group_id = group->group_id;
+            is_found = 1;
+        }
+        group_node = picosplay_previous(group_node);
+    }
+    if (is_complete_group_required && !is_found) {
+        join_group_id = quicrq_fragment_cache_join_group_id(cache_ctx, 0);
+    }
+    return join_group_id;
+}
+
+/* Check whether a fragment arrived before another. Fragments received in
+ * the same tick have the same cache time, the tie is broken by their order
+ * in the arrival list.
+ */
+static int quicrq_fragment_arrived_before(quicrq_cached_fragment_t* fragment, quicrq_cached_fragment_t* other)
+{
+    int is_before = fragment->cache_time < other->cache_time;
+
+    if (fragment->cache_time == other->cache_time) {
+        quicrq_cached_fragment_t* next = fragment->next_in_order;
+
+        while (next != NULL && next != other && next->cache_time == fragment->cache_time) {
+            next = next->next_in_order;
+        }
+        is_before = (next == other);
+    }
+    return is_before;
+}
+
+quicrq_cached_fragment_t* quicrq_fragment_cache_seek_arrival(quicrq_fragment_cache_t* cache_ctx, uint64_t start_group_id)
+{
+    quicrq_cached_fragment_t* fragment = NULL;
+    quicrq_cached_group_t key = { 0 };
+    picosplay_node_t* group_node = NULL;
+    int is_known = 1;
+
+    key.group_id = start_group_id;
+    group_node = picosplay_find_previous(&cache_ctx->group_tree, &key);
+    if (group_node == NULL) {
+        group_node = picosplay_first(&cache_ctx->group_tree);
+    }
+    else if (((quicrq_cached_group_t*)quicrq_fragment_group_node_value(group_node))->group_id < start_group_id) {
+        group_node = picosplay_next(group_node);
+    }
+    /* Fragments of a later group may have arrived before those of the start group */
+    while (group_node != NULL && is_known) {
+        quicrq_cached_group_t* group = (quicrq_cached_group_t*)quicrq_fragment_group_node_value(group_node);
+
+        if (group->first_fragment == NULL) {
+            is_known = 0;
+        }
+        else if (fragment == NULL || quicrq_fragment_arrived_before(group->first_fragment, fragment)) {
+            fragment = group->first_fragment;
+        }
+        group_node = picosplay_next(group_node);
+    }
+    if (!is_known) {
+        fragment = cache_ctx->first_fragment;
+    }
+    return fragment;
+}
+
+/* Manage the object index.
+ * Objects are created when their first fragment is added to the cache,
+ * and deleted when their last fragment is removed.
+ */
+static void* quicrq_fragment_object_node_value(picosplay_node_t* object_node)
+{
+    return (object_node == NULL) ? NULL : (void*)((char*)object_node - offsetof(struct st_quicrq_cached_object_t, object_node));
+}
+
+static int64_t quicrq_fragment_object_node_compare(void* l, void* r) {
+    quicrq_cached_object_t* ls = (quicrq_cached_object_t*)l;
+    quicrq_cached_object_t* rs = (quicrq_cached_object_t*)r;
+    int64_t ret = ls->group_id - rs->group_id;
+
+    if (ret == 0) {
+        ret = ls->object_id - rs->object_id;
+    }
+    return ret;
+}
+
+static picosplay_node_t* quicrq_fragment_object_node_create(void* v_object)
+{
+    return &((quicrq_cached_object_t*)v_object)->object_node;
+}
+
+static void quicrq_fragment_object_node_delete(void* tree, picosplay_node_t* node)
+{
+    quicrq_fragment_cache_t* cached_media = (quicrq_fragment_cache_t*)((char*)tree - offsetof(struct st_quicrq_fragment_cache_t, object_tree));
+    quicrq_cached_object_t* object = (quicrq_cached_object_t*)quicrq_fragment_object_node_value(node);
+    quicrq_cached_group_t* group = object->group;
+
+    /* Update the group index, delete the group after its last object */
+    group->nb_cached_objects--;
+    if (object->is_complete) {
+        group->nb_objects_complete--;
+    }
+    if (group->start_object == object) {
+        group->start_object = NULL;
+    }
+    if (group->nb_cached_objects == 0) {
+        picosplay_delete_hint(&cached_media->group_tree, &group->group_node);
+    }
+    else {
+        quicrq_fragment_cache_group_check_complete(cached_media, group);
+    }
+    quicrq_pool_free(cached_media->qr_ctx, quicrq_pool_cached_object, object);
+}
+
+quicrq_cached_object_t* quicrq_fragment_cache_get_object(quicrq_fragment_cache_t* cache_ctx,
+    uint64_t group_id, uint64_t object_id)
+{
+    quicrq_cached_object_t key = { 0 };
+    key.group_id = group_id;
+    key.object_id = object_id;
+    picosplay_node_t* object_node = picosplay_find(&cache_ctx->object_tree, &key);
+    return (quicrq_cached_object_t*)quicrq_fragment_object_node_value(object_node);
+}
+
+static quicrq_cached_object_t* quicrq_fragment_cache_object_add(quicrq_fragment_cache_t* cache_ctx,
+    quicrq_cached_fragment_t* fragment)
+{
+    quicrq_cached_object_t* object = quicrq_fragment_cache_get_object(cache_ctx, fragment->group_id, fragment->object_id);
+
+    if (object == NULL) {
+        quicrq_cached_group_t* group = quicrq_fragment_cache_group_add(cache_ctx, fragment);
+
+        if (group != NULL) {
+            object = (quicrq_cached_object_t*)quicrq_pool_alloc(cache_ctx->qr_ctx, quicrq_pool_cached_object,
+                sizeof(quicrq_cached_object_t));
+            if (object == NULL) {
+                if (group->nb_cached_objects == 0) {
+                    picosplay_delete_hint(&cache_ctx->group_tree, &group->group_node);
+                }
+            }
+            else {
+                memset(object, 0, sizeof(quicrq_cached_object_t));
+                object->group_id = fragment->group_id;
+                object->object_id = fragment->object_id;
+                object->object_length = fragment->object_length;
+                object->flags = fragment->flags;
+                object->first_cache_time = fragment->cache_time;
+                object->group = group;
+                group->nb_cached_objects++;
+                picosplay_insert(&cache_ctx->object_tree, object);
+            }
+        }
+    }
+    if (object != NULL) {
+        /* Document the state of the object at arrival, for the arrival cursor */
+        fragment->is_object_start = (object->nb_fragments == 0);
+        fragment->object_bytes_before = object->bytes_received;
+        object->bytes_received += fragment->data_length;
+        object->nb_fragments++;
+        if (fragment->offset == 0) {
+            /* Flags and the number of objects in the previous group are documented in the first fragment */
+            object->first_fragment = fragment;
+            object->flags = fragment->flags;
+            object->nb_objects_previous_group = fragment->nb_objects_previous_group;
+            if (object->object_id == 0) {
+                quicrq_cached_group_t* previous_group = (fragment->group_id == 0) ? NULL :
+                    quicrq_fragment_cache_get_group(cache_ctx, fragment->group_id - 1);
+
+                object->group->start_object = object;
+                if (previous_group != NULL) {
+                    previous_group->nb_objects = fragment->nb_objects_previous_group;
+                    quicrq_fragment_cache_group_check_complete(cache_ctx, previous_group);
+                }
+            }
+        }
+        fragment->object = object;
+    }
+    return object;
+}
+
+/* Update the contiguous length of the object after a fragment is inserted
+ * in the fragment tree, and count the object as received when complete.
+ */
+static void quicrq_fragment_cache_object_progress(quicrq_fragment_cache_t* cache_ctx,
+    quicrq_cached_fragment_t* fragment)
+{
+    quicrq_cached_object_t* object = fragment->object;
+
+    if (fragment->offset <= object->contiguous_length &&
+        fragment->offset + fragment->data_length > object->contiguous_length) {
+        picosplay_node_t* next_fragment_node = &fragment->fragment_node;
+
+        object->contiguous_length = fragment->offset + fragment->data_length;
+        while ((next_fragment_node = picosplay_next(next_fragment_node)) != NULL) {
+            quicrq_cached_fragment_t* next_fragment = (quicrq_cached_fragment_t*)quicrq_fragment_cache_node_value(next_fragment_node);
+            if (next_fragment->object != object || next_fragment->offset > object->contiguous_length) {
+                break;
+            }
+            if (next_fragment->offset + next_fragment->data_length > object->contiguous_length) {
+                object->contiguous_length = next_fragment->offset + next_fragment->data_length;
+            }
+        }
+    }
+    if (!object->is_complete && object->first_fragment != NULL &&
+        object->contiguous_length >= object->object_length) {
+        /* The object was just completely received. Keep counts. */
+        object->is_complete = 1;
+        object->group->nb_objects_complete++;
+        quicrq_fragment_cache_group_check_complete(cache_ctx, object->group);
+        cache_ctx->nb_object_received += 1;
+        quicrq_hop_latency_record(cache_ctx, quicrq_hop_latency_receive_to_cache,
+            fragment->cache_time - object->first_cache_time);
+    }
+}
+
 void quicrq_fragment_cache_media_clear(quicrq_fragment_cache_t* cached_media)
 {
     cached_media->first_fragment = NULL;
     cached_media->last_fragment = NULL;
     picosplay_empty_tree(&cached_media->fragment_tree);
+    picosplay_empty_tree(&cached_media->object_tree);
+    picosplay_empty_tree(&cached_media->group_tree);
 }
 
 void quicrq_fragment_cache_media_init(quicrq_fragment_cache_t* cached_media)
@@ -94,6 +435,12 @@ void quicrq_fragment_cache_media_init(quicrq_fragment_cache_t* cached_media)
     picosplay_init_tree(&cached_media->fragment_tree, quicrq_fragment_cache_node_compare,
         quicrq_fragment_cache_node_create, quicrq_fragment_cache_node_delete,
         quicrq_fragment_cache_node_value);
+    picosplay_init_tree(&cached_media->object_tree, quicrq_fragment_object_node_compare,
+        quicrq_fragment_object_node_create, quicrq_fragment_object_node_delete,
+        quicrq_fragment_object_node_value);
+    picosplay_init_tree(&cached_media->group_tree, quicrq_fragment_group_node_compare,
+        quicrq_fragment_group_node_create, quicrq_fragment_group_node_delete,
+        quicrq_fragment_group_node_value);
 }
 
 
@@ -156,7 +503,11 @@ void quicrq_fragment_cache_progress(quicrq_fragment_cache_t* cache_ctx,
     } while ((next_fragment_node = picosplay_next(next_fragment_node)) != NULL);
 }
 
-int quicrq_fragment_add_to_cache(quicrq_fragment_cache_t* cache_ctx,
+/* Add a fragment to the cache. If a shared buffer is provided, the data points into
+ * it and the fragment holds a reference to the buffer; otherwise, the data is copied.
+ */
+int quicrq_fragment_add_buffer_to_cache(quicrq_fragment_cache_t* cache_ctx,
+    quicrq_fragment_buffer_t* shared_buffer,
     const uint8_t* data,
     uint64_t group_id,
     uint64_t object_id,
@@ -169,22 +520,25 @@ int quicrq_fragment_add_to_cache(quicrq_fragment_cache_t* cache_ctx,
     uint64_t current_time)
 {
     int ret = 0;
-    quicrq_cached_fragment_t* fragment = (quicrq_cached_fragment_t*)malloc(
-        sizeof(quicrq_cached_fragment_t) + data_length);
+    quicrq_cached_fragment_t* fragment = (quicrq_cached_fragment_t*)quicrq_pool_alloc(cache_ctx->qr_ctx,
+        quicrq_pool_cached_fragment, sizeof(quicrq_cached_fragment_t));
+    quicrq_fragment_buffer_t* buffer = shared_buffer;
 
-    if (fragment == NULL) {
+    if (buffer == NULL) {
+        buffer = quicrq_fragment_buffer_create(cache_ctx->qr_ctx, data, data_length);
+        data = (buffer == NULL) ? NULL : buffer->data;
+    }
+    else {
+        quicrq_fragment_buffer_hold(buffer);
+    }
+
+    if (fragment == NULL || buffer == NULL) {
+        quicrq_pool_free(cache_ctx->qr_ctx, quicrq_pool_cached_fragment, fragment);
+        quicrq_fragment_buffer_release(buffer);
         ret = -1;
     }
     else {
         memset(fragment, 0, sizeof(quicrq_cached_fragment_t));
-        if (cache_ctx->last_fragment == NULL) {
-            cache_ctx->first_fragment = fragment;
-        }
-        else {
-            fragment->previous_in_order = cache_ctx->last_fragment;
-            cache_ctx->last_fragment->next_in_order = fragment;
-        }
-        cache_ctx->last_fragment = fragment;
         fragment->group_id = group_id;
         fragment->object_id = object_id;
         fragment->offset = offset;
@@ -193,16 +547,58 @@ int quicrq_fragment_add_to_cache(quicrq_fragment_cache_t* cache_ctx,
         fragment->flags = flags;
         fragment->nb_objects_previous_group = nb_objects_previous_group;
         fragment->object_length = object_length;
-        fragment->data = ((uint8_t*)fragment) + sizeof(quicrq_cached_fragment_t);
+        fragment->buffer = buffer;
+        fragment->data = (uint8_t*)data;
         fragment->data_length = data_length;
-        memcpy(fragment->data, data, data_length);
-        picosplay_insert(&cache_ctx->fragment_tree, fragment);
-        quicrq_fragment_cache_progress(cache_ctx, fragment);
+        if (quicrq_fragment_cache_object_add(cache_ctx, fragment) == NULL) {
+            quicrq_pool_free(cache_ctx->qr_ctx, quicrq_pool_cached_fragment, fragment);
+            quicrq_fragment_buffer_release(buffer);
+            ret = -1;
+        }
+        else {
+            if (cache_ctx->last_fragment == NULL) {
+                cache_ctx->first_fragment = fragment;
+            }
+            else {
+                fragment->previous_in_order = cache_ctx->last_fragment;
+                cache_ctx->last_fragment->next_in_order = fragment;
+            }
+            cache_ctx->last_fragment = fragment;
+            cache_ctx->cache_bytes += data_length;
+            if (cache_ctx->qr_ctx != NULL) {
+                cache_ctx->qr_ctx->cache_bytes += data_length;
+            }
+            picosplay_insert(&cache_ctx->fragment_tree, fragment);
+            /* The queue delay is coded in milliseconds */
+            quicrq_hop_latency_record(cache_ctx, quicrq_hop_latency_upstream_queue_delay, queue_delay * 1000);
+            quicrq_fragment_cache_object_progress(cache_ctx, fragment);
+            quicrq_fragment_cache_progress(cache_ctx, fragment);
+            if (cache_ctx->first_shard_feed != NULL) {
+                /* Copy the fragment to the relay shards */
+                ret = quicrq_shard_feed_fragment(cache_ctx, fragment);
+            }
+        }
     }
 
     return ret;
 }
 
+int quicrq_fragment_add_to_cache(quicrq_fragment_cache_t* cache_ctx,
+    const uint8_t* data,
+    uint64_t group_id,
+    uint64_t object_id,
+    uint64_t offset,
+    uint64_t queue_delay,
+    uint8_t flags,
+    uint64_t nb_objects_previous_group,
+    uint64_t object_length,
+    size_t data_length,
+    uint64_t current_time)
+{
+    return quicrq_fragment_add_buffer_to_cache(cache_ctx, NULL, data, group_id, object_id, offset, queue_delay,
+        flags, nb_objects_previous_group, object_length, data_length, current_time);
+}
+
 int quicrq_fragment_propose_to_cache(quicrq_fragment_cache_t* cache_ctx,
     const uint8_t* data,
     uint64_t group_id,
@@ -214,6 +610,26 @@ int quicrq_fragment_propose_to_cache(quicrq_fragment_cache_t* cache_ctx,
     uint64_t object_length,
     size_t data_length,
     uint64_t current_time)
+{
+    return quicrq_fragment_propose_buffer_to_cache(cache_ctx, NULL, data, group_id, object_id, offset, queue_delay,
+        flags, nb_objects_previous_group, object_length, data_length, current_time);
+}
+
+/* Propose a fragment to the cache, only adding the parts that are not already present.
+ * If a shared buffer is provided, the data points into it and is not copied.
+ */
+int quicrq_fragment_propose_buffer_to_cache(quicrq_fragment_cache_t* cache_ctx,
+    quicrq_fragment_buffer_t* shared_buffer,
+    const uint8_t* data,
+    uint64_t group_id,
+    uint64_t object_id,
+    uint64_t offset,
+    uint64_t queue_delay,
+    uint8_t flags,
+    uint64_t nb_objects_previous_group,
+    uint64_t object_length,
+    size_t data_length,
+    uint64_t current_time)
 {
     int ret = 0;
     int data_was_added = 0;
@@ -239,7 +655,7 @@ int quicrq_fragment_propose_to_cache(quicrq_fragment_cache_t* cache_ctx,
             first_fragment_state->object_id != object_id ||
             first_fragment_state->offset + first_fragment_state->data_length < offset) {          
             /* Insert the whole fragment */
-            ret = quicrq_fragment_add_to_cache(cache_ctx, data, 
+            ret = quicrq_fragment_add_buffer_to_cache(cache_ctx, shared_buffer, data, 
                 group_id, object_id, offset, queue_delay, flags, nb_objects_previous_group, object_length, data_length, current_time);
             data_was_added = 1;
             /* Mark done */
@@ -251,7 +667,7 @@ int quicrq_fragment_propose_to_cache(quicrq_fragment_cache_t* cache_ctx,
             if (offset + data_length > previous_last_byte) {
                 /* Some of the fragment data comes after this one. Submit */
                 size_t added_length = offset + data_length - previous_last_byte;
-                ret = quicrq_fragment_add_to_cache(cache_ctx, data, 
+                ret = quicrq_fragment_add_buffer_to_cache(cache_ctx, shared_buffer, data, 
                     group_id, object_id, offset, queue_delay, flags, nb_objects_previous_group, object_length, added_length, current_time);
                 data_was_added = 1;
                 data_length -= added_length;
@@ -273,39 +689,9 @@ int quicrq_fragment_propose_to_cache(quicrq_fragment_cache_t* cache_ctx,
     } while (ret == 0 && data_length > 0);
 
     if (ret == 0 && data_was_added) {
-        /* Wake up the consumers of this source */
+        /* Wake up the consumers of this source.
+         * Completion of the object is tracked in the object index. */
         quicrq_source_wakeup(cache_ctx->srce_ctx);
-        /* Check whether this object is now complete */
-        last_fragment_node = picosplay_find_previous(&cache_ctx->fragment_tree, &key);
-        first_fragment_state = (quicrq_cached_fragment_t*)quicrq_fragment_cache_node_value(last_fragment_node);
-        if (first_fragment_state != NULL) {
-            int last_is_final =
-                (first_fragment_state->offset + first_fragment_state->data_length) >=
-                first_fragment_state->object_length;
-            uint64_t previous_offset = first_fragment_state->offset;
-
-            while (last_is_final && previous_offset > 0) {
-                last_fragment_node = picosplay_previous(last_fragment_node);
-                if (last_fragment_node == NULL) {
-                    last_is_final = 0;
-                }
-                else {
-                    first_fragment_state = (quicrq_cached_fragment_t*)quicrq_fragment_cache_node_value(last_fragment_node);
-                    if (first_fragment_state->group_id != group_id ||
-                        first_fragment_state->object_id != object_id ||
-                        first_fragment_state->offset + first_fragment_state->data_length < previous_offset) {
-                        last_is_final = 0;
-                    }
-                    else {
-                        previous_offset = first_fragment_state->offset;
-                    }
-                }
-            }
-            if (last_is_final) {
-                /* The object was just completely received. Keep counts. */
-                cache_ctx->nb_object_received += 1;
-            }
-        }
     }
 
     return ret;
@@ -349,13 +735,15 @@ int quicrq_fragment_cache_learn_start_point(quicrq_fragment_cache_t* cache_ctx,
             * so the start point can be releayed. */
             stream_ctx->start_group_id = start_group_id;
             stream_ctx->start_object_id = start_object_id;
-            if (stream_ctx->cnx_ctx->cnx != NULL) {
-                picoquic_mark_active_stream(stream_ctx->cnx_ctx->cnx, stream_ctx->stream_id, 1, stream_ctx);
-            }
+            (void)quicrq_mark_control_stream_active(stream_ctx);
             stream_ctx = stream_ctx->next_stream_for_source;
         }
     }
 
+    if (ret == 0 && cache_ctx->first_shard_feed != NULL) {
+        ret = quicrq_shard_feed_start_point(cache_ctx);
+    }
+
     /* TODO: if the end is known, something special? */
     return ret;
 }
@@ -367,8 +755,18 @@ int quicrq_fragment_cache_learn_end_point(quicrq_fragment_cache_t* cache_ctx,
     /* Document the final group-ID and object-ID in context */
     cache_ctx->final_group_id = final_group_id;
     cache_ctx->final_object_id = final_object_id;
+    if (final_object_id > 0) {
+        /* The end point documents the number of objects in the final group */
+        quicrq_cached_group_t* final_group = quicrq_fragment_cache_get_group(cache_ctx, final_group_id);
+        if (final_group != NULL) {
+            quicrq_fragment_cache_group_check_complete(cache_ctx, final_group);
+        }
+    }
     /* wake up the clients waiting for data on this media */
     quicrq_source_wakeup(cache_ctx->srce_ctx);
+    if (cache_ctx->first_shard_feed != NULL) {
+        ret = quicrq_shard_feed_end_point(cache_ctx);
+    }
     
     return ret;
 }
@@ -385,9 +783,7 @@ int quicrq_fragment_cache_set_real_time_cache(quicrq_fragment_cache_t* cache_ctx
         * update the cache policy
         * so the start point can be releayed. */
         stream_ctx->is_cache_real_time = 1;
-        if (stream_ctx->cnx_ctx->cnx != NULL) {
-            ret = picoquic_mark_active_stream(stream_ctx->cnx_ctx->cnx, stream_ctx->stream_id, 1, stream_ctx);
-        }
+        ret = quicrq_mark_control_stream_active(stream_ctx);
         stream_ctx = stream_ctx->next_stream_for_source;
     }
     return ret;
@@ -413,7 +809,13 @@ void quicrq_fragment_cache_media_purge_to_gob(
             quicrq_fragment_publisher_context_t* media_ctx = stream_ctx->media_ctx;
             quicrq_fragment_publisher_object_state_t* first_object = quicrq_fragment_cache_node_value(picosplay_first(&media_ctx->publisher_object_tree));
 
-            if (first_object != NULL && first_object->group_id < kept_group_id) {
+            if (media_ctx->is_arrival_cursor) {
+                /* No object states, the cursor is the oldest read point */
+                if (media_ctx->current_fragment != NULL && media_ctx->current_fragment->group_id < kept_group_id) {
+                    kept_group_id = media_ctx->current_fragment->group_id;
+                }
+            }
+            else if (first_object != NULL && first_object->group_id < kept_group_id) {
                 kept_group_id = first_object->group_id;
             }
             stream_ctx = stream_ctx->next_stream_for_source;
@@ -437,8 +839,150 @@ void quicrq_fragment_cache_media_purge_to_gob(
     }
 }
 
+/* Find the lowest group that may still be read by the streams subscribed
+ * to the source. Groups from that point on shall be kept in the cache.
+ * - single stream: the group of the publisher's cursor,
+ * - datagrams: the group of the current fragment and of the oldest object still tracked,
+ * - warp and rush: the groups of the open uni streams, and the next group to open.
+ * The result is capped at the next group expected in sequence, so that
+ * groups not yet completely received are never evicted.
+ */
+uint64_t quicrq_fragment_cache_lowest_read_group(quicrq_media_source_ctx_t* srce_ctx)
+{
+    quicrq_fragment_cache_t* cache_ctx = srce_ctx->cache_ctx;
+    uint64_t kept_group_id = cache_ctx->next_group_id;
+    quicrq_stream_ctx_t* stream_ctx = srce_ctx->first_stream;
+
+    while (stream_ctx != NULL) {
+        quicrq_fragment_publisher_context_t* media_ctx = stream_ctx->media_ctx;
+
+        if (media_ctx != NULL) {
+            quicrq_fragment_publisher_object_state_t* first_object = quicrq_fragment_cache_node_value(picosplay_first(&media_ctx->publisher_object_tree));
+            quicrq_uni_stream_ctx_t* uni_stream_ctx = NULL;
+
+            if (first_object != NULL && first_object->group_id < kept_group_id) {
+                kept_group_id = first_object->group_id;
+            }
+            switch (stream_ctx->transport_mode) {
+            case quicrq_transport_mode_warp:
+            case quicrq_transport_mode_rush:
+                /* The tracks of a batch use datagrams, and do not have uni streams */
+                uni_stream_ctx = stream_ctx->first_uni_stream;
+                if (stream_ctx->next_warp_group_id < kept_group_id) {
+                    kept_group_id = stream_ctx->next_warp_group_id;
+                }
+                while (uni_stream_ctx != NULL) {
+                    if (uni_stream_ctx->send_state != quicrq_sending_warp_should_close &&
+                        uni_stream_ctx->current_group_id < kept_group_id) {
+                        kept_group_id = uni_stream_ctx->current_group_id;
+                    }
+                    uni_stream_ctx = uni_stream_ctx->next_uni_stream_for_control_stream;
+                }
+                break;
+            case quicrq_transport_mode_datagram:
+                if (media_ctx->current_fragment == NULL) {
+                    if (stream_ctx->start_group_id < kept_group_id) {
+                        kept_group_id = stream_ctx->start_group_id;
+                    }
+                }
+                else if (media_ctx->current_fragment->group_id < kept_group_id) {
+                    kept_group_id = media_ctx->current_fragment->group_id;
+                }
+                break;
+            default:
+                if (media_ctx->current_group_id < kept_group_id) {
+                    kept_group_id = media_ctx->current_group_id;
+                }
+                break;
+            }
+        }
+        stream_ctx = stream_ctx->next_stream_for_source;
+    }
+    return kept_group_id;
+}
+
+/* Remove all the fragments of the first group in the cache, if that group
+ * is below the kept group. Returns the number of data bytes removed.
+ */
+size_t quicrq_fragment_cache_evict_group(quicrq_fragment_cache_t* cache_ctx, uint64_t kept_group_id)
+{
+    size_t cache_bytes_before = cache_ctx->cache_bytes;
+    picosplay_node_t* fragment_node = picosplay_first(&cache_ctx->fragment_tree);
+
+    if (fragment_node != NULL) {
+        uint64_t evicted_group_id = ((quicrq_cached_fragment_t*)quicrq_fragment_cache_node_value(fragment_node))->group_id;
+
+        if (evicted_group_id < kept_group_id) {
+            while ((fragment_node = picosplay_first(&cache_ctx->fragment_tree)) != NULL) {
+                quicrq_cached_fragment_t* fragment =
+                    (quicrq_cached_fragment_t*)quicrq_fragment_cache_node_value(fragment_node);
+                if (fragment->group_id != evicted_group_id) {
+                    break;
+                }
+                picosplay_delete_hint(&cache_ctx->fragment_tree, fragment_node);
+            }
+            /* The cache now starts at the next group */
+            cache_ctx->first_group_id = evicted_group_id + 1;
+            cache_ctx->first_object_id = 0;
+            if (fragment_node != NULL) {
+                quicrq_cached_fragment_t* fragment =
+                    (quicrq_cached_fragment_t*)quicrq_fragment_cache_node_value(fragment_node);
+                cache_ctx->first_group_id = fragment->group_id;
+                cache_ctx->first_object_id = fragment->object_id;
+            }
+            cache_ctx->evicted_bytes += cache_bytes_before - cache_ctx->cache_bytes;
+        }
+    }
+    return cache_bytes_before - cache_ctx->cache_bytes;
+}
+
+/* Evict groups until the memory used by the caches fits in the limit,
+ * or no group can be evicted. At each step, pick the least recently read
+ * cache that has an evictable group, or if several caches were read at the
+ * same time, the one holding the oldest fragment.
+ */
+void quicrq_fragment_cache_enforce_memory_limit(quicrq_ctx_t* qr_ctx)
+{
+    while (qr_ctx->cache_memory_limit > 0 && qr_ctx->cache_bytes > qr_ctx->cache_memory_limit) {
+        quicrq_media_source_ctx_t* srce_ctx = qr_ctx->first_source;
+        quicrq_fragment_cache_t* evicted_cache_ctx = NULL;
+        uint64_t evicted_kept_group_id = 0;
+        uint64_t evicted_cache_time = 0;
+
+        while (srce_ctx != NULL) {
+            quicrq_fragment_cache_t* cache_ctx = srce_ctx->cache_ctx;
+            quicrq_cached_fragment_t* fragment = (cache_ctx == NULL) ? NULL :
+                (quicrq_cached_fragment_t*)quicrq_fragment_cache_node_value(picosplay_first(&cache_ctx->fragment_tree));
+
+            if (fragment != NULL && (evicted_cache_ctx == NULL ||
+                cache_ctx->last_read_time < evicted_cache_ctx->last_read_time ||
+                (cache_ctx->last_read_time == evicted_cache_ctx->last_read_time &&
+                    fragment->cache_time < evicted_cache_time))) {
+                uint64_t kept_group_id = quicrq_fragment_cache_lowest_read_group(srce_ctx);
+                if (fragment->group_id < kept_group_id) {
+                    evicted_cache_ctx = cache_ctx;
+                    evicted_kept_group_id = kept_group_id;
+                    evicted_cache_time = fragment->cache_time;
+                }
+            }
+            srce_ctx = srce_ctx->next_source;
+        }
+
+        if (evicted_cache_ctx == NULL) {
+            /* All remaining groups are in use */
+            break;
+        }
+        else {
+            qr_ctx->cache_evicted_bytes += quicrq_fragment_cache_evict_group(evicted_cache_ctx, evicted_kept_group_id);
+            qr_ctx->cache_evicted_groups++;
+        }
+    }
+}
+
 void quicrq_fragment_cache_delete_ctx(quicrq_fragment_cache_t* cache_ctx)
 {
+    quicrq_shard_feed_source_closed(cache_ctx);
+    quicrq_shard_feed_mirror_deleted(cache_ctx);
     quicrq_fragment_cache_media_clear(cache_ctx);
 
     free(cache_ctx);
@@ -499,20 +1043,21 @@ static picosplay_node_t* quicrq_fragment_publisher_object_node_create(void* v_pu
 static void quicrq_fragment_publisher_object_node_delete(void* tree, picosplay_node_t* node)
 {
     if (tree == NULL){
-        /* quicrq_fragment_publisher_context_t* cached_media = (quicrq_fragment_publisher_context_t*)((char*)tree - offsetof(struct st_quicrq_fragment_publisher_context_t, publisher_object_tree)); */
         DBG_PRINTF("%s", "Calling object node delete with empty tree");
-
+        free(quicrq_fragment_publisher_object_node_value(node));
+    }
+    else {
+        quicrq_fragment_publisher_context_t* media_ctx = (quicrq_fragment_publisher_context_t*)((char*)tree - offsetof(struct st_quicrq_fragment_publisher_context_t, publisher_object_tree));
+        quicrq_pool_free(media_ctx->qr_ctx, quicrq_pool_publisher_object, quicrq_fragment_publisher_object_node_value(node));
     }
-
-    free(quicrq_fragment_publisher_object_node_value(node));
 }
 
 
 quicrq_fragment_publisher_object_state_t* quicrq_fragment_publisher_object_add(quicrq_fragment_publisher_context_t* media_ctx,
     uint64_t group_id, uint64_t object_id, uint64_t object_length)
 {
-    quicrq_fragment_publisher_object_state_t* publisher_object = 
-        (quicrq_fragment_publisher_object_state_t*)malloc(sizeof(quicrq_fragment_publisher_object_state_t));
+    quicrq_fragment_publisher_object_state_t* publisher_object = (quicrq_fragment_publisher_object_state_t*)
+        quicrq_pool_alloc(media_ctx->qr_ctx, quicrq_pool_publisher_object, sizeof(quicrq_fragment_publisher_object_state_t));
 
     if (publisher_object != NULL) {
         memset(publisher_object, 0, sizeof(quicrq_fragment_publisher_object_state_t));
@@ -540,6 +1085,12 @@ void quicrq_fragment_publisher_close(quicrq_fragment_publisher_context_t* media_
     quicrq_fragment_cache_t * cache_ctx = media_ctx->cache_ctx;
 
     picosplay_empty_tree(&media_ctx->publisher_object_tree);
+    if (media_ctx->qr_ctx != NULL) {
+        quicrq_timer_cancel(media_ctx->qr_ctx, &media_ctx->catch_up_timer);
+    }
+    if (media_ctx->is_arrival_cursor) {
+        cache_ctx->nb_arrival_cursors--;
+    }
 
     if (cache_ctx->is_feed_closed && cache_ctx->qr_ctx != NULL) {
         /* This may be the last connection served from this cache */
@@ -549,6 +1100,64 @@ void quicrq_fragment_publisher_close(quicrq_fragment_publisher_context_t* media_
     free(media_ctx);
 }
 
+int quicrq_fragment_publisher_catch_up_hold(quicrq_fragment_publisher_context_t* media_ctx,
+    quicrq_cached_object_t* object, uint64_t current_time)
+{
+    int should_hold = 0;
+    uint32_t catch_up_speed = (media_ctx->qr_ctx == NULL) ? 0 : media_ctx->qr_ctx->catch_up_speed;
+
+    if (object != NULL && !media_ctx->is_catch_up_checked && catch_up_speed > 0) {
+        /* The first object presented sets the origin of the pacing schedule. If it
+         * just arrived, the subscriber is already at the live edge. */
+        media_ctx->is_catch_up_checked = 1;
+        media_ctx->is_catching_up = (object->first_cache_time < current_time);
+        media_ctx->catch_up_start_time = current_time;
+        media_ctx->catch_up_origin_time = object->first_cache_time;
+    }
+
+    if (object != NULL && media_ctx->is_catching_up) {
+        uint64_t release_time = media_ctx->catch_up_start_time;
+
+        if (catch_up_speed == 0) {
+            /* Pacing disabled since the start of the catch up */
+            media_ctx->is_catching_up = 0;
+        }
+        else {
+            if (object->first_cache_time > media_ctx->catch_up_origin_time) {
+                release_time += ((object->first_cache_time - media_ctx->catch_up_origin_time) * 100) / catch_up_speed;
+            }
+            if (object->first_cache_time >= release_time) {
+                /* The object arrived after its release time: caught up with the live edge */
+                media_ctx->is_catching_up = 0;
+            }
+            else if (current_time < release_time) {
+                should_hold = 1;
+                if (media_ctx->catch_up_timer.heap_index == 0 || media_ctx->catch_up_timer.deadline > release_time) {
+                    if (quicrq_timer_set(media_ctx->qr_ctx, &media_ctx->catch_up_timer, release_time) != 0) {
+                        /* Cannot wake up the stream later, do not hold the object */
+                        should_hold = 0;
+                    }
+                }
+            }
+        }
+    }
+
+    return should_hold;
+}
+
+void quicrq_fragment_publisher_catch_up_wakeup(quicrq_fragment_publisher_context_t* media_ctx)
+{
+    quicrq_stream_ctx_t* stream_ctx = media_ctx->stream_ctx;
+
+    if (stream_ctx != NULL && stream_ctx->cnx_ctx->cnx != NULL) {
+        quicrq_wakeup_media_stream(stream_ctx);
+        if (stream_ctx->transport_mode == quicrq_transport_mode_datagram) {
+            /* The connection may have been marked not ready while the object was held */
+            picoquic_mark_datagram_ready(stream_ctx->cnx_ctx->cnx, 1);
+        }
+    }
+}
+
 int quicrq_fragment_is_ready_to_send(void* v_media_ctx, size_t data_max_size, uint64_t current_time)
 {
     int is_ready = 0;
@@ -569,6 +1178,27 @@ int quicrq_fragment_is_ready_to_send(void* v_media_ctx, size_t data_max_size, ui
     return is_ready;
 }
 
+/* At the end of a fragment, find the next one in the same group by walking
+ * the splay from the current one, instead of searching the cache on the
+ * next call. Objects are sent in order, so the next fragment is either the
+ * continuation of the object or the beginning of the next one. Returns NULL
+ * if that fragment is not there yet, or if it starts a new group, in which
+ * case the next call searches the cache.
+ */
+static quicrq_cached_fragment_t* quicrq_fragment_publisher_next_fragment(quicrq_fragment_publisher_context_t* media_ctx)
+{
+    quicrq_cached_fragment_t* next_fragment = (quicrq_cached_fragment_t*)quicrq_fragment_cache_node_value(
+        picosplay_next(&media_ctx->current_fragment->fragment_node));
+
+    if (next_fragment != NULL && (next_fragment->group_id != media_ctx->current_group_id ||
+        next_fragment->object_id != media_ctx->current_object_id || next_fragment->offset != media_ctx->current_offset)) {
+        next_fragment = NULL;
+    }
+    media_ctx->nb_fragments_deleted = media_ctx->cache_ctx->nb_fragments_deleted;
+
+    return next_fragment;
+}
+
 int quicrq_fragment_publisher_fn(
     quicrq_media_source_action_enum action,
     void* v_media_ctx,
@@ -605,6 +1235,11 @@ int quicrq_fragment_publisher_fn(
             *is_media_finished = 1;
         }
         else {
+            if (media_ctx->current_fragment != NULL && media_ctx->length_sent == 0 &&
+                media_ctx->nb_fragments_deleted != media_ctx->cache_ctx->nb_fragments_deleted) {
+                /* The next fragment was set at the end of the previous one, but it may have been deleted since */
+                media_ctx->current_fragment = NULL;
+            }
             /* If skipping the current objet, check that the next object is available */
             if (media_ctx->is_current_object_skipped) {
 
@@ -667,6 +1302,10 @@ int quicrq_fragment_publisher_fn(
             if (media_ctx->current_fragment == NULL) {
                 /* Check for end of media maybe */
             }
+            else if (media_ctx->length_sent == 0 && media_ctx->current_offset == 0 &&
+                quicrq_fragment_publisher_catch_up_hold(media_ctx, media_ctx->current_fragment->object, current_time)) {
+                /* The object is paced during catch up, the stream will be woken up by the catch up timer */
+            }
             else {
                 size_t available = media_ctx->current_fragment->data_length - media_ctx->length_sent;
                 size_t copied = data_max_size;
@@ -692,6 +1331,11 @@ int quicrq_fragment_publisher_fn(
                     /* If data is set to NULL, return the available size but do not copy anything */
                     memcpy(data, media_ctx->current_fragment->data + media_ctx->length_sent, copied);
                     media_ctx->length_sent += copied;
+                    media_ctx->cache_ctx->last_read_time = current_time;
+                    if (current_time > media_ctx->current_fragment->cache_time) {
+                        quicrq_hop_latency_record(media_ctx->cache_ctx, quicrq_hop_latency_cache_to_send,
+                            current_time - media_ctx->current_fragment->cache_time);
+                    }
                     if (end_of_fragment) {
                         size_t next_offset = media_ctx->current_offset + media_ctx->current_fragment->data_length;
                         if (next_offset >= media_ctx->current_fragment->object_length) {
@@ -703,7 +1347,7 @@ int quicrq_fragment_publisher_fn(
                         }
 
                         media_ctx->length_sent = 0;
-                        media_ctx->current_fragment = NULL;
+                        media_ctx->current_fragment = quicrq_fragment_publisher_next_fragment(media_ctx);
                     }
                 }
             }
@@ -720,6 +1364,68 @@ int quicrq_fragment_publisher_fn(
     return ret;
 }
 
+/* Arrival cursor.
+ * Most subscribers of a live source are at the same position and send every
+ * object. The publishers attached to the arrival cursor follow the fragments in
+ * the arrival order of the cache, and share the object states that the cache
+ * documents once per fragment when it arrives: whether the fragment starts its
+ * object, and how many bytes of the object came before it. An attached publisher
+ * only keeps its own position in the arrival order, because each connection
+ * sends at its own pace. When the congestion control drops an object, the
+ * publisher detaches and uses its own object states, starting from the object
+ * of the last fragment it sent if that one is not complete. It attaches again
+ * once it has sent the last fragment in the cache, and has no other object in
+ * progress. Fragments of the objects before that point are then skipped, as
+ * they would be by the object states.
+ */
+static int quicrq_fragment_publisher_leave_arrival_cursor(quicrq_stream_ctx_t* stream_ctx,
+    quicrq_fragment_publisher_context_t* media_ctx)
+{
+    int ret = 0;
+    quicrq_cached_fragment_t* last_sent = media_ctx->current_fragment->previous_in_order;
+
+    media_ctx->is_arrival_cursor = 0;
+    media_ctx->cache_ctx->nb_arrival_cursors--;
+    media_ctx->cache_ctx->nb_arrival_cursor_exits++;
+    if (last_sent != NULL && last_sent->object_bytes_before + last_sent->data_length < last_sent->object_length &&
+        (last_sent->group_id > stream_ctx->start_group_id ||
+            (last_sent->group_id == stream_ctx->start_group_id && last_sent->object_id >= stream_ctx->start_object_id)) &&
+        (last_sent->group_id > media_ctx->cursor_floor_group_id ||
+            (last_sent->group_id == media_ctx->cursor_floor_group_id && last_sent->object_id >= media_ctx->cursor_floor_object_id))) {
+        /* Keep sending the fragments of the object in progress */
+        quicrq_fragment_publisher_object_state_t* publisher_object = quicrq_fragment_publisher_object_add(media_ctx,
+            last_sent->group_id, last_sent->object_id, last_sent->object_length);
+        if (publisher_object == NULL) {
+            ret = -1;
+        }
+        else {
+            publisher_object->bytes_sent = last_sent->object_bytes_before + last_sent->data_length;
+            if (last_sent->object != NULL) {
+                publisher_object->nb_objects_previous_group = last_sent->object->nb_objects_previous_group;
+            }
+        }
+    }
+    return ret;
+}
+
+static void quicrq_fragment_publisher_join_arrival_cursor(quicrq_fragment_publisher_context_t* media_ctx)
+{
+    if (media_ctx->is_arrival_cursor_allowed &&
+        media_ctx->is_current_fragment_sent && media_ctx->current_fragment->next_in_order == NULL) {
+        quicrq_fragment_publisher_object_state_t* first_object = (quicrq_fragment_publisher_object_state_t*)
+            quicrq_fragment_publisher_object_node_value(picosplay_first(&media_ctx->publisher_object_tree));
+
+        if (first_object != NULL && first_object->is_sent && !first_object->is_dropped &&
+            picosplay_next(&first_object->publisher_object_node) == NULL) {
+            media_ctx->is_arrival_cursor = 1;
+            media_ctx->cursor_floor_group_id = first_object->group_id;
+            media_ctx->cursor_floor_object_id = first_object->object_id;
+            picosplay_empty_tree(&media_ctx->publisher_object_tree);
+            media_ctx->cache_ctx->nb_arrival_cursors++;
+        }
+    }
+}
+
 /* datagram_publisher_check_object:
  * evaluate and if necessary progress the "current fragment" pointer.
  * After this evaluation, expect the following results:
@@ -739,7 +1445,8 @@ int quicrq_fragment_datagram_publisher_check_fragment(
 
     /* The "current fragment" shall never be NULL, unless this is the very first one. */
     if (media_ctx->current_fragment == NULL) {
-        media_ctx->current_fragment = media_ctx->cache_ctx->first_fragment;
+        /* Seek the start group in the group index instead of walking all the fragments */
+        media_ctx->current_fragment = quicrq_fragment_cache_seek_arrival(media_ctx->cache_ctx, stream_ctx->start_group_id);
         while (media_ctx->current_fragment != NULL &&
             (media_ctx->current_fragment->group_id < stream_ctx->start_group_id ||
                 (media_ctx->current_fragment->group_id == stream_ctx->start_group_id &&
@@ -758,9 +1465,30 @@ int quicrq_fragment_datagram_publisher_check_fragment(
             media_ctx->length_sent = 0;
             media_ctx->is_current_fragment_sent = 0;
             media_ctx->current_fragment = media_ctx->current_fragment->next_in_order;
-            publisher_object =
-                quicrq_fragment_publisher_object_get(media_ctx, media_ctx->current_fragment->group_id, media_ctx->current_fragment->object_id);
-            if (publisher_object == NULL) {
+            if (media_ctx->is_arrival_cursor) {
+                /* No object was dropped, only check the start point and the new objects */
+                if (media_ctx->current_fragment->group_id < stream_ctx->start_group_id ||
+                    (media_ctx->current_fragment->group_id == stream_ctx->start_group_id &&
+                        media_ctx->current_fragment->object_id < stream_ctx->start_object_id) ||
+                    media_ctx->current_fragment->group_id < media_ctx->cursor_floor_group_id ||
+                    (media_ctx->current_fragment->group_id == media_ctx->cursor_floor_group_id &&
+                        media_ctx->current_fragment->object_id < media_ctx->cursor_floor_object_id)) {
+                    /* Continue looking for the next object */
+                    media_ctx->is_current_fragment_sent = 1;
+                }
+                else {
+                    if (media_ctx->current_fragment->is_object_start) {
+                        /* This is a new object. If it is dropped, the publisher needs its own object states. */
+                        *should_skip = quicrq_evaluate_datagram_congestion(stream_ctx, media_ctx, current_time);
+                        if (*should_skip) {
+                            ret = quicrq_fragment_publisher_leave_arrival_cursor(stream_ctx, media_ctx);
+                        }
+                    }
+                    break;
+                }
+            }
+            else if ((publisher_object = quicrq_fragment_publisher_object_get(media_ctx,
+                media_ctx->current_fragment->group_id, media_ctx->current_fragment->object_id)) == NULL) {
                 /* Check whether the object is before the start of the list */
                 quicrq_fragment_publisher_object_state_t* first_object = (quicrq_fragment_publisher_object_state_t*)
                     quicrq_fragment_publisher_object_node_value(picosplay_first(&media_ctx->publisher_object_tree));
@@ -831,8 +1559,9 @@ int quicrq_fragment_datagram_publisher_object_prune(
  * - Keep track of the bytes needed:
  *   - zero if object is skipped
  *   - final offset if object is sent.
- * - Mark "sent" if all bytes sent.
+ * - Mark "sent" if all bytes sent, or if the object is skipped.
  * - if sent, check whether to prune the tree
+ * With the arrival cursor, there is no object state to update.
  */
 int quicrq_fragment_datagram_publisher_object_update(
     quicrq_fragment_publisher_context_t* media_ctx,
@@ -841,38 +1570,71 @@ int quicrq_fragment_datagram_publisher_object_update(
     size_t copied )
 {
     int ret = 0;
-    quicrq_fragment_publisher_object_state_t* publisher_object = 
-        quicrq_fragment_publisher_object_get(media_ctx, media_ctx->current_fragment->group_id, media_ctx->current_fragment->object_id);
-    if (publisher_object == NULL) {
-        publisher_object = quicrq_fragment_publisher_object_add(media_ctx,
-            media_ctx->current_fragment->group_id, media_ctx->current_fragment->object_id,
-            media_ctx->current_fragment->object_length);
-    }
-    if (publisher_object == NULL) {
-        ret = -1;
-    }
-    else {
-        /* Document object properties */
-        int is_last_fragment = (next_offset >= publisher_object->object_length);
-        publisher_object->bytes_sent += copied;
-        publisher_object->is_dropped = should_skip;
-        if (media_ctx->current_fragment->nb_objects_previous_group > 0) {
-            publisher_object->nb_objects_previous_group = media_ctx->current_fragment->nb_objects_previous_group;
-        }
-        /* Check whether fully sent.
-         * Consider special case of zero length fragments, skipped at previous network node.
-         */
-        if ((is_last_fragment && copied >= next_offset) ||
-            publisher_object->bytes_sent >= publisher_object->object_length) {
-            publisher_object->is_sent = 1;
-            ret = quicrq_fragment_datagram_publisher_object_prune(media_ctx);
+    quicrq_fragment_publisher_object_state_t* publisher_object = NULL;
+
+    /* With the arrival cursor, the object states are documented in the cached fragments */
+    if (!media_ctx->is_arrival_cursor) {
+        publisher_object = 
+            quicrq_fragment_publisher_object_get(media_ctx, media_ctx->current_fragment->group_id, media_ctx->current_fragment->object_id);
+        if (publisher_object == NULL) {
+            publisher_object = quicrq_fragment_publisher_object_add(media_ctx,
+                media_ctx->current_fragment->group_id, media_ctx->current_fragment->object_id,
+                media_ctx->current_fragment->object_length);
+        }
+        if (publisher_object == NULL) {
+            ret = -1;
+        }
+        else {
+            /* Document object properties */
+            int is_last_fragment = (next_offset >= publisher_object->object_length);
+            publisher_object->bytes_sent += copied;
+            publisher_object->is_dropped = should_skip;
+            if (media_ctx->current_fragment->nb_objects_previous_group > 0) {
+                publisher_object->nb_objects_previous_group = media_ctx->current_fragment->nb_objects_previous_group;
+            }
+            /* Check whether fully sent.
+             * Consider special case of zero length fragments, skipped at previous network node.
+             * A dropped object is also done: once it is pruned, its other fragments are
+             * before the start of the list, and are skipped.
+             */
+            if (should_skip || (is_last_fragment && copied >= next_offset) ||
+                publisher_object->bytes_sent >= publisher_object->object_length) {
+                publisher_object->is_sent = 1;
+                ret = quicrq_fragment_datagram_publisher_object_prune(media_ctx);
+                if (ret == 0 && !should_skip) {
+                    quicrq_fragment_publisher_join_arrival_cursor(media_ctx);
+                }
+            }
         }
     }
 
     return ret;
 }
 
-/* Send the next fragment, or a placeholder if the object shall be skipped. 
+/* Size of the datagram fragments for a media stream.
+ * The sender uses the smaller of the fragment size of the context and the one
+ * asked by the receiver, or 0 if none is set.
+ */
+static size_t quicrq_fragment_datagram_size(quicrq_stream_ctx_t* stream_ctx)
+{
+    size_t fragment_size = 0;
+
+    if (stream_ctx != NULL) {
+        fragment_size = stream_ctx->cnx_ctx->qr_ctx->fragment_size;
+        if (fragment_size == 0 || (stream_ctx->fragment_size != 0 && stream_ctx->fragment_size < fragment_size)) {
+            fragment_size = stream_ctx->fragment_size;
+        }
+    }
+    return fragment_size;
+}
+
+/* Send the next fragment, or a placeholder if the object shall be skipped.
+ * When coalescing, the fragment is appended to the coalesced datagram, with
+ * its length after the header. A fragment is only split if it is the first
+ * one in the datagram, so that small objects are not cut in pieces to fill
+ * the end of a datagram. If a fragment size is set, fragments are also cut
+ * at the multiples of that size from the start of the object, so that cached
+ * fragments that are already aligned are sent unchanged.
  */
 int quicrq_fragment_datagram_publisher_send_fragment(
     quicrq_stream_ctx_t* stream_ctx,
@@ -880,6 +1642,7 @@ int quicrq_fragment_datagram_publisher_send_fragment(
     uint64_t media_id,
     void* context,
     size_t space,
+    quicrq_datagram_coalescing_t* coalescing,
     int* media_was_sent,
     int* at_least_one_active,
     int should_skip)
@@ -890,10 +1653,26 @@ int quicrq_fragment_datagram_publisher_send_fragment(
     uint8_t flags = (should_skip) ? 0xff : media_ctx->current_fragment->flags;
     uint64_t object_length = (should_skip) ? 0 : media_ctx->current_fragment->object_length;
     size_t h_size = 0;
-    uint8_t* h_byte = quicrq_datagram_header_encode(datagram_header, datagram_header + QUICRQ_DATAGRAM_HEADER_MAX,
+    /* Room for the length of the fragment, which is always below 16384 in a datagram */
+    size_t l_size = (coalescing == NULL) ? 0 : 2;
+    size_t fragment_size = quicrq_fragment_datagram_size(stream_ctx);
+    /* With compact headers, the object length is implied in the last fragment
+     * of an object. The header is first encoded with the length, and encoded
+     * again without it once the number of bytes sent is known. */
+    uint8_t* h_byte = quicrq_datagram_stream_header_encode(stream_ctx, datagram_header, datagram_header + QUICRQ_DATAGRAM_HEADER_MAX,
         media_id, media_ctx->current_fragment->group_id, media_ctx->current_fragment->object_id, offset,
         media_ctx->current_fragment->queue_delay, flags, media_ctx->current_fragment->nb_objects_previous_group,
-        object_length);
+        object_length, 0);
+
+    if (coalescing != NULL) {
+        space = coalescing->space - coalescing->length;
+    }
+    if (stream_ctx != NULL && quicrq_fec_window(stream_ctx) > 0 &&
+        space > QUICRQ_FEC_RECORD_MAX + l_size) {
+        /* Leave room for the FEC header in the parity datagram */
+        space = QUICRQ_FEC_RECORD_MAX + l_size;
+    }
+
     if (h_byte == NULL) {
         /* Should never happen. */
         ret = -1;
@@ -901,55 +1680,114 @@ int quicrq_fragment_datagram_publisher_send_fragment(
     else {
         h_size = h_byte - datagram_header;
 
-        if (h_size > space) {
+        if (h_size + l_size > space) {
             /* TODO: should get a min encoding length per stream */
             /* Can't do anything there */
             *at_least_one_active = 1;
+            if (coalescing != NULL) {
+                coalescing->is_full = 1;
+            }
         }
         else {
             size_t available = 0;
             size_t copied = 0; 
+            int should_defer = 0;
             if (!should_skip && media_ctx->current_fragment->data_length > 0) {
                 /* If we are not skipping this object, compute the exact number of bytes to be sent.
                  * Encode the header again if something changed, e.g., last fragment bit. 
                  */
                 available = media_ctx->current_fragment->data_length - media_ctx->length_sent;
-                copied = space - h_size;
+                if (fragment_size > 0 && available > fragment_size - (offset % fragment_size)) {
+                    /* Stop at the next fragment boundary, counted from the start of the object */
+                    available = fragment_size - (offset % fragment_size);
+                }
+                copied = space - h_size - l_size;
                 if (copied >= available) {
                     copied = available;
                 }
+                else if (coalescing != NULL && coalescing->nb_fragments > 0) {
+                    /* Leave the fragment for the next datagram */
+                    should_defer = 1;
+                    coalescing->is_full = 1;
+                    *at_least_one_active = 1;
+                }
+            }
+            if (!should_defer && (copied > 0 || should_skip || media_ctx->current_fragment->data_length == 0) &&
+                stream_ctx != NULL && stream_ctx->datagram_header_format == quicrq_datagram_header_compact &&
+                offset + copied >= object_length) {
+                h_byte = quicrq_datagram_stream_header_encode(stream_ctx, datagram_header, datagram_header + QUICRQ_DATAGRAM_HEADER_MAX,
+                    media_id, media_ctx->current_fragment->group_id, media_ctx->current_fragment->object_id, offset,
+                    media_ctx->current_fragment->queue_delay, flags, media_ctx->current_fragment->nb_objects_previous_group,
+                    object_length, 1);
+                if (h_byte == NULL) {
+                    ret = -1;
+                }
+                else {
+                    h_size = h_byte - datagram_header;
+                }
             }
-            if (copied > 0 || should_skip || media_ctx->current_fragment->data_length == 0){
+            if (ret == 0 && !should_defer && (copied > 0 || should_skip || media_ctx->current_fragment->data_length == 0)){
                 /* Get a buffer inside the datagram packet */
-                void* buffer = picoquic_provide_datagram_buffer(context, copied + h_size);
+                uint8_t* buffer = NULL;
+                if (coalescing == NULL) {
+                    buffer = (uint8_t*)picoquic_provide_datagram_buffer(context, copied + h_size);
+                }
+                else {
+                    uint8_t* bytes_max = coalescing->bytes + coalescing->space;
+                    uint8_t* l_byte = coalescing->bytes + coalescing->length + h_size;
+                    if ((buffer = picoquic_frames_varint_encode(l_byte, bytes_max, copied)) != NULL) {
+                        l_size = buffer - l_byte;
+                        buffer = coalescing->bytes + coalescing->length;
+                        coalescing->length += h_size + l_size + copied;
+                        coalescing->nb_fragments++;
+                    }
+                }
                 if (buffer == NULL) {
                     ret = -1;
                 }
                 else {
                     /* Push the header */
                     if (ret == 0) {
+                        const uint8_t* sent_data = media_ctx->current_fragment->data + media_ctx->length_sent;
                         memcpy(buffer, datagram_header, h_size);
                         /* Get the media */
                         if (copied > 0) {
-                            memcpy(((uint8_t*)buffer) + h_size, media_ctx->current_fragment->data + media_ctx->length_sent, copied);
+                            memcpy(buffer + h_size + l_size, sent_data, copied);
                             media_ctx->length_sent += copied;
                         }
                         media_ctx->is_current_fragment_sent |= (should_skip || media_ctx->length_sent >= media_ctx->current_fragment->data_length);
                         *media_was_sent = 1;
                         *at_least_one_active = 1;
                         if (stream_ctx != NULL) {
+                            uint64_t current_time = picoquic_get_quic_time(stream_ctx->cnx_ctx->qr_ctx->quic);
                             /* Keep track in stream context */
+                            if (should_skip) {
+                                stream_ctx->counters.media.objects_dropped++;
+                            }
+                            else {
+                                quicrq_media_counters_fragment_sent(&stream_ctx->counters, copied,
+                                    offset + copied >= media_ctx->current_fragment->object_length);
+                                if (current_time > media_ctx->current_fragment->cache_time) {
+                                    quicrq_hop_latency_record(media_ctx->cache_ctx, quicrq_hop_latency_cache_to_send,
+                                        current_time - media_ctx->current_fragment->cache_time);
+                                }
+                            }
                             ret = quicrq_datagram_ack_init(stream_ctx,
                                 media_ctx->current_fragment->group_id,
                                 media_ctx->current_fragment->object_id, offset, flags,
                                 media_ctx->current_fragment->nb_objects_previous_group,
-                                ((uint8_t*)buffer) + h_size, copied,
-                                media_ctx->current_fragment->queue_delay, 
-                                media_ctx->current_fragment->object_length, NULL,
-                                picoquic_get_quic_time(stream_ctx->cnx_ctx->qr_ctx->quic));
+                                sent_data, copied,
+                                media_ctx->current_fragment->buffer, media_ctx->current_fragment->queue_delay,
+                                media_ctx->current_fragment->object_length, NULL, current_time);
                             if (ret != 0) {
                                 DBG_PRINTF("Datagram ack init returns %d", ret);
                             }
+                            else if (quicrq_fec_window(stream_ctx) > 0) {
+                                ret = quicrq_fec_encoder_add(stream_ctx, media_ctx->current_fragment->group_id,
+                                    media_ctx->current_fragment->object_id, offset, flags,
+                                    media_ctx->current_fragment->nb_objects_previous_group, object_length,
+                                    sent_data, copied);
+                            }
                         }
                         if (ret == 0) {
                             ret = quicrq_fragment_datagram_publisher_object_update(media_ctx,
@@ -970,6 +1808,7 @@ int quicrq_fragment_datagram_publisher_prepare(
     uint64_t media_id,
     void* context,
     size_t space,
+    quicrq_datagram_coalescing_t* coalescing,
     int* media_was_sent,
     int* at_least_one_active,
     int* not_ready,
@@ -985,14 +1824,19 @@ int quicrq_fragment_datagram_publisher_prepare(
     /* Evaluate fragment and congestion */
     ret = quicrq_fragment_datagram_publisher_check_fragment(stream_ctx, media_ctx, &should_skip, current_time);
 
-    if (ret != 0 || media_ctx->current_fragment == NULL || media_ctx->is_current_fragment_sent) {
+    if (ret != 0 || media_ctx->current_fragment == NULL || media_ctx->is_current_fragment_sent ||
+        (media_ctx->length_sent == 0 && !should_skip &&
+            quicrq_fragment_publisher_catch_up_hold(media_ctx, media_ctx->current_fragment->object, current_time))) {
         *not_ready = 1;
     }
     else  {
         /* Then send the object */
         if (ret == 0) {
             ret = quicrq_fragment_datagram_publisher_send_fragment(stream_ctx, media_ctx, media_id,
-                context, space, media_was_sent, at_least_one_active, should_skip);
+                context, space, coalescing, media_was_sent, at_least_one_active, should_skip);
+            if (*media_was_sent) {
+                media_ctx->cache_ctx->last_read_time = current_time;
+            }
         }
     }
     return ret;
@@ -1002,6 +1846,7 @@ int quicrq_fragment_datagram_publisher_fn(
     quicrq_stream_ctx_t* stream_ctx,
     void* context,
     size_t space,
+    quicrq_datagram_coalescing_t* coalescing,
     int* media_was_sent,
     int* at_least_one_active,
     uint64_t current_time)
@@ -1014,7 +1859,7 @@ int quicrq_fragment_datagram_publisher_fn(
      * which helps designing unit tests.
      */
     ret = quicrq_fragment_datagram_publisher_prepare(stream_ctx, media_ctx,
-        stream_ctx->media_id, context, space, media_was_sent, at_least_one_active, &not_ready, current_time);
+        stream_ctx->media_id, context, space, coalescing, media_was_sent, at_least_one_active, &not_ready, current_time);
 
     if (not_ready){
         /* Nothing to send at this point. If the media sending is finished, mark the stream accordingly.
@@ -1030,8 +1875,10 @@ int quicrq_fragment_datagram_publisher_fn(
             /* Mark the stream as finished, prepare sending a final message */
             stream_ctx->final_group_id = media_ctx->cache_ctx->final_group_id;
             stream_ctx->final_object_id = media_ctx->cache_ctx->final_object_id;
+            /* Protect the last fragments */
+            ret = quicrq_fec_encoder_flush(stream_ctx);
             /* Wake up the control stream so the final message can be sent. */
-            picoquic_mark_active_stream(stream_ctx->cnx_ctx->cnx, stream_ctx->stream_id, 1, stream_ctx);
+            (void)quicrq_mark_control_stream_active(stream_ctx);
             stream_ctx->is_active_datagram = 0;
         }
     }
@@ -1055,19 +1902,12 @@ void quicrq_fragment_notify_final_to_control(quicrq_fragment_cache_t* cache_ctx,
 /* Check whether the number of objects in the next group is known */
 uint64_t quicrq_fragment_get_object_count(quicrq_fragment_cache_t* cache_ctx, uint64_t group_id)
 {
-    /* Find whether the next object is in cache */
-    quicrq_cached_fragment_t key = { 0 };
-    picosplay_node_t* fragment_node;
+    /* Find whether the first fragment of the next group is in cache */
     uint64_t nb_objects = 0;
-    key.group_id = group_id + 1;
-    key.object_id = 0;
-    key.offset = 0;
-    fragment_node = picosplay_find(&cache_ctx->fragment_tree, &key);
+    quicrq_cached_object_t* object = quicrq_fragment_cache_get_object(cache_ctx, group_id + 1, 0);
 
-    if (fragment_node != NULL) {
-        quicrq_cached_fragment_t* fragment_state =
-            (quicrq_cached_fragment_t*)quicrq_fragment_cache_node_value(fragment_node);
-        nb_objects = fragment_state->nb_objects_previous_group;
+    if (object != NULL && object->first_fragment != NULL) {
+        nb_objects = object->nb_objects_previous_group;
     }
     return nb_objects;
 }
@@ -1075,17 +1915,11 @@ uint64_t quicrq_fragment_get_object_count(quicrq_fragment_cache_t* cache_ctx, ui
 /* Get the object flags, or zero if the object is not available*/
 uint8_t quicrq_fragment_get_flags(quicrq_fragment_cache_t* cache_ctx, uint64_t group_id, uint64_t object_id)
 {
-    quicrq_cached_fragment_t key = { 0 };
-    picosplay_node_t* fragment_node;
     uint8_t flags = 0;
-    key.group_id = group_id;
-    key.object_id = object_id;
-    key.offset = 0;
-    fragment_node = picosplay_find(&cache_ctx->fragment_tree, &key);
-    if (fragment_node != NULL) {
-        quicrq_cached_fragment_t* fragment_state =
-            (quicrq_cached_fragment_t*)quicrq_fragment_cache_node_value(fragment_node);
-        flags = fragment_state->flags;
+    quicrq_cached_object_t* object = quicrq_fragment_cache_get_object(cache_ctx, group_id, object_id);
+
+    if (object != NULL && object->first_fragment != NULL) {
+        flags = object->flags;
     }
     return flags;
 }
@@ -1097,49 +1931,59 @@ int quicrq_fragment_get_object_properties(quicrq_fragment_cache_t* cache_ctx, ui
     size_t* object_length, uint64_t* nb_objects_previous_group, uint8_t* flags)
 {
     int ret = -1;
-    quicrq_cached_fragment_t key = { 0 };
-    picosplay_node_t* fragment_node;
-    key.group_id = group_id;
-    key.object_id = object_id;
-    key.offset = 0;
-    fragment_node = picosplay_find(&cache_ctx->fragment_tree, &key);
-    if (fragment_node != NULL) {
-        quicrq_cached_fragment_t* fragment_state =
-            (quicrq_cached_fragment_t*)quicrq_fragment_cache_node_value(fragment_node);
+    quicrq_cached_object_t* object = quicrq_fragment_cache_get_object(cache_ctx, group_id, object_id);
+
+    if (object != NULL && object->first_fragment != NULL) {
         ret = 0;
-        *object_length = fragment_state->object_length;
-        *nb_objects_previous_group = fragment_state->nb_objects_previous_group;
-        *flags = fragment_state->flags;
+        *object_length = (size_t)object->object_length;
+        *nb_objects_previous_group = object->nb_objects_previous_group;
+        *flags = object->flags;
     }
     return ret;
 }
 
-size_t quicrq_fragment_object_copy_available_data(quicrq_fragment_cache_t* cache_ctx, 
+size_t quicrq_fragment_object_copy_available_data(quicrq_fragment_cache_t* cache_ctx, quicrq_fragment_cursor_t* cursor,
     uint64_t group_id, uint64_t object_id, size_t offset, size_t available, uint8_t* buffer)
 {
     size_t fragment_size = 0;
-    uint64_t current_offset = 0;
     picosplay_node_t* fragment_node = NULL;
-    /* find the fragment tree for the group/object */
-    /* TODO: should start the lookup at the current offset. */
-    quicrq_cached_fragment_t key = { 0 };
-    key.group_id = group_id;
-    key.object_id = object_id;
-    key.offset = 0;
-    fragment_node = picosplay_find(&cache_ctx->fragment_tree, &key);
+    int is_cursor_valid = (cursor != NULL && cursor->fragment != NULL &&
+        cursor->nb_fragments_deleted == cache_ctx->nb_fragments_deleted &&
+        cursor->fragment->group_id == group_id && cursor->fragment->object_id == object_id);
+    /* A valid cursor also spares the search of the object */
+    quicrq_cached_object_t* object = (is_cursor_valid) ? cursor->fragment->object :
+        quicrq_fragment_cache_get_object(cache_ctx, group_id, object_id);
+
+    /* Only the data received in sequence from the beginning of the object is available */
+    if (object != NULL && object->contiguous_length > offset) {
+        if (object->contiguous_length - offset < available) {
+            available = (size_t)(object->contiguous_length - offset);
+        }
+        if (is_cursor_valid && cursor->fragment->offset <= offset) {
+            /* Resume at the fragment where the previous copy stopped */
+            fragment_node = &cursor->fragment->fragment_node;
+        }
+        else {
+            /* Find the fragment that contains the offset */
+            quicrq_cached_fragment_t key = { 0 };
+            key.group_id = group_id;
+            key.object_id = object_id;
+            key.offset = offset;
+            fragment_node = picosplay_find_previous(&cache_ctx->fragment_tree, &key);
+        }
+    }
 
     while (fragment_node != NULL && fragment_size < available) {
         quicrq_cached_fragment_t* fragment_state =
             (quicrq_cached_fragment_t*)quicrq_fragment_cache_node_value(fragment_node);
-        if (fragment_state->group_id != group_id || 
-            fragment_state->object_id != object_id ||
-            fragment_state->offset != current_offset) {
+        uint64_t current_offset = offset + fragment_size;
+        if (fragment_state->object != object || fragment_state->offset > current_offset) {
             /* Next fragment in order is not what we expect, so stop there */
             break;
         }
         /* compute the object size and fill the passed in buffer, if non-null */
-        if (current_offset + fragment_state->data_length > offset) {
-            size_t offset_offset = (current_offset < offset) ? offset - current_offset : 0;
+        if (fragment_state->offset + fragment_state->data_length > current_offset) {
+            size_t offset_offset = (size_t)(current_offset - fragment_state->offset);
             size_t copied = fragment_state->data_length - offset_offset;
             if (fragment_size + copied > available) {
                 copied = available - fragment_size;
@@ -1149,7 +1993,10 @@ size_t quicrq_fragment_object_copy_available_data(quicrq_fragment_cache_t* cache
             }
             fragment_size += copied;
         }
-        current_offset += fragment_state->data_length;
+        if (cursor != NULL) {
+            cursor->fragment = fragment_state;
+            cursor->nb_fragments_deleted = cache_ctx->nb_fragments_deleted;
+        }
         fragment_node = picosplay_next(fragment_node);
     }
 
@@ -1193,7 +2040,7 @@ size_t quicrq_fragment_object_copy(quicrq_fragment_cache_t* cache_ctx, uint64_t
         /* compute the object size and fill the passed in buffer, if non-null*/
         object_size += fragment_state->data_length;
         if (buffer != NULL) {
-            memcpy(buffer, fragment_state->data + current_offset, fragment_state->data_length);
+            memcpy(buffer + current_offset, fragment_state->data, fragment_state->data_length);
         }
         current_offset += fragment_state->data_length;
 
@@ -1216,6 +2063,7 @@ void* quicrq_fragment_publisher_subscribe(quicrq_fragment_cache_t* cache_ctx, qu
         memset(media_ctx, 0, sizeof(quicrq_fragment_publisher_context_t));
         media_ctx->stream_ctx = stream_ctx;
         media_ctx->cache_ctx = cache_ctx;
+        media_ctx->qr_ctx = stream_ctx->cnx_ctx->qr_ctx;
         media_ctx->congestion_control_mode = stream_ctx->cnx_ctx->qr_ctx->congestion_control_mode;
         if (stream_ctx != NULL) {
             stream_ctx->start_group_id = cache_ctx->first_group_id;
@@ -1226,6 +2074,12 @@ void* quicrq_fragment_publisher_subscribe(quicrq_fragment_cache_t* cache_ctx, qu
         picosplay_init_tree(&media_ctx->publisher_object_tree, quicrq_fragment_publisher_object_node_compare,
             quicrq_fragment_publisher_object_node_create, quicrq_fragment_publisher_object_node_delete,
             quicrq_fragment_publisher_object_node_value);
+        if (media_ctx->qr_ctx->is_arrival_cursor_enabled) {
+            media_ctx->is_arrival_cursor_allowed = 1;
+            media_ctx->is_arrival_cursor = 1;
+            cache_ctx->nb_arrival_cursors++;
+        }
+        quicrq_timer_init(&media_ctx->catch_up_timer, quicrq_timer_catch_up);
     }
     return media_ctx;
 }
@@ -1233,8 +2087,7 @@ void* quicrq_fragment_publisher_subscribe(quicrq_fragment_cache_t* cache_ctx, qu
 void quicrq_fragment_publisher_delete(void* v_pub_ctx)
 {
     quicrq_fragment_cache_t* cache_ctx = (quicrq_fragment_cache_t*)v_pub_ctx;
-    quicrq_fragment_cache_media_clear(cache_ctx);
-    free(cache_ctx);
+    quicrq_fragment_cache_delete_ctx(cache_ctx);
 }
 
 int quicrq_publish_fragment_cached_media(quicrq_ctx_t* qr_ctx,
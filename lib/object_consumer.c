@@ -121,6 +121,14 @@ int quicrq_media_object_bridge_ready(
         /* Deliver to the application, update the counters */
         quicrq_object_stream_consumer_properties_t properties = { 0 };
         properties.flags = flags;
+        if (bridge_ctx->reassembly_ctx.use_fragment_views) {
+            /* Pass the fragments in place. The data is only contiguous if there is a single fragment. */
+            properties.nb_fragments = bridge_ctx->reassembly_ctx.nb_views;
+            properties.fragments = bridge_ctx->reassembly_ctx.views;
+            if (properties.nb_fragments > 1) {
+                data = NULL;
+            }
+        }
         bridge_ctx->next_group_id = group_id;
         bridge_ctx->next_object_id = object_id + 1;
         ret = bridge_ctx->object_stream_consumer_fn(
@@ -193,23 +201,33 @@ int quicrq_media_object_bridge_fn(
 }
 
 /* Subscribe object stream. */
-quicrq_object_stream_consumer_ctx* quicrq_subscribe_object_stream(quicrq_cnx_ctx_t* cnx_ctx,
-    const uint8_t* url, size_t url_length, quicrq_transport_mode_enum transport_mode,
-    quicrq_subscribe_order_enum order_required, quicrq_subscribe_intent_t * intent,
+static quicrq_object_stream_consumer_ctx* quicrq_object_stream_consumer_create(quicrq_cnx_ctx_t* cnx_ctx,
+    quicrq_subscribe_order_enum order_required,
     quicrq_object_stream_consumer_fn object_stream_consumer_fn, void* object_stream_consumer_ctx)
 {
     quicrq_object_stream_consumer_ctx* bridge_ctx = (quicrq_object_stream_consumer_ctx*)malloc(sizeof(quicrq_object_stream_consumer_ctx));
     if (bridge_ctx != NULL) {
-        int ret;
-
         memset(bridge_ctx, 0, sizeof(quicrq_object_stream_consumer_ctx));
         bridge_ctx->qr_ctx = cnx_ctx->qr_ctx;
         bridge_ctx->object_stream_consumer_fn = object_stream_consumer_fn;
         bridge_ctx->object_stream_consumer_ctx = object_stream_consumer_ctx;
         bridge_ctx->order_required = order_required;
         quicrq_reassembly_init(&bridge_ctx->reassembly_ctx);
+        bridge_ctx->reassembly_ctx.qr_ctx = cnx_ctx->qr_ctx;
+    }
+    return bridge_ctx;
+}
+
+quicrq_object_stream_consumer_ctx* quicrq_subscribe_object_stream(quicrq_cnx_ctx_t* cnx_ctx,
+    const uint8_t* url, size_t url_length, quicrq_transport_mode_enum transport_mode,
+    quicrq_subscribe_order_enum order_required, quicrq_subscribe_intent_t * intent,
+    quicrq_object_stream_consumer_fn object_stream_consumer_fn, void* object_stream_consumer_ctx)
+{
+    quicrq_object_stream_consumer_ctx* bridge_ctx = quicrq_object_stream_consumer_create(cnx_ctx, order_required,
+        object_stream_consumer_fn, object_stream_consumer_ctx);
+    if (bridge_ctx != NULL) {
         /* Create a media context for the stream */
-        ret = quicrq_cnx_subscribe_media_ex(cnx_ctx, url, url_length, transport_mode, intent,
+        int ret = quicrq_cnx_subscribe_media_ex(cnx_ctx, url, url_length, transport_mode, intent,
             quicrq_media_object_bridge_fn, bridge_ctx, &bridge_ctx->stream_ctx);
         if (ret != 0) {
             free(bridge_ctx);
@@ -220,13 +238,75 @@ quicrq_object_stream_consumer_ctx* quicrq_subscribe_object_stream(quicrq_cnx_ctx
      return bridge_ctx;
 }
 
+/* Subscribe to several media with a single batch request. The media are received
+ * as datagrams. One consumer context is created per media, and returned in subscribe_ctx.
+ */
+int quicrq_subscribe_object_stream_batch(quicrq_cnx_ctx_t* cnx_ctx, size_t nb_media,
+    const uint8_t** url, const size_t* url_length,
+    quicrq_subscribe_order_enum order_required, quicrq_subscribe_intent_t* intent,
+    quicrq_object_stream_consumer_fn object_stream_consumer_fn, void** object_stream_consumer_ctx,
+    quicrq_object_stream_consumer_ctx** subscribe_ctx)
+{
+    int ret = 0;
+    void** bridge_list = (nb_media > 0) ? (void**)malloc(nb_media * sizeof(void*)) : NULL;
+    quicrq_stream_ctx_t** track_list = (nb_media > 0) ? (quicrq_stream_ctx_t**)malloc(nb_media * sizeof(quicrq_stream_ctx_t*)) : NULL;
+    size_t nb_created = 0;
+
+    if (bridge_list == NULL || track_list == NULL) {
+        ret = -1;
+    }
+    while (ret == 0 && nb_created < nb_media) {
+        if ((bridge_list[nb_created] = quicrq_object_stream_consumer_create(cnx_ctx, order_required,
+            object_stream_consumer_fn, object_stream_consumer_ctx[nb_created])) == NULL) {
+            ret = -1;
+        }
+        else {
+            nb_created++;
+        }
+    }
+    if (ret == 0) {
+        ret = quicrq_cnx_subscribe_media_batch(cnx_ctx, nb_media, url, url_length, intent,
+            quicrq_media_object_bridge_fn, bridge_list, track_list);
+    }
+    for (size_t i = 0; i < nb_created; i++) {
+        quicrq_object_stream_consumer_ctx* bridge_ctx = (quicrq_object_stream_consumer_ctx*)bridge_list[i];
+        if (ret == 0) {
+            bridge_ctx->stream_ctx = track_list[i];
+            subscribe_ctx[i] = bridge_ctx;
+        }
+        else {
+            free(bridge_ctx);
+        }
+    }
+    if (bridge_list != NULL) {
+        free(bridge_list);
+    }
+    if (track_list != NULL) {
+        free(track_list);
+    }
+    return ret;
+}
+
+void quicrq_object_stream_set_fragment_views(quicrq_object_stream_consumer_ctx* bridge_ctx, int use_fragment_views)
+{
+    bridge_ctx->reassembly_ctx.use_fragment_views = (use_fragment_views) ? 1 : 0;
+}
+
+int quicrq_object_stream_set_feedback(quicrq_object_stream_consumer_ctx* bridge_ctx, uint8_t max_flags, uint64_t target_bitrate)
+{
+    return quicrq_stream_set_feedback(bridge_ctx->stream_ctx, max_flags, target_bitrate);
+}
+
+/* Unsubscribe. If the media is a track of a batch, the context of the track
+ * is deleted and the server is asked to close that track, see quicrq_delete_stream_ctx.
+ * The bridge context is freed when the stream context is deleted.
+ */
 void quicrq_unsubscribe_object_stream(quicrq_object_stream_consumer_ctx* bridge_ctx)
 {
+    quicrq_stream_ctx_t* stream_ctx = bridge_ctx->stream_ctx;
 
-    if (bridge_ctx->stream_ctx->close_reason == quicrq_media_close_reason_unknown) {
-        bridge_ctx->stream_ctx->close_reason = quicrq_media_close_local_application;
+    if (stream_ctx->close_reason == quicrq_media_close_reason_unknown) {
+        stream_ctx->close_reason = quicrq_media_close_local_application;
     }
-    quicrq_delete_stream_ctx(bridge_ctx->stream_ctx->cnx_ctx, bridge_ctx->stream_ctx);
-    bridge_ctx->object_stream_consumer_fn = NULL;
-    bridge_ctx->object_stream_consumer_ctx = NULL;
+    quicrq_delete_stream_ctx(stream_ctx->cnx_ctx, stream_ctx);
 }
@@ -24,6 +24,7 @@ quicrq_media_object_source_ctx_t* quicrq_publish_object_source(quicrq_ctx_t* qr_
 
         memset(object_source_ctx, 0, sizeof(quicrq_media_object_source_ctx_t));
         object_source_ctx->qr_ctx = qr_ctx;
+        quicrq_mpsc_queue_init(&object_source_ctx->publish_queue.queue);
         /* Add to double linked list of sources for context */
         if (qr_ctx->last_object_source == NULL) {
             qr_ctx->first_object_source = object_source_ctx;
@@ -38,6 +39,12 @@ quicrq_media_object_source_ctx_t* quicrq_publish_object_source(quicrq_ctx_t* qr_
         if (properties != NULL) {
             memcpy(&object_source_ctx->properties, properties, sizeof(quicrq_media_object_source_properties_t));
         }
+        if (object_source_ctx->properties.fragment_size == 0) {
+            object_source_ctx->properties.fragment_size = qr_ctx->fragment_size;
+        }
+        else if (object_source_ctx->properties.fragment_size > QUICRQ_FRAGMENT_SIZE_MAX) {
+            object_source_ctx->properties.fragment_size = QUICRQ_FRAGMENT_SIZE_MAX;
+        }
         /* create and initialize fragment cache, publish the corresponding source,
         * then publish the corresponding source.
         */
@@ -71,8 +78,52 @@ quicrq_media_object_source_ctx_t* quicrq_publish_object_source(quicrq_ctx_t* qr_
     return(object_source_ctx);
 }
 
-int quicrq_publish_object(
+/* Add an object to the cache in fragments of at most fragment_size bytes, starting
+ * at the beginning of the object. The object is copied once, and the fragments
+ * point into the same buffer.
+ */
+static int quicrq_publish_object_fragments(
     quicrq_media_object_source_ctx_t* object_source_ctx,
+    quicrq_fragment_buffer_t* shared_buffer,
+    uint8_t* object_data,
+    size_t object_length,
+    uint8_t flags,
+    uint64_t nb_objects_previous_group,
+    size_t fragment_size,
+    uint64_t current_time)
+{
+    int ret = 0;
+    quicrq_fragment_buffer_t* buffer = shared_buffer;
+    const uint8_t* data = object_data;
+
+    if (buffer == NULL) {
+        if ((buffer = quicrq_fragment_buffer_create(object_source_ctx->qr_ctx, object_data, object_length)) == NULL) {
+            ret = -1;
+        }
+        else {
+            data = buffer->data;
+        }
+    }
+    for (size_t offset = 0; ret == 0 && offset < object_length; offset += fragment_size) {
+        size_t data_length = (object_length - offset > fragment_size) ? fragment_size : object_length - offset;
+        /* The number of objects in the previous group is only used on the first fragment */
+        ret = quicrq_fragment_propose_buffer_to_cache(object_source_ctx->cache_ctx, buffer,
+            data + offset, object_source_ctx->next_group_id, object_source_ctx->next_object_id,
+            offset, /* queue delay */ 0, flags, (offset == 0) ? nb_objects_previous_group : 0,
+            object_length, data_length, current_time);
+    }
+    if (shared_buffer == NULL) {
+        /* The fragments hold their own references */
+        quicrq_fragment_buffer_release(buffer);
+    }
+    return ret;
+}
+
+/* Publish an object, copying it or, if a shared buffer is provided, keeping a reference to it.
+ */
+static int quicrq_publish_object_buffer(
+    quicrq_media_object_source_ctx_t* object_source_ctx,
+    quicrq_fragment_buffer_t* shared_buffer,
     uint8_t* object_data,
     size_t object_length,
     quicrq_media_object_properties_t* properties,
@@ -100,10 +151,18 @@ int quicrq_publish_object(
     }
 
     if (ret == 0) {
-        ret = quicrq_fragment_propose_to_cache(object_source_ctx->cache_ctx,
-            object_data, object_source_ctx->next_group_id, object_source_ctx->next_object_id,
-            /* offset */ 0, /* queue delay */ 0, properties->flags, nb_objects_previous_group,
-            object_length, object_length, current_time);
+        size_t fragment_size = object_source_ctx->properties.fragment_size;
+
+        if (fragment_size == 0 || object_length <= fragment_size) {
+            ret = quicrq_fragment_propose_buffer_to_cache(object_source_ctx->cache_ctx, shared_buffer,
+                object_data, object_source_ctx->next_group_id, object_source_ctx->next_object_id,
+                /* offset */ 0, /* queue delay */ 0, properties->flags, nb_objects_previous_group,
+                object_length, object_length, current_time);
+        }
+        else {
+            ret = quicrq_publish_object_fragments(object_source_ctx, shared_buffer, object_data, object_length,
+                properties->flags, nb_objects_previous_group, fragment_size, current_time);
+        }
         if (ret == 0) {
             object_source_ctx->next_object_id++;
         }
@@ -111,6 +170,50 @@ int quicrq_publish_object(
     return ret;
 }
 
+int quicrq_publish_object(
+    quicrq_media_object_source_ctx_t* object_source_ctx,
+    uint8_t* object_data,
+    size_t object_length,
+    quicrq_media_object_properties_t* properties,
+    uint64_t group_id,
+    uint64_t object_id)
+{
+    return quicrq_publish_object_buffer(object_source_ctx, NULL, object_data, object_length,
+        properties, group_id, object_id);
+}
+
+int quicrq_publish_object_ex(
+    quicrq_media_object_source_ctx_t* object_source_ctx,
+    uint8_t* object_data,
+    size_t object_length,
+    quicrq_media_object_properties_t* properties,
+    uint64_t group_id,
+    uint64_t object_id,
+    quicrq_object_release_fn release_fn,
+    void* release_ctx)
+{
+    int ret = 0;
+    quicrq_fragment_buffer_t* buffer = NULL;
+
+    if (release_fn == NULL) {
+        /* The object could never be returned to the application */
+        ret = -1;
+    }
+    else if ((buffer = quicrq_fragment_buffer_create_external(object_source_ctx->qr_ctx,
+        object_data, object_length, release_fn, release_ctx)) == NULL) {
+        release_fn(release_ctx, object_data, object_length);
+        ret = -1;
+    }
+    else {
+        ret = quicrq_publish_object_buffer(object_source_ctx, buffer, object_data, object_length,
+            properties, group_id, object_id);
+        /* The cache holds its own reference. If the object was not
+         * published, this calls the release function. */
+        quicrq_fragment_buffer_release(buffer);
+    }
+    return ret;
+}
+
 void quicrq_publish_object_fin(quicrq_media_object_source_ctx_t* object_source_ctx)
 {
     /* Document the final group-ID and object-ID in context */
@@ -118,8 +221,171 @@ void quicrq_publish_object_fin(quicrq_media_object_source_ctx_t* object_source_c
         object_source_ctx->next_group_id, object_source_ctx->next_object_id);
 }
 
+/* Multiple producers, single consumer queue.
+ */
+void quicrq_mpsc_queue_init(quicrq_mpsc_queue_t* queue)
+{
+    queue->stub.next = NULL;
+    queue->head = &queue->stub;
+    queue->tail = &queue->stub;
+}
+
+void quicrq_mpsc_queue_push(quicrq_mpsc_queue_t* queue, quicrq_mpsc_node_t* node)
+{
+    quicrq_mpsc_node_t* previous;
+
+    quicrq_atomic_store_ptr(&node->next, NULL);
+    previous = quicrq_atomic_exchange_ptr(&queue->head, node);
+    /* Until this store, the node is not visible to the consumer */
+    quicrq_atomic_store_ptr(&previous->next, node);
+}
+
+/* Pop the oldest node of the queue. Returns NULL if the queue is empty, or if the
+ * next node is still being pushed by a producer; that node will be found at the next call.
+ */
+quicrq_mpsc_node_t* quicrq_mpsc_queue_pop(quicrq_mpsc_queue_t* queue)
+{
+    quicrq_mpsc_node_t* tail = queue->tail;
+    quicrq_mpsc_node_t* next = quicrq_atomic_load_ptr(&tail->next);
+
+    if (tail == &queue->stub) {
+        if (next == NULL) {
+            return NULL;
+        }
+        queue->tail = next;
+        tail = next;
+        next = quicrq_atomic_load_ptr(&tail->next);
+    }
+    if (next == NULL) {
+        if (tail != quicrq_atomic_load_ptr(&queue->head)) {
+            return NULL;
+        }
+        /* The tail is the last node. Push the stub behind it, so it can be popped */
+        quicrq_mpsc_queue_push(queue, &queue->stub);
+        next = quicrq_atomic_load_ptr(&tail->next);
+        if (next == NULL) {
+            return NULL;
+        }
+    }
+    queue->tail = next;
+    return tail;
+}
+
+/* Publish queue, for publishing objects from other threads.
+ */
+static quicrq_publish_entry_t* quicrq_publish_queue_pop(quicrq_publish_queue_t* queue)
+{
+    return (quicrq_publish_entry_t*)quicrq_mpsc_queue_pop(&queue->queue);
+}
+
+static int quicrq_publish_queue_add(quicrq_media_object_source_ctx_t* object_source_ctx, quicrq_publish_entry_t* entry)
+{
+    quicrq_ctx_t* qr_ctx = object_source_ctx->qr_ctx;
+
+    quicrq_mpsc_queue_push(&object_source_ctx->publish_queue.queue, &entry->node);
+    /* Only wake up the context if it was not already notified */
+    if (quicrq_atomic_exchange(&qr_ctx->is_publish_queue_pending, 1) == 0 &&
+        qr_ctx->publish_wakeup_fn != NULL) {
+        qr_ctx->publish_wakeup_fn(qr_ctx->publish_wakeup_ctx);
+    }
+    return 0;
+}
+
+void quicrq_set_publish_wakeup_fn(quicrq_ctx_t* qr_ctx, quicrq_publish_wakeup_fn publish_wakeup_fn, void* publish_wakeup_ctx)
+{
+    qr_ctx->publish_wakeup_fn = publish_wakeup_fn;
+    qr_ctx->publish_wakeup_ctx = publish_wakeup_ctx;
+}
+
+int quicrq_publish_object_queued(
+    quicrq_media_object_source_ctx_t* object_source_ctx,
+    const uint8_t* object,
+    size_t object_length,
+    quicrq_media_object_properties_t* properties,
+    uint64_t group_id,
+    uint64_t object_id)
+{
+    int ret = 0;
+    /* The copy of the object is allocated with the entry */
+    quicrq_publish_entry_t* entry = (quicrq_publish_entry_t*)malloc(sizeof(quicrq_publish_entry_t) + object_length);
+
+    if (entry == NULL) {
+        ret = -1;
+    }
+    else {
+        memset(entry, 0, sizeof(quicrq_publish_entry_t));
+        entry->group_id = group_id;
+        entry->object_id = object_id;
+        if (properties != NULL) {
+            entry->properties = *properties;
+        }
+        entry->object_length = object_length;
+        entry->object = ((uint8_t*)entry) + sizeof(quicrq_publish_entry_t);
+        if (object_length > 0) {
+            memcpy(entry->object, object, object_length);
+        }
+        ret = quicrq_publish_queue_add(object_source_ctx, entry);
+    }
+    return ret;
+}
+
+int quicrq_publish_object_fin_queued(quicrq_media_object_source_ctx_t* object_source_ctx)
+{
+    int ret = 0;
+    quicrq_publish_entry_t* entry = (quicrq_publish_entry_t*)malloc(sizeof(quicrq_publish_entry_t));
+
+    if (entry == NULL) {
+        ret = -1;
+    }
+    else {
+        memset(entry, 0, sizeof(quicrq_publish_entry_t));
+        entry->is_fin = 1;
+        ret = quicrq_publish_queue_add(object_source_ctx, entry);
+    }
+    return ret;
+}
+
+uint64_t quicrq_get_publish_queue_errors(quicrq_media_object_source_ctx_t* object_source_ctx)
+{
+    return object_source_ctx->publish_queue.nb_errors;
+}
+
+/* Publish the objects queued by other threads. Called from quicrq_time_check,
+ * in the thread of the context. The pending flag is cleared before the queues
+ * are read, so objects queued during the drain trigger another one.
+ */
+void quicrq_publish_queues_drain(quicrq_ctx_t* qr_ctx)
+{
+    quicrq_media_object_source_ctx_t* object_source_ctx = qr_ctx->first_object_source;
+
+    (void)quicrq_atomic_exchange(&qr_ctx->is_publish_queue_pending, 0);
+
+    while (object_source_ctx != NULL) {
+        quicrq_publish_entry_t* entry;
+
+        while ((entry = quicrq_publish_queue_pop(&object_source_ctx->publish_queue)) != NULL) {
+            if (entry->is_fin) {
+                quicrq_publish_object_fin(object_source_ctx);
+            }
+            else if (quicrq_publish_object(object_source_ctx, entry->object, entry->object_length,
+                &entry->properties, entry->group_id, entry->object_id) != 0) {
+                DBG_PRINTF("Cannot publish queued object %" PRIu64 "/%" PRIu64, entry->group_id, entry->object_id);
+                object_source_ctx->publish_queue.nb_errors++;
+            }
+            free(entry);
+        }
+        object_source_ctx = object_source_ctx->next_in_qr_ctx;
+    }
+}
+
 void quicrq_delete_object_source(quicrq_media_object_source_ctx_t* object_source_ctx)
 {
+    quicrq_publish_entry_t* entry;
+
+    /* Objects still in the publish queue are dropped */
+    while ((entry = quicrq_publish_queue_pop(&object_source_ctx->publish_queue)) != NULL) {
+        free(entry);
+    }
     if (object_source_ctx->cache_ctx != NULL) {
         /* Close the corresponding source context */
         if (object_source_ctx->cache_ctx->srce_ctx != NULL) {
@@ -0,0 +1,193 @@
+/* Memory pools for the per fragment structures */
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include "picoquic_utils.h"
+#include "quicrq.h"
+#include "quicrq_internal.h"
+#include "quicrq_fragment.h"
+
+/* The per fragment structures are allocated and freed on the hot path:
+ * cached fragments and objects, datagram ack states, publisher object states, and
+ * the fragment data buffers and reassembly packets. In warp and rush modes, a
+ * uni stream context is also created for each group or object. Instead of calling
+ * malloc and free for each of them, we keep a free list of the items of
+ * each type. Variable size data is allocated from the smallest size class
+ * that fits, or directly from the system if larger than the largest class.
+ *
+ * The number of items in each free list is capped by "max_free". This
+ * limits the memory kept by the pools after the cache is purged.
+ */
+
+static size_t quicrq_pool_item_size(quicrq_pool_id_enum pool_id)
+{
+    size_t item_size = 0;
+
+    switch (pool_id) {
+    case quicrq_pool_cached_fragment:
+        item_size = sizeof(quicrq_cached_fragment_t);
+        break;
+    case quicrq_pool_datagram_ack:
+        item_size = sizeof(quicrq_datagram_ack_state_t);
+        break;
+    case quicrq_pool_publisher_object:
+        item_size = sizeof(quicrq_fragment_publisher_object_state_t);
+        break;
+    case quicrq_pool_cached_object:
+        item_size = sizeof(quicrq_cached_object_t);
+        break;
+    case quicrq_pool_uni_stream:
+        item_size = sizeof(quicrq_uni_stream_ctx_t);
+        break;
+    case quicrq_pool_data_128:
+        item_size = 128;
+        break;
+    case quicrq_pool_data_256:
+        item_size = 256;
+        break;
+    case quicrq_pool_data_512:
+        item_size = 512;
+        break;
+    case quicrq_pool_data_1024:
+        item_size = 1024;
+        break;
+    case quicrq_pool_data_2048:
+        item_size = 2048;
+        break;
+    default:
+        break;
+    }
+    return item_size;
+}
+
+static quicrq_pool_id_enum quicrq_pool_data_id(size_t size)
+{
+    quicrq_pool_id_enum pool_id = quicrq_pool_data_128;
+
+    while (pool_id < quicrq_pool_data_oversize && size > quicrq_pool_item_size(pool_id)) {
+        pool_id++;
+    }
+    return pool_id;
+}
+
+void quicrq_pools_init(quicrq_ctx_t* qr_ctx)
+{
+    for (int i = 0; i < quicrq_pool_max; i++) {
+        memset(&qr_ctx->pools[i], 0, sizeof(quicrq_pool_t));
+        qr_ctx->pools[i].max_free = QUICRQ_POOL_MAX_FREE_DEFAULT;
+        qr_ctx->pools[i].stats.item_size = quicrq_pool_item_size((quicrq_pool_id_enum)i);
+    }
+}
+
+static void quicrq_pool_trim(quicrq_pool_t* pool, size_t max_free)
+{
+    quicrq_pool_item_t* item;
+
+    while (pool->stats.nb_free > max_free && (item = pool->first_free) != NULL) {
+        pool->first_free = item->next_item;
+        pool->stats.nb_free--;
+        pool->stats.nb_released++;
+        free(item);
+    }
+}
+
+void quicrq_pools_release(quicrq_ctx_t* qr_ctx)
+{
+    for (int i = 0; i < quicrq_pool_max; i++) {
+        if (qr_ctx->pools[i].stats.nb_in_use > 0) {
+            DBG_PRINTF("Pool %d, %zu items still in use", i, qr_ctx->pools[i].stats.nb_in_use);
+        }
+        quicrq_pool_trim(&qr_ctx->pools[i], 0);
+    }
+}
+
+void* quicrq_pool_alloc(quicrq_ctx_t* qr_ctx, quicrq_pool_id_enum pool_id, size_t size)
+{
+    void* item = NULL;
+
+    if (qr_ctx == NULL) {
+        item = malloc(size);
+    }
+    else {
+        quicrq_pool_t* pool = &qr_ctx->pools[pool_id];
+
+        if (pool->first_free != NULL) {
+            item = pool->first_free;
+            pool->first_free = pool->first_free->next_item;
+            pool->stats.nb_free--;
+            pool->stats.nb_reused++;
+        }
+        else {
+            item = malloc((pool->stats.item_size > 0) ? pool->stats.item_size : size);
+        }
+        if (item != NULL) {
+            pool->stats.nb_alloc++;
+            pool->stats.nb_in_use++;
+            if (pool->stats.nb_in_use > pool->stats.max_in_use) {
+                pool->stats.max_in_use = pool->stats.nb_in_use;
+            }
+        }
+    }
+    return item;
+}
+
+void quicrq_pool_free(quicrq_ctx_t* qr_ctx, quicrq_pool_id_enum pool_id, void* item)
+{
+    if (item != NULL) {
+        if (qr_ctx == NULL) {
+            free(item);
+        }
+        else {
+            quicrq_pool_t* pool = &qr_ctx->pools[pool_id];
+
+            pool->stats.nb_in_use--;
+            if (pool->stats.item_size == 0 || pool->stats.nb_free >= pool->max_free) {
+                pool->stats.nb_released++;
+                free(item);
+            }
+            else {
+                quicrq_pool_item_t* pool_item = (quicrq_pool_item_t*)item;
+                pool_item->next_item = pool->first_free;
+                pool->first_free = pool_item;
+                pool->stats.nb_free++;
+            }
+        }
+    }
+}
+
+void* quicrq_pool_alloc_data(quicrq_ctx_t* qr_ctx, size_t size)
+{
+    return quicrq_pool_alloc(qr_ctx, quicrq_pool_data_id(size), size);
+}
+
+void quicrq_pool_free_data(quicrq_ctx_t* qr_ctx, void* item, size_t size)
+{
+    quicrq_pool_free(qr_ctx, quicrq_pool_data_id(size), item);
+}
+
+/* Pool statistics and management API */
+size_t quicrq_get_nb_pools()
+{
+    return (size_t)quicrq_pool_max;
+}
+
+int quicrq_get_pool_stats(quicrq_ctx_t* qr, size_t pool_index, quicrq_pool_stats_t* stats)
+{
+    int ret = 0;
+
+    if (pool_index >= (size_t)quicrq_pool_max) {
+        ret = -1;
+    }
+    else {
+        *stats = qr->pools[pool_index].stats;
+    }
+    return ret;
+}
+
+void quicrq_set_pool_max_free(quicrq_ctx_t* qr, size_t max_free)
+{
+    for (int i = 0; i < quicrq_pool_max; i++) {
+        qr->pools[i].max_free = max_free;
+        quicrq_pool_trim(&qr->pools[i], max_free);
+    }
+}
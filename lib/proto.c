@@ -3,6 +3,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
 #include "quicrq.h"
 #include "quicrq_internal.h"
 #include "quicrq_fragment.h"
@@ -107,7 +108,20 @@ const uint8_t* quicrq_notify_msg_decode(const uint8_t* bytes, const uint8_t* byt
  *     intent_mode(i),
  *     [ start_group_id(i),
  *       start_object_id(i),]
+ *     [ datagram_header_format(i),
+ *       [ fragment_size(i),
+ *         [ fec_window(i) ]]]
+ * }
  * 
+ * The datagram header format is only present if the receiver of datagrams
+ * asks for a format other than the default full headers, for a fragment
+ * size, or for FEC. The fragment size is present if the receiver asks the
+ * sender to cut the objects in fragments of at most that size, starting at
+ * the beginning of the objects, or if it asks for FEC, in which case it is
+ * 0 when no size is asked. The FEC window is only present if the receiver
+ * asks the sender to add parity datagrams, see quicrq_set_datagram_fec.
+ * These are the last fields of the message, so peers that do not set them
+ * send the same bytes as before.
  * 
  * Same encoding and decoding code is used for both.
  * 
@@ -115,12 +129,29 @@ const uint8_t* quicrq_notify_msg_decode(const uint8_t* bytes, const uint8_t* byt
 size_t quicrq_rq_msg_reserve(size_t url_length, quicrq_subscribe_intent_enum intent_mode)
 {
     size_t intent_length = (intent_mode == quicrq_subscribe_intent_start_point) ? 17:1;
-    return 8 + 2 + url_length + 8 + 1 + intent_length;
+    return 8 + 2 + url_length + 8 + 1 + intent_length + 1 + 4 + 1;
+}
+
+/* Encode the optional datagram header format, fragment size and FEC window at the end of a message */
+static uint8_t* quicrq_datagram_options_encode(uint8_t* bytes, uint8_t* bytes_max,
+    quicrq_datagram_header_format_enum datagram_header_format, size_t fragment_size, size_t fec_window)
+{
+    if (bytes != NULL && (datagram_header_format != quicrq_datagram_header_full || fragment_size != 0 || fec_window != 0)) {
+        bytes = picoquic_frames_varint_encode(bytes, bytes_max, (uint64_t)datagram_header_format);
+        if (bytes != NULL && (fragment_size != 0 || fec_window != 0)) {
+            bytes = picoquic_frames_varint_encode(bytes, bytes_max, (uint64_t)fragment_size);
+            if (bytes != NULL && fec_window != 0) {
+                bytes = picoquic_frames_varint_encode(bytes, bytes_max, (uint64_t)fec_window);
+            }
+        }
+    }
+    return bytes;
 }
 
 uint8_t* quicrq_rq_msg_encode(uint8_t* bytes, uint8_t* bytes_max, uint64_t message_type, size_t url_length, const uint8_t* url,
     uint64_t media_id, quicrq_transport_mode_enum transport_mode, quicrq_subscribe_intent_enum intent_mode,
-    uint64_t start_group_id,  uint64_t start_object_id)
+    uint64_t start_group_id,  uint64_t start_object_id, quicrq_datagram_header_format_enum datagram_header_format,
+    size_t fragment_size, size_t fec_window)
 {
     if ((bytes = picoquic_frames_varint_encode(bytes, bytes_max, message_type)) != NULL &&
         (bytes = picoquic_frames_length_data_encode(bytes, bytes_max, url_length, url)) != NULL &&
@@ -132,13 +163,69 @@ uint8_t* quicrq_rq_msg_encode(uint8_t* bytes, uint8_t* bytes_max, uint64_t messa
                 bytes = picoquic_frames_varint_encode(bytes, bytes_max, (uint64_t)start_object_id);
             }
         }
+        bytes = quicrq_datagram_options_encode(bytes, bytes_max, datagram_header_format, fragment_size, fec_window);
+    }
+    return bytes;
+}
+
+/* Decode the optional datagram header format at the end of a message */
+static const uint8_t* quicrq_datagram_header_format_decode(const uint8_t* bytes, const uint8_t* bytes_max,
+    quicrq_datagram_header_format_enum* datagram_header_format)
+{
+    uint64_t format_64 = 0;
+
+    *datagram_header_format = quicrq_datagram_header_full;
+    if (bytes != NULL && bytes < bytes_max) {
+        if ((bytes = picoquic_frames_varint_decode(bytes, bytes_max, &format_64)) != NULL) {
+            if (format_64 >= quicrq_datagram_header_format_max) {
+                bytes = NULL;
+            }
+            else {
+                *datagram_header_format = (quicrq_datagram_header_format_enum)format_64;
+            }
+        }
+    }
+    return bytes;
+}
+
+/* Decode the optional datagram header format, fragment size and FEC window at the end of a message.
+ * A fragment size of 0 is only valid if a FEC window follows. */
+static const uint8_t* quicrq_datagram_options_decode(const uint8_t* bytes, const uint8_t* bytes_max,
+    quicrq_datagram_header_format_enum* datagram_header_format, size_t* fragment_size, size_t* fec_window)
+{
+    uint64_t size_64 = 0;
+    uint64_t window_64 = 0;
+
+    *fragment_size = 0;
+    *fec_window = 0;
+    bytes = quicrq_datagram_header_format_decode(bytes, bytes_max, datagram_header_format);
+    if (bytes != NULL && bytes < bytes_max) {
+        if ((bytes = picoquic_frames_varint_decode(bytes, bytes_max, &size_64)) != NULL) {
+            if (size_64 > QUICRQ_FRAGMENT_SIZE_MAX || (size_64 == 0 && bytes >= bytes_max)) {
+                bytes = NULL;
+            }
+            else {
+                *fragment_size = (size_t)size_64;
+            }
+        }
+        if (bytes != NULL && bytes < bytes_max) {
+            if ((bytes = picoquic_frames_varint_decode(bytes, bytes_max, &window_64)) != NULL) {
+                if (window_64 == 0 || window_64 > QUICRQ_FEC_WINDOW_MAX) {
+                    bytes = NULL;
+                }
+                else {
+                    *fec_window = (size_t)window_64;
+                }
+            }
+        }
     }
     return bytes;
 }
 
 const uint8_t* quicrq_rq_msg_decode(const uint8_t* bytes, const uint8_t* bytes_max, uint64_t * message_type, size_t * url_length, const uint8_t** url,
     uint64_t *media_id, quicrq_transport_mode_enum* transport_mode, quicrq_subscribe_intent_enum* intent_mode,
-    uint64_t *start_group_id, uint64_t *start_object_id)
+    uint64_t *start_group_id, uint64_t *start_object_id, quicrq_datagram_header_format_enum* datagram_header_format,
+    size_t* fragment_size, size_t* fec_window)
 {
     uint64_t intent_64 = 0;
     uint64_t t_mode_64 = 0;
@@ -149,6 +236,7 @@ const uint8_t* quicrq_rq_msg_decode(const uint8_t* bytes, const uint8_t* bytes_m
     *intent_mode = 0;
     *start_group_id = 0;
     *start_object_id = 0;
+    *datagram_header_format = quicrq_datagram_header_full;
 
     if ((bytes = picoquic_frames_varint_decode(bytes, bytes_max, message_type)) != NULL &&
         (bytes = picoquic_frames_varlen_decode(bytes, bytes_max, url_length)) != NULL){
@@ -157,7 +245,7 @@ const uint8_t* quicrq_rq_msg_decode(const uint8_t* bytes, const uint8_t* bytes_m
             (bytes = picoquic_frames_varint_decode(bytes, bytes_max, media_id)) != NULL &&
             (bytes = picoquic_frames_varint_decode(bytes, bytes_max, &t_mode_64)) != NULL &&
             (bytes = picoquic_frames_varint_decode(bytes, bytes_max, &intent_64)) != NULL) {
-            if (intent_64 > quicrq_subscribe_intent_start_point ||
+            if (intent_64 >= quicrq_subscribe_intent_max ||
                 t_mode_64 >= quicrq_transport_mode_max) {
                 bytes = NULL;
             }
@@ -170,6 +258,7 @@ const uint8_t* quicrq_rq_msg_decode(const uint8_t* bytes, const uint8_t* bytes_m
                         bytes = picoquic_frames_varint_decode(bytes, bytes_max, start_object_id);
                     }
                 }
+                bytes = quicrq_datagram_options_decode(bytes, bytes_max, datagram_header_format, fragment_size, fec_window);
             }
         }
     }
@@ -365,6 +454,41 @@ const uint8_t* quicrq_cache_policy_msg_decode(const uint8_t* bytes, const uint8_
     return bytes;
 }
 
+/* Feedback Message
+ *     message_type(i),
+ *     max_flags(8),
+ *     target_bitrate(i)
+ *
+ * The feedback message is sent by the receiver of a media on the control
+ * stream, to indicate the highest value of the object flags, i.e., the
+ * highest layer, that it wants to receive, and optionally the bit rate
+ * in bits per second that it can absorb. A target bitrate of 0 means
+ * no rate limit.
+ */
+size_t quicrq_feedback_msg_reserve(uint64_t target_bitrate)
+{
+    size_t len = 2 + picoquic_frames_varint_encode_length(target_bitrate);
+    return len;
+}
+
+uint8_t* quicrq_feedback_msg_encode(uint8_t* bytes, uint8_t* bytes_max, uint64_t message_type, uint8_t max_flags, uint64_t target_bitrate)
+{
+    if ((bytes = picoquic_frames_varint_encode(bytes, bytes_max, message_type)) != NULL &&
+        (bytes = picoquic_frames_uint8_encode(bytes, bytes_max, max_flags)) != NULL) {
+        bytes = picoquic_frames_varint_encode(bytes, bytes_max, target_bitrate);
+    }
+    return bytes;
+}
+
+const uint8_t* quicrq_feedback_msg_decode(const uint8_t* bytes, const uint8_t* bytes_max, uint64_t* message_type, uint8_t* max_flags, uint64_t* target_bitrate)
+{
+    if ((bytes = picoquic_frames_varint_decode(bytes, bytes_max, message_type)) != NULL &&
+        (bytes = picoquic_frames_uint8_decode(bytes, bytes_max, max_flags)) != NULL) {
+        bytes = picoquic_frames_varint_decode(bytes, bytes_max, target_bitrate);
+    }
+    return bytes;
+}
+
 /* Media POST message.  
  *     message_type(i),
  *     url_length(i),
@@ -429,10 +553,15 @@ const uint8_t* quicrq_post_msg_decode(const uint8_t* bytes, const uint8_t* bytes
   *     message_type(i),
   *     transport_mode(i),
   *     [media_id(i)]
+  *     [datagram_header_format(i),
+  *       [fragment_size(i),
+  *         [fec_window(i)]]]
   *     
   * This is the response to the POST message. The server tells the client whether it
   * should send as datagrams or as stream, and if using streams send a datagram
-  * stream ID.
+  * stream ID. The server receives the datagrams, and may ask for a datagram
+  * header format other than full headers, for a fragment size, or for FEC,
+  * as in the REQUEST message.
   */
 
 size_t quicrq_accept_msg_reserve(quicrq_transport_mode_enum transport_mode, uint64_t media_id)
@@ -440,28 +569,34 @@ size_t quicrq_accept_msg_reserve(quicrq_transport_mode_enum transport_mode, uint
     size_t len = 1 +
         picoquic_frames_varint_encode_length((uint64_t)transport_mode);
     if (transport_mode != quicrq_transport_mode_single_stream) {
-        len += picoquic_frames_varint_encode_length(media_id);
+        len += picoquic_frames_varint_encode_length(media_id) + 1 + 4 + 1;
     }
     return len;
 }
 
-uint8_t* quicrq_accept_msg_encode(uint8_t* bytes, uint8_t* bytes_max, uint64_t message_type, quicrq_transport_mode_enum transport_mode, uint64_t media_id)
+uint8_t* quicrq_accept_msg_encode(uint8_t* bytes, uint8_t* bytes_max, uint64_t message_type, quicrq_transport_mode_enum transport_mode, uint64_t media_id,
+    quicrq_datagram_header_format_enum datagram_header_format, size_t fragment_size, size_t fec_window)
 {
     if ((bytes = picoquic_frames_varint_encode(bytes, bytes_max, message_type)) != NULL &&
         (bytes = picoquic_frames_varint_encode(bytes, bytes_max, (uint64_t)transport_mode)) != NULL) {
         if (transport_mode != quicrq_transport_mode_single_stream) {
             bytes = picoquic_frames_varint_encode(bytes, bytes_max, media_id);
+            bytes = quicrq_datagram_options_encode(bytes, bytes_max, datagram_header_format, fragment_size, fec_window);
         }
     }
     return bytes;
 }
 
 const uint8_t* quicrq_accept_msg_decode(const uint8_t* bytes, const uint8_t* bytes_max, uint64_t* message_type,
-    quicrq_transport_mode_enum * transport_mode, uint64_t * media_id)
+    quicrq_transport_mode_enum * transport_mode, uint64_t * media_id, quicrq_datagram_header_format_enum* datagram_header_format,
+    size_t* fragment_size, size_t* fec_window)
 {
     uint64_t use_dg = 0;
     *transport_mode = 0;
     *media_id = 0;
+    *datagram_header_format = quicrq_datagram_header_full;
+    *fragment_size = 0;
+    *fec_window = 0;
     if ((bytes = picoquic_frames_varint_decode(bytes, bytes_max, message_type)) != NULL &&
         (bytes = picoquic_frames_varint_decode(bytes, bytes_max, &use_dg)) != NULL) {
         if (use_dg >= quicrq_transport_mode_max) {
@@ -471,6 +606,7 @@ const uint8_t* quicrq_accept_msg_decode(const uint8_t* bytes, const uint8_t* byt
             *transport_mode = (quicrq_transport_mode_enum)use_dg;
             if (use_dg != quicrq_transport_mode_single_stream) {
                 bytes = picoquic_frames_varint_decode(bytes, bytes_max, media_id);
+                bytes = quicrq_datagram_options_decode(bytes, bytes_max, datagram_header_format, fragment_size, fec_window);
             }
         }
     }
@@ -582,6 +718,238 @@ const uint8_t* quicrq_object_header_msg_decode(const uint8_t* bytes, const uint8
 }
 
 
+/* Batched media request, accept and track messages.
+ * A batch requests several media on a single control stream, all received
+ * as datagrams with the same intent. The client allocates the media ids of
+ * the tracks in sequence, starting with first_media_id. The server replies
+ * with the list of media ids that it accepted, in increasing order. The
+ * start point, final point and cache policy of each track are then sent on
+ * the control stream as track messages, which carry the media id of the
+ * track followed by a START_POINT, FIN_DATAGRAM or CACHE_POLICY message.
+ * The client closes a single track of the batch by sending a track message
+ * followed by an UNSUBSCRIBE_TRACK message, which has no content.
+ *
+ * quicrq_batch_request_message {
+ *     message_type(i),
+ *     first_media_id(i),
+ *     intent_mode(i),
+ *     [start_group_id(i),
+ *     start_object_id(i),]
+ *     datagram_header_format(i),
+ *     nb_tracks(i),
+ *     nb_tracks * {
+ *         url_length(i),
+ *         url(...)
+ *     }
+ * }
+ *
+ * quicrq_batch_accept_message {
+ *     message_type(i),
+ *     nb_tracks(i),
+ *     nb_tracks * media_id(i)
+ * }
+ *
+ * quicrq_track_message {
+ *     message_type(i),
+ *     media_id(i),
+ *     track_message(...)
+ * }
+ *
+ * quicrq_unsubscribe_track_message {
+ *     message_type(i)
+ * }
+ */
+size_t quicrq_batch_rq_msg_reserve(size_t nb_tracks, const size_t* url_length, quicrq_subscribe_intent_enum intent_mode)
+{
+    size_t intent_length = (intent_mode == quicrq_subscribe_intent_start_point) ? 17 : 1;
+    size_t length = 8 + 8 + intent_length + 1 + 8;
+
+    for (size_t i = 0; i < nb_tracks; i++) {
+        length += 2 + url_length[i];
+    }
+    return length;
+}
+
+uint8_t* quicrq_batch_rq_msg_encode(uint8_t* bytes, uint8_t* bytes_max, uint64_t message_type, uint64_t first_media_id,
+    quicrq_subscribe_intent_enum intent_mode, uint64_t start_group_id, uint64_t start_object_id,
+    quicrq_datagram_header_format_enum datagram_header_format, size_t nb_tracks, const uint8_t** url, const size_t* url_length)
+{
+    if ((bytes = picoquic_frames_varint_encode(bytes, bytes_max, message_type)) != NULL &&
+        (bytes = picoquic_frames_varint_encode(bytes, bytes_max, first_media_id)) != NULL &&
+        (bytes = picoquic_frames_varint_encode(bytes, bytes_max, (uint64_t)intent_mode)) != NULL) {
+        if (intent_mode == quicrq_subscribe_intent_start_point) {
+            if ((bytes = picoquic_frames_varint_encode(bytes, bytes_max, start_group_id)) != NULL) {
+                bytes = picoquic_frames_varint_encode(bytes, bytes_max, start_object_id);
+            }
+        }
+        if (bytes != NULL &&
+            (bytes = picoquic_frames_varint_encode(bytes, bytes_max, (uint64_t)datagram_header_format)) != NULL) {
+            bytes = picoquic_frames_varint_encode(bytes, bytes_max, (uint64_t)nb_tracks);
+            for (size_t i = 0; bytes != NULL && i < nb_tracks; i++) {
+                bytes = picoquic_frames_length_data_encode(bytes, bytes_max, url_length[i], url[i]);
+            }
+        }
+    }
+    return bytes;
+}
+
+const uint8_t* quicrq_batch_url_decode(const uint8_t* bytes, const uint8_t* bytes_max, size_t* url_length, const uint8_t** url)
+{
+    if ((bytes = picoquic_frames_varlen_decode(bytes, bytes_max, url_length)) != NULL) {
+        *url = bytes;
+        bytes = picoquic_frames_fixed_skip(bytes, bytes_max, *url_length);
+    }
+    return bytes;
+}
+
+/* The list of URLs is verified when decoding the message, so that the
+ * URLs can later be read one at a time from the track list. */
+const uint8_t* quicrq_batch_rq_msg_decode(const uint8_t* bytes, const uint8_t* bytes_max, uint64_t* message_type, uint64_t* first_media_id,
+    quicrq_subscribe_intent_enum* intent_mode, uint64_t* start_group_id, uint64_t* start_object_id,
+    quicrq_datagram_header_format_enum* datagram_header_format, size_t* nb_tracks, const uint8_t** track_list)
+{
+    uint64_t intent_64 = 0;
+    uint64_t format_64 = 0;
+    *first_media_id = 0;
+    *intent_mode = 0;
+    *start_group_id = 0;
+    *start_object_id = 0;
+    *datagram_header_format = quicrq_datagram_header_full;
+    *nb_tracks = 0;
+    *track_list = NULL;
+
+    if ((bytes = picoquic_frames_varint_decode(bytes, bytes_max, message_type)) != NULL &&
+        (bytes = picoquic_frames_varint_decode(bytes, bytes_max, first_media_id)) != NULL &&
+        (bytes = picoquic_frames_varint_decode(bytes, bytes_max, &intent_64)) != NULL) {
+        if (intent_64 >= quicrq_subscribe_intent_max) {
+            bytes = NULL;
+        }
+        else {
+            *intent_mode = (quicrq_subscribe_intent_enum)intent_64;
+            if (*intent_mode == quicrq_subscribe_intent_start_point) {
+                if ((bytes = picoquic_frames_varint_decode(bytes, bytes_max, start_group_id)) != NULL) {
+                    bytes = picoquic_frames_varint_decode(bytes, bytes_max, start_object_id);
+                }
+            }
+            if (bytes != NULL &&
+                (bytes = picoquic_frames_varint_decode(bytes, bytes_max, &format_64)) != NULL &&
+                (bytes = picoquic_frames_varlen_decode(bytes, bytes_max, nb_tracks)) != NULL) {
+                if (format_64 >= quicrq_datagram_header_format_max || *nb_tracks > QUICRQ_BATCH_TRACKS_MAX) {
+                    bytes = NULL;
+                }
+                else {
+                    *datagram_header_format = (quicrq_datagram_header_format_enum)format_64;
+                    *track_list = bytes;
+                    for (size_t i = 0; bytes != NULL && i < *nb_tracks; i++) {
+                        size_t url_length = 0;
+                        const uint8_t* url = NULL;
+                        bytes = quicrq_batch_url_decode(bytes, bytes_max, &url_length, &url);
+                    }
+                }
+            }
+        }
+    }
+    return bytes;
+}
+
+size_t quicrq_batch_accept_msg_reserve(size_t nb_tracks)
+{
+    return 8 + 8 + 8 * nb_tracks;
+}
+
+uint8_t* quicrq_batch_accept_msg_encode(uint8_t* bytes, uint8_t* bytes_max, uint64_t message_type, size_t nb_tracks, const uint64_t* media_id)
+{
+    if ((bytes = picoquic_frames_varint_encode(bytes, bytes_max, message_type)) != NULL) {
+        bytes = picoquic_frames_varint_encode(bytes, bytes_max, (uint64_t)nb_tracks);
+        for (size_t i = 0; bytes != NULL && i < nb_tracks; i++) {
+            bytes = picoquic_frames_varint_encode(bytes, bytes_max, media_id[i]);
+        }
+    }
+    return bytes;
+}
+
+const uint8_t* quicrq_batch_accept_msg_decode(const uint8_t* bytes, const uint8_t* bytes_max, uint64_t* message_type,
+    size_t* nb_tracks, const uint8_t** track_list)
+{
+    *nb_tracks = 0;
+    *track_list = NULL;
+    if ((bytes = picoquic_frames_varint_decode(bytes, bytes_max, message_type)) != NULL &&
+        (bytes = picoquic_frames_varlen_decode(bytes, bytes_max, nb_tracks)) != NULL) {
+        if (*nb_tracks > QUICRQ_BATCH_TRACKS_MAX) {
+            bytes = NULL;
+        }
+        else {
+            *track_list = bytes;
+            for (size_t i = 0; bytes != NULL && i < *nb_tracks; i++) {
+                uint64_t media_id = 0;
+                bytes = picoquic_frames_varint_decode(bytes, bytes_max, &media_id);
+            }
+        }
+    }
+    return bytes;
+}
+
+size_t quicrq_track_msg_reserve(uint64_t media_id)
+{
+    return 1 + picoquic_frames_varint_encode_length(media_id);
+}
+
+/* Encode the prefix of a track message. The message for the track is
+ * encoded after it. */
+uint8_t* quicrq_track_msg_encode(uint8_t* bytes, uint8_t* bytes_max, uint64_t message_type, uint64_t media_id)
+{
+    if ((bytes = picoquic_frames_varint_encode(bytes, bytes_max, message_type)) != NULL) {
+        bytes = picoquic_frames_varint_encode(bytes, bytes_max, media_id);
+    }
+    return bytes;
+}
+
+size_t quicrq_unsubscribe_track_msg_reserve(uint64_t media_id)
+{
+    return quicrq_track_msg_reserve(media_id) + 1;
+}
+
+uint8_t* quicrq_unsubscribe_track_msg_encode(uint8_t* bytes, uint8_t* bytes_max, uint64_t media_id)
+{
+    if ((bytes = quicrq_track_msg_encode(bytes, bytes_max, QUICRQ_ACTION_TRACK, media_id)) != NULL) {
+        bytes = picoquic_frames_varint_encode(bytes, bytes_max, QUICRQ_ACTION_UNSUBSCRIBE_TRACK);
+    }
+    return bytes;
+}
+
+static const uint8_t* quicrq_track_msg_decode(const uint8_t* bytes, const uint8_t* bytes_max, quicrq_message_t* msg)
+{
+    uint64_t media_id = 0;
+    uint64_t track_message_type = 0;
+
+    if ((bytes = picoquic_frames_varint_decode(bytes, bytes_max, &msg->message_type)) != NULL &&
+        (bytes = picoquic_frames_varint_decode(bytes, bytes_max, &media_id)) != NULL &&
+        picoquic_frames_varint_decode(bytes, bytes_max, &track_message_type) != NULL) {
+        /* Check the type before decoding, so that track messages cannot be nested */
+        if (track_message_type == QUICRQ_ACTION_UNSUBSCRIBE_TRACK) {
+            if ((bytes = picoquic_frames_varint_decode(bytes, bytes_max, &track_message_type)) != NULL) {
+                msg->track_message_type = track_message_type;
+                msg->message_type = QUICRQ_ACTION_TRACK;
+                msg->media_id = media_id;
+            }
+        }
+        else if (track_message_type != QUICRQ_ACTION_START_POINT &&
+            track_message_type != QUICRQ_ACTION_FIN_DATAGRAM &&
+            track_message_type != QUICRQ_ACTION_CACHE_POLICY) {
+            bytes = NULL;
+        }
+        else if ((bytes = quicrq_msg_decode(bytes, bytes_max, msg)) != NULL) {
+            msg->track_message_type = track_message_type;
+            msg->message_type = QUICRQ_ACTION_TRACK;
+            msg->media_id = media_id;
+        }
+    }
+    else {
+        bytes = NULL;
+    }
+    return bytes;
+}
+
 /* Generic decoding of QUICRQ control message */
 const uint8_t* quicrq_msg_decode(const uint8_t* bytes, const uint8_t* bytes_max, quicrq_message_t* msg)
 {
@@ -593,7 +961,8 @@ const uint8_t* quicrq_msg_decode(const uint8_t* bytes, const uint8_t* bytes_max,
         switch (msg->message_type) {
         case QUICRQ_ACTION_REQUEST:
             bytes = quicrq_rq_msg_decode(bytes, bytes_max, &msg->message_type, &msg->url_length, &msg->url,
-                &msg->media_id, &msg->transport_mode, &msg->subscribe_intent, &msg->group_id, &msg->object_id);
+                &msg->media_id, &msg->transport_mode, &msg->subscribe_intent, &msg->group_id, &msg->object_id,
+                &msg->datagram_header_format, &msg->fragment_size, &msg->fec_window);
             break;
         case QUICRQ_ACTION_FIN_DATAGRAM:
             bytes = quicrq_fin_msg_decode(bytes, bytes_max, &msg->message_type, &msg->group_id, &msg->object_id);
@@ -608,7 +977,8 @@ const uint8_t* quicrq_msg_decode(const uint8_t* bytes, const uint8_t* bytes_max,
                 &msg->transport_mode, &msg->cache_policy, &msg->group_id, &msg->object_id);
             break;
         case QUICRQ_ACTION_ACCEPT:
-            bytes = quicrq_accept_msg_decode(bytes, bytes_max, &msg->message_type, &msg->transport_mode, &msg->media_id);
+            bytes = quicrq_accept_msg_decode(bytes, bytes_max, &msg->message_type, &msg->transport_mode, &msg->media_id,
+                &msg->datagram_header_format, &msg->fragment_size, &msg->fec_window);
             break;
         case QUICRQ_ACTION_START_POINT:
             bytes = quicrq_start_point_msg_decode(bytes, bytes_max, &msg->message_type, &msg->group_id, &msg->object_id);
@@ -629,6 +999,21 @@ const uint8_t* quicrq_msg_decode(const uint8_t* bytes, const uint8_t* bytes_max,
             bytes = quicrq_object_header_msg_decode(bytes, bytes_max, &msg->message_type, &msg->object_id,
                 &msg->nb_objects_previous_group, &msg->flags, &msg->object_length);
             break;
+        case QUICRQ_ACTION_REQUEST_BATCH:
+            bytes = quicrq_batch_rq_msg_decode(bytes, bytes_max, &msg->message_type, &msg->media_id,
+                &msg->subscribe_intent, &msg->group_id, &msg->object_id, &msg->datagram_header_format,
+                &msg->nb_tracks, &msg->track_list);
+            msg->transport_mode = quicrq_transport_mode_datagram;
+            break;
+        case QUICRQ_ACTION_ACCEPT_BATCH:
+            bytes = quicrq_batch_accept_msg_decode(bytes, bytes_max, &msg->message_type, &msg->nb_tracks, &msg->track_list);
+            break;
+        case QUICRQ_ACTION_TRACK:
+            bytes = quicrq_track_msg_decode(bytes, bytes_max, msg);
+            break;
+        case QUICRQ_ACTION_FEEDBACK:
+            bytes = quicrq_feedback_msg_decode(bytes, bytes_max, &msg->message_type, &msg->flags, &msg->target_bitrate);
+            break;
         default:
             /* Unexpected message type */
             bytes = NULL;
@@ -644,7 +1029,8 @@ uint8_t* quicrq_msg_encode(uint8_t* bytes, uint8_t* bytes_max, quicrq_message_t*
     switch (msg->message_type) {
     case QUICRQ_ACTION_REQUEST:
         bytes = quicrq_rq_msg_encode(bytes, bytes_max, msg->message_type, msg->url_length, msg->url,
-            msg->media_id, msg->transport_mode, msg->subscribe_intent, msg->group_id, msg->object_id);
+            msg->media_id, msg->transport_mode, msg->subscribe_intent, msg->group_id, msg->object_id,
+            msg->datagram_header_format, msg->fragment_size, msg->fec_window);
         break;
     case QUICRQ_ACTION_FIN_DATAGRAM:
         bytes = quicrq_fin_msg_encode(bytes, bytes_max, msg->message_type, msg->group_id, msg->object_id);
@@ -659,7 +1045,8 @@ uint8_t* quicrq_msg_encode(uint8_t* bytes, uint8_t* bytes_max, quicrq_message_t*
             msg->transport_mode, msg->cache_policy, msg->group_id, msg->object_id);
         break;
     case QUICRQ_ACTION_ACCEPT:
-        bytes = quicrq_accept_msg_encode(bytes, bytes_max, msg->message_type, msg->transport_mode, msg->media_id);
+        bytes = quicrq_accept_msg_encode(bytes, bytes_max, msg->message_type, msg->transport_mode, msg->media_id,
+            msg->datagram_header_format, msg->fragment_size, msg->fec_window);
         break;
     case QUICRQ_ACTION_START_POINT:
         bytes = quicrq_start_point_msg_encode(bytes, bytes_max, msg->message_type, msg->group_id, msg->object_id);
@@ -680,6 +1067,9 @@ uint8_t* quicrq_msg_encode(uint8_t* bytes, uint8_t* bytes_max, quicrq_message_t*
         bytes = quicrq_object_header_msg_encode(bytes, bytes_max, msg->message_type, msg->object_id,
             msg->nb_objects_previous_group, msg->flags, msg->object_length);
         break;
+    case QUICRQ_ACTION_FEEDBACK:
+        bytes = quicrq_feedback_msg_encode(bytes, bytes_max, msg->message_type, msg->flags, msg->target_bitrate);
+        break;
     default:
         /* Unexpected message type */
         bytes = NULL;
@@ -727,15 +1117,15 @@ uint8_t* quicrq_datagram_header_encode(uint8_t* bytes, uint8_t* bytes_max, uint6
 const uint8_t* quicrq_datagram_header_decode(const uint8_t* bytes, const uint8_t* bytes_max, uint64_t* media_id, uint64_t* group_id,
     uint64_t* object_id, uint64_t* object_offset, uint64_t* queue_delay, uint8_t* flags, uint64_t* nb_objects_previous_group, uint64_t* object_length)
 {
-    if ((bytes = picoquic_frames_varint_decode(bytes, bytes_max, media_id)) != NULL &&
-        (bytes = picoquic_frames_varint_decode(bytes, bytes_max, group_id)) != NULL &&
-        (bytes = picoquic_frames_varint_decode(bytes, bytes_max, object_id)) != NULL &&
-        (bytes = picoquic_frames_varint_decode(bytes, bytes_max, object_offset)) != NULL &&
-        (bytes = picoquic_frames_varint_decode(bytes, bytes_max, object_length)) != NULL &&
-        (bytes = picoquic_frames_varint_decode(bytes, bytes_max, queue_delay)) != NULL &&
+    if ((bytes = quicrq_varint_decode(bytes, bytes_max, media_id)) != NULL &&
+        (bytes = quicrq_varint_decode(bytes, bytes_max, group_id)) != NULL &&
+        (bytes = quicrq_varint_decode(bytes, bytes_max, object_id)) != NULL &&
+        (bytes = quicrq_varint_decode(bytes, bytes_max, object_offset)) != NULL &&
+        (bytes = quicrq_varint_decode(bytes, bytes_max, object_length)) != NULL &&
+        (bytes = quicrq_varint_decode(bytes, bytes_max, queue_delay)) != NULL &&
         (bytes = picoquic_frames_uint8_decode(bytes, bytes_max, flags)) != NULL) {
         if (*object_id == 0 && *object_offset == 0) {
-            bytes = picoquic_frames_varint_decode(bytes, bytes_max, nb_objects_previous_group);
+            bytes = quicrq_varint_decode(bytes, bytes_max, nb_objects_previous_group);
         }
         else {
             *nb_objects_previous_group = 0;
@@ -744,6 +1134,412 @@ const uint8_t* quicrq_datagram_header_decode(const uint8_t* bytes, const uint8_t
     return bytes;
 }
 
+/* Decoding of varints in the datagram receive path.
+ * The length of the varint is given by the two most significant bits of the
+ * first byte. If at least 8 bytes are available, the function loads them
+ * all at once and shifts the value in place, without a loop or a switch on
+ * the length. Close to the end of the buffer, it reads one byte at a time.
+ */
+const uint8_t* quicrq_varint_decode(const uint8_t* bytes, const uint8_t* bytes_max, uint64_t* n64)
+{
+    if (bytes == NULL || bytes >= bytes_max) {
+        bytes = NULL;
+    }
+    else {
+        size_t length = ((size_t)1) << (bytes[0] >> 6);
+
+        if (length > (size_t)(bytes_max - bytes)) {
+            bytes = NULL;
+        }
+        else if (bytes_max - bytes >= 8) {
+            uint64_t v = ((uint64_t)bytes[0] << 56) | ((uint64_t)bytes[1] << 48) |
+                ((uint64_t)bytes[2] << 40) | ((uint64_t)bytes[3] << 32) |
+                ((uint64_t)bytes[4] << 24) | ((uint64_t)bytes[5] << 16) |
+                ((uint64_t)bytes[6] << 8) | ((uint64_t)bytes[7]);
+            *n64 = (v >> (64 - 8 * length)) & (UINT64_MAX >> (66 - 8 * length));
+            bytes += length;
+        }
+        else {
+            uint64_t v = bytes[0] & 0x3f;
+            for (size_t i = 1; i < length; i++) {
+                v = (v << 8) | bytes[i];
+            }
+            *n64 = v;
+            bytes += length;
+        }
+    }
+    return bytes;
+}
+
+/* Encoding of the compact datagram header
+ * quicrq_compact_datagram_header {
+ *     media_id (i)
+ *     control (8)
+ *     group_id (8) or group_id (i)
+ *     object_id (i)
+ *     [offset (i)]
+ *     [object_length (i)]
+ *     [queue_delay (i)]
+ *     [flags (8)]
+ *     [nb_objects_previous_group (i)]
+ * }
+ * The bits of the control byte tell which of the optional fields are present.
+ * Absent fields are zero, except the object length, which is implied for the
+ * last fragment of an object: it is then the offset plus the data length.
+ * If QUICRQ_COMPACT_GROUP_TRUNCATED is set, the group ID is reduced to its
+ * least significant byte, and the receiver picks the group ID closest to the
+ * group reference, in the same way that QUIC decodes packet numbers. The
+ * sender only truncates the group ID if the receiver cannot pick the wrong
+ * value, see quicrq_compact_group_can_truncate.
+ */
+uint8_t* quicrq_compact_datagram_header_encode(uint8_t* bytes, uint8_t* bytes_max, uint64_t media_id, uint64_t group_id,
+    int is_group_truncated, uint64_t object_id, uint64_t object_offset, uint64_t queue_delay, uint8_t flags,
+    uint64_t nb_objects_previous_group, uint64_t object_length, int is_final)
+{
+    uint8_t control = 0;
+
+    if (is_group_truncated) {
+        control |= QUICRQ_COMPACT_GROUP_TRUNCATED;
+    }
+    if (object_offset != 0) {
+        control |= QUICRQ_COMPACT_OFFSET_PRESENT;
+    }
+    if (!is_final) {
+        control |= QUICRQ_COMPACT_LENGTH_PRESENT;
+    }
+    if (queue_delay != 0) {
+        control |= QUICRQ_COMPACT_DELAY_PRESENT;
+    }
+    if (flags != 0) {
+        control |= QUICRQ_COMPACT_FLAGS_PRESENT;
+    }
+    if (object_id == 0 && object_offset == 0 && nb_objects_previous_group != 0) {
+        control |= QUICRQ_COMPACT_PREVIOUS_PRESENT;
+    }
+
+    if ((bytes = picoquic_frames_varint_encode(bytes, bytes_max, media_id)) != NULL &&
+        (bytes = picoquic_frames_uint8_encode(bytes, bytes_max, control)) != NULL) {
+        if (is_group_truncated) {
+            bytes = picoquic_frames_uint8_encode(bytes, bytes_max, (uint8_t)(group_id & 0xff));
+        }
+        else {
+            bytes = picoquic_frames_varint_encode(bytes, bytes_max, group_id);
+        }
+        if (bytes != NULL) {
+            bytes = picoquic_frames_varint_encode(bytes, bytes_max, object_id);
+        }
+        if (bytes != NULL && (control & QUICRQ_COMPACT_OFFSET_PRESENT) != 0) {
+            bytes = picoquic_frames_varint_encode(bytes, bytes_max, object_offset);
+        }
+        if (bytes != NULL && (control & QUICRQ_COMPACT_LENGTH_PRESENT) != 0) {
+            bytes = picoquic_frames_varint_encode(bytes, bytes_max, object_length);
+        }
+        if (bytes != NULL && (control & QUICRQ_COMPACT_DELAY_PRESENT) != 0) {
+            bytes = picoquic_frames_varint_encode(bytes, bytes_max, queue_delay);
+        }
+        if (bytes != NULL && (control & QUICRQ_COMPACT_FLAGS_PRESENT) != 0) {
+            bytes = picoquic_frames_uint8_encode(bytes, bytes_max, flags);
+        }
+        if (bytes != NULL && (control & QUICRQ_COMPACT_PREVIOUS_PRESENT) != 0) {
+            bytes = picoquic_frames_varint_encode(bytes, bytes_max, nb_objects_previous_group);
+        }
+    }
+    return bytes;
+}
+
+/* Decode the compact header. If the object length is implied, it is set to
+ * UINT64_MAX, and will be computed once the data length is known. */
+const uint8_t* quicrq_compact_datagram_header_decode(const uint8_t* bytes, const uint8_t* bytes_max, uint64_t group_ref,
+    uint64_t* media_id, uint64_t* group_id, uint64_t* object_id, uint64_t* object_offset, uint64_t* queue_delay,
+    uint8_t* flags, uint64_t* nb_objects_previous_group, uint64_t* object_length)
+{
+    uint8_t control = 0;
+
+    *object_offset = 0;
+    *object_length = UINT64_MAX;
+    *queue_delay = 0;
+    *flags = 0;
+    *nb_objects_previous_group = 0;
+
+    if ((bytes = quicrq_varint_decode(bytes, bytes_max, media_id)) != NULL &&
+        (bytes = picoquic_frames_uint8_decode(bytes, bytes_max, &control)) != NULL) {
+        if ((control & QUICRQ_COMPACT_GROUP_TRUNCATED) != 0) {
+            uint8_t truncated = 0;
+            if ((bytes = picoquic_frames_uint8_decode(bytes, bytes_max, &truncated)) != NULL) {
+                *group_id = quicrq_compact_group_expand(group_ref, truncated);
+            }
+        }
+        else {
+            bytes = quicrq_varint_decode(bytes, bytes_max, group_id);
+        }
+        if (bytes != NULL) {
+            bytes = quicrq_varint_decode(bytes, bytes_max, object_id);
+        }
+        if (bytes != NULL && (control & QUICRQ_COMPACT_OFFSET_PRESENT) != 0) {
+            bytes = quicrq_varint_decode(bytes, bytes_max, object_offset);
+        }
+        if (bytes != NULL && (control & QUICRQ_COMPACT_LENGTH_PRESENT) != 0) {
+            bytes = quicrq_varint_decode(bytes, bytes_max, object_length);
+        }
+        if (bytes != NULL && (control & QUICRQ_COMPACT_DELAY_PRESENT) != 0) {
+            bytes = quicrq_varint_decode(bytes, bytes_max, queue_delay);
+        }
+        if (bytes != NULL && (control & QUICRQ_COMPACT_FLAGS_PRESENT) != 0) {
+            bytes = picoquic_frames_uint8_decode(bytes, bytes_max, flags);
+        }
+        if (bytes != NULL && (control & QUICRQ_COMPACT_PREVIOUS_PRESENT) != 0) {
+            bytes = quicrq_varint_decode(bytes, bytes_max, nb_objects_previous_group);
+        }
+    }
+    return bytes;
+}
+
+/* Recover a truncated group ID: of all the values that end with the
+ * truncated byte, pick the one closest to the reference. */
+uint64_t quicrq_compact_group_expand(uint64_t group_ref, uint8_t truncated)
+{
+    uint64_t group_id = (group_ref & ~((uint64_t)0xff)) | truncated;
+
+    if (group_id + 0x80 <= group_ref && group_id < UINT64_MAX - 0xff) {
+        group_id += 0x100;
+    }
+    else if (group_id > group_ref + 0x80 && group_id >= 0x100) {
+        group_id -= 0x100;
+    }
+    return group_id;
+}
+
+/* The receiver decodes the group ID against the highest group it received,
+ * which is at least the highest group acknowledged by the sender and at
+ * most the highest group sent. The truncation is safe if the group is close
+ * enough to both ends of that range. */
+int quicrq_compact_group_can_truncate(uint64_t group_id, uint64_t group_acked, uint64_t group_sent)
+{
+    uint64_t delta_acked = (group_id > group_acked) ? group_id - group_acked : group_acked - group_id;
+    uint64_t delta_sent = (group_id > group_sent) ? group_id - group_sent : group_sent - group_id;
+
+    return (delta_acked < 0x80 && delta_sent < 0x80);
+}
+
+/* Coalesced datagrams start with a two bytes encoding of the varint 0. The
+ * minimal encoding used for media IDs never produces that pattern, so it
+ * can be told apart from the header of a single fragment datagram.
+ */
+int quicrq_datagram_is_coalesced(const uint8_t* bytes, size_t length)
+{
+    return (length >= QUICRQ_DATAGRAM_COALESCED_MARKER_LENGTH && bytes[0] == 0x40 && bytes[1] == 0);
+}
+
+uint8_t* quicrq_datagram_coalesced_marker_encode(uint8_t* bytes, uint8_t* bytes_max)
+{
+    if (bytes + QUICRQ_DATAGRAM_COALESCED_MARKER_LENGTH > bytes_max) {
+        bytes = NULL;
+    }
+    else {
+        *bytes++ = 0x40;
+        *bytes++ = 0;
+    }
+    return bytes;
+}
+
+/* Decode one fragment of a datagram. In a single fragment datagram, the data
+ * extends to the end of the datagram. In a coalesced datagram, the header is
+ * followed by the data length, and the function returns a pointer to the next
+ * fragment.
+ */
+const uint8_t* quicrq_datagram_fragment_decode(const uint8_t* bytes, const uint8_t* bytes_max, int is_coalesced,
+    uint64_t* media_id, uint64_t* group_id, uint64_t* object_id, uint64_t* object_offset, uint64_t* queue_delay,
+    uint8_t* flags, uint64_t* nb_objects_previous_group, uint64_t* object_length, const uint8_t** data, size_t* data_length)
+{
+    return quicrq_datagram_fragment_decode_ex(bytes, bytes_max, is_coalesced, quicrq_datagram_header_full, 0,
+        media_id, group_id, object_id, object_offset, queue_delay, flags, nb_objects_previous_group, object_length,
+        data, data_length);
+}
+
+/* Decode a fragment sent with the specified header format. The group
+ * reference is only used by the compact format. */
+const uint8_t* quicrq_datagram_fragment_decode_ex(const uint8_t* bytes, const uint8_t* bytes_max, int is_coalesced,
+    quicrq_datagram_header_format_enum header_format, uint64_t group_ref,
+    uint64_t* media_id, uint64_t* group_id, uint64_t* object_id, uint64_t* object_offset, uint64_t* queue_delay,
+    uint8_t* flags, uint64_t* nb_objects_previous_group, uint64_t* object_length, const uint8_t** data, size_t* data_length)
+{
+    if (header_format == quicrq_datagram_header_compact) {
+        bytes = quicrq_compact_datagram_header_decode(bytes, bytes_max, group_ref, media_id, group_id, object_id, object_offset,
+            queue_delay, flags, nb_objects_previous_group, object_length);
+    }
+    else {
+        bytes = quicrq_datagram_header_decode(bytes, bytes_max, media_id, group_id, object_id, object_offset, queue_delay,
+            flags, nb_objects_previous_group, object_length);
+    }
+    if (bytes != NULL) {
+        if (is_coalesced) {
+            uint64_t length = 0;
+            if ((bytes = quicrq_varint_decode(bytes, bytes_max, &length)) != NULL) {
+                if (length > (uint64_t)(bytes_max - bytes)) {
+                    bytes = NULL;
+                }
+                else {
+                    *data = bytes;
+                    *data_length = (size_t)length;
+                    bytes += length;
+                }
+            }
+        }
+        else {
+            *data = bytes;
+            *data_length = bytes_max - bytes;
+            bytes = bytes_max;
+        }
+        if (bytes != NULL && *object_length == UINT64_MAX && header_format == quicrq_datagram_header_compact) {
+            *object_length = *object_offset + *data_length;
+        }
+    }
+    return bytes;
+}
+
+/* Index of local media sources.
+ * Relays and origins may hold thousands of sources, and the URL is looked up
+ * for every subscribe or post. Exact lookups use a hash table, with sources
+ * chained in each bin through "next_in_url_bin". Subscribe patterns need to
+ * find all the sources whose URL starts with a prefix; these lookups use a
+ * splay tree ordered by URL, in which all the URLs sharing a prefix are
+ * contiguous, starting with the prefix itself.
+ */
+#define QUICRQ_SOURCE_URL_BINS_MIN 32
+
+uint64_t quicrq_source_url_hash(const uint8_t* url, size_t url_length)
+{
+    /* FNV-1a */
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < url_length; i++) {
+        hash ^= url[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+static void* quicrq_source_url_node_value(picosplay_node_t* url_node)
+{
+    return (url_node == NULL) ? NULL : (void*)((char*)url_node - offsetof(struct st_quicrq_media_source_ctx_t, url_node));
+}
+
+static int64_t quicrq_source_url_node_compare(void* l, void* r)
+{
+    quicrq_media_source_ctx_t* ls = (quicrq_media_source_ctx_t*)l;
+    quicrq_media_source_ctx_t* rs = (quicrq_media_source_ctx_t*)r;
+    size_t common_length = (ls->media_url_length < rs->media_url_length) ? ls->media_url_length : rs->media_url_length;
+    int64_t ret = (common_length == 0) ? 0 : memcmp(ls->media_url, rs->media_url, common_length);
+
+    if (ret == 0) {
+        if (ls->media_url_length < rs->media_url_length) {
+            ret = -1;
+        }
+        else if (ls->media_url_length > rs->media_url_length) {
+            ret = 1;
+        }
+    }
+    return ret;
+}
+
+static picosplay_node_t* quicrq_source_url_node_create(void* v_srce_ctx)
+{
+    return &((quicrq_media_source_ctx_t*)v_srce_ctx)->url_node;
+}
+
+static void quicrq_source_url_node_delete(void* tree, picosplay_node_t* node)
+{
+    /* The source context is owned by the list of sources, not by the index */
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(tree);
+    UNREFERENCED_PARAMETER(node);
+#endif
+}
+
+void quicrq_source_index_init(quicrq_ctx_t* qr_ctx)
+{
+    picosplay_init_tree(&qr_ctx->source_url_tree, quicrq_source_url_node_compare,
+        quicrq_source_url_node_create, quicrq_source_url_node_delete,
+        quicrq_source_url_node_value);
+}
+
+void quicrq_source_index_release(quicrq_ctx_t* qr_ctx)
+{
+    picosplay_empty_tree(&qr_ctx->source_url_tree);
+    if (qr_ctx->source_url_bins != NULL) {
+        free(qr_ctx->source_url_bins);
+        qr_ctx->source_url_bins = NULL;
+    }
+    qr_ctx->nb_source_url_bins = 0;
+    qr_ctx->nb_sources = 0;
+}
+
+/* Resize the hash table, keeping the load factor below 1. The number of bins is
+ * always a power of 2. */
+static int quicrq_source_index_resize(quicrq_ctx_t* qr_ctx, size_t nb_bins)
+{
+    int ret = 0;
+    quicrq_media_source_ctx_t** new_bins = (quicrq_media_source_ctx_t**)malloc(nb_bins * sizeof(quicrq_media_source_ctx_t*));
+
+    if (new_bins == NULL) {
+        ret = -1;
+    }
+    else {
+        memset(new_bins, 0, nb_bins * sizeof(quicrq_media_source_ctx_t*));
+        for (size_t i = 0; i < qr_ctx->nb_source_url_bins; i++) {
+            quicrq_media_source_ctx_t* srce_ctx = qr_ctx->source_url_bins[i];
+            while (srce_ctx != NULL) {
+                quicrq_media_source_ctx_t* next_in_bin = srce_ctx->next_in_url_bin;
+                size_t bin = (size_t)(srce_ctx->url_hash & (nb_bins - 1));
+                srce_ctx->next_in_url_bin = new_bins[bin];
+                new_bins[bin] = srce_ctx;
+                srce_ctx = next_in_bin;
+            }
+        }
+        if (qr_ctx->source_url_bins != NULL) {
+            free(qr_ctx->source_url_bins);
+        }
+        qr_ctx->source_url_bins = new_bins;
+        qr_ctx->nb_source_url_bins = nb_bins;
+    }
+    return ret;
+}
+
+static int quicrq_source_index_insert(quicrq_ctx_t* qr_ctx, quicrq_media_source_ctx_t* srce_ctx)
+{
+    int ret = 0;
+
+    if (qr_ctx->nb_sources >= qr_ctx->nb_source_url_bins) {
+        size_t nb_bins = (qr_ctx->nb_source_url_bins == 0) ? QUICRQ_SOURCE_URL_BINS_MIN : 2 * qr_ctx->nb_source_url_bins;
+        ret = quicrq_source_index_resize(qr_ctx, nb_bins);
+    }
+    if (ret == 0) {
+        size_t bin = (size_t)(srce_ctx->url_hash & (qr_ctx->nb_source_url_bins - 1));
+        srce_ctx->next_in_url_bin = qr_ctx->source_url_bins[bin];
+        qr_ctx->source_url_bins[bin] = srce_ctx;
+        qr_ctx->nb_sources++;
+        picosplay_insert(&qr_ctx->source_url_tree, srce_ctx);
+    }
+    return ret;
+}
+
+static void quicrq_source_index_remove(quicrq_ctx_t* qr_ctx, quicrq_media_source_ctx_t* srce_ctx)
+{
+    if (qr_ctx->nb_source_url_bins > 0) {
+        quicrq_media_source_ctx_t** p_next = &qr_ctx->source_url_bins[srce_ctx->url_hash & (qr_ctx->nb_source_url_bins - 1)];
+
+        while (*p_next != NULL) {
+            if (*p_next == srce_ctx) {
+                *p_next = srce_ctx->next_in_url_bin;
+                srce_ctx->next_in_url_bin = NULL;
+                qr_ctx->nb_sources--;
+                picosplay_delete_hint(&qr_ctx->source_url_tree, &srce_ctx->url_node);
+                break;
+            }
+            p_next = &(*p_next)->next_in_url_bin;
+        }
+    }
+}
+
 /* Publish local source API.
  */
 
@@ -762,24 +1558,34 @@ quicrq_media_source_ctx_t* quicrq_publish_datagram_source(quicrq_ctx_t* qr_ctx,
             srce_ctx->media_url_length = url_length;
             memcpy(srce_ctx->media_url, url, url_length);
             srce_ctx->is_cache_real_time = is_cache_real_time;
-            if (qr_ctx->last_source == NULL) {
-                qr_ctx->first_source = srce_ctx;
-                qr_ctx->last_source = srce_ctx;
+            srce_ctx->qr_ctx = qr_ctx;
+            quicrq_timer_init(&srce_ctx->cache_delete_timer, quicrq_timer_cache_delete);
+            srce_ctx->url_hash = quicrq_source_url_hash(url, url_length);
+            if (quicrq_source_index_insert(qr_ctx, srce_ctx) != 0) {
+                DBG_PRINTF("%s", "Cannot index new source");
+                free(srce_ctx);
+                srce_ctx = NULL;
             }
             else {
-                qr_ctx->last_source->next_source = srce_ctx;
-                srce_ctx->previous_source = qr_ctx->last_source;
-                qr_ctx->last_source = srce_ctx;
-            }
-            srce_ctx->cache_ctx = cache_ctx;
-            srce_ctx->is_local_object_source = is_local_object_source;
-
-            // Called in the case there exists streams on the cnx
-            // For publish object source, it is a no-op
-            if (quicrq_notify_url_to_all(qr_ctx, url, url_length) < 0) {
-                DBG_PRINTF("%s", "Fail to notify new source");
-                quicrq_delete_source(srce_ctx, qr_ctx);
-                srce_ctx = NULL;
+                if (qr_ctx->last_source == NULL) {
+                    qr_ctx->first_source = srce_ctx;
+                    qr_ctx->last_source = srce_ctx;
+                }
+                else {
+                    qr_ctx->last_source->next_source = srce_ctx;
+                    srce_ctx->previous_source = qr_ctx->last_source;
+                    qr_ctx->last_source = srce_ctx;
+                }
+                srce_ctx->cache_ctx = cache_ctx;
+                srce_ctx->is_local_object_source = is_local_object_source;
+
+                // Called in the case there exists streams on the cnx
+                // For publish object source, it is a no-op
+                if (quicrq_notify_url_to_all(qr_ctx, url, url_length) < 0) {
+                    DBG_PRINTF("%s", "Fail to notify new source");
+                    quicrq_delete_source(srce_ctx, qr_ctx);
+                    srce_ctx = NULL;
+                }
             }
         }
     }
@@ -793,6 +1599,28 @@ void quicrq_set_default_source(quicrq_ctx_t* qr_ctx, quicrq_default_source_fn de
     qr_ctx->default_source_ctx = default_source_ctx;
 }
 
+/* Remove a source from the list of pending wakeups, e.g., when the source is deleted */
+static void quicrq_source_wakeup_cancel(quicrq_media_source_ctx_t* srce_ctx, quicrq_ctx_t* qr_ctx)
+{
+    if (srce_ctx->is_wakeup_pending) {
+        if (srce_ctx->previous_pending_wakeup == NULL) {
+            qr_ctx->first_pending_wakeup = srce_ctx->next_pending_wakeup;
+        }
+        else {
+            srce_ctx->previous_pending_wakeup->next_pending_wakeup = srce_ctx->next_pending_wakeup;
+        }
+        if (srce_ctx->next_pending_wakeup == NULL) {
+            qr_ctx->last_pending_wakeup = srce_ctx->previous_pending_wakeup;
+        }
+        else {
+            srce_ctx->next_pending_wakeup->previous_pending_wakeup = srce_ctx->previous_pending_wakeup;
+        }
+        srce_ctx->next_pending_wakeup = NULL;
+        srce_ctx->previous_pending_wakeup = NULL;
+        srce_ctx->is_wakeup_pending = 0;
+    }
+}
+
 void quicrq_delete_source(quicrq_media_source_ctx_t* srce_ctx, quicrq_ctx_t* qr_ctx)
 {
     quicrq_stream_ctx_t* stream_ctx = srce_ctx->first_stream;
@@ -807,6 +1635,10 @@ void quicrq_delete_source(quicrq_media_source_ctx_t* srce_ctx, quicrq_ctx_t* qr_
         stream_ctx = next_stream_ctx;
     }
 
+    quicrq_source_index_remove(qr_ctx, srce_ctx);
+    quicrq_source_wakeup_cancel(srce_ctx, qr_ctx);
+    quicrq_timer_cancel(qr_ctx, &srce_ctx->cache_delete_timer);
+
     if (srce_ctx == qr_ctx->first_source) {
         qr_ctx->first_source = srce_ctx->next_source;
     }
@@ -845,19 +1677,62 @@ quicrq_media_source_ctx_t* quicrq_create_default_source(quicrq_ctx_t* qr_ctx, co
 /* Find whether the local context for a media source */
 quicrq_media_source_ctx_t* quicrq_find_local_media_source(quicrq_ctx_t* qr_ctx, const uint8_t* url, const size_t url_length)
 {
-    quicrq_media_source_ctx_t* srce_ctx = qr_ctx->first_source;
+    quicrq_media_source_ctx_t* srce_ctx = NULL;
 
     /* Find whether there is a matching media published locally */
-    while (srce_ctx != NULL) {
-        if (url_length == srce_ctx->media_url_length &&
-            memcmp(url, srce_ctx->media_url, url_length) == 0) {
-            break;
+    if (qr_ctx->nb_source_url_bins > 0) {
+        uint64_t url_hash = quicrq_source_url_hash(url, url_length);
+
+        srce_ctx = qr_ctx->source_url_bins[url_hash & (qr_ctx->nb_source_url_bins - 1)];
+        while (srce_ctx != NULL) {
+            if (srce_ctx->url_hash == url_hash &&
+                url_length == srce_ctx->media_url_length &&
+                memcmp(url, srce_ctx->media_url, url_length) == 0) {
+                break;
+            }
+            srce_ctx = srce_ctx->next_in_url_bin;
         }
-        srce_ctx = srce_ctx->next_source;
     }
     return srce_ctx;
 }
 
+/* Iterate through the local sources whose URL starts with the specified prefix,
+ * in URL order. */
+static quicrq_media_source_ctx_t* quicrq_source_if_prefix(picosplay_node_t* url_node, const uint8_t* prefix, size_t prefix_length)
+{
+    quicrq_media_source_ctx_t* srce_ctx = (quicrq_media_source_ctx_t*)quicrq_source_url_node_value(url_node);
+
+    if (srce_ctx != NULL && (srce_ctx->media_url_length < prefix_length ||
+        (prefix_length > 0 && memcmp(srce_ctx->media_url, prefix, prefix_length) != 0))) {
+        srce_ctx = NULL;
+    }
+    return srce_ctx;
+}
+
+quicrq_media_source_ctx_t* quicrq_first_source_with_prefix(quicrq_ctx_t* qr_ctx, const uint8_t* prefix, size_t prefix_length)
+{
+    quicrq_media_source_ctx_t key = { 0 };
+    picosplay_node_t* url_node = NULL;
+
+    key.media_url = (uint8_t*)prefix;
+    key.media_url_length = prefix_length;
+    /* The prefix sorts before all the URLs that extend it. Start after the last
+     * URL strictly lower than the prefix. */
+    url_node = picosplay_find_previous(&qr_ctx->source_url_tree, &key);
+    if (url_node == NULL) {
+        url_node = picosplay_first(&qr_ctx->source_url_tree);
+    }
+    else if (quicrq_source_url_node_compare(quicrq_source_url_node_value(url_node), &key) < 0) {
+        url_node = picosplay_next(url_node);
+    }
+    return quicrq_source_if_prefix(url_node, prefix, prefix_length);
+}
+
+quicrq_media_source_ctx_t* quicrq_next_source_with_prefix(quicrq_media_source_ctx_t* srce_ctx, const uint8_t* prefix, size_t prefix_length)
+{
+    return quicrq_source_if_prefix(picosplay_next(&srce_ctx->url_node), prefix, prefix_length);
+}
+
 /* Parse incoming request, connect incoming stream to media source
  */
 int quicrq_subscribe_local_media(quicrq_stream_ctx_t* stream_ctx, const uint8_t* url, const size_t url_length)
@@ -887,6 +1762,7 @@ int quicrq_subscribe_local_media(quicrq_stream_ctx_t* stream_ctx, const uint8_t*
             stream_ctx->previous_stream_for_source = srce_ctx->last_stream;
             srce_ctx->last_stream = stream_ctx;
         }
+        quicrq_source_feedback_count(srce_ctx, stream_ctx, 1);
         /* set the cache policy */
         stream_ctx->is_cache_real_time = srce_ctx->is_cache_real_time;
         /* Create a subscribe media context */
@@ -899,6 +1775,8 @@ int quicrq_subscribe_local_media(quicrq_stream_ctx_t* stream_ctx, const uint8_t*
         else {
             quicrq_log_message(stream_ctx->cnx_ctx, "Set a subscription to URL: %s",
                 quicrq_uint8_t_to_text(url, url_length, buffer, 256));
+            /* The new subscriber is not limited until it sends feedback */
+            quicrq_source_feedback_update(srce_ctx);
         }
     }
     return ret;
@@ -914,6 +1792,7 @@ void quicrq_unsubscribe_local_media(quicrq_stream_ctx_t* stream_ctx)
         quicrq_stream_ctx_t* previous = stream_ctx->previous_stream_for_source;
         quicrq_stream_ctx_t* next = stream_ctx->next_stream_for_source;
 
+        quicrq_source_feedback_count(srce_ctx, stream_ctx, 0);
         if (next != NULL) {
             next->previous_stream_for_source = previous;
         }
@@ -930,6 +1809,120 @@ void quicrq_unsubscribe_local_media(quicrq_stream_ctx_t* stream_ctx)
         stream_ctx->media_source = NULL;
         stream_ctx->previous_stream_for_source = NULL;
         stream_ctx->next_stream_for_source = NULL;
+        quicrq_source_feedback_update(srce_ctx);
+    }
+}
+
+static void quicrq_source_feedback_highest_add(quicrq_media_source_ctx_t* srce_ctx, uint8_t flags, uint64_t bitrate)
+{
+    if (srce_ctx->nb_feedback_highest_flags == 0 || flags > srce_ctx->feedback_highest_flags) {
+        srce_ctx->feedback_highest_flags = flags;
+        srce_ctx->nb_feedback_highest_flags = 1;
+    }
+    else if (flags == srce_ctx->feedback_highest_flags) {
+        srce_ctx->nb_feedback_highest_flags++;
+    }
+    if (bitrate == 0) {
+        /* Not counted in the highest bitrate */
+    }
+    else if (srce_ctx->nb_feedback_highest_bitrate == 0 || bitrate > srce_ctx->feedback_highest_bitrate) {
+        srce_ctx->feedback_highest_bitrate = bitrate;
+        srce_ctx->nb_feedback_highest_bitrate = 1;
+    }
+    else if (bitrate == srce_ctx->feedback_highest_bitrate) {
+        srce_ctx->nb_feedback_highest_bitrate++;
+    }
+}
+
+/* Count the feedback of a stream in the running aggregate of its source, when
+ * the stream is added to the source or its feedback is set, or remove it, when
+ * the stream leaves or before its feedback changes. The highest values are
+ * only marked stale when the last stream that requested them is removed.
+ */
+void quicrq_source_feedback_count(quicrq_media_source_ctx_t* srce_ctx, quicrq_stream_ctx_t* stream_ctx, int is_added)
+{
+    uint8_t flags = stream_ctx->feedback.max_flags;
+    uint64_t bitrate = stream_ctx->feedback.target_bitrate;
+
+    if (!stream_ctx->is_feedback_set) {
+        if (is_added) {
+            srce_ctx->nb_feedback_unset++;
+        }
+        else {
+            srce_ctx->nb_feedback_unset--;
+        }
+    }
+    else if (is_added) {
+        if (bitrate == 0) {
+            srce_ctx->nb_feedback_unlimited_rate++;
+        }
+        if (!srce_ctx->is_feedback_highest_stale) {
+            /* If stale, computed again from all the streams in quicrq_source_feedback_update */
+            quicrq_source_feedback_highest_add(srce_ctx, flags, bitrate);
+        }
+    }
+    else {
+        if (bitrate == 0) {
+            srce_ctx->nb_feedback_unlimited_rate--;
+        }
+        if (flags == srce_ctx->feedback_highest_flags && srce_ctx->nb_feedback_highest_flags > 0) {
+            srce_ctx->nb_feedback_highest_flags--;
+            if (srce_ctx->nb_feedback_highest_flags == 0) {
+                srce_ctx->is_feedback_highest_stale = 1;
+            }
+        }
+        if (bitrate != 0 && bitrate == srce_ctx->feedback_highest_bitrate && srce_ctx->nb_feedback_highest_bitrate > 0) {
+            srce_ctx->nb_feedback_highest_bitrate--;
+            if (srce_ctx->nb_feedback_highest_bitrate == 0) {
+                srce_ctx->is_feedback_highest_stale = 1;
+            }
+        }
+    }
+}
+
+/* Aggregate the feedback of the streams subscribed to a source: the highest
+ * layer and the highest bitrate requested by any subscriber. Subscribers that
+ * did not send feedback are not limited, which is signalled with max flags 0xff
+ * and target bitrate 0. When the aggregate changes, relays forward it upstream,
+ * see quicrq_relay_forward_feedback. The aggregate is read from the running
+ * counts, and the streams are only scanned if the highest values are stale.
+ */
+void quicrq_source_feedback_update(quicrq_media_source_ctx_t* srce_ctx)
+{
+    uint8_t max_flags = 0xff;
+    uint64_t target_bitrate = 0;
+    int is_limited = (srce_ctx->first_stream != NULL && srce_ctx->nb_feedback_unset == 0);
+
+    if (srce_ctx->is_feedback_highest_stale) {
+        quicrq_stream_ctx_t* stream_ctx = srce_ctx->first_stream;
+
+        srce_ctx->feedback_highest_flags = 0;
+        srce_ctx->nb_feedback_highest_flags = 0;
+        srce_ctx->feedback_highest_bitrate = 0;
+        srce_ctx->nb_feedback_highest_bitrate = 0;
+        srce_ctx->is_feedback_highest_stale = 0;
+        while (stream_ctx != NULL) {
+            if (stream_ctx->is_feedback_set) {
+                quicrq_source_feedback_highest_add(srce_ctx, stream_ctx->feedback.max_flags, stream_ctx->feedback.target_bitrate);
+            }
+            stream_ctx = stream_ctx->next_stream_for_source;
+        }
+    }
+    if (is_limited) {
+        max_flags = srce_ctx->feedback_highest_flags;
+        if (srce_ctx->nb_feedback_unlimited_rate == 0) {
+            target_bitrate = srce_ctx->feedback_highest_bitrate;
+        }
+    }
+    if ((is_limited || srce_ctx->is_feedback_forwarded) &&
+        (!srce_ctx->is_feedback_forwarded || max_flags != srce_ctx->feedback_max_flags ||
+            target_bitrate != srce_ctx->feedback_target_bitrate)) {
+        srce_ctx->feedback_max_flags = max_flags;
+        srce_ctx->feedback_target_bitrate = target_bitrate;
+        srce_ctx->is_feedback_forwarded = 1;
+        if (srce_ctx->qr_ctx != NULL && srce_ctx->qr_ctx->manage_relay_feedback_fn != NULL) {
+            srce_ctx->qr_ctx->manage_relay_feedback_fn(srce_ctx->qr_ctx, srce_ctx, max_flags, target_bitrate);
+        }
     }
 }
 
@@ -964,17 +1957,56 @@ static void quicrq_set_control_stream_priority(quicrq_stream_ctx_t* stream_ctx)
  * wakeup on the arrival of fragments. This is also required for Warp.
  */
 
-static void quicrq_set_rush_stream_priority(quicrq_uni_stream_ctx_t* uni_stream_ctx)
+/* Priority classes of uni streams.
+ * The class of a uni stream is set by the flags of its objects, as for the
+ * control stream. In the "group based + priorities" congestion mode, the
+ * streams of older groups are moved down one class per group of age, up to
+ * QUICRQ_UNI_STREAM_AGE_MAX classes, so that newer groups preempt stale ones
+ * on the wire. Streams of flags 0x80, e.g., audio, are not moved down.
+ */
+#define QUICRQ_UNI_STREAM_AGE_MAX 3
+
+static uint8_t quicrq_uni_stream_priority(quicrq_stream_ctx_t* stream_ctx, uint8_t flags, uint64_t group_id, int use_fifo)
 {
-    if (uni_stream_ctx->stream_priority == 0) {
-        uint8_t flags = quicrq_fragment_get_flags(uni_stream_ctx->control_stream_ctx->media_ctx->cache_ctx,
-            uni_stream_ctx->current_group_id, uni_stream_ctx->current_object_id);
+    uint8_t stream_priority = quicrq_flags_to_picoquic_stream_priority(flags, use_fifo);
+    uint64_t highest_group_id = stream_ctx->media_ctx->cache_ctx->highest_group_id;
+
+    if (group_id < highest_group_id && stream_ctx->media_ctx->congestion_control_mode == quicrq_congestion_control_group_p &&
+        flags != 0x80) {
+        uint64_t age = highest_group_id - group_id;
 
-        if (flags != 0) {
-            uni_stream_ctx->stream_priority = quicrq_flags_to_picoquic_stream_priority(flags, 1);
-            (void)picoquic_set_stream_priority(uni_stream_ctx->control_stream_ctx->cnx_ctx->cnx,
-                uni_stream_ctx->stream_id, uni_stream_ctx->stream_priority);
+        if (age > QUICRQ_UNI_STREAM_AGE_MAX) {
+            age = QUICRQ_UNI_STREAM_AGE_MAX;
         }
+        while (age > 0 && stream_priority < 0xfe) {
+            stream_priority += 2;
+            age--;
+        }
+    }
+    return stream_priority;
+}
+
+static void quicrq_set_uni_stream_priority(quicrq_uni_stream_ctx_t* uni_stream_ctx, uint8_t stream_priority)
+{
+    if (uni_stream_ctx->stream_priority != stream_priority) {
+        uni_stream_ctx->stream_priority = stream_priority;
+        (void)picoquic_set_stream_priority(uni_stream_ctx->control_stream_ctx->cnx_ctx->cnx,
+            uni_stream_ctx->stream_id, stream_priority);
+    }
+}
+
+/* In rush mode, each stream carries one object, and the class is set by the flags of
+ * that object once they are known.
+ */
+static void quicrq_set_rush_stream_priority(quicrq_uni_stream_ctx_t* uni_stream_ctx)
+{
+    if (uni_stream_ctx->priority_flags == 0) {
+        uni_stream_ctx->priority_flags = quicrq_fragment_get_flags(uni_stream_ctx->control_stream_ctx->media_ctx->cache_ctx,
+            uni_stream_ctx->current_group_id, uni_stream_ctx->current_object_id);
+    }
+    if (uni_stream_ctx->priority_flags != 0) {
+        quicrq_set_uni_stream_priority(uni_stream_ctx, quicrq_uni_stream_priority(uni_stream_ctx->control_stream_ctx,
+            uni_stream_ctx->priority_flags, uni_stream_ctx->current_group_id, 1));
     }
 }
 
@@ -1058,8 +2090,9 @@ void quicrq_wakeup_media_uni_stream(quicrq_stream_ctx_t* stream_ctx)
     /* loop through all the unistreams, since more than one can be active */
     quicrq_uni_stream_ctx_t* uni_stream_ctx = stream_ctx->first_uni_stream;
     while (uni_stream_ctx != NULL) {
-        if (uni_stream_ctx->send_state != quicrq_sending_warp_should_close) {
+        if (uni_stream_ctx->send_state != quicrq_sending_warp_should_close && !uni_stream_ctx->is_active_stream) {
             /* TODO: the used contexts should be removed, so the test above will not be needed. */
+            uni_stream_ctx->is_active_stream = 1;
             picoquic_mark_active_stream(uni_stream_ctx->control_stream_ctx->cnx_ctx->cnx, uni_stream_ctx->stream_id, 1, uni_stream_ctx);
         }
         uni_stream_ctx = uni_stream_ctx->next_uni_stream_for_control_stream;
@@ -1074,6 +2107,7 @@ void quicrq_wakeup_media_uni_stream(quicrq_stream_ctx_t* stream_ctx)
             uni_created = 1;
             ctx->current_group_id = i;
             stream_ctx->next_warp_group_id = i + 1;
+            ctx->is_active_stream = 1;
             picoquic_mark_active_stream(ctx->control_stream_ctx->cnx_ctx->cnx,
                 ctx->stream_id, 1, ctx);
         }
@@ -1092,27 +2126,13 @@ void quicrq_wakeup_media_uni_stream(quicrq_stream_ctx_t* stream_ctx)
         quicrq_set_control_stream_priority(stream_ctx);
     }
     if (uni_created && stream_ctx->lowest_flags != 0) {
-        uint8_t uni_stream_priority = quicrq_flags_to_picoquic_stream_priority(stream_ctx->lowest_flags, 0);
         uni_stream_ctx = stream_ctx->first_uni_stream;
 
         while (uni_stream_ctx != NULL) {
             if (uni_stream_ctx->send_state != quicrq_sending_warp_should_close) {
-                if (uni_stream_ctx->current_group_id == highest_group_id) {
-                    (void)picoquic_set_stream_priority(stream_ctx->cnx_ctx->cnx, uni_stream_ctx->stream_id, uni_stream_priority);
-                    uni_stream_ctx->stream_priority = uni_stream_priority;
-                }
-                else
-                {
-                    uint8_t lower_uni_stream_priority = uni_stream_priority;
-                    if (stream_ctx->media_ctx != NULL && stream_ctx->media_ctx->congestion_control_mode == quicrq_congestion_control_group_p &&
-                        stream_ctx->lowest_flags != 0x80 && lower_uni_stream_priority < 0xfe) {
-                        lower_uni_stream_priority += 2;
-                    }
-                    if (uni_stream_ctx->stream_priority != lower_uni_stream_priority) {
-                        (void)picoquic_set_stream_priority(stream_ctx->cnx_ctx->cnx, uni_stream_ctx->stream_id, lower_uni_stream_priority);
-                        uni_stream_ctx->stream_priority = lower_uni_stream_priority;
-                    }
-                }
+                uni_stream_ctx->priority_flags = stream_ctx->lowest_flags;
+                quicrq_set_uni_stream_priority(uni_stream_ctx, quicrq_uni_stream_priority(stream_ctx,
+                    stream_ctx->lowest_flags, uni_stream_ctx->current_group_id, 0));
             }
             uni_stream_ctx = uni_stream_ctx->next_uni_stream_for_control_stream;
         }
@@ -1124,7 +2144,11 @@ void quicrq_wakeup_media_stream(quicrq_stream_ctx_t* stream_ctx)
 {
     if (stream_ctx->cnx_ctx->cnx != NULL) {
         if (stream_ctx->transport_mode == quicrq_transport_mode_single_stream) {
-            picoquic_mark_active_stream(stream_ctx->cnx_ctx->cnx, stream_ctx->stream_id, 1, stream_ctx);
+            /* If the stream is already active, picoquic will call prepare to send */
+            if (!stream_ctx->is_active_stream) {
+                stream_ctx->is_active_stream = 1;
+                picoquic_mark_active_stream(stream_ctx->cnx_ctx->cnx, stream_ctx->stream_id, 1, stream_ctx);
+            }
         }
         else {
             if (!stream_ctx->is_final_object_id_sent && stream_ctx->media_ctx != NULL &&
@@ -1140,13 +2164,16 @@ void quicrq_wakeup_media_stream(quicrq_stream_ctx_t* stream_ctx)
                 (!stream_ctx->is_final_object_id_sent &&
                     ( stream_ctx->final_group_id != 0 ||
                         stream_ctx->final_object_id != 0))){
-                picoquic_mark_active_stream(stream_ctx->cnx_ctx->cnx, stream_ctx->stream_id, 1, stream_ctx);
+                (void)quicrq_mark_control_stream_active(stream_ctx);
                 quicrq_set_control_stream_priority(stream_ctx);
             }
 
             if (stream_ctx->transport_mode == quicrq_transport_mode_datagram) {
-                stream_ctx->is_active_datagram = 1;
-                picoquic_mark_datagram_ready(stream_ctx->cnx_ctx->cnx, 1);
+                /* If the stream is already active, the connection is already marked ready */
+                if (!stream_ctx->is_active_datagram) {
+                    stream_ctx->is_active_datagram = 1;
+                    picoquic_mark_datagram_ready(stream_ctx->cnx_ctx->cnx, 1);
+                }
             }
             else if (stream_ctx->transport_mode == quicrq_transport_mode_warp) {
                 /* handle case of handling warp mode */
@@ -1181,11 +2208,7 @@ void quicrq_wakeup_media_stream(quicrq_stream_ctx_t* stream_ctx)
 }
 
 
-/* When data is available for a source, wake up the corresponding connection 
- * and possibly stream.
- * TODO: for datagram, we may want to manage a queue of media for which data is ready.
- */
-void quicrq_source_wakeup(quicrq_media_source_ctx_t* srce_ctx)
+static void quicrq_source_wakeup_streams(quicrq_media_source_ctx_t* srce_ctx)
 {
     quicrq_stream_ctx_t* stream_ctx = srce_ctx->first_stream;
     while (stream_ctx != NULL) {
@@ -1194,6 +2217,56 @@ void quicrq_source_wakeup(quicrq_media_source_ctx_t* srce_ctx)
     }
 }
 
+/* When data is available for a source, wake up the corresponding connection 
+ * and possibly stream.
+ * A popular source may have a large number of subscribers, and receive
+ * many fragments between two iterations of the packet loop. Instead of
+ * waking up all the streams for each fragment, the source is queued in
+ * the list of pending wakeups, and the streams are woken up once when
+ * the list is flushed by `quicrq_time_check`. Sources that are not
+ * attached to a quicrq context are woken up immediately.
+ */
+void quicrq_source_wakeup(quicrq_media_source_ctx_t* srce_ctx)
+{
+    quicrq_ctx_t* qr_ctx = srce_ctx->qr_ctx;
+
+    if (qr_ctx == NULL) {
+        quicrq_source_wakeup_streams(srce_ctx);
+    }
+    else if (!srce_ctx->is_wakeup_pending) {
+        srce_ctx->is_wakeup_pending = 1;
+        srce_ctx->next_pending_wakeup = NULL;
+        srce_ctx->previous_pending_wakeup = qr_ctx->last_pending_wakeup;
+        if (qr_ctx->last_pending_wakeup == NULL) {
+            qr_ctx->first_pending_wakeup = srce_ctx;
+        }
+        else {
+            qr_ctx->last_pending_wakeup->next_pending_wakeup = srce_ctx;
+        }
+        qr_ctx->last_pending_wakeup = srce_ctx;
+    }
+}
+
+/* Wake up the streams of all the sources that received data since the last flush */
+void quicrq_source_wakeup_flush(quicrq_ctx_t* qr_ctx)
+{
+    quicrq_media_source_ctx_t* srce_ctx;
+
+    while ((srce_ctx = qr_ctx->first_pending_wakeup) != NULL) {
+        qr_ctx->first_pending_wakeup = srce_ctx->next_pending_wakeup;
+        if (qr_ctx->first_pending_wakeup == NULL) {
+            qr_ctx->last_pending_wakeup = NULL;
+        }
+        else {
+            qr_ctx->first_pending_wakeup->previous_pending_wakeup = NULL;
+        }
+        srce_ctx->next_pending_wakeup = NULL;
+        srce_ctx->is_wakeup_pending = 0;
+        quicrq_source_wakeup_streams(srce_ctx);
+    }
+}
+
+
 /* Request media in connection.
  * Send a media request to the server.
  */
@@ -1222,15 +2295,22 @@ int quicrq_cnx_subscribe_media_ex(quicrq_cnx_ctx_t* cnx_ctx, const uint8_t* url,
         else {
             /* Format the media request */
             uint64_t media_id = stream_ctx->cnx_ctx->next_media_id;
+            quicrq_datagram_header_format_enum header_format = (transport_mode == quicrq_transport_mode_datagram &&
+                cnx_ctx->qr_ctx->is_compact_datagram_header) ? quicrq_datagram_header_compact : quicrq_datagram_header_full;
+            size_t fragment_size = (transport_mode == quicrq_transport_mode_datagram) ? cnx_ctx->qr_ctx->fragment_size : 0;
+            size_t fec_window = (transport_mode == quicrq_transport_mode_datagram) ? cnx_ctx->qr_ctx->datagram_fec_window : 0;
             uint8_t* message_next = quicrq_rq_msg_encode(message->buffer, message->buffer + message->buffer_alloc,
                 QUICRQ_ACTION_REQUEST, url_length, url, media_id, transport_mode,
-                intent->intent_mode, intent->start_group_id, intent->start_object_id);
+                intent->intent_mode, intent->start_group_id, intent->start_object_id, header_format, fragment_size, fec_window);
             if (message_next == NULL) {
                 ret = -1;
             } else {
                 char buffer[256];
                 /* Queue the media request message to that stream */
                 stream_ctx->transport_mode = transport_mode;
+                stream_ctx->datagram_header_format = header_format;
+                stream_ctx->fragment_size = fragment_size;
+                stream_ctx->fec_window = fec_window;
                 stream_ctx->media_id = media_id;
                 message->message_size = message_next - message->buffer;
                 stream_ctx->consumer_fn = media_consumer_fn;
@@ -1257,6 +2337,91 @@ int quicrq_cnx_subscribe_media(quicrq_cnx_ctx_t* cnx_ctx, const uint8_t* url, si
         transport_mode, NULL, media_consumer_fn, media_ctx, NULL);
 }
 
+/* Subscribe to several media in a single batch request. All the media are
+ * received as datagrams, with the same intent. One track context is created
+ * for each media, and returned in p_track_ctx if the caller needs them.
+ */
+int quicrq_cnx_subscribe_media_batch(quicrq_cnx_ctx_t* cnx_ctx, size_t nb_tracks, const uint8_t** url, const size_t* url_length,
+    const quicrq_subscribe_intent_t* intent, quicrq_media_consumer_fn media_consumer_fn, void** media_ctx,
+    quicrq_stream_ctx_t** p_track_ctx)
+{
+    int ret = 0;
+    quicrq_stream_ctx_t* stream_ctx = NULL;
+    size_t reserve = 0;
+    static const quicrq_subscribe_intent_t default_intent = { quicrq_subscribe_intent_start_point, 0, 0 };
+
+    if (intent == NULL) {
+        intent = &default_intent;
+    }
+    if (nb_tracks > 0 && nb_tracks <= QUICRQ_BATCH_TRACKS_MAX) {
+        reserve = quicrq_batch_rq_msg_reserve(nb_tracks, url_length, intent->intent_mode);
+    }
+
+    if (reserve == 0 || reserve > 0xFFFF) {
+        /* The whole batch is sent in a single control message. */
+        ret = -1;
+    }
+    else if ((stream_ctx = quicrq_create_stream_context(cnx_ctx, picoquic_get_next_local_stream_id(cnx_ctx->cnx, 0))) == NULL) {
+        ret = -1;
+    }
+    else if (quicrq_msg_buffer_alloc(&stream_ctx->message_sent, reserve, 0) != 0) {
+        ret = -1;
+    }
+    else {
+        quicrq_message_buffer_t* message = &stream_ctx->message_sent;
+        uint64_t first_media_id = cnx_ctx->next_media_id;
+        quicrq_datagram_header_format_enum header_format = (cnx_ctx->qr_ctx->is_compact_datagram_header) ?
+            quicrq_datagram_header_compact : quicrq_datagram_header_full;
+        uint8_t* message_next = quicrq_batch_rq_msg_encode(message->buffer, message->buffer + message->buffer_alloc,
+            QUICRQ_ACTION_REQUEST_BATCH, first_media_id, intent->intent_mode, intent->start_group_id, intent->start_object_id,
+            header_format, nb_tracks, url, url_length);
+
+        if (message_next == NULL) {
+            ret = -1;
+        }
+        else {
+            /* Queue the batch request message to that stream */
+            message->message_size = message_next - message->buffer;
+            stream_ctx->is_batch = 1;
+            stream_ctx->media_id = UINT64_MAX;
+            stream_ctx->datagram_header_format = header_format;
+            stream_ctx->send_state = quicrq_sending_initial;
+            stream_ctx->receive_state = quicrq_receive_confirmation;
+            for (size_t i = 0; ret == 0 && i < nb_tracks; i++) {
+                quicrq_stream_ctx_t* track_ctx = quicrq_create_track_context(stream_ctx, first_media_id + i);
+                if (track_ctx == NULL) {
+                    ret = -1;
+                }
+                else {
+                    track_ctx->receive_state = quicrq_receive_fragment;
+                    if (p_track_ctx != NULL) {
+                        p_track_ctx[i] = track_ctx;
+                    }
+                }
+            }
+        }
+    }
+
+    if (ret == 0) {
+        /* Set the consumers only after all tracks are created, so failures do not close them */
+        quicrq_stream_ctx_t* track_ctx = stream_ctx->first_track;
+        for (size_t i = 0; i < nb_tracks; i++) {
+            track_ctx->consumer_fn = media_consumer_fn;
+            track_ctx->media_ctx = media_ctx[i];
+            track_ctx = track_ctx->next_track;
+        }
+        cnx_ctx->next_media_id += nb_tracks;
+        ret = quicrq_mark_control_stream_active(stream_ctx);
+        quicrq_log_message(cnx_ctx, "Posting batch subscribe to %zu URLs on stream %" PRIu64,
+            nb_tracks, stream_ctx->stream_id);
+    }
+    else if (stream_ctx != NULL) {
+        stream_ctx->close_reason = quicrq_media_close_internal_error;
+        quicrq_delete_stream_ctx(cnx_ctx, stream_ctx);
+    }
+    return ret;
+}
+
 /* Process an incoming subscribe command */
 int quicrq_cnx_connect_media_source(quicrq_stream_ctx_t* stream_ctx, uint8_t * url, size_t url_length)
 {
@@ -1358,6 +2523,10 @@ int quicrq_cnx_accept_media(quicrq_stream_ctx_t * stream_ctx, const uint8_t* url
     int ret = 0;
     quicrq_message_buffer_t* message = &stream_ctx->message_sent;
     uint64_t media_id = (transport_mode == quicrq_transport_mode_single_stream)?0:stream_ctx->cnx_ctx->next_media_id;
+    quicrq_datagram_header_format_enum header_format = (transport_mode == quicrq_transport_mode_datagram &&
+        stream_ctx->cnx_ctx->qr_ctx->is_compact_datagram_header) ? quicrq_datagram_header_compact : quicrq_datagram_header_full;
+    size_t fragment_size = (transport_mode == quicrq_transport_mode_datagram) ? stream_ctx->cnx_ctx->qr_ctx->fragment_size : 0;
+    size_t fec_window = (transport_mode == quicrq_transport_mode_datagram) ? stream_ctx->cnx_ctx->qr_ctx->datagram_fec_window : 0;
 
     /* Format the accept message */
     if (quicrq_msg_buffer_alloc(message, quicrq_accept_msg_reserve(transport_mode, media_id), 0) != 0) {
@@ -1365,7 +2534,7 @@ int quicrq_cnx_accept_media(quicrq_stream_ctx_t * stream_ctx, const uint8_t* url
     }
     else {
         uint8_t* message_next = quicrq_accept_msg_encode(message->buffer, message->buffer + message->buffer_alloc,
-            QUICRQ_ACTION_ACCEPT, transport_mode, media_id);
+            QUICRQ_ACTION_ACCEPT, transport_mode, media_id, header_format, fragment_size, fec_window);
         if (message_next == NULL) {
             ret = -1;
         }
@@ -1373,6 +2542,9 @@ int quicrq_cnx_accept_media(quicrq_stream_ctx_t * stream_ctx, const uint8_t* url
             /* Queue the accept message to that stream */
             char buffer[256];
             stream_ctx->transport_mode = transport_mode;
+            stream_ctx->datagram_header_format = header_format;
+            stream_ctx->fragment_size = fragment_size;
+            stream_ctx->fec_window = fec_window;
             message->message_size = message_next - message->buffer;
             stream_ctx->send_state = quicrq_sending_initial;
             stream_ctx->receive_state = quicrq_receive_fragment;
@@ -1458,7 +2630,7 @@ int quicrq_cnx_handle_consumer_finished(quicrq_stream_ctx_t* stream_ctx, int is_
         if (stream_ctx->close_reason == quicrq_media_close_reason_unknown) {
             stream_ctx->close_reason = quicrq_media_close_finished;
         }
-        picoquic_mark_active_stream(stream_ctx->cnx_ctx->cnx, stream_ctx->stream_id, 1, stream_ctx);
+        (void)quicrq_mark_control_stream_active(stream_ctx);
         ret = 0;
     }
     return ret;
@@ -1468,7 +2640,7 @@ int quicrq_cnx_handle_consumer_finished(quicrq_stream_ctx_t* stream_ctx, int is_
 void quicrq_cnx_abandon_stream(quicrq_stream_ctx_t* stream_ctx)
 {
     stream_ctx->send_state = quicrq_sending_fin;
-    (void)picoquic_mark_active_stream(stream_ctx->cnx_ctx->cnx, stream_ctx->stream_id, 1, stream_ctx);
+    (void)quicrq_mark_control_stream_active(stream_ctx);
     if (stream_ctx->transport_mode == quicrq_transport_mode_datagram && !stream_ctx->is_sender) {
         if (stream_ctx->cnx_ctx->next_abandon_datagram_id <= stream_ctx->media_id) {
             stream_ctx->cnx_ctx->next_abandon_datagram_id = stream_ctx->media_id + 1;
@@ -115,6 +115,69 @@ void quicrq_msg_buffer_release(quicrq_message_buffer_t* msg_buffer)
     memset(msg_buffer, 0, sizeof(quicrq_message_buffer_t));
 }
 
+/* Fragment buffers are allocated in a single block, with the data
+ * following the header. External buffers only allocate the header.
+ * The creator holds the first reference.
+ */
+quicrq_fragment_buffer_t* quicrq_fragment_buffer_create(quicrq_ctx_t* qr_ctx, const uint8_t* data, size_t length)
+{
+    quicrq_fragment_buffer_t* buffer = (quicrq_fragment_buffer_t*)quicrq_pool_alloc_data(qr_ctx,
+        sizeof(quicrq_fragment_buffer_t) + length);
+    if (buffer != NULL) {
+        memset(buffer, 0, sizeof(quicrq_fragment_buffer_t));
+        buffer->qr_ctx = qr_ctx;
+        buffer->ref_count = 1;
+        buffer->length = length;
+        buffer->data = ((uint8_t*)buffer) + sizeof(quicrq_fragment_buffer_t);
+        if (length > 0) {
+            memcpy(buffer->data, data, length);
+        }
+    }
+    return buffer;
+}
+
+quicrq_fragment_buffer_t* quicrq_fragment_buffer_create_external(quicrq_ctx_t* qr_ctx, uint8_t* data, size_t length,
+    quicrq_object_release_fn release_fn, void* release_ctx)
+{
+    quicrq_fragment_buffer_t* buffer = (quicrq_fragment_buffer_t*)quicrq_pool_alloc_data(qr_ctx,
+        sizeof(quicrq_fragment_buffer_t));
+    if (buffer != NULL) {
+        memset(buffer, 0, sizeof(quicrq_fragment_buffer_t));
+        buffer->qr_ctx = qr_ctx;
+        buffer->ref_count = 1;
+        buffer->length = length;
+        buffer->data = data;
+        buffer->is_external = 1;
+        buffer->release_fn = release_fn;
+        buffer->release_ctx = release_ctx;
+    }
+    return buffer;
+}
+
+void quicrq_fragment_buffer_hold(quicrq_fragment_buffer_t* buffer)
+{
+    buffer->ref_count++;
+}
+
+void quicrq_fragment_buffer_release(quicrq_fragment_buffer_t* buffer)
+{
+    if (buffer != NULL) {
+        if (buffer->ref_count > 1) {
+            buffer->ref_count--;
+        }
+        else if (buffer->is_external) {
+            /* External buffer: return the data to the application, and free the header only */
+            if (buffer->release_fn != NULL) {
+                buffer->release_fn(buffer->release_ctx, buffer->data, buffer->length);
+            }
+            quicrq_pool_free_data(buffer->qr_ctx, buffer, sizeof(quicrq_fragment_buffer_t));
+        }
+        else {
+            quicrq_pool_free_data(buffer->qr_ctx, buffer, sizeof(quicrq_fragment_buffer_t) + buffer->length);
+        }
+    }
+}
+
 /* Send a protocol message through series of read data call backs.
  * The repair messages include some data after the header.
  * The "data" and "data_length" must be the same across all calls for the same message.
@@ -261,6 +324,7 @@ int quicrq_prepare_to_send_media_to_stream(quicrq_stream_ctx_t* stream_ctx, void
 
                     stream_ctx->next_object_id++;
                     stream_ctx->next_object_offset = 0;
+                    stream_ctx->counters.media.objects_dropped++;
 
                     if (is_media_finished) {
                         stream_ctx->final_group_id = stream_ctx->next_group_id;
@@ -360,6 +424,8 @@ int quicrq_prepare_to_send_media_to_stream(quicrq_stream_ctx_t* stream_ctx, void
                         buffer[1] = (uint8_t)(message_length & 0xff);
 
                         stream_ctx->next_object_offset += available;
+                        quicrq_media_counters_fragment_sent(&stream_ctx->counters, available,
+                            stream_ctx->next_object_offset >= object_length);
                         if (stream_ctx->next_object_offset >= object_length) {
                             stream_ctx->next_object_id++;
                             stream_ctx->next_object_offset = 0;
@@ -380,30 +446,108 @@ int quicrq_prepare_to_send_media_to_stream(quicrq_stream_ctx_t* stream_ctx, void
 }
 
 /* Find the stream context associated with a datagram */
+/* Find the stream context for a datagram media ID.
+ * Media IDs are allocated in sequence, so the datagram streams can be found by
+ * indexing a table with the media ID. Sent and received media IDs are allocated
+ * independently, so there is one table for each direction. The tables are filled
+ * when a lookup succeeds, and the entries are verified against the stream state
+ * before being used. Lookups that miss the table fall back to scanning the list
+ * of streams, which only happens on the first datagram of a media, or for
+ * datagrams arriving after a stream was closed.
+ */
+#define QUICRQ_MEDIA_ID_TABLE_MAX 0x10000
+#define QUICRQ_MEDIA_ID_TABLE_MIN 16
+
+static int quicrq_stream_ctx_matches_datagram(quicrq_stream_ctx_t* stream_ctx, uint64_t media_id, int is_sender)
+{
+    return (stream_ctx->is_sender == is_sender) && stream_ctx->transport_mode == quicrq_transport_mode_datagram && stream_ctx->media_id == media_id;
+}
+
+static void quicrq_media_id_table_set(quicrq_cnx_ctx_t* cnx_ctx, uint64_t media_id, int is_sender, quicrq_stream_ctx_t* stream_ctx)
+{
+    int table_id = (is_sender) ? 1 : 0;
+
+    if (media_id < QUICRQ_MEDIA_ID_TABLE_MAX) {
+        if (media_id >= cnx_ctx->media_id_table_size[table_id]) {
+            size_t new_size = (cnx_ctx->media_id_table_size[table_id] == 0) ? QUICRQ_MEDIA_ID_TABLE_MIN : 2 * cnx_ctx->media_id_table_size[table_id];
+            quicrq_stream_ctx_t** new_table;
+
+            while (new_size <= media_id) {
+                new_size *= 2;
+            }
+            new_table = (quicrq_stream_ctx_t**)malloc(new_size * sizeof(quicrq_stream_ctx_t*));
+            if (new_table != NULL) {
+                memset(new_table, 0, new_size * sizeof(quicrq_stream_ctx_t*));
+                if (cnx_ctx->media_id_table[table_id] != NULL) {
+                    memcpy(new_table, cnx_ctx->media_id_table[table_id], cnx_ctx->media_id_table_size[table_id] * sizeof(quicrq_stream_ctx_t*));
+                    free(cnx_ctx->media_id_table[table_id]);
+                }
+                cnx_ctx->media_id_table[table_id] = new_table;
+                cnx_ctx->media_id_table_size[table_id] = new_size;
+            }
+        }
+        /* If the table could not be extended, the lookups will use the list of streams */
+        if (media_id < cnx_ctx->media_id_table_size[table_id]) {
+            cnx_ctx->media_id_table[table_id][media_id] = stream_ctx;
+        }
+    }
+}
+
+static void quicrq_media_id_table_remove(quicrq_cnx_ctx_t* cnx_ctx, quicrq_stream_ctx_t* stream_ctx)
+{
+    for (int table_id = 0; table_id < 2; table_id++) {
+        if (stream_ctx->media_id < cnx_ctx->media_id_table_size[table_id] &&
+            cnx_ctx->media_id_table[table_id][stream_ctx->media_id] == stream_ctx) {
+            cnx_ctx->media_id_table[table_id][stream_ctx->media_id] = NULL;
+        }
+    }
+}
+
+static void quicrq_media_id_table_release(quicrq_cnx_ctx_t* cnx_ctx)
+{
+    for (int table_id = 0; table_id < 2; table_id++) {
+        if (cnx_ctx->media_id_table[table_id] != NULL) {
+            free(cnx_ctx->media_id_table[table_id]);
+            cnx_ctx->media_id_table[table_id] = NULL;
+        }
+        cnx_ctx->media_id_table_size[table_id] = 0;
+    }
+}
+
 quicrq_stream_ctx_t* quicrq_find_stream_ctx_for_datagram(quicrq_cnx_ctx_t* cnx_ctx, uint64_t media_id, int is_sender)
 {
     quicrq_stream_ctx_t* stream_ctx = NULL;
+    int table_id = (is_sender) ? 1 : 0;
 
     /* Find the stream context by datagram ID */
-    stream_ctx = cnx_ctx->first_stream;
-    while (stream_ctx != NULL) {
-        if ((stream_ctx->is_sender == is_sender) && stream_ctx->transport_mode == quicrq_transport_mode_datagram && stream_ctx->media_id == media_id) {
-            break;
+    if (media_id < cnx_ctx->media_id_table_size[table_id]) {
+        stream_ctx = cnx_ctx->media_id_table[table_id][media_id];
+        if (stream_ctx != NULL && !quicrq_stream_ctx_matches_datagram(stream_ctx, media_id, is_sender)) {
+            stream_ctx = NULL;
+        }
+    }
+    if (stream_ctx == NULL) {
+        stream_ctx = cnx_ctx->first_stream;
+        while (stream_ctx != NULL) {
+            if (quicrq_stream_ctx_matches_datagram(stream_ctx, media_id, is_sender)) {
+                quicrq_media_id_table_set(cnx_ctx, media_id, is_sender, stream_ctx);
+                break;
+            }
+            stream_ctx = stream_ctx->next_stream;
         }
-        stream_ctx = stream_ctx->next_stream;
     }
     return stream_ctx;
 }
 
-/* Receive data in a datagram */
-int quicrq_receive_datagram(quicrq_cnx_ctx_t* cnx_ctx, const uint8_t* bytes, size_t length, uint64_t current_time)
+/* Receive one fragment of a datagram */
+static const uint8_t* quicrq_receive_datagram_fragment(quicrq_cnx_ctx_t* cnx_ctx, const uint8_t* bytes, const uint8_t* bytes_max,
+    int is_coalesced, int is_fec_record, uint64_t current_time, int* p_ret)
 {
     int ret = 0;
     quicrq_stream_ctx_t* stream_ctx = NULL;
 
     /* Parse the datagram header */
-    const uint8_t* bytes_max = bytes + length;
-    uint64_t media_id;
+    uint64_t media_id = 0;
     uint64_t group_id;
     uint64_t object_id;
     uint64_t object_offset;
@@ -411,17 +555,38 @@ int quicrq_receive_datagram(quicrq_cnx_ctx_t* cnx_ctx, const uint8_t* bytes, siz
     uint64_t nb_objects_previous_group;
     uint64_t object_length;
     uint8_t flags;
+    const uint8_t* data = NULL;
+    size_t data_length = 0;
     const uint8_t* next_bytes;
+    quicrq_datagram_header_format_enum header_format = quicrq_datagram_header_full;
+    uint64_t group_ref = 0;
+
+    /* The header format depends on the stream, found by datagram ID. FEC records
+     * always use full headers. If the stream is already closed, assume that the
+     * peer used the format that we ask for. */
+    if (quicrq_varint_decode(bytes, bytes_max, &media_id) != NULL) {
+        stream_ctx = quicrq_find_stream_ctx_for_datagram(cnx_ctx, media_id, 0);
+    }
+    if (is_fec_record) {
+        header_format = quicrq_datagram_header_full;
+    }
+    else if (stream_ctx != NULL) {
+        header_format = stream_ctx->datagram_header_format;
+        group_ref = stream_ctx->compact_group_ref;
+    }
+    else if (cnx_ctx->qr_ctx->is_compact_datagram_header) {
+        header_format = quicrq_datagram_header_compact;
+    }
 
-    next_bytes = quicrq_datagram_header_decode(bytes, bytes_max, &media_id, &group_id, &object_id, &object_offset, &queue_delay, &flags, &nb_objects_previous_group, &object_length);
+    next_bytes = quicrq_datagram_fragment_decode_ex(bytes, bytes_max, is_coalesced, header_format, group_ref,
+        &media_id, &group_id, &object_id, &object_offset, &queue_delay, &flags, &nb_objects_previous_group,
+        &object_length, &data, &data_length);
 
     if (next_bytes == NULL) {
         DBG_PRINTF("%s", "Error decoding datagram header");
         ret = -1;
     }
     else {
-        /* Find the stream context by datagram ID */
-        stream_ctx = quicrq_find_stream_ctx_for_datagram(cnx_ctx, media_id, 0);
         if (stream_ctx == NULL) {
             DBG_PRINTF("Unexpected datagram on stream %" PRIu64 ", object id %" PRIu64 "/%" PRIu64 ", max: % " PRIu64, 
                 media_id, group_id, object_id, cnx_ctx->next_media_id);
@@ -434,8 +599,9 @@ int quicrq_receive_datagram(quicrq_cnx_ctx_t* cnx_ctx, const uint8_t* bytes, siz
             }
         }
         else {
-            /* Compute data length based on remaining bytes */
-            size_t data_length = bytes_max - next_bytes;
+            if (group_id > stream_ctx->compact_group_ref) {
+                stream_ctx->compact_group_ref = group_id;
+            }
             /* Verification that there are no unexpected fragments, used in tests */
             if (group_id < stream_ctx->start_group_id ||
                 (group_id == stream_ctx->start_group_id && object_id < stream_ctx->start_object_id)) {
@@ -446,8 +612,18 @@ int quicrq_receive_datagram(quicrq_cnx_ctx_t* cnx_ctx, const uint8_t* bytes, siz
                 picoquic_log_app_message(cnx_ctx->cnx, "Received final fragment of object %" PRIu64 "/%" PRIu64 " on datagram stream %" PRIu64 ", stream %" PRIu64,
                     group_id, object_id, media_id, stream_ctx->stream_id);
             }
-            ret = stream_ctx->consumer_fn(quicrq_media_datagram_ready, stream_ctx->media_ctx, current_time, next_bytes, group_id, object_id, object_offset, 
-                queue_delay, flags, nb_objects_previous_group, object_length, bytes_max - next_bytes);
+            quicrq_media_counters_fragment_received(&stream_ctx->counters, data_length,
+                object_offset + data_length >= object_length, flags);
+            ret = quicrq_media_counters_queue_delay(&stream_ctx->counters, queue_delay);
+            /* Keep a copy for the recovery of the other fragments of the FEC window */
+            if (ret == 0 && stream_ctx->fec_decoder != NULL) {
+                quicrq_fec_decoder_add(stream_ctx->fec_decoder, media_id, group_id, object_id, object_offset,
+                    flags, nb_objects_previous_group, object_length, data, data_length);
+            }
+            if (ret == 0) {
+                ret = stream_ctx->consumer_fn(quicrq_media_datagram_ready, stream_ctx->media_ctx, current_time, data, group_id, object_id, object_offset,
+                    queue_delay, flags, nb_objects_previous_group, object_length, data_length);
+            }
             if (ret == quicrq_consumer_finished) {
                 ret = quicrq_cnx_handle_consumer_finished(stream_ctx, 0, 1, ret);
             }
@@ -457,16 +633,92 @@ int quicrq_receive_datagram(quicrq_cnx_ctx_t* cnx_ctx, const uint8_t* bytes, siz
         }
     }
 
+    *p_ret = ret;
+    return next_bytes;
+}
+
+/* Receive a FEC datagram. Records of the received fragments are only kept
+ * after the first FEC datagram for the stream is seen, so receiving streams
+ * do not pay for the copies if the sender does not use FEC. If exactly one
+ * fragment of the window was lost, it is recovered and received as if it
+ * had arrived in a datagram.
+ */
+static int quicrq_receive_fec_datagram(quicrq_cnx_ctx_t* cnx_ctx, const uint8_t* bytes, size_t length, uint64_t current_time)
+{
+    int ret = 0;
+    quicrq_fec_parity_t parity;
+
+    if (quicrq_fec_parity_decode(bytes, bytes + length, &parity) == NULL) {
+        DBG_PRINTF("%s", "Error decoding FEC datagram");
+        ret = -1;
+    }
+    else {
+        quicrq_stream_ctx_t* stream_ctx = quicrq_find_stream_ctx_for_datagram(cnx_ctx, parity.media_id, 0);
+
+        if (stream_ctx == NULL) {
+            /* The stream may be closed, or the parity may arrive before the start of the stream. */
+        }
+        else if (stream_ctx->fec_decoder == NULL) {
+            stream_ctx->fec_decoder = (quicrq_fec_decoder_t*)malloc(sizeof(quicrq_fec_decoder_t));
+            if (stream_ctx->fec_decoder == NULL) {
+                ret = -1;
+            }
+            else {
+                memset(stream_ctx->fec_decoder, 0, sizeof(quicrq_fec_decoder_t));
+            }
+        }
+        else {
+            uint8_t record[QUICRQ_FEC_RECORD_MAX];
+            size_t record_length = 0;
+
+            if (quicrq_fec_decoder_recover(stream_ctx->fec_decoder, &parity, record, &record_length)) {
+                picoquic_log_app_message(cnx_ctx->cnx, "Recovered a fragment of group %" PRIu64 " on datagram stream %" PRIu64,
+                    parity.group_id, parity.media_id);
+                stream_ctx->counters.media.fragments_recovered++;
+                (void)quicrq_receive_datagram_fragment(cnx_ctx, record, record + record_length, 0, 1, current_time, &ret);
+            }
+        }
+    }
+
+    return ret;
+}
+
+/* Receive data in a datagram, which may carry several coalesced fragments,
+ * or the parity of a FEC window */
+int quicrq_receive_datagram(quicrq_cnx_ctx_t* cnx_ctx, const uint8_t* bytes, size_t length, uint64_t current_time)
+{
+    int ret = 0;
+    const uint8_t* bytes_max = bytes + length;
+
+    if (quicrq_datagram_is_fec(bytes, length)) {
+        ret = quicrq_receive_fec_datagram(cnx_ctx, bytes, length, current_time);
+    }
+    else if (quicrq_datagram_is_coalesced(bytes, length)) {
+        bytes += QUICRQ_DATAGRAM_COALESCED_MARKER_LENGTH;
+        while (ret == 0 && bytes != NULL && bytes < bytes_max) {
+            bytes = quicrq_receive_datagram_fragment(cnx_ctx, bytes, bytes_max, 1, 0, current_time, &ret);
+        }
+    }
+    else {
+        (void)quicrq_receive_datagram_fragment(cnx_ctx, bytes, bytes_max, 0, 0, current_time, &ret);
+    }
+
     return ret;
 }
 
 /* Handle the list of datagrams pending acknowledgement or retransmission.
- * The code maintains an acknowledgement tree of the fragments that were sent.
+ * The code maintains the acknowledgement states of the fragments that were sent,
+ * in key order. Most states are in a ring, filled in send order, in which they can
+ * be found by binary search and from which the horizon removes them at the head.
+ * States that are not sent in key order go to an overflow tree. 
  * TODO: handle whether we can have overlapping fragments. We will assume that
  * we will not, i.e., that the MTU will remain valid for the duration of
  * the datagram. Thus, we do not use the length field as part of the
  * key.
  */
+#define QUICRQ_DATAGRAM_ACK_RING_SIZE_MIN 64
+#define quicrq_datagram_ack_ring_entry(stream_ctx, sequence) \
+    (stream_ctx)->datagram_ack_ring[(sequence) & (stream_ctx)->datagram_ack_ring_mask]
 
 static void* quicrq_datagram_ack_node_value(picosplay_node_t* datagram_ack_node)
 {
@@ -497,13 +749,31 @@ static picosplay_node_t* quicrq_datagram_ack_node_create(void* v_datagram_ack_st
     return &((quicrq_datagram_ack_state_t*)v_datagram_ack_state)->datagram_ack_node;
 }
 
+/* The extra repeat timer of the stream follows the repeat time of the first
+ * element in the extra queue. Repeat times increase along the queue.
+ */
+static void quicrq_datagram_ack_extra_timer_update(quicrq_stream_ctx_t* stream_ctx)
+{
+    quicrq_ctx_t* qr_ctx = stream_ctx->cnx_ctx->qr_ctx;
+
+    if (stream_ctx->extra_first == NULL) {
+        quicrq_timer_cancel(qr_ctx, &stream_ctx->extra_repeat_timer);
+    }
+    else if (quicrq_timer_set(qr_ctx, &stream_ctx->extra_repeat_timer, stream_ctx->extra_first->extra_repeat_time) != 0) {
+        DBG_PRINTF("Cannot set extra repeat timer, stream %" PRIu64, stream_ctx->stream_id);
+    }
+}
+
 static void quicrq_datagram_ack_extra_dequeue(quicrq_stream_ctx_t* stream_ctx, quicrq_datagram_ack_state_t* das)
 {
+    int was_first = 0;
+
     if (das->extra_data == NULL) {
         return;
     }
     if (das->extra_previous == NULL) {
         stream_ctx->extra_first = das->extra_next;
+        was_first = 1;
     }
     else {
         das->extra_previous->extra_next = das->extra_next;
@@ -515,11 +785,13 @@ static void quicrq_datagram_ack_extra_dequeue(quicrq_stream_ctx_t* stream_ctx, q
         das->extra_next->extra_previous = das->extra_previous;
     }
 
-    free(das->extra_data);
     das->extra_data = NULL;
     das->extra_next = NULL;
     das->extra_previous = NULL;
     das->extra_repeat_time = 0;
+    if (was_first) {
+        quicrq_datagram_ack_extra_timer_update(stream_ctx);
+    }
 }
 
 static void quicrq_datagram_ack_extra_queue(quicrq_stream_ctx_t* stream_ctx, quicrq_datagram_ack_state_t* das, const uint8_t * data, uint64_t repeat_time)
@@ -533,34 +805,46 @@ static void quicrq_datagram_ack_extra_queue(quicrq_stream_ctx_t* stream_ctx, qui
         /* new repeat request replaces the previous one */
         quicrq_datagram_ack_extra_dequeue(stream_ctx, das);
     }
-    das->extra_data = (uint8_t *)malloc(das->length);
+    if (das->data_buffer == NULL) {
+        /* The data is not shared yet, keep a copy for the repeat */
+        das->data_buffer = quicrq_fragment_buffer_create(stream_ctx->cnx_ctx->qr_ctx, data, das->length);
+        das->data = (das->data_buffer == NULL) ? NULL : das->data_buffer->data;
+    }
+    das->extra_data = das->data;
     if (das->extra_data != NULL) {
-        memcpy(das->extra_data, data, das->length);
+        das->extra_repeat_time = repeat_time;
         if (stream_ctx->extra_last == NULL) {
             stream_ctx->extra_first = das;
             stream_ctx->extra_last = das;
+            quicrq_datagram_ack_extra_timer_update(stream_ctx);
         }
         else {
             stream_ctx->extra_last->extra_next = das;
             das->extra_previous = stream_ctx->extra_last;
             stream_ctx->extra_last = das;
         }
-        das->extra_repeat_time = repeat_time;
         stream_ctx->nb_extra_sent++;
+        stream_ctx->counters.media.fragments_extra_sent++;
     }
 }
 
-static void quicrq_datagram_ack_node_delete(void* tree, picosplay_node_t* node)
+static void quicrq_datagram_ack_state_delete(quicrq_stream_ctx_t* stream_ctx, quicrq_datagram_ack_state_t* das)
 {
-    quicrq_stream_ctx_t* stream_ctx = (quicrq_stream_ctx_t*)
-        ((char*)tree - offsetof(struct st_quicrq_stream_ctx_t, datagram_ack_tree));
-    quicrq_datagram_ack_state_t* das = (quicrq_datagram_ack_state_t*)
-        quicrq_datagram_ack_node_value(node);
     if (das->extra_data != NULL) {
         /* dequeue from extra repeat list */
         quicrq_datagram_ack_extra_dequeue(stream_ctx, das);
     }
-    free(quicrq_datagram_ack_node_value(node));
+    quicrq_fragment_buffer_release(das->data_buffer);
+    quicrq_pool_free(stream_ctx->cnx_ctx->qr_ctx, quicrq_pool_datagram_ack, das);
+}
+
+static void quicrq_datagram_ack_node_delete(void* tree, picosplay_node_t* node)
+{
+    quicrq_stream_ctx_t* stream_ctx = (quicrq_stream_ctx_t*)
+        ((char*)tree - offsetof(struct st_quicrq_stream_ctx_t, datagram_ack_overflow));
+    quicrq_datagram_ack_state_t* das = (quicrq_datagram_ack_state_t*)
+        quicrq_datagram_ack_node_value(node);
+    quicrq_datagram_ack_state_delete(stream_ctx, das);
 }
 
 static void quicrq_datagram_ack_ctx_init(quicrq_stream_ctx_t* stream_ctx)
@@ -569,20 +853,35 @@ static void quicrq_datagram_ack_ctx_init(quicrq_stream_ctx_t* stream_ctx)
     stream_ctx->horizon_object_id = UINT64_MAX;
     stream_ctx->horizon_offset = UINT64_MAX;
     stream_ctx->horizon_is_last_fragment = 1;
-    picosplay_init_tree(&stream_ctx->datagram_ack_tree, quicrq_datagram_ack_node_compare,
+    picosplay_init_tree(&stream_ctx->datagram_ack_overflow, quicrq_datagram_ack_node_compare,
         quicrq_datagram_ack_node_create, quicrq_datagram_ack_node_delete, quicrq_datagram_ack_node_value);
 }
 
+size_t quicrq_datagram_ack_count(quicrq_stream_ctx_t* stream_ctx)
+{
+    return (size_t)(stream_ctx->datagram_ack_ring_next - stream_ctx->datagram_ack_ring_first) +
+        (size_t)stream_ctx->datagram_ack_overflow.size;
+}
+
 static void quicrq_datagram_ack_ctx_release(quicrq_stream_ctx_t* stream_ctx)
 {
-    if (stream_ctx->datagram_ack_tree.size != 0 || stream_ctx->nb_extra_sent > 0 ||
+    if (quicrq_datagram_ack_count(stream_ctx) != 0 || stream_ctx->nb_extra_sent > 0 ||
         stream_ctx->nb_horizon_acks > 0 || stream_ctx->nb_horizon_events > 0) {
-        picosplay_node_t * next_node = picosplay_first(&stream_ctx->datagram_ack_tree);
+        picosplay_node_t * next_node = picosplay_first(&stream_ctx->datagram_ack_overflow);
+        uint64_t sequence = stream_ctx->datagram_ack_ring_first;
         int nb_fragments_acked = 0;
         int nb_fragments_nacked = 0;
         int nb_fragments_alone = 0;
-        while (next_node != NULL) {
-            quicrq_datagram_ack_state_t* das = (quicrq_datagram_ack_state_t*)quicrq_datagram_ack_node_value(next_node);
+        while (sequence < stream_ctx->datagram_ack_ring_next || next_node != NULL) {
+            quicrq_datagram_ack_state_t* das;
+            if (sequence < stream_ctx->datagram_ack_ring_next) {
+                das = quicrq_datagram_ack_ring_entry(stream_ctx, sequence);
+                sequence++;
+            }
+            else {
+                das = (quicrq_datagram_ack_state_t*)quicrq_datagram_ack_node_value(next_node);
+                next_node = picosplay_next(next_node);
+            }
             if (das->is_acked) {
                 nb_fragments_acked++;
             }
@@ -592,12 +891,10 @@ static void quicrq_datagram_ack_ctx_release(quicrq_stream_ctx_t* stream_ctx)
             if (!das->is_acked && !das->nack_received) {
                 nb_fragments_alone++;
             }
-
-            next_node = picosplay_next(next_node);
         }
 
-        DBG_PRINTF("End of stream  %" PRIu64 ", %d nodes in datagram list, %d acked, %d nacked, alone: %d, extra: %d",
-            stream_ctx->stream_id, stream_ctx->datagram_ack_tree.size,
+        DBG_PRINTF("End of stream  %" PRIu64 ", %zu nodes in datagram list, %d acked, %d nacked, alone: %d, extra: %d",
+            stream_ctx->stream_id, quicrq_datagram_ack_count(stream_ctx),
             nb_fragments_acked, nb_fragments_nacked, nb_fragments_alone,
             stream_ctx->nb_extra_sent);
         DBG_PRINTF("Horizon Object ID: %" PRIu64 ", offset: %" PRIu64,
@@ -605,20 +902,130 @@ static void quicrq_datagram_ack_ctx_release(quicrq_stream_ctx_t* stream_ctx)
         DBG_PRINTF("ACKs below horizon: %" PRIu64 ", ACK Init below horizon: %" PRIu64,
             stream_ctx->nb_horizon_acks, stream_ctx->nb_horizon_events);
     }
-    picosplay_empty_tree(&stream_ctx->datagram_ack_tree);
+    while (stream_ctx->datagram_ack_ring_first < stream_ctx->datagram_ack_ring_next) {
+        quicrq_datagram_ack_state_delete(stream_ctx,
+            quicrq_datagram_ack_ring_entry(stream_ctx, stream_ctx->datagram_ack_ring_first));
+        stream_ctx->datagram_ack_ring_first++;
+    }
+    if (stream_ctx->datagram_ack_ring != NULL) {
+        free(stream_ctx->datagram_ack_ring);
+        stream_ctx->datagram_ack_ring = NULL;
+        stream_ctx->datagram_ack_ring_mask = 0;
+    }
+    picosplay_empty_tree(&stream_ctx->datagram_ack_overflow);
+}
+
+/* Double the size of the ring, keeping the states at the same sequence numbers */
+static int quicrq_datagram_ack_ring_grow(quicrq_stream_ctx_t* stream_ctx)
+{
+    int ret = 0;
+    size_t new_size = (stream_ctx->datagram_ack_ring == NULL) ? QUICRQ_DATAGRAM_ACK_RING_SIZE_MIN :
+        2 * (stream_ctx->datagram_ack_ring_mask + 1);
+    quicrq_datagram_ack_state_t** new_ring = (quicrq_datagram_ack_state_t**)malloc(
+        new_size * sizeof(quicrq_datagram_ack_state_t*));
+
+    if (new_ring == NULL) {
+        ret = -1;
+    }
+    else {
+        for (uint64_t sequence = stream_ctx->datagram_ack_ring_first; sequence < stream_ctx->datagram_ack_ring_next; sequence++) {
+            new_ring[sequence & (new_size - 1)] = quicrq_datagram_ack_ring_entry(stream_ctx, sequence);
+        }
+        if (stream_ctx->datagram_ack_ring != NULL) {
+            free(stream_ctx->datagram_ack_ring);
+        }
+        stream_ctx->datagram_ack_ring = new_ring;
+        stream_ctx->datagram_ack_ring_mask = new_size - 1;
+    }
+    return ret;
+}
+
+/* Add a state to the ring if it comes after the last one, or to the overflow tree */
+static int quicrq_datagram_ack_insert(quicrq_stream_ctx_t* stream_ctx, quicrq_datagram_ack_state_t* das)
+{
+    int ret = 0;
+    size_t nb_in_ring = (size_t)(stream_ctx->datagram_ack_ring_next - stream_ctx->datagram_ack_ring_first);
+
+    if (nb_in_ring == 0 || quicrq_datagram_ack_node_compare(das,
+        quicrq_datagram_ack_ring_entry(stream_ctx, stream_ctx->datagram_ack_ring_next - 1)) > 0) {
+        if (stream_ctx->datagram_ack_ring == NULL || nb_in_ring > stream_ctx->datagram_ack_ring_mask) {
+            ret = quicrq_datagram_ack_ring_grow(stream_ctx);
+        }
+        if (ret == 0) {
+            quicrq_datagram_ack_ring_entry(stream_ctx, stream_ctx->datagram_ack_ring_next) = das;
+            stream_ctx->datagram_ack_ring_next++;
+        }
+    }
+    else {
+        picosplay_insert(&stream_ctx->datagram_ack_overflow, das);
+    }
+    return ret;
+}
+
+/* Find the first state in key order, which is either the first in the ring or the first in the overflow */
+static quicrq_datagram_ack_state_t* quicrq_datagram_ack_first(quicrq_stream_ctx_t* stream_ctx, int* is_in_ring)
+{
+    quicrq_datagram_ack_state_t* das = NULL;
+    quicrq_datagram_ack_state_t* das_overflow = (quicrq_datagram_ack_state_t*)quicrq_datagram_ack_node_value(
+        picosplay_first(&stream_ctx->datagram_ack_overflow));
+
+    if (stream_ctx->datagram_ack_ring_first < stream_ctx->datagram_ack_ring_next) {
+        das = quicrq_datagram_ack_ring_entry(stream_ctx, stream_ctx->datagram_ack_ring_first);
+    }
+    *is_in_ring = 1;
+    if (das_overflow != NULL && (das == NULL || quicrq_datagram_ack_node_compare(das_overflow, das) < 0)) {
+        das = das_overflow;
+        *is_in_ring = 0;
+    }
+    return das;
+}
+
+/* The group of a fragment waiting for an ack is at least the group of the
+ * first ack state. The sender decodes the truncated group IDs of acked or lost
+ * datagrams against that floor, instead of the highest group sent, which may
+ * have moved far ahead by the time a late ack or loss arrives. The floor is
+ * UINT64_MAX if no fragment is waiting for an ack.
+ */
+static uint64_t quicrq_datagram_ack_group_floor(quicrq_stream_ctx_t* stream_ctx)
+{
+    int is_in_ring = 0;
+    quicrq_datagram_ack_state_t* das = quicrq_datagram_ack_first(stream_ctx, &is_in_ring);
+
+    return (das == NULL) ? UINT64_MAX : das->group_id;
 }
 
 quicrq_datagram_ack_state_t* quicrq_datagram_ack_find(quicrq_stream_ctx_t* stream_ctx, uint64_t group_id, uint64_t object_id, uint64_t object_offset)
 {
     quicrq_datagram_ack_state_t* found = NULL;
     quicrq_datagram_ack_state_t target = { 0 };
+    uint64_t low = stream_ctx->datagram_ack_ring_first;
+    uint64_t high = stream_ctx->datagram_ack_ring_next;
     target.group_id = group_id;
     target.object_id = object_id;
     target.object_offset = object_offset;
 
-    picosplay_node_t* node = picosplay_find(&stream_ctx->datagram_ack_tree, (void*)&target);
-    if (node != NULL) {
-        found = (quicrq_datagram_ack_state_t*)quicrq_datagram_ack_node_value(node);
+    /* The ring is sorted by key, search it first */
+    while (low < high) {
+        uint64_t middle = low + (high - low) / 2;
+        quicrq_datagram_ack_state_t* das = quicrq_datagram_ack_ring_entry(stream_ctx, middle);
+        int64_t delta = quicrq_datagram_ack_node_compare(&target, das);
+
+        if (delta == 0) {
+            found = das;
+            break;
+        }
+        else if (delta < 0) {
+            high = middle;
+        }
+        else {
+            low = middle + 1;
+        }
+    }
+    if (found == NULL && stream_ctx->datagram_ack_overflow.size > 0) {
+        picosplay_node_t* node = picosplay_find(&stream_ctx->datagram_ack_overflow, (void*)&target);
+        if (node != NULL) {
+            found = (quicrq_datagram_ack_state_t*)quicrq_datagram_ack_node_value(node);
+        }
     }
     return found;
 }
@@ -638,7 +1045,8 @@ int64_t quicrq_datagram_check_horizon(quicrq_stream_ctx_t* stream_ctx, uint64_t
 
 int quicrq_datagram_ack_init(quicrq_stream_ctx_t* stream_ctx, uint64_t group_id, uint64_t object_id, 
     uint64_t object_offset, uint8_t flags, uint64_t nb_objects_previous_group, const uint8_t * data, size_t length,
-    uint64_t queue_delay, uint64_t object_length, void** p_created_state, uint64_t current_time)
+    quicrq_fragment_buffer_t* data_buffer, uint64_t queue_delay, uint64_t object_length, void** p_created_state,
+    uint64_t current_time)
 {
     int ret = 0;
 
@@ -658,7 +1066,8 @@ int quicrq_datagram_ack_init(quicrq_stream_ctx_t* stream_ctx, uint64_t group_id,
         }
         else {
             /* else, create a record. */
-            quicrq_datagram_ack_state_t* da_new = (quicrq_datagram_ack_state_t*)malloc(sizeof(quicrq_datagram_ack_state_t));
+            quicrq_datagram_ack_state_t* da_new = (quicrq_datagram_ack_state_t*)quicrq_pool_alloc(
+                stream_ctx->cnx_ctx->qr_ctx, quicrq_pool_datagram_ack, sizeof(quicrq_datagram_ack_state_t));
             if (da_new == NULL) {
                 /* memory error */
                 ret = -1;
@@ -674,16 +1083,27 @@ int quicrq_datagram_ack_init(quicrq_stream_ctx_t* stream_ctx, uint64_t group_id,
                 da_new->object_length = object_length;
                 da_new->queue_delay = queue_delay;
                 da_new->start_time = current_time;
-                picosplay_insert(&stream_ctx->datagram_ack_tree, da_new);
-                if (p_created_state != NULL) {
-                    *p_created_state = da_new;
+                if (data_buffer != NULL) {
+                    /* Share the fragment data instead of copying it */
+                    quicrq_fragment_buffer_hold(data_buffer);
+                    da_new->data_buffer = data_buffer;
+                    da_new->data = data;
                 }
-                /* If this is a delayed fragment, we could schedule an extra repeat 
-                 */
-                if (stream_ctx->cnx_ctx->qr_ctx->extra_repeat_after_received_delayed &&
-                    stream_ctx->cnx_ctx->qr_ctx->extra_repeat_delay > 0 &&
-                    queue_delay > 20) {
-                    quicrq_datagram_ack_extra_queue(stream_ctx, da_new, data, current_time + stream_ctx->cnx_ctx->qr_ctx->extra_repeat_delay);
+                if (quicrq_datagram_ack_insert(stream_ctx, da_new) != 0) {
+                    quicrq_datagram_ack_state_delete(stream_ctx, da_new);
+                    ret = -1;
+                }
+                else {
+                    if (p_created_state != NULL) {
+                        *p_created_state = da_new;
+                    }
+                    /* If this is a delayed fragment, we could schedule an extra repeat
+                     */
+                    if (stream_ctx->cnx_ctx->qr_ctx->extra_repeat_after_received_delayed &&
+                        stream_ctx->cnx_ctx->qr_ctx->extra_repeat_delay > 0 &&
+                        queue_delay > 20) {
+                        quicrq_datagram_ack_extra_queue(stream_ctx, da_new, data, current_time + stream_ctx->cnx_ctx->qr_ctx->extra_repeat_delay);
+                    }
                 }
             }
         }
@@ -740,10 +1160,8 @@ int quicrq_datagram_handle_ack(quicrq_stream_ctx_t* stream_ctx, uint64_t group_i
             acked_length -= found->length;
             acked_offset += found->length;
             if (acked_length > 0) {
-                found = (quicrq_datagram_ack_state_t*)quicrq_datagram_ack_node_value(picosplay_next(&found->datagram_ack_node));
-                if (found->group_id != group_id || found->object_id != object_id || found->object_offset != acked_offset) {
-                    break;
-                }
+                /* The next record, if any, starts where this one ends */
+                found = quicrq_datagram_ack_find(stream_ctx, group_id, object_id, acked_offset);
             }
             else {
                 break;
@@ -774,10 +1192,10 @@ int quicrq_datagram_handle_ack(quicrq_stream_ctx_t* stream_ctx, uint64_t group_i
 
     if (should_check_horizon) {
         /* Progress the horizon */
-        picosplay_node_t* next_node = picosplay_first(&stream_ctx->datagram_ack_tree);
-        while (next_node != NULL) {
+        int is_in_ring = 0;
+        quicrq_datagram_ack_state_t* das;
+        while ((das = quicrq_datagram_ack_first(stream_ctx, &is_in_ring)) != NULL) {
             int just_after = 0;
-            quicrq_datagram_ack_state_t* das = (quicrq_datagram_ack_state_t*)quicrq_datagram_ack_node_value(next_node);
             if (!das->is_acked) {
                 break;
             }
@@ -800,21 +1218,54 @@ int quicrq_datagram_handle_ack(quicrq_stream_ctx_t* stream_ctx, uint64_t group_i
             }
             else {
                 /* collapse the horizon */
-                picosplay_node_t* to_be_forgotten = next_node;
                 stream_ctx->horizon_group_id = das->group_id;
                 stream_ctx->horizon_object_id = das->object_id;
                 stream_ctx->horizon_offset = das->object_offset + das->length;
                 stream_ctx->horizon_is_last_fragment =
                     stream_ctx->horizon_offset >= das->object_length;
-                next_node = picosplay_next(next_node);
-                picosplay_delete_hint(&stream_ctx->datagram_ack_tree, to_be_forgotten);
+                if (is_in_ring) {
+                    stream_ctx->datagram_ack_ring_first++;
+                    quicrq_datagram_ack_state_delete(stream_ctx, das);
+                }
+                else {
+                    picosplay_delete_hint(&stream_ctx->datagram_ack_overflow, &das->datagram_ack_node);
+                }
             }
         }
     }
     return ret;
 }
 
- /* If a datagram frame needs to be repeated, a copy of the frame will be
+/* Encode the header of a datagram in the format chosen by the receiver.
+ * With compact headers, the group ID is truncated if the receiver will
+ * decode it correctly, whatever the fragments that it received so far,
+ * and if the sender will decode it correctly from the ack floor when the
+ * datagram is acked or lost, see quicrq_datagram_ack_group_floor.
+ */
+uint8_t* quicrq_datagram_stream_header_encode(quicrq_stream_ctx_t* stream_ctx, uint8_t* bytes, uint8_t* bytes_max,
+    uint64_t media_id, uint64_t group_id, uint64_t object_id, uint64_t object_offset, uint64_t queue_delay, uint8_t flags,
+    uint64_t nb_objects_previous_group, uint64_t object_length, int is_final)
+{
+    if (stream_ctx == NULL || stream_ctx->datagram_header_format != quicrq_datagram_header_compact) {
+        bytes = quicrq_datagram_header_encode(bytes, bytes_max, media_id, group_id, object_id, object_offset,
+            queue_delay, flags, nb_objects_previous_group, object_length);
+    }
+    else {
+        uint64_t group_floor = quicrq_datagram_ack_group_floor(stream_ctx);
+        int is_group_truncated = stream_ctx->is_compact_group_acked &&
+            quicrq_compact_group_can_truncate(group_id, stream_ctx->compact_group_acked, stream_ctx->compact_group_ref) &&
+            (group_id < group_floor || group_id - group_floor < 0x100);
+
+        bytes = quicrq_compact_datagram_header_encode(bytes, bytes_max, media_id, group_id, is_group_truncated,
+            object_id, object_offset, queue_delay, flags, nb_objects_previous_group, object_length, is_final);
+        if (group_id > stream_ctx->compact_group_ref) {
+            stream_ctx->compact_group_ref = group_id;
+        }
+    }
+    return bytes;
+}
+
+/* If a datagram frame needs to be repeated, a copy of the frame will be
  * queued using the picoquic_queue_datagram_frame() API. That API can 
  * only handle datagram of at most PICOQUIC_DATAGRAM_QUEUE_MAX_LENGTH
  * bytes. If the original datagram is longer, it needs to be split.
@@ -845,18 +1296,25 @@ int quicrq_datagram_handle_repeat(quicrq_stream_ctx_t* stream_ctx,
             }
             /* Encode the header */
             found->last_sent_time = current_time;
-            bytes = quicrq_datagram_header_encode(bytes, bytes_max, stream_ctx->media_id,
+            bytes = quicrq_datagram_stream_header_encode(stream_ctx, bytes, bytes_max, stream_ctx->media_id,
                 found->group_id, found->object_id, found->object_offset, found->queue_delay + queue_delay_delta, found->flags,
-                found->nb_objects_previous_group, found->object_length);
+                found->nb_objects_previous_group, found->object_length, found->object_offset + data_length >= found->object_length);
             /* Check how much data should be send in this fragment */
-            header_length = bytes - datagram;
+            header_length = (bytes == NULL) ? 0 : bytes - datagram;
             datagram_length = header_length + data_length;
-            if (datagram_length > PICOQUIC_DATAGRAM_QUEUE_MAX_LENGTH) {
+            if (bytes != NULL && datagram_length > PICOQUIC_DATAGRAM_QUEUE_MAX_LENGTH) {
+                if (stream_ctx->datagram_header_format == quicrq_datagram_header_compact) {
+                    /* The fragment will be split, so the object length cannot be implied */
+                    bytes = quicrq_datagram_stream_header_encode(stream_ctx, datagram, bytes_max, stream_ctx->media_id,
+                        found->group_id, found->object_id, found->object_offset, found->queue_delay + queue_delay_delta, found->flags,
+                        found->nb_objects_previous_group, found->object_length, 0);
+                    header_length = (bytes == NULL) ? 0 : bytes - datagram;
+                }
                 fragment_length = PICOQUIC_DATAGRAM_QUEUE_MAX_LENGTH - header_length;
                 datagram_length = PICOQUIC_DATAGRAM_QUEUE_MAX_LENGTH;
             }
             /* Copy the data */
-            if (bytes + fragment_length > bytes_max) {
+            if (bytes == NULL || bytes + fragment_length > bytes_max) {
                 ret = -1;
             }
             else {
@@ -874,10 +1332,12 @@ int quicrq_datagram_handle_repeat(quicrq_stream_ctx_t* stream_ctx,
                         data += fragment_length;
                         data_length -= fragment_length;
 
-                        /* split the fragment, get a new one, update old record, point found to new record. */
+                        /* split the fragment, get a new one, update old record, point found to new record.
+                         * If the data is shared, the new record shares the tail of the buffer. */
                         ret = quicrq_datagram_ack_init(stream_ctx, found->group_id, found->object_id, next_offset,
-                            found->flags, found->nb_objects_previous_group, data, data_length,
-                            found->queue_delay, found->object_length, &p_next_record, found->start_time);
+                            found->flags, found->nb_objects_previous_group,
+                            (found->data_buffer == NULL) ? data : found->data + fragment_length, data_length,
+                            found->data_buffer, found->queue_delay, found->object_length, &p_next_record, found->start_time);
                         if (ret == 0) {
                             quicrq_datagram_ack_state_t* next_record = (quicrq_datagram_ack_state_t*)p_next_record;
                             next_record->object_length = found->object_length;
@@ -914,6 +1374,7 @@ int quicrq_datagram_handle_lost(quicrq_stream_ctx_t* stream_ctx, uint64_t group_
         if (!found->is_extra_queued || found->last_sent_time <= sent_time + 1000) {
             found->nack_received = 1;
             stream_ctx->nb_fragment_lost++;
+            stream_ctx->counters.media.fragments_repaired++;
             /* Update the datagram header, and queue as datagram */
             ret = quicrq_datagram_handle_repeat(stream_ctx, found, bytes, length,
                 stream_ctx->cnx_ctx->qr_ctx->extra_repeat_on_nack, current_time);
@@ -926,7 +1387,20 @@ int quicrq_datagram_handle_lost(quicrq_stream_ctx_t* stream_ctx, uint64_t group_
     return ret;
 }
 
-/* Handle the acknowledgements of datagrams */
+/* Track the highest group acknowledged, which bounds the group reference of the
+ * receiver when truncating group IDs in compact headers. */
+static void quicrq_datagram_compact_group_acked(quicrq_stream_ctx_t* stream_ctx, uint64_t group_id)
+{
+    if (!stream_ctx->is_compact_group_acked || group_id > stream_ctx->compact_group_acked) {
+        stream_ctx->compact_group_acked = group_id;
+        stream_ctx->is_compact_group_acked = 1;
+    }
+}
+
+/* Handle the acknowledgements of datagrams.
+ * Coalesced datagrams carry several fragments, which are acknowledged
+ * or repaired one by one.
+ */
 int quicrq_handle_datagram_ack_nack(quicrq_cnx_ctx_t* cnx_ctx, picoquic_call_back_event_t picoquic_event, 
     uint64_t send_time, const uint8_t* bytes, size_t length, uint64_t current_time)
 {
@@ -941,34 +1415,57 @@ int quicrq_handle_datagram_ack_nack(quicrq_cnx_ctx_t* cnx_ctx, picoquic_call_bac
     uint8_t flags;
     uint64_t nb_objects_previous_group;
     uint64_t object_length;
-    const uint8_t* next_bytes;
+    const uint8_t* data = NULL;
+    size_t data_length = 0;
+    int is_coalesced = 0;
 
     if (bytes == NULL) {
         ret = -1;
     }
-    else {
-        next_bytes = quicrq_datagram_header_decode(bytes, bytes_max, &media_id, &group_id, &object_id, &object_offset, &queue_delay, &flags, &nb_objects_previous_group, &object_length);
+    else if (quicrq_datagram_is_fec(bytes, length)) {
+        /* FEC datagrams are neither tracked nor repaired */
+        bytes = bytes_max;
+    }
+    else if ((is_coalesced = quicrq_datagram_is_coalesced(bytes, length)) != 0) {
+        bytes += QUICRQ_DATAGRAM_COALESCED_MARKER_LENGTH;
+    }
+
+    while (ret == 0 && bytes < bytes_max) {
+        /* Find the stream context by datagram ID, which tells the header format.
+         * the stream may already be closed, so not finding it is not an error.
+         */
+        quicrq_stream_ctx_t* stream_ctx = NULL;
+        quicrq_datagram_header_format_enum header_format = cnx_ctx->peer_datagram_header_format;
+        uint64_t group_ref = 0;
+
+        if (quicrq_varint_decode(bytes, bytes_max, &media_id) != NULL &&
+            (stream_ctx = quicrq_find_stream_ctx_for_datagram(cnx_ctx, media_id, 1)) != NULL) {
+            uint64_t group_floor = quicrq_datagram_ack_group_floor(stream_ctx);
+
+            header_format = stream_ctx->datagram_header_format;
+            /* Truncated groups expand to the range [floor, floor + 0xff] */
+            group_ref = (group_floor == UINT64_MAX) ? stream_ctx->compact_group_ref : group_floor + 0x7f;
+        }
+        bytes = quicrq_datagram_fragment_decode_ex(bytes, bytes_max, is_coalesced, header_format, group_ref,
+            &media_id, &group_id, &object_id, &object_offset, &queue_delay, &flags, &nb_objects_previous_group,
+            &object_length, &data, &data_length);
         
-        /* Retrieve the stream context for the datagram */
-        if (next_bytes == NULL) {
+        if (bytes == NULL) {
             ret = -1;
         }
         else {
-            /* Find the stream context by datagram ID.
-             * the stream may already be closed, so not finding it is not an error.
-             */
-            quicrq_stream_ctx_t* stream_ctx = quicrq_find_stream_ctx_for_datagram(cnx_ctx, media_id, 1);
             if (stream_ctx != NULL) {
-                size_t data_length = (size_t)(bytes_max - next_bytes);
                 switch (picoquic_event) {
                 case picoquic_callback_datagram_acked: /* Ack for packet carrying datagram-object received from peer */
+                    quicrq_datagram_compact_group_acked(stream_ctx, group_id);
                     ret = quicrq_datagram_handle_ack(stream_ctx, group_id, object_id, object_offset, data_length);
                     break;
                 case picoquic_callback_datagram_lost: /* Packet carrying datagram-object probably lost */
                     ret = quicrq_datagram_handle_lost(stream_ctx, group_id, object_id, object_offset, send_time,
-                        next_bytes, data_length, current_time);
+                        data, data_length, current_time);
                     break;
                 case picoquic_callback_datagram_spurious: /* Packet carrying datagram-object was not really lost */
+                    quicrq_datagram_compact_group_acked(stream_ctx, group_id);
                     ret = quicrq_datagram_handle_ack(stream_ctx, group_id, object_id, object_offset, data_length);
                     break;
                 default:
@@ -1005,76 +1502,235 @@ void quicrq_set_extra_repeat_delay(quicrq_ctx_t* qr, uint64_t delay_in_microseco
  * if there are queued datagrams, or the time at which the next datagram will be
  * queued
  */
-uint64_t quicrq_handle_extra_repeat(quicrq_ctx_t* qr, uint64_t current_time)
+/* Perform the extra repeats that are due on a stream */
+static void quicrq_handle_extra_repeat_stream(quicrq_stream_ctx_t* stream_ctx, uint64_t current_time)
 {
-    uint64_t next_time = UINT64_MAX;
-    quicrq_cnx_ctx_t* cnx_ctx = qr->first_cnx;
+    quicrq_datagram_ack_state_t* das = stream_ctx->extra_first;
 
-    while (cnx_ctx != NULL) {
-        quicrq_stream_ctx_t* stream_ctx = cnx_ctx->first_stream;
-        while (stream_ctx != NULL) {
-            quicrq_datagram_ack_state_t* das = stream_ctx->extra_first;
-            while (das != NULL) {
-                if (das->extra_repeat_time <= current_time) {
-                    next_time = current_time;
-                    int ret = quicrq_datagram_handle_repeat(stream_ctx, das, das->extra_data, das->length, 0, current_time);
-                    if (ret != 0) {
-                        DBG_PRINTF("Handle repeat error, ret = %d", ret);
-                    }
-                    quicrq_datagram_ack_extra_dequeue(stream_ctx, das);
-                    das = stream_ctx->extra_first;
-                }
-                else
-                {
-                    if (das->extra_repeat_time < next_time) {
-                        next_time = das->extra_repeat_time;
-                    }
-                    break;
-                }
-            }
-            stream_ctx = stream_ctx->next_stream;
+    while (das != NULL && das->extra_repeat_time <= current_time) {
+        int ret = quicrq_datagram_handle_repeat(stream_ctx, das, das->extra_data, das->length, 0, current_time);
+        if (ret != 0) {
+            DBG_PRINTF("Handle repeat error, ret = %d", ret);
         }
-        cnx_ctx = cnx_ctx->next_cnx;
+        /* Dequeuing the first element also resets the timer of the stream */
+        quicrq_datagram_ack_extra_dequeue(stream_ctx, das);
+        das = stream_ctx->extra_first;
     }
-    return next_time;
 }
 
-/* Enable of disablecongestion control*/
+/* Delete a relay cache if it is still closed and unused when its timer is due */
+static void quicrq_handle_cache_delete(quicrq_ctx_t* qr, quicrq_media_source_ctx_t* srce_ctx)
+{
+    if (qr->cache_duration_max > 0 && !srce_ctx->is_local_object_source &&
+        srce_ctx->cache_ctx->is_feed_closed && srce_ctx->first_stream == NULL) {
+        quicrq_delete_source(srce_ctx, qr);
+    }
+}
 
-void quicrq_enable_congestion_control(quicrq_ctx_t* qr, quicrq_congestion_control_enum congestion_control_mode)
+/* Periodic check of the relay cache */
+static void quicrq_handle_cache_check(quicrq_ctx_t* qr, uint64_t current_time)
 {
-    if (congestion_control_mode < 0 || congestion_control_mode >= quicrq_congestion_control_max)
-        qr->congestion_control_mode = quicrq_congestion_control_delay;
-    else {
-        qr->congestion_control_mode = congestion_control_mode;
+    if (qr->manage_relay_cache_fn != NULL && qr->cache_duration_max > 0) {
+        (void)qr->manage_relay_cache_fn(qr, current_time);
+        if (quicrq_timer_set(qr, &qr->cache_check_timer, current_time + qr->cache_duration_max / 2) != 0) {
+            DBG_PRINTF("%s", "Cannot set the cache check timer");
+        }
     }
 }
 
-/* Prepare to send a datagram */
+/* Open the warm upstream connections of a relay that are missing */
+static void quicrq_handle_relay_warm(quicrq_ctx_t* qr, uint64_t current_time)
+{
+    if (qr->manage_relay_warm_fn != NULL) {
+        uint64_t next_time = qr->manage_relay_warm_fn(qr, current_time);
+        if (next_time != UINT64_MAX && quicrq_timer_set(qr, &qr->relay_warm_timer, next_time) != 0) {
+            DBG_PRINTF("%s", "Cannot set the relay warm timer");
+        }
+    }
+}
 
-int quicrq_prepare_to_send_datagram(quicrq_cnx_ctx_t* cnx_ctx, void* context, size_t space, uint64_t current_time)
+/* Process all the timers that are due, in order of deadline, and return the
+ * next deadline. Each timer is removed from the heap before its action runs,
+ * so the action can set timers or delete their owners. */
+static uint64_t quicrq_handle_timers(quicrq_ctx_t* qr, uint64_t current_time)
 {
-    /* Find a stream on which datagrams are available */
-    int ret = 0;
-    int at_least_one_active = 0;
-    quicrq_stream_ctx_t* stream_ctx = cnx_ctx->first_stream;
+    quicrq_timer_t* timer;
 
-    /* TODO: handle congestion. Check whether one stream is congested. 
-     * look at priority levels, etc.
-     */
+    while ((timer = quicrq_timer_pop_due(qr, current_time)) != NULL) {
+        switch (timer->timer_type) {
+        case quicrq_timer_extra_repeat:
+            quicrq_handle_extra_repeat_stream((quicrq_stream_ctx_t*)
+                ((char*)timer - offsetof(struct st_quicrq_stream_ctx_t, extra_repeat_timer)), current_time);
+            break;
+        case quicrq_timer_cache_delete:
+            quicrq_handle_cache_delete(qr, (quicrq_media_source_ctx_t*)
+                ((char*)timer - offsetof(struct st_quicrq_media_source_ctx_t, cache_delete_timer)));
+            break;
+        case quicrq_timer_cache_check:
+            quicrq_handle_cache_check(qr, current_time);
+            break;
+        case quicrq_timer_catch_up:
+            quicrq_fragment_publisher_catch_up_wakeup((quicrq_fragment_publisher_context_t*)
+                ((char*)timer - offsetof(struct st_quicrq_fragment_publisher_context_t, catch_up_timer)));
+            break;
+        case quicrq_timer_relay_warm:
+            quicrq_handle_relay_warm(qr, current_time);
+            break;
+        default:
+            DBG_PRINTF("Unexpected timer type: %d", (int)timer->timer_type);
+            break;
+        }
+    }
+    return quicrq_timer_next_deadline(qr);
+}
 
-    while (stream_ctx != NULL) {
-        if (stream_ctx->transport_mode == quicrq_transport_mode_datagram && stream_ctx->is_sender && stream_ctx->is_active_datagram && stream_ctx->media_id < UINT64_MAX) {
+/* The extra repeats are scheduled with the other deadlines of the context.
+ * Only the timers that are due are processed. */
+uint64_t quicrq_handle_extra_repeat(quicrq_ctx_t* qr, uint64_t current_time)
+{
+    return quicrq_handle_timers(qr, current_time);
+}
+
+/* Enable of disablecongestion control*/
+
+void quicrq_enable_congestion_control(quicrq_ctx_t* qr, quicrq_congestion_control_enum congestion_control_mode)
+{
+    if (congestion_control_mode < 0 || congestion_control_mode >= quicrq_congestion_control_max)
+        qr->congestion_control_mode = quicrq_congestion_control_delay;
+    else {
+        qr->congestion_control_mode = congestion_control_mode;
+    }
+}
+
+/* Prepare to send a datagram */
+
+void quicrq_set_datagram_scheduler(quicrq_ctx_t* qr, quicrq_datagram_scheduler_enum scheduler_mode)
+{
+    if (scheduler_mode < 0 || scheduler_mode >= quicrq_datagram_scheduler_max) {
+        qr->datagram_scheduler_mode = quicrq_datagram_scheduler_round_robin;
+    }
+    else {
+        qr->datagram_scheduler_mode = scheduler_mode;
+    }
+}
+
+/* Enable or disable the coalescing of datagrams.
+ * When coalescing, several fragments from one or several media streams are
+ * packed in the same datagram. The fragments are still acknowledged and
+ * repaired one by one.
+ */
+void quicrq_set_datagram_coalescing(quicrq_ctx_t* qr, int is_enabled)
+{
+    qr->is_datagram_coalescing = (is_enabled != 0);
+}
+
+/* Ask the peers to use compact headers in the datagrams that they send to us.
+ * The choice is made per media stream, when sending the request or accepting
+ * the post.
+ */
+void quicrq_set_compact_datagram_headers(quicrq_ctx_t* qr, int is_enabled)
+{
+    qr->is_compact_datagram_header = (is_enabled != 0);
+}
+
+/* Set the size of the datagram fragments, 0 to disable */
+void quicrq_set_fragment_size(quicrq_ctx_t* qr, size_t fragment_size)
+{
+    qr->fragment_size = (fragment_size > QUICRQ_FRAGMENT_SIZE_MAX) ? QUICRQ_FRAGMENT_SIZE_MAX : fragment_size;
+}
+
+/* Enable or disable the arrival cursor for the datagram subscriptions */
+void quicrq_set_arrival_cursor(quicrq_ctx_t* qr, int is_enabled)
+{
+    qr->is_arrival_cursor_enabled = (is_enabled != 0);
+}
+
+/* Set the number of fragments protected by each FEC datagram, 0 to disable FEC */
+void quicrq_set_datagram_fec(quicrq_ctx_t* qr, size_t fec_window)
+{
+    qr->datagram_fec_window = (fec_window > QUICRQ_FEC_WINDOW_MAX) ? QUICRQ_FEC_WINDOW_MAX : fec_window;
+}
+
+/* Fill a coalesced datagram with the fragments of the streams, in the
+ * order set by the scheduler, until the datagram is full or no stream
+ * has anything to send. */
+static int quicrq_prepare_to_send_coalesced_datagram(quicrq_cnx_ctx_t* cnx_ctx, void* context, size_t space,
+    int* at_least_one_active, uint64_t current_time)
+{
+    int ret = 0;
+    int nb_fragments_before;
+    uint8_t datagram[PICOQUIC_MAX_PACKET_SIZE];
+    quicrq_datagram_coalescing_t coalescing = { 0 };
+
+    coalescing.bytes = datagram;
+    coalescing.space = (space < sizeof(datagram)) ? space : sizeof(datagram);
+    if (quicrq_datagram_coalesced_marker_encode(datagram, datagram + coalescing.space) == NULL) {
+        /* Not even enough space for the marker */
+        *at_least_one_active = 1;
+        coalescing.is_full = 1;
+    }
+    coalescing.length = QUICRQ_DATAGRAM_COALESCED_MARKER_LENGTH;
+
+    do {
+        quicrq_stream_ctx_t* stream_ctx = (coalescing.is_full) ? NULL : quicrq_datagram_scheduler_first(cnx_ctx);
+
+        nb_fragments_before = coalescing.nb_fragments;
+        while (stream_ctx != NULL) {
             int media_was_sent = 0;
-            ret = quicrq_fragment_datagram_publisher_fn(stream_ctx, context, space, &media_was_sent, &at_least_one_active, current_time);
-            if (media_was_sent || ret != 0) {
+            ret = quicrq_fragment_datagram_publisher_fn(stream_ctx, context, space, &coalescing,
+                &media_was_sent, at_least_one_active, current_time);
+            if (ret != 0) {
                 break;
             }
-            else {
-                stream_ctx->is_active_datagram = 0;
+            if (media_was_sent && stream_ctx->media_ctx->current_fragment != NULL) {
+                stream_ctx->datagram_flags = stream_ctx->media_ctx->current_fragment->flags;
             }
+            if (coalescing.is_full && !media_was_sent) {
+                /* This stream still has data, it will be first in the next datagram */
+                cnx_ctx->datagram_scheduler.next_stream = stream_ctx;
+                break;
+            }
+            stream_ctx = quicrq_datagram_scheduler_next(cnx_ctx, stream_ctx, media_was_sent);
+        }
+    } while (ret == 0 && !coalescing.is_full && coalescing.nb_fragments > nb_fragments_before);
+
+    if (ret == 0 && coalescing.nb_fragments > 0) {
+        uint8_t* buffer = (uint8_t*)picoquic_provide_datagram_buffer(context, coalescing.length);
+        if (buffer == NULL) {
+            ret = -1;
+        }
+        else {
+            memcpy(buffer, datagram, coalescing.length);
+        }
+    }
+
+    return ret;
+}
+
+int quicrq_prepare_to_send_datagram(quicrq_cnx_ctx_t* cnx_ctx, void* context, size_t space, uint64_t current_time)
+{
+    /* Find a stream on which datagrams are available, in the order set by the scheduler */
+    int ret = 0;
+    int at_least_one_active = 0;
+
+    if (cnx_ctx->qr_ctx->is_datagram_coalescing) {
+        ret = quicrq_prepare_to_send_coalesced_datagram(cnx_ctx, context, space, &at_least_one_active, current_time);
+    }
+    else {
+        quicrq_stream_ctx_t* stream_ctx = quicrq_datagram_scheduler_first(cnx_ctx);
+
+        while (stream_ctx != NULL) {
+            int media_was_sent = 0;
+            ret = quicrq_fragment_datagram_publisher_fn(stream_ctx, context, space, NULL,
+                &media_was_sent, &at_least_one_active, current_time);
+            if (ret != 0) {
+                break;
+            }
+            if (media_was_sent && stream_ctx->media_ctx->current_fragment != NULL) {
+                stream_ctx->datagram_flags = stream_ctx->media_ctx->current_fragment->flags;
+            }
+            stream_ctx = quicrq_datagram_scheduler_next(cnx_ctx, stream_ctx, media_was_sent);
         }
-        stream_ctx = stream_ctx->next_stream;
     }
 
     if (ret == 0) {
@@ -1141,15 +1797,161 @@ int quicrq_prepare_start_point(quicrq_stream_ctx_t* stream_ctx)
     return ret;
 }
 
+/* Prepare the feedback message on the control stream of a receiver */
+static int quicrq_prepare_feedback(quicrq_stream_ctx_t* stream_ctx)
+{
+    int ret = 0;
+    quicrq_message_buffer_t* message = &stream_ctx->message_sent;
+
+    quicrq_log_message(stream_ctx->cnx_ctx,
+        "Stream %" PRIu64 ", sending feedback, max flags: 0x%x, target bitrate: %" PRIu64,
+        stream_ctx->stream_id, stream_ctx->feedback.max_flags, stream_ctx->feedback.target_bitrate);
+    if (quicrq_msg_buffer_alloc(message, quicrq_feedback_msg_reserve(stream_ctx->feedback.target_bitrate), 0) != 0) {
+        ret = -1;
+    }
+    else {
+        uint8_t* message_next = quicrq_feedback_msg_encode(message->buffer, message->buffer + message->buffer_alloc, QUICRQ_ACTION_FEEDBACK,
+            stream_ctx->feedback.max_flags, stream_ctx->feedback.target_bitrate);
+        if (message_next == NULL) {
+            ret = -1;
+        }
+        else {
+            message->message_size = message_next - message->buffer;
+            stream_ctx->send_state = quicrq_sending_feedback;
+            stream_ctx->is_feedback_pending = 0;
+        }
+    }
+    return ret;
+}
+
+/* Prepare the next message on the control stream of a batch.
+ * The finished tracks are deleted first. When no track is left, the stream
+ * is closed. Otherwise, the receiver sends the pending unsubscribe messages,
+ * and the sender looks for the first track that has a start point, a cache
+ * policy or a final point to send, and queues it as a track message.
+ */
+static int quicrq_prepare_batch_message(quicrq_stream_ctx_t* stream_ctx)
+{
+    int ret = 0;
+    quicrq_stream_ctx_t* track_ctx = stream_ctx->first_track;
+
+    while (track_ctx != NULL) {
+        quicrq_stream_ctx_t* next_track = track_ctx->next_track;
+        if (track_ctx->send_state == quicrq_sending_fin) {
+            quicrq_log_message(stream_ctx->cnx_ctx, "Stream %" PRIu64 ", track %" PRIu64 " is finished",
+                stream_ctx->stream_id, track_ctx->media_id);
+            quicrq_delete_stream_ctx(stream_ctx->cnx_ctx, track_ctx);
+        }
+        track_ctx = next_track;
+    }
+
+    if (stream_ctx->first_track == NULL) {
+        stream_ctx->send_state = quicrq_sending_fin;
+    }
+    else if (stream_ctx->nb_unsubscribed_tracks > 0) {
+        quicrq_message_buffer_t* message = &stream_ctx->message_sent;
+        uint64_t media_id = stream_ctx->unsubscribed_track_id[stream_ctx->nb_unsubscribed_tracks - 1];
+
+        if (quicrq_msg_buffer_alloc(message, quicrq_unsubscribe_track_msg_reserve(media_id), 0) != 0) {
+            ret = -1;
+        }
+        else {
+            uint8_t* message_next = quicrq_unsubscribe_track_msg_encode(message->buffer, message->buffer + message->buffer_alloc, media_id);
+            if (message_next == NULL) {
+                ret = -1;
+            }
+            else {
+                quicrq_log_message(stream_ctx->cnx_ctx, "Stream %" PRIu64 ", unsubscribe track %" PRIu64,
+                    stream_ctx->stream_id, media_id);
+                message->message_size = message_next - message->buffer;
+                stream_ctx->nb_unsubscribed_tracks--;
+                stream_ctx->send_state = quicrq_sending_batch;
+            }
+        }
+    }
+    else if (stream_ctx->is_sender) {
+        quicrq_message_buffer_t* message = &stream_ctx->message_sent;
+        uint64_t inner_type = 0;
+
+        track_ctx = stream_ctx->first_track;
+        while (track_ctx != NULL && inner_type == 0) {
+            if ((track_ctx->start_group_id > 0 || track_ctx->start_object_id > 0) && !track_ctx->is_start_object_id_sent) {
+                inner_type = QUICRQ_ACTION_START_POINT;
+            }
+            else if (track_ctx->is_cache_real_time && !track_ctx->is_cache_policy_sent) {
+                inner_type = QUICRQ_ACTION_CACHE_POLICY;
+            }
+            else if ((track_ctx->final_group_id > 0 || track_ctx->final_object_id > 0) && !track_ctx->is_final_object_id_sent) {
+                inner_type = QUICRQ_ACTION_FIN_DATAGRAM;
+            }
+            else {
+                track_ctx = track_ctx->next_track;
+            }
+        }
+        if (track_ctx != NULL) {
+            size_t reserve = quicrq_track_msg_reserve(track_ctx->media_id) +
+                quicrq_fin_msg_reserve(track_ctx->final_group_id, track_ctx->final_object_id) +
+                quicrq_start_point_msg_reserve(track_ctx->start_group_id, track_ctx->start_object_id) +
+                quicrq_cache_policy_msg_reserve();
+
+            if (quicrq_msg_buffer_alloc(message, reserve, 0) != 0) {
+                ret = -1;
+            }
+            else {
+                uint8_t* message_next = quicrq_track_msg_encode(message->buffer, message->buffer + message->buffer_alloc,
+                    QUICRQ_ACTION_TRACK, track_ctx->media_id);
+
+                if (message_next != NULL) {
+                    switch (inner_type) {
+                    case QUICRQ_ACTION_START_POINT:
+                        message_next = quicrq_start_point_msg_encode(message_next, message->buffer + message->buffer_alloc, QUICRQ_ACTION_START_POINT,
+                            track_ctx->start_group_id, track_ctx->start_object_id);
+                        track_ctx->is_start_object_id_sent = 1;
+                        break;
+                    case QUICRQ_ACTION_CACHE_POLICY:
+                        message_next = quicrq_cache_policy_msg_encode(message_next, message->buffer + message->buffer_alloc, QUICRQ_ACTION_CACHE_POLICY, 1);
+                        track_ctx->is_cache_policy_sent = 1;
+                        break;
+                    default:
+                        message_next = quicrq_fin_msg_encode(message_next, message->buffer + message->buffer_alloc, QUICRQ_ACTION_FIN_DATAGRAM,
+                            track_ctx->final_group_id, track_ctx->final_object_id);
+                        track_ctx->is_final_object_id_sent = 1;
+                        if (track_ctx->close_reason == quicrq_media_close_reason_unknown) {
+                            track_ctx->close_reason = quicrq_media_close_finished;
+                        }
+                        break;
+                    }
+                }
+                if (message_next == NULL) {
+                    ret = -1;
+                }
+                else {
+                    quicrq_log_message(stream_ctx->cnx_ctx, "Stream %" PRIu64 ", sending message %" PRIu64 " for track %" PRIu64,
+                        stream_ctx->stream_id, inner_type, track_ctx->media_id);
+                    message->message_size = message_next - message->buffer;
+                    stream_ctx->send_state = quicrq_sending_batch;
+                }
+            }
+        }
+    }
+    return ret;
+}
+
 int quicrq_prepare_to_send_on_stream(quicrq_stream_ctx_t* stream_ctx, void* context, size_t space, uint64_t current_time)
 {
     int ret = 0;
     int more_to_send = 0;
 
+    /* The next wake up marks the stream active again, in case this call leaves it inactive */
+    stream_ctx->is_active_stream = 0;
+
     if (stream_ctx->send_state == quicrq_sending_ready) {
         quicrq_message_buffer_t* message = &stream_ctx->message_sent;
         /* Ready to send next message */
-        if (stream_ctx->is_sender) {
+        if (stream_ctx->is_batch) {
+            ret = quicrq_prepare_batch_message(stream_ctx);
+        }
+        else if (stream_ctx->is_sender) {
             if ((stream_ctx->start_group_id > 0 || stream_ctx->start_object_id > 0) && !stream_ctx->is_start_object_id_sent) {
                 ret = quicrq_prepare_start_point(stream_ctx);
             }
@@ -1207,6 +2009,9 @@ int quicrq_prepare_to_send_on_stream(quicrq_stream_ctx_t* stream_ctx, void* cont
                 picoquic_mark_active_stream(stream_ctx->cnx_ctx->cnx, stream_ctx->stream_id, 0, stream_ctx);
             }
         }
+        else if (stream_ctx->is_feedback_pending) {
+            ret = quicrq_prepare_feedback(stream_ctx);
+        }
         else {
             /* TODO: consider receiver messages */
             quicrq_log_message(stream_ctx->cnx_ctx,
@@ -1262,6 +2067,8 @@ int quicrq_prepare_to_send_on_stream(quicrq_stream_ctx_t* stream_ctx, void* cont
         case quicrq_sending_initial:
             /* Send available buffer data. Mark state ready after sent. */
             more_to_send = (stream_ctx->final_group_id > 0 || stream_ctx->final_object_id > 0) && !stream_ctx->is_final_object_id_sent;
+            more_to_send |= stream_ctx->is_feedback_pending;
+            more_to_send |= (stream_ctx->nb_unsubscribed_tracks > 0);
             ret = quicrq_msg_buffer_prepare_to_send(stream_ctx, context, space, more_to_send);
             break;
         case quicrq_sending_repair:
@@ -1291,6 +2098,14 @@ int quicrq_prepare_to_send_on_stream(quicrq_stream_ctx_t* stream_ctx, void* cont
             stream_ctx->is_cache_policy_sent = 1;
             stream_ctx->send_state = quicrq_sending_ready;
             break;
+        case quicrq_sending_feedback:
+            /* Send the feedback, then send the next one if the application changed it. */
+            ret = quicrq_msg_buffer_prepare_to_send(stream_ctx, context, space, stream_ctx->is_feedback_pending);
+            break;
+        case quicrq_sending_batch:
+            /* Send the batch accept or track message, then look for the next one. */
+            ret = quicrq_msg_buffer_prepare_to_send(stream_ctx, context, space, 1);
+            break;
         case quicrq_sending_subscribe:
             ret = quicrq_msg_buffer_prepare_to_send(stream_ctx, context, space, 0);
             if (stream_ctx->send_state == quicrq_sending_ready) {
@@ -1397,7 +2212,15 @@ int quicrq_prepare_warp_object_header(quicrq_uni_stream_ctx_t* uni_stream_ctx, u
         /* Todo: we may send this immediately, as soon as the object length is known. */
         if (quicrq_fragment_get_object_properties(cache_ctx, uni_stream_ctx->current_group_id, uni_stream_ctx->current_object_id,
             &uni_stream_ctx->current_object_length, &uni_stream_ctx->nb_objects_previous_group, 
-            &uni_stream_ctx->current_object_flags) == 0){
+            &uni_stream_ctx->current_object_flags) != 0) {
+            /* Not available. Could it be because the final object ID has been reached? */
+            quicrq_fragment_notify_final_to_control(cache_ctx, uni_stream_ctx->control_stream_ctx);
+        }
+        else if (quicrq_fragment_publisher_catch_up_hold(media_ctx, quicrq_fragment_cache_get_object(cache_ctx,
+            uni_stream_ctx->current_group_id, uni_stream_ctx->current_object_id), current_time)) {
+            /* The object is paced during catch up, the stream will be woken up by the catch up timer */
+        }
+        else {
             int should_skip = 0;
             quicrq_message_buffer_t* message = &uni_stream_ctx->message_buffer;
             uint8_t* message_next = NULL;
@@ -1407,6 +2230,7 @@ int quicrq_prepare_warp_object_header(quicrq_uni_stream_ctx_t* uni_stream_ctx, u
             if (should_skip) {
                 uni_stream_ctx->current_object_length = 0;
                 uni_stream_ctx->current_object_flags = 0xff;
+                uni_stream_ctx->control_stream_ctx->counters.media.objects_dropped++;
             }
             /* Encode object header */
             if (quicrq_msg_buffer_alloc(message, quicrq_object_header_msg_reserve(uni_stream_ctx->current_object_id, 
@@ -1428,6 +2252,9 @@ int quicrq_prepare_warp_object_header(quicrq_uni_stream_ctx_t* uni_stream_ctx, u
                 }
                 if (uni_stream_ctx->current_object_length == 0) {
                     /* No need to wait for transmission of the object data! */
+                    if (!should_skip) {
+                        quicrq_media_counters_fragment_sent(&uni_stream_ctx->control_stream_ctx->counters, 0, 1);
+                    }
                     uni_stream_ctx->current_object_id++;
                     uni_stream_ctx->send_state = quicrq_sending_warp_header_sent;
                 }
@@ -1436,10 +2263,6 @@ int quicrq_prepare_warp_object_header(quicrq_uni_stream_ctx_t* uni_stream_ctx, u
                 }
             }
         }
-        else {
-            /* Not available. Could it be because the final object ID has been reached? */
-            quicrq_fragment_notify_final_to_control(cache_ctx, uni_stream_ctx->control_stream_ctx);
-        }
     }
     return ret;
 }
@@ -1447,13 +2270,16 @@ int quicrq_prepare_warp_object_header(quicrq_uni_stream_ctx_t* uni_stream_ctx, u
 int quicrq_prepare_to_send_on_unistream(quicrq_cnx_ctx_t * cnx_ctx, quicrq_uni_stream_ctx_t * uni_stream_ctx, void* context, size_t space, uint64_t current_time)
 {
     int ret = 0;
+
+    /* The next wake up marks the stream active again, in case this call leaves it inactive */
+    uni_stream_ctx->is_active_stream = 0;
     /* prepare the message that needs to be sent */
     if (uni_stream_ctx->send_state == quicrq_sending_object_data) {
         /* Todo: if content is available, send it */
         /* When done: back to quicrq_sending_warp_header_sent */
         quicrq_fragment_publisher_context_t* media_ctx = uni_stream_ctx->control_stream_ctx->media_ctx;
         quicrq_fragment_cache_t* cache_ctx = media_ctx->cache_ctx;
-        size_t fragment_length = quicrq_fragment_object_copy_available_data(cache_ctx,
+        size_t fragment_length = quicrq_fragment_object_copy_available_data(cache_ctx, &uni_stream_ctx->cursor,
             uni_stream_ctx->current_group_id, uni_stream_ctx->current_object_id,
             uni_stream_ctx->current_object_offset, space, NULL);
 
@@ -1463,14 +2289,22 @@ int quicrq_prepare_to_send_on_unistream(quicrq_cnx_ctx_t * cnx_ctx, quicrq_uni_s
                 ret = -1;
             }
             else {
-                size_t copied_length = quicrq_fragment_object_copy_available_data(cache_ctx,
+                size_t copied_length = quicrq_fragment_object_copy_available_data(cache_ctx, &uni_stream_ctx->cursor,
                     uni_stream_ctx->current_group_id, uni_stream_ctx->current_object_id,
                     uni_stream_ctx->current_object_offset, fragment_length, buffer);
                 if (copied_length != fragment_length) {
                     ret = -1;
                 }
                 else {
+                    cache_ctx->last_read_time = current_time;
                     uni_stream_ctx->current_object_offset += copied_length;
+                    quicrq_media_counters_fragment_sent(&uni_stream_ctx->control_stream_ctx->counters, copied_length,
+                        uni_stream_ctx->current_object_offset >= uni_stream_ctx->current_object_length);
+                    if (uni_stream_ctx->cursor.fragment != NULL && current_time > uni_stream_ctx->cursor.fragment->cache_time) {
+                        /* The cursor is left at the last fragment copied */
+                        quicrq_hop_latency_record(cache_ctx, quicrq_hop_latency_cache_to_send,
+                            current_time - uni_stream_ctx->cursor.fragment->cache_time);
+                    }
                     if (uni_stream_ctx->current_object_offset == uni_stream_ctx->current_object_length) {
                         /* this object is sent, back to state quicrq_sending_warp_header_sent */
                         uni_stream_ctx->current_object_id++;
@@ -1519,92 +2353,495 @@ int quicrq_prepare_to_send_on_unistream(quicrq_cnx_ctx_t * cnx_ctx, quicrq_uni_s
             }
         }
     }
-
+
+    return ret;
+}
+
+/* Prefix trie of the active subscribe patterns.
+ * The number of children of a node is bounded by the 256 values of a byte,
+ * and is in practice small, so the children are kept in a simple list.
+ */
+static quicrq_subscribe_node_t* quicrq_subscribe_trie_child(quicrq_subscribe_node_t* node, uint8_t prefix_byte)
+{
+    quicrq_subscribe_node_t* child = node->first_child;
+
+    while (child != NULL && child->prefix_byte != prefix_byte) {
+        child = child->next_sibling;
+    }
+    return child;
+}
+
+/* Delete the nodes that have no subscriber, no upstream and no children,
+ * starting from the specified node and going up to the root. */
+static void quicrq_subscribe_trie_prune(quicrq_subscribe_node_t* node)
+{
+    while (node->parent != NULL && node->first_child == NULL &&
+        node->first_subscriber == NULL && node->upstream_stream_ctx == NULL) {
+        quicrq_subscribe_node_t* parent = node->parent;
+        quicrq_subscribe_node_t** previous = &parent->first_child;
+
+        while (*previous != node) {
+            previous = &(*previous)->next_sibling;
+        }
+        *previous = node->next_sibling;
+        free(node);
+        node = parent;
+    }
+}
+
+static quicrq_subscribe_node_t* quicrq_subscribe_trie_get(quicrq_ctx_t* qr_ctx, const uint8_t* prefix, size_t prefix_length, int should_create)
+{
+    quicrq_subscribe_node_t* node = &qr_ctx->subscribe_root;
+
+    for (size_t i = 0; node != NULL && i < prefix_length; i++) {
+        quicrq_subscribe_node_t* child = quicrq_subscribe_trie_child(node, prefix[i]);
+
+        if (child == NULL && should_create) {
+            child = (quicrq_subscribe_node_t*)malloc(sizeof(quicrq_subscribe_node_t));
+            if (child == NULL) {
+                /* Remove the nodes created so far */
+                quicrq_subscribe_trie_prune(node);
+            }
+            else {
+                memset(child, 0, sizeof(quicrq_subscribe_node_t));
+                child->parent = node;
+                child->prefix_byte = prefix[i];
+                child->next_sibling = node->first_child;
+                node->first_child = child;
+            }
+        }
+        node = child;
+    }
+    return node;
+}
+
+quicrq_subscribe_node_t* quicrq_subscribe_trie_find(quicrq_ctx_t* qr_ctx, const uint8_t* prefix, size_t prefix_length)
+{
+    return quicrq_subscribe_trie_get(qr_ctx, prefix, prefix_length, 0);
+}
+
+int quicrq_subscribe_trie_add(quicrq_stream_ctx_t* stream_ctx)
+{
+    int ret = 0;
+    quicrq_subscribe_node_t* node = quicrq_subscribe_trie_get(stream_ctx->cnx_ctx->qr_ctx,
+        stream_ctx->subscribe_prefix, stream_ctx->subscribe_prefix_length, 1);
+
+    if (node == NULL) {
+        ret = -1;
+    }
+    else {
+        stream_ctx->subscribe_node = node;
+        stream_ctx->previous_subscriber = NULL;
+        stream_ctx->next_subscriber = node->first_subscriber;
+        if (node->first_subscriber != NULL) {
+            node->first_subscriber->previous_subscriber = stream_ctx;
+        }
+        node->first_subscriber = stream_ctx;
+        node->nb_subscribers++;
+    }
+    return ret;
+}
+
+/* Remove a stream from the trie, whether it is subscribed to a pattern
+ * or forwarding a pattern upstream. When the last subscriber to a pattern
+ * leaves, the relay is told to unsubscribe from the origin.
+ */
+void quicrq_subscribe_trie_remove(quicrq_stream_ctx_t* stream_ctx)
+{
+    quicrq_ctx_t* qr_ctx = stream_ctx->cnx_ctx->qr_ctx;
+    quicrq_subscribe_node_t* node = stream_ctx->subscribe_node;
+
+    if (node != NULL) {
+        if (stream_ctx->previous_subscriber == NULL) {
+            node->first_subscriber = stream_ctx->next_subscriber;
+        }
+        else {
+            stream_ctx->previous_subscriber->next_subscriber = stream_ctx->next_subscriber;
+        }
+        if (stream_ctx->next_subscriber != NULL) {
+            stream_ctx->next_subscriber->previous_subscriber = stream_ctx->previous_subscriber;
+        }
+        stream_ctx->subscribe_node = NULL;
+        stream_ctx->next_subscriber = NULL;
+        stream_ctx->previous_subscriber = NULL;
+        node->nb_subscribers--;
+        if (node->nb_subscribers == 0 && qr_ctx->manage_relay_subscribe_fn != NULL) {
+            qr_ctx->manage_relay_subscribe_fn(qr_ctx, quicrq_subscribe_action_unsubscribe,
+                stream_ctx->subscribe_prefix, stream_ctx->subscribe_prefix_length);
+        }
+        quicrq_subscribe_trie_prune(node);
+    }
+
+    node = stream_ctx->upstream_subscribe_node;
+    if (node != NULL) {
+        quicrq_subscribe_trie_set_upstream(node, NULL);
+        quicrq_subscribe_trie_prune(node);
+    }
+}
+
+/* Set or clear the stream that forwards the pattern of a node upstream.
+ * This does not prune the node, which is left to the caller. */
+void quicrq_subscribe_trie_set_upstream(quicrq_subscribe_node_t* node, quicrq_stream_ctx_t* stream_ctx)
+{
+    if (node->upstream_stream_ctx != NULL) {
+        node->upstream_stream_ctx->upstream_subscribe_node = NULL;
+    }
+    node->upstream_stream_ctx = stream_ctx;
+    if (stream_ctx != NULL) {
+        stream_ctx->upstream_subscribe_node = node;
+    }
+}
+
+/* Processing of subscribe and notify messages */
+
+static int quicrq_notify_url_queue(quicrq_stream_ctx_t* stream_ctx, const uint8_t* url, size_t url_length)
+{
+    int ret = 0;
+    quicrq_notify_url_t* notified = (quicrq_notify_url_t*)
+        malloc(sizeof(quicrq_notify_url_t) + url_length);
+    if (notified == NULL) {
+        ret = -1;
+    }
+    else {
+        memset(notified, 0, sizeof(quicrq_notify_url_t));
+        notified->next_notify_url = stream_ctx->first_notify_url;
+        notified->url_len = url_length;
+        notified->url = ((uint8_t*)notified) + sizeof(quicrq_notify_url_t);
+        memcpy(notified->url, url, url_length);
+        stream_ctx->first_notify_url = notified;
+        quicrq_wakeup_media_stream(stream_ctx);
+    }
+    return ret;
+}
+
+int quicrq_notify_url_to_stream(quicrq_stream_ctx_t* stream_ctx, const uint8_t* url, size_t url_length)
+{
+    int ret = 0;
+    /* Store the subscribe parameters */
+    if (url_length >= stream_ctx->subscribe_prefix_length &&
+        memcmp(url, stream_ctx->subscribe_prefix, stream_ctx->subscribe_prefix_length) == 0) {
+        ret = quicrq_notify_url_queue(stream_ctx, url, url_length);
+        if (ret == 0) {
+            ret = 1;
+        }
+    }
+    return ret;
+}
+
+/* Notify a new URL to all the streams subscribed to a prefix of that URL.
+ * The nodes on the path of the URL in the prefix trie are exactly
+ * the matching prefixes. */
+int quicrq_notify_url_to_all(quicrq_ctx_t* qr_ctx, const uint8_t* url, size_t url_length)
+{
+    int ret = 0;
+    size_t url_index = 0;
+    quicrq_subscribe_node_t* node = &qr_ctx->subscribe_root;
+
+    while (node != NULL && ret == 0) {
+        quicrq_stream_ctx_t* stream_ctx = node->first_subscriber;
+
+        while (stream_ctx != NULL && ret == 0) {
+            ret = quicrq_notify_url_queue(stream_ctx, url, url_length);
+            stream_ctx = stream_ctx->next_subscriber;
+        }
+        if (url_index < url_length) {
+            node = quicrq_subscribe_trie_child(node, url[url_index]);
+            url_index++;
+        }
+        else {
+            node = NULL;
+        }
+    }
+
+    return ret;
+}
+
+int quicrq_process_incoming_subscribe(quicrq_stream_ctx_t* stream_ctx, size_t url_length, const uint8_t* url)
+{
+    int ret = 0;
+    quicrq_ctx_t* qr_ctx = stream_ctx->cnx_ctx->qr_ctx;
+    /* Store the subscribe parameters */
+    stream_ctx->subscribe_prefix = malloc(url_length + 1);
+    if (stream_ctx->subscribe_prefix == NULL) {
+        ret = -1;
+    }
+    else {
+        stream_ctx->subscribe_prefix_length = url_length;
+        memcpy(stream_ctx->subscribe_prefix, url, url_length);
+        stream_ctx->receive_state = quicrq_receive_done;
+        stream_ctx->send_state = quicrq_notify_ready;
+        ret = quicrq_subscribe_trie_add(stream_ctx);
+    }
+    if (ret == 0) {
+        /* Check all the known media source whose URL matches the prefix */
+        quicrq_media_source_ctx_t* srce_ctx = quicrq_first_source_with_prefix(qr_ctx, url, url_length);
+
+        while (srce_ctx != NULL) {
+            if (quicrq_notify_url_to_stream(stream_ctx, srce_ctx->media_url, srce_ctx->media_url_length) < 0) {
+                ret = -1;
+                break;
+            }
+            else {
+                srce_ctx = quicrq_next_source_with_prefix(srce_ctx, url, url_length);
+            }
+        }
+    }
+
+    /* TODO: if this is a relay, perform necessary actions */
+    return ret;
+}
+
+/* Process a media request, either received on its own control stream or
+ * as part of a batch. For the tracks of a batch, the start point is sent
+ * in a track message on the control stream of the batch.
+ */
+static int quicrq_process_incoming_request(quicrq_stream_ctx_t* stream_ctx, const uint8_t* url, size_t url_length,
+    quicrq_subscribe_intent_enum intent_mode, uint64_t start_group_id, uint64_t start_object_id)
+{
+    int ret = 0;
+    uint64_t intent_group = 0;
+    uint64_t intent_object = 0;
+
+    ret = quicrq_subscribe_local_media(stream_ctx, url, url_length);
+    if (ret == 0) {
+        quicrq_wakeup_media_stream(stream_ctx);
+    }
+    if (ret == 0) {
+        /* Apply the preferences based on intent */
+        stream_ctx->is_sender = 1;
+        switch (intent_mode) {
+        case quicrq_subscribe_intent_current_group:
+            intent_group = quicrq_fragment_cache_join_group_id(stream_ctx->media_ctx->cache_ctx, 0);
+            intent_object = 0;
+            break;
+        case quicrq_subscribe_intent_latest_complete_group:
+            intent_group = quicrq_fragment_cache_join_group_id(stream_ctx->media_ctx->cache_ctx, 1);
+            intent_object = 0;
+            break;
+        case quicrq_subscribe_intent_next_group:
+            intent_group = stream_ctx->media_ctx->cache_ctx->next_group_id + 1;
+            intent_object = 0;
+            break;
+        case quicrq_subscribe_intent_start_point:
+            intent_group = start_group_id;
+            intent_object = start_object_id;
+            break;
+        default:
+            break;
+        }
+        /* Override the intent if impossible to meet */
+        if (stream_ctx->start_group_id > 0 || stream_ctx->start_object_id > 0) {
+            if (intent_group < stream_ctx->next_group_id ||
+                (intent_group == stream_ctx->next_group_id &&
+                    intent_object < stream_ctx->next_object_id)) {
+                intent_group = stream_ctx->start_group_id;
+                intent_object = stream_ctx->start_object_id;
+            }
+        }
+    }
+    if (intent_group > 0 || intent_object > 0) {
+        /* apply the intent, prepare a start point message */
+        stream_ctx->start_group_id = intent_group;
+        stream_ctx->start_object_id = intent_object;
+        stream_ctx->next_group_id = intent_group;
+        stream_ctx->next_object_id = intent_object;
+        stream_ctx->media_ctx->current_group_id = intent_group;
+        stream_ctx->media_ctx->current_object_id = intent_object;
+        stream_ctx->media_ctx->current_offset = 0;
+        if (stream_ctx->batch_ctx == NULL) {
+            ret = quicrq_prepare_start_point(stream_ctx);
+        }
+        stream_ctx->receive_state = quicrq_receive_feedback;
+        (void)quicrq_mark_control_stream_active(stream_ctx);
+    }
+    else if (stream_ctx->transport_mode == quicrq_transport_mode_single_stream) {
+        /* Start sending stream without endpoint message */
+        stream_ctx->send_state = quicrq_sending_single_stream;
+        stream_ctx->receive_state = quicrq_receive_feedback;
+        picoquic_mark_active_stream(stream_ctx->cnx_ctx->cnx, stream_ctx->stream_id, 1, stream_ctx);
+    }
+    else if (stream_ctx->transport_mode == quicrq_transport_mode_datagram
+        || stream_ctx->transport_mode == quicrq_transport_mode_warp
+        || stream_ctx->transport_mode == quicrq_transport_mode_rush) {
+        /* Start sending data without endpoint message */
+        stream_ctx->send_state = quicrq_sending_ready;
+        stream_ctx->receive_state = quicrq_receive_feedback;
+    }
+    else {
+        /* Not supported yet */
+        ret = -1;
+    }
     return ret;
 }
 
-/* Processing of subscribe and notify messages */
-
-int quicrq_notify_url_to_stream(quicrq_stream_ctx_t* stream_ctx, const uint8_t* url, size_t url_length)
+/* Process a batch request. Each URL of the batch is processed as a separate
+ * request, creating a track context with the media id allocated by the client.
+ * The media ids of the accepted tracks are sent back in the batch accept message.
+ */
+static int quicrq_process_incoming_batch(quicrq_stream_ctx_t* stream_ctx, quicrq_message_t* incoming)
 {
     int ret = 0;
-    /* Store the subscribe parameters */
-    if (url_length >= stream_ctx->subscribe_prefix_length &&
-        memcmp(url, stream_ctx->subscribe_prefix, stream_ctx->subscribe_prefix_length) == 0) {
-        quicrq_notify_url_t* notified = (quicrq_notify_url_t*)
-            malloc(sizeof(quicrq_notify_url_t) + url_length);
-        if (notified == NULL) {
+    uint64_t* accepted = NULL;
+    size_t nb_accepted = 0;
+    const uint8_t* bytes = incoming->track_list;
+    const uint8_t* bytes_max = stream_ctx->message_receive.buffer + stream_ctx->message_receive.message_size;
+
+    stream_ctx->is_batch = 1;
+    stream_ctx->is_sender = 1;
+    stream_ctx->media_id = UINT64_MAX;
+    stream_ctx->datagram_header_format = incoming->datagram_header_format;
+    if (incoming->datagram_header_format != quicrq_datagram_header_full) {
+        stream_ctx->cnx_ctx->peer_datagram_header_format = incoming->datagram_header_format;
+    }
+    stream_ctx->receive_state = quicrq_receive_batch;
+    quicrq_log_message(stream_ctx->cnx_ctx, "Stream %" PRIu64 ", received a batch request for %zu tracks, first id= %" PRIu64,
+        stream_ctx->stream_id, incoming->nb_tracks, incoming->media_id);
+
+    if (incoming->nb_tracks > 0 &&
+        (accepted = (uint64_t*)malloc(incoming->nb_tracks * sizeof(uint64_t))) == NULL) {
+        ret = -1;
+    }
+    for (size_t i = 0; ret == 0 && i < incoming->nb_tracks; i++) {
+        size_t url_length = 0;
+        const uint8_t* url = NULL;
+        quicrq_stream_ctx_t* track_ctx = NULL;
+
+        if ((bytes = quicrq_batch_url_decode(bytes, bytes_max, &url_length, &url)) == NULL ||
+            (track_ctx = quicrq_create_track_context(stream_ctx, incoming->media_id + i)) == NULL) {
             ret = -1;
         }
+        else if (quicrq_process_incoming_request(track_ctx, url, url_length, incoming->subscribe_intent,
+            incoming->group_id, incoming->object_id) == 0) {
+            accepted[nb_accepted] = track_ctx->media_id;
+            nb_accepted++;
+        }
         else {
-            memset(notified, 0, sizeof(quicrq_notify_url_t));
-            notified->next_notify_url = stream_ctx->first_notify_url;
-            notified->url_len = url_length;
-            notified->url_len = url_length;
-            notified->url = ((uint8_t*)notified) + sizeof(quicrq_notify_url_t);
-            memcpy(notified->url, url, url_length);
-            stream_ctx->first_notify_url = notified;
-            quicrq_wakeup_media_stream(stream_ctx);
-            ret = 1;
+            char url_text[256];
+
+            quicrq_log_message(stream_ctx->cnx_ctx, "Stream %" PRIu64 ", cannot serve track %" PRIu64 ", url %s",
+                stream_ctx->stream_id, track_ctx->media_id, quicrq_uint8_t_to_text(url, url_length, url_text, 256));
+            track_ctx->close_reason = quicrq_media_close_local_application;
+            quicrq_delete_stream_ctx(stream_ctx->cnx_ctx, track_ctx);
         }
     }
-    return ret;
-}
-
-int quicrq_notify_url_to_all(quicrq_ctx_t* qr_ctx, const uint8_t* url, size_t url_length)
-{
-    int ret = 0;
-    quicrq_cnx_ctx_t* cnx_ctx = qr_ctx->first_cnx;
 
-    while (cnx_ctx != NULL && ret == 0) {
-        quicrq_stream_ctx_t* stream_ctx = cnx_ctx->first_stream;
+    if (ret == 0) {
+        quicrq_message_buffer_t* message = &stream_ctx->message_sent;
 
-        while (stream_ctx != NULL) {
-            if (stream_ctx->send_state == quicrq_notify_ready) {
-                if ((ret = quicrq_notify_url_to_stream(stream_ctx, url, url_length)) > 0) {
-                    ret = 0;
-                    break;
-                }
+        if (quicrq_msg_buffer_alloc(message, quicrq_batch_accept_msg_reserve(nb_accepted), 0) != 0) {
+            ret = -1;
+        }
+        else {
+            uint8_t* message_next = quicrq_batch_accept_msg_encode(message->buffer, message->buffer + message->buffer_alloc,
+                QUICRQ_ACTION_ACCEPT_BATCH, nb_accepted, accepted);
+            if (message_next == NULL) {
+                ret = -1;
+            }
+            else {
+                /* Queue the accept message, ahead of the track messages */
+                message->message_size = message_next - message->buffer;
+                stream_ctx->send_state = quicrq_sending_batch;
+                ret = quicrq_mark_control_stream_active(stream_ctx);
             }
-            stream_ctx = stream_ctx->next_stream;
         }
-        cnx_ctx = cnx_ctx->next_cnx;
     }
 
+    if (accepted != NULL) {
+        free(accepted);
+    }
     return ret;
 }
 
-int quicrq_process_incoming_subscribe(quicrq_stream_ctx_t* stream_ctx, size_t url_length, const uint8_t* url)
+/* Process the batch accept message. The tracks that the server did
+ * not accept are closed. */
+static void quicrq_batch_accepted(quicrq_stream_ctx_t* stream_ctx, quicrq_message_t* incoming)
 {
-    int ret = 0;
-    quicrq_ctx_t* qr_ctx = stream_ctx->cnx_ctx->qr_ctx;
-    /* Store the subscribe parameters */
-    stream_ctx->subscribe_prefix = malloc(url_length + 1);
-    if (stream_ctx->subscribe_prefix == NULL) {
-        ret = -1;
-    }
-    else {
-        stream_ctx->subscribe_prefix_length = url_length;
-        memcpy(stream_ctx->subscribe_prefix, url, url_length);
-        stream_ctx->receive_state = quicrq_receive_done;
-        stream_ctx->send_state = quicrq_notify_ready;
+    const uint8_t* bytes = incoming->track_list;
+    const uint8_t* bytes_max = stream_ctx->message_receive.buffer + stream_ctx->message_receive.message_size;
+    size_t nb_read = 0;
+    uint64_t media_id = UINT64_MAX;
+    quicrq_stream_ctx_t* track_ctx = stream_ctx->first_track;
+
+    while (track_ctx != NULL) {
+        /* Both the accepted list and the list of tracks are in increasing media id order */
+        while (nb_read < incoming->nb_tracks && (media_id == UINT64_MAX || media_id < track_ctx->media_id)) {
+            bytes = picoquic_frames_varint_decode(bytes, bytes_max, &media_id);
+            nb_read++;
+        }
+        if (media_id != track_ctx->media_id) {
+            quicrq_log_message(stream_ctx->cnx_ctx, "Stream %" PRIu64 ", track %" PRIu64 " not accepted",
+                stream_ctx->stream_id, track_ctx->media_id);
+            track_ctx->close_reason = quicrq_media_close_remote_application;
+            track_ctx->send_state = quicrq_sending_fin;
+        }
+        track_ctx = track_ctx->next_track;
     }
-    if (ret == 0) {
-        /* Check all the known media source, see whether they match */
-        quicrq_media_source_ctx_t* srce_ctx = qr_ctx->first_source;
+    stream_ctx->receive_state = quicrq_receive_batch;
+    (void)quicrq_mark_control_stream_active(stream_ctx);
+}
 
-        while (srce_ctx != NULL) {
-            if (quicrq_notify_url_to_stream(stream_ctx, srce_ctx->media_url, srce_ctx->media_url_length) < 0) {
+/* Process the start point, final point and cache policy messages of a media
+ * flow, received on its control stream or in a track message. */
+static int quicrq_receive_media_control_message(quicrq_stream_ctx_t* stream_ctx, quicrq_message_t* incoming)
+{
+    int ret = 0;
+
+    switch (incoming->message_type) {
+        case QUICRQ_ACTION_START_POINT:
+            if (stream_ctx->receive_state != quicrq_receive_fragment || stream_ctx->start_group_id != 0 || stream_ctx->start_object_id != 0) {
+                /* Protocol error */
                 ret = -1;
-                break;
             }
             else {
-                srce_ctx = srce_ctx->next_source;
+                /* Pass the start point to the media consumer. */
+                quicrq_log_message(stream_ctx->cnx_ctx,
+                    "Stream %" PRIu64 ", start point notified: %" PRIu64 "/%" PRIu64,
+                    stream_ctx->stream_id, incoming->group_id, incoming->object_id);
+                stream_ctx->start_group_id = incoming->group_id;
+                stream_ctx->start_object_id = incoming->object_id;
+                ret = stream_ctx->consumer_fn(quicrq_media_start_point, stream_ctx->media_ctx, picoquic_get_quic_time(stream_ctx->cnx_ctx->qr_ctx->quic),
+                    NULL, incoming->group_id, incoming->object_id, 0, 0, incoming->flags, 0, 0, 0);
+
+                ret = quicrq_cnx_handle_consumer_finished(stream_ctx, 0, 0, ret);
             }
-        }
-    }
+            break;
+        case QUICRQ_ACTION_FIN_DATAGRAM:
+            if (stream_ctx->receive_state != quicrq_receive_fragment ||
+                (stream_ctx->final_object_id != 0 || stream_ctx->final_object_id != 0)) {
+                /* Protocol error */
+                ret = -1;
+            }
+            else {
+                quicrq_log_message(stream_ctx->cnx_ctx,
+                    "Stream %" PRIu64 ", final point notified: %" PRIu64 "/%" PRIu64,
+                    stream_ctx->stream_id, incoming->group_id, incoming->object_id);
+                /* Pass the final offset to the media consumer. */
+                ret = stream_ctx->consumer_fn(quicrq_media_final_object_id, stream_ctx->media_ctx, picoquic_get_quic_time(stream_ctx->cnx_ctx->qr_ctx->quic), NULL,
+                    incoming->group_id, incoming->object_id, 0, 0, 0, 0, 0, 0);
+                ret = quicrq_cnx_handle_consumer_finished(stream_ctx, 1, 0, ret);
+            }
+            break;
+        case QUICRQ_ACTION_CACHE_POLICY:
+            if (stream_ctx->receive_state != quicrq_receive_fragment || stream_ctx->is_cache_real_time) {
+                /* Protocol error */
+                ret = -1;
+            }
+            else {
+                /* Pass the start point to the media consumer. */
+                quicrq_log_message(stream_ctx->cnx_ctx,
+                    "Stream %" PRIu64 ", cache policy: %d",
+                    stream_ctx->stream_id, incoming->cache_policy);
+                stream_ctx->is_cache_real_time = (incoming->cache_policy == 0) ? 0 : 1;
+                ret = stream_ctx->consumer_fn(quicrq_media_real_time_cache, stream_ctx->media_ctx, picoquic_get_quic_time(stream_ctx->cnx_ctx->qr_ctx->quic),
+                    NULL, 0, 0, 0, 0, 0, 0, 0, 0);
 
-    /* TODO: if this is a relay, perform necessary actions */
+                ret = quicrq_cnx_handle_consumer_finished(stream_ctx, 0, 0, ret);
+            }
+            break;
+        default:
+            ret = -1;
+            break;
+    }
     return ret;
 }
 
@@ -1663,79 +2900,22 @@ int quicrq_receive_stream_data(quicrq_stream_ctx_t* stream_ctx, uint8_t* bytes,
                         }
                         else {
                             char url_text[256];
-                            uint64_t intent_group = 0;
-                            uint64_t intent_object = 0;
 
                             /* Process initial request */
                             stream_ctx->media_id = incoming.media_id;
                             stream_ctx->transport_mode = incoming.transport_mode;
+                            stream_ctx->datagram_header_format = incoming.datagram_header_format;
+                            if (incoming.datagram_header_format != quicrq_datagram_header_full) {
+                                stream_ctx->cnx_ctx->peer_datagram_header_format = incoming.datagram_header_format;
+                            }
+                            stream_ctx->fragment_size = incoming.fragment_size;
+                            stream_ctx->fec_window = incoming.fec_window;
                             /* Open the media -- TODO, variants with different actions. */
                             quicrq_log_message(stream_ctx->cnx_ctx, "Stream %" PRIu64 ", received a subscribe request for url %s, mode = %s, id= %" PRIu64,
                                 stream_ctx->stream_id, quicrq_uint8_t_to_text(incoming.url, incoming.url_length, url_text, 256),
                                 quicrq_transport_mode_to_string(stream_ctx->transport_mode), incoming.media_id);
-                            ret = quicrq_subscribe_local_media(stream_ctx, incoming.url, incoming.url_length);
-                            if (ret == 0) {
-                                quicrq_wakeup_media_stream(stream_ctx);
-                            }
-                            if (ret == 0) {
-                                /* Apply the preferences based on intent */
-                                stream_ctx->is_sender = 1;
-                                switch (incoming.subscribe_intent) {
-                                case quicrq_subscribe_intent_current_group:
-                                    intent_group = stream_ctx->media_ctx->cache_ctx->next_group_id;
-                                    intent_object = 0;
-                                    break;
-                                case quicrq_subscribe_intent_next_group:
-                                    intent_group = stream_ctx->media_ctx->cache_ctx->next_group_id + 1;
-                                    intent_object = 0;
-                                    break;
-                                case quicrq_subscribe_intent_start_point:
-                                    intent_group = incoming.group_id;
-                                    intent_object = incoming.object_id;
-                                    break;
-                                default:
-                                    break;
-                                }
-                                /* Override the intent if impossible to meet */
-                                if (stream_ctx->start_group_id > 0 || stream_ctx->start_object_id > 0) {
-                                    if (intent_group < stream_ctx->next_group_id ||
-                                        (intent_group == stream_ctx->next_group_id &&
-                                            intent_object < stream_ctx->next_object_id)) {
-                                        intent_group = stream_ctx->start_group_id;
-                                        intent_object = stream_ctx->start_object_id;
-                                    }
-                                }
-                            }
-                            if (intent_group > 0 || intent_object > 0) {
-                                /* apply the intent, prepare a start point message */
-                                stream_ctx->start_group_id = intent_group;
-                                stream_ctx->start_object_id = intent_object;
-                                stream_ctx->next_group_id = intent_group;
-                                stream_ctx->next_object_id = intent_object;
-                                stream_ctx->media_ctx->current_group_id = intent_group;
-                                stream_ctx->media_ctx->current_object_id = intent_object;
-                                stream_ctx->media_ctx->current_offset = 0;
-                                ret = quicrq_prepare_start_point(stream_ctx);
-                                stream_ctx->receive_state = quicrq_receive_done;
-                                picoquic_mark_active_stream(stream_ctx->cnx_ctx->cnx, stream_ctx->stream_id, 1, stream_ctx);
-                            }
-                            else if (incoming.transport_mode == quicrq_transport_mode_single_stream) {
-                                /* Start sending stream without endpoint message */
-                                stream_ctx->send_state = quicrq_sending_single_stream;
-                                stream_ctx->receive_state = quicrq_receive_done;
-                                picoquic_mark_active_stream(stream_ctx->cnx_ctx->cnx, stream_ctx->stream_id, 1, stream_ctx);
-                            }
-                            else if (incoming.transport_mode == quicrq_transport_mode_datagram
-                                || incoming.transport_mode == quicrq_transport_mode_warp
-                                || incoming.transport_mode == quicrq_transport_mode_rush) {
-                                /* Start sending data without endpoint message */
-                                stream_ctx->send_state = quicrq_sending_ready;
-                                stream_ctx->receive_state = quicrq_receive_done;
-                            }
-                            else {
-                                /* Not supported yet */
-                                ret = -1;
-                            }
+                            ret = quicrq_process_incoming_request(stream_ctx, incoming.url, incoming.url_length,
+                                incoming.subscribe_intent, incoming.group_id, incoming.object_id);
                         }
                         break;
                     case QUICRQ_ACTION_POST:
@@ -1764,41 +2944,18 @@ int quicrq_receive_stream_data(quicrq_stream_ctx_t* stream_ctx, uint8_t* bytes,
                         /* Depending on mode, set media ready or datagram ready */
                         quicrq_log_message(stream_ctx->cnx_ctx, "Stream %" PRIu64 ", publish request accepted, mode = %s",
                             stream_ctx->stream_id, quicrq_transport_mode_to_string(incoming.transport_mode));
+                        stream_ctx->datagram_header_format = incoming.datagram_header_format;
+                        if (incoming.datagram_header_format != quicrq_datagram_header_full) {
+                            stream_ctx->cnx_ctx->peer_datagram_header_format = incoming.datagram_header_format;
+                        }
+                        stream_ctx->fragment_size = incoming.fragment_size;
+                        stream_ctx->fec_window = incoming.fec_window;
                         ret = quicrq_cnx_post_accepted(stream_ctx, incoming.transport_mode, incoming.media_id);
                         break;
                     case QUICRQ_ACTION_START_POINT:
-                        if (stream_ctx->receive_state != quicrq_receive_fragment || stream_ctx->start_group_id != 0 || stream_ctx->start_object_id != 0) {
-                            /* Protocol error */
-                            ret = -1;
-                        }
-                        else {
-                            /* Pass the start point to the media consumer. */
-                            quicrq_log_message(stream_ctx->cnx_ctx,
-                                "Stream %" PRIu64 ", start point notified: %" PRIu64 "/%" PRIu64,
-                                stream_ctx->stream_id, incoming.group_id, incoming.object_id);
-                            stream_ctx->start_group_id = incoming.group_id;
-                            stream_ctx->start_object_id = incoming.object_id;
-                            ret = stream_ctx->consumer_fn(quicrq_media_start_point, stream_ctx->media_ctx, picoquic_get_quic_time(stream_ctx->cnx_ctx->qr_ctx->quic),
-                                NULL, incoming.group_id, incoming.object_id, 0, 0, incoming.flags, 0, 0, 0);
-
-                            ret = quicrq_cnx_handle_consumer_finished(stream_ctx, 0, 0, ret);
-                        }
-                        break;
                     case QUICRQ_ACTION_FIN_DATAGRAM:
-                        if (stream_ctx->receive_state != quicrq_receive_fragment ||
-                            (stream_ctx->final_object_id != 0 || stream_ctx->final_object_id != 0)) {
-                            /* Protocol error */
-                            ret = -1;
-                        }
-                        else {
-                            quicrq_log_message(stream_ctx->cnx_ctx,
-                                "Stream %" PRIu64 ", final point notified: %" PRIu64 "/%" PRIu64,
-                                stream_ctx->stream_id, incoming.group_id, incoming.object_id);
-                            /* Pass the final offset to the media consumer. */
-                            ret = stream_ctx->consumer_fn(quicrq_media_final_object_id, stream_ctx->media_ctx, picoquic_get_quic_time(stream_ctx->cnx_ctx->qr_ctx->quic), NULL,
-                                incoming.group_id, incoming.object_id, 0, 0, 0, 0, 0, 0);
-                            ret = quicrq_cnx_handle_consumer_finished(stream_ctx, 1, 0, ret);
-                        }
+                    case QUICRQ_ACTION_CACHE_POLICY:
+                        ret = quicrq_receive_media_control_message(stream_ctx, &incoming);
                         break;
                     case QUICRQ_ACTION_FRAGMENT:
                         if (stream_ctx->receive_state != quicrq_receive_fragment) {
@@ -1812,6 +2969,8 @@ int quicrq_receive_stream_data(quicrq_stream_ctx_t* stream_ctx, uint8_t* bytes,
                                     incoming.object_id < stream_ctx->start_object_id)) {
                                 stream_ctx->cnx_ctx->qr_ctx->useless_fragments++;
                             }
+                            quicrq_media_counters_fragment_received(&stream_ctx->counters, incoming.fragment_length,
+                                incoming.fragment_offset + incoming.fragment_length >= incoming.object_length, incoming.flags);
                             /* Pass the fragment data to the media consumer. */
                             ret = stream_ctx->consumer_fn(quicrq_media_datagram_ready, stream_ctx->media_ctx, picoquic_get_quic_time(stream_ctx->cnx_ctx->qr_ctx->quic),
                                 incoming.data, incoming.group_id, incoming.object_id,
@@ -1850,23 +3009,75 @@ int quicrq_receive_stream_data(quicrq_stream_ctx_t* stream_ctx, uint8_t* bytes,
                             stream_ctx->media_notify_fn(stream_ctx->notify_ctx, incoming.url, incoming.url_length);
                         }
                         break;
-                    case QUICRQ_ACTION_CACHE_POLICY:
-                        if (stream_ctx->receive_state != quicrq_receive_fragment || stream_ctx->is_cache_real_time) {
+                    case QUICRQ_ACTION_REQUEST_BATCH:
+                        if (stream_ctx->receive_state != quicrq_receive_initial) {
+                            quicrq_log_message(stream_ctx->cnx_ctx, "Stream %" PRIu64 ", unexpected batch request in stream receive state %d",
+                                stream_ctx->stream_id, stream_ctx->receive_state);
+                            ret = -1;
+                        }
+                        else {
+                            ret = quicrq_process_incoming_batch(stream_ctx, &incoming);
+                        }
+                        break;
+                    case QUICRQ_ACTION_ACCEPT_BATCH:
+                        if (stream_ctx->receive_state != quicrq_receive_confirmation || !stream_ctx->is_batch) {
+                            /* Protocol error */
+                            ret = -1;
+                        }
+                        else {
+                            quicrq_batch_accepted(stream_ctx, &incoming);
+                        }
+                        break;
+                    case QUICRQ_ACTION_FEEDBACK:
+                        if (stream_ctx->receive_state != quicrq_receive_feedback || !stream_ctx->is_sender) {
+                            quicrq_log_message(stream_ctx->cnx_ctx, "Stream %" PRIu64 ", unexpected feedback message in stream receive state %d",
+                                stream_ctx->stream_id, stream_ctx->receive_state);
+                            ret = -1;
+                        }
+                        else {
+                            quicrq_log_message(stream_ctx->cnx_ctx, "Stream %" PRIu64 ", received feedback, max flags: 0x%x, target bitrate: %" PRIu64,
+                                stream_ctx->stream_id, incoming.flags, incoming.target_bitrate);
+                            quicrq_feedback_set(stream_ctx, incoming.flags, incoming.target_bitrate,
+                                picoquic_get_quic_time(stream_ctx->cnx_ctx->qr_ctx->quic));
+                            if (stream_ctx->media_source != NULL) {
+                                quicrq_source_feedback_update(stream_ctx->media_source);
+                            }
+                        }
+                        break;
+                    case QUICRQ_ACTION_TRACK:
+                        if (stream_ctx->receive_state != quicrq_receive_batch ||
+                            (stream_ctx->is_sender != (incoming.track_message_type == QUICRQ_ACTION_UNSUBSCRIBE_TRACK))) {
                             /* Protocol error */
                             ret = -1;
                         }
+                        else if (stream_ctx->is_sender) {
+                            /* The receiver closed a track of the batch */
+                            quicrq_stream_ctx_t* track_ctx = quicrq_find_stream_ctx_for_datagram(stream_ctx->cnx_ctx, incoming.media_id, 1);
+
+                            if (track_ctx == NULL || track_ctx->batch_ctx != stream_ctx) {
+                                quicrq_log_message(stream_ctx->cnx_ctx, "Stream %" PRIu64 ", ignore unsubscribe for track %" PRIu64,
+                                    stream_ctx->stream_id, incoming.media_id);
+                            }
+                            else {
+                                quicrq_log_message(stream_ctx->cnx_ctx, "Stream %" PRIu64 ", track %" PRIu64 " unsubscribed",
+                                    stream_ctx->stream_id, incoming.media_id);
+                                track_ctx->close_reason = quicrq_media_close_unsubscribe;
+                                quicrq_delete_stream_ctx(stream_ctx->cnx_ctx, track_ctx);
+                            }
+                        }
                         else {
-                            /* Pass the start point to the media consumer. */
-                            quicrq_log_message(stream_ctx->cnx_ctx,
-                                "Stream %" PRIu64 ", cache policy: %d",
-                                stream_ctx->stream_id, incoming.cache_policy);
-                            stream_ctx->is_cache_real_time = (incoming.cache_policy == 0) ? 0 : 1;
-                            ret = stream_ctx->consumer_fn(quicrq_media_real_time_cache, stream_ctx->media_ctx, picoquic_get_quic_time(stream_ctx->cnx_ctx->qr_ctx->quic),
-                                NULL, 0, 0, 0, 0, 0, 0, 0, 0);
+                            quicrq_stream_ctx_t* track_ctx = quicrq_find_stream_ctx_for_datagram(stream_ctx->cnx_ctx, incoming.media_id, 0);
 
-                            ret = quicrq_cnx_handle_consumer_finished(stream_ctx, 0, 0, ret);
+                            if (track_ctx == NULL || track_ctx->batch_ctx != stream_ctx || track_ctx->send_state == quicrq_sending_fin) {
+                                /* The track might already be finished */
+                                quicrq_log_message(stream_ctx->cnx_ctx, "Stream %" PRIu64 ", ignore message for track %" PRIu64,
+                                    stream_ctx->stream_id, incoming.media_id);
+                            }
+                            else {
+                                incoming.message_type = incoming.track_message_type;
+                                ret = quicrq_receive_media_control_message(track_ctx, &incoming);
+                            }
                         }
-                    break;
                         break;
                     default:
                         /* Some unknown message, maybe not implemented yet */
@@ -1903,7 +3114,9 @@ int quicrq_receive_stream_data(quicrq_stream_ctx_t* stream_ctx, uint8_t* bytes,
 quicrq_stream_ctx_t*  quicrq_get_control_stream_for_media_id(quicrq_cnx_ctx_t* cnx, uint64_t  media_id) {
     quicrq_stream_ctx_t* ctrl_stream_ctx = cnx->first_stream;
     while (ctrl_stream_ctx != NULL) {
-        if (ctrl_stream_ctx->media_id == media_id) {
+        /* Tracks of a batch have no uni streams, a warp or rush header
+         * cannot name them. */
+        if (ctrl_stream_ctx->batch_ctx == NULL && ctrl_stream_ctx->media_id == media_id) {
             return ctrl_stream_ctx;
         }
         ctrl_stream_ctx = ctrl_stream_ctx->next_stream;
@@ -1937,6 +3150,8 @@ int quicrq_receive_warp_or_rush_stream_data(quicrq_cnx_ctx_t* cnx_ctx, quicrq_un
                 uni_stream_ctx->nb_objects_previous_group,  uni_stream_ctx->current_object_length, copied);
             uni_stream_ctx->current_object_offset += copied;
             length -= copied;
+            quicrq_media_counters_fragment_received(&ctrl_stream_ctx->counters, copied,
+                uni_stream_ctx->current_object_offset >= uni_stream_ctx->current_object_length, uni_stream_ctx->current_object_flags);
             if (uni_stream_ctx->current_object_offset >= uni_stream_ctx->current_object_length) {
                 uni_stream_ctx->receive_state = quicrq_receive_object_header;
                 /* Increment predicted object ID to enable checks */
@@ -2032,6 +3247,7 @@ int quicrq_receive_warp_or_rush_stream_data(quicrq_cnx_ctx_t* cnx_ctx, quicrq_un
                                 quicrq_stream_ctx_t* ctrl_stream_ctx = uni_stream_ctx->control_stream_ctx;
 
                                 uni_stream_ctx->receive_state = quicrq_receive_object_header;
+                                quicrq_media_counters_fragment_received(&ctrl_stream_ctx->counters, 0, 1, incoming.flags);
                                 /* Pass the empty data to the media consumer. */
                                 ret = ctrl_stream_ctx->consumer_fn(quicrq_media_datagram_ready, ctrl_stream_ctx->media_ctx, picoquic_get_quic_time(ctrl_stream_ctx->cnx_ctx->qr_ctx->quic),
                                     incoming.data, uni_stream_ctx->current_group_id, incoming.object_id,
@@ -2328,37 +3544,77 @@ void quicrq_set_cache_duration(quicrq_ctx_t* qr_ctx, uint64_t cache_duration_max
     qr_ctx->cache_duration_max = cache_duration_max;
 }
 
+void quicrq_set_cache_memory_limit(quicrq_ctx_t* qr_ctx, size_t memory_limit)
+{
+    qr_ctx->cache_memory_limit = memory_limit;
+}
+
+void quicrq_set_catch_up_speed(quicrq_ctx_t* qr_ctx, uint32_t speed_percent)
+{
+    qr_ctx->catch_up_speed = (speed_percent >= QUICRQ_CATCH_UP_SPEED_MIN) ? speed_percent : 0;
+}
+
+void quicrq_get_cache_memory_stats(quicrq_ctx_t* qr_ctx, quicrq_cache_memory_stats_t* stats)
+{
+    stats->memory_limit = qr_ctx->cache_memory_limit;
+    stats->cache_bytes = qr_ctx->cache_bytes;
+    stats->evicted_bytes = qr_ctx->cache_evicted_bytes;
+    stats->spilled_bytes = qr_ctx->cache_spilled_bytes;
+    stats->spilled_groups = qr_ctx->cache_spilled_groups;
+    stats->evicted_groups = qr_ctx->cache_evicted_groups;
+}
+
 uint64_t quicrq_time_check(quicrq_ctx_t* qr_ctx, uint64_t current_time)
 {
     uint64_t next_time = UINT64_MAX;
-    uint64_t extra_repeat_time = quicrq_handle_extra_repeat(qr_ctx, current_time);
-    uint64_t quic_time = picoquic_get_next_wake_time(qr_ctx->quic, current_time);
+    uint64_t timer_time;
+    uint64_t quic_time;
 
-    if (extra_repeat_time < quic_time) {
-        quic_time = extra_repeat_time;
+    if (quicrq_atomic_load(&qr_ctx->is_publish_queue_pending) != 0) {
+        /* Publish the objects queued by other threads */
+        quicrq_publish_queues_drain(qr_ctx);
     }
-    if (quic_time < next_time) {
-        next_time = quic_time;
+    if (qr_ctx->first_shard_feed_out != NULL || qr_ctx->first_shard_feed_in != NULL ||
+        quicrq_atomic_load(&qr_ctx->is_shard_request_pending) != 0) {
+        /* Exchange the data of the mirrored sources with the other relay shards */
+        next_time = quicrq_shard_feeds_process(qr_ctx, current_time);
+    }
+    /* Wake up the streams of the sources that received data, before
+     * checking when the quic context is ready to send. */
+    quicrq_source_wakeup_flush(qr_ctx);
+    if (qr_ctx->spill_directory != NULL && qr_ctx->cache_bytes > qr_ctx->spill_hot_limit) {
+        /* Move old complete groups to the spill segments */
+        quicrq_fragment_cache_spill(qr_ctx, current_time);
+    }
+    if (qr_ctx->cache_memory_limit > 0 && qr_ctx->cache_bytes > qr_ctx->cache_memory_limit) {
+        /* Evict old groups until the caches fit in the memory budget */
+        quicrq_fragment_cache_enforce_memory_limit(qr_ctx);
     }
-
     if (qr_ctx->manage_relay_cache_fn != NULL) {
-        int should_manage = qr_ctx->is_cache_closing_needed;
-        if (qr_ctx->cache_duration_max > 0) {
-            if (current_time >= qr_ctx->cache_check_next_time) {
-                should_manage = 1;
-                qr_ctx->cache_check_next_time = current_time + qr_ctx->cache_duration_max / 2;
-            }
-            if (qr_ctx->cache_check_next_time < next_time) {
-                next_time = qr_ctx->cache_check_next_time;
+        if (qr_ctx->cache_duration_max > 0 && qr_ctx->cache_check_timer.heap_index == 0) {
+            /* Start the periodic check of the cache */
+            if (quicrq_timer_set(qr_ctx, &qr_ctx->cache_check_timer, current_time) != 0) {
+                DBG_PRINTF("%s", "Cannot set the cache check timer");
             }
         }
-        if (should_manage) {
+        if (qr_ctx->is_cache_closing_needed) {
+            /* Schedule the deletion of the caches that were just closed */
             uint64_t manage_time = qr_ctx->manage_relay_cache_fn(qr_ctx, current_time);
             if (manage_time < next_time) {
                 next_time = manage_time;
             }
         }
     }
+    /* Only the deadlines that are due are processed */
+    timer_time = quicrq_handle_timers(qr_ctx, current_time);
+    quic_time = picoquic_get_next_wake_time(qr_ctx->quic, current_time);
+
+    if (timer_time < quic_time) {
+        quic_time = timer_time;
+    }
+    if (quic_time < next_time) {
+        next_time = quic_time;
+    }
 
     return next_time;
 }
@@ -2379,6 +3635,14 @@ void quicrq_delete(quicrq_ctx_t* qr_ctx)
     struct st_quicrq_media_object_source_ctx_t* object_source_ctx = qr_ctx->first_object_source;
     struct st_quicrq_media_object_source_ctx_t* object_source_next = NULL;
 
+    /* Detach from the other relay shards */
+    quicrq_shard_feeds_release(qr_ctx);
+    if (qr_ctx->shard_peers != NULL) {
+        free(qr_ctx->shard_peers);
+        qr_ctx->shard_peers = NULL;
+        qr_ctx->nb_shard_peers = 0;
+    }
+
     while (cnx_ctx != NULL) {
         next = cnx_ctx->next_cnx;
         quicrq_delete_cnx_context(cnx_ctx, quicrq_media_close_delete_context, 0);
@@ -2401,12 +3665,18 @@ void quicrq_delete(quicrq_ctx_t* qr_ctx)
         srce_ctx = srce_next;
     }
 
+    quicrq_source_index_release(qr_ctx);
+
     if (qr_ctx->quic != NULL) {
         picoquic_free(qr_ctx->quic);
     }
 
     quicrq_disable_relay(qr_ctx);
 
+    (void)quicrq_set_cache_spill(qr_ctx, NULL, 0, 0);
+    quicrq_timers_release(qr_ctx);
+    quicrq_pools_release(qr_ctx);
+
     free(qr_ctx);
 }
 
@@ -2419,6 +3689,11 @@ quicrq_ctx_t* quicrq_create_empty()
 
     if (qr_ctx != NULL) {
         memset(qr_ctx, 0, sizeof(quicrq_ctx_t));
+        quicrq_source_index_init(qr_ctx);
+        quicrq_pools_init(qr_ctx);
+        quicrq_mpsc_queue_init(&qr_ctx->shard_requests);
+        quicrq_timer_init(&qr_ctx->cache_check_timer, quicrq_timer_cache_check);
+        quicrq_timer_init(&qr_ctx->relay_warm_timer, quicrq_timer_relay_warm);
     }
     return qr_ctx;
 }
@@ -2428,17 +3703,28 @@ void quicrq_set_quic(quicrq_ctx_t* qr_ctx, picoquic_quic_t* quic)
     qr_ctx->quic = quic;
 }
 
-quicrq_ctx_t* quicrq_create(char const* alpn,
+/* Create a QUICRQ context and its quic context.
+ * The connections are kept in a double linked list, and the periodic work
+ * is driven by the timer heap, the pending source wakeups and the subscribe
+ * trie, so the number of connections is only limited by max_nb_connections.
+ * If max_nb_connections is zero, the default QUICRQ_MAX_CONNECTIONS is used.
+ */
+quicrq_ctx_t* quicrq_create_ex(char const* alpn,
     char const* cert_file_name, char const* key_file_name, char const* cert_root_file_name,
     char const* ticket_store_file_name, char const* token_store_file_name,
     const uint8_t* ticket_encryption_key, size_t ticket_encryption_key_length,
-    uint64_t* p_simulated_time)
+    uint64_t* p_simulated_time, uint32_t max_nb_connections)
 {
     quicrq_ctx_t* qr_ctx = quicrq_create_empty();
     uint64_t current_time = (p_simulated_time == NULL) ? picoquic_current_time() : *p_simulated_time;
 
+    if (max_nb_connections == 0) {
+        max_nb_connections = QUICRQ_MAX_CONNECTIONS;
+    }
+
     if (qr_ctx != NULL) {
-        qr_ctx->quic = picoquic_create(QUICRQ_MAX_CONNECTIONS, cert_file_name, key_file_name, cert_root_file_name, alpn,
+        qr_ctx->max_nb_connections = max_nb_connections;
+        qr_ctx->quic = picoquic_create(max_nb_connections, cert_file_name, key_file_name, cert_root_file_name, alpn,
             quicrq_callback, qr_ctx, NULL, NULL, NULL, current_time, p_simulated_time,
             ticket_store_file_name, ticket_encryption_key, ticket_encryption_key_length);
 
@@ -2456,9 +3742,31 @@ quicrq_ctx_t* quicrq_create(char const* alpn,
     return qr_ctx;
 }
 
+quicrq_ctx_t* quicrq_create(char const* alpn,
+    char const* cert_file_name, char const* key_file_name, char const* cert_root_file_name,
+    char const* ticket_store_file_name, char const* token_store_file_name,
+    const uint8_t* ticket_encryption_key, size_t ticket_encryption_key_length,
+    uint64_t* p_simulated_time)
+{
+    return quicrq_create_ex(alpn, cert_file_name, key_file_name, cert_root_file_name,
+        ticket_store_file_name, token_store_file_name, ticket_encryption_key, ticket_encryption_key_length,
+        p_simulated_time, 0);
+}
+
+size_t quicrq_get_nb_connections(quicrq_ctx_t* qr_ctx)
+{
+    return qr_ctx->nb_connections;
+}
+
 /* Delete a connection context */
 void quicrq_delete_cnx_context(quicrq_cnx_ctx_t* cnx_ctx, quicrq_media_close_reason_enum close_reason, uint64_t close_error_code)
 {
+    /* Let the relay forget the connection before the streams are closed,
+     * so that subscriptions can move to another upstream. */
+    if (cnx_ctx->qr_ctx != NULL && cnx_ctx->qr_ctx->manage_relay_cnx_close_fn != NULL) {
+        cnx_ctx->qr_ctx->manage_relay_cnx_close_fn(cnx_ctx->qr_ctx, cnx_ctx, close_reason);
+    }
+
     /* Delete the stream contexts */
     while (cnx_ctx->first_stream != NULL) {
         if (cnx_ctx->first_stream->close_reason == quicrq_media_close_reason_unknown) {
@@ -2473,6 +3781,9 @@ void quicrq_delete_cnx_context(quicrq_cnx_ctx_t* cnx_ctx, quicrq_media_close_rea
         quicrq_delete_uni_stream_ctx(cnx_ctx, cnx_ctx->first_uni_stream);
     }
 
+    quicrq_media_id_table_release(cnx_ctx);
+    quicrq_media_counters_release(&cnx_ctx->closed_counters);
+
     /* Delete the quic connection */
     if (cnx_ctx->cnx != NULL) {
         picoquic_set_callback(cnx_ctx->cnx, NULL, NULL);
@@ -2493,6 +3804,7 @@ void quicrq_delete_cnx_context(quicrq_cnx_ctx_t* cnx_ctx, quicrq_media_close_rea
         else {
             cnx_ctx->previous_cnx->next_cnx = cnx_ctx->next_cnx;
         }
+        cnx_ctx->qr_ctx->nb_connections--;
     }
     /* Free the context */
     free(cnx_ctx);
@@ -2517,6 +3829,7 @@ quicrq_cnx_ctx_t* quicrq_create_cnx_context(quicrq_ctx_t* qr_ctx, picoquic_cnx_t
         }
         cnx_ctx->previous_cnx = qr_ctx->last_cnx;
         qr_ctx->last_cnx = cnx_ctx;
+        qr_ctx->nb_connections++;
         cnx_ctx->qr_ctx = qr_ctx;
         picoquic_set_callback(cnx, quicrq_callback, cnx_ctx);
     }
@@ -2546,10 +3859,12 @@ quicrq_cnx_ctx_t* quicrq_create_client_cnx(quicrq_ctx_t* qr_ctx,
         }
         if (cnx != NULL) {
             cnx_ctx = quicrq_create_cnx_context(qr_ctx, cnx);
-            cnx_ctx->is_client = 1;
             if (cnx_ctx == NULL) {
                 picoquic_delete_cnx(cnx);
             }
+            else {
+                cnx_ctx->is_client = 1;
+            }
         }
     }
     return cnx_ctx;
@@ -2620,26 +3935,85 @@ void quicrq_delete_uni_stream_ctx(quicrq_cnx_ctx_t* cnx_ctx, quicrq_uni_stream_c
     }
     /* Release memory*/
     quicrq_msg_buffer_release(&uni_stream_ctx->message_buffer);
-    free(uni_stream_ctx);
+    quicrq_pool_free(cnx_ctx->qr_ctx, quicrq_pool_uni_stream, uni_stream_ctx);
 }
 
-void quicrq_delete_stream_ctx(quicrq_cnx_ctx_t* cnx_ctx, quicrq_stream_ctx_t* stream_ctx)
+/* Queue the unsubscribe message of a track on the control stream of the batch. */
+static int quicrq_batch_unsubscribe_track(quicrq_stream_ctx_t* batch_ctx, uint64_t media_id)
 {
-    quicrq_datagram_ack_ctx_release(stream_ctx);
+    int ret = 0;
+    uint64_t* new_id = (uint64_t*)realloc(batch_ctx->unsubscribed_track_id, (batch_ctx->nb_unsubscribed_tracks + 1) * sizeof(uint64_t));
 
-    while (stream_ctx->first_notify_url != NULL) {
-        quicrq_notify_url_t* next = stream_ctx->first_notify_url->next_notify_url;
-        free(stream_ctx->first_notify_url);
-        stream_ctx->first_notify_url = next;
+    if (new_id == NULL) {
+        ret = -1;
     }
+    else {
+        new_id[batch_ctx->nb_unsubscribed_tracks] = media_id;
+        batch_ctx->unsubscribed_track_id = new_id;
+        batch_ctx->nb_unsubscribed_tracks++;
+    }
+    return ret;
+}
 
-    if (stream_ctx->subscribe_prefix != NULL) {
-        free(stream_ctx->subscribe_prefix);
-        stream_ctx->subscribe_prefix = NULL;
+void quicrq_delete_stream_ctx(quicrq_cnx_ctx_t* cnx_ctx, quicrq_stream_ctx_t* stream_ctx)
+{
+    quicrq_stream_ctx_t* batch_ctx = stream_ctx->batch_ctx;
+
+    if (batch_ctx == NULL) {
+        /* Delete the tracks of a batch with its control stream */
+        while (stream_ctx->first_track != NULL) {
+            if (stream_ctx->first_track->close_reason == quicrq_media_close_reason_unknown) {
+                stream_ctx->first_track->close_reason = stream_ctx->close_reason;
+                stream_ctx->first_track->close_error_code = stream_ctx->close_error_code;
+            }
+            quicrq_delete_stream_ctx(cnx_ctx, stream_ctx->first_track);
+        }
+    }
+    else {
+        /* If the receiver closes a track before the end, the sender is asked to close it too.
+         * Then, unlink the track from its batch, close the batch after the last track */
+        if (!stream_ctx->is_sender && !stream_ctx->is_receive_complete &&
+            stream_ctx->close_reason != quicrq_media_close_remote_application) {
+            (void)quicrq_batch_unsubscribe_track(batch_ctx, stream_ctx->media_id);
+        }
+        if (batch_ctx->first_track == stream_ctx) {
+            batch_ctx->first_track = stream_ctx->next_track;
+        }
+        else {
+            quicrq_stream_ctx_t* previous_track = batch_ctx->first_track;
+            while (previous_track != NULL && previous_track->next_track != stream_ctx) {
+                previous_track = previous_track->next_track;
+            }
+            if (previous_track != NULL) {
+                previous_track->next_track = stream_ctx->next_track;
+            }
+        }
+        if (batch_ctx->first_track == NULL || batch_ctx->nb_unsubscribed_tracks > 0) {
+            (void)quicrq_mark_control_stream_active(batch_ctx);
+        }
     }
-    /* Delete the uni streams controlled by this context */
-    while (stream_ctx->first_uni_stream != NULL) {
-        quicrq_delete_uni_stream_ctx(stream_ctx->cnx_ctx, stream_ctx->first_uni_stream);
+    quicrq_datagram_ack_ctx_release(stream_ctx);
+    quicrq_timer_cancel(cnx_ctx->qr_ctx, &stream_ctx->extra_repeat_timer);
+    quicrq_datagram_scheduler_remove(cnx_ctx, stream_ctx);
+    quicrq_media_id_table_remove(cnx_ctx, stream_ctx);
+
+    /* The tracks of a batch do not have the control stream state */
+    if (batch_ctx == NULL) {
+        while (stream_ctx->first_notify_url != NULL) {
+            quicrq_notify_url_t* next = stream_ctx->first_notify_url->next_notify_url;
+            free(stream_ctx->first_notify_url);
+            stream_ctx->first_notify_url = next;
+        }
+
+        quicrq_subscribe_trie_remove(stream_ctx);
+        if (stream_ctx->subscribe_prefix != NULL) {
+            free(stream_ctx->subscribe_prefix);
+            stream_ctx->subscribe_prefix = NULL;
+        }
+        /* Delete the uni streams controlled by this context */
+        while (stream_ctx->first_uni_stream != NULL) {
+            quicrq_delete_uni_stream_ctx(stream_ctx->cnx_ctx, stream_ctx->first_uni_stream);
+        }
     }
 
     /* Remove stream context from connection context */
@@ -2658,7 +4032,7 @@ void quicrq_delete_stream_ctx(quicrq_cnx_ctx_t* cnx_ctx, quicrq_stream_ctx_t* st
 
     quicrq_unsubscribe_local_media(stream_ctx);
 
-    if (cnx_ctx->cnx != NULL) {
+    if (cnx_ctx->cnx != NULL && batch_ctx == NULL) {
         (void)picoquic_mark_active_stream(cnx_ctx->cnx, stream_ctx->stream_id, 0, NULL);
         (void)picoquic_add_to_stream(cnx_ctx->cnx, stream_ctx->stream_id, NULL, 0, 1);
     }
@@ -2674,8 +4048,22 @@ void quicrq_delete_stream_ctx(quicrq_cnx_ctx_t* cnx_ctx, quicrq_stream_ctx_t* st
         }
     }
 
-    quicrq_msg_buffer_release(&stream_ctx->message_receive);
-    quicrq_msg_buffer_release(&stream_ctx->message_sent);
+    if (batch_ctx == NULL) {
+        quicrq_msg_buffer_release(&stream_ctx->message_receive);
+        quicrq_msg_buffer_release(&stream_ctx->message_sent);
+        if (stream_ctx->unsubscribed_track_id != NULL) {
+            free(stream_ctx->unsubscribed_track_id);
+        }
+    }
+    if (stream_ctx->fec_encoder != NULL) {
+        free(stream_ctx->fec_encoder);
+    }
+    if (stream_ctx->fec_decoder != NULL) {
+        free(stream_ctx->fec_decoder);
+    }
+    /* Keep the counters of the stream in the connection statistics */
+    (void)quicrq_media_counters_add(&cnx_ctx->closed_counters, &stream_ctx->counters);
+    quicrq_media_counters_release(&stream_ctx->counters);
 
     free(stream_ctx);
 }
@@ -2687,6 +4075,7 @@ quicrq_stream_ctx_t* quicrq_create_stream_context(quicrq_cnx_ctx_t* cnx_ctx, uin
         memset(stream_ctx, 0, sizeof(quicrq_stream_ctx_t));
         stream_ctx->cnx_ctx = cnx_ctx;
         stream_ctx->stream_id = stream_id;
+        quicrq_timer_init(&stream_ctx->extra_repeat_timer, quicrq_timer_extra_repeat);
         if (cnx_ctx->last_stream == NULL) {
             cnx_ctx->first_stream = stream_ctx;
         }
@@ -2701,6 +4090,71 @@ quicrq_stream_ctx_t* quicrq_create_stream_context(quicrq_cnx_ctx_t* cnx_ctx, uin
     return stream_ctx;
 }
 
+/* The tracks of a batch do not have a QUIC stream of their own. Their
+ * messages are sent on the control stream of the batch, so waking up a
+ * track wakes up the batch stream. */
+int quicrq_mark_control_stream_active(quicrq_stream_ctx_t* stream_ctx)
+{
+    int ret = 0;
+    quicrq_stream_ctx_t* control_ctx = (stream_ctx->batch_ctx == NULL) ? stream_ctx : stream_ctx->batch_ctx;
+
+    if (control_ctx->cnx_ctx->cnx != NULL) {
+        ret = picoquic_mark_active_stream(control_ctx->cnx_ctx->cnx, control_ctx->stream_id, 1, control_ctx);
+    }
+    return ret;
+}
+
+/* Set the feedback of the receiver of a media, and queue the feedback message
+ * on the control stream. The tracks of a batch are not supported, because the
+ * feedback is carried on the control stream of a single media.
+ */
+int quicrq_stream_set_feedback(quicrq_stream_ctx_t* stream_ctx, uint8_t max_flags, uint64_t target_bitrate)
+{
+    int ret = 0;
+
+    if (stream_ctx->is_sender || stream_ctx->is_batch || stream_ctx->batch_ctx != NULL ||
+        stream_ctx->send_state == quicrq_sending_fin || stream_ctx->send_state == quicrq_sending_no_more) {
+        ret = -1;
+    }
+    else if (stream_ctx->feedback.max_flags != max_flags || stream_ctx->feedback.target_bitrate != target_bitrate ||
+        !stream_ctx->is_feedback_set) {
+        stream_ctx->feedback.max_flags = max_flags;
+        stream_ctx->feedback.target_bitrate = target_bitrate;
+        stream_ctx->is_feedback_set = 1;
+        stream_ctx->is_feedback_pending = 1;
+        ret = quicrq_mark_control_stream_active(stream_ctx);
+    }
+    return ret;
+}
+
+/* The tracks of a batch share the stream id of the batch, whose context
+ * holds the control stream state. */
+quicrq_stream_ctx_t* quicrq_create_track_context(quicrq_stream_ctx_t* batch_ctx, uint64_t media_id)
+{
+    quicrq_stream_ctx_t* track_ctx = quicrq_create_stream_context(batch_ctx->cnx_ctx, batch_ctx->stream_id);
+
+    if (track_ctx != NULL) {
+        quicrq_stream_ctx_t* last_track = batch_ctx->first_track;
+
+        track_ctx->batch_ctx = batch_ctx;
+        track_ctx->media_id = media_id;
+        track_ctx->transport_mode = quicrq_transport_mode_datagram;
+        track_ctx->datagram_header_format = batch_ctx->datagram_header_format;
+        track_ctx->is_sender = batch_ctx->is_sender;
+        /* Keep the tracks in increasing media id order */
+        if (last_track == NULL) {
+            batch_ctx->first_track = track_ctx;
+        }
+        else {
+            while (last_track->next_track != NULL) {
+                last_track = last_track->next_track;
+            }
+            last_track->next_track = track_ctx;
+        }
+    }
+    return track_ctx;
+}
+
 void quicrq_chain_uni_stream_to_control_stream(quicrq_uni_stream_ctx_t* uni_stream_ctx, quicrq_stream_ctx_t* stream_ctx)
 {
     uni_stream_ctx->control_stream_ctx = stream_ctx;
@@ -2717,7 +4171,8 @@ void quicrq_chain_uni_stream_to_control_stream(quicrq_uni_stream_ctx_t* uni_stre
 quicrq_uni_stream_ctx_t* quicrq_create_uni_stream_context(
     quicrq_cnx_ctx_t* cnx_ctx, quicrq_stream_ctx_t * stream_ctx, uint64_t stream_id)
 {
-    quicrq_uni_stream_ctx_t* uni_stream_ctx = (quicrq_uni_stream_ctx_t*)malloc(sizeof(quicrq_uni_stream_ctx_t));
+    quicrq_uni_stream_ctx_t* uni_stream_ctx = (quicrq_uni_stream_ctx_t*)quicrq_pool_alloc(cnx_ctx->qr_ctx,
+        quicrq_pool_uni_stream, sizeof(quicrq_uni_stream_ctx_t));
     if (uni_stream_ctx != NULL) {
         /* Chain to connection */
         memset(uni_stream_ctx, 0, sizeof(quicrq_uni_stream_ctx_t));
@@ -2746,7 +4201,7 @@ quicrq_stream_ctx_t* quicrq_find_or_create_stream(
     quicrq_stream_ctx_t* stream_ctx = cnx_ctx->first_stream;
 
     while (stream_ctx != NULL) {
-        if (stream_ctx->stream_id == stream_id) {
+        if (stream_ctx->stream_id == stream_id && stream_ctx->batch_ctx == NULL) {
             break;
         }
         stream_ctx = stream_ctx->next_stream;
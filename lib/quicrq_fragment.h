@@ -15,8 +15,51 @@
 extern "C" {
 #endif
 
+/* Group index.
+ * Each group present in the cache has an entry in the group tree, ordered
+ * by group_id. The entry documents the start object of the group, i.e., the
+ * object 0 that can be decoded without the previous groups, the number of
+ * objects in the group once known, and the first fragment of the group in
+ * arrival order. Subscribers joining the media use the index to seek the
+ * newest group start without walking the fragments.
+ */
+typedef struct st_quicrq_cached_group_t {
+    picosplay_node_t group_node;
+    uint64_t group_id;
+    uint64_t nb_objects; /* Number of objects in the group, 0 until known */
+    uint64_t nb_objects_complete; /* Objects of the group completely received */
+    size_t nb_cached_objects; /* Objects of the group in the object tree */
+    struct st_quicrq_cached_object_t* start_object; /* Object 0 of the group, or NULL */
+    struct st_quicrq_cached_fragment_t* first_fragment; /* First fragment in arrival order, or NULL if unknown */
+    int is_complete;
+    int is_spilled; /* Data moved to a spill segment, see quicrq_fragment_cache_spill */
+} quicrq_cached_group_t;
+
+/* Object index.
+ * Each object present in the cache has an entry in the object tree, ordered
+ * by group_id/object_id. The entry documents the object properties, the
+ * fragment at offset 0 if it was received, and the length of the contiguous
+ * run of data received from offset 0.
+ */
+typedef struct st_quicrq_cached_object_t {
+    picosplay_node_t object_node;
+    uint64_t group_id;
+    uint64_t object_id;
+    uint64_t nb_objects_previous_group;
+    uint64_t object_length;
+    uint8_t flags;
+    struct st_quicrq_cached_fragment_t* first_fragment; /* Fragment at offset 0, or NULL */
+    uint64_t contiguous_length; /* Bytes received in sequence from offset 0 */
+    size_t nb_fragments;
+    int is_complete;
+    uint64_t first_cache_time; /* Arrival of the first fragment received, see quicrq_hop_latency_t */
+    uint64_t bytes_received; /* Data bytes received, in any order */
+    quicrq_cached_group_t* group;
+} quicrq_cached_object_t;
+
 typedef struct st_quicrq_cached_fragment_t {
     picosplay_node_t fragment_node;
+    quicrq_cached_object_t* object;
     uint64_t group_id;
     uint64_t object_id;
     uint64_t offset;
@@ -25,10 +68,16 @@ typedef struct st_quicrq_cached_fragment_t {
     uint64_t nb_objects_previous_group;
     uint8_t flags;
     uint64_t object_length;
+    int is_spilled; /* The data is in a spill segment, and not counted in cache_bytes */
+    size_t spill_offset; /* Offset of the data in the spill segment, if spilled */
     struct st_quicrq_cached_fragment_t* previous_in_order;
     struct st_quicrq_cached_fragment_t* next_in_order;
+    /* Object state at arrival, shared by the publishers on the arrival cursor */
+    int is_object_start; /* First fragment of the object in arrival order */
+    uint64_t object_bytes_before; /* Bytes of the object received before this fragment */
     size_t data_length;
-    uint8_t* data;
+    quicrq_fragment_buffer_t* buffer; /* Shared, reference counted copy of the data */
+    uint8_t* data; /* Points to the data in the buffer */
 } quicrq_cached_fragment_t;
 
 typedef struct st_quicrq_fragment_cache_t {
@@ -48,9 +97,22 @@ typedef struct st_quicrq_fragment_cache_t {
     quicrq_cached_fragment_t* first_fragment; /* Fragments in order of arrival */
     quicrq_cached_fragment_t* last_fragment;
     picosplay_tree_t fragment_tree; /* Splay ordered by group_id/object_id/offset */
+    picosplay_tree_t object_tree; /* Splay of objects ordered by group_id/object_id */
+    picosplay_tree_t group_tree; /* Splay of groups ordered by group_id */
+    uint64_t nb_fragments_deleted; /* Invalidates the fragment cursors */
     uint8_t lowest_flags;
     int is_feed_closed; /* Whether the data providing connection is closed. */
     uint64_t cache_delete_time;
+    size_t cache_bytes; /* Data bytes held in the fragments of this cache */
+    size_t spilled_bytes; /* Data bytes of this cache held in spill segments */
+    uint64_t next_spill_group_id; /* Groups below this one are spilled or evicted */
+    uint64_t evicted_bytes; /* Data bytes removed to meet the cache memory limit */
+    uint64_t last_read_time; /* Last time a publisher read from the cache, or 0 */
+    struct st_quicrq_shard_feed_t* first_shard_feed; /* Feeds copying this cache to shard contexts */
+    struct st_quicrq_shard_feed_t* shard_feed_in; /* Feed filling this cache, if mirror of another context */
+    quicrq_hop_latency_t latency; /* Latency added at this node, for this source */
+    uint64_t nb_arrival_cursors; /* Datagram publishers attached to the arrival cursor */
+    uint64_t nb_arrival_cursor_exits; /* Times a publisher left the arrival cursor, for statistics */
 } quicrq_fragment_cache_t;
 
 typedef struct st_quicrq_fragment_publisher_object_state_t {
@@ -67,6 +129,7 @@ typedef struct st_quicrq_fragment_publisher_object_state_t {
 typedef struct st_quicrq_fragment_publisher_context_t {
     quicrq_stream_ctx_t* stream_ctx;
     quicrq_fragment_cache_t* cache_ctx;
+    quicrq_ctx_t* qr_ctx; /* Pools for the publisher object states, or NULL */
     uint64_t current_group_id;
     uint64_t current_object_id;
     size_t current_offset;
@@ -78,10 +141,28 @@ typedef struct st_quicrq_fragment_publisher_context_t {
     int is_start_point_sent;
     int is_current_object_skipped;
     int has_backlog;
+    /* Fragment being sent, and bytes of it already sent.
+     * In stream mode, the next fragment is set when the current one is sent,
+     * and only used if no fragment was deleted from the cache since then. */
     quicrq_cached_fragment_t* current_fragment;
     uint64_t length_sent;
+    uint64_t nb_fragments_deleted;
     int is_current_fragment_sent;
     picosplay_tree_t publisher_object_tree;
+    /* Arrival cursor, see quicrq_set_arrival_cursor. While the publisher is attached,
+     * no object is dropped and the publisher object tree stays empty: the object
+     * states are those documented in the cached fragments, and the publisher only
+     * keeps its position in the arrival order. */
+    int is_arrival_cursor_allowed; /* The option was set when the subscription was created */
+    int is_arrival_cursor;
+    uint64_t cursor_floor_group_id; /* Objects before this one were handled before joining */
+    uint64_t cursor_floor_object_id;
+    /* Catch up pacing, see quicrq_fragment_publisher_catch_up_hold */
+    int is_catch_up_checked;
+    int is_catching_up;
+    uint64_t catch_up_start_time; /* Local time at which the first object was presented */
+    uint64_t catch_up_origin_time; /* Arrival time in cache of that first object */
+    quicrq_timer_t catch_up_timer;
 } quicrq_fragment_publisher_context_t;
 
 void* quicrq_fragment_cache_node_value(picosplay_node_t* fragment_node);
@@ -89,6 +170,25 @@ void* quicrq_fragment_cache_node_value(picosplay_node_t* fragment_node);
 quicrq_cached_fragment_t* quicrq_fragment_cache_get_fragment(quicrq_fragment_cache_t* cached_ctx,
     uint64_t group_id, uint64_t object_id, uint64_t offset);
 
+quicrq_cached_object_t* quicrq_fragment_cache_get_object(quicrq_fragment_cache_t* cache_ctx,
+    uint64_t group_id, uint64_t object_id);
+
+quicrq_cached_group_t* quicrq_fragment_cache_get_group(quicrq_fragment_cache_t* cache_ctx, uint64_t group_id);
+
+/* Join point of a new subscriber.
+ * The live edge is the newest group whose start object is completely received,
+ * or the group in progress if that is more recent. When is_complete_group_required
+ * is set, the join point is the newest group whose objects are all received,
+ * so it can be played at once, or the live edge if there is no such group.
+ */
+uint64_t quicrq_fragment_cache_join_group_id(quicrq_fragment_cache_t* cache_ctx, int is_complete_group_required);
+
+/* First fragment in arrival order that may belong to a group at or after
+ * start_group_id, or NULL if no such group is in the cache yet. Falls back
+ * to the first fragment of the cache if the index cannot tell.
+ */
+quicrq_cached_fragment_t* quicrq_fragment_cache_seek_arrival(quicrq_fragment_cache_t* cache_ctx, uint64_t start_group_id);
+
 void quicrq_fragment_cache_media_clear(quicrq_fragment_cache_t* cached_media);
 
 void quicrq_fragment_cache_media_init(quicrq_fragment_cache_t* cached_media);
@@ -123,6 +223,36 @@ int quicrq_fragment_propose_to_cache(quicrq_fragment_cache_t* cached_ctx,
     size_t data_length,
     uint64_t current_time);
 
+/* Variants of add and propose that keep a reference to a shared buffer
+ * instead of copying the data, which must point into that buffer.
+ * When shared_buffer is NULL, the data is copied.
+ */
+int quicrq_fragment_add_buffer_to_cache(quicrq_fragment_cache_t* cached_ctx,
+    quicrq_fragment_buffer_t* shared_buffer,
+    const uint8_t* data,
+    uint64_t group_id,
+    uint64_t object_id,
+    uint64_t offset,
+    uint64_t queue_delay,
+    uint8_t flags,
+    uint64_t nb_objects_previous_group,
+    uint64_t object_length,
+    size_t data_length,
+    uint64_t current_time);
+
+int quicrq_fragment_propose_buffer_to_cache(quicrq_fragment_cache_t* cached_ctx,
+    quicrq_fragment_buffer_t* shared_buffer,
+    const uint8_t* data,
+    uint64_t group_id,
+    uint64_t object_id,
+    uint64_t offset,
+    uint64_t queue_delay,
+    uint8_t flags,
+    uint64_t nb_objects_previous_group,
+    uint64_t object_length,
+    size_t data_length,
+    uint64_t current_time);
+
 int quicrq_fragment_cache_learn_start_point(quicrq_fragment_cache_t* cached_ctx,
     uint64_t start_group_id, uint64_t start_object_id);
 
@@ -160,8 +290,49 @@ void quicrq_fragment_cache_media_purge(
     uint64_t cache_duration_max,
     uint64_t first_object_id_kept);
 
+/* Eviction of cached groups to meet the cache memory limit.
+ * When the fragment data held by all caches exceeds the limit set by
+ * `quicrq_set_cache_memory_limit`, whole groups are removed, starting with
+ * the oldest group of the least recently read cache. The groups at or after
+ * the lowest group still read by a subscribed stream are kept, as well as
+ * the groups that are not yet completely received.
+ */
+uint64_t quicrq_fragment_cache_lowest_read_group(quicrq_media_source_ctx_t* srce_ctx);
+size_t quicrq_fragment_cache_evict_group(quicrq_fragment_cache_t* cache_ctx, uint64_t kept_group_id);
+void quicrq_fragment_cache_enforce_memory_limit(quicrq_ctx_t* qr_ctx);
+
+/* Spill of complete groups to memory mapped segment files.
+ * A segment is a file of fixed size, mapped in memory, to which the data of
+ * spilled fragments is appended. The file is unlinked as soon as created, so
+ * it disappears when the segment is closed. Each spilled fragment holds an
+ * external buffer pointing to its data in the mapping, and the offset of the
+ * data in the segment; the fragment tree is thus the index of the segments.
+ * The segment counts one reference per external buffer, plus one as long as
+ * it is the segment to which data is appended, and is closed when the last
+ * reference is released.
+ */
+typedef struct st_quicrq_spill_segment_t {
+#ifdef _WINDOWS
+    HANDLE file_handle;
+    HANDLE mapping_handle;
+#else
+    int fd;
+#endif
+    uint8_t* map;
+    size_t segment_size;
+    size_t file_length; /* Bytes appended so far */
+    uint64_t ref_count;
+} quicrq_spill_segment_t;
+
+int quicrq_fragment_cache_spill_group(quicrq_ctx_t* qr_ctx, quicrq_fragment_cache_t* cache_ctx, quicrq_cached_group_t* group);
+void quicrq_fragment_cache_spill(quicrq_ctx_t* qr_ctx, uint64_t current_time);
+void quicrq_spill_release(quicrq_ctx_t* qr_ctx);
+
 void quicrq_fragment_cache_delete_ctx(quicrq_fragment_cache_t* cache_ctx);
 
+/* Record a delay in the latency histograms of the cache and of the context */
+void quicrq_hop_latency_record(quicrq_fragment_cache_t* cache_ctx, quicrq_hop_latency_enum hop_latency, uint64_t delay);
+
 quicrq_fragment_cache_t* quicrq_fragment_cache_create_ctx(quicrq_ctx_t* qr_ctx);
 
 /* Fragment publisher
@@ -189,6 +360,22 @@ quicrq_fragment_publisher_object_state_t* quicrq_fragment_publisher_object_get(q
 
 void quicrq_fragment_publisher_close(quicrq_fragment_publisher_context_t* media_ctx);
 
+/* Catch up pacing.
+ * A subscriber joining an existing media first receives the objects already
+ * in cache. If `quicrq_set_catch_up_speed` was set, these objects are not sent
+ * at once but paced at a multiple of the rate at which they arrived: object N
+ * is released at
+ *     catch_up_start_time + (first_cache_time(N) - catch_up_origin_time) * 100 / speed
+ * The pacing stops when an object is released no earlier than it arrived in the
+ * cache, i.e., when the subscriber reached the live edge. The objects are then
+ * forwarded as they arrive.
+ * Returns 1 if the object shall be held, in which case the catch up timer is
+ * set to wake up the stream at the release time, 0 if it can be sent.
+ */
+int quicrq_fragment_publisher_catch_up_hold(quicrq_fragment_publisher_context_t* media_ctx,
+    quicrq_cached_object_t* object, uint64_t current_time);
+void quicrq_fragment_publisher_catch_up_wakeup(quicrq_fragment_publisher_context_t* media_ctx);
+
 int quicrq_fragment_publisher_fn(
     quicrq_media_source_action_enum action,
     void* v_media_ctx,
@@ -230,8 +417,9 @@ int quicrq_fragment_datagram_publisher_object_prune(
  * - Keep track of the bytes needed:
  *   - zero if object is skipped
  *   - final offset if object is sent.
- * - Mark "sent" if all bytes sent.
+ * - Mark "sent" if all bytes sent, or if the object is skipped.
  * - if sent, check whether to prune the tree
+ * With the arrival cursor, there is no object state to update.
  */
 int quicrq_fragment_datagram_publisher_object_update(
     quicrq_fragment_publisher_context_t* media_ctx,
@@ -239,7 +427,9 @@ int quicrq_fragment_datagram_publisher_object_update(
     uint64_t next_offset,
     size_t copied);
 
-/* Send the next fragment, or a placeholder if the object shall be skipped. 
+/* Send the next fragment, or a placeholder if the object shall be skipped.
+ * If "coalescing" is not NULL, the fragment is appended to the coalesced
+ * datagram instead of being written in the picoquic datagram buffer.
  */
 int quicrq_fragment_datagram_publisher_send_fragment(
     quicrq_stream_ctx_t* stream_ctx,
@@ -247,6 +437,7 @@ int quicrq_fragment_datagram_publisher_send_fragment(
     uint64_t datagram_stream_id,
     void* context,
     size_t space,
+    quicrq_datagram_coalescing_t* coalescing,
     int* media_was_sent,
     int* at_least_one_active,
     int should_skip);
@@ -257,6 +448,7 @@ int quicrq_fragment_datagram_publisher_prepare(
     uint64_t datagram_stream_id,
     void* context,
     size_t space,
+    quicrq_datagram_coalescing_t* coalescing,
     int* media_was_sent,
     int* at_least_one_active,
     int* not_ready,
@@ -266,6 +458,7 @@ int quicrq_fragment_datagram_publisher_fn(
     quicrq_stream_ctx_t* stream_ctx,
     void* context,
     size_t space,
+    quicrq_datagram_coalescing_t* coalescing,
     int* media_was_sent,
     int* at_least_one_active,
     uint64_t current_time);
@@ -279,7 +472,11 @@ uint8_t quicrq_fragment_get_flags(quicrq_fragment_cache_t* cache_ctx, uint64_t g
 int quicrq_fragment_get_object_properties(quicrq_fragment_cache_t* cache_ctx, uint64_t group_id, uint64_t object_id,
     size_t* object_length, uint64_t* nb_objects_previous_group, uint8_t* flags);
 
-size_t quicrq_fragment_object_copy_available_data(quicrq_fragment_cache_t* cache_ctx,
+/* Copy the data available in sequence from the specified offset of an object.
+ * If the cursor is not NULL, the lookup resumes from the position at which
+ * the previous call stopped, and the cursor is updated.
+ */
+size_t quicrq_fragment_object_copy_available_data(quicrq_fragment_cache_t* cache_ctx, quicrq_fragment_cursor_t* cursor,
     uint64_t group_id, uint64_t object_id, size_t offset, size_t available, uint8_t* buffer);
 
 size_t quicrq_fragment_object_copy(quicrq_fragment_cache_t* cache_ctx, uint64_t group_id, uint64_t object_id, uint64_t* nb_objects_previous_group, uint8_t* flags, uint8_t* buffer);
@@ -293,6 +490,92 @@ int quicrq_publish_fragment_cached_media(quicrq_ctx_t* qr_ctx,
     quicrq_fragment_cache_t* cache_ctx, const uint8_t* url, const size_t url_length,
     int is_local_object_source, int is_cache_real_time);
 
+/* Relay shards.
+ * A shard feed copies the content of a cache in the source context to a
+ * mirror cache in the shard context, which runs in another thread. The source
+ * thread pushes entries in a single producer, single consumer ring, and
+ * the shard thread pops them. The head of the ring is only written by the
+ * source thread and the tail by the shard thread, with release stores and
+ * acquire loads, so no lock is needed. If the ring is full, entries are kept
+ * in a backlog list owned by the source thread and retried at its next
+ * time check. Each entry carries its own copy of the data, allocated with
+ * malloc instead of the per context pools, since it is freed in the other thread.
+ *
+ * Feeds are created in the source thread while both threads run. The feed
+ * is then handed to the shard thread through the request queue of the shard
+ * context, and the shard thread creates the mirror cache when it pops it.
+ * Either side may detach first: each side swaps "is_detached" when it stops
+ * using the feed, and the side that finds it already set frees the feed.
+ * The shard thread is woken up by the publish wakeup function of the shard
+ * context when the ring goes from idle to pending; without that function,
+ * the incoming feeds are polled at every QUICRQ_SHARD_POLL_INTERVAL.
+ */
+#define QUICRQ_SHARD_POLL_INTERVAL 1000
+
+typedef enum {
+    quicrq_shard_entry_fragment = 0,
+    quicrq_shard_entry_start_point,
+    quicrq_shard_entry_end_point,
+    quicrq_shard_entry_closed
+} quicrq_shard_entry_enum;
+
+typedef struct st_quicrq_shard_entry_t {
+    struct st_quicrq_shard_entry_t* next_backlog;
+    quicrq_shard_entry_enum entry_type;
+    uint64_t group_id;
+    uint64_t object_id;
+    uint64_t offset;
+    uint64_t queue_delay;
+    uint8_t flags;
+    uint64_t nb_objects_previous_group;
+    uint64_t object_length;
+    size_t data_length;
+    uint8_t* data; /* Copy of the data, allocated with the entry */
+} quicrq_shard_entry_t;
+
+struct st_quicrq_shard_feed_t {
+    /* Set at creation, read by both threads */
+    quicrq_mpsc_node_t request_node; /* In the request queue of the shard context */
+    quicrq_publish_wakeup_fn wakeup_fn;
+    void* wakeup_ctx;
+    uint8_t* url;
+    size_t url_length;
+    int is_real_time;
+    int is_auto_delete; /* Deleted by the source when the source is closed, see quicrq_shard_feed_create_auto */
+    /* Owned by the source thread */
+    quicrq_ctx_t* source_ctx;
+    quicrq_fragment_cache_t* source_cache_ctx; /* NULL after the source cache is deleted */
+    struct st_quicrq_shard_feed_t* next_feed_for_cache;
+    struct st_quicrq_shard_feed_t* next_feed_out;
+    struct st_quicrq_shard_feed_t* previous_feed_out;
+    quicrq_shard_entry_t* first_backlog;
+    quicrq_shard_entry_t* last_backlog;
+    /* Owned by the shard thread */
+    quicrq_ctx_t* shard_ctx;
+    quicrq_fragment_cache_t* shard_cache_ctx; /* NULL after the mirror cache is deleted */
+    struct st_quicrq_shard_feed_t* next_feed_in;
+    struct st_quicrq_shard_feed_t* previous_feed_in;
+    int is_attached; /* In the list of incoming feeds of the shard context */
+    /* Shared by both threads */
+    uint64_t is_detached; /* Set by the first side that stops using the feed */
+    uint64_t is_pending; /* Entries pushed since the shard last drained the ring */
+    quicrq_shard_entry_t** ring;
+    uint64_t ring_mask;
+    uint64_t ring_head; /* Number of entries pushed, written by the source thread */
+    uint64_t ring_tail; /* Number of entries popped, written by the shard thread */
+};
+
+int quicrq_shard_feed_fragment(quicrq_fragment_cache_t* cache_ctx, quicrq_cached_fragment_t* fragment);
+int quicrq_shard_feed_start_point(quicrq_fragment_cache_t* cache_ctx);
+int quicrq_shard_feed_end_point(quicrq_fragment_cache_t* cache_ctx);
+void quicrq_shard_feed_source_closed(quicrq_fragment_cache_t* cache_ctx);
+void quicrq_shard_feed_mirror_deleted(quicrq_fragment_cache_t* cache_ctx);
+uint64_t quicrq_shard_feeds_process(quicrq_ctx_t* qr_ctx, uint64_t current_time);
+void quicrq_shard_feeds_release(quicrq_ctx_t* qr_ctx);
+quicrq_shard_feed_t* quicrq_shard_feed_create_auto(quicrq_ctx_t* source_ctx, quicrq_media_source_ctx_t* srce_ctx,
+    quicrq_ctx_t* shard_ctx, size_t ring_size);
+void quicrq_shard_feed_peers(quicrq_ctx_t* qr_ctx, quicrq_media_source_ctx_t* srce_ctx);
+
 /* Evaluation of congestion for single stream transmission */
 int quicrq_evaluate_stream_congestion(quicrq_fragment_publisher_context_t* media_ctx, uint64_t current_time);
 
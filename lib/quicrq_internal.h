@@ -30,6 +30,7 @@
 extern "C" {
 #endif
 
+/* Default number of connections, if not specified in quicrq_create_ex */
 #define QUICRQ_MAX_CONNECTIONS 256
 
 /* Implementation of the quicrq application on top of picoquic. 
@@ -55,6 +56,102 @@ uint8_t* quicrq_msg_buffer_store(uint8_t* bytes, size_t length, quicrq_message_b
 void quicrq_msg_buffer_reset(quicrq_message_buffer_t* msg_buffer);
 void quicrq_msg_buffer_release(quicrq_message_buffer_t* msg_buffer);
 
+/* Memory pools.
+ * The per fragment structures are allocated from pools attached to the
+ * quicrq context, with one pool per structure type and a set of pools
+ * per size class for variable size data. If the quicrq context is NULL,
+ * e.g., in unit tests, allocations fall back to malloc and free.
+ */
+typedef enum {
+    quicrq_pool_cached_fragment = 0,
+    quicrq_pool_datagram_ack,
+    quicrq_pool_publisher_object,
+    quicrq_pool_cached_object,
+    quicrq_pool_uni_stream,
+    quicrq_pool_data_128,
+    quicrq_pool_data_256,
+    quicrq_pool_data_512,
+    quicrq_pool_data_1024,
+    quicrq_pool_data_2048,
+    quicrq_pool_data_oversize,
+    quicrq_pool_max
+} quicrq_pool_id_enum;
+
+typedef struct st_quicrq_pool_item_t {
+    struct st_quicrq_pool_item_t* next_item;
+} quicrq_pool_item_t;
+
+typedef struct st_quicrq_pool_t {
+    quicrq_pool_item_t* first_free;
+    size_t max_free;
+    quicrq_pool_stats_t stats;
+} quicrq_pool_t;
+
+void quicrq_pools_init(quicrq_ctx_t* qr_ctx);
+void quicrq_pools_release(quicrq_ctx_t* qr_ctx);
+void* quicrq_pool_alloc(quicrq_ctx_t* qr_ctx, quicrq_pool_id_enum pool_id, size_t size);
+void quicrq_pool_free(quicrq_ctx_t* qr_ctx, quicrq_pool_id_enum pool_id, void* item);
+void* quicrq_pool_alloc_data(quicrq_ctx_t* qr_ctx, size_t size);
+void quicrq_pool_free_data(quicrq_ctx_t* qr_ctx, void* item, size_t size);
+
+/* Deadlines managed by the quicrq context, see timer.c.
+ * Timers are embedded in the objects that own them, and kept in a
+ * min heap ordered by deadline in the quicrq context. The type of
+ * the timer determines the owner and the action performed when the
+ * timer is due.
+ */
+typedef enum {
+    quicrq_timer_extra_repeat = 0, /* extra_repeat_timer in quicrq_stream_ctx_t */
+    quicrq_timer_cache_delete, /* cache_delete_timer in quicrq_media_source_ctx_t */
+    quicrq_timer_cache_check, /* cache_check_timer in quicrq_ctx_t */
+    quicrq_timer_catch_up, /* catch_up_timer in quicrq_fragment_publisher_context_t */
+    quicrq_timer_relay_warm /* relay_warm_timer in quicrq_ctx_t */
+} quicrq_timer_type_enum;
+
+typedef struct st_quicrq_timer_t {
+    uint64_t deadline;
+    size_t heap_index; /* One plus the position in the heap, or 0 if the timer is not set */
+    quicrq_timer_type_enum timer_type;
+} quicrq_timer_t;
+
+typedef struct st_quicrq_timer_heap_t {
+    quicrq_timer_t** heap;
+    size_t nb_timers;
+    size_t heap_size;
+} quicrq_timer_heap_t;
+
+void quicrq_timer_init(quicrq_timer_t* timer, quicrq_timer_type_enum timer_type);
+int quicrq_timer_set(quicrq_ctx_t* qr_ctx, quicrq_timer_t* timer, uint64_t deadline);
+void quicrq_timer_cancel(quicrq_ctx_t* qr_ctx, quicrq_timer_t* timer);
+uint64_t quicrq_timer_next_deadline(quicrq_ctx_t* qr_ctx);
+quicrq_timer_t* quicrq_timer_pop_due(quicrq_ctx_t* qr_ctx, uint64_t current_time);
+void quicrq_timers_release(quicrq_ctx_t* qr_ctx);
+
+/* Fragment buffer.
+ * Fragment data is copied once when received, and then stays immutable.
+ * The buffer is shared by the fragment cache and by the datagram ack states
+ * of all the streams that forward it, each holding a reference. The buffer
+ * is freed when the last reference is released.
+ * External buffers point to data owned by the application, see
+ * quicrq_publish_object_ex; their release function is called instead of
+ * freeing the data.
+ */
+typedef struct st_quicrq_fragment_buffer_t {
+    quicrq_ctx_t* qr_ctx; /* Pools from which the buffer was allocated */
+    uint32_t ref_count;
+    size_t length;
+    uint8_t* data;
+    int is_external; /* Data not allocated with the header */
+    quicrq_object_release_fn release_fn; /* Only set for external buffers, may be NULL */
+    void* release_ctx;
+} quicrq_fragment_buffer_t;
+
+quicrq_fragment_buffer_t* quicrq_fragment_buffer_create(quicrq_ctx_t* qr_ctx, const uint8_t* data, size_t length);
+quicrq_fragment_buffer_t* quicrq_fragment_buffer_create_external(quicrq_ctx_t* qr_ctx, uint8_t* data, size_t length,
+    quicrq_object_release_fn release_fn, void* release_ctx);
+void quicrq_fragment_buffer_hold(quicrq_fragment_buffer_t* buffer);
+void quicrq_fragment_buffer_release(quicrq_fragment_buffer_t* buffer);
+
 /* The protocol used for our tests defines a set of actions:
  * - Request: request to open a media stream, defined by URL of media fragment. Content as per transport type.
  * - Fin Datagram: when the media fragment has been sent as a set of datagrams, provides the final offset.
@@ -73,6 +170,22 @@ void quicrq_msg_buffer_release(quicrq_message_buffer_t* msg_buffer);
 #define QUICRQ_ACTION_WARP_HEADER 12
 #define QUICRQ_ACTION_OBJECT_HEADER 13
 #define QUICRQ_ACTION_RUSH_HEADER 14
+#define QUICRQ_ACTION_REQUEST_BATCH 15
+#define QUICRQ_ACTION_ACCEPT_BATCH 16
+#define QUICRQ_ACTION_TRACK 17
+#define QUICRQ_ACTION_FEEDBACK 18
+#define QUICRQ_ACTION_UNSUBSCRIBE_TRACK 19
+
+/* Largest number of media requested in a single batch */
+#define QUICRQ_BATCH_TRACKS_MAX 1024
+
+/* Format of the datagram headers, chosen by the receiver of the datagrams
+ * in the REQUEST or ACCEPT message. */
+typedef enum {
+    quicrq_datagram_header_full = 0,
+    quicrq_datagram_header_compact,
+    quicrq_datagram_header_format_max
+} quicrq_datagram_header_format_enum;
 
 /* Protocol message.
  * This structure is used when decoding messages
@@ -93,6 +206,17 @@ typedef struct st_quicrq_message_t {
     quicrq_transport_mode_enum transport_mode;
     uint8_t cache_policy;
     quicrq_subscribe_intent_enum subscribe_intent;
+    quicrq_datagram_header_format_enum datagram_header_format;
+    /* Batch messages: number of tracks, and encoded list of URLs or media ids */
+    size_t nb_tracks;
+    const uint8_t* track_list;
+    /* Track messages: type of the message carried for the track */
+    uint64_t track_message_type;
+    /* Feedback messages: target bit rate, max flags are carried in "flags" */
+    uint64_t target_bitrate;
+    /* Request and accept messages: fragment size and FEC window asked by the receiver of datagrams, or 0 */
+    size_t fragment_size;
+    size_t fec_window;
 } quicrq_message_t;
 
 /* Encode and decode protocol messages
@@ -122,10 +246,12 @@ const uint8_t* quicrq_notify_msg_decode(const uint8_t* bytes, const uint8_t* byt
 size_t quicrq_rq_msg_reserve(size_t url_length, quicrq_subscribe_intent_enum intent_mode);
 uint8_t* quicrq_rq_msg_encode(uint8_t* bytes, uint8_t* bytes_max, uint64_t message_type, size_t url_length, const uint8_t* url,
     uint64_t media_id, quicrq_transport_mode_enum transport_mode, quicrq_subscribe_intent_enum intent_mode,
-    uint64_t start_group_id, uint64_t start_object_id);
+    uint64_t start_group_id, uint64_t start_object_id, quicrq_datagram_header_format_enum datagram_header_format,
+    size_t fragment_size, size_t fec_window);
 const uint8_t* quicrq_rq_msg_decode(const uint8_t* bytes, const uint8_t* bytes_max, uint64_t* message_type, size_t* url_length, const uint8_t** url,
     uint64_t* media_id, quicrq_transport_mode_enum* transport_mode, quicrq_subscribe_intent_enum* intent_mode,
-    uint64_t* start_group_id, uint64_t* start_object_id);
+    uint64_t* start_group_id, uint64_t* start_object_id, quicrq_datagram_header_format_enum* datagram_header_format,
+    size_t* fragment_size, size_t* fec_window);
 size_t quicrq_post_msg_reserve(size_t url_length);
 uint8_t* quicrq_post_msg_encode(uint8_t* bytes, uint8_t* bytes_max, uint64_t message_type, size_t url_length, 
     const uint8_t* url, quicrq_transport_mode_enum transport_mode, uint8_t cache_policy,
@@ -150,11 +276,30 @@ const uint8_t* quicrq_fragment_msg_decode(const uint8_t* bytes, const uint8_t* b
 size_t quicrq_start_point_msg_reserve(uint64_t start_group, uint64_t start_object);
 uint8_t* quicrq_start_point_msg_encode(uint8_t* bytes, uint8_t* bytes_max, uint64_t message_type, uint64_t start_group, uint64_t start_object);
 const uint8_t* quicrq_start_point_msg_decode(const uint8_t* bytes, const uint8_t* bytes_max, uint64_t* message_type, uint64_t* start_group, uint64_t* start_object);
+size_t quicrq_batch_rq_msg_reserve(size_t nb_tracks, const size_t* url_length, quicrq_subscribe_intent_enum intent_mode);
+uint8_t* quicrq_batch_rq_msg_encode(uint8_t* bytes, uint8_t* bytes_max, uint64_t message_type, uint64_t first_media_id,
+    quicrq_subscribe_intent_enum intent_mode, uint64_t start_group_id, uint64_t start_object_id,
+    quicrq_datagram_header_format_enum datagram_header_format, size_t nb_tracks, const uint8_t** url, const size_t* url_length);
+const uint8_t* quicrq_batch_rq_msg_decode(const uint8_t* bytes, const uint8_t* bytes_max, uint64_t* message_type, uint64_t* first_media_id,
+    quicrq_subscribe_intent_enum* intent_mode, uint64_t* start_group_id, uint64_t* start_object_id,
+    quicrq_datagram_header_format_enum* datagram_header_format, size_t* nb_tracks, const uint8_t** track_list);
+const uint8_t* quicrq_batch_url_decode(const uint8_t* bytes, const uint8_t* bytes_max, size_t* url_length, const uint8_t** url);
+size_t quicrq_batch_accept_msg_reserve(size_t nb_tracks);
+uint8_t* quicrq_batch_accept_msg_encode(uint8_t* bytes, uint8_t* bytes_max, uint64_t message_type, size_t nb_tracks, const uint64_t* media_id);
+const uint8_t* quicrq_batch_accept_msg_decode(const uint8_t* bytes, const uint8_t* bytes_max, uint64_t* message_type,
+    size_t* nb_tracks, const uint8_t** track_list);
+size_t quicrq_track_msg_reserve(uint64_t media_id);
+uint8_t* quicrq_track_msg_encode(uint8_t* bytes, uint8_t* bytes_max, uint64_t message_type, uint64_t media_id);
+size_t quicrq_unsubscribe_track_msg_reserve(uint64_t media_id);
+uint8_t* quicrq_unsubscribe_track_msg_encode(uint8_t* bytes, uint8_t* bytes_max, uint64_t media_id);
 uint8_t* quicrq_msg_encode(uint8_t* bytes, uint8_t* bytes_max, quicrq_message_t* msg);
 const uint8_t* quicrq_msg_decode(const uint8_t* bytes, const uint8_t* bytes_max, quicrq_message_t * msg);
 size_t quicrq_cache_policy_msg_reserve();
 uint8_t* quicrq_cache_policy_msg_encode(uint8_t* bytes, uint8_t* bytes_max, uint64_t message_type, uint8_t cache_policy);
 const uint8_t* quicrq_cache_policy_msg_decode(const uint8_t* bytes, const uint8_t* bytes_max, uint64_t * message_type, uint8_t * cache_policy);
+size_t quicrq_feedback_msg_reserve(uint64_t target_bitrate);
+uint8_t* quicrq_feedback_msg_encode(uint8_t* bytes, uint8_t* bytes_max, uint64_t message_type, uint8_t max_flags, uint64_t target_bitrate);
+const uint8_t* quicrq_feedback_msg_decode(const uint8_t* bytes, const uint8_t* bytes_max, uint64_t* message_type, uint8_t* max_flags, uint64_t* target_bitrate);
 size_t quicrq_warp_header_msg_reserve(uint64_t media_id, uint64_t group_id);
 uint8_t* quicrq_warp_header_msg_encode(uint8_t* bytes, uint8_t* bytes_max, uint64_t message_type, uint64_t media_id, uint64_t group_id);
 const uint8_t* quicrq_warp_header_msg_decode(const uint8_t* bytes, const uint8_t* bytes_max, uint64_t* message_type, uint64_t* media_id, uint64_t* group_id);
@@ -170,13 +315,120 @@ uint8_t* quicrq_datagram_header_encode(uint8_t* bytes, uint8_t* bytes_max, uint6
     uint64_t object_id, uint64_t object_offset, uint64_t queue_delay, uint8_t flags, uint64_t nb_objects_previous_group, uint64_t object_length);
 const uint8_t* quicrq_datagram_header_decode(const uint8_t* bytes, const uint8_t* bytes_max, uint64_t* media_id, uint64_t* group_id,
     uint64_t* object_id, uint64_t* object_offset, uint64_t *queue_delay, uint8_t * flags, uint64_t *nb_objects_previous_group, uint64_t* object_length);
+/* Coalesced datagrams carry several fragments, each encoded as a datagram
+ * header followed by the varint encoded data length and the data. */
+#define QUICRQ_DATAGRAM_COALESCED_MARKER_LENGTH 2
+int quicrq_datagram_is_coalesced(const uint8_t* bytes, size_t length);
+uint8_t* quicrq_datagram_coalesced_marker_encode(uint8_t* bytes, uint8_t* bytes_max);
+const uint8_t* quicrq_datagram_fragment_decode(const uint8_t* bytes, const uint8_t* bytes_max, int is_coalesced,
+    uint64_t* media_id, uint64_t* group_id, uint64_t* object_id, uint64_t* object_offset, uint64_t* queue_delay,
+    uint8_t* flags, uint64_t* nb_objects_previous_group, uint64_t* object_length, const uint8_t** data, size_t* data_length);
+const uint8_t* quicrq_datagram_fragment_decode_ex(const uint8_t* bytes, const uint8_t* bytes_max, int is_coalesced,
+    quicrq_datagram_header_format_enum header_format, uint64_t group_ref,
+    uint64_t* media_id, uint64_t* group_id, uint64_t* object_id, uint64_t* object_offset, uint64_t* queue_delay,
+    uint8_t* flags, uint64_t* nb_objects_previous_group, uint64_t* object_length, const uint8_t** data, size_t* data_length);
+/* Compact datagram headers, see quicrq_compact_datagram_header_encode */
+#define QUICRQ_COMPACT_GROUP_TRUNCATED 0x01
+#define QUICRQ_COMPACT_OFFSET_PRESENT 0x02
+#define QUICRQ_COMPACT_LENGTH_PRESENT 0x04
+#define QUICRQ_COMPACT_DELAY_PRESENT 0x08
+#define QUICRQ_COMPACT_FLAGS_PRESENT 0x10
+#define QUICRQ_COMPACT_PREVIOUS_PRESENT 0x20
+uint8_t* quicrq_compact_datagram_header_encode(uint8_t* bytes, uint8_t* bytes_max, uint64_t media_id, uint64_t group_id,
+    int is_group_truncated, uint64_t object_id, uint64_t object_offset, uint64_t queue_delay, uint8_t flags,
+    uint64_t nb_objects_previous_group, uint64_t object_length, int is_final);
+const uint8_t* quicrq_compact_datagram_header_decode(const uint8_t* bytes, const uint8_t* bytes_max, uint64_t group_ref,
+    uint64_t* media_id, uint64_t* group_id, uint64_t* object_id, uint64_t* object_offset, uint64_t* queue_delay,
+    uint8_t* flags, uint64_t* nb_objects_previous_group, uint64_t* object_length);
+uint64_t quicrq_compact_group_expand(uint64_t group_ref, uint8_t truncated);
+int quicrq_compact_group_can_truncate(uint64_t group_id, uint64_t group_acked, uint64_t group_sent);
+/* Varint decoding for the datagram receive path */
+const uint8_t* quicrq_varint_decode(const uint8_t* bytes, const uint8_t* bytes_max, uint64_t* n64);
+
+/* State of a coalesced datagram while it is being filled. */
+typedef struct st_quicrq_datagram_coalescing_t {
+    uint8_t* bytes;
+    size_t length; /* Bytes already written, including the marker */
+    size_t space; /* Size of the datagram */
+    int nb_fragments;
+    int is_full; /* Set when the next fragment does not fit */
+} quicrq_datagram_coalescing_t;
+
+/* FEC datagrams start with a two bytes encoding of the varint 1, which
+ * minimal media ID encodings never produce either. The FEC marker is
+ * followed by the media ID, the group ID, the number of fragments in the
+ * window, the object ID and offset of each fragment, the XOR of the
+ * lengths of the fragments, and the parity bytes.
+ * Each fragment is protected as a "FEC record": its datagram header, with
+ * a queue delay of 0 so that copies seen after a repeat match, followed by
+ * its data. The parity is the XOR of the records padded with zeroes.
+ */
+#define QUICRQ_DATAGRAM_FEC_MARKER_LENGTH 2
+#define QUICRQ_FEC_HEADER_MAX (QUICRQ_DATAGRAM_FEC_MARKER_LENGTH + 8 + 8 + 1 + 16 * QUICRQ_FEC_WINDOW_MAX + 8)
+#define QUICRQ_FEC_RECORD_MAX (PICOQUIC_DATAGRAM_QUEUE_MAX_LENGTH - QUICRQ_FEC_HEADER_MAX)
+#define QUICRQ_FEC_DECODER_RECORDS (2 * QUICRQ_FEC_WINDOW_MAX)
+
+typedef struct st_quicrq_fec_parity_t {
+    uint64_t media_id;
+    uint64_t group_id;
+    size_t nb_fragments;
+    uint64_t object_id[QUICRQ_FEC_WINDOW_MAX];
+    uint64_t object_offset[QUICRQ_FEC_WINDOW_MAX];
+    uint64_t length_xor;
+    const uint8_t* parity;
+    size_t parity_length;
+} quicrq_fec_parity_t;
+
+/* Parity of the window being sent on a media stream */
+typedef struct st_quicrq_fec_encoder_t {
+    uint64_t group_id;
+    size_t nb_fragments;
+    uint64_t object_id[QUICRQ_FEC_WINDOW_MAX];
+    uint64_t object_offset[QUICRQ_FEC_WINDOW_MAX];
+    uint64_t length_xor;
+    size_t parity_length;
+    uint64_t nb_parity_sent;
+    uint8_t parity[QUICRQ_FEC_RECORD_MAX];
+} quicrq_fec_encoder_t;
+
+/* Records of the last fragments received on a media stream, kept in a ring */
+typedef struct st_quicrq_fec_record_t {
+    uint64_t group_id;
+    uint64_t object_id;
+    uint64_t object_offset;
+    size_t length;
+    uint8_t bytes[QUICRQ_FEC_RECORD_MAX];
+} quicrq_fec_record_t;
+
+typedef struct st_quicrq_fec_decoder_t {
+    size_t next_record;
+    size_t nb_records;
+    uint64_t nb_recovered;
+    quicrq_fec_record_t records[QUICRQ_FEC_DECODER_RECORDS];
+} quicrq_fec_decoder_t;
+
+int quicrq_datagram_is_fec(const uint8_t* bytes, size_t length);
+uint8_t* quicrq_fec_parity_encode(uint8_t* bytes, uint8_t* bytes_max, uint64_t media_id, const quicrq_fec_encoder_t* encoder);
+const uint8_t* quicrq_fec_parity_decode(const uint8_t* bytes, const uint8_t* bytes_max, quicrq_fec_parity_t* parity);
+int quicrq_fec_encoder_add(quicrq_stream_ctx_t* stream_ctx, uint64_t group_id, uint64_t object_id, uint64_t object_offset,
+    uint8_t flags, uint64_t nb_objects_previous_group, uint64_t object_length, const uint8_t* data, size_t data_length);
+int quicrq_fec_encoder_flush(quicrq_stream_ctx_t* stream_ctx);
+size_t quicrq_fec_window(quicrq_stream_ctx_t* stream_ctx);
+void quicrq_fec_decoder_add(quicrq_fec_decoder_t* decoder, uint64_t media_id, uint64_t group_id, uint64_t object_id,
+    uint64_t object_offset, uint8_t flags, uint64_t nb_objects_previous_group, uint64_t object_length,
+    const uint8_t* data, size_t data_length);
+int quicrq_fec_decoder_recover(quicrq_fec_decoder_t* decoder, const quicrq_fec_parity_t* parity, uint8_t* record, size_t* record_length);
 /* Stream header is indentical to repair message */
 #define QUICRQ_STREAM_HEADER_MAX 2+1+8+4+2
 
+/* Number of fragments tracked in a stream context */
+size_t quicrq_datagram_ack_count(quicrq_stream_ctx_t* stream_ctx);
+
 /* Initialize the tracking of a datagram after sending it in a stream context */
 int quicrq_datagram_ack_init(quicrq_stream_ctx_t* stream_ctx, uint64_t group_id, uint64_t object_id,
     uint64_t object_offset, uint8_t flags, uint64_t nb_objects_previous_group, const uint8_t* data, size_t length,
-    uint64_t queue_delay, uint64_t object_length, void** p_created_state, uint64_t current_time);
+    quicrq_fragment_buffer_t* data_buffer, uint64_t queue_delay, uint64_t object_length, void** p_created_state,
+    uint64_t current_time);
 
 /* Media publisher API.
  * This now only an internal API. 
@@ -236,6 +488,7 @@ typedef struct st_quicrq_media_source_ctx_t quicrq_media_source_ctx_t;
 
 void quicrq_delete_source(quicrq_media_source_ctx_t* srce_ctx, quicrq_ctx_t* qr_ctx);
 void quicrq_source_wakeup(quicrq_media_source_ctx_t* srce_ctx);
+void quicrq_source_wakeup_flush(quicrq_ctx_t* qr_ctx);
 
 quicrq_media_source_ctx_t* quicrq_publish_datagram_source(quicrq_ctx_t* qr_ctx, const uint8_t* url, size_t url_length,
     void* cache_ctx, int is_local_object_source, int is_cache_real_time);
@@ -243,6 +496,65 @@ quicrq_media_source_ctx_t* quicrq_publish_datagram_source(quicrq_ctx_t* qr_ctx,
  /* Quicrq per media object source context.
   */
 
+/* Atomic operations, for the structures shared between threads: the relay
+ * shard feeds and the publish queues of media object sources. Loads have
+ * acquire semantics, stores have release semantics, exchanges are full barriers.
+ */
+#ifdef _WINDOWS
+#define quicrq_atomic_load(p) ((uint64_t)InterlockedCompareExchange64((volatile LONG64*)(p), 0, 0))
+#define quicrq_atomic_store(p, v) (void)InterlockedExchange64((volatile LONG64*)(p), (LONG64)(v))
+#define quicrq_atomic_exchange(p, v) ((uint64_t)InterlockedExchange64((volatile LONG64*)(p), (LONG64)(v)))
+#define quicrq_atomic_load_ptr(p) InterlockedCompareExchangePointer((PVOID volatile*)(p), NULL, NULL)
+#define quicrq_atomic_store_ptr(p, v) (void)InterlockedExchangePointer((PVOID volatile*)(p), (PVOID)(v))
+#define quicrq_atomic_exchange_ptr(p, v) InterlockedExchangePointer((PVOID volatile*)(p), (PVOID)(v))
+#else
+#define quicrq_atomic_load(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define quicrq_atomic_store(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define quicrq_atomic_exchange(p, v) __atomic_exchange_n((p), (v), __ATOMIC_SEQ_CST)
+#define quicrq_atomic_load_ptr(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define quicrq_atomic_store_ptr(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define quicrq_atomic_exchange_ptr(p, v) __atomic_exchange_n((p), (v), __ATOMIC_SEQ_CST)
+#endif
+
+/* Intrusive multiple producers, single consumer queue, used to pass
+ * objects or requests to the thread of a quicrq context. Producers swap
+ * the head, then link the previous head to the new node; the consumer pops
+ * from the tail, in the thread of the quicrq context. A stub node keeps the
+ * queue non empty, so producers never touch the tail.
+ */
+typedef struct st_quicrq_mpsc_node_t {
+    struct st_quicrq_mpsc_node_t* next;
+} quicrq_mpsc_node_t;
+
+typedef struct st_quicrq_mpsc_queue_t {
+    quicrq_mpsc_node_t* head; /* Last pushed node, swapped by producers */
+    quicrq_mpsc_node_t* tail; /* Next node to pop, only used by the consumer */
+    quicrq_mpsc_node_t stub;
+} quicrq_mpsc_queue_t;
+
+void quicrq_mpsc_queue_init(quicrq_mpsc_queue_t* queue);
+void quicrq_mpsc_queue_push(quicrq_mpsc_queue_t* queue, quicrq_mpsc_node_t* node);
+quicrq_mpsc_node_t* quicrq_mpsc_queue_pop(quicrq_mpsc_queue_t* queue);
+
+/* Publish queue of a media object source.
+ * Objects published from other threads with `quicrq_publish_object_queued` are
+ * pushed in the multiple producers, single consumer queue of the source.
+ */
+typedef struct st_quicrq_publish_entry_t {
+    quicrq_mpsc_node_t node; /* Must be first */
+    int is_fin;
+    uint64_t group_id;
+    uint64_t object_id;
+    quicrq_media_object_properties_t properties;
+    size_t object_length;
+    uint8_t* object; /* Copy of the object, allocated with the entry */
+} quicrq_publish_entry_t;
+
+typedef struct st_quicrq_publish_queue_t {
+    quicrq_mpsc_queue_t queue;
+    uint64_t nb_errors; /* Queued objects that could not be published */
+} quicrq_publish_queue_t;
+
 struct st_quicrq_media_object_source_ctx_t {
     quicrq_ctx_t* qr_ctx;
     struct st_quicrq_media_object_source_ctx_t* previous_in_qr_ctx;
@@ -252,8 +564,11 @@ struct st_quicrq_media_object_source_ctx_t {
     uint64_t next_group_id;
     uint64_t next_object_id;
     quicrq_media_object_source_properties_t properties;
+    quicrq_publish_queue_t publish_queue;
 };
 
+void quicrq_publish_queues_drain(quicrq_ctx_t* qr_ctx);
+
 
 /* Quicrq per media source context.
  */
@@ -261,6 +576,10 @@ struct st_quicrq_media_object_source_ctx_t {
 struct st_quicrq_media_source_ctx_t {
     struct st_quicrq_media_source_ctx_t* next_source;
     struct st_quicrq_media_source_ctx_t* previous_source;
+    /* Index by URL: hash chain for exact match, ordered splay for prefix match */
+    struct st_quicrq_media_source_ctx_t* next_in_url_bin;
+    uint64_t url_hash;
+    picosplay_node_t url_node;
     struct st_quicrq_stream_ctx_t* first_stream;
     struct st_quicrq_stream_ctx_t* last_stream;
     uint8_t* media_url;
@@ -268,11 +587,41 @@ struct st_quicrq_media_source_ctx_t {
     struct st_quicrq_fragment_cache_t* cache_ctx;
     int is_local_object_source;
     int is_cache_real_time;
+    /* Batched wakeup of the streams, see quicrq_source_wakeup */
+    quicrq_ctx_t* qr_ctx;
+    struct st_quicrq_media_source_ctx_t* next_pending_wakeup;
+    struct st_quicrq_media_source_ctx_t* previous_pending_wakeup;
+    int is_wakeup_pending;
+    /* Deletion of the relay cache after the source is closed */
+    quicrq_timer_t cache_delete_timer;
+    /* Aggregated feedback of the subscribers, see quicrq_source_feedback_update.
+     * The running counts are kept by quicrq_source_feedback_count: subscribers
+     * without feedback, subscribers without target bitrate, and the highest
+     * flags and bitrate with the number of subscribers that requested them.
+     * The highest values are computed again from the subscribers only when
+     * the last of those changes its feedback or leaves. */
+    uint8_t feedback_max_flags;
+    uint64_t feedback_target_bitrate;
+    int is_feedback_forwarded;
+    uint64_t nb_feedback_unset;
+    uint64_t nb_feedback_unlimited_rate;
+    uint8_t feedback_highest_flags;
+    uint64_t nb_feedback_highest_flags;
+    uint64_t feedback_highest_bitrate;
+    uint64_t nb_feedback_highest_bitrate;
+    int is_feedback_highest_stale;
 };
 
 quicrq_media_source_ctx_t* quicrq_find_local_media_source(quicrq_ctx_t* qr_ctx, const uint8_t* url, const size_t url_length);
+uint64_t quicrq_source_url_hash(const uint8_t* url, size_t url_length);
+quicrq_media_source_ctx_t* quicrq_first_source_with_prefix(quicrq_ctx_t* qr_ctx, const uint8_t* prefix, size_t prefix_length);
+quicrq_media_source_ctx_t* quicrq_next_source_with_prefix(quicrq_media_source_ctx_t* srce_ctx, const uint8_t* prefix, size_t prefix_length);
+void quicrq_source_index_init(quicrq_ctx_t* qr_ctx);
+void quicrq_source_index_release(quicrq_ctx_t* qr_ctx);
 int quicrq_subscribe_local_media(quicrq_stream_ctx_t* stream_ctx, const uint8_t* url, const size_t url_length);
 void quicrq_unsubscribe_local_media(quicrq_stream_ctx_t* stream_ctx);
+void quicrq_source_feedback_count(quicrq_media_source_ctx_t* srce_ctx, quicrq_stream_ctx_t* stream_ctx, int is_added);
+void quicrq_source_feedback_update(quicrq_media_source_ctx_t* srce_ctx);
 void quicrq_wakeup_media_stream(quicrq_stream_ctx_t* stream_ctx);
 void quicrq_wakeup_media_uni_stream(quicrq_stream_ctx_t* stream_ctx);
 
@@ -308,6 +657,9 @@ int quicrq_cnx_subscribe_media(quicrq_cnx_ctx_t* cnx_ctx,
 int quicrq_cnx_subscribe_media_ex(quicrq_cnx_ctx_t* cnx_ctx, const uint8_t* url, size_t url_length,
     quicrq_transport_mode_enum transport_mode, const quicrq_subscribe_intent_t * intent,
     quicrq_media_consumer_fn media_consumer_fn, void* media_ctx, quicrq_stream_ctx_t** p_stream_ctx);
+int quicrq_cnx_subscribe_media_batch(quicrq_cnx_ctx_t* cnx_ctx, size_t nb_tracks, const uint8_t** url, const size_t* url_length,
+    const quicrq_subscribe_intent_t* intent, quicrq_media_consumer_fn media_consumer_fn, void** media_ctx,
+    quicrq_stream_ctx_t** p_track_ctx);
 
 
 /* Quicrq stream handling.
@@ -334,6 +686,8 @@ typedef enum {
     quicrq_waiting_notify,
     quicrq_sending_notify,
     quicrq_notify_ready,
+    quicrq_sending_batch,
+    quicrq_sending_feedback,
     quicrq_sending_no_more
 } quicrq_stream_sending_state_enum;
 
@@ -343,6 +697,8 @@ typedef enum {
     quicrq_receive_confirmation,
     quicrq_receive_fragment,
     quicrq_receive_notify,
+    quicrq_receive_batch,
+    quicrq_receive_feedback,
     quicrq_receive_done
 }  quicrq_stream_receive_state_enum;
 
@@ -378,14 +734,20 @@ typedef struct st_quicrq_datagram_ack_state_t {
     size_t length;
     int is_acked;
     int nack_received;
+    /* Reference to the data of the fragment, if available. The data points
+     * inside the data buffer, which is shared with the fragment cache.
+     */
+    quicrq_fragment_buffer_t* data_buffer;
+    const uint8_t* data;
     /* Handling of extra repeat, i.e., poor man's FEC.
-     * Presence of extra data indicates an extra repeat is scheduled. 
+     * Presence of extra data indicates an extra repeat is scheduled.
      * Length of extra_data is always equal to length of fragment.
+     * Extra data points to the shared data buffer, it is not a copy.
      */
     struct st_quicrq_datagram_ack_state_t* extra_previous;
     struct st_quicrq_datagram_ack_state_t* extra_next;
     uint64_t extra_repeat_time;
-    uint8_t* extra_data;
+    const uint8_t* extra_data;
     int is_extra_queued;
     /* Start time is the time of the first transmission at this node */
     uint64_t start_time;
@@ -393,12 +755,86 @@ typedef struct st_quicrq_datagram_ack_state_t {
     uint64_t last_sent_time;
 } quicrq_datagram_ack_state_t;
 
+/* Find the ack state of a fragment, and process the acknowledgement of a fragment */
+quicrq_datagram_ack_state_t* quicrq_datagram_ack_find(quicrq_stream_ctx_t* stream_ctx, uint64_t group_id, uint64_t object_id, uint64_t object_offset);
+int quicrq_datagram_handle_ack(quicrq_stream_ctx_t* stream_ctx, uint64_t group_id, uint64_t object_id, uint64_t object_offset, size_t length);
+int quicrq_handle_datagram_ack_nack(quicrq_cnx_ctx_t* cnx_ctx, picoquic_call_back_event_t picoquic_event,
+    uint64_t send_time, const uint8_t* bytes, size_t length, uint64_t current_time);
+int quicrq_receive_datagram(quicrq_cnx_ctx_t* cnx_ctx, const uint8_t* bytes, size_t length, uint64_t current_time);
+/* Encode the header of a datagram sent for the stream, in the format chosen by the receiver.
+ * "is_final" tells whether the fragment ends the object. */
+uint8_t* quicrq_datagram_stream_header_encode(quicrq_stream_ctx_t* stream_ctx, uint8_t* bytes, uint8_t* bytes_max,
+    uint64_t media_id, uint64_t group_id, uint64_t object_id, uint64_t object_offset, uint64_t queue_delay, uint8_t flags,
+    uint64_t nb_objects_previous_group, uint64_t object_length, int is_final);
+
 typedef struct st_quicrq_notify_url_t {
     struct st_quicrq_notify_url_t* next_notify_url;
     size_t url_len;
     uint8_t* url;
 } quicrq_notify_url_t;
 
+/* Fragment cursor.
+ * Remembers the cached fragment at which a sender stopped, so that the next
+ * read of the object resumes there instead of searching the cache. The cursor
+ * is only valid if no fragment was deleted from the cache since it was set.
+ */
+typedef struct st_quicrq_fragment_cursor_t {
+    struct st_quicrq_cached_fragment_t* fragment;
+    uint64_t nb_fragments_deleted;
+} quicrq_fragment_cursor_t;
+
+/* Delay histogram.
+ * Log-linear buckets: values below 16 have their own bucket, and each power
+ * of 2 above that is divided in 8 buckets, so a bucket covers less than 1/8th
+ * of its values. The last bucket holds all values above 2^36.
+ */
+#define QUICRQ_DELAY_HISTOGRAM_SUB_BUCKETS 8
+#define QUICRQ_DELAY_HISTOGRAM_OCTAVES 32
+#define QUICRQ_DELAY_HISTOGRAM_BUCKETS (QUICRQ_DELAY_HISTOGRAM_SUB_BUCKETS * (QUICRQ_DELAY_HISTOGRAM_OCTAVES + 2))
+
+typedef struct st_quicrq_delay_histogram_t {
+    uint64_t nb_samples;
+    uint64_t max_value;
+    uint32_t counts[QUICRQ_DELAY_HISTOGRAM_BUCKETS];
+} quicrq_delay_histogram_t;
+
+size_t quicrq_delay_histogram_index(uint64_t value);
+uint64_t quicrq_delay_histogram_bucket_max(size_t index);
+void quicrq_delay_histogram_record(quicrq_delay_histogram_t* histogram, uint64_t value);
+void quicrq_delay_histogram_merge(quicrq_delay_histogram_t* histogram, const quicrq_delay_histogram_t* other);
+uint64_t quicrq_delay_histogram_percentile(const quicrq_delay_histogram_t* histogram, double percentile);
+void quicrq_delay_histogram_summary(const quicrq_delay_histogram_t* histogram, quicrq_delay_stats_t* stats);
+
+/* Per hop latency histograms, see quicrq_get_hop_latency_stats */
+typedef enum {
+    quicrq_hop_latency_upstream_queue_delay = 0,
+    quicrq_hop_latency_receive_to_cache,
+    quicrq_hop_latency_cache_to_send,
+    quicrq_hop_latency_max
+} quicrq_hop_latency_enum;
+
+typedef struct st_quicrq_hop_latency_t {
+    quicrq_delay_histogram_t histograms[quicrq_hop_latency_max];
+} quicrq_hop_latency_t;
+
+void quicrq_hop_latency_summary(const quicrq_hop_latency_t* latency, quicrq_hop_latency_stats_t* stats);
+
+/* Media counters of a stream, see quicrq_get_stream_stats.
+ * The histogram is allocated when the first queue delay is recorded, so
+ * that streams that do not receive datagrams do not pay for it.
+ */
+typedef struct st_quicrq_media_counters_t {
+    quicrq_media_stats_t media;
+    quicrq_delay_histogram_t* queue_delay;
+} quicrq_media_counters_t;
+
+void quicrq_media_counters_fragment_sent(quicrq_media_counters_t* counters, size_t length, int is_last_fragment);
+void quicrq_media_counters_fragment_received(quicrq_media_counters_t* counters, size_t length, int is_last_fragment, uint8_t flags);
+int quicrq_media_counters_queue_delay(quicrq_media_counters_t* counters, uint64_t queue_delay);
+int quicrq_media_counters_add(quicrq_media_counters_t* counters, const quicrq_media_counters_t* other);
+void quicrq_media_counters_snapshot(const quicrq_media_counters_t* counters, quicrq_media_stats_t* stats);
+void quicrq_media_counters_release(quicrq_media_counters_t* counters);
+
 /* Context representing unidirectional streams*/
 struct st_quicrq_uni_stream_ctx_t {
     struct st_quicrq_uni_stream_ctx_t* next_uni_stream_for_cnx;
@@ -416,15 +852,37 @@ struct st_quicrq_uni_stream_ctx_t {
     uint8_t current_object_flags;
     uint64_t last_object_id; 
     uint64_t nb_objects_previous_group;
+    /* Priority set on the picoquic stream, and the object flags from which it was derived,
+     * see quicrq_uni_stream_priority. Both are 0 until the flags are known. */
     uint8_t stream_priority;
+    uint8_t priority_flags;
+    /* Position of the next data to send in the fragment cache */
+    quicrq_fragment_cursor_t cursor;
     /* UniStream state */
     quicrq_uni_stream_sending_state_enum send_state;
     quicrq_uni_stream_receive_state_enum receive_state;
+    /* The stream was marked active since the last prepare to send callback */
+    unsigned int is_active_stream : 1;
 
     quicrq_message_buffer_t message_buffer;
-    /* TODO: Add priority */
 };
 
+#define QUICRQ_CONGESTION_RATE_LEVELS 8
+
+/* Feedback of the receiver of a media: highest object flags value, i.e.,
+ * highest layer, and target bitrate in bits per second, 0 if not limited.
+ * On the receiver side, holds the values set by the application. On the
+ * sender side, holds the values received from the peer, and the bytes
+ * offered per layer since the start of the epoch, see quicrq_feedback_should_skip.
+ */
+typedef struct st_quicrq_stream_feedback_t {
+    uint8_t max_flags;
+    uint8_t rate_threshold;
+    uint64_t target_bitrate;
+    uint64_t epoch_start_time;
+    uint64_t bytes_per_level[QUICRQ_CONGESTION_RATE_LEVELS];
+} quicrq_stream_feedback_t;
+
 struct st_quicrq_stream_ctx_t {
     struct st_quicrq_stream_ctx_t* next_stream;
     struct st_quicrq_stream_ctx_t* previous_stream;
@@ -436,6 +894,7 @@ struct st_quicrq_stream_ctx_t {
     /* queue of datagrams that qualify for extra transmission */
     struct st_quicrq_datagram_ack_state_t* extra_first;
     struct st_quicrq_datagram_ack_state_t* extra_last;
+    quicrq_timer_t extra_repeat_timer; /* Set to the repeat time of extra_first */
     /* stream_id: control stream identifier */
     uint64_t stream_id;
     /* media_id: local identifier of media stream.
@@ -449,8 +908,6 @@ struct st_quicrq_stream_ctx_t {
     uint64_t start_object_id;
     uint64_t final_group_id;
     uint64_t final_object_id;
-    uint64_t next_warp_group_id; /* group_id to create next in warp mode */
-    uint64_t next_rush_object_id; /* in rush, next object to send in this group */
     /* Control of datagrams sent for that media
      * We only keep track of fragments that are above the horizon.
      * The one below horizon are already acked, or otherwise forgotten.
@@ -463,13 +920,19 @@ struct st_quicrq_stream_ctx_t {
     int nb_horizon_acks;
     int nb_extra_sent;
     int nb_fragment_lost;
-    picosplay_tree_t datagram_ack_tree;
-    /* For notification streams, URL and notification queue */
-    uint8_t* subscribe_prefix;
-    size_t subscribe_prefix_length;
-    quicrq_notify_url_t* first_notify_url;
-    quicrq_media_notify_fn media_notify_fn;
-    void* notify_ctx;
+    /* Ack states of the fragments sent. Fragments are mostly sent in increasing
+     * order of group id, object id and offset; these are kept in a ring, indexed
+     * by a send sequence number and thus sorted by key. The others, such as the
+     * tail of a split repeat, are kept in an overflow splay.
+     */
+    quicrq_datagram_ack_state_t** datagram_ack_ring;
+    size_t datagram_ack_ring_mask;
+    uint64_t datagram_ack_ring_first; /* Sequence number of the first state in the ring */
+    uint64_t datagram_ack_ring_next; /* Sequence number of the next state added to the ring */
+    picosplay_tree_t datagram_ack_overflow;
+    /* Parity of the fragments sent, and records of the fragments received, if FEC is used */
+    quicrq_fec_encoder_t* fec_encoder;
+    quicrq_fec_decoder_t* fec_decoder;
     /* Transport mode: stream, datagram, etc. */
     quicrq_transport_mode_enum transport_mode;
     /* Stream state */
@@ -480,6 +943,18 @@ struct st_quicrq_stream_ctx_t {
     uint64_t close_error_code;
     /* Control flags */
     uint8_t lowest_flags; /* Mark the lowest value of the flags field for media segments */
+    /* Datagram scheduling: flags of the last datagram sent, and credit left in the deficit round */
+    uint8_t datagram_flags;
+    int64_t datagram_deficit;
+    /* Datagram header format, set by the receiver. With compact headers,
+     * the group reference is the highest group received, or for the sender
+     * the highest group sent; the sender also tracks the highest group acked. */
+    quicrq_datagram_header_format_enum datagram_header_format;
+    uint64_t compact_group_ref;
+    uint64_t compact_group_acked;
+    /* Fragment size and FEC window asked by the receiver of the datagrams, or 0 */
+    size_t fragment_size;
+    size_t fec_window;
     unsigned int is_sender : 1;
     /* is_cache_real_time:
      * Indicates whether local cache management follows the "real time" logic,
@@ -498,19 +973,51 @@ struct st_quicrq_stream_ctx_t {
     unsigned int is_local_finished : 1;
     unsigned int is_receive_complete: 1;
     unsigned int is_active_datagram : 1;
+    unsigned int is_active_stream : 1;
     unsigned int is_start_object_id_sent : 1;
     unsigned int is_final_object_id_sent : 1;
     unsigned int is_cache_policy_sent : 1;
     unsigned int is_warp_mode_started: 1;
-
-    quicrq_message_buffer_t message_sent;
-    quicrq_message_buffer_t message_receive;
+    unsigned int is_compact_group_acked : 1;
+    unsigned int is_batch : 1;
+    unsigned int is_feedback_set : 1;
+    unsigned int is_feedback_pending : 1;
+    /* Layer and bitrate feedback of the receiver */
+    quicrq_stream_feedback_t feedback;
 
     quicrq_media_consumer_fn consumer_fn; /* Callback function for media data arrival  */
     struct st_quicrq_fragment_publisher_context_t* media_ctx; /* Callback argument for receiving or sending data */
+    /* Batched subscriptions. The tracks of a batch share the control stream
+     * of the batch context, and only carry the state of a datagram media flow.
+     * Tracks are listed in increasing order of media id. */
+    struct st_quicrq_stream_ctx_t* batch_ctx;
+    struct st_quicrq_stream_ctx_t* next_track;
+    /* Statistics, see quicrq_get_stream_stats */
+    quicrq_media_counters_t counters;
+    /* State of the control stream. The tracks of a batch do not have a
+     * control stream of their own, and do not use the fields below. */
+    quicrq_message_buffer_t message_sent;
+    quicrq_message_buffer_t message_receive;
+    uint64_t next_warp_group_id; /* group_id to create next in warp mode */
+    uint64_t next_rush_object_id; /* in rush, next object to send in this group */
+    /* For notification streams, URL and notification queue */
+    uint8_t* subscribe_prefix;
+    size_t subscribe_prefix_length;
+    struct st_quicrq_subscribe_node_t* subscribe_node; /* Trie node of the prefix, if subscribed */
+    struct st_quicrq_stream_ctx_t* next_subscriber;
+    struct st_quicrq_stream_ctx_t* previous_subscriber;
+    struct st_quicrq_subscribe_node_t* upstream_subscribe_node; /* Relay only, pattern forwarded to the origin */
+    quicrq_notify_url_t* first_notify_url;
+    quicrq_media_notify_fn media_notify_fn;
+    void* notify_ctx;
     /* set of uni_streams for a given media_id - is there a better way handle the individual stream - priorities, reset.. */
     struct st_quicrq_uni_stream_ctx_t* first_uni_stream;
     struct st_quicrq_uni_stream_ctx_t* last_uni_stream;
+    /* Tracks of a batch, and media ids of the tracks that the receiver
+     * closed, for which an unsubscribe message is not yet sent. */
+    struct st_quicrq_stream_ctx_t* first_track;
+    uint64_t* unsubscribed_track_id;
+    size_t nb_unsubscribed_tracks;
 };
 
 
@@ -523,8 +1030,22 @@ typedef struct st_quicrq_cnx_congestion_state_t {
     uint8_t priority_threshold; /* Indicates the highest priority level that may be dropped. */
     uint8_t old_priority_threshold; /* Threshold at beginning of epoch. */
     uint64_t congestion_check_time;
+    /* Rate based congestion control: bytes offered per priority level since the start of the epoch */
+    uint64_t epoch_start_time;
+    uint64_t bytes_per_level[QUICRQ_CONGESTION_RATE_LEVELS];
 } quicrq_cnx_congestion_state_t;
 
+/* State of the datagram scheduler of a connection.
+ * The next_stream cursor persists across calls, so that each call
+ * resumes the round where the previous one stopped.
+ */
+typedef struct st_quicrq_datagram_scheduler_t {
+    struct st_quicrq_stream_ctx_t* next_stream; /* First stream to consider at the next call */
+    struct st_quicrq_stream_ctx_t* scan_start; /* Stream at which the current call started */
+    int nb_waiting; /* Number of active streams passed over for lack of credit */
+    int is_replenished;
+} quicrq_datagram_scheduler_t;
+
 /* Quicrq per connection context */
 struct st_quicrq_cnx_ctx_t {
     struct st_quicrq_cnx_ctx_t* next_cnx;
@@ -537,14 +1058,24 @@ struct st_quicrq_cnx_ctx_t {
     int is_server;
     int is_client;
     quicrq_cnx_congestion_state_t congestion;
+    quicrq_datagram_scheduler_t datagram_scheduler;
 
     uint64_t next_media_id; /* only used for receiving */
     uint64_t next_abandon_datagram_id; /* used to test whether unexpected datagrams are OK */
+    /* Header format used by the peer for the datagrams that we send, remembered
+     * for parsing acknowledgements of coalesced datagrams after a stream is closed. */
+    quicrq_datagram_header_format_enum peer_datagram_header_format;
     struct st_quicrq_stream_ctx_t* first_stream;
     struct st_quicrq_stream_ctx_t* last_stream;
     /* reference to the unidirectional streams */
     struct st_quicrq_uni_stream_ctx_t* first_uni_stream;
     struct st_quicrq_uni_stream_ctx_t* last_uni_stream;
+    /* Datagram streams indexed by media ID, one table for received media (0)
+     * and one for sent media (1), see quicrq_find_stream_ctx_for_datagram */
+    struct st_quicrq_stream_ctx_t** media_id_table[2];
+    size_t media_id_table_size[2];
+    /* Counters of the streams closed so far, see quicrq_get_cnx_stats */
+    quicrq_media_counters_t closed_counters;
 };
 
 /* Prototype function for managing the cache of relays.
@@ -554,8 +1085,32 @@ struct st_quicrq_cnx_ctx_t {
  */
 typedef uint64_t (*quicrq_manage_relay_cache_fn)(quicrq_ctx_t* qr_ctx, uint64_t current_time);
 
+/* Prototype function for opening the warm upstream connections at relays,
+ * returns the time of the next check or UINT64_MAX */
+typedef uint64_t (*quicrq_manage_relay_warm_fn)(quicrq_ctx_t* qr_ctx, uint64_t current_time);
+
 /* Management of notifications
+ * The active subscribe patterns are kept in a prefix trie, with one node per
+ * byte of prefix. Each node lists the streams subscribed to exactly that
+ * prefix. A new URL is notified by walking the trie along the URL and
+ * notifying the subscribers of each node on the path.
+ * On a relay, the node also holds the stream that forwards the pattern to
+ * the origin. It is closed when the last subscriber to the pattern leaves.
  */
+typedef struct st_quicrq_subscribe_node_t {
+    struct st_quicrq_subscribe_node_t* parent;
+    struct st_quicrq_subscribe_node_t* first_child;
+    struct st_quicrq_subscribe_node_t* next_sibling;
+    uint8_t prefix_byte;
+    size_t nb_subscribers;
+    struct st_quicrq_stream_ctx_t* first_subscriber;
+    struct st_quicrq_stream_ctx_t* upstream_stream_ctx;
+} quicrq_subscribe_node_t;
+
+int quicrq_subscribe_trie_add(quicrq_stream_ctx_t* stream_ctx);
+void quicrq_subscribe_trie_remove(quicrq_stream_ctx_t* stream_ctx);
+quicrq_subscribe_node_t* quicrq_subscribe_trie_find(quicrq_ctx_t* qr_ctx, const uint8_t* prefix, size_t prefix_length);
+void quicrq_subscribe_trie_set_upstream(quicrq_subscribe_node_t* node, quicrq_stream_ctx_t* stream_ctx);
 
 int quicrq_notify_url_to_stream(quicrq_stream_ctx_t* stream_ctx, const uint8_t* url, size_t url_length);
 int quicrq_notify_url_to_all(quicrq_ctx_t * qr_ctx, const uint8_t* url, size_t url_length);
@@ -568,12 +1123,28 @@ typedef enum {
 
 typedef void (*quicrq_manage_relay_subscribe_fn)(quicrq_ctx_t* qr_ctx, quicrq_subscribe_action_enum action, const uint8_t* url, size_t url_length);
 
+/* Prototype function for tracking the closure of connections at relays. */
+typedef void (*quicrq_manage_relay_cnx_close_fn)(quicrq_ctx_t* qr_ctx, quicrq_cnx_ctx_t* cnx_ctx, quicrq_media_close_reason_enum close_reason);
+
+/* Prototype function for forwarding the aggregated feedback of subscribers at relays. */
+typedef void (*quicrq_manage_relay_feedback_fn)(quicrq_ctx_t* qr_ctx, quicrq_media_source_ctx_t* srce_ctx, uint8_t max_flags, uint64_t target_bitrate);
+
 /* Quicrq context */
 struct st_quicrq_ctx_t {
     picoquic_quic_t* quic; /* The quic context for the Quicrq service */
     /* Local media sources */
     quicrq_media_source_ctx_t* first_source;
     quicrq_media_source_ctx_t* last_source;
+    /* Index of local media sources by URL, see quicrq_find_local_media_source */
+    quicrq_media_source_ctx_t** source_url_bins;
+    size_t nb_source_url_bins;
+    size_t nb_sources;
+    picosplay_tree_t source_url_tree;
+    /* Sources waiting for the wakeup of their streams, flushed in quicrq_time_check */
+    quicrq_media_source_ctx_t* first_pending_wakeup;
+    quicrq_media_source_ctx_t* last_pending_wakeup;
+    /* Root of the prefix trie of active subscribe patterns */
+    quicrq_subscribe_node_t subscribe_root;
     /* local media object sources */
     struct st_quicrq_media_object_source_ctx_t* first_object_source;
     struct st_quicrq_media_object_source_ctx_t* last_object_source;
@@ -587,18 +1158,47 @@ struct st_quicrq_ctx_t {
     /* List of connections */
     struct st_quicrq_cnx_ctx_t* first_cnx; /* First in double linked list of open connections in this context */
     struct st_quicrq_cnx_ctx_t* last_cnx; /* last in list of open connections in this context */
+    size_t nb_connections; /* Number of connections in the list */
+    uint32_t max_nb_connections; /* Number of connections supported by the quic context */
     /* Cache management:
      * cache_duration_max in micros seconds, or zero if no cache management required
      * cache will be checked at once every cache_duration_max/2, as controlled
-     * by cache_check_next_time.
+     * by cache_check_timer.
      * When checking cache, the function manage_relay_cache_fn is called if the
      * relay function is enabled.
+     * cache_memory_limit in bytes of fragment data held by all caches, or zero
+     * if not limited. Groups are evicted in quicrq_time_check when cache_bytes
+     * exceeds the limit.
+     * catch_up_speed paces the objects sent from cache to new subscribers,
+     * see quicrq_set_catch_up_speed.
+     * spill_directory, if not NULL, enables the spill of complete groups to
+     * segment files in quicrq_time_check when cache_bytes exceeds spill_hot_limit.
+     * The data held in spill segments is counted in cache_spilled_bytes, not
+     * in cache_bytes. If a group cannot be spilled, the next attempt waits
+     * until spill_retry_time, and the delay doubles at each failure.
      */
     int is_cache_closing_needed;
     uint64_t cache_duration_max;
-    uint64_t cache_check_next_time;
+    quicrq_timer_t cache_check_timer;
+    size_t cache_memory_limit;
+    uint32_t catch_up_speed;
+    size_t cache_bytes;
+    uint64_t cache_evicted_bytes;
+    uint64_t cache_evicted_groups;
+    char* spill_directory;
+    size_t spill_hot_limit;
+    size_t spill_segment_size;
+    struct st_quicrq_spill_segment_t* spill_segment; /* Segment to which data is appended, or NULL */
+    size_t cache_spilled_bytes;
+    uint64_t cache_spilled_groups;
+    uint64_t spill_retry_time;
+    uint64_t spill_retry_delay;
     quicrq_manage_relay_cache_fn manage_relay_cache_fn;
     quicrq_manage_relay_subscribe_fn manage_relay_subscribe_fn;
+    quicrq_manage_relay_cnx_close_fn manage_relay_cnx_close_fn;
+    quicrq_manage_relay_feedback_fn manage_relay_feedback_fn;
+    quicrq_manage_relay_warm_fn manage_relay_warm_fn;
+    quicrq_timer_t relay_warm_timer;
     /* Extra repeat option */
     int extra_repeat_on_nack : 1;
     int extra_repeat_after_received_delayed : 1;
@@ -607,6 +1207,38 @@ struct st_quicrq_ctx_t {
     uint64_t useless_fragments;
     /* Control how enable congestion control -- mostly for testability */
     quicrq_congestion_control_enum congestion_control_mode;
+    /* Scheduling of datagrams between media streams of a connection */
+    quicrq_datagram_scheduler_enum datagram_scheduler_mode;
+    /* Pack several fragments per datagram */
+    int is_datagram_coalescing;
+    /* Ask the senders of datagrams to use compact headers */
+    int is_compact_datagram_header;
+    /* Size of the datagram fragments asked to the senders and used by the local sources, or 0 */
+    size_t fragment_size;
+    /* Datagram publishers start on the arrival cursor, without object tree */
+    int is_arrival_cursor_enabled;
+    /* Number of fragments protected by each FEC datagram, or 0 */
+    size_t datagram_fec_window;
+    /* Memory pools for per fragment structures */
+    quicrq_pool_t pools[quicrq_pool_max];
+    /* Latency added by this node, summed over all caches */
+    quicrq_hop_latency_t latency;
+    /* Deadlines of extra repeats and cache management */
+    quicrq_timer_heap_t timers;
+    /* Objects queued from other threads, see quicrq_publish_object_queued */
+    uint64_t is_publish_queue_pending;
+    quicrq_publish_wakeup_fn publish_wakeup_fn;
+    void* publish_wakeup_ctx;
+    /* Relay shards: feeds from the caches of this context, and feeds to mirror caches in this context */
+    struct st_quicrq_shard_feed_t* first_shard_feed_out;
+    struct st_quicrq_shard_feed_t* first_shard_feed_in;
+    /* Feeds created by the source threads, waiting to be attached in this context */
+    quicrq_mpsc_queue_t shard_requests;
+    uint64_t is_shard_request_pending;
+    /* Shard peers, to which the sources published in this context are mirrored */
+    quicrq_ctx_t** shard_peers;
+    size_t nb_shard_peers;
+    size_t shard_peer_ring_size;
 };
 
 quicrq_stream_ctx_t* quicrq_find_or_create_stream(
@@ -614,6 +1246,12 @@ quicrq_stream_ctx_t* quicrq_find_or_create_stream(
     quicrq_cnx_ctx_t* cnx_ctx,
     int should_create);
 quicrq_stream_ctx_t* quicrq_create_stream_context(quicrq_cnx_ctx_t* cnx_ctx, uint64_t stream_id);
+quicrq_stream_ctx_t* quicrq_find_stream_ctx_for_datagram(quicrq_cnx_ctx_t* cnx_ctx, uint64_t media_id, int is_sender);
+/* Tracks of a batch, and activation of the control stream of a media flow,
+ * which for a track is the stream of the batch. */
+quicrq_stream_ctx_t* quicrq_create_track_context(quicrq_stream_ctx_t* batch_ctx, uint64_t media_id);
+int quicrq_mark_control_stream_active(quicrq_stream_ctx_t* stream_ctx);
+int quicrq_stream_set_feedback(quicrq_stream_ctx_t* stream_ctx, uint8_t max_flags, uint64_t target_bitrate);
 
 quicrq_uni_stream_ctx_t* quicrq_find_or_create_uni_stream(
     uint64_t stream_id,
@@ -622,6 +1260,8 @@ quicrq_uni_stream_ctx_t* quicrq_find_or_create_uni_stream(
     int should_create);
 
 void quicrq_chain_uni_stream_to_control_stream(quicrq_uni_stream_ctx_t* uni_stream_ctx, quicrq_stream_ctx_t* stream_ctx);
+quicrq_stream_ctx_t* quicrq_get_control_stream_for_media_id(quicrq_cnx_ctx_t* cnx, uint64_t media_id);
+int quicrq_receive_warp_or_rush_stream_data(quicrq_cnx_ctx_t* cnx_ctx, quicrq_uni_stream_ctx_t* uni_stream_ctx, uint8_t* bytes, size_t length, int is_fin);
 
 void quicrq_delete_stream_ctx(quicrq_cnx_ctx_t* cnx_ctx, quicrq_stream_ctx_t* stream_ctx);
 void quicrq_delete_uni_stream_ctx(quicrq_cnx_ctx_t* cnx_ctx, quicrq_uni_stream_ctx_t* stream_ctx);
@@ -666,6 +1306,15 @@ const char* quicrq_transport_mode_to_string(quicrq_transport_mode_enum transport
 
 /* Evaluation of congestion state */
 int quicrq_congestion_check_per_cnx(quicrq_cnx_ctx_t* cnx_ctx, uint8_t flags, int has_backlog, uint64_t current_time);
+int quicrq_congestion_check_rate_per_cnx(quicrq_cnx_ctx_t* cnx_ctx, uint8_t flags, uint64_t length, int has_backlog, uint64_t current_time);
+void quicrq_congestion_rate_epoch(quicrq_cnx_congestion_state_t* congestion, uint64_t rtt, uint64_t pacing_rate, uint64_t current_time);
+int quicrq_feedback_should_skip(quicrq_stream_ctx_t* stream_ctx, uint64_t object_id, uint8_t flags, uint64_t length, uint64_t current_time);
+void quicrq_feedback_set(quicrq_stream_ctx_t* stream_ctx, uint8_t max_flags, uint64_t target_bitrate, uint64_t current_time);
+
+/* Scheduling of datagrams between the media streams of a connection */
+quicrq_stream_ctx_t* quicrq_datagram_scheduler_first(quicrq_cnx_ctx_t* cnx_ctx);
+quicrq_stream_ctx_t* quicrq_datagram_scheduler_next(quicrq_cnx_ctx_t* cnx_ctx, quicrq_stream_ctx_t* stream_ctx, int media_was_sent);
+void quicrq_datagram_scheduler_remove(quicrq_cnx_ctx_t* cnx_ctx, quicrq_stream_ctx_t* stream_ctx);
 
 #ifdef __cplusplus
 }
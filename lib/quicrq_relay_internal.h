@@ -51,17 +51,84 @@
 typedef struct st_quicrq_relay_consumer_context_t {
     quicrq_ctx_t* qr_ctx;
     quicrq_fragment_cache_t* cache_ctx;
+    size_t upstream_index;
+    unsigned int is_upstream_subscription : 1;
+    unsigned int is_resubscribed : 1;
 } quicrq_relay_consumer_context_t;
 
-typedef struct st_quicrq_relay_context_t {
+/* Consumer of the media received by the relay, feeding the relay cache */
+int quicrq_relay_consumer_cb(
+    quicrq_media_consumer_enum action,
+    void* media_ctx,
+    uint64_t current_time,
+    const uint8_t* data,
+    uint64_t group_id,
+    uint64_t object_id,
+    uint64_t offset,
+    uint64_t queue_delay,
+    uint8_t flags,
+    uint64_t nb_objects_previous_group,
+    uint64_t object_length,
+    size_t data_length);
+
+/* Upstream servers of a relay.
+ * A relay may be configured with several upstream origins or relays. Each
+ * URL is assigned to an upstream by hashing the URL, and the subscriptions
+ * assigned to the same upstream are spread over up to nb_cnx_per_upstream
+ * connections, to avoid head of line blocking and congestion window limits
+ * of a single connection.
+ *
+ * When an upstream connection is lost, the upstream is marked down until
+ * down_until, and the subscriptions that were not finished are sent again
+ * to the next available upstream, starting at the next object expected
+ * in the cache. Subscribers to the cache do not see the switch.
+ */
+#define QUICRQ_RELAY_CNX_PER_UPSTREAM_MAX 8
+#define QUICRQ_RELAY_UPSTREAM_RETRY_DELAY 2000000ull
+
+typedef struct st_quicrq_relay_upstream_t {
     const char* sni;
     struct sockaddr_storage server_addr;
+    quicrq_cnx_ctx_t* cnx_ctx[QUICRQ_RELAY_CNX_PER_UPSTREAM_MAX];
+    uint64_t down_until;
+    uint64_t nb_failovers;
+    uint64_t nb_warm_connections; /* Connections opened in advance, see quicrq_relay_warm_upstreams */
+} quicrq_relay_upstream_t;
+
+typedef struct st_quicrq_relay_context_t {
     quicrq_ctx_t* qr_ctx;
-    quicrq_cnx_ctx_t* cnx_ctx;
+    quicrq_relay_upstream_t* upstreams;
+    size_t nb_upstreams;
+    size_t nb_cnx_per_upstream;
     quicrq_transport_mode_enum transport_mode;
     unsigned int is_origin_only : 1;
+    unsigned int is_warm_upstreams : 1;
 } quicrq_relay_context_t;
 
+/* Selection of the upstream connection serving an URL.
+ * The upstream is chosen by hashing the URL, skipping upstreams that are
+ * marked down or equal to excluded_index. If no upstream is available and
+ * excluded_index is SIZE_MAX, the hashed upstream is used anyway, as a
+ * relay with a single upstream always did. The connection is created if
+ * needed. Returns NULL if no connection can be found.
+ */
+quicrq_cnx_ctx_t* quicrq_relay_get_upstream_cnx(quicrq_relay_context_t* relay_ctx, const uint8_t* url, size_t url_length,
+    size_t excluded_index, uint64_t current_time, size_t* p_upstream_index);
+
+/* Tracking of connection closure: forget the upstream connection, and
+ * mark the upstream as down if the connection was lost.
+ */
+void quicrq_relay_cnx_close(quicrq_ctx_t* qr_ctx, quicrq_cnx_ctx_t* cnx_ctx, quicrq_media_close_reason_enum close_reason);
+
+/* Forwarding of the aggregated subscriber feedback to the upstream subscription.
+ */
+void quicrq_relay_forward_feedback(quicrq_ctx_t* qr_ctx, quicrq_media_source_ctx_t* srce_ctx, uint8_t max_flags, uint64_t target_bitrate);
+
+/* Opening of the warm upstream connections that are missing. Returns the
+ * time at which an upstream marked down can be connected again, or UINT64_MAX.
+ */
+uint64_t quicrq_relay_warm_upstreams(quicrq_ctx_t* qr_ctx, uint64_t current_time);
+
 /* Management of the relay cache
  */
 uint64_t quicrq_manage_relay_cache(quicrq_ctx_t* qr_ctx, uint64_t current_time);
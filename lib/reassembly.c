@@ -15,8 +15,22 @@
   * indexed by the object id and object offset. When a new fragment is received
   * the code will check whether the object is already present, and then whether the
   * fragment for that object has already arrived.
+  *
+  * Objects are normally reassembled in place: the buffer of the object is allocated
+  * when the first fragment arrives, each fragment is copied at its offset, and
+  * a bitmap of the received bytes tracks which parts are already present. Objects
+  * larger than QUICRQ_REASSEMBLY_IN_PLACE_MAX are kept as a list of packets, and
+  * copied in a contiguous buffer once complete, so that a peer cannot trigger
+  * large allocations by announcing a large object length. The buffers of the
+  * objects reassembled in place are also limited per context by the in place
+  * budget: once it is used up, the next objects are kept as packets, whose size
+  * is that of the data actually received. Packets are also kept when the
+  * context uses fragment views, since the application then reads them in place.
   */
 
+#define QUICRQ_REASSEMBLY_IN_PLACE_MAX 0x1000000
+#define QUICRQ_REASSEMBLY_IN_PLACE_BUDGET 0x2000000
+
 /* Define data types used by implementation of public reassembly API */
 
 typedef struct st_quicrq_reassembly_packet_t {
@@ -42,6 +56,9 @@ typedef struct st_quicrq_reassembly_object_t {
     uint64_t data_received;
     uint64_t last_update_time;
     uint8_t* reassembled;
+    int is_reassembled_in_packet; /* reassembled points to the data of the single packet, or to the in place data */
+    uint8_t* in_place_data; /* Object buffer allocated on the first fragment, followed by the received bitmap */
+    uint64_t* received_bitmap; /* One bit per byte of the object */
 } quicrq_reassembly_object_t;
 
 /* manage the splay of objects waiting reassembly */
@@ -78,8 +95,11 @@ void quicrq_reassembly_init(quicrq_reassembly_context_t* object_list)
 {
     picosplay_init_tree(&object_list->object_tree, quicrq_object_node_compare,
         quicrq_object_node_create, quicrq_object_node_delete, quicrq_object_node_value);
+    object_list->in_place_budget = QUICRQ_REASSEMBLY_IN_PLACE_BUDGET;
 }
 
+static void quicrq_reassembly_object_delete(quicrq_reassembly_context_t* reassembly_ctx, quicrq_reassembly_object_t* object);
+
 /* Free the reassembly context
  */
 void quicrq_reassembly_release(quicrq_reassembly_context_t* reassembly_ctx)
@@ -109,7 +129,14 @@ void quicrq_reassembly_release(quicrq_reassembly_context_t* reassembly_ctx)
         DBG_PRINTF("Reassembly contains %d objects, %d incomplete", nb_objects, nb_incomplete);
     }
 
-    picosplay_empty_tree(&reassembly_ctx->object_tree);
+    /* Delete the objects, which also frees their packets */
+    while (reassembly_ctx->object_tree.root != NULL) {
+        quicrq_reassembly_object_delete(reassembly_ctx,
+            (quicrq_reassembly_object_t*)quicrq_object_node_value(reassembly_ctx->object_tree.root));
+    }
+    if (reassembly_ctx->views != NULL) {
+        free(reassembly_ctx->views);
+    }
     memset(reassembly_ctx, 0, sizeof(quicrq_reassembly_context_t));
 }
 
@@ -140,6 +167,7 @@ uint64_t quicrq_reassembly_get_object_count(quicrq_reassembly_context_t* object_
 
 /* Management of the list of objects undergoing reassembly, object-id based logic */
 static quicrq_reassembly_packet_t* quicrq_reassembly_object_create_packet(
+    quicrq_reassembly_context_t* reassembly_ctx,
     quicrq_reassembly_object_t* object,
     quicrq_reassembly_packet_t* previous_packet,
     uint64_t current_time,
@@ -150,7 +178,7 @@ static quicrq_reassembly_packet_t* quicrq_reassembly_object_create_packet(
     quicrq_reassembly_packet_t* packet = NULL;
     size_t packet_size = sizeof(quicrq_reassembly_packet_t) + data_length;
     if (packet_size >= sizeof(quicrq_reassembly_packet_t)) {
-        packet = (quicrq_reassembly_packet_t*)malloc(packet_size);
+        packet = (quicrq_reassembly_packet_t*)quicrq_pool_alloc_data(reassembly_ctx->qr_ctx, packet_size);
         if (packet != NULL) {
             memset(packet, 0, sizeof(quicrq_reassembly_packet_t));
             packet->current_time = current_time;
@@ -182,10 +210,80 @@ static quicrq_reassembly_packet_t* quicrq_reassembly_object_create_packet(
     return packet;
 }
 
+/* Size of the in place buffer, including the bitmap of received bytes. */
+static size_t quicrq_reassembly_in_place_size(uint64_t object_length)
+{
+    size_t data_size = ((size_t)object_length + 7) & ~((size_t)7);
+    return data_size + (((size_t)object_length + 63) / 64) * sizeof(uint64_t);
+}
+
+/* Allocate the in place buffer of the object, if the object is not too large
+ * and the budget of the context allows it. Otherwise, the object is kept as
+ * a list of packets.
+ */
+static int quicrq_reassembly_in_place_init(quicrq_reassembly_context_t* reassembly_ctx, quicrq_reassembly_object_t* object)
+{
+    int ret = 0;
+
+    if (!reassembly_ctx->use_fragment_views &&
+        object->object_length > 0 && object->object_length <= QUICRQ_REASSEMBLY_IN_PLACE_MAX &&
+        reassembly_ctx->in_place_bytes + quicrq_reassembly_in_place_size(object->object_length) <= reassembly_ctx->in_place_budget) {
+        size_t alloc_size = quicrq_reassembly_in_place_size(object->object_length);
+        size_t data_size = ((size_t)object->object_length + 7) & ~((size_t)7);
+
+        object->in_place_data = (uint8_t*)quicrq_pool_alloc_data(reassembly_ctx->qr_ctx, alloc_size);
+        if (object->in_place_data == NULL) {
+            ret = -1;
+        }
+        else {
+            object->received_bitmap = (uint64_t*)(object->in_place_data + data_size);
+            memset(object->received_bitmap, 0, alloc_size - data_size);
+            reassembly_ctx->in_place_bytes += alloc_size;
+        }
+    }
+    return ret;
+}
+
+static uint64_t quicrq_reassembly_popcount(uint64_t x)
+{
+    x = x - ((x >> 1) & 0x5555555555555555ull);
+    x = (x & 0x3333333333333333ull) + ((x >> 2) & 0x3333333333333333ull);
+    x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0Full;
+    return (x * 0x0101010101010101ull) >> 56;
+}
+
+/* Copy a fragment at its offset in the object, and mark the bytes as received.
+ * Only the bytes that were not received yet are counted in data_received.
+ */
+static void quicrq_reassembly_in_place_add(quicrq_reassembly_object_t* object, uint64_t current_time,
+    const uint8_t* data, uint64_t offset, size_t data_length)
+{
+    size_t first_bit = (size_t)offset;
+    size_t last_bit = (size_t)offset + data_length; /* Not included */
+
+    memcpy(object->in_place_data + first_bit, data, data_length);
+    while (first_bit < last_bit) {
+        size_t word = first_bit / 64;
+        size_t shift = first_bit % 64;
+        size_t nb_bits = 64 - shift;
+        uint64_t mask;
+
+        if (nb_bits > last_bit - first_bit) {
+            nb_bits = last_bit - first_bit;
+        }
+        mask = (nb_bits == 64) ? UINT64_MAX : (((1ull << nb_bits) - 1) << shift);
+        object->data_received += quicrq_reassembly_popcount(mask & ~object->received_bitmap[word]);
+        object->received_bitmap[word] |= mask;
+        first_bit += nb_bits;
+    }
+    object->last_update_time = current_time;
+}
+
 static quicrq_reassembly_object_t* quicrq_reassembly_object_create(quicrq_reassembly_context_t* reassembly_ctx,
     uint64_t group_id, uint64_t object_id)
 {
-    quicrq_reassembly_object_t* object = (quicrq_reassembly_object_t*)malloc(sizeof(quicrq_reassembly_object_t));
+    quicrq_reassembly_object_t* object = (quicrq_reassembly_object_t*)quicrq_pool_alloc_data(reassembly_ctx->qr_ctx,
+        sizeof(quicrq_reassembly_object_t));
     if (object != NULL) {
         memset(object, 0, sizeof(quicrq_reassembly_object_t));
         object->group_id = group_id;
@@ -200,23 +298,30 @@ static void quicrq_reassembly_object_delete(quicrq_reassembly_context_t* reassem
     /* Free the object's resource */
     quicrq_reassembly_packet_t* packet;
 
-    if (object->reassembled != NULL) {
+    if (object->reassembled != NULL && !object->is_reassembled_in_packet) {
         free(object->reassembled);
     }
 
+    if (object->in_place_data != NULL) {
+        quicrq_pool_free_data(reassembly_ctx->qr_ctx, object->in_place_data,
+            quicrq_reassembly_in_place_size(object->object_length));
+        reassembly_ctx->in_place_bytes -= quicrq_reassembly_in_place_size(object->object_length);
+    }
+
     while ((packet = object->first_packet) != NULL) {
         object->first_packet = packet->next_packet;
-        free(packet);
+        quicrq_pool_free_data(reassembly_ctx->qr_ctx, packet, sizeof(quicrq_reassembly_packet_t) + packet->data_length);
     }
 
     /* Remove the object from the list */
     picosplay_delete_hint(&reassembly_ctx->object_tree, &object->object_node);
 
     /* and free the memory */
-    free(object);
+    quicrq_pool_free_data(reassembly_ctx->qr_ctx, object, sizeof(quicrq_reassembly_object_t));
 }
 
 static int quicrq_reassembly_object_add_packet(
+    quicrq_reassembly_context_t* reassembly_ctx,
     quicrq_reassembly_object_t* object,
     uint64_t current_time,
     const uint8_t* data,
@@ -232,7 +337,7 @@ static int quicrq_reassembly_object_add_packet(
             /* filling a hole */
             if (offset + data_length <= packet->offset) {
                 /* No overlap. Just insert the packet after the previous one */
-                quicrq_reassembly_packet_t* new_packet = quicrq_reassembly_object_create_packet(object, previous_packet, current_time, data, offset, data_length);
+                quicrq_reassembly_packet_t* new_packet = quicrq_reassembly_object_create_packet(reassembly_ctx, object, previous_packet, current_time, data, offset, data_length);
                 if (new_packet == NULL) {
                     ret = -1;
                 }
@@ -244,7 +349,7 @@ static int quicrq_reassembly_object_add_packet(
             else if (offset < packet->offset) {
                 /* partial overlap. Create a packet for the non overlapping part, then retain the bytes at the end. */
                 size_t consumed = (size_t)(packet->offset - offset);
-                quicrq_reassembly_packet_t* new_packet = quicrq_reassembly_object_create_packet(object, previous_packet, current_time, data, offset, consumed);
+                quicrq_reassembly_packet_t* new_packet = quicrq_reassembly_object_create_packet(reassembly_ctx, object, previous_packet, current_time, data, offset, consumed);
                 if (new_packet == NULL) {
                     ret = -1;
                     break;
@@ -279,7 +384,7 @@ static int quicrq_reassembly_object_add_packet(
     /* All packets in store have been checked */
     if (ret == 0 && data_length > 0) {
         /* Some of the incoming data was not inserted */
-        quicrq_reassembly_packet_t* new_packet = quicrq_reassembly_object_create_packet(object, previous_packet, current_time, data, offset, data_length);
+        quicrq_reassembly_packet_t* new_packet = quicrq_reassembly_object_create_packet(reassembly_ctx, object, previous_packet, current_time, data, offset, data_length);
         if (new_packet == NULL) {
             ret = -1;
         }
@@ -291,7 +396,7 @@ static int quicrq_reassembly_object_add_packet(
     return ret;
 }
 
-static int quicrq_reassembly_object_reassemble(quicrq_reassembly_object_t* object)
+static int quicrq_reassembly_object_reassemble(quicrq_reassembly_context_t* reassembly_ctx, quicrq_reassembly_object_t* object)
 {
     int ret = 0;
     /* Special case for zero length objects */
@@ -305,6 +410,11 @@ static int quicrq_reassembly_object_reassemble(quicrq_reassembly_object_t* objec
     else if (object->object_length == 0 || object->data_received != object->object_length) {
         ret = -1;
     }
+    else if (object->in_place_data != NULL) {
+        /* All the bytes were written in place, no copy needed */
+        object->reassembled = object->in_place_data;
+        object->is_reassembled_in_packet = 1;
+    }
     else if (object->first_packet == NULL || object->first_packet->offset != 0) {
         ret = -1;
     }
@@ -315,6 +425,32 @@ static int quicrq_reassembly_object_reassemble(quicrq_reassembly_object_t* objec
     else if (object->object_length > SIZE_MAX) {
         ret = -1;
     }
+    else if (object->first_packet == object->last_packet) {
+        /* The object was received in a single packet, no need to copy it. */
+        object->reassembled = object->first_packet->data;
+        object->is_reassembled_in_packet = 1;
+    }
+    else if (reassembly_ctx->use_fragment_views) {
+        /* The packets are passed in place, only verify that they are contiguous */
+        uint64_t running_offset = 0;
+        quicrq_reassembly_packet_t* packet = object->first_packet;
+        while (packet != NULL && ret == 0) {
+            if (packet->offset != running_offset) {
+                ret = -1;
+            }
+            else {
+                running_offset += packet->data_length;
+                packet = packet->next_packet;
+            }
+        }
+        if (ret == 0 && running_offset != object->object_length) {
+            ret = -1;
+        }
+        if (ret == 0) {
+            object->reassembled = object->first_packet->data;
+            object->is_reassembled_in_packet = 1;
+        }
+    }
     else {
         object->reassembled = (uint8_t*)malloc((size_t)object->object_length);
         if (object->reassembled == NULL) {
@@ -348,6 +484,52 @@ static int quicrq_reassembly_object_reassemble(quicrq_reassembly_object_t* objec
     return ret;
 }
 
+/* Pass a reassembled object to the application. If fragment views are used,
+ * first describe the packets of the object in the views of the context.
+ */
+static int quicrq_reassembly_object_deliver(quicrq_reassembly_context_t* reassembly_ctx, quicrq_reassembly_object_t* object,
+    uint64_t current_time, quicrq_reassembly_object_mode_enum object_mode, quicrq_reassembly_object_ready_fn ready_fn,
+    void* app_media_ctx)
+{
+    int ret = 0;
+
+    reassembly_ctx->nb_views = 0;
+    if (reassembly_ctx->use_fragment_views) {
+        size_t nb_packets = 0;
+        quicrq_reassembly_packet_t* packet = object->first_packet;
+
+        while (packet != NULL) {
+            nb_packets++;
+            packet = packet->next_packet;
+        }
+        if (nb_packets > reassembly_ctx->views_alloc) {
+            quicrq_object_fragment_view_t* views = (quicrq_object_fragment_view_t*)malloc(
+                nb_packets * sizeof(quicrq_object_fragment_view_t));
+            if (views == NULL) {
+                ret = -1;
+            }
+            else {
+                if (reassembly_ctx->views != NULL) {
+                    free(reassembly_ctx->views);
+                }
+                reassembly_ctx->views = views;
+                reassembly_ctx->views_alloc = nb_packets;
+            }
+        }
+        for (packet = object->first_packet; ret == 0 && packet != NULL; packet = packet->next_packet) {
+            reassembly_ctx->views[reassembly_ctx->nb_views].data = packet->data;
+            reassembly_ctx->views[reassembly_ctx->nb_views].data_length = packet->data_length;
+            reassembly_ctx->nb_views++;
+        }
+    }
+    if (ret == 0) {
+        ret = ready_fn(app_media_ctx, current_time, object->group_id, object->object_id, object->flags, object->reassembled,
+            (size_t)object->object_length, object_mode);
+    }
+    reassembly_ctx->nb_views = 0;
+    return ret;
+}
+
 int quicrq_reassembly_update_start_point(quicrq_reassembly_context_t* reassembly_ctx,
     uint64_t current_time,
     quicrq_reassembly_object_ready_fn ready_fn,
@@ -382,8 +564,8 @@ int quicrq_reassembly_update_start_point(quicrq_reassembly_context_t* reassembly
             break;
         } 
         /* Submit the object in order */
-        ret = ready_fn(app_media_ctx, current_time, object->group_id, object->object_id, object->flags, object->reassembled,
-            (size_t)object->object_length, quicrq_reassembly_object_repair);
+        ret = quicrq_reassembly_object_deliver(reassembly_ctx, object, current_time, quicrq_reassembly_object_repair,
+            ready_fn, app_media_ctx);
         /* delete the object that was just repaired. */
         quicrq_reassembly_object_delete(reassembly_ctx, object);
         /* update the next_object id */
@@ -426,9 +608,15 @@ int quicrq_reassembly_input(
         if (object == NULL) {
             /* Create a media object for reassembly */
             object = quicrq_reassembly_object_create(reassembly_ctx, group_id, object_id);
-            object->queue_delay = queue_delay;
-            object->flags = flags;
-            object->object_length = object_length;
+            if (object != NULL) {
+                object->queue_delay = queue_delay;
+                object->flags = flags;
+                object->object_length = object_length;
+                if (quicrq_reassembly_in_place_init(reassembly_ctx, object) != 0) {
+                    quicrq_reassembly_object_delete(reassembly_ctx, object);
+                    object = NULL;
+                }
+            }
         }
         else {
             if (object->queue_delay < queue_delay) {
@@ -456,7 +644,12 @@ int quicrq_reassembly_input(
             }
             if (ret == 0) {
                 /* Insert the object at the proper location */
-                ret = quicrq_reassembly_object_add_packet(object, current_time, data, offset, data_length);
+                if (object->in_place_data != NULL) {
+                    quicrq_reassembly_in_place_add(object, current_time, data, offset, data_length);
+                }
+                else {
+                    ret = quicrq_reassembly_object_add_packet(reassembly_ctx, object, current_time, data, offset, data_length);
+                }
                 if (ret != 0) {
                     DBG_PRINTF("Add packet, ret = %d", ret);
                 }
@@ -479,10 +672,11 @@ int quicrq_reassembly_input(
 
                     if (object->reassembled == NULL) {
                         /* Reassemble and verify -- maybe should do that in real time instead of at the end? */
-                        ret = quicrq_reassembly_object_reassemble(object);
+                        ret = quicrq_reassembly_object_reassemble(reassembly_ctx, object);
                         if (ret == 0) {
                             /* If the object is fully received, pass it to the application, indicating sequence or not. */
-                            ret = ready_fn(app_media_ctx, current_time, group_id, object_id, flags, object->reassembled, (size_t)object->object_length, object_mode);
+                            ret = quicrq_reassembly_object_deliver(reassembly_ctx, object, current_time, object_mode,
+                                ready_fn, app_media_ctx);
                         }
                         if (ret == 0 && object_mode == quicrq_reassembly_object_in_sequence) {
                             /* delete the object that was just reassembled. */
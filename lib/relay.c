@@ -33,6 +33,60 @@
  * may need to be reflected in the contract between connection and sources.
  */
 
+/* Failover of upstream subscriptions.
+ * When the connection to an upstream is lost before the media is finished,
+ * the relay subscribes to the same URL on another upstream, asking to start
+ * at the next object expected in the cache. Fragments received twice are
+ * ignored by the cache, so the readers of the cache do not see a gap.
+ */
+static int quicrq_relay_is_cnx_lost(uint64_t close_reason)
+{
+    return (close_reason == quicrq_media_close_quic_connection ||
+        close_reason == quicrq_media_close_remote_application);
+}
+
+static int quicrq_relay_resubscribe(quicrq_relay_consumer_context_t* cons_ctx, uint64_t current_time)
+{
+    int ret = 0;
+    quicrq_relay_context_t* relay_ctx = cons_ctx->qr_ctx->relay_ctx;
+    quicrq_media_source_ctx_t* srce_ctx = cons_ctx->cache_ctx->srce_ctx;
+    quicrq_cnx_ctx_t* cnx_ctx = NULL;
+    size_t upstream_index = 0;
+
+    if (relay_ctx == NULL || srce_ctx == NULL) {
+        ret = -1;
+    }
+    else if ((cnx_ctx = quicrq_relay_get_upstream_cnx(relay_ctx, srce_ctx->media_url, srce_ctx->media_url_length,
+        cons_ctx->upstream_index, current_time, &upstream_index)) == NULL) {
+        /* No other upstream available */
+        ret = -1;
+    }
+    else {
+        quicrq_subscribe_intent_t intent = { quicrq_subscribe_intent_start_point, 0, 0 };
+        quicrq_stream_ctx_t* stream_ctx = NULL;
+
+        intent.start_group_id = cons_ctx->cache_ctx->next_group_id;
+        intent.start_object_id = cons_ctx->cache_ctx->next_object_id;
+        ret = quicrq_cnx_subscribe_media_ex(cnx_ctx, srce_ctx->media_url, srce_ctx->media_url_length,
+            relay_ctx->transport_mode, &intent, quicrq_relay_consumer_cb, cons_ctx, &stream_ctx);
+        if (ret == 0) {
+            char buffer[256];
+            relay_ctx->upstreams[cons_ctx->upstream_index].nb_failovers++;
+            cons_ctx->upstream_index = upstream_index;
+            cons_ctx->is_resubscribed = 1;
+            cons_ctx->cache_ctx->subscribe_stream_id = stream_ctx->stream_id;
+            if (srce_ctx->is_feedback_forwarded) {
+                /* Ask the new upstream for the same layers */
+                (void)quicrq_stream_set_feedback(stream_ctx, srce_ctx->feedback_max_flags, srce_ctx->feedback_target_bitrate);
+            }
+            quicrq_log_message(cnx_ctx, "Failover of URL: %s to upstream %zu, from group %" PRIu64 ", object %" PRIu64,
+                quicrq_uint8_t_to_text(srce_ctx->media_url, srce_ctx->media_url_length, buffer, 256),
+                upstream_index, intent.start_group_id, intent.start_object_id);
+        }
+    }
+    return ret;
+}
+
 int quicrq_relay_consumer_cb(
     quicrq_media_consumer_enum action,
     void* media_ctx,
@@ -84,60 +138,77 @@ int quicrq_relay_consumer_cb(
         ret = quicrq_fragment_cache_set_real_time_cache(cons_ctx->cache_ctx);
         break;
     case quicrq_media_start_point:
-        /* Document the start point, and clean the cache of data before that point */
-        ret = quicrq_fragment_cache_learn_start_point(cons_ctx->cache_ctx, group_id, object_id);
+        if (cons_ctx->is_resubscribed &&
+            (group_id < cons_ctx->cache_ctx->next_group_id ||
+            (group_id == cons_ctx->cache_ctx->next_group_id && object_id <= cons_ctx->cache_ctx->next_object_id))) {
+            /* After a failover, the new upstream confirms a start point already covered by the cache. */
+            ret = 0;
+        }
+        else {
+            /* Document the start point, and clean the cache of data before that point */
+            ret = quicrq_fragment_cache_learn_start_point(cons_ctx->cache_ctx, group_id, object_id);
+        }
         break;
     case quicrq_media_close:
-        /* Document the final object */
-        if (cons_ctx->cache_ctx->final_group_id == 0 && cons_ctx->cache_ctx->final_object_id == 0) {
-            /* cache delete time set in the future to allow for reconnection. */
-            cons_ctx->cache_ctx->cache_delete_time = current_time + 
-                ((cons_ctx->qr_ctx->cache_duration_max > QUICRQ_CACHE_INITIAL_DURATION)?
-                cons_ctx->qr_ctx->cache_duration_max:QUICRQ_CACHE_INITIAL_DURATION);
-            /* Document the last group_id and object_id that were fully received. */
-            if (cons_ctx->cache_ctx->next_offset == 0) {
-                cons_ctx->cache_ctx->final_group_id = cons_ctx->cache_ctx->next_group_id;
-                cons_ctx->cache_ctx->final_object_id = cons_ctx->cache_ctx->next_object_id;
-            }
-            else  if (cons_ctx->cache_ctx->next_object_id > 1) {
-                cons_ctx->cache_ctx->final_group_id = cons_ctx->cache_ctx->next_group_id;
-                cons_ctx->cache_ctx->final_object_id = cons_ctx->cache_ctx->next_object_id - 1;
-            }
-            else {
-                /* find the last object that was fully received. If there is none,
-                 * leave the final_group_id and final_object_id
-                 */
-                quicrq_cached_fragment_t key = { 0 };
-                picosplay_node_t* fragment_node = NULL;
-                quicrq_cached_fragment_t* fragment = NULL;
-
-                key.group_id = cons_ctx->cache_ctx->next_group_id;
-                key.object_id = 0;
-                key.offset = 0;
-                fragment_node = picosplay_find_previous(&cons_ctx->cache_ctx->fragment_tree, &key);
-                if (fragment_node != NULL) {
-                    fragment = (quicrq_cached_fragment_t*)quicrq_fragment_cache_node_value(fragment_node);
+        /* The close reason is passed in the object length parameter.
+         * If the upstream connection was lost, move the subscription to another upstream
+         * and keep the cache open. */
+        if (cons_ctx->is_upstream_subscription && quicrq_relay_is_cnx_lost(object_length) &&
+            quicrq_relay_resubscribe(cons_ctx, current_time) == 0) {
+            /* The cache is now fed by the new subscription, the consumer context is kept. */
+        }
+        else {
+            /* Document the final object */
+            if (cons_ctx->cache_ctx->final_group_id == 0 && cons_ctx->cache_ctx->final_object_id == 0) {
+                /* cache delete time set in the future to allow for reconnection. */
+                cons_ctx->cache_ctx->cache_delete_time = current_time + 
+                    ((cons_ctx->qr_ctx->cache_duration_max > QUICRQ_CACHE_INITIAL_DURATION)?
+                    cons_ctx->qr_ctx->cache_duration_max:QUICRQ_CACHE_INITIAL_DURATION);
+                /* Document the last group_id and object_id that were fully received. */
+                if (cons_ctx->cache_ctx->next_offset == 0) {
+                    cons_ctx->cache_ctx->final_group_id = cons_ctx->cache_ctx->next_group_id;
+                    cons_ctx->cache_ctx->final_object_id = cons_ctx->cache_ctx->next_object_id;
                 }
-                if (fragment != NULL) {
-                    cons_ctx->cache_ctx->final_group_id = fragment->group_id;
-                    cons_ctx->cache_ctx->final_object_id = fragment->object_id;
+                else  if (cons_ctx->cache_ctx->next_object_id > 1) {
+                    cons_ctx->cache_ctx->final_group_id = cons_ctx->cache_ctx->next_group_id;
+                    cons_ctx->cache_ctx->final_object_id = cons_ctx->cache_ctx->next_object_id - 1;
                 }
                 else {
-                    cons_ctx->cache_ctx->final_group_id = cons_ctx->cache_ctx->first_group_id;
-                    cons_ctx->cache_ctx->final_object_id = cons_ctx->cache_ctx->first_object_id;
+                    /* find the last object that was fully received. If there is none,
+                     * leave the final_group_id and final_object_id
+                     */
+                    quicrq_cached_fragment_t key = { 0 };
+                    picosplay_node_t* fragment_node = NULL;
+                    quicrq_cached_fragment_t* fragment = NULL;
+
+                    key.group_id = cons_ctx->cache_ctx->next_group_id;
+                    key.object_id = 0;
+                    key.offset = 0;
+                    fragment_node = picosplay_find_previous(&cons_ctx->cache_ctx->fragment_tree, &key);
+                    if (fragment_node != NULL) {
+                        fragment = (quicrq_cached_fragment_t*)quicrq_fragment_cache_node_value(fragment_node);
+                    }
+                    if (fragment != NULL) {
+                        cons_ctx->cache_ctx->final_group_id = fragment->group_id;
+                        cons_ctx->cache_ctx->final_object_id = fragment->object_id;
+                    }
+                    else {
+                        cons_ctx->cache_ctx->final_group_id = cons_ctx->cache_ctx->first_group_id;
+                        cons_ctx->cache_ctx->final_object_id = cons_ctx->cache_ctx->first_object_id;
+                    }
                 }
             }
-        }
-        else {
-            /* Nothing? */
-        }
-        cons_ctx->cache_ctx->is_feed_closed = 1;
+            else {
+                /* Nothing? */
+            }
+            cons_ctx->cache_ctx->is_feed_closed = 1;
         
-        /* Set the target delete date */
-        /* Notify consumers of the stream */
-        quicrq_source_wakeup(cons_ctx->cache_ctx->srce_ctx);
-        /* Free the media context resource */
-        free(media_ctx);
+            /* Set the target delete date */
+            /* Notify consumers of the stream */
+            quicrq_source_wakeup(cons_ctx->cache_ctx->srce_ctx);
+            /* Free the media context resource */
+            free(media_ctx);
+        }
         break;
 
     default:
@@ -168,21 +239,180 @@ int quicrq_relay_consumer_cb(
  * the server. Possibly, starting a connection if there is no server available.
  */
 
-int quicrq_relay_check_server_cnx(quicrq_relay_context_t* relay_ctx, quicrq_ctx_t* qr_ctx)
+quicrq_cnx_ctx_t* quicrq_relay_get_upstream_cnx(quicrq_relay_context_t* relay_ctx, const uint8_t* url, size_t url_length,
+    size_t excluded_index, uint64_t current_time, size_t* p_upstream_index)
 {
-    int ret = 0;
-    /* If there is no valid connection to the server, create one. */
-    /* TODO: check for expiring connection */
-    if (relay_ctx->cnx_ctx == NULL) {
-        relay_ctx->cnx_ctx = quicrq_create_client_cnx(qr_ctx, relay_ctx->sni,
-            (struct sockaddr*)&relay_ctx->server_addr);
+    quicrq_cnx_ctx_t* cnx_ctx = NULL;
+
+    if (relay_ctx->nb_upstreams > 0) {
+        uint64_t url_hash = quicrq_source_url_hash(url, url_length);
+        size_t preferred_index = (size_t)(url_hash % relay_ctx->nb_upstreams);
+        size_t upstream_index = SIZE_MAX;
+
+        for (size_t i = 0; upstream_index == SIZE_MAX && i < relay_ctx->nb_upstreams; i++) {
+            size_t candidate = (preferred_index + i) % relay_ctx->nb_upstreams;
+            if (candidate != excluded_index && relay_ctx->upstreams[candidate].down_until <= current_time) {
+                upstream_index = candidate;
+            }
+        }
+        if (upstream_index == SIZE_MAX && excluded_index == SIZE_MAX) {
+            upstream_index = preferred_index;
+        }
+        if (upstream_index != SIZE_MAX) {
+            /* If there is no valid connection to the server, create one. */
+            /* TODO: check for expiring connection */
+            quicrq_relay_upstream_t* upstream = &relay_ctx->upstreams[upstream_index];
+            size_t cnx_index = (size_t)((url_hash >> 32) % relay_ctx->nb_cnx_per_upstream);
+
+            if (upstream->cnx_ctx[cnx_index] == NULL) {
+                upstream->cnx_ctx[cnx_index] = quicrq_create_client_cnx(relay_ctx->qr_ctx, upstream->sni,
+                    (struct sockaddr*)&upstream->server_addr);
+            }
+            cnx_ctx = upstream->cnx_ctx[cnx_index];
+            *p_upstream_index = upstream_index;
+        }
+    }
+    return cnx_ctx;
+}
+
+void quicrq_relay_cnx_close(quicrq_ctx_t* qr_ctx, quicrq_cnx_ctx_t* cnx_ctx, quicrq_media_close_reason_enum close_reason)
+{
+    quicrq_relay_context_t* relay_ctx = qr_ctx->relay_ctx;
+
+    /* Only the client connections can be upstream connections. Closing one of
+     * the many subscriber connections does not need to look at the upstreams. */
+    if (relay_ctx != NULL && cnx_ctx->is_client) {
+        int is_upstream = 0;
+
+        for (size_t i = 0; i < relay_ctx->nb_upstreams; i++) {
+            quicrq_relay_upstream_t* upstream = &relay_ctx->upstreams[i];
+            for (size_t j = 0; j < relay_ctx->nb_cnx_per_upstream; j++) {
+                if (upstream->cnx_ctx[j] == cnx_ctx) {
+                    upstream->cnx_ctx[j] = NULL;
+                    is_upstream = 1;
+                    if (quicrq_relay_is_cnx_lost(close_reason)) {
+                        upstream->down_until = picoquic_get_quic_time(qr_ctx->quic) + QUICRQ_RELAY_UPSTREAM_RETRY_DELAY;
+                    }
+                }
+            }
+        }
+        if (is_upstream && relay_ctx->is_warm_upstreams && close_reason != quicrq_media_close_delete_context) {
+            /* The connection is opened again from the timer, not while it is being deleted */
+            if (quicrq_timer_set(qr_ctx, &qr_ctx->relay_warm_timer, picoquic_get_quic_time(qr_ctx->quic)) != 0) {
+                DBG_PRINTF("%s", "Cannot set the relay warm timer");
+            }
+        }
     }
-    if (relay_ctx->cnx_ctx == NULL) {
+}
+
+/* Warm upstream connections.
+ * By default, the connection to an upstream is created when the first subscribe
+ * or post needs it, and the first client of a cold relay waits for the handshake
+ * before the request is even sent. When warm upstreams are enabled, all the
+ * upstream connections are opened in advance, kept alive, and opened again when
+ * they close. If the upstream was lost, it is connected again once it is not
+ * marked down anymore. The connections use the session tickets of the quic
+ * context, so data sent before the end of the handshake is sent as 0-RTT.
+ */
+uint64_t quicrq_relay_warm_upstreams(quicrq_ctx_t* qr_ctx, uint64_t current_time)
+{
+    uint64_t next_time = UINT64_MAX;
+    quicrq_relay_context_t* relay_ctx = qr_ctx->relay_ctx;
+
+    if (relay_ctx != NULL && relay_ctx->is_warm_upstreams) {
+        for (size_t i = 0; i < relay_ctx->nb_upstreams; i++) {
+            quicrq_relay_upstream_t* upstream = &relay_ctx->upstreams[i];
+            for (size_t j = 0; j < relay_ctx->nb_cnx_per_upstream; j++) {
+                if (upstream->cnx_ctx[j] != NULL) {
+                    /* Already connected */
+                }
+                else if (upstream->down_until > current_time) {
+                    if (upstream->down_until < next_time) {
+                        next_time = upstream->down_until;
+                    }
+                }
+                else if ((upstream->cnx_ctx[j] = quicrq_create_client_cnx(qr_ctx, upstream->sni,
+                    (struct sockaddr*)&upstream->server_addr)) == NULL) {
+                    /* Cannot create the connection now, try again later */
+                    if (current_time + QUICRQ_RELAY_UPSTREAM_RETRY_DELAY < next_time) {
+                        next_time = current_time + QUICRQ_RELAY_UPSTREAM_RETRY_DELAY;
+                    }
+                }
+                else {
+                    upstream->nb_warm_connections++;
+                    picoquic_log_app_message(upstream->cnx_ctx[j]->cnx, "Warm connection %zu to upstream %zu, %s",
+                        j, i, (upstream->sni == NULL) ? "" : upstream->sni);
+                }
+            }
+        }
+    }
+    return next_time;
+}
+
+int quicrq_relay_set_warm_upstreams(quicrq_ctx_t* qr_ctx, int is_enabled)
+{
+    int ret = 0;
+
+    if (qr_ctx->relay_ctx == NULL) {
         ret = -1;
     }
+    else if (is_enabled) {
+        qr_ctx->relay_ctx->is_warm_upstreams = 1;
+        qr_ctx->manage_relay_warm_fn = quicrq_relay_warm_upstreams;
+        ret = quicrq_timer_set(qr_ctx, &qr_ctx->relay_warm_timer, picoquic_get_quic_time(qr_ctx->quic));
+    }
+    else {
+        qr_ctx->relay_ctx->is_warm_upstreams = 0;
+        qr_ctx->manage_relay_warm_fn = NULL;
+        quicrq_timer_cancel(qr_ctx, &qr_ctx->relay_warm_timer);
+    }
     return ret;
 }
 
+/* Find the stream of the upstream subscription that feeds a cache.
+ * The subscription is found on the upstream connections by the stream id
+ * documented in the cache, and must be received by the relay consumer of
+ * that cache. After a failover, it may not be on the connection that
+ * quicrq_relay_get_upstream_cnx selects for the URL. Connections are never
+ * created here.
+ */
+static quicrq_stream_ctx_t* quicrq_relay_find_upstream_subscription(quicrq_relay_context_t* relay_ctx, quicrq_media_source_ctx_t* srce_ctx)
+{
+    quicrq_stream_ctx_t* stream_ctx = NULL;
+
+    if (relay_ctx != NULL && srce_ctx->cache_ctx != NULL) {
+        for (size_t i = 0; stream_ctx == NULL && i < relay_ctx->nb_upstreams; i++) {
+            quicrq_relay_upstream_t* upstream = &relay_ctx->upstreams[i];
+            for (size_t j = 0; stream_ctx == NULL && j < relay_ctx->nb_cnx_per_upstream; j++) {
+                if (upstream->cnx_ctx[j] != NULL) {
+                    stream_ctx = quicrq_find_or_create_stream(srce_ctx->cache_ctx->subscribe_stream_id, upstream->cnx_ctx[j], 0);
+                    if (stream_ctx != NULL && (stream_ctx->is_sender || stream_ctx->consumer_fn != quicrq_relay_consumer_cb ||
+                        ((quicrq_relay_consumer_context_t*)stream_ctx->media_ctx)->cache_ctx != srce_ctx->cache_ctx)) {
+                        stream_ctx = NULL;
+                    }
+                }
+            }
+        }
+    }
+    return stream_ctx;
+}
+
+/* Forwarding of the subscriber feedback.
+ * The relay skips the layers that none of its subscribers want, see
+ * quicrq_feedback_should_skip, and asks the upstream for the aggregate of
+ * the subscribers feedback, so the upstream does not send these layers either.
+ */
+void quicrq_relay_forward_feedback(quicrq_ctx_t* qr_ctx, quicrq_media_source_ctx_t* srce_ctx, uint8_t max_flags, uint64_t target_bitrate)
+{
+    quicrq_stream_ctx_t* stream_ctx = quicrq_relay_find_upstream_subscription(qr_ctx->relay_ctx, srce_ctx);
+
+    if (stream_ctx != NULL && quicrq_stream_set_feedback(stream_ctx, max_flags, target_bitrate) == 0) {
+        char buffer[256];
+        quicrq_log_message(stream_ctx->cnx_ctx, "Forward feedback for URL: %s, max flags: 0x%x, target bitrate: %" PRIu64,
+            quicrq_uint8_t_to_text(srce_ctx->media_url, srce_ctx->media_url_length, buffer, 256), max_flags, target_bitrate);
+    }
+}
+
 quicrq_relay_consumer_context_t* quicrq_relay_create_cons_ctx(quicrq_ctx_t* qr_ctx)
 {
     quicrq_relay_consumer_context_t* cons_ctx = (quicrq_relay_consumer_context_t*)
@@ -211,10 +441,15 @@ int quicrq_relay_default_source_fn(void* default_source_ctx, quicrq_ctx_t* qr_ct
             ret = -1;
         }
         else if (!relay_ctx->is_origin_only) {
-            /* If there is no valid connection to the server, create one. */
-            ret = quicrq_relay_check_server_cnx(relay_ctx, qr_ctx);
+            /* Find the upstream connection for this URL, or create one. */
+            size_t upstream_index = 0;
+            quicrq_cnx_ctx_t* upstream_cnx_ctx = quicrq_relay_get_upstream_cnx(relay_ctx, url, url_length,
+                SIZE_MAX, picoquic_get_quic_time(qr_ctx->quic), &upstream_index);
 
-            if (ret == 0) {
+            if (upstream_cnx_ctx == NULL) {
+                ret = -1;
+            }
+            else {
                 /* Create a consumer context for the relay to server connection */
                 cons_ctx = quicrq_relay_create_cons_ctx(qr_ctx);
 
@@ -223,15 +458,17 @@ int quicrq_relay_default_source_fn(void* default_source_ctx, quicrq_ctx_t* qr_ct
                 }
                 else {
                     cons_ctx->cache_ctx = cache_ctx;
+                    cons_ctx->upstream_index = upstream_index;
+                    cons_ctx->is_upstream_subscription = 1;
 
                     /* Request a URL on a new stream on that connection */
-                    ret = quicrq_cnx_subscribe_media(relay_ctx->cnx_ctx, url, url_length,
+                    ret = quicrq_cnx_subscribe_media(upstream_cnx_ctx, url, url_length,
                         relay_ctx->transport_mode, quicrq_relay_consumer_cb, cons_ctx);
                     if (ret == 0){
                         /* Document the stream ID for that cache */
                         char buffer[256];
-                        cache_ctx->subscribe_stream_id = relay_ctx->cnx_ctx->last_stream->stream_id; 
-                        picoquic_log_app_message(relay_ctx->cnx_ctx->cnx, "Asking server for URL: %s on stream %" PRIu64,
+                        cache_ctx->subscribe_stream_id = upstream_cnx_ctx->last_stream->stream_id; 
+                        picoquic_log_app_message(upstream_cnx_ctx->cnx, "Asking server for URL: %s on stream %" PRIu64,
                             quicrq_uint8_t_to_text(url, url_length, buffer, 256), cache_ctx->subscribe_stream_id);
                     }
                 }
@@ -273,10 +510,15 @@ int quicrq_relay_consumer_init_callback(quicrq_stream_ctx_t* stream_ctx, const u
 
     quicrq_fragment_cache_t* cache_ctx = NULL;
     quicrq_relay_consumer_context_t* cons_ctx = NULL;
+    size_t upstream_index = 0;
+    /* Find the upstream connection for this URL, or create one. */
+    quicrq_cnx_ctx_t* upstream_cnx_ctx = quicrq_relay_get_upstream_cnx(relay_ctx, url, url_length,
+        SIZE_MAX, picoquic_get_quic_time(qr_ctx->quic), &upstream_index);
 
-    /* If there is no valid connection to the server, create one. */
-    ret = quicrq_relay_check_server_cnx(relay_ctx, qr_ctx);
-    if (ret == 0) {
+    if (upstream_cnx_ctx == NULL) {
+        ret = -1;
+    }
+    else {
         quicrq_media_source_ctx_t* srce_ctx = quicrq_find_local_media_source(qr_ctx, url, url_length);
 
         if (srce_ctx != NULL) {
@@ -285,9 +527,14 @@ int quicrq_relay_consumer_init_callback(quicrq_stream_ctx_t* stream_ctx, const u
                 ret = -1;
             }
             else {
-                /* Abandon the stream that was open to receive the media */
+                /* Abandon the stream that was open to receive the media, which
+                 * after a failover is not on the connection selected for the post */
                 char buffer[256];
-                quicrq_cnx_abandon_stream_id(relay_ctx->cnx_ctx, cache_ctx->subscribe_stream_id);
+                quicrq_stream_ctx_t* subscribe_ctx = quicrq_relay_find_upstream_subscription(relay_ctx, srce_ctx);
+
+                if (subscribe_ctx != NULL) {
+                    quicrq_cnx_abandon_stream(subscribe_ctx);
+                }
                 picoquic_log_app_message(stream_ctx->cnx_ctx->cnx, "Abandon subscription to URL: %s",
                     quicrq_uint8_t_to_text(url, url_length, buffer, 256));
             }
@@ -315,7 +562,7 @@ int quicrq_relay_consumer_init_callback(quicrq_stream_ctx_t* stream_ctx, const u
                 ret = -1;
             }
             else {
-                ret = quicrq_cnx_post_media(relay_ctx->cnx_ctx, url, url_length, relay_ctx->transport_mode);
+                ret = quicrq_cnx_post_media(upstream_cnx_ctx, url, url_length, relay_ctx->transport_mode);
                 if (ret != 0) {
                     /* TODO: unpublish the media context */
                     DBG_PRINTF("Should unpublish media context, ret = %d", ret);
@@ -348,15 +595,8 @@ int quicrq_relay_subscribe_notify(void* notify_ctx, const uint8_t* url, size_t u
     /* Retrieve the relay context */
     quicrq_ctx_t* qr_ctx = (quicrq_ctx_t*)notify_ctx;
     /* Find whether there is already a source with that name */
-    quicrq_media_source_ctx_t* srce_ctx = qr_ctx->first_source;
+    quicrq_media_source_ctx_t* srce_ctx = quicrq_find_local_media_source(qr_ctx, url, url_length);
 
-    while (srce_ctx != NULL) {
-        if (srce_ctx->media_url_length == url_length &&
-            memcmp(srce_ctx->media_url, url, url_length) == 0) {
-            break;
-        }
-        srce_ctx = srce_ctx->next_source;
-    }
     if (srce_ctx == NULL) {
         /* If there is not, add the corresponding file to the catch, as
          * if a subscribe to a file had been received. */
@@ -366,113 +606,108 @@ int quicrq_relay_subscribe_notify(void* notify_ctx, const uint8_t* url, size_t u
     return ret;
 }
 
-quicrq_stream_ctx_t* quicrq_relay_find_subscription(quicrq_ctx_t* qr_ctx, const uint8_t* url, size_t url_length)
-{
-    quicrq_stream_ctx_t* stream_ctx = NULL;
-    /* Locate the connection to the origin */
-    if (qr_ctx->relay_ctx->cnx_ctx != NULL) {
-        stream_ctx = qr_ctx->relay_ctx->cnx_ctx->first_stream;
-        while (stream_ctx != NULL) {
-            if (stream_ctx->subscribe_prefix != NULL &&
-                stream_ctx->subscribe_prefix_length == url_length &&
-                memcmp(stream_ctx->subscribe_prefix, url, url_length) == 0) {
-                break;
-            }
-            stream_ctx = stream_ctx->next_stream;
-        }
-    }
-    return stream_ctx;
-}
-
+/* The subscriptions to the origin are shared between all the clients
+ * subscribing to the same pattern. The trie node of the pattern counts the
+ * subscribers, and the forwarded subscription is created with the first one
+ * and closed when the last one leaves.
+ */
 void quicrq_relay_subscribe_pattern(quicrq_ctx_t* qr_ctx, quicrq_subscribe_action_enum action, const uint8_t* url, size_t url_length)
 {
+    quicrq_subscribe_node_t* node = quicrq_subscribe_trie_find(qr_ctx, url, url_length);
+
     if (action == quicrq_subscribe_action_unsubscribe) {
-        if (qr_ctx->relay_ctx->cnx_ctx != NULL) {
-            /* Check whether there is still a client connection subscribed to this pattern */
-            quicrq_cnx_ctx_t* cnx_ctx = qr_ctx->first_cnx;
-            int is_subscribed = 0;
-            while (cnx_ctx != NULL && !is_subscribed) {
-                /* Only examine the connections to this relay */
-                if (cnx_ctx->is_server) {
-                    quicrq_stream_ctx_t* stream_ctx = cnx_ctx->first_stream;
-                    while (stream_ctx != NULL) {
-                        if (stream_ctx->send_state == quicrq_notify_ready &&
-                            stream_ctx->subscribe_prefix_length == url_length &&
-                            memcmp(stream_ctx->subscribe_prefix, url, url_length) == 0) {
-                            is_subscribed = 1;
-                            break;
-                        }
-                        stream_ctx = stream_ctx->next_stream;
-                    }
-                }
+        /* Close the outgoing stream for that pattern if there is no client subscribed to it anymore. */
+        if (node != NULL && node->nb_subscribers == 0 && node->upstream_stream_ctx != NULL) {
+            quicrq_stream_ctx_t* stream_ctx = node->upstream_stream_ctx;
+            int ret = quicrq_cnx_subscribe_pattern_close(stream_ctx->cnx_ctx, stream_ctx);
+            if (ret != 0) {
+                char buffer[256];
+                quicrq_log_message(stream_ctx->cnx_ctx, "Cannot unsubscribe relay from origin for %s*",
+                    quicrq_uint8_t_to_text(url, url_length, buffer, 256));
             }
-            /* Find the outgoing stream for that pattern and close it. */
-            if (is_subscribed) {
-                quicrq_stream_ctx_t* stream_ctx = quicrq_relay_find_subscription(qr_ctx, url, url_length);
-                if (stream_ctx != NULL) {
-                    int ret = quicrq_cnx_subscribe_pattern_close(qr_ctx->relay_ctx->cnx_ctx, stream_ctx);
-                    if (ret != 0) {
-                        char buffer[256];
-                        quicrq_log_message(qr_ctx->relay_ctx->cnx_ctx, "Cannot unsubscribe relay from origin for %s*",
-                            quicrq_uint8_t_to_text(url, url_length, buffer, 256));
-                    }
-                }
+            else {
+                quicrq_subscribe_trie_set_upstream(node, NULL);
             }
         }
     }
     else if (action == quicrq_subscribe_action_subscribe) {
-        /* new subscription from a client. Check the current connection to
-         * see whether a matching subscription exists.*/
-         /* If no connection to the server yet, create one */
-        if (quicrq_relay_check_server_cnx(qr_ctx->relay_ctx, qr_ctx) != 0) {
-            DBG_PRINTF("%s", "Cannot create a connection to the origin");
+        /* new subscription from a client. Check whether a matching subscription
+         * to the origin exists. */
+        if (node == NULL) {
+            DBG_PRINTF("%s", "Subscribe pattern not registered");
         }
-        else {
-            quicrq_stream_ctx_t* stream_ctx = quicrq_relay_find_subscription(qr_ctx, url, url_length);
-            if (stream_ctx == NULL) {
+        else if (node->upstream_stream_ctx == NULL) {
+            /* If no connection to the server yet, create one */
+            size_t upstream_index = 0;
+            quicrq_cnx_ctx_t* upstream_cnx_ctx = quicrq_relay_get_upstream_cnx(qr_ctx->relay_ctx, url, url_length,
+                SIZE_MAX, picoquic_get_quic_time(qr_ctx->quic), &upstream_index);
+
+            if (upstream_cnx_ctx == NULL) {
+                DBG_PRINTF("%s", "Cannot create a connection to the origin");
+            }
+            else {
                 /* No subscription, create one. */
-                stream_ctx = quicrq_cnx_subscribe_pattern(qr_ctx->relay_ctx->cnx_ctx, url, url_length,
+                quicrq_stream_ctx_t* stream_ctx = quicrq_cnx_subscribe_pattern(upstream_cnx_ctx, url, url_length,
                     quicrq_relay_subscribe_notify, qr_ctx);
-            }
 
-            if (stream_ctx == NULL) {
-                char buffer[256];
-                quicrq_log_message(qr_ctx->relay_ctx->cnx_ctx, "Cannot subscribe from relay to origin for %s*",
-                    quicrq_uint8_t_to_text(url, url_length, buffer, 256));
+                if (stream_ctx == NULL) {
+                    char buffer[256];
+                    quicrq_log_message(upstream_cnx_ctx, "Cannot subscribe from relay to origin for %s*",
+                        quicrq_uint8_t_to_text(url, url_length, buffer, 256));
+                }
+                else {
+                    quicrq_subscribe_trie_set_upstream(node, stream_ctx);
+                }
             }
         }
     }
 }
 
 /* The relay functionality has to be established to add the relay
- * function to a QUICRQ node.
+ * function to a QUICRQ node. The relay context is allocated in a single
+ * block, followed by the array of upstreams and by the copies of their SNI.
  */
-int quicrq_enable_relay(quicrq_ctx_t* qr_ctx, const char* sni, const struct sockaddr* addr,
-    quicrq_transport_mode_enum transport_mode)
+int quicrq_enable_relay_ex(quicrq_ctx_t* qr_ctx, size_t nb_upstreams, const char** sni, const struct sockaddr** addr,
+    size_t nb_cnx_per_upstream, quicrq_transport_mode_enum transport_mode)
 {
     int ret = 0;
 
-    if (qr_ctx->relay_ctx != NULL) {
-        /* Error -- cannot enable relaying twice without first disabling it */
+    if (qr_ctx->relay_ctx != NULL || nb_upstreams == 0) {
+        /* Error -- cannot enable relaying twice without first disabling it,
+         * or without an upstream server. */
         ret = -1;
     }
     else {
-        size_t sni_len = (sni == NULL) ? 0 : strlen(sni);
-        quicrq_relay_context_t* relay_ctx = (quicrq_relay_context_t*)malloc(
-            sizeof(quicrq_relay_context_t) + sni_len + 1);
+        size_t alloc_size = sizeof(quicrq_relay_context_t) + nb_upstreams * sizeof(quicrq_relay_upstream_t);
+        quicrq_relay_context_t* relay_ctx = NULL;
+
+        for (size_t i = 0; i < nb_upstreams; i++) {
+            alloc_size += ((sni[i] == NULL) ? 0 : strlen(sni[i])) + 1;
+        }
+        relay_ctx = (quicrq_relay_context_t*)malloc(alloc_size);
         if (relay_ctx == NULL) {
             ret = -1;
         }
         else {
             /* initialize the relay context. */
-            uint8_t* v_sni = ((uint8_t*)relay_ctx) + sizeof(quicrq_relay_context_t);
-            memset(relay_ctx, 0, sizeof(quicrq_relay_context_t));
-            picoquic_store_addr(&relay_ctx->server_addr, addr);
-            if (sni_len > 0) {
-                memcpy(v_sni, sni, sni_len);
+            uint8_t* v_sni = NULL;
+            memset(relay_ctx, 0, alloc_size);
+            relay_ctx->qr_ctx = qr_ctx;
+            relay_ctx->upstreams = (quicrq_relay_upstream_t*)(((uint8_t*)relay_ctx) + sizeof(quicrq_relay_context_t));
+            relay_ctx->nb_upstreams = nb_upstreams;
+            relay_ctx->nb_cnx_per_upstream = (nb_cnx_per_upstream == 0) ? 1 :
+                ((nb_cnx_per_upstream > QUICRQ_RELAY_CNX_PER_UPSTREAM_MAX) ? QUICRQ_RELAY_CNX_PER_UPSTREAM_MAX : nb_cnx_per_upstream);
+            v_sni = (uint8_t*)(relay_ctx->upstreams + nb_upstreams);
+            for (size_t i = 0; i < nb_upstreams; i++) {
+                size_t sni_len = (sni[i] == NULL) ? 0 : strlen(sni[i]);
+                picoquic_store_addr(&relay_ctx->upstreams[i].server_addr, addr[i]);
+                if (sni_len > 0) {
+                    memcpy(v_sni, sni[i], sni_len);
+                }
+                v_sni[sni_len] = 0;
+                relay_ctx->upstreams[i].sni = (char const*)v_sni;
+                v_sni += sni_len + 1;
             }
-            v_sni[sni_len] = 0;
-            relay_ctx->sni = (char const*)v_sni;
             relay_ctx->transport_mode = transport_mode;
             /* set the relay as default provider */
             quicrq_set_default_source(qr_ctx, quicrq_relay_default_source_fn, relay_ctx);
@@ -481,22 +716,37 @@ int quicrq_enable_relay(quicrq_ctx_t* qr_ctx, const char* sni, const struct sock
             qr_ctx->relay_ctx = relay_ctx;
             qr_ctx->manage_relay_cache_fn = quicrq_manage_relay_cache;
             qr_ctx->manage_relay_subscribe_fn = quicrq_relay_subscribe_pattern;
+            qr_ctx->manage_relay_cnx_close_fn = quicrq_relay_cnx_close;
+            qr_ctx->manage_relay_feedback_fn = quicrq_relay_forward_feedback;
         }
     }
     return ret;
 }
 
+int quicrq_enable_relay(quicrq_ctx_t* qr_ctx, const char* sni, const struct sockaddr* addr,
+    quicrq_transport_mode_enum transport_mode)
+{
+    return quicrq_enable_relay_ex(qr_ctx, 1, &sni, &addr, 1, transport_mode);
+}
+
 void quicrq_disable_relay(quicrq_ctx_t* qr_ctx)
 {
     if (qr_ctx->relay_ctx != NULL) {
         free(qr_ctx->relay_ctx);
         qr_ctx->relay_ctx = NULL;
         qr_ctx->manage_relay_cache_fn = NULL;
+        qr_ctx->manage_relay_subscribe_fn = NULL;
+        qr_ctx->manage_relay_cnx_close_fn = NULL;
+        qr_ctx->manage_relay_feedback_fn = NULL;
+        qr_ctx->manage_relay_warm_fn = NULL;
+        quicrq_timer_cancel(qr_ctx, &qr_ctx->relay_warm_timer);
     }
 }
 
 /* Management of the relay cache.
- * Ensure that old segments are removed.
+ * Ensure that old segments are removed, and schedule the deletion of
+ * the closed caches that have no reader. The deletion is performed
+ * when the cache delete timer of the source is due.
  */
 uint64_t quicrq_manage_relay_cache(quicrq_ctx_t* qr_ctx, uint64_t current_time)
 {
@@ -523,9 +773,11 @@ uint64_t quicrq_manage_relay_cache(quicrq_ctx_t* qr_ctx, uint64_t current_time)
                     if (current_time >= cache_ctx->cache_delete_time) {
                         srce_to_delete = srce_ctx;
                     }
-                    else if (cache_ctx->cache_delete_time < next_time) {
-                        /* Not ready to delete yet, ask for a wake up on timer */
-                        next_time = cache_ctx->cache_delete_time;
+                    else if (quicrq_timer_set(qr_ctx, &srce_ctx->cache_delete_timer, cache_ctx->cache_delete_time) != 0) {
+                        /* Not ready to delete yet, and no timer available: check again at the next wake up */
+                        if (cache_ctx->cache_delete_time < next_time) {
+                            next_time = cache_ctx->cache_delete_time;
+                        }
                         is_cache_closing_still_needed = 1;
                     }
                 }
@@ -599,6 +851,14 @@ int quicrq_origin_consumer_init_callback(quicrq_stream_ctx_t* stream_ctx, const
             ret = quicrq_set_media_stream_ctx(stream_ctx, quicrq_relay_consumer_cb, cons_ctx);
         }
 
+        if (ret == 0 && qr_ctx->nb_shard_peers > 0) {
+            /* Mirror the posted media to the shard peers */
+            quicrq_media_source_ctx_t* posted_srce_ctx = quicrq_find_local_media_source(qr_ctx, url, url_length);
+            if (posted_srce_ctx != NULL) {
+                quicrq_shard_feed_peers(qr_ctx, posted_srce_ctx);
+            }
+        }
+
         if (ret != 0) {
             free(cons_ctx);
         }
@@ -0,0 +1,692 @@
+/* Mirroring of sources between relay shards */
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include "picoquic_utils.h"
+#include "quicrq.h"
+#include "quicrq_internal.h"
+#include "quicrq_fragment.h"
+
+/* A relay shard is a quicrq context running in its own thread. The sources
+ * received in one context are mirrored to the shards by shard feeds, see
+ * the definition of quicrq_shard_feed_t in quicrq_fragment.h. The functions
+ * named "source" below are only called in the thread of the source context,
+ * and the functions named "shard" in the thread of the shard context.
+ */
+
+static quicrq_shard_entry_t* quicrq_shard_entry_create(quicrq_shard_entry_enum entry_type, size_t data_length)
+{
+    quicrq_shard_entry_t* entry = (quicrq_shard_entry_t*)malloc(sizeof(quicrq_shard_entry_t) + data_length);
+
+    if (entry != NULL) {
+        memset(entry, 0, sizeof(quicrq_shard_entry_t));
+        entry->entry_type = entry_type;
+        entry->data_length = data_length;
+        entry->data = ((uint8_t*)entry) + sizeof(quicrq_shard_entry_t);
+    }
+    return entry;
+}
+
+/* Push an entry in the ring. Returns -1 if the ring is full. */
+static int quicrq_shard_ring_push(quicrq_shard_feed_t* feed, quicrq_shard_entry_t* entry)
+{
+    int ret = 0;
+    uint64_t head = feed->ring_head;
+    uint64_t tail = quicrq_atomic_load(&feed->ring_tail);
+
+    if (head - tail > feed->ring_mask) {
+        ret = -1;
+    }
+    else {
+        feed->ring[head & feed->ring_mask] = entry;
+        quicrq_atomic_store(&feed->ring_head, head + 1);
+    }
+    return ret;
+}
+
+/* Pop an entry from the ring, or return NULL if the ring is empty. */
+static quicrq_shard_entry_t* quicrq_shard_ring_pop(quicrq_shard_feed_t* feed)
+{
+    quicrq_shard_entry_t* entry = NULL;
+    uint64_t tail = feed->ring_tail;
+    uint64_t head = quicrq_atomic_load(&feed->ring_head);
+
+    if (head != tail) {
+        entry = feed->ring[tail & feed->ring_mask];
+        feed->ring[tail & feed->ring_mask] = NULL;
+        quicrq_atomic_store(&feed->ring_tail, tail + 1);
+    }
+    return entry;
+}
+
+/* Source side: wake up the shard thread if the ring was idle */
+static void quicrq_shard_source_notify(quicrq_shard_feed_t* feed)
+{
+    if (quicrq_atomic_exchange(&feed->is_pending, 1) == 0 && feed->wakeup_fn != NULL) {
+        feed->wakeup_fn(feed->wakeup_ctx);
+    }
+}
+
+/* Source side: push the backlog to the ring, as long as there is space.
+ * Once pushed, the entry belongs to the shard thread, which may free it at
+ * once, so the next entry is found before the push. */
+static void quicrq_shard_source_flush_backlog(quicrq_shard_feed_t* feed)
+{
+    int is_pushed = 0;
+
+    while (feed->first_backlog != NULL) {
+        quicrq_shard_entry_t* next_backlog = feed->first_backlog->next_backlog;
+        if (quicrq_shard_ring_push(feed, feed->first_backlog) != 0) {
+            break;
+        }
+        is_pushed = 1;
+        feed->first_backlog = next_backlog;
+        if (feed->first_backlog == NULL) {
+            feed->last_backlog = NULL;
+        }
+    }
+    if (is_pushed) {
+        quicrq_shard_source_notify(feed);
+    }
+}
+
+static void quicrq_shard_free_backlog(quicrq_shard_feed_t* feed)
+{
+    quicrq_shard_entry_t* entry;
+
+    while ((entry = feed->first_backlog) != NULL) {
+        feed->first_backlog = entry->next_backlog;
+        free(entry);
+    }
+    feed->last_backlog = NULL;
+}
+
+/* Source side: queue an entry. Entries are queued in the backlog if the
+ * ring is full, or if older entries are already waiting, so that the
+ * order is preserved. */
+static void quicrq_shard_source_queue(quicrq_shard_feed_t* feed, quicrq_shard_entry_t* entry)
+{
+    if (feed->first_backlog == NULL && quicrq_shard_ring_push(feed, entry) == 0) {
+        quicrq_shard_source_notify(feed);
+    }
+    else {
+        entry->next_backlog = NULL;
+        if (feed->last_backlog == NULL) {
+            feed->first_backlog = entry;
+        }
+        else {
+            feed->last_backlog->next_backlog = entry;
+        }
+        feed->last_backlog = entry;
+    }
+}
+
+static int quicrq_shard_source_queue_fragment(quicrq_shard_feed_t* feed, quicrq_cached_fragment_t* fragment)
+{
+    int ret = 0;
+    quicrq_shard_entry_t* entry = quicrq_shard_entry_create(quicrq_shard_entry_fragment, fragment->data_length);
+
+    if (entry == NULL) {
+        ret = -1;
+    }
+    else {
+        entry->group_id = fragment->group_id;
+        entry->object_id = fragment->object_id;
+        entry->offset = fragment->offset;
+        entry->queue_delay = fragment->queue_delay;
+        entry->flags = fragment->flags;
+        entry->nb_objects_previous_group = fragment->nb_objects_previous_group;
+        entry->object_length = fragment->object_length;
+        memcpy(entry->data, fragment->data, fragment->data_length);
+        quicrq_shard_source_queue(feed, entry);
+    }
+    return ret;
+}
+
+static int quicrq_shard_source_queue_point(quicrq_shard_feed_t* feed, quicrq_shard_entry_enum entry_type,
+    uint64_t group_id, uint64_t object_id)
+{
+    int ret = 0;
+    quicrq_shard_entry_t* entry = quicrq_shard_entry_create(entry_type, 0);
+
+    if (entry == NULL) {
+        ret = -1;
+    }
+    else {
+        entry->group_id = group_id;
+        entry->object_id = object_id;
+        quicrq_shard_source_queue(feed, entry);
+    }
+    return ret;
+}
+
+/* Source side: called when a fragment is added to a cache that has feeds */
+int quicrq_shard_feed_fragment(quicrq_fragment_cache_t* cache_ctx, quicrq_cached_fragment_t* fragment)
+{
+    int ret = 0;
+    quicrq_shard_feed_t* feed = cache_ctx->first_shard_feed;
+
+    while (feed != NULL && ret == 0) {
+        ret = quicrq_shard_source_queue_fragment(feed, fragment);
+        feed = feed->next_feed_for_cache;
+    }
+    return ret;
+}
+
+/* Source side: called when the start point of a cache that has feeds is learned */
+int quicrq_shard_feed_start_point(quicrq_fragment_cache_t* cache_ctx)
+{
+    int ret = 0;
+    quicrq_shard_feed_t* feed = cache_ctx->first_shard_feed;
+
+    while (feed != NULL && ret == 0) {
+        ret = quicrq_shard_source_queue_point(feed, quicrq_shard_entry_start_point,
+            cache_ctx->first_group_id, cache_ctx->first_object_id);
+        feed = feed->next_feed_for_cache;
+    }
+    return ret;
+}
+
+/* Source side: called when the end point of a cache that has feeds is learned */
+int quicrq_shard_feed_end_point(quicrq_fragment_cache_t* cache_ctx)
+{
+    int ret = 0;
+    quicrq_shard_feed_t* feed = cache_ctx->first_shard_feed;
+
+    while (feed != NULL && ret == 0) {
+        ret = quicrq_shard_source_queue_point(feed, quicrq_shard_entry_end_point,
+            cache_ctx->final_group_id, cache_ctx->final_object_id);
+        feed = feed->next_feed_for_cache;
+    }
+    return ret;
+}
+
+
+/* Source side: the source cache is deleted. Tell the shards that no more
+ * data will come, and detach the feeds from the cache. */
+void quicrq_shard_feed_source_closed(quicrq_fragment_cache_t* cache_ctx)
+{
+    while (cache_ctx->first_shard_feed != NULL) {
+        quicrq_shard_feed_t* feed = cache_ctx->first_shard_feed;
+        quicrq_shard_entry_t* entry = quicrq_shard_entry_create(quicrq_shard_entry_closed, 0);
+
+        if (entry == NULL) {
+            DBG_PRINTF("%s", "Cannot notify the closure of a shard feed");
+        }
+        else {
+            quicrq_shard_source_queue(feed, entry);
+        }
+        cache_ctx->first_shard_feed = feed->next_feed_for_cache;
+        feed->next_feed_for_cache = NULL;
+        feed->source_cache_ctx = NULL;
+    }
+}
+
+/* Shard side: the mirror cache is deleted, the entries will be discarded */
+void quicrq_shard_feed_mirror_deleted(quicrq_fragment_cache_t* cache_ctx)
+{
+    if (cache_ctx->shard_feed_in != NULL) {
+        cache_ctx->shard_feed_in->shard_cache_ctx = NULL;
+        cache_ctx->shard_feed_in = NULL;
+    }
+}
+
+/* Free a feed, once both sides are detached */
+static void quicrq_shard_feed_free(quicrq_shard_feed_t* feed)
+{
+    quicrq_shard_entry_t* entry;
+
+    /* Free the entries that were not delivered */
+    while ((entry = quicrq_shard_ring_pop(feed)) != NULL) {
+        free(entry);
+    }
+    quicrq_shard_free_backlog(feed);
+    free(feed->ring);
+    free(feed);
+}
+
+/* Source side: stop feeding the cache content to the shard */
+static void quicrq_shard_source_stop(quicrq_shard_feed_t* feed)
+{
+    if (feed->source_cache_ctx != NULL) {
+        quicrq_shard_feed_t** p_feed = &feed->source_cache_ctx->first_shard_feed;
+        while (*p_feed != NULL) {
+            if (*p_feed == feed) {
+                *p_feed = feed->next_feed_for_cache;
+                break;
+            }
+            p_feed = &(*p_feed)->next_feed_for_cache;
+        }
+        feed->next_feed_for_cache = NULL;
+        feed->source_cache_ctx = NULL;
+    }
+    quicrq_shard_free_backlog(feed);
+}
+
+/* Source side: release the feed. If the shard side still uses it, it will
+ * find the feed detached at its next time check, and free it. */
+static void quicrq_shard_source_detach(quicrq_shard_feed_t* feed)
+{
+    quicrq_publish_wakeup_fn wakeup_fn = feed->wakeup_fn;
+    void* wakeup_ctx = feed->wakeup_ctx;
+
+    quicrq_shard_source_stop(feed);
+    if (feed->previous_feed_out == NULL) {
+        feed->source_ctx->first_shard_feed_out = feed->next_feed_out;
+    }
+    else {
+        feed->previous_feed_out->next_feed_out = feed->next_feed_out;
+    }
+    if (feed->next_feed_out != NULL) {
+        feed->next_feed_out->previous_feed_out = feed->previous_feed_out;
+    }
+    feed->next_feed_out = NULL;
+    feed->previous_feed_out = NULL;
+
+    if (quicrq_atomic_exchange(&feed->is_detached, 1) != 0) {
+        quicrq_shard_feed_free(feed);
+    }
+    else if (wakeup_fn != NULL) {
+        /* The feed may already be freed by the shard thread, only use the copies */
+        wakeup_fn(wakeup_ctx);
+    }
+}
+
+/* Shard side: no more data will come, manage the mirror like a relay cache
+ * whose feed is closed, so it is deleted after the cache duration. */
+static void quicrq_shard_mirror_close(quicrq_shard_feed_t* feed, uint64_t current_time)
+{
+    quicrq_fragment_cache_t* cache_ctx = feed->shard_cache_ctx;
+
+    if (!cache_ctx->is_feed_closed) {
+        if (cache_ctx->final_group_id == 0 && cache_ctx->final_object_id == 0) {
+            cache_ctx->final_group_id = cache_ctx->next_group_id;
+            cache_ctx->final_object_id = cache_ctx->next_object_id;
+        }
+        cache_ctx->cache_delete_time = current_time +
+            ((feed->shard_ctx->cache_duration_max > QUICRQ_CACHE_INITIAL_DURATION) ?
+                feed->shard_ctx->cache_duration_max : QUICRQ_CACHE_INITIAL_DURATION);
+        cache_ctx->is_feed_closed = 1;
+        feed->shard_ctx->is_cache_closing_needed = 1;
+        quicrq_source_wakeup(cache_ctx->srce_ctx);
+    }
+}
+
+/* Shard side: release the feed. The mirror stays in the shard until it is
+ * closed and no longer used. If the source side still uses the feed, it
+ * will find it detached at its next time check. */
+static void quicrq_shard_mirror_detach(quicrq_shard_feed_t* feed, uint64_t current_time)
+{
+    if (feed->is_attached) {
+        if (feed->previous_feed_in == NULL) {
+            feed->shard_ctx->first_shard_feed_in = feed->next_feed_in;
+        }
+        else {
+            feed->previous_feed_in->next_feed_in = feed->next_feed_in;
+        }
+        if (feed->next_feed_in != NULL) {
+            feed->next_feed_in->previous_feed_in = feed->previous_feed_in;
+        }
+        feed->next_feed_in = NULL;
+        feed->previous_feed_in = NULL;
+        feed->is_attached = 0;
+    }
+    if (feed->shard_cache_ctx != NULL) {
+        quicrq_shard_mirror_close(feed, current_time);
+        feed->shard_cache_ctx->shard_feed_in = NULL;
+        feed->shard_cache_ctx = NULL;
+    }
+    if (quicrq_atomic_exchange(&feed->is_detached, 1) != 0) {
+        quicrq_shard_feed_free(feed);
+    }
+}
+
+/* Shard side: create the mirror of a feed popped from the request queue.
+ * The mirror is managed like a relay cache, and deleted after the source is closed.
+ * If the shard already has a source with the same URL, the feed is refused, unless
+ * that source was created by a subscription and has not received any media yet:
+ * as an origin does when the media is posted, the feed then fills that source. */
+static void quicrq_shard_mirror_attach(quicrq_ctx_t* shard_ctx, quicrq_shard_feed_t* feed, uint64_t current_time)
+{
+    int ret = 0;
+    quicrq_fragment_cache_t* cache_ctx = NULL;
+    quicrq_media_source_ctx_t* srce_ctx = NULL;
+
+    if (quicrq_atomic_load(&feed->is_detached) != 0) {
+        /* The source side gave up before the shard saw the feed */
+        ret = -1;
+    }
+    else if ((srce_ctx = quicrq_find_local_media_source(shard_ctx, feed->url, feed->url_length)) != NULL) {
+        cache_ctx = srce_ctx->cache_ctx;
+        if (cache_ctx == NULL || cache_ctx->shard_feed_in != NULL || cache_ctx->first_shard_feed != NULL ||
+            cache_ctx->is_feed_closed || picosplay_first(&cache_ctx->fragment_tree) != NULL) {
+            DBG_PRINTF("%s", "Shard feed refused, the source already exists in the shard");
+            ret = -1;
+        }
+    }
+    else if ((cache_ctx = quicrq_fragment_cache_create_ctx(shard_ctx)) == NULL) {
+        ret = -1;
+    }
+    else if (quicrq_publish_fragment_cached_media(shard_ctx, cache_ctx, feed->url, feed->url_length,
+        0, feed->is_real_time) != 0) {
+        quicrq_fragment_cache_delete_ctx(cache_ctx);
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        feed->shard_cache_ctx = cache_ctx;
+        cache_ctx->shard_feed_in = feed;
+        feed->next_feed_in = shard_ctx->first_shard_feed_in;
+        feed->previous_feed_in = NULL;
+        if (shard_ctx->first_shard_feed_in != NULL) {
+            shard_ctx->first_shard_feed_in->previous_feed_in = feed;
+        }
+        shard_ctx->first_shard_feed_in = feed;
+        feed->is_attached = 1;
+    }
+    else {
+        quicrq_shard_mirror_detach(feed, current_time);
+    }
+}
+
+/* Shard side: apply an entry to the mirror cache */
+static int quicrq_shard_apply_entry(quicrq_shard_feed_t* feed, quicrq_shard_entry_t* entry, uint64_t current_time)
+{
+    int ret = 0;
+    quicrq_fragment_cache_t* cache_ctx = feed->shard_cache_ctx;
+
+    switch (entry->entry_type) {
+    case quicrq_shard_entry_fragment:
+        ret = quicrq_fragment_propose_to_cache(cache_ctx, entry->data, entry->group_id, entry->object_id,
+            entry->offset, entry->queue_delay, entry->flags, entry->nb_objects_previous_group,
+            entry->object_length, entry->data_length, current_time);
+        break;
+    case quicrq_shard_entry_start_point:
+        ret = quicrq_fragment_cache_learn_start_point(cache_ctx, entry->group_id, entry->object_id);
+        break;
+    case quicrq_shard_entry_end_point:
+        ret = quicrq_fragment_cache_learn_end_point(cache_ctx, entry->group_id, entry->object_id);
+        break;
+    case quicrq_shard_entry_closed:
+        /* Same as the closure of the feed of a relay cache */
+        quicrq_shard_mirror_close(feed, current_time);
+        break;
+    default:
+        ret = -1;
+        break;
+    }
+    return ret;
+}
+
+/* Called from quicrq_time_check in the thread of the context:
+ * - as shard, attach the feeds created by the source threads,
+ * - as source, retry pushing the backlog of the outgoing feeds, and
+ *   release the feeds that the shards detached,
+ * - as shard, apply the entries received on the incoming feeds, and
+ *   release the feeds that the sources detached.
+ * Returns the next time at which the feeds shall be polled.
+ */
+uint64_t quicrq_shard_feeds_process(quicrq_ctx_t* qr_ctx, uint64_t current_time)
+{
+    uint64_t next_time = UINT64_MAX;
+    quicrq_shard_feed_t* feed;
+    quicrq_mpsc_node_t* node;
+
+    if (quicrq_atomic_exchange(&qr_ctx->is_shard_request_pending, 0) != 0) {
+        while ((node = quicrq_mpsc_queue_pop(&qr_ctx->shard_requests)) != NULL) {
+            feed = (quicrq_shard_feed_t*)(((uint8_t*)node) - offsetof(quicrq_shard_feed_t, request_node));
+            quicrq_shard_mirror_attach(qr_ctx, feed, current_time);
+        }
+        if (qr_ctx->shard_requests.tail != quicrq_atomic_load_ptr(&qr_ctx->shard_requests.head)) {
+            /* A request is still being pushed, look again at the next time check */
+            (void)quicrq_atomic_exchange(&qr_ctx->is_shard_request_pending, 1);
+            next_time = current_time + QUICRQ_SHARD_POLL_INTERVAL;
+        }
+    }
+
+    feed = qr_ctx->first_shard_feed_out;
+    while (feed != NULL) {
+        quicrq_shard_feed_t* next_feed = feed->next_feed_out;
+
+        if (quicrq_atomic_load(&feed->is_detached) != 0) {
+            /* The shard does not use the feed anymore */
+            if (feed->is_auto_delete) {
+                quicrq_shard_source_detach(feed);
+            }
+            else {
+                quicrq_shard_source_stop(feed);
+            }
+        }
+        else {
+            quicrq_shard_source_flush_backlog(feed);
+            if (feed->first_backlog != NULL) {
+                next_time = current_time + QUICRQ_SHARD_POLL_INTERVAL;
+            }
+            else if (feed->is_auto_delete && feed->source_cache_ctx == NULL) {
+                /* The closure of the source was pushed to the shard */
+                quicrq_shard_source_detach(feed);
+            }
+        }
+        feed = next_feed;
+    }
+
+    feed = qr_ctx->first_shard_feed_in;
+    while (feed != NULL) {
+        quicrq_shard_feed_t* next_feed = feed->next_feed_in;
+        quicrq_shard_entry_t* entry;
+        /* Entries pushed before the source detached are visible once the flag is seen */
+        int is_source_detached = (quicrq_atomic_load(&feed->is_detached) != 0);
+
+        (void)quicrq_atomic_exchange(&feed->is_pending, 0);
+        while ((entry = quicrq_shard_ring_pop(feed)) != NULL) {
+            if (feed->shard_cache_ctx != NULL && quicrq_shard_apply_entry(feed, entry, current_time) != 0) {
+                DBG_PRINTF("Cannot apply shard entry, type %d", entry->entry_type);
+            }
+            free(entry);
+        }
+        if (is_source_detached) {
+            quicrq_shard_mirror_detach(feed, current_time);
+        }
+        else if (feed->wakeup_fn == NULL) {
+            /* The source thread cannot wake up this thread, poll the ring */
+            next_time = current_time + QUICRQ_SHARD_POLL_INTERVAL;
+        }
+        feed = next_feed;
+    }
+    return next_time;
+}
+
+static uint64_t quicrq_shard_ring_size(size_t ring_size)
+{
+    uint64_t size = 1;
+
+    if (ring_size == 0) {
+        ring_size = QUICRQ_SHARD_RING_SIZE_DEFAULT;
+    }
+    while (size < ring_size) {
+        size <<= 1;
+    }
+    return size;
+}
+
+/* Source side: create a feed for a source of the source context, queue the
+ * content already in the cache, and hand the feed to the shard thread. */
+static quicrq_shard_feed_t* quicrq_shard_feed_create_ex(quicrq_ctx_t* source_ctx, quicrq_media_source_ctx_t* srce_ctx,
+    quicrq_ctx_t* shard_ctx, size_t ring_size, int is_auto_delete)
+{
+    int ret = 0;
+    quicrq_shard_feed_t* feed = NULL;
+    quicrq_fragment_cache_t* cache_ctx = (srce_ctx == NULL) ? NULL : srce_ctx->cache_ctx;
+
+    if (cache_ctx == NULL || shard_ctx == source_ctx) {
+        ret = -1;
+    }
+    else {
+        /* Only one feed per source and shard */
+        quicrq_shard_feed_t* other_feed = cache_ctx->first_shard_feed;
+        while (other_feed != NULL && other_feed->shard_ctx != shard_ctx) {
+            other_feed = other_feed->next_feed_for_cache;
+        }
+        if (other_feed != NULL) {
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        /* The copy of the URL is allocated with the feed */
+        feed = (quicrq_shard_feed_t*)malloc(sizeof(quicrq_shard_feed_t) + srce_ctx->media_url_length);
+        if (feed == NULL) {
+            ret = -1;
+        }
+        else {
+            uint64_t size = quicrq_shard_ring_size(ring_size);
+
+            memset(feed, 0, sizeof(quicrq_shard_feed_t));
+            feed->url = ((uint8_t*)feed) + sizeof(quicrq_shard_feed_t);
+            memcpy(feed->url, srce_ctx->media_url, srce_ctx->media_url_length);
+            feed->url_length = srce_ctx->media_url_length;
+            feed->is_real_time = srce_ctx->is_cache_real_time;
+            feed->is_auto_delete = is_auto_delete;
+            feed->wakeup_fn = shard_ctx->publish_wakeup_fn;
+            feed->wakeup_ctx = shard_ctx->publish_wakeup_ctx;
+            feed->source_ctx = source_ctx;
+            feed->shard_ctx = shard_ctx;
+            feed->ring_mask = size - 1;
+            feed->ring = (quicrq_shard_entry_t**)malloc((size_t)size * sizeof(quicrq_shard_entry_t*));
+            if (feed->ring == NULL) {
+                free(feed);
+                feed = NULL;
+                ret = -1;
+            }
+            else {
+                memset(feed->ring, 0, (size_t)size * sizeof(quicrq_shard_entry_t*));
+            }
+        }
+    }
+
+    if (ret == 0) {
+        /* Attach the feed to the source cache and context, and queue the current content */
+        picosplay_node_t* fragment_node = picosplay_first(&cache_ctx->fragment_tree);
+
+        feed->source_cache_ctx = cache_ctx;
+        feed->next_feed_for_cache = cache_ctx->first_shard_feed;
+        cache_ctx->first_shard_feed = feed;
+        feed->next_feed_out = source_ctx->first_shard_feed_out;
+        if (source_ctx->first_shard_feed_out != NULL) {
+            source_ctx->first_shard_feed_out->previous_feed_out = feed;
+        }
+        source_ctx->first_shard_feed_out = feed;
+
+        if (cache_ctx->first_group_id != 0 || cache_ctx->first_object_id != 0) {
+            ret = quicrq_shard_source_queue_point(feed, quicrq_shard_entry_start_point,
+                cache_ctx->first_group_id, cache_ctx->first_object_id);
+        }
+        while (ret == 0 && fragment_node != NULL) {
+            ret = quicrq_shard_source_queue_fragment(feed, (quicrq_cached_fragment_t*)quicrq_fragment_cache_node_value(fragment_node));
+            fragment_node = picosplay_next(fragment_node);
+        }
+        if (ret == 0 && (cache_ctx->final_group_id != 0 || cache_ctx->final_object_id != 0)) {
+            ret = quicrq_shard_source_queue_point(feed, quicrq_shard_entry_end_point,
+                cache_ctx->final_group_id, cache_ctx->final_object_id);
+        }
+        if (ret != 0) {
+            /* The shard never saw the feed, both sides can be released here */
+            (void)quicrq_atomic_exchange(&feed->is_detached, 1);
+            quicrq_shard_source_detach(feed);
+            feed = NULL;
+        }
+    }
+
+    if (ret == 0) {
+        /* Hand the feed to the shard thread */
+        quicrq_mpsc_queue_push(&shard_ctx->shard_requests, &feed->request_node);
+        if (quicrq_atomic_exchange(&shard_ctx->is_shard_request_pending, 1) == 0 && feed->wakeup_fn != NULL) {
+            feed->wakeup_fn(feed->wakeup_ctx);
+        }
+    }
+
+    return feed;
+}
+
+quicrq_shard_feed_t* quicrq_shard_feed_create(quicrq_ctx_t* source_ctx, const uint8_t* url, size_t url_length,
+    quicrq_ctx_t* shard_ctx, size_t ring_size)
+{
+    return quicrq_shard_feed_create_ex(source_ctx, quicrq_find_local_media_source(source_ctx, url, url_length),
+        shard_ctx, ring_size, 0);
+}
+
+/* Feeds created by the library itself are deleted automatically once the
+ * source is closed, or when the shard refuses or releases them. */
+quicrq_shard_feed_t* quicrq_shard_feed_create_auto(quicrq_ctx_t* source_ctx, quicrq_media_source_ctx_t* srce_ctx,
+    quicrq_ctx_t* shard_ctx, size_t ring_size)
+{
+    return quicrq_shard_feed_create_ex(source_ctx, srce_ctx, shard_ctx, ring_size, 1);
+}
+
+void quicrq_shard_feed_delete(quicrq_shard_feed_t* feed)
+{
+    quicrq_shard_source_detach(feed);
+}
+
+/* Release the feeds when a context is deleted. The other threads may still
+ * be running: they will find the feeds detached. */
+void quicrq_shard_feeds_release(quicrq_ctx_t* qr_ctx)
+{
+    quicrq_mpsc_node_t* node;
+
+    while (qr_ctx->first_shard_feed_out != NULL) {
+        quicrq_shard_source_detach(qr_ctx->first_shard_feed_out);
+    }
+    while (qr_ctx->first_shard_feed_in != NULL) {
+        quicrq_shard_mirror_detach(qr_ctx->first_shard_feed_in, 0);
+    }
+    while ((node = quicrq_mpsc_queue_pop(&qr_ctx->shard_requests)) != NULL) {
+        quicrq_shard_mirror_detach((quicrq_shard_feed_t*)(((uint8_t*)node) - offsetof(quicrq_shard_feed_t, request_node)), 0);
+    }
+}
+
+/* Source side: mirror a source to the shard peers of the context.
+ * Mirrors are not fed again, so that the content does not loop between peers. */
+void quicrq_shard_feed_peers(quicrq_ctx_t* qr_ctx, quicrq_media_source_ctx_t* srce_ctx)
+{
+    if (srce_ctx->cache_ctx != NULL && srce_ctx->cache_ctx->shard_feed_in == NULL) {
+        for (size_t i = 0; i < qr_ctx->nb_shard_peers; i++) {
+            if (qr_ctx->shard_peers[i] != qr_ctx &&
+                quicrq_shard_feed_create_auto(qr_ctx, srce_ctx, qr_ctx->shard_peers[i], qr_ctx->shard_peer_ring_size) == NULL) {
+                DBG_PRINTF("Cannot feed the source to shard peer %zu", i);
+            }
+        }
+    }
+}
+
+int quicrq_set_shard_peers(quicrq_ctx_t* qr_ctx, quicrq_ctx_t** peers, size_t nb_peers, size_t ring_size)
+{
+    int ret = 0;
+    quicrq_ctx_t** shard_peers = NULL;
+
+    if (nb_peers > 0) {
+        shard_peers = (quicrq_ctx_t**)malloc(nb_peers * sizeof(quicrq_ctx_t*));
+        if (shard_peers == NULL) {
+            ret = -1;
+        }
+        else {
+            memcpy(shard_peers, peers, nb_peers * sizeof(quicrq_ctx_t*));
+        }
+    }
+    if (ret == 0) {
+        quicrq_media_source_ctx_t* srce_ctx = qr_ctx->first_source;
+
+        if (qr_ctx->shard_peers != NULL) {
+            free(qr_ctx->shard_peers);
+        }
+        qr_ctx->shard_peers = shard_peers;
+        qr_ctx->nb_shard_peers = nb_peers;
+        qr_ctx->shard_peer_ring_size = ring_size;
+        /* Mirror the sources already published */
+        while (srce_ctx != NULL) {
+            quicrq_shard_feed_peers(qr_ctx, srce_ctx);
+            srce_ctx = srce_ctx->next_source;
+        }
+    }
+    return ret;
+}
@@ -0,0 +1,345 @@
+/* Spill of the fragment caches to memory mapped segment files */
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#ifdef _WINDOWS
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+#include "picoquic_utils.h"
+#include "quicrq.h"
+#include "quicrq_internal.h"
+#include "quicrq_fragment.h"
+
+/* Caches that are not real time keep all the groups until the feed is closed.
+ * When the data held in memory exceeds the hot limit, the oldest complete
+ * groups are copied to the current spill segment, and the fragments are
+ * switched to external buffers pointing to the copy in the mapping. The
+ * memory buffers are released, or kept only as long as datagrams waiting
+ * for acknowledgement reference them. See quicrq_spill_segment_t in
+ * quicrq_fragment.h.
+ */
+
+#ifdef _WINDOWS
+#define QUICRQ_SPILL_FILE_PREFIX "qrq"
+#else
+#define QUICRQ_SPILL_FILE_TEMPLATE "/quicrq_spill_XXXXXX"
+#endif
+/* Delay before trying again after a failed spill, doubled at each failure */
+#define QUICRQ_SPILL_RETRY_DELAY_MIN 100000ull
+#define QUICRQ_SPILL_RETRY_DELAY_MAX 10000000ull
+
+static void quicrq_spill_segment_close(quicrq_spill_segment_t* segment)
+{
+#ifdef _WINDOWS
+    if (segment->map != NULL) {
+        (void)UnmapViewOfFile(segment->map);
+    }
+    if (segment->mapping_handle != NULL) {
+        (void)CloseHandle(segment->mapping_handle);
+    }
+    if (segment->file_handle != INVALID_HANDLE_VALUE) {
+        /* The file was opened with "delete on close" */
+        (void)CloseHandle(segment->file_handle);
+    }
+#else
+    if (segment->map != NULL) {
+        (void)munmap(segment->map, segment->segment_size);
+    }
+    if (segment->fd >= 0) {
+        (void)close(segment->fd);
+    }
+#endif
+    free(segment);
+}
+
+/* Create a segment file in the spill directory, and map it in memory.
+ * The file is removed from the directory as soon as it is open, so that
+ * it does not survive the process.
+ */
+static quicrq_spill_segment_t* quicrq_spill_segment_create(const char* spill_directory, size_t segment_size)
+{
+    int ret = 0;
+    quicrq_spill_segment_t* segment = (quicrq_spill_segment_t*)malloc(sizeof(quicrq_spill_segment_t));
+
+    if (segment != NULL) {
+        memset(segment, 0, sizeof(quicrq_spill_segment_t));
+        segment->segment_size = segment_size;
+        segment->ref_count = 1;
+#ifdef _WINDOWS
+        char file_name[MAX_PATH];
+
+        segment->file_handle = INVALID_HANDLE_VALUE;
+        if (GetTempFileNameA(spill_directory, QUICRQ_SPILL_FILE_PREFIX, 0, file_name) == 0) {
+            ret = -1;
+        }
+        else if ((segment->file_handle = CreateFileA(file_name, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+            FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL)) == INVALID_HANDLE_VALUE) {
+            (void)DeleteFileA(file_name);
+            ret = -1;
+        }
+        else if ((segment->mapping_handle = CreateFileMappingA(segment->file_handle, NULL, PAGE_READWRITE,
+            (DWORD)(((uint64_t)segment_size) >> 32), (DWORD)(segment_size & 0xffffffff), NULL)) == NULL) {
+            ret = -1;
+        }
+        else if ((segment->map = (uint8_t*)MapViewOfFile(segment->mapping_handle, FILE_MAP_ALL_ACCESS, 0, 0, segment_size)) == NULL) {
+            ret = -1;
+        }
+#else
+        size_t name_length = strlen(spill_directory) + strlen(QUICRQ_SPILL_FILE_TEMPLATE) + 1;
+        char* file_name = (char*)malloc(name_length);
+
+        segment->fd = -1;
+        if (file_name == NULL) {
+            ret = -1;
+        }
+        else {
+            memcpy(file_name, spill_directory, strlen(spill_directory));
+            memcpy(file_name + strlen(spill_directory), QUICRQ_SPILL_FILE_TEMPLATE, strlen(QUICRQ_SPILL_FILE_TEMPLATE) + 1);
+            if ((segment->fd = mkstemp(file_name)) < 0) {
+                ret = -1;
+            }
+            else {
+                (void)unlink(file_name);
+                if (ftruncate(segment->fd, (off_t)segment_size) != 0) {
+                    ret = -1;
+                }
+                else {
+                    void* map = mmap(NULL, segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, segment->fd, 0);
+                    if (map == MAP_FAILED) {
+                        ret = -1;
+                    }
+                    else {
+                        segment->map = (uint8_t*)map;
+                    }
+                }
+            }
+            free(file_name);
+        }
+#endif
+        if (ret != 0) {
+            DBG_PRINTF("Cannot create a spill segment of %zu bytes in %s", segment_size, spill_directory);
+            quicrq_spill_segment_close(segment);
+            segment = NULL;
+        }
+    }
+    return segment;
+}
+
+static void quicrq_spill_segment_release(quicrq_spill_segment_t* segment)
+{
+    if (segment->ref_count > 1) {
+        segment->ref_count--;
+    }
+    else {
+        quicrq_spill_segment_close(segment);
+    }
+}
+
+/* Release function of the external buffers pointing to a segment */
+static void quicrq_spill_buffer_release(void* release_ctx, uint8_t* data, size_t length)
+{
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(data);
+    UNREFERENCED_PARAMETER(length);
+#endif
+    quicrq_spill_segment_release((quicrq_spill_segment_t*)release_ctx);
+}
+
+/* Get a segment with room for the group. If the current segment is full,
+ * a new one is started; groups larger than the segment size get a segment
+ * of their own.
+ */
+static quicrq_spill_segment_t* quicrq_spill_segment_get(quicrq_ctx_t* qr_ctx, size_t group_bytes)
+{
+    quicrq_spill_segment_t* segment = qr_ctx->spill_segment;
+
+    if (segment != NULL && segment->segment_size - segment->file_length < group_bytes) {
+        /* The segment is closed when the data it holds leaves the caches */
+        quicrq_spill_segment_release(segment);
+        qr_ctx->spill_segment = NULL;
+        segment = NULL;
+    }
+    if (segment == NULL) {
+        size_t segment_size = (qr_ctx->spill_segment_size > 0) ? qr_ctx->spill_segment_size : QUICRQ_SPILL_SEGMENT_SIZE_DEFAULT;
+
+        if (segment_size < group_bytes) {
+            segment_size = group_bytes;
+        }
+        segment = quicrq_spill_segment_create(qr_ctx->spill_directory, segment_size);
+        qr_ctx->spill_segment = segment;
+    }
+    return segment;
+}
+
+/* Move the data of a complete group to the spill segment. */
+int quicrq_fragment_cache_spill_group(quicrq_ctx_t* qr_ctx, quicrq_fragment_cache_t* cache_ctx, quicrq_cached_group_t* group)
+{
+    int ret = 0;
+    size_t group_bytes = 0;
+    quicrq_spill_segment_t* segment = NULL;
+    quicrq_cached_fragment_t* first_fragment = quicrq_fragment_cache_get_fragment(cache_ctx, group->group_id, 0, 0);
+    quicrq_cached_fragment_t* fragment = first_fragment;
+
+    while (fragment != NULL && fragment->group_id == group->group_id) {
+        group_bytes += fragment->data_length;
+        fragment = (quicrq_cached_fragment_t*)quicrq_fragment_cache_node_value(picosplay_next(&fragment->fragment_node));
+    }
+
+    if ((segment = quicrq_spill_segment_get(qr_ctx, group_bytes)) == NULL) {
+        ret = -1;
+    }
+    else {
+        fragment = first_fragment;
+        while (ret == 0 && fragment != NULL && fragment->group_id == group->group_id) {
+            if (fragment->data_length > 0 && !fragment->is_spilled) {
+                uint8_t* spilled_data = segment->map + segment->file_length;
+                quicrq_fragment_buffer_t* buffer = quicrq_fragment_buffer_create_external(qr_ctx, spilled_data,
+                    fragment->data_length, quicrq_spill_buffer_release, segment);
+
+                if (buffer == NULL) {
+                    ret = -1;
+                }
+                else {
+                    /* Append the data, then serve it from the mapping */
+                    memcpy(spilled_data, fragment->data, fragment->data_length);
+                    segment->ref_count++;
+                    quicrq_fragment_buffer_release(fragment->buffer);
+                    fragment->buffer = buffer;
+                    fragment->data = spilled_data;
+                    fragment->is_spilled = 1;
+                    fragment->spill_offset = segment->file_length;
+                    segment->file_length += fragment->data_length;
+                    cache_ctx->cache_bytes -= fragment->data_length;
+                    cache_ctx->spilled_bytes += fragment->data_length;
+                    qr_ctx->cache_bytes -= fragment->data_length;
+                    qr_ctx->cache_spilled_bytes += fragment->data_length;
+                }
+            }
+            fragment = (quicrq_cached_fragment_t*)quicrq_fragment_cache_node_value(picosplay_next(&fragment->fragment_node));
+        }
+        if (ret == 0) {
+            group->is_spilled = 1;
+            qr_ctx->cache_spilled_groups++;
+        }
+    }
+    return ret;
+}
+
+/* Find the next group of the cache that can be spilled: the first group not
+ * yet spilled, if it is complete, and if it is not the newest group.
+ */
+static quicrq_cached_group_t* quicrq_fragment_cache_spill_candidate(quicrq_fragment_cache_t* cache_ctx)
+{
+    quicrq_cached_group_t* group = NULL;
+
+    if (cache_ctx->next_spill_group_id < cache_ctx->first_group_id) {
+        cache_ctx->next_spill_group_id = cache_ctx->first_group_id;
+    }
+    while (cache_ctx->next_spill_group_id < cache_ctx->highest_group_id &&
+        (group = quicrq_fragment_cache_get_group(cache_ctx, cache_ctx->next_spill_group_id)) != NULL &&
+        group->is_spilled) {
+        cache_ctx->next_spill_group_id++;
+        group = NULL;
+    }
+    if (group != NULL && !group->is_complete) {
+        group = NULL;
+    }
+    return group;
+}
+
+/* Spill groups until the data held in memory fits in the hot limit, or no
+ * group can be spilled. At each step, pick the oldest spillable group of
+ * all caches, by arrival time of its first fragment.
+ * If the spill fails, for example because no segment can be created, the
+ * group stays in memory and the spill is not tried again before the retry
+ * delay, which doubles at each consecutive failure.
+ */
+void quicrq_fragment_cache_spill(quicrq_ctx_t* qr_ctx, uint64_t current_time)
+{
+    int ret = 0;
+
+    if (current_time < qr_ctx->spill_retry_time) {
+        /* Back off after a failure */
+        ret = -1;
+    }
+
+    while (ret == 0 && qr_ctx->spill_directory != NULL && qr_ctx->cache_bytes > qr_ctx->spill_hot_limit) {
+        quicrq_media_source_ctx_t* srce_ctx = qr_ctx->first_source;
+        quicrq_fragment_cache_t* spilled_cache_ctx = NULL;
+        quicrq_cached_group_t* spilled_group = NULL;
+
+        while (srce_ctx != NULL) {
+            quicrq_fragment_cache_t* cache_ctx = srce_ctx->cache_ctx;
+            quicrq_cached_group_t* group = (cache_ctx == NULL || srce_ctx->is_cache_real_time) ? NULL :
+                quicrq_fragment_cache_spill_candidate(cache_ctx);
+
+            if (group != NULL && group->first_fragment != NULL && (spilled_group == NULL ||
+                group->first_fragment->cache_time < spilled_group->first_fragment->cache_time)) {
+                spilled_cache_ctx = cache_ctx;
+                spilled_group = group;
+            }
+            srce_ctx = srce_ctx->next_source;
+        }
+
+        if (spilled_group == NULL) {
+            /* No complete group left in memory */
+            break;
+        }
+        else {
+            ret = quicrq_fragment_cache_spill_group(qr_ctx, spilled_cache_ctx, spilled_group);
+            if (ret == 0) {
+                spilled_cache_ctx->next_spill_group_id = spilled_group->group_id + 1;
+                qr_ctx->spill_retry_delay = 0;
+            }
+            else {
+                qr_ctx->spill_retry_delay = (qr_ctx->spill_retry_delay == 0) ? QUICRQ_SPILL_RETRY_DELAY_MIN :
+                    2 * qr_ctx->spill_retry_delay;
+                if (qr_ctx->spill_retry_delay > QUICRQ_SPILL_RETRY_DELAY_MAX) {
+                    qr_ctx->spill_retry_delay = QUICRQ_SPILL_RETRY_DELAY_MAX;
+                }
+                qr_ctx->spill_retry_time = current_time + qr_ctx->spill_retry_delay;
+            }
+        }
+    }
+}
+
+/* Release the current segment when the spill is disabled or the context deleted.
+ * The segment stays open as long as spilled fragments point to it.
+ */
+void quicrq_spill_release(quicrq_ctx_t* qr_ctx)
+{
+    if (qr_ctx->spill_segment != NULL) {
+        quicrq_spill_segment_release(qr_ctx->spill_segment);
+        qr_ctx->spill_segment = NULL;
+    }
+}
+
+int quicrq_set_cache_spill(quicrq_ctx_t* qr_ctx, const char* spill_directory, size_t hot_limit, size_t segment_size)
+{
+    int ret = 0;
+
+    quicrq_spill_release(qr_ctx);
+    if (qr_ctx->spill_directory != NULL) {
+        free(qr_ctx->spill_directory);
+        qr_ctx->spill_directory = NULL;
+    }
+    qr_ctx->spill_hot_limit = hot_limit;
+    qr_ctx->spill_segment_size = segment_size;
+    qr_ctx->spill_retry_time = 0;
+    qr_ctx->spill_retry_delay = 0;
+    if (spill_directory != NULL) {
+        size_t length = strlen(spill_directory);
+
+        if ((qr_ctx->spill_directory = (char*)malloc(length + 1)) == NULL) {
+            ret = -1;
+        }
+        else {
+            memcpy(qr_ctx->spill_directory, spill_directory, length + 1);
+        }
+    }
+    return ret;
+}
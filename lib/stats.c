@@ -0,0 +1,289 @@
+/* Media statistics of streams, connections and caches */
+#include <stdlib.h>
+#include <string.h>
+#include "quicrq.h"
+#include "quicrq_internal.h"
+#include "quicrq_fragment.h"
+
+/* The bucket of a value is found by shifting the value right until it is below
+ * 16. The number of shifts is the octave, and the remaining bits, between 8 and
+ * 15, select the bucket in the octave. Values below 16 are their own bucket.
+ */
+size_t quicrq_delay_histogram_index(uint64_t value)
+{
+    size_t index = QUICRQ_DELAY_HISTOGRAM_BUCKETS - 1;
+    size_t octave = 0;
+
+    while (value >= 2 * QUICRQ_DELAY_HISTOGRAM_SUB_BUCKETS && octave <= QUICRQ_DELAY_HISTOGRAM_OCTAVES) {
+        value >>= 1;
+        octave++;
+    }
+    if (octave <= QUICRQ_DELAY_HISTOGRAM_OCTAVES) {
+        index = octave * QUICRQ_DELAY_HISTOGRAM_SUB_BUCKETS + (size_t)value;
+    }
+    return index;
+}
+
+/* Largest value that falls in the bucket */
+uint64_t quicrq_delay_histogram_bucket_max(size_t index)
+{
+    uint64_t bucket_max = UINT64_MAX;
+
+    if (index < 2 * QUICRQ_DELAY_HISTOGRAM_SUB_BUCKETS) {
+        bucket_max = index;
+    }
+    else if (index < QUICRQ_DELAY_HISTOGRAM_BUCKETS - 1) {
+        size_t octave = index / QUICRQ_DELAY_HISTOGRAM_SUB_BUCKETS - 1;
+        uint64_t mantissa = QUICRQ_DELAY_HISTOGRAM_SUB_BUCKETS + index % QUICRQ_DELAY_HISTOGRAM_SUB_BUCKETS;
+        bucket_max = ((mantissa + 1) << octave) - 1;
+    }
+    return bucket_max;
+}
+
+void quicrq_delay_histogram_record(quicrq_delay_histogram_t* histogram, uint64_t value)
+{
+    histogram->counts[quicrq_delay_histogram_index(value)]++;
+    histogram->nb_samples++;
+    if (value > histogram->max_value) {
+        histogram->max_value = value;
+    }
+}
+
+void quicrq_delay_histogram_merge(quicrq_delay_histogram_t* histogram, const quicrq_delay_histogram_t* other)
+{
+    if (other != NULL && other->nb_samples > 0) {
+        for (size_t i = 0; i < QUICRQ_DELAY_HISTOGRAM_BUCKETS; i++) {
+            histogram->counts[i] += other->counts[i];
+        }
+        histogram->nb_samples += other->nb_samples;
+        if (other->max_value > histogram->max_value) {
+            histogram->max_value = other->max_value;
+        }
+    }
+}
+
+/* Value below which the given percentile of the samples fall, from 0 to 100.
+ * Returns the upper bound of the bucket, capped by the largest value recorded.
+ */
+uint64_t quicrq_delay_histogram_percentile(const quicrq_delay_histogram_t* histogram, double percentile)
+{
+    uint64_t value = 0;
+
+    if (histogram != NULL && histogram->nb_samples > 0) {
+        uint64_t rank = (uint64_t)((percentile * histogram->nb_samples) / 100.0);
+        uint64_t cumulative = 0;
+        size_t index = 0;
+
+        if (rank >= histogram->nb_samples) {
+            rank = histogram->nb_samples - 1;
+        }
+        while (index < QUICRQ_DELAY_HISTOGRAM_BUCKETS - 1 && cumulative + histogram->counts[index] <= rank) {
+            cumulative += histogram->counts[index];
+            index++;
+        }
+        value = quicrq_delay_histogram_bucket_max(index);
+        if (value > histogram->max_value) {
+            value = histogram->max_value;
+        }
+    }
+    return value;
+}
+
+void quicrq_delay_histogram_summary(const quicrq_delay_histogram_t* histogram, quicrq_delay_stats_t* stats)
+{
+    memset(stats, 0, sizeof(quicrq_delay_stats_t));
+    if (histogram != NULL) {
+        stats->nb_samples = histogram->nb_samples;
+        stats->delay_p50 = quicrq_delay_histogram_percentile(histogram, 50.0);
+        stats->delay_p90 = quicrq_delay_histogram_percentile(histogram, 90.0);
+        stats->delay_p99 = quicrq_delay_histogram_percentile(histogram, 99.0);
+        stats->delay_max = histogram->max_value;
+    }
+}
+
+/* Per hop latency */
+void quicrq_hop_latency_record(quicrq_fragment_cache_t* cache_ctx, quicrq_hop_latency_enum hop_latency, uint64_t delay)
+{
+    quicrq_delay_histogram_record(&cache_ctx->latency.histograms[hop_latency], delay);
+    if (cache_ctx->qr_ctx != NULL) {
+        quicrq_delay_histogram_record(&cache_ctx->qr_ctx->latency.histograms[hop_latency], delay);
+    }
+}
+
+void quicrq_hop_latency_summary(const quicrq_hop_latency_t* latency, quicrq_hop_latency_stats_t* stats)
+{
+    quicrq_delay_histogram_summary(&latency->histograms[quicrq_hop_latency_upstream_queue_delay], &stats->upstream_queue_delay);
+    quicrq_delay_histogram_summary(&latency->histograms[quicrq_hop_latency_receive_to_cache], &stats->receive_to_cache);
+    quicrq_delay_histogram_summary(&latency->histograms[quicrq_hop_latency_cache_to_send], &stats->cache_to_send);
+}
+
+/* Counters */
+void quicrq_media_counters_fragment_sent(quicrq_media_counters_t* counters, size_t length, int is_last_fragment)
+{
+    counters->media.fragments_sent++;
+    counters->media.bytes_sent += length;
+    if (is_last_fragment) {
+        counters->media.objects_sent++;
+    }
+}
+
+void quicrq_media_counters_fragment_received(quicrq_media_counters_t* counters, size_t length, int is_last_fragment, uint8_t flags)
+{
+    counters->media.fragments_received++;
+    counters->media.bytes_received += length;
+    if (flags == 0xff) {
+        counters->media.objects_dropped++;
+    }
+    else if (is_last_fragment) {
+        counters->media.objects_received++;
+    }
+}
+
+int quicrq_media_counters_queue_delay(quicrq_media_counters_t* counters, uint64_t queue_delay)
+{
+    int ret = 0;
+
+    if (counters->queue_delay == NULL) {
+        counters->queue_delay = (quicrq_delay_histogram_t*)malloc(sizeof(quicrq_delay_histogram_t));
+        if (counters->queue_delay == NULL) {
+            ret = -1;
+        }
+        else {
+            memset(counters->queue_delay, 0, sizeof(quicrq_delay_histogram_t));
+        }
+    }
+    if (ret == 0) {
+        /* The queue delay is coded in milliseconds */
+        quicrq_delay_histogram_record(counters->queue_delay, queue_delay * 1000);
+    }
+    return ret;
+}
+
+/* Add the counters of a stream to those of a connection. The queue delays are
+ * not summarized in the media stats, so only the histogram is merged. */
+int quicrq_media_counters_add(quicrq_media_counters_t* counters, const quicrq_media_counters_t* other)
+{
+    int ret = 0;
+
+    counters->media.objects_sent += other->media.objects_sent;
+    counters->media.fragments_sent += other->media.fragments_sent;
+    counters->media.bytes_sent += other->media.bytes_sent;
+    counters->media.objects_received += other->media.objects_received;
+    counters->media.fragments_received += other->media.fragments_received;
+    counters->media.bytes_received += other->media.bytes_received;
+    counters->media.objects_dropped += other->media.objects_dropped;
+    counters->media.fragments_repaired += other->media.fragments_repaired;
+    counters->media.fragments_extra_sent += other->media.fragments_extra_sent;
+    counters->media.fragments_recovered += other->media.fragments_recovered;
+
+    if (other->queue_delay != NULL && other->queue_delay->nb_samples > 0) {
+        if (counters->queue_delay == NULL) {
+            counters->queue_delay = (quicrq_delay_histogram_t*)malloc(sizeof(quicrq_delay_histogram_t));
+            if (counters->queue_delay == NULL) {
+                ret = -1;
+            }
+            else {
+                memset(counters->queue_delay, 0, sizeof(quicrq_delay_histogram_t));
+            }
+        }
+        if (ret == 0) {
+            quicrq_delay_histogram_merge(counters->queue_delay, other->queue_delay);
+        }
+    }
+    return ret;
+}
+
+void quicrq_media_counters_snapshot(const quicrq_media_counters_t* counters, quicrq_media_stats_t* stats)
+{
+    *stats = counters->media;
+    quicrq_delay_histogram_summary(counters->queue_delay, &stats->queue_delay);
+}
+
+void quicrq_media_counters_release(quicrq_media_counters_t* counters)
+{
+    if (counters->queue_delay != NULL) {
+        free(counters->queue_delay);
+        counters->queue_delay = NULL;
+    }
+}
+
+/* Public API */
+quicrq_stream_ctx_t* quicrq_first_stream(quicrq_cnx_ctx_t* cnx_ctx)
+{
+    return cnx_ctx->first_stream;
+}
+
+quicrq_stream_ctx_t* quicrq_next_stream(quicrq_stream_ctx_t* stream_ctx)
+{
+    return stream_ctx->next_stream;
+}
+
+void quicrq_get_stream_stats(quicrq_stream_ctx_t* stream_ctx, quicrq_stream_stats_t* stats)
+{
+    memset(stats, 0, sizeof(quicrq_stream_stats_t));
+    stats->stream_id = stream_ctx->stream_id;
+    stats->transport_mode = stream_ctx->transport_mode;
+    stats->is_sender = stream_ctx->is_sender;
+    quicrq_media_counters_snapshot(&stream_ctx->counters, &stats->media);
+}
+
+/* The histogram of the sum is on the stack, so that taking a snapshot does
+ * not allocate memory. */
+void quicrq_get_cnx_stats(quicrq_cnx_ctx_t* cnx_ctx, quicrq_cnx_stats_t* stats)
+{
+    quicrq_delay_histogram_t queue_delay;
+    quicrq_media_counters_t counters;
+    quicrq_stream_ctx_t* stream_ctx = cnx_ctx->first_stream;
+
+    memset(stats, 0, sizeof(quicrq_cnx_stats_t));
+    memset(&queue_delay, 0, sizeof(quicrq_delay_histogram_t));
+    memset(&counters, 0, sizeof(quicrq_media_counters_t));
+    counters.queue_delay = &queue_delay;
+    (void)quicrq_media_counters_add(&counters, &cnx_ctx->closed_counters);
+    while (stream_ctx != NULL) {
+        (void)quicrq_media_counters_add(&counters, &stream_ctx->counters);
+        stats->nb_streams++;
+        stream_ctx = stream_ctx->next_stream;
+    }
+    stats->is_congested = cnx_ctx->congestion.is_congested;
+    stats->priority_threshold = cnx_ctx->congestion.priority_threshold;
+    quicrq_media_counters_snapshot(&counters, &stats->media);
+}
+
+int quicrq_get_cache_stats(quicrq_ctx_t* qr_ctx, const uint8_t* url, size_t url_length, quicrq_cache_stats_t* stats)
+{
+    int ret = 0;
+    quicrq_media_source_ctx_t* srce_ctx = quicrq_find_local_media_source(qr_ctx, url, url_length);
+
+    memset(stats, 0, sizeof(quicrq_cache_stats_t));
+    if (srce_ctx == NULL || srce_ctx->cache_ctx == NULL) {
+        ret = -1;
+    }
+    else {
+        quicrq_fragment_cache_t* cache_ctx = srce_ctx->cache_ctx;
+        quicrq_stream_ctx_t* stream_ctx = srce_ctx->first_stream;
+
+        stats->cache_bytes = cache_ctx->cache_bytes;
+        stats->evicted_bytes = cache_ctx->evicted_bytes;
+        stats->spilled_bytes = cache_ctx->spilled_bytes;
+        stats->nb_fragments = (size_t)cache_ctx->fragment_tree.size;
+        stats->nb_objects = (size_t)cache_ctx->object_tree.size;
+        stats->nb_object_received = cache_ctx->nb_object_received;
+        stats->first_group_id = cache_ctx->first_group_id;
+        stats->first_object_id = cache_ctx->first_object_id;
+        stats->highest_group_id = cache_ctx->highest_group_id;
+        stats->highest_object_id = cache_ctx->highest_object_id;
+        stats->is_feed_closed = cache_ctx->is_feed_closed;
+        while (stream_ctx != NULL) {
+            stats->nb_readers++;
+            stream_ctx = stream_ctx->next_stream_for_source;
+        }
+        quicrq_hop_latency_summary(&cache_ctx->latency, &stats->latency);
+    }
+    return ret;
+}
+
+void quicrq_get_hop_latency_stats(quicrq_ctx_t* qr_ctx, quicrq_hop_latency_stats_t* stats)
+{
+    quicrq_hop_latency_summary(&qr_ctx->latency, stats);
+}
@@ -0,0 +1,146 @@
+/* Deadlines of the quicrq context */
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include "picoquic_utils.h"
+#include "quicrq.h"
+#include "quicrq_internal.h"
+
+/* The quicrq context manages deadlines for extra repeats, for the deletion
+ * of closed caches, and for the periodic check of the relay cache. Instead
+ * of scanning all connections, streams and sources at each time check, the
+ * deadlines are kept in a binary min heap ordered by deadline. The timers
+ * are embedded in the objects that own them, and each timer remembers its
+ * position in the heap, so it can be moved or removed in O(log n) when the
+ * deadline changes or the owner is deleted.
+ */
+#define QUICRQ_TIMER_HEAP_SIZE_MIN 16
+
+static void quicrq_timer_place(quicrq_timer_heap_t* timers, quicrq_timer_t* timer, size_t index)
+{
+    timers->heap[index] = timer;
+    timer->heap_index = index + 1;
+}
+
+static void quicrq_timer_sift_up(quicrq_timer_heap_t* timers, size_t index)
+{
+    quicrq_timer_t* timer = timers->heap[index];
+
+    while (index > 0) {
+        size_t parent = (index - 1) / 2;
+        if (timers->heap[parent]->deadline <= timer->deadline) {
+            break;
+        }
+        quicrq_timer_place(timers, timers->heap[parent], index);
+        index = parent;
+    }
+    quicrq_timer_place(timers, timer, index);
+}
+
+static void quicrq_timer_sift_down(quicrq_timer_heap_t* timers, size_t index)
+{
+    quicrq_timer_t* timer = timers->heap[index];
+
+    while (2 * index + 1 < timers->nb_timers) {
+        size_t child = 2 * index + 1;
+        if (child + 1 < timers->nb_timers && timers->heap[child + 1]->deadline < timers->heap[child]->deadline) {
+            child++;
+        }
+        if (timer->deadline <= timers->heap[child]->deadline) {
+            break;
+        }
+        quicrq_timer_place(timers, timers->heap[child], index);
+        index = child;
+    }
+    quicrq_timer_place(timers, timer, index);
+}
+
+void quicrq_timer_init(quicrq_timer_t* timer, quicrq_timer_type_enum timer_type)
+{
+    memset(timer, 0, sizeof(quicrq_timer_t));
+    timer->timer_type = timer_type;
+}
+
+int quicrq_timer_set(quicrq_ctx_t* qr_ctx, quicrq_timer_t* timer, uint64_t deadline)
+{
+    int ret = 0;
+    quicrq_timer_heap_t* timers = &qr_ctx->timers;
+
+    if (timer->heap_index != 0) {
+        /* Already scheduled, move the timer to its new place */
+        size_t index = timer->heap_index - 1;
+        timer->deadline = deadline;
+        quicrq_timer_sift_up(timers, index);
+        quicrq_timer_sift_down(timers, timer->heap_index - 1);
+    }
+    else {
+        if (timers->nb_timers >= timers->heap_size) {
+            size_t new_size = (timers->heap_size == 0) ? QUICRQ_TIMER_HEAP_SIZE_MIN : 2 * timers->heap_size;
+            quicrq_timer_t** new_heap = (quicrq_timer_t**)malloc(new_size * sizeof(quicrq_timer_t*));
+            if (new_heap == NULL) {
+                ret = -1;
+            }
+            else {
+                if (timers->heap != NULL) {
+                    memcpy(new_heap, timers->heap, timers->nb_timers * sizeof(quicrq_timer_t*));
+                    free(timers->heap);
+                }
+                timers->heap = new_heap;
+                timers->heap_size = new_size;
+            }
+        }
+        if (ret == 0) {
+            timer->deadline = deadline;
+            timers->heap[timers->nb_timers] = timer;
+            timers->nb_timers++;
+            quicrq_timer_sift_up(timers, timers->nb_timers - 1);
+        }
+    }
+    return ret;
+}
+
+void quicrq_timer_cancel(quicrq_ctx_t* qr_ctx, quicrq_timer_t* timer)
+{
+    if (timer->heap_index != 0) {
+        quicrq_timer_heap_t* timers = &qr_ctx->timers;
+        size_t index = timer->heap_index - 1;
+
+        timers->nb_timers--;
+        if (index < timers->nb_timers) {
+            /* Move the last timer in the hole, then restore the heap order */
+            quicrq_timer_place(timers, timers->heap[timers->nb_timers], index);
+            quicrq_timer_sift_up(timers, index);
+            quicrq_timer_sift_down(timers, timers->heap[index]->heap_index - 1);
+        }
+        timers->heap[timers->nb_timers] = NULL;
+        timer->heap_index = 0;
+    }
+}
+
+uint64_t quicrq_timer_next_deadline(quicrq_ctx_t* qr_ctx)
+{
+    return (qr_ctx->timers.nb_timers == 0) ? UINT64_MAX : qr_ctx->timers.heap[0]->deadline;
+}
+
+/* Remove and return the earliest timer if it is due, or return NULL */
+quicrq_timer_t* quicrq_timer_pop_due(quicrq_ctx_t* qr_ctx, uint64_t current_time)
+{
+    quicrq_timer_t* timer = NULL;
+
+    if (qr_ctx->timers.nb_timers > 0 && qr_ctx->timers.heap[0]->deadline <= current_time) {
+        timer = qr_ctx->timers.heap[0];
+        quicrq_timer_cancel(qr_ctx, timer);
+    }
+    return timer;
+}
+
+void quicrq_timers_release(quicrq_ctx_t* qr_ctx)
+{
+    while (qr_ctx->timers.nb_timers > 0) {
+        quicrq_timer_cancel(qr_ctx, qr_ctx->timers.heap[0]);
+    }
+    if (qr_ctx->timers.heap != NULL) {
+        free(qr_ctx->timers.heap);
+    }
+    memset(&qr_ctx->timers, 0, sizeof(quicrq_timer_heap_t));
+}
@@ -1,4 +1,8 @@
 /* quicr demo app */
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+/* Needed for recvmmsg, sendmmsg and in6_pktinfo */
+#define _GNU_SOURCE
+#endif
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
@@ -31,6 +35,16 @@
 #include <netdb.h>
 #include <netinet/in.h>
 #include <sys/select.h>
+#ifdef __linux__
+/* Worker mode, with batched UDP I/O and SO_REUSEPORT steering */
+#define QUICRQ_APP_WORKERS
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <linux/filter.h>
+#include <netinet/udp.h>
+#endif
 #endif
 
 #include <picoquic.h>
@@ -39,6 +53,9 @@
 #include <picoquic_packet_loop.h>
 #include <autoqlog.h>
 #include <performance_log.h>
+#ifdef QUICRQ_APP_WORKERS
+#include <picoquic_lb.h>
+#endif
 #include "quicrq.h"
 #include "quicrq_relay.h"
 #include "quicrq_test_internal.h"
@@ -50,6 +67,8 @@ typedef enum {
     quicrq_app_mode_client
 } quicrq_app_mode_enum;
 
+#define QUICRQ_APP_WORKERS_MAX 64
+
 typedef struct st_quicrq_app_loop_cb_t {
     quicrq_app_mode_enum mode;
     quicrq_ctx_t* qr_ctx;
@@ -388,33 +407,33 @@ int quic_app_scenario_parse(quicrq_app_loop_cb_t* cb_ctx, char const* scenario,
     return (next_char == NULL) ? -1 : 0;
 }
 
-int quic_app_loop(picoquic_quic_config_t* config,
-    int mode,
-    const char* server_name,
+/* Initialization of an application context: the quicrq context, the
+ * matching picoquic context, the origin or relay function, the client
+ * connection and the local sources of the scenario.
+ */
+int quicrq_app_init_context(quicrq_app_loop_cb_t* cb_ctx, picoquic_quic_t** p_quic,
+    picoquic_quic_config_t* config,
+    quicrq_app_mode_enum mode,
+    char const* sni,
+    struct sockaddr_storage* addr,
     quicrq_transport_mode_enum transport_mode,
     quicrq_congestion_control_enum congestion_control_mode,
     quicrq_subscribe_order_enum subscribe_order,
-    int server_port,
-    char const* scenario)
+    int is_warm_upstreams,
+    char const* scenario,
+    uint64_t current_time)
 {
     int ret = 0;
-
-    /* Initialize the loop callback context */
-    quicrq_app_loop_cb_t cb_ctx = { 0 };
-    struct sockaddr_storage addr = { 0 };
-    int is_name = 0;
-    char const* sni = NULL;
     picoquic_quic_t* quic = NULL;
     quicrq_cnx_ctx_t* cnx_ctx = NULL;
-    uint64_t current_time = picoquic_current_time();
 
-    cb_ctx.qr_ctx = quicrq_create_empty();
+    cb_ctx->qr_ctx = quicrq_create_empty();
 
-    if (cb_ctx.qr_ctx == NULL) {
+    if (cb_ctx->qr_ctx == NULL) {
         ret = -1;
     }
     else {
-        cb_ctx.mode = mode;
+        cb_ctx->mode = mode;
 
         if (config->alpn == NULL) {
             picoquic_config_set_option(config, picoquic_option_ALPN, QUICRQ_ALPN);
@@ -423,17 +442,17 @@ int quic_app_loop(picoquic_quic_config_t* config,
         /* TODO: Verify that the ALPN configured corresponds to our application. */
         /* Create a picoquic context, using the configuration */
         quic = picoquic_create_and_configure(config,
-            quicrq_callback, cb_ctx.qr_ctx,
+            quicrq_callback, cb_ctx->qr_ctx,
             current_time, NULL);
         if (quic == NULL) {
             ret = -1;
         }
         else {
             /* Enable congestion control or not, based on CLI choice */
-            quicrq_enable_congestion_control(cb_ctx.qr_ctx, congestion_control_mode);
+            quicrq_enable_congestion_control(cb_ctx->qr_ctx, congestion_control_mode);
 
             /* Setting logs, etc. */
-            quicrq_set_quic(cb_ctx.qr_ctx, quic);
+            quicrq_set_quic(cb_ctx->qr_ctx, quic);
 
             picoquic_set_key_log_file_from_env(quic);
 
@@ -451,34 +470,21 @@ int quic_app_loop(picoquic_quic_config_t* config,
     }
     /* Set up a default receiver on the server */
     if (ret == 0 && mode == quicrq_app_mode_server) {
-        quicrq_enable_origin(cb_ctx.qr_ctx, transport_mode);
+        quicrq_enable_origin(cb_ctx->qr_ctx, transport_mode);
     }
 
-    /* If client or relay, resolve the address */
-    if (ret == 0 && (mode == quicrq_app_mode_client || mode == quicrq_app_mode_relay)) {
-        ret = picoquic_get_server_address(server_name, server_port, &addr, &is_name);
-        if (ret != 0) {
-            fprintf(stderr, "Cannot find address of %s\n", server_name);
-        }
-        else if (is_name != 0) {
-            sni = server_name;
-        }
-    }
     /* If relay, enable relaying */
     if (ret == 0 && mode == quicrq_app_mode_relay) {
-        ret = quicrq_enable_relay(cb_ctx.qr_ctx, sni, (struct sockaddr*)&addr, transport_mode);
-        if (ret != 0) {
-            fprintf(stderr, "Cannot initialize relay to %s\n", server_name);
-        }
-        else {
-            fprintf(stdout, "Relaying to %s:%d\n", server_name, server_port);
+        ret = quicrq_enable_relay(cb_ctx->qr_ctx, sni, (struct sockaddr*)addr, transport_mode);
+        if (ret == 0 && is_warm_upstreams) {
+            /* Open the upstream connection now, and again when it closes */
+            ret = quicrq_relay_set_warm_upstreams(cb_ctx->qr_ctx, 1);
         }
     }
 
     /* if client, create a connection to the upstream node so we can start the scenarios */
     if (ret == 0 && mode == quicrq_app_mode_client) {
-        if ((cnx_ctx = quicrq_create_client_cnx(cb_ctx.qr_ctx, sni, (struct sockaddr *) &addr)) == NULL) {
-            fprintf(stderr, "Cannot create connection to %s\n", server_name);
+        if ((cnx_ctx = quicrq_create_client_cnx(cb_ctx->qr_ctx, sni, (struct sockaddr *) addr)) == NULL) {
             ret = -1;
         }
     }
@@ -492,31 +498,742 @@ int quic_app_loop(picoquic_quic_config_t* config,
             }
         }
         else {
-            ret = quic_app_scenario_parse(&cb_ctx, scenario, current_time,
+            ret = quic_app_scenario_parse(cb_ctx, scenario, current_time,
                 transport_mode, subscribe_order, cnx_ctx);
         }
     }
 
     /* If relay or origin, delete cached entries longer than 10 seconds */
-    quicrq_set_cache_duration(cb_ctx.qr_ctx, 10000000);
+    if (cb_ctx->qr_ctx != NULL) {
+        quicrq_set_cache_duration(cb_ctx->qr_ctx, 10000000);
+    }
 
-    /* Start the loop */
-    if (ret == 0) {
+    *p_quic = quic;
+
+    return ret;
+}
+
+void quicrq_app_release_context(quicrq_app_loop_cb_t* cb_ctx)
+{
+    /* Release the media sources*/
+    quicrq_app_free_sources(cb_ctx);
+    /* Free the quicrq context */
+    if (cb_ctx->qr_ctx != NULL) {
+        quicrq_delete(cb_ctx->qr_ctx);
+        cb_ctx->qr_ctx = NULL;
+    }
+}
+
+#ifdef QUICRQ_APP_WORKERS
+/* Worker mode.
+ * 
+ * The server or relay runs nb_workers copies of the application context,
+ * each with its own quicrq context, picoquic context, UDP socket and
+ * thread. All sockets are bound to the same port with SO_REUSEPORT,
+ * so the kernel spreads the incoming packets between them. Each worker
+ * runs its own packet loop, which batches the packets received and sent
+ * with recvmmsg and sendmmsg, and uses GRO and GSO unless the picoquic
+ * option "-0" is set.
+ *
+ * A connection must stay on the worker that created it. The connection
+ * identifiers are built by the picoquic load balancer support with the
+ * worker index in clear in their second byte, and a classic BPF program
+ * attached to the reuse port group returns that byte as the index of the
+ * socket: at offset 2 in short header packets, and at offset 7 in long
+ * header packets, after the version and the length of the destination
+ * connection identifier. Initial packets carry a connection identifier
+ * chosen by the client; when the byte does not match a worker, the kernel
+ * falls back to the hash of the addresses, which is stable for the
+ * duration of the handshake. The upstream connections of a relay worker
+ * also use that worker's socket and identifiers, so their replies come
+ * back to the same worker. The sockets are dual stack, and see IPv4 peers
+ * as IPv4-mapped IPv6 addresses; the upstream address is mapped the same way.
+ *
+ * If a worker exits on an error, it sets the stop flag shared by all workers
+ * and wakes them up through their event fd, so that all the loops exit.
+ *
+ * On a server, the first worker publishes the sources of the scenario.
+ * The workers are shard peers of each other, see quicrq_set_shard_peers:
+ * the scenario sources and the media posted by the clients of a worker are
+ * mirrored to the other workers, so every client sees every media. The
+ * shard feeds wake up the other workers through their event fd.
+ *
+ * On a relay, the workers do not share state. Each worker opens its own
+ * connections to the upstream node and keeps its own cache, so the upstream
+ * node receives up to one subscription per worker for the same media, and
+ * the traffic from the upstream node is multiplied by the number of workers.
+ */
+#define QUICRQ_APP_BATCH_MAX 32
+#define QUICRQ_APP_GSO_BUFFER_SIZE 0xFFFF
+#define QUICRQ_APP_CONTROL_SIZE 128
+#define QUICRQ_APP_WAIT_MAX 10000000
+#define QUICRQ_APP_CID_LENGTH 8
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+typedef struct st_quicrq_app_worker_t {
+    int worker_index;
+    int fd;
+    int af;
+    int use_gso;
+    int use_gro;
+    int ret;
+    uint16_t port;
+    picoquic_quic_t* quic;
+    quicrq_app_loop_cb_t cb_ctx;
+    pthread_t thread_id;
+    int is_thread_started;
+    int wake_fd;
+    uint64_t* is_stopping; /* Shared by all the workers */
+    struct st_quicrq_app_worker_t* workers;
+    int nb_workers;
+    size_t buffer_size;
+    uint8_t* buffers;
+    struct mmsghdr msgs[QUICRQ_APP_BATCH_MAX];
+    struct iovec iovs[QUICRQ_APP_BATCH_MAX];
+    struct sockaddr_storage addrs[QUICRQ_APP_BATCH_MAX];
+    uint8_t controls[QUICRQ_APP_BATCH_MAX][QUICRQ_APP_CONTROL_SIZE];
+} quicrq_app_worker_t;
+
+int quicrq_app_worker_socket(quicrq_app_worker_t* worker, int socket_buffer_size)
+{
+    int ret = 0;
+    int one = 1;
+    int zero = 0;
+    struct sockaddr_storage addr = { 0 };
+    socklen_t addr_length;
+
+    worker->af = AF_INET6;
+    if ((worker->fd = socket(AF_INET6, SOCK_DGRAM, IPPROTO_UDP)) < 0) {
+        worker->af = AF_INET;
+        worker->fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    }
+
+    if (worker->fd < 0) {
+        ret = -1;
+    }
+    else if (setsockopt(worker->fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) != 0 ||
+        setsockopt(worker->fd, IPPROTO_IP, IP_PKTINFO, &one, sizeof(one)) != 0 ||
+        (worker->af == AF_INET6 &&
+            (setsockopt(worker->fd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero)) != 0 ||
+            setsockopt(worker->fd, IPPROTO_IPV6, IPV6_RECVPKTINFO, &one, sizeof(one)) != 0))) {
+        ret = -1;
+    }
+    else if (socket_buffer_size > 0 &&
+        (setsockopt(worker->fd, SOL_SOCKET, SO_SNDBUF, &socket_buffer_size, sizeof(socket_buffer_size)) != 0 ||
+        setsockopt(worker->fd, SOL_SOCKET, SO_RCVBUF, &socket_buffer_size, sizeof(socket_buffer_size)) != 0)) {
+        ret = -1;
+    }
+    else {
+        if (worker->af == AF_INET6) {
+            struct sockaddr_in6* addr6 = (struct sockaddr_in6*)&addr;
+            addr6->sin6_family = AF_INET6;
+            addr6->sin6_port = htons(worker->port);
+            addr_length = sizeof(struct sockaddr_in6);
+        }
+        else {
+            struct sockaddr_in* addr4 = (struct sockaddr_in*)&addr;
+            addr4->sin_family = AF_INET;
+            addr4->sin_port = htons(worker->port);
+            addr_length = sizeof(struct sockaddr_in);
+        }
+        ret = bind(worker->fd, (struct sockaddr*)&addr, addr_length);
+    }
+
+    if (ret == 0 && worker->use_gro &&
+        setsockopt(worker->fd, SOL_UDP, UDP_GRO, &one, sizeof(one)) != 0) {
+        /* Older kernels do not support GRO. Receive packets one by one. */
+        worker->use_gro = 0;
+    }
+
+    if (ret != 0) {
+        fprintf(stderr, "Cannot open the socket of worker %d on port %d, errno = %d\n",
+            worker->worker_index, worker->port, errno);
+    }
+
+    return ret;
+}
+
+/* The sockets of the workers are dual stack, so the packets of an IPv4 peer
+ * arrive from an IPv4-mapped address. Map the upstream address of a relay
+ * in the same way, so that the replies match the address of the connection. */
+void quicrq_app_worker_map_address(quicrq_app_worker_t* worker, struct sockaddr_storage* addr,
+    struct sockaddr_storage* worker_addr)
+{
+    if (worker->af == AF_INET6 && addr->ss_family == AF_INET) {
+        struct sockaddr_in* addr4 = (struct sockaddr_in*)addr;
+        struct sockaddr_in6* addr6 = (struct sockaddr_in6*)worker_addr;
+
+        memset(worker_addr, 0, sizeof(struct sockaddr_storage));
+        addr6->sin6_family = AF_INET6;
+        addr6->sin6_port = addr4->sin_port;
+        addr6->sin6_addr.s6_addr[10] = 0xff;
+        addr6->sin6_addr.s6_addr[11] = 0xff;
+        memcpy(addr6->sin6_addr.s6_addr + 12, &addr4->sin_addr, 4);
+    }
+    else {
+        memcpy(worker_addr, addr, sizeof(struct sockaddr_storage));
+    }
+}
+
+/* Wake up a worker waiting in ppoll, from another thread. */
+void quicrq_app_worker_wakeup(void* v_worker)
+{
+    quicrq_app_worker_t* worker = (quicrq_app_worker_t*)v_worker;
+    uint64_t one = 1;
+
+    if (write(worker->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        fprintf(stderr, "Cannot wake up worker %d, errno = %d\n", worker->worker_index, errno);
+    }
+}
+
+/* Stop all the workers when one of them exits. */
+void quicrq_app_workers_stop(quicrq_app_worker_t* worker)
+{
+    if (__atomic_exchange_n(worker->is_stopping, 1, __ATOMIC_SEQ_CST) == 0) {
+        for (int i = 0; i < worker->nb_workers; i++) {
+            if (i != worker->worker_index) {
+                quicrq_app_worker_wakeup(&worker->workers[i]);
+            }
+        }
+    }
+}
+
+/* Attach the steering program to the reuse port group, once all sockets
+ * are bound. The index returned by the program is the order in which the
+ * sockets were bound, i.e., the worker index.
+ */
+int quicrq_app_workers_steer(quicrq_app_worker_t* workers)
+{
+    int ret = 0;
+    struct sock_filter code[] = {
+        /* A = first byte. If the long header bit is set, go to the long header case */
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 0),
+        BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x80, 2, 0),
+        /* Short header: worker index is the second byte of the DCID */
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 2),
+        BPF_STMT(BPF_RET | BPF_A, 0),
+        /* Long header: skip the version and the DCID length */
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 7),
+        BPF_STMT(BPF_RET | BPF_A, 0)
+    };
+    struct sock_fprog prog = { 0 };
+
+    prog.len = (unsigned short)(sizeof(code) / sizeof(code[0]));
+    prog.filter = code;
+
+    if (setsockopt(workers[0].fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) != 0) {
+        fprintf(stderr, "Cannot attach the steering program, errno = %d\n", errno);
+        ret = -1;
+    }
+    return ret;
+}
+
+/* Configure the connection identifiers of the worker so that their
+ * second byte is the worker index. */
+int quicrq_app_worker_set_cid(quicrq_app_worker_t* worker)
+{
+    int ret = 0;
+    picoquic_load_balancer_config_t lb_config;
+
+    memset(&lb_config, 0, sizeof(lb_config));
+    lb_config.method = picoquic_load_balancer_cid_clear;
+    lb_config.server_id_length = 1;
+    lb_config.nonce_length = QUICRQ_APP_CID_LENGTH - 2;
+    lb_config.connection_id_length = QUICRQ_APP_CID_LENGTH;
+    lb_config.first_byte = 0;
+    lb_config.server_id64 = (uint64_t)worker->worker_index;
+
+    if ((ret = picoquic_lb_compat_cid_config(worker->quic, &lb_config)) != 0) {
+        fprintf(stderr, "Cannot configure the connection ids of worker %d\n", worker->worker_index);
+    }
+    return ret;
+}
+
+/* Find the local address and interface, and the GRO segment size,
+ * in the control data of a received message. */
+void quicrq_app_worker_parse_control(quicrq_app_worker_t* worker, struct msghdr* msg,
+    struct sockaddr_storage* addr_to, int* if_index, size_t* segment_size)
+{
+    struct cmsghdr* cmsg;
+
+    memset(addr_to, 0, sizeof(struct sockaddr_storage));
+    if (worker->af == AF_INET6) {
+        ((struct sockaddr_in6*)addr_to)->sin6_family = AF_INET6;
+        ((struct sockaddr_in6*)addr_to)->sin6_port = htons(worker->port);
+    }
+    else {
+        ((struct sockaddr_in*)addr_to)->sin_family = AF_INET;
+        ((struct sockaddr_in*)addr_to)->sin_port = htons(worker->port);
+    }
+
+    for (cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_PKTINFO) {
+            struct in_pktinfo pktinfo;
+            memcpy(&pktinfo, CMSG_DATA(cmsg), sizeof(pktinfo));
+            *if_index = (int)pktinfo.ipi_ifindex;
+            if (worker->af == AF_INET6) {
+                /* IPv4 packet received on a dual stack socket */
+                uint8_t* a6 = ((struct sockaddr_in6*)addr_to)->sin6_addr.s6_addr;
+                a6[10] = 0xff;
+                a6[11] = 0xff;
+                memcpy(a6 + 12, &pktinfo.ipi_addr, 4);
+            }
+            else {
+                ((struct sockaddr_in*)addr_to)->sin_addr = pktinfo.ipi_addr;
+            }
+        }
+        else if (cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_PKTINFO) {
+            struct in6_pktinfo pktinfo6;
+            memcpy(&pktinfo6, CMSG_DATA(cmsg), sizeof(pktinfo6));
+            *if_index = (int)pktinfo6.ipi6_ifindex;
+            ((struct sockaddr_in6*)addr_to)->sin6_addr = pktinfo6.ipi6_addr;
+        }
+        else if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+            int gro_size = 0;
+            memcpy(&gro_size, CMSG_DATA(cmsg), sizeof(int));
+            if (gro_size > 0) {
+                *segment_size = (size_t)gro_size;
+            }
+        }
+    }
+}
+
+/* Receive a batch of messages, and submit each of the packets that
+ * they contain to picoquic. */
+int quicrq_app_worker_receive(quicrq_app_worker_t* worker)
+{
+    int ret = 0;
+    int nb_received;
+
+    for (int i = 0; i < QUICRQ_APP_BATCH_MAX; i++) {
+        struct msghdr* msg = &worker->msgs[i].msg_hdr;
+        memset(msg, 0, sizeof(struct msghdr));
+        worker->iovs[i].iov_base = worker->buffers + i * worker->buffer_size;
+        worker->iovs[i].iov_len = worker->buffer_size;
+        msg->msg_name = &worker->addrs[i];
+        msg->msg_namelen = sizeof(struct sockaddr_storage);
+        msg->msg_iov = &worker->iovs[i];
+        msg->msg_iovlen = 1;
+        msg->msg_control = worker->controls[i];
+        msg->msg_controllen = QUICRQ_APP_CONTROL_SIZE;
+        worker->msgs[i].msg_len = 0;
+    }
+
+    nb_received = recvmmsg(worker->fd, worker->msgs, QUICRQ_APP_BATCH_MAX, MSG_DONTWAIT, NULL);
+
+    if (nb_received < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            fprintf(stderr, "Worker %d, recvmmsg error, errno = %d\n", worker->worker_index, errno);
+            ret = -1;
+        }
+    }
+    else {
+        uint64_t current_time = picoquic_current_time();
+
+        for (int i = 0; ret == 0 && i < nb_received; i++) {
+            struct sockaddr_storage addr_to;
+            int if_index = 0;
+            size_t msg_length = worker->msgs[i].msg_len;
+            size_t segment_size = msg_length;
+            uint8_t* bytes = worker->buffers + i * worker->buffer_size;
+
+            quicrq_app_worker_parse_control(worker, &worker->msgs[i].msg_hdr, &addr_to, &if_index, &segment_size);
+            for (size_t offset = 0; offset < msg_length; offset += segment_size) {
+                size_t length = (msg_length - offset < segment_size) ? msg_length - offset : segment_size;
+                /* Errors on a single packet do not stop the loop. */
+                (void)picoquic_incoming_packet(worker->quic, bytes + offset, (uint32_t)length,
+                    (struct sockaddr*)&worker->addrs[i], (struct sockaddr*)&addr_to, if_index, 0, current_time);
+            }
+        }
+    }
+    return ret;
+}
+
+/* Fill the message header for sending one buffer, with the source address
+ * chosen by picoquic and the GSO segment size if the buffer holds several
+ * packets. The destination is already in worker->addrs[i]. */
+void quicrq_app_worker_set_message(quicrq_app_worker_t* worker, int i, uint8_t* buffer, size_t length,
+    struct sockaddr_storage* addr_from, int if_index, size_t send_msg_size)
+{
+    struct msghdr* msg = &worker->msgs[i].msg_hdr;
+    struct cmsghdr* cmsg;
+    size_t control_length = 0;
+
+    memset(msg, 0, sizeof(struct msghdr));
+    memset(worker->controls[i], 0, QUICRQ_APP_CONTROL_SIZE);
+    worker->iovs[i].iov_base = buffer;
+    worker->iovs[i].iov_len = length;
+    msg->msg_name = &worker->addrs[i];
+    msg->msg_namelen = (worker->addrs[i].ss_family == AF_INET) ?
+        sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6);
+    msg->msg_iov = &worker->iovs[i];
+    msg->msg_iovlen = 1;
+    msg->msg_control = worker->controls[i];
+    msg->msg_controllen = QUICRQ_APP_CONTROL_SIZE;
+
+    cmsg = CMSG_FIRSTHDR(msg);
+    if (addr_from->ss_family == AF_INET6 && worker->af == AF_INET6) {
+        struct in6_pktinfo pktinfo6;
+        memset(&pktinfo6, 0, sizeof(pktinfo6));
+        pktinfo6.ipi6_addr = ((struct sockaddr_in6*)addr_from)->sin6_addr;
+        pktinfo6.ipi6_ifindex = (unsigned int)if_index;
+        cmsg->cmsg_level = IPPROTO_IPV6;
+        cmsg->cmsg_type = IPV6_PKTINFO;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(pktinfo6));
+        memcpy(CMSG_DATA(cmsg), &pktinfo6, sizeof(pktinfo6));
+        control_length += CMSG_SPACE(sizeof(pktinfo6));
+        cmsg = CMSG_NXTHDR(msg, cmsg);
+    }
+    else if (addr_from->ss_family == AF_INET && worker->af == AF_INET) {
+        struct in_pktinfo pktinfo;
+        memset(&pktinfo, 0, sizeof(pktinfo));
+        pktinfo.ipi_spec_dst = ((struct sockaddr_in*)addr_from)->sin_addr;
+        pktinfo.ipi_ifindex = if_index;
+        cmsg->cmsg_level = IPPROTO_IP;
+        cmsg->cmsg_type = IP_PKTINFO;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(pktinfo));
+        memcpy(CMSG_DATA(cmsg), &pktinfo, sizeof(pktinfo));
+        control_length += CMSG_SPACE(sizeof(pktinfo));
+        cmsg = CMSG_NXTHDR(msg, cmsg);
+    }
+    if (send_msg_size > 0 && send_msg_size < length && cmsg != NULL) {
+        uint16_t segment_size = (uint16_t)send_msg_size;
+        cmsg->cmsg_level = SOL_UDP;
+        cmsg->cmsg_type = UDP_SEGMENT;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(segment_size));
+        memcpy(CMSG_DATA(cmsg), &segment_size, sizeof(segment_size));
+        control_length += CMSG_SPACE(sizeof(segment_size));
+    }
+
+    msg->msg_controllen = control_length;
+    if (control_length == 0) {
+        msg->msg_control = NULL;
+    }
+}
+
+/* Send a batch of messages. As in the picoquic packet loop, send errors
+ * only cause packet losses, which the transport will repair: the message
+ * that failed is skipped, and the rest of the batch is sent. If the
+ * interface does not support GSO, the worker stops using it. */
+void quicrq_app_worker_flush(quicrq_app_worker_t* worker, int nb_msgs)
+{
+    int nb_sent = 0;
+
+    while (nb_sent < nb_msgs) {
+        int nb = sendmmsg(worker->fd, worker->msgs + nb_sent, (unsigned int)(nb_msgs - nb_sent), 0);
+        if (nb > 0) {
+            nb_sent += nb;
+        }
+        else if (nb < 0 && errno == EINTR) {
+            /* Try again */
+        }
+        else {
+            if (nb < 0 && errno == EIO && worker->use_gso) {
+                fprintf(stderr, "Worker %d, GSO not supported, disabled.\n", worker->worker_index);
+                worker->use_gso = 0;
+            }
+            nb_sent++;
+        }
+    }
+}
+
+/* Prepare all the packets that picoquic has ready, and send them in batches. */
+int quicrq_app_worker_send(quicrq_app_worker_t* worker)
+{
+    int ret = 0;
+    int nb_msgs = 0;
+    int is_done = 0;
+    uint64_t current_time = picoquic_current_time();
+    picoquic_cnx_t* last_cnx = NULL;
+
+    while (ret == 0 && !is_done) {
+        size_t send_length = 0;
+        size_t send_msg_size = 0;
+        int if_index = 0;
+        struct sockaddr_storage addr_from;
+        uint8_t* buffer = worker->buffers + nb_msgs * worker->buffer_size;
+
+        memset(&addr_from, 0, sizeof(addr_from));
+        ret = picoquic_prepare_next_packet_ex(worker->quic, current_time, buffer,
+            (worker->use_gso) ? worker->buffer_size : PICOQUIC_MAX_PACKET_SIZE,
+            &send_length, &worker->addrs[nb_msgs], &addr_from, &if_index, NULL, &last_cnx,
+            (worker->use_gso) ? &send_msg_size : NULL);
+        if (ret == 0 && send_length > 0) {
+            quicrq_app_worker_set_message(worker, nb_msgs, buffer, send_length, &addr_from, if_index, send_msg_size);
+            nb_msgs++;
+        }
+        else {
+            is_done = 1;
+        }
+        if (nb_msgs > 0 && (is_done || nb_msgs >= QUICRQ_APP_BATCH_MAX)) {
+            quicrq_app_worker_flush(worker, nb_msgs);
+            nb_msgs = 0;
+        }
+    }
+    return ret;
+}
+
+/* Packet loop of a worker, using the same callbacks as the picoquic loop */
+void* quicrq_app_worker_loop(void* v_worker)
+{
+    quicrq_app_worker_t* worker = (quicrq_app_worker_t*)v_worker;
+    int ret = 0;
+
+    while (ret == 0 && __atomic_load_n(worker->is_stopping, __ATOMIC_ACQUIRE) == 0) {
+        packet_loop_time_check_arg_t time_check_arg;
+        struct pollfd pfd[2];
+        struct timespec timeout;
+
+        time_check_arg.current_time = picoquic_current_time();
+        time_check_arg.delta_t = picoquic_get_next_wake_delay(worker->quic, time_check_arg.current_time, QUICRQ_APP_WAIT_MAX);
+        ret = quicrq_app_loop_cb(worker->quic, picoquic_packet_loop_time_check, &worker->cb_ctx, &time_check_arg);
+        if (ret == 0) {
+            pfd[0].fd = worker->fd;
+            pfd[0].events = POLLIN;
+            pfd[0].revents = 0;
+            pfd[1].fd = worker->wake_fd;
+            pfd[1].events = POLLIN;
+            pfd[1].revents = 0;
+            timeout.tv_sec = (time_t)(time_check_arg.delta_t / 1000000);
+            timeout.tv_nsec = (long)((time_check_arg.delta_t % 1000000) * 1000);
+            if (ppoll(pfd, 2, &timeout, NULL) > 0 && (pfd[1].revents & POLLIN) != 0) {
+                /* Reset the event counter, the next time check does the work */
+                uint64_t nb_wakeups = 0;
+                if (read(worker->wake_fd, &nb_wakeups, sizeof(nb_wakeups)) < 0 && errno != EAGAIN) {
+                    fprintf(stderr, "Worker %d, cannot read the event fd, errno = %d\n", worker->worker_index, errno);
+                    ret = -1;
+                }
+            }
+            if (ret == 0 && (pfd[0].revents & POLLIN) != 0) {
+                ret = quicrq_app_worker_receive(worker);
+                if (ret == 0) {
+                    ret = quicrq_app_loop_cb(worker->quic, picoquic_packet_loop_after_receive, &worker->cb_ctx, NULL);
+                }
+            }
+        }
+        if (ret == 0) {
+            ret = quicrq_app_worker_send(worker);
+            if (ret == 0) {
+                ret = quicrq_app_loop_cb(worker->quic, picoquic_packet_loop_after_send, &worker->cb_ctx, NULL);
+            }
+        }
+    }
+    worker->ret = ret;
+    quicrq_app_workers_stop(worker);
+
+    return NULL;
+}
+
+/* On a server, mirror the media of each worker to all the others. */
+int quicrq_app_workers_set_peers(quicrq_app_worker_t* workers, int nb_workers)
+{
+    int ret = 0;
+    quicrq_ctx_t* peers[QUICRQ_APP_WORKERS_MAX];
+
+    for (int i = 0; i < nb_workers; i++) {
+        peers[i] = workers[i].cb_ctx.qr_ctx;
+    }
+    for (int i = 0; ret == 0 && i < nb_workers; i++) {
+        if ((ret = quicrq_set_shard_peers(peers[i], peers, (size_t)nb_workers, 0)) != 0) {
+            fprintf(stderr, "Cannot set the shard peers of worker %d\n", i);
+        }
+    }
+    return ret;
+}
+
+int quicrq_app_workers_loop(picoquic_quic_config_t* config,
+    quicrq_app_mode_enum mode,
+    char const* sni,
+    struct sockaddr_storage* addr,
+    quicrq_transport_mode_enum transport_mode,
+    quicrq_congestion_control_enum congestion_control_mode,
+    quicrq_subscribe_order_enum subscribe_order,
+    int is_warm_upstreams,
+    char const* scenario,
+    int nb_workers,
+    uint64_t current_time)
+{
+    int ret = 0;
+    uint64_t is_stopping = 0;
+    int use_gso = !config->do_not_use_gso;
+    size_t buffer_size = (use_gso) ? QUICRQ_APP_GSO_BUFFER_SIZE : PICOQUIC_MAX_PACKET_SIZE;
+    quicrq_app_worker_t* workers = (quicrq_app_worker_t*)malloc(nb_workers * sizeof(quicrq_app_worker_t));
+
+    if (workers == NULL) {
+        ret = -1;
+    }
+    else {
+        memset(workers, 0, nb_workers * sizeof(quicrq_app_worker_t));
+        for (int i = 0; i < nb_workers; i++) {
+            workers[i].fd = -1;
+            workers[i].wake_fd = -1;
+        }
+        /* Bind the sockets and create the contexts in the order of the workers */
+        for (int i = 0; ret == 0 && i < nb_workers; i++) {
+            quicrq_app_worker_t* worker = &workers[i];
+            struct sockaddr_storage worker_addr;
+            worker->worker_index = i;
+            worker->is_stopping = &is_stopping;
+            worker->workers = workers;
+            worker->nb_workers = nb_workers;
+            worker->port = (uint16_t)config->server_port;
+            worker->use_gso = use_gso;
+            worker->use_gro = use_gso;
+            worker->buffer_size = buffer_size;
+            if ((worker->buffers = (uint8_t*)malloc(QUICRQ_APP_BATCH_MAX * buffer_size)) == NULL ||
+                (worker->wake_fd = eventfd(0, EFD_NONBLOCK)) < 0) {
+                fprintf(stderr, "Cannot allocate the resources of worker %d\n", i);
+                ret = -1;
+            }
+            else if ((ret = quicrq_app_worker_socket(worker, config->socket_buffer_size)) == 0) {
+                quicrq_app_worker_map_address(worker, addr, &worker_addr);
+                /* Only the first worker publishes the scenario, the others mirror it */
+                if ((ret = quicrq_app_init_context(&worker->cb_ctx, &worker->quic, config, mode, sni, &worker_addr,
+                    transport_mode, congestion_control_mode, subscribe_order, is_warm_upstreams,
+                    (i == 0) ? scenario : NULL, current_time)) == 0) {
+                    quicrq_set_publish_wakeup_fn(worker->cb_ctx.qr_ctx, quicrq_app_worker_wakeup, worker);
+                    ret = quicrq_app_worker_set_cid(worker);
+                }
+            }
+        }
+        if (ret == 0 && mode == quicrq_app_mode_server && nb_workers > 1) {
+            ret = quicrq_app_workers_set_peers(workers, nb_workers);
+        }
+        if (ret == 0 && mode == quicrq_app_mode_relay) {
+            fprintf(stdout, "Relaying to the upstream node from %d workers, each with its own upstream connections\n", nb_workers);
+        }
+        if (ret == 0 && nb_workers > 1 && quicrq_app_workers_steer(workers) != 0) {
+            ret = -1;
+        }
+        /* Start the threads */
+        if (ret == 0) {
+            fprintf(stdout, "Waiting for packets on %d workers.\n", nb_workers);
+        }
+        for (int i = 0; ret == 0 && i < nb_workers; i++) {
+            if (pthread_create(&workers[i].thread_id, NULL, quicrq_app_worker_loop, &workers[i]) != 0) {
+                fprintf(stderr, "Cannot start worker %d\n", i);
+                ret = -1;
+            }
+            else {
+                workers[i].is_thread_started = 1;
+            }
+        }
+        if (ret != 0) {
+            /* Stop the workers already started */
+            __atomic_store_n(&is_stopping, 1, __ATOMIC_RELEASE);
+            for (int i = 0; i < nb_workers; i++) {
+                if (workers[i].is_thread_started) {
+                    quicrq_app_worker_wakeup(&workers[i]);
+                }
+            }
+        }
+        /* Wait until the workers exit, and then clean up */
+        for (int i = 0; i < nb_workers; i++) {
+            if (workers[i].is_thread_started) {
+                pthread_join(workers[i].thread_id, NULL);
+                if (ret == 0) {
+                    ret = workers[i].ret;
+                }
+            }
+        }
+        for (int i = 0; i < nb_workers; i++) {
+            quicrq_app_release_context(&workers[i].cb_ctx);
+        }
+        for (int i = 0; i < nb_workers; i++) {
+            if (workers[i].fd >= 0) {
+                close(workers[i].fd);
+            }
+            if (workers[i].wake_fd >= 0) {
+                close(workers[i].wake_fd);
+            }
+            if (workers[i].buffers != NULL) {
+                free(workers[i].buffers);
+            }
+        }
+        free(workers);
+    }
+
+    return ret;
+}
+#endif
+
+int quic_app_loop(picoquic_quic_config_t* config,
+    int mode,
+    const char* server_name,
+    quicrq_transport_mode_enum transport_mode,
+    quicrq_congestion_control_enum congestion_control_mode,
+    quicrq_subscribe_order_enum subscribe_order,
+    int is_warm_upstreams,
+    int server_port,
+    char const* scenario,
+    int nb_workers)
+{
+    int ret = 0;
+
+    /* Initialize the loop callback context */
+    quicrq_app_loop_cb_t cb_ctx = { 0 };
+    struct sockaddr_storage addr = { 0 };
+    int is_name = 0;
+    char const* sni = NULL;
+    picoquic_quic_t* quic = NULL;
+    uint64_t current_time = picoquic_current_time();
+
+    /* If client or relay, resolve the address */
+    if (mode == quicrq_app_mode_client || mode == quicrq_app_mode_relay) {
+        ret = picoquic_get_server_address(server_name, server_port, &addr, &is_name);
+        if (ret != 0) {
+            fprintf(stderr, "Cannot find address of %s\n", server_name);
+        }
+        else if (is_name != 0) {
+            sni = server_name;
+        }
+    }
+
+    if (ret == 0 && nb_workers > 0) {
+#ifdef QUICRQ_APP_WORKERS
+        /* Run the server or relay on several workers */
+        ret = quicrq_app_workers_loop(config, mode, sni, &addr, transport_mode,
+            congestion_control_mode, subscribe_order, is_warm_upstreams, scenario, nb_workers, current_time);
+#else
+        fprintf(stderr, "Workers are not supported on this platform.\n");
+        ret = -1;
+#endif
+    }
+    else if (ret == 0) {
+        ret = quicrq_app_init_context(&cb_ctx, &quic, config, mode, sni, &addr, transport_mode,
+            congestion_control_mode, subscribe_order, is_warm_upstreams, scenario, current_time);
+        if (ret != 0) {
+            if (mode == quicrq_app_mode_relay) {
+                fprintf(stderr, "Cannot initialize relay to %s\n", server_name);
+            }
+            else if (mode == quicrq_app_mode_client) {
+                fprintf(stderr, "Cannot create connection to %s\n", server_name);
+            }
+        }
+        else if (mode == quicrq_app_mode_relay) {
+            fprintf(stdout, "Relaying to %s:%d\n", server_name, server_port);
+        }
+
+        /* Start the loop */
+        if (ret == 0) {
 #if _WINDOWS
-        ret = picoquic_packet_loop_win(quic, config->server_port, 0, config->dest_if,
-            config->socket_buffer_size, quicrq_app_loop_cb, &cb_ctx);
+            ret = picoquic_packet_loop_win(quic, config->server_port, 0, config->dest_if,
+                config->socket_buffer_size, quicrq_app_loop_cb, &cb_ctx);
 #else
-        ret = picoquic_packet_loop(quic, config->server_port, 0, config->dest_if,
-            config->socket_buffer_size, config->do_not_use_gso, quicrq_app_loop_cb, &cb_ctx);
+            ret = picoquic_packet_loop(quic, config->server_port, 0, config->dest_if,
+                config->socket_buffer_size, config->do_not_use_gso, quicrq_app_loop_cb, &cb_ctx);
 #endif
+        }
+        quicrq_app_release_context(&cb_ctx);
     }
 
     /* And exit */
     printf("Quicrq_app loop exit, ret = %d (0x%x)\n", ret, ret);
-    /* Release the media sources*/
-    quicrq_app_free_sources(&cb_ctx);
-    /* Free the quicrq context */
-    quicrq_delete(cb_ctx.qr_ctx);
 
     return ret;
 }
@@ -535,10 +1252,21 @@ void usage()
     fprintf(stderr, "                        -f 1  drop low priority frames,\n");
     fprintf(stderr, "                        -f 2  drop tail of group of block,\n");
     fprintf(stderr, "                        -f 3  lower priority of previous group of blocks,\n");
+    fprintf(stderr, "                        -f 4  drop priority levels that exceed the pacing rate,\n");
     fprintf(stderr, "                        -f 0  do not drop any frame (default).\n");
     fprintf(stderr, "  -u subscribe_order    Specify in what order the client processes objects.\n");
     fprintf(stderr, "                        -u 1  process in order (default).\n");
     fprintf(stderr, "                        -u 2  skip ahead to last received group.\n");
+    fprintf(stderr, "  -Z nb_workers         Server or relay only, Linux only: run nb_workers\n");
+    fprintf(stderr, "                        packet loops, each with its own SO_REUSEPORT socket,\n");
+    fprintf(stderr, "                        thread and context, using recvmmsg and sendmmsg,\n");
+    fprintf(stderr, "                        and GSO and GRO unless -0 is set. Server workers\n");
+    fprintf(stderr, "                        mirror their media to each other; each relay worker\n");
+    fprintf(stderr, "                        opens its own upstream connections.\n");
+    fprintf(stderr, "  -Y                    Relay only: keep the upstream connections warm,\n");
+    fprintf(stderr, "                        open them at start and again when they close.\n");
+    fprintf(stderr, "                        With a ticket store, set with -T, the new\n");
+    fprintf(stderr, "                        connections resume the session and use 0-RTT.\n");
     fprintf(stderr, "\nOn the client, the scenario argument specifies the media files\n");
     fprintf(stderr, "that should be retrieved (get) or published (post):\n");
     fprintf(stderr, "  *{{'get'|'post'}':'<url>':'<path>[':'<log_path>]';'}\n");
@@ -562,6 +1290,8 @@ int main(int argc, char** argv)
     int congestion_mode = 0;
     int subscribe_order = 1;
     char const* scenario = NULL;
+    int nb_workers = 0;
+    int is_warm_upstreams = 0;
 #ifdef _WINDOWS
     WSADATA wsaData = { 0 };
     (void)WSA_START(MAKEWORD(2, 2), &wsaData);
@@ -569,8 +1299,8 @@ int main(int argc, char** argv)
     fprintf(stdout, "QUICRQ Version %s, Picoquic Version %s\n", QUICRQ_VERSION, PICOQUIC_VERSION);
 
     picoquic_config_init(&config);
-    memcpy(option_string, "f:u:", 5);
-    ret = picoquic_config_option_letters(option_string + 4, sizeof(option_string) - 4, NULL);
+    memcpy(option_string, "f:u:Z:Y", 8);
+    ret = picoquic_config_option_letters(option_string + 7, sizeof(option_string) - 7, NULL);
 
     if (ret == 0) {
         /* Get the parameters */
@@ -590,6 +1320,16 @@ int main(int argc, char** argv)
                     usage();
                 }
                 break;
+            case 'Z':
+                nb_workers = atoi(optarg);
+                if (nb_workers <= 0 || nb_workers > QUICRQ_APP_WORKERS_MAX) {
+                    fprintf(stderr, "Invalid number of workers: %s\n", optarg);
+                    usage();
+                }
+                break;
+            case 'Y':
+                is_warm_upstreams = 1;
+                break;
             case 'h':
                 usage();
                 break;
@@ -671,13 +1411,23 @@ int main(int argc, char** argv)
             fprintf(stderr, "Extra argument not expected: %s\n", optarg);
             usage();
         }
+
+        if (nb_workers > 0 && mode == quicrq_app_mode_client) {
+            fprintf(stderr, "Workers are only supported in server or relay mode.\n");
+            usage();
+        }
+
+        if (is_warm_upstreams && mode != quicrq_app_mode_relay) {
+            fprintf(stderr, "Warm upstreams are only supported in relay mode.\n");
+            usage();
+        }
     }
 
     /* Run */
     ret = quic_app_loop(&config, mode, server_name, transport_mode, 
         (quicrq_congestion_control_enum)congestion_mode, 
-        (quicrq_subscribe_order_enum)subscribe_order,
-        server_port, scenario);
+        (quicrq_subscribe_order_enum)subscribe_order, is_warm_upstreams,
+        server_port, scenario, nb_workers);
     /* Clean up */
     picoquic_config_clear(&config);
     /* Exit */
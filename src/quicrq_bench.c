@@ -0,0 +1,717 @@
+/* Microbenchmarks of the quicrq hot paths.
+ *
+ * Each benchmark is defined by a setup function, which prepares the state
+ * for a number of operations, a run function, which is timed, and a cleanup
+ * function. The setup and cleanup are not timed. For each benchmark, the
+ * program runs one warmup pass, then the specified number of timed passes,
+ * and reports the median and minimum time per operation in nanoseconds, as
+ * well as the median number of CPU cycles per operation on platforms where
+ * the time stamp counter is available.
+ *
+ * Benchmarks of operations that consume the state, such as the purge of the
+ * cache, also have a refill function. Each operation is then timed on its
+ * own, and the state is refilled before it, outside of the timed region.
+ *
+ * The cache and reassembly benchmarks use fragments of 256 bytes, objects of
+ * 4 fragments and groups of 30 objects. The "reordered" input reverses the
+ * order of fragments by blocks of 2 objects. The "lossy" input delays one
+ * fragment out of 16 to the end of a block of 16 objects, as if it was
+ * lost and repaired. The "cache_purge" benchmark refills the cache with one
+ * complete group before each purge.
+ */
+#ifdef _WINDOWS
+#include "getopt.h"
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#else
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#endif
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <inttypes.h>
+#include "picoquic_utils.h"
+#include "quicrq.h"
+#include "quicrq_reassembly.h"
+#include "quicrq_internal.h"
+#include "quicrq_fragment.h"
+
+#define QUICRQ_MICROBENCH_FRAGMENT_SIZE 256
+#define QUICRQ_MICROBENCH_FRAGMENTS_PER_OBJECT 4
+#define QUICRQ_MICROBENCH_OBJECTS_PER_GROUP 30
+#define QUICRQ_MICROBENCH_MESSAGE_MAX (QUICRQ_MICROBENCH_FRAGMENT_SIZE + 64)
+
+/* Results of the benchmarked calls are accumulated here, so that they are not optimized out */
+volatile uint64_t quicrq_microbench_sink = 0;
+
+typedef enum {
+    quicrq_microbench_in_order = 0,
+    quicrq_microbench_reordered,
+    quicrq_microbench_lossy
+} quicrq_microbench_order_enum;
+
+typedef enum {
+    quicrq_microbench_format_text = 0,
+    quicrq_microbench_format_csv,
+    quicrq_microbench_format_json
+} quicrq_microbench_format_enum;
+
+typedef struct st_quicrq_microbench_fragment_t {
+    uint64_t group_id;
+    uint64_t object_id;
+    uint64_t offset;
+    uint64_t nb_objects_previous_group;
+} quicrq_microbench_fragment_t;
+
+typedef struct st_quicrq_microbench_ctx_t {
+    uint64_t simulated_time;
+    quicrq_ctx_t* qr_ctx;
+    quicrq_fragment_cache_t* cache_ctx;
+    quicrq_media_source_ctx_t srce_ctx;
+    quicrq_reassembly_context_t reassembly_ctx;
+    quicrq_microbench_fragment_t* fragments;
+    size_t nb_fragments;
+    uint8_t data[QUICRQ_MICROBENCH_FRAGMENT_SIZE];
+    uint8_t message[QUICRQ_MICROBENCH_MESSAGE_MAX];
+    size_t message_length;
+    uint64_t refill_group_id;
+    uint64_t sink;
+} quicrq_microbench_ctx_t;
+
+typedef struct st_quicrq_microbench_def_t {
+    char const* name;
+    int (*setup_fn)(quicrq_microbench_ctx_t* ctx, size_t nb_ops);
+    int (*run_fn)(quicrq_microbench_ctx_t* ctx, size_t nb_ops);
+    void (*cleanup_fn)(quicrq_microbench_ctx_t* ctx);
+    int (*refill_fn)(quicrq_microbench_ctx_t* ctx); /* If not NULL, called before each timed operation */
+} quicrq_microbench_def_t;
+
+typedef struct st_quicrq_microbench_result_t {
+    size_t nb_ops;
+    int nb_passes;
+    double ns_per_op_median;
+    double ns_per_op_min;
+    double cycles_per_op_median;
+} quicrq_microbench_result_t;
+
+static uint64_t quicrq_microbench_ns()
+{
+    struct timespec ts;
+
+    (void)timespec_get(&ts, TIME_UTC);
+    return ((uint64_t)ts.tv_sec) * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t quicrq_microbench_cycles()
+{
+#if (defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))) || (!defined(_WINDOWS) && (defined(__x86_64__) || defined(__i386__)))
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+/* Build the list of fragments submitted to the cache or to the reassembly */
+static int quicrq_microbench_fragments_create(quicrq_microbench_ctx_t* ctx, size_t nb_ops, quicrq_microbench_order_enum order)
+{
+    int ret = 0;
+
+    ctx->fragments = (quicrq_microbench_fragment_t*)malloc(nb_ops * sizeof(quicrq_microbench_fragment_t));
+    if (ctx->fragments == NULL) {
+        ret = -1;
+    }
+    else {
+        size_t block_size = (order == quicrq_microbench_reordered) ? 2 * QUICRQ_MICROBENCH_FRAGMENTS_PER_OBJECT :
+            16 * QUICRQ_MICROBENCH_FRAGMENTS_PER_OBJECT;
+
+        memset(ctx->fragments, 0, nb_ops * sizeof(quicrq_microbench_fragment_t));
+        ctx->nb_fragments = nb_ops;
+        for (size_t i = 0; i < nb_ops; i++) {
+            size_t rank = i;
+            size_t block_start = i - (i % block_size);
+
+            if (block_start + block_size <= nb_ops) {
+                switch (order) {
+                case quicrq_microbench_reordered:
+                    /* Reverse the order of the fragments in the block */
+                    rank = block_start + block_size - 1 - (i - block_start);
+                    break;
+                case quicrq_microbench_lossy: {
+                    /* Move one fragment out of 16 to the end of the block */
+                    size_t nb_delayed = block_size / 16;
+                    size_t nb_direct = block_size - nb_delayed;
+                    size_t x = i - block_start;
+
+                    if (x < nb_direct) {
+                        rank = block_start + x + (x / 15);
+                    }
+                    else {
+                        rank = block_start + 15 + 16 * (x - nb_direct);
+                    }
+                    break;
+                }
+                default:
+                    break;
+                }
+            }
+            {
+                uint64_t object_rank = rank / QUICRQ_MICROBENCH_FRAGMENTS_PER_OBJECT;
+                quicrq_microbench_fragment_t* fragment = &ctx->fragments[i];
+
+                fragment->group_id = object_rank / QUICRQ_MICROBENCH_OBJECTS_PER_GROUP;
+                fragment->object_id = object_rank % QUICRQ_MICROBENCH_OBJECTS_PER_GROUP;
+                fragment->offset = (rank % QUICRQ_MICROBENCH_FRAGMENTS_PER_OBJECT) * QUICRQ_MICROBENCH_FRAGMENT_SIZE;
+                fragment->nb_objects_previous_group = (fragment->group_id > 0 && fragment->object_id == 0) ?
+                    QUICRQ_MICROBENCH_OBJECTS_PER_GROUP : 0;
+            }
+        }
+    }
+    return ret;
+}
+
+static void quicrq_microbench_cleanup(quicrq_microbench_ctx_t* ctx)
+{
+    if (ctx->fragments != NULL) {
+        free(ctx->fragments);
+        ctx->fragments = NULL;
+    }
+    ctx->nb_fragments = 0;
+    if (ctx->cache_ctx != NULL) {
+        quicrq_fragment_cache_delete_ctx(ctx->cache_ctx);
+        ctx->cache_ctx = NULL;
+    }
+    quicrq_reassembly_release(&ctx->reassembly_ctx);
+}
+
+/* Codec benchmarks */
+static int quicrq_microbench_codec_setup(quicrq_microbench_ctx_t* ctx, size_t nb_ops)
+{
+    int ret = 0;
+    uint8_t* bytes = quicrq_fragment_msg_encode(ctx->message, ctx->message + sizeof(ctx->message), QUICRQ_ACTION_FRAGMENT,
+        1234, 17, 30, QUICRQ_MICROBENCH_FRAGMENT_SIZE, 4 * QUICRQ_MICROBENCH_FRAGMENT_SIZE, 0x80,
+        QUICRQ_MICROBENCH_FRAGMENT_SIZE, ctx->data);
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(nb_ops);
+#endif
+
+    if (bytes == NULL) {
+        ret = -1;
+    }
+    else {
+        ctx->message_length = bytes - ctx->message;
+    }
+    return ret;
+}
+
+static int quicrq_microbench_datagram_header_encode_run(quicrq_microbench_ctx_t* ctx, size_t nb_ops)
+{
+    int ret = 0;
+
+    for (size_t i = 0; ret == 0 && i < nb_ops; i++) {
+        uint8_t* bytes = quicrq_datagram_header_encode(ctx->message, ctx->message + sizeof(ctx->message), 3,
+            1234 + (i >> 5), i & 31, (i & 3) * QUICRQ_MICROBENCH_FRAGMENT_SIZE, 0, 0x80, 30,
+            4 * QUICRQ_MICROBENCH_FRAGMENT_SIZE);
+        if (bytes == NULL) {
+            ret = -1;
+        }
+        else {
+            ctx->sink += bytes - ctx->message;
+        }
+    }
+    return ret;
+}
+
+static int quicrq_microbench_datagram_header_decode_setup(quicrq_microbench_ctx_t* ctx, size_t nb_ops)
+{
+    int ret = 0;
+    uint8_t* bytes = quicrq_datagram_header_encode(ctx->message, ctx->message + sizeof(ctx->message), 3,
+        1234, 17, QUICRQ_MICROBENCH_FRAGMENT_SIZE, 0, 0x80, 30, 4 * QUICRQ_MICROBENCH_FRAGMENT_SIZE);
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(nb_ops);
+#endif
+
+    if (bytes == NULL) {
+        ret = -1;
+    }
+    else {
+        ctx->message_length = bytes - ctx->message;
+    }
+    return ret;
+}
+
+static int quicrq_microbench_datagram_header_decode_run(quicrq_microbench_ctx_t* ctx, size_t nb_ops)
+{
+    int ret = 0;
+
+    for (size_t i = 0; ret == 0 && i < nb_ops; i++) {
+        uint64_t media_id;
+        uint64_t group_id;
+        uint64_t object_id;
+        uint64_t object_offset;
+        uint64_t queue_delay;
+        uint8_t flags;
+        uint64_t nb_objects_previous_group;
+        uint64_t object_length;
+
+        if (quicrq_datagram_header_decode(ctx->message, ctx->message + ctx->message_length, &media_id, &group_id,
+            &object_id, &object_offset, &queue_delay, &flags, &nb_objects_previous_group, &object_length) == NULL) {
+            ret = -1;
+        }
+        else {
+            ctx->sink += object_id + object_offset;
+        }
+    }
+    return ret;
+}
+
+static int quicrq_microbench_fragment_msg_encode_run(quicrq_microbench_ctx_t* ctx, size_t nb_ops)
+{
+    int ret = 0;
+
+    for (size_t i = 0; ret == 0 && i < nb_ops; i++) {
+        uint8_t* bytes = quicrq_fragment_msg_encode(ctx->message, ctx->message + sizeof(ctx->message), QUICRQ_ACTION_FRAGMENT,
+            1234 + (i >> 5), i & 31, 30, (i & 3) * QUICRQ_MICROBENCH_FRAGMENT_SIZE, 4 * QUICRQ_MICROBENCH_FRAGMENT_SIZE,
+            0x80, QUICRQ_MICROBENCH_FRAGMENT_SIZE, ctx->data);
+        if (bytes == NULL) {
+            ret = -1;
+        }
+        else {
+            ctx->sink += bytes - ctx->message;
+        }
+    }
+    return ret;
+}
+
+static int quicrq_microbench_fragment_msg_decode_run(quicrq_microbench_ctx_t* ctx, size_t nb_ops)
+{
+    int ret = 0;
+
+    for (size_t i = 0; ret == 0 && i < nb_ops; i++) {
+        uint64_t message_type;
+        uint64_t group_id;
+        uint64_t object_id;
+        uint64_t nb_objects_previous_group;
+        uint64_t offset;
+        uint64_t object_length;
+        uint8_t flags;
+        size_t length;
+        const uint8_t* data;
+
+        if (quicrq_fragment_msg_decode(ctx->message, ctx->message + ctx->message_length, &message_type, &group_id,
+            &object_id, &nb_objects_previous_group, &offset, &object_length, &flags, &length, &data) == NULL) {
+            ret = -1;
+        }
+        else {
+            ctx->sink += object_id + length;
+        }
+    }
+    return ret;
+}
+
+static int quicrq_microbench_msg_decode_run(quicrq_microbench_ctx_t* ctx, size_t nb_ops)
+{
+    int ret = 0;
+
+    for (size_t i = 0; ret == 0 && i < nb_ops; i++) {
+        quicrq_message_t msg;
+
+        if (quicrq_msg_decode(ctx->message, ctx->message + ctx->message_length, &msg) == NULL) {
+            ret = -1;
+        }
+        else {
+            ctx->sink += msg.object_id + msg.fragment_length;
+        }
+    }
+    return ret;
+}
+
+/* Fragment cache benchmarks */
+static int quicrq_microbench_propose_setup(quicrq_microbench_ctx_t* ctx, size_t nb_ops)
+{
+    int ret = quicrq_microbench_fragments_create(ctx, nb_ops, quicrq_microbench_in_order);
+
+    if (ret == 0 && (ctx->cache_ctx = quicrq_fragment_cache_create_ctx(ctx->qr_ctx)) == NULL) {
+        ret = -1;
+    }
+    if (ret == 0) {
+        /* A source without subscribed streams, which is not queued for wakeup */
+        memset(&ctx->srce_ctx, 0, sizeof(ctx->srce_ctx));
+        ctx->srce_ctx.cache_ctx = ctx->cache_ctx;
+        ctx->cache_ctx->srce_ctx = &ctx->srce_ctx;
+    }
+    return ret;
+}
+
+static int quicrq_microbench_propose_run(quicrq_microbench_ctx_t* ctx, size_t nb_ops)
+{
+    int ret = 0;
+
+    for (size_t i = 0; ret == 0 && i < nb_ops; i++) {
+        quicrq_microbench_fragment_t* fragment = &ctx->fragments[i];
+
+        ret = quicrq_fragment_propose_to_cache(ctx->cache_ctx, ctx->data, fragment->group_id, fragment->object_id,
+            fragment->offset, 0, 0x80, fragment->nb_objects_previous_group,
+            QUICRQ_MICROBENCH_FRAGMENT_SIZE * QUICRQ_MICROBENCH_FRAGMENTS_PER_OBJECT, QUICRQ_MICROBENCH_FRAGMENT_SIZE,
+            ctx->simulated_time);
+    }
+    return ret;
+}
+
+/* The purge benchmark keeps the fragments of one group, and adds them to the
+ * cache as the next group before each purge. */
+static int quicrq_microbench_purge_setup(quicrq_microbench_ctx_t* ctx, size_t nb_ops)
+{
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(nb_ops);
+#endif
+    ctx->refill_group_id = 0;
+
+    return quicrq_microbench_propose_setup(ctx, QUICRQ_MICROBENCH_FRAGMENTS_PER_OBJECT * QUICRQ_MICROBENCH_OBJECTS_PER_GROUP);
+}
+
+static int quicrq_microbench_purge_refill(quicrq_microbench_ctx_t* ctx)
+{
+    int ret = 0;
+
+    for (size_t i = 0; ret == 0 && i < ctx->nb_fragments; i++) {
+        quicrq_microbench_fragment_t* fragment = &ctx->fragments[i];
+
+        ret = quicrq_fragment_propose_to_cache(ctx->cache_ctx, ctx->data, ctx->refill_group_id, fragment->object_id,
+            fragment->offset, 0, 0x80, (ctx->refill_group_id > 0 && fragment->object_id == 0) ? QUICRQ_MICROBENCH_OBJECTS_PER_GROUP : 0,
+            QUICRQ_MICROBENCH_FRAGMENT_SIZE * QUICRQ_MICROBENCH_FRAGMENTS_PER_OBJECT, QUICRQ_MICROBENCH_FRAGMENT_SIZE,
+            ctx->simulated_time);
+    }
+    ctx->refill_group_id++;
+
+    return ret;
+}
+
+static int quicrq_microbench_purge_run(quicrq_microbench_ctx_t* ctx, size_t nb_ops)
+{
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(nb_ops);
+#endif
+    /* The source has no subscribed streams, so the refilled group is purged */
+    quicrq_fragment_cache_media_purge_to_gob(&ctx->srce_ctx);
+    ctx->sink += ctx->cache_ctx->first_group_id;
+
+    return 0;
+}
+
+/* Reassembly benchmarks */
+static int quicrq_microbench_object_ready(void* media_ctx, uint64_t current_time, uint64_t group_id, uint64_t object_id,
+    uint8_t flags, const uint8_t* data, size_t data_length, quicrq_reassembly_object_mode_enum object_mode)
+{
+    quicrq_microbench_ctx_t* ctx = (quicrq_microbench_ctx_t*)media_ctx;
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(current_time);
+    UNREFERENCED_PARAMETER(group_id);
+    UNREFERENCED_PARAMETER(object_id);
+    UNREFERENCED_PARAMETER(flags);
+    UNREFERENCED_PARAMETER(data);
+    UNREFERENCED_PARAMETER(object_mode);
+#endif
+    ctx->sink += data_length;
+
+    return 0;
+}
+
+static int quicrq_microbench_reassembly_setup(quicrq_microbench_ctx_t* ctx, size_t nb_ops, quicrq_microbench_order_enum order)
+{
+    int ret = quicrq_microbench_fragments_create(ctx, nb_ops, order);
+
+    memset(&ctx->reassembly_ctx, 0, sizeof(ctx->reassembly_ctx));
+    quicrq_reassembly_init(&ctx->reassembly_ctx);
+    ctx->reassembly_ctx.qr_ctx = ctx->qr_ctx;
+
+    return ret;
+}
+
+static int quicrq_microbench_reassembly_in_order_setup(quicrq_microbench_ctx_t* ctx, size_t nb_ops)
+{
+    return quicrq_microbench_reassembly_setup(ctx, nb_ops, quicrq_microbench_in_order);
+}
+
+static int quicrq_microbench_reassembly_reordered_setup(quicrq_microbench_ctx_t* ctx, size_t nb_ops)
+{
+    return quicrq_microbench_reassembly_setup(ctx, nb_ops, quicrq_microbench_reordered);
+}
+
+static int quicrq_microbench_reassembly_lossy_setup(quicrq_microbench_ctx_t* ctx, size_t nb_ops)
+{
+    return quicrq_microbench_reassembly_setup(ctx, nb_ops, quicrq_microbench_lossy);
+}
+
+static int quicrq_microbench_reassembly_run(quicrq_microbench_ctx_t* ctx, size_t nb_ops)
+{
+    int ret = 0;
+
+    for (size_t i = 0; ret == 0 && i < nb_ops; i++) {
+        quicrq_microbench_fragment_t* fragment = &ctx->fragments[i];
+
+        ret = quicrq_reassembly_input(&ctx->reassembly_ctx, ctx->simulated_time, ctx->data, fragment->group_id,
+            fragment->object_id, fragment->offset, 0, 0x80, fragment->nb_objects_previous_group,
+            QUICRQ_MICROBENCH_FRAGMENT_SIZE * QUICRQ_MICROBENCH_FRAGMENTS_PER_OBJECT, QUICRQ_MICROBENCH_FRAGMENT_SIZE,
+            quicrq_microbench_object_ready, ctx);
+    }
+    return ret;
+}
+
+static const quicrq_microbench_def_t microbench_table[] = {
+    { "datagram_header_encode", quicrq_microbench_codec_setup, quicrq_microbench_datagram_header_encode_run, quicrq_microbench_cleanup, NULL },
+    { "datagram_header_decode", quicrq_microbench_datagram_header_decode_setup, quicrq_microbench_datagram_header_decode_run, quicrq_microbench_cleanup, NULL },
+    { "fragment_msg_encode", quicrq_microbench_codec_setup, quicrq_microbench_fragment_msg_encode_run, quicrq_microbench_cleanup, NULL },
+    { "fragment_msg_decode", quicrq_microbench_codec_setup, quicrq_microbench_fragment_msg_decode_run, quicrq_microbench_cleanup, NULL },
+    { "msg_decode", quicrq_microbench_codec_setup, quicrq_microbench_msg_decode_run, quicrq_microbench_cleanup, NULL },
+    { "propose_to_cache", quicrq_microbench_propose_setup, quicrq_microbench_propose_run, quicrq_microbench_cleanup, NULL },
+    { "cache_purge", quicrq_microbench_purge_setup, quicrq_microbench_purge_run, quicrq_microbench_cleanup, quicrq_microbench_purge_refill },
+    { "reassembly_in_order", quicrq_microbench_reassembly_in_order_setup, quicrq_microbench_reassembly_run, quicrq_microbench_cleanup, NULL },
+    { "reassembly_reordered", quicrq_microbench_reassembly_reordered_setup, quicrq_microbench_reassembly_run, quicrq_microbench_cleanup, NULL },
+    { "reassembly_lossy", quicrq_microbench_reassembly_lossy_setup, quicrq_microbench_reassembly_run, quicrq_microbench_cleanup, NULL }
+};
+
+static size_t const nb_microbench = sizeof(microbench_table) / sizeof(quicrq_microbench_def_t);
+
+static int quicrq_microbench_compare_double(const void* a, const void* b)
+{
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+
+    return (x < y) ? -1 : ((x > y) ? 1 : 0);
+}
+
+/* Run the warmup pass and the timed passes of a benchmark */
+static int quicrq_microbench_run_one(quicrq_microbench_ctx_t* ctx, const quicrq_microbench_def_t* def,
+    size_t nb_ops, size_t nb_warmup_ops, int nb_passes, quicrq_microbench_result_t* result)
+{
+    int ret = 0;
+    double* ns_per_op = (double*)malloc(nb_passes * sizeof(double));
+    double* cycles_per_op = (double*)malloc(nb_passes * sizeof(double));
+
+    memset(result, 0, sizeof(quicrq_microbench_result_t));
+    result->nb_ops = nb_ops;
+    result->nb_passes = nb_passes;
+
+    if (ns_per_op == NULL || cycles_per_op == NULL) {
+        ret = -1;
+    }
+    else if (nb_warmup_ops > 0) {
+        if ((ret = def->setup_fn(ctx, nb_warmup_ops)) == 0) {
+            if (def->refill_fn == NULL) {
+                ret = def->run_fn(ctx, nb_warmup_ops);
+            }
+            else {
+                for (size_t i = 0; ret == 0 && i < nb_warmup_ops; i++) {
+                    if ((ret = def->refill_fn(ctx)) == 0) {
+                        ret = def->run_fn(ctx, 1);
+                    }
+                }
+            }
+        }
+        def->cleanup_fn(ctx);
+    }
+
+    for (int pass = 0; ret == 0 && pass < nb_passes; pass++) {
+        if ((ret = def->setup_fn(ctx, nb_ops)) == 0) {
+            uint64_t cycles_total = 0;
+            uint64_t ns_total = 0;
+
+            if (def->refill_fn == NULL) {
+                uint64_t cycles_start = quicrq_microbench_cycles();
+                uint64_t ns_start = quicrq_microbench_ns();
+
+                ret = def->run_fn(ctx, nb_ops);
+                ns_total = quicrq_microbench_ns() - ns_start;
+                cycles_total = quicrq_microbench_cycles() - cycles_start;
+            }
+            else {
+                for (size_t i = 0; ret == 0 && i < nb_ops; i++) {
+                    /* Refill the state outside of the timed region */
+                    if ((ret = def->refill_fn(ctx)) == 0) {
+                        uint64_t cycles_start = quicrq_microbench_cycles();
+                        uint64_t ns_start = quicrq_microbench_ns();
+
+                        ret = def->run_fn(ctx, 1);
+                        ns_total += quicrq_microbench_ns() - ns_start;
+                        cycles_total += quicrq_microbench_cycles() - cycles_start;
+                    }
+                }
+            }
+            ns_per_op[pass] = ((double)ns_total) / ((double)nb_ops);
+            cycles_per_op[pass] = ((double)cycles_total) / ((double)nb_ops);
+        }
+        def->cleanup_fn(ctx);
+    }
+
+    if (ret == 0) {
+        qsort(ns_per_op, nb_passes, sizeof(double), quicrq_microbench_compare_double);
+        qsort(cycles_per_op, nb_passes, sizeof(double), quicrq_microbench_compare_double);
+        result->ns_per_op_median = ns_per_op[nb_passes / 2];
+        result->ns_per_op_min = ns_per_op[0];
+        result->cycles_per_op_median = cycles_per_op[nb_passes / 2];
+    }
+
+    if (ns_per_op != NULL) {
+        free(ns_per_op);
+    }
+    if (cycles_per_op != NULL) {
+        free(cycles_per_op);
+    }
+    return ret;
+}
+
+static void quicrq_microbench_report(FILE* F, quicrq_microbench_format_enum format, char const* name,
+    const quicrq_microbench_result_t* result, int is_first)
+{
+    switch (format) {
+    case quicrq_microbench_format_csv:
+        if (is_first) {
+            fprintf(F, "name,ops,passes,ns_per_op_median,ns_per_op_min,cycles_per_op_median\n");
+        }
+        fprintf(F, "%s,%zu,%d,%.2f,%.2f,%.1f\n", name, result->nb_ops, result->nb_passes,
+            result->ns_per_op_median, result->ns_per_op_min, result->cycles_per_op_median);
+        break;
+    case quicrq_microbench_format_json:
+        fprintf(F, "%s\n  { \"name\": \"%s\", \"ops\": %zu, \"passes\": %d, \"ns_per_op_median\": %.2f, \"ns_per_op_min\": %.2f, \"cycles_per_op_median\": %.1f }",
+            (is_first) ? "[" : ",", name, result->nb_ops, result->nb_passes,
+            result->ns_per_op_median, result->ns_per_op_min, result->cycles_per_op_median);
+        break;
+    default:
+        if (is_first) {
+            fprintf(F, "%-24s %10s %12s %12s %12s\n", "benchmark", "ops", "ns/op", "min ns/op", "cycles/op");
+        }
+        fprintf(F, "%-24s %10zu %12.2f %12.2f %12.1f\n", name, result->nb_ops,
+            result->ns_per_op_median, result->ns_per_op_min, result->cycles_per_op_median);
+        break;
+    }
+    fflush(F);
+}
+
+static int usage(char const* argv0)
+{
+    fprintf(stderr, "QUICRQ microbenchmarks\n");
+    fprintf(stderr, "\nUsage: %s [options] [benchmark1 [benchmark2 ..[benchmarkN]]]\n\n", argv0);
+    fprintf(stderr, "Valid benchmark names are: \n");
+    for (size_t x = 0; x < nb_microbench; x++) {
+        fprintf(stderr, "    %s\n", microbench_table[x].name);
+    }
+    fprintf(stderr, "Options: \n");
+    fprintf(stderr, "  -n nb_ops         Number of operations per pass, default 100000.\n");
+    fprintf(stderr, "  -w nb_ops         Number of operations in the warmup pass, default 10000.\n");
+    fprintf(stderr, "  -p nb_passes      Number of timed passes, default 5.\n");
+    fprintf(stderr, "  -f format         Output format, text, csv or json.\n");
+    fprintf(stderr, "  -h                Print this help message\n");
+
+    return -1;
+}
+
+int main(int argc, char** argv)
+{
+    int ret = 0;
+    int opt;
+    size_t nb_ops = 100000;
+    size_t nb_warmup_ops = 10000;
+    int nb_passes = 5;
+    int nb_reported = 0;
+    quicrq_microbench_format_enum format = quicrq_microbench_format_text;
+    quicrq_microbench_ctx_t ctx;
+
+    memset(&ctx, 0, sizeof(ctx));
+    for (size_t i = 0; i < sizeof(ctx.data); i++) {
+        ctx.data[i] = (uint8_t)i;
+    }
+
+    while (ret == 0 && (opt = getopt(argc, argv, "n:w:p:f:h")) != -1) {
+        switch (opt) {
+        case 'n':
+            nb_ops = (size_t)strtoul(optarg, NULL, 10);
+            if (nb_ops == 0) {
+                ret = usage(argv[0]);
+            }
+            break;
+        case 'w':
+            nb_warmup_ops = (size_t)strtoul(optarg, NULL, 10);
+            break;
+        case 'p':
+            nb_passes = atoi(optarg);
+            if (nb_passes <= 0) {
+                ret = usage(argv[0]);
+            }
+            break;
+        case 'f':
+            if (strcmp(optarg, "text") == 0) {
+                format = quicrq_microbench_format_text;
+            }
+            else if (strcmp(optarg, "csv") == 0) {
+                format = quicrq_microbench_format_csv;
+            }
+            else if (strcmp(optarg, "json") == 0) {
+                format = quicrq_microbench_format_json;
+            }
+            else {
+                ret = usage(argv[0]);
+            }
+            break;
+        case 'h':
+            usage(argv[0]);
+            exit(0);
+            break;
+        default:
+            ret = usage(argv[0]);
+            break;
+        }
+    }
+
+    for (int arg_num = optind; ret == 0 && arg_num < argc; arg_num++) {
+        size_t i = 0;
+        while (i < nb_microbench && strcmp(argv[arg_num], microbench_table[i].name) != 0) {
+            i++;
+        }
+        if (i >= nb_microbench) {
+            fprintf(stderr, "Incorrect benchmark name: %s\n", argv[arg_num]);
+            ret = usage(argv[0]);
+        }
+    }
+
+    /* The cache and reassembly benchmarks allocate from the pools of a quicrq context */
+    if (ret == 0 && (ctx.qr_ctx = quicrq_create(QUICRQ_ALPN, NULL, NULL, NULL, NULL, NULL, NULL, 0, &ctx.simulated_time)) == NULL) {
+        fprintf(stderr, "Could not create the quicrq context.\n");
+        ret = -1;
+    }
+
+    for (size_t i = 0; ret == 0 && i < nb_microbench; i++) {
+        int is_selected = (optind >= argc);
+
+        for (int arg_num = optind; !is_selected && arg_num < argc; arg_num++) {
+            is_selected = (strcmp(argv[arg_num], microbench_table[i].name) == 0);
+        }
+        if (is_selected) {
+            quicrq_microbench_result_t result;
+
+            if ((ret = quicrq_microbench_run_one(&ctx, &microbench_table[i], nb_ops, nb_warmup_ops, nb_passes, &result)) != 0) {
+                fprintf(stderr, "Benchmark %s failed, ret = %d\n", microbench_table[i].name, ret);
+            }
+            else {
+                quicrq_microbench_report(stdout, format, microbench_table[i].name, &result, nb_reported == 0);
+                nb_reported++;
+            }
+        }
+    }
+
+    if (format == quicrq_microbench_format_json && nb_reported > 0) {
+        fprintf(stdout, "\n]\n");
+    }
+
+    if (ctx.qr_ctx != NULL) {
+        quicrq_delete(ctx.qr_ctx);
+    }
+
+    quicrq_microbench_sink += ctx.sink;
+
+    return (ret);
+}
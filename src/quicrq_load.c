@@ -0,0 +1,725 @@
+/* Load generator for quicrq relays.
+ *
+ * The load generator connects publishers and subscribers to a relay or an origin
+ * over UDP, using the synthetic media sources of the tests. Each publisher uses
+ * its own connection to post a generated media. Each subscriber uses its own
+ * connection to get one of the media, chosen in round robin. The publishers and
+ * subscribers are spread over several threads, each with its own quicrq and
+ * picoquic context, socket and packet loop.
+ *
+ * The number of subscribers follows a profile, defined as a list of steps
+ * "<nb_subscribers>@<seconds>" with increasing times. Between two steps, the
+ * number of subscribers varies linearly. Subscribers join in order of their
+ * index and leave in reverse order. A subscriber that left does not join again,
+ * so after a decrease the number of subscribers only grows again above the
+ * highest number reached before. All subscribers leave at the time of the last
+ * step, and the media sources end at the same time.
+ *
+ * For each subscriber, the generator records the join time, i.e., the delay
+ * between the subscription and the first object, the end to end delay of the
+ * objects, computed from the time at which the publisher produced them since
+ * publishers and subscribers use the same clock, the number of objects
+ * skipped by the relays and of objects missing, and the throughput.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+#ifdef _WINDOWS
+#define WIN32_LEAN_AND_MEAN
+#include "getopt.h"
+#include <WinSock2.h>
+#include <Windows.h>
+#else /* Linux */
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#include <picoquic.h>
+#include <picosocks.h>
+#include <picoquic_utils.h>
+#include <picoquic_packet_loop.h>
+#include "quicrq.h"
+#include "quicrq_test_internal.h"
+
+#define QUICRQ_LOAD_PROFILE_MAX 32
+#define QUICRQ_LOAD_TICK 10000
+#define QUICRQ_LOAD_DRAIN_TIME 2000000
+#define QUICRQ_LOAD_URL_MAX 64
+
+#ifdef _WINDOWS
+typedef HANDLE quicrq_load_thread_t;
+#else
+typedef pthread_t quicrq_load_thread_t;
+#endif
+
+typedef struct st_quicrq_load_step_t {
+    uint64_t step_time;
+    size_t nb_subscribers;
+} quicrq_load_step_t;
+
+typedef struct st_quicrq_load_config_t {
+    char const* server_name;
+    char const* sni;
+    struct sockaddr_storage server_addr;
+    quicrq_transport_mode_enum transport_mode;
+    quicrq_subscribe_order_enum subscribe_order;
+    int is_audio;
+    generation_parameters_t generation;
+    int nb_threads;
+    size_t nb_publishers;
+    size_t nb_steps;
+    quicrq_load_step_t steps[QUICRQ_LOAD_PROFILE_MAX];
+    size_t max_subscribers;
+    uint64_t start_time;
+    char const* result_file;
+} quicrq_load_config_t;
+
+typedef struct st_quicrq_load_subscriber_t {
+    size_t subscriber_index;
+    size_t publisher_index;
+    quicrq_cnx_ctx_t* cnx_ctx;
+    test_object_stream_ctx_t* object_stream_ctx;
+    uint64_t join_time;
+    uint64_t leave_time;
+    int has_joined;
+    int has_left;
+} quicrq_load_subscriber_t;
+
+typedef struct st_quicrq_load_thread_ctx_t {
+    quicrq_load_config_t* config;
+    int thread_index;
+    quicrq_ctx_t* qr_ctx;
+    size_t nb_sources;
+    test_media_object_source_context_t** sources;
+    size_t nb_subscribers;
+    quicrq_load_subscriber_t* subscribers;
+    size_t nb_joined;
+    size_t nb_left;
+    uint64_t end_time;
+    int ret;
+} quicrq_load_thread_ctx_t;
+
+static void quicrq_load_media_url(quicrq_load_config_t* config, size_t publisher_index, char* url, size_t* url_length)
+{
+    (void)picoquic_sprintf(url, QUICRQ_LOAD_URL_MAX, url_length, "load_%s_%zu",
+        (config->is_audio) ? "audio" : "video", publisher_index);
+}
+
+/* Number of subscribers required by the profile at the specified time */
+static size_t quicrq_load_profile_target(quicrq_load_config_t* config, uint64_t current_time)
+{
+    size_t target = 0;
+    uint64_t elapsed = (current_time > config->start_time) ? current_time - config->start_time : 0;
+
+    for (size_t i = 0; i < config->nb_steps; i++) {
+        if (elapsed >= config->steps[i].step_time) {
+            if (i + 1 < config->nb_steps && elapsed < config->steps[i + 1].step_time) {
+                /* Interpolate between the two steps */
+                uint64_t delta_t = config->steps[i + 1].step_time - config->steps[i].step_time;
+                uint64_t x = elapsed - config->steps[i].step_time;
+                if (config->steps[i + 1].nb_subscribers >= config->steps[i].nb_subscribers) {
+                    target = config->steps[i].nb_subscribers + (size_t)(
+                        ((config->steps[i + 1].nb_subscribers - config->steps[i].nb_subscribers) * x) / delta_t);
+                }
+                else {
+                    target = config->steps[i].nb_subscribers - (size_t)(
+                        ((config->steps[i].nb_subscribers - config->steps[i + 1].nb_subscribers) * x) / delta_t);
+                }
+            }
+            else if (i + 1 < config->nb_steps) {
+                target = config->steps[i + 1].nb_subscribers;
+            }
+            else {
+                /* End of the profile */
+                target = 0;
+            }
+        }
+    }
+    return target;
+}
+
+static int quicrq_load_subscriber_join(quicrq_load_thread_ctx_t* thread_ctx, quicrq_load_subscriber_t* subscriber, uint64_t current_time)
+{
+    int ret = 0;
+    char url[QUICRQ_LOAD_URL_MAX];
+    size_t url_length;
+
+    quicrq_load_media_url(thread_ctx->config, subscriber->publisher_index, url, &url_length);
+    subscriber->has_joined = 1;
+    subscriber->join_time = current_time;
+    if ((subscriber->cnx_ctx = quicrq_create_client_cnx(thread_ctx->qr_ctx, thread_ctx->config->sni,
+        (struct sockaddr*)&thread_ctx->config->server_addr)) == NULL ||
+        (subscriber->object_stream_ctx = test_object_stream_subscribe_ex(subscriber->cnx_ctx, (uint8_t*)url, url_length,
+            thread_ctx->config->transport_mode, thread_ctx->config->subscribe_order, NULL, NULL, NULL)) == NULL) {
+        fprintf(stderr, "Cannot subscribe to %s for subscriber %zu\n", url, subscriber->subscriber_index);
+        ret = -1;
+    }
+    else {
+        subscriber->object_stream_ctx->stats.media_start_time = thread_ctx->config->start_time;
+    }
+    return ret;
+}
+
+static int quicrq_load_subscriber_leave(quicrq_load_subscriber_t* subscriber, uint64_t current_time)
+{
+    int ret = 0;
+
+    subscriber->has_left = 1;
+    subscriber->leave_time = current_time;
+    if (subscriber->cnx_ctx != NULL && !quicrq_is_cnx_disconnected(subscriber->cnx_ctx)) {
+        ret = quicrq_close_cnx(subscriber->cnx_ctx);
+    }
+    return ret;
+}
+
+/* Join or leave subscribers to follow the profile.
+ * The subscribers of the thread are those whose index modulo the number
+ * of threads is the index of the thread, in increasing order. The active
+ * subscribers with the highest index leave first.
+ */
+static int quicrq_load_apply_profile(quicrq_load_thread_ctx_t* thread_ctx, uint64_t current_time)
+{
+    int ret = 0;
+    size_t target = quicrq_load_profile_target(thread_ctx->config, current_time);
+    size_t rank = thread_ctx->nb_joined;
+
+    while (ret == 0 && thread_ctx->nb_joined < thread_ctx->nb_subscribers &&
+        thread_ctx->subscribers[thread_ctx->nb_joined].subscriber_index < target) {
+        ret = quicrq_load_subscriber_join(thread_ctx, &thread_ctx->subscribers[thread_ctx->nb_joined], current_time);
+        thread_ctx->nb_joined++;
+    }
+    while (ret == 0 && rank > 0 && thread_ctx->nb_left < thread_ctx->nb_joined &&
+        (thread_ctx->subscribers[rank - 1].has_left || thread_ctx->subscribers[rank - 1].subscriber_index >= target)) {
+        rank--;
+        if (!thread_ctx->subscribers[rank].has_left) {
+            ret = quicrq_load_subscriber_leave(&thread_ctx->subscribers[rank], current_time);
+            thread_ctx->nb_left++;
+        }
+    }
+    return ret;
+}
+
+static int quicrq_load_check_time(quicrq_load_thread_ctx_t* thread_ctx, packet_loop_time_check_arg_t* time_check_arg)
+{
+    int ret = 0;
+    uint64_t next_time = time_check_arg->current_time + QUICRQ_LOAD_TICK;
+    uint64_t cache_next_time;
+
+    if (time_check_arg->current_time >= thread_ctx->end_time) {
+        ret = PICOQUIC_NO_ERROR_TERMINATE_PACKET_LOOP;
+    }
+    else {
+        ret = quicrq_load_apply_profile(thread_ctx, time_check_arg->current_time);
+    }
+
+    for (size_t i = 0; ret == 0 && i < thread_ctx->nb_sources; i++) {
+        /* Publish the objects that are ready, as in quicrq_app */
+        uint64_t next_source_time = test_media_object_source_next_time(thread_ctx->sources[i], time_check_arg->current_time);
+        if (next_source_time <= time_check_arg->current_time) {
+            int is_active = 0;
+            ret = test_media_object_source_iterate(thread_ctx->sources[i], time_check_arg->current_time, &is_active);
+            next_time = time_check_arg->current_time;
+        }
+        else if (next_source_time < next_time) {
+            next_time = next_source_time;
+        }
+    }
+    cache_next_time = quicrq_time_check(thread_ctx->qr_ctx, time_check_arg->current_time);
+    if (cache_next_time < next_time) {
+        next_time = cache_next_time;
+    }
+    if (next_time <= time_check_arg->current_time) {
+        time_check_arg->delta_t = 0;
+    }
+    else if (next_time - time_check_arg->current_time < (uint64_t)time_check_arg->delta_t) {
+        time_check_arg->delta_t = next_time - time_check_arg->current_time;
+    }
+    return ret;
+}
+
+static int quicrq_load_loop_cb(picoquic_quic_t* quic, picoquic_packet_loop_cb_enum cb_mode,
+    void* callback_ctx, void* callback_arg)
+{
+    int ret = 0;
+    quicrq_load_thread_ctx_t* thread_ctx = (quicrq_load_thread_ctx_t*)callback_ctx;
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(quic);
+#else
+    (void)quic;
+#endif
+
+    switch (cb_mode) {
+    case picoquic_packet_loop_ready:
+        if (callback_arg != NULL) {
+            picoquic_packet_loop_options_t* options = (picoquic_packet_loop_options_t*)callback_arg;
+            options->do_time_check |= 1;
+        }
+        break;
+    case picoquic_packet_loop_after_receive:
+    case picoquic_packet_loop_after_send:
+        if (picoquic_current_time() >= thread_ctx->end_time) {
+            ret = PICOQUIC_NO_ERROR_TERMINATE_PACKET_LOOP;
+        }
+        break;
+    case picoquic_packet_loop_port_update:
+        break;
+    case picoquic_packet_loop_time_check:
+        ret = quicrq_load_check_time(thread_ctx, (packet_loop_time_check_arg_t*)callback_arg);
+        break;
+    default:
+        ret = PICOQUIC_ERROR_UNEXPECTED_ERROR;
+        break;
+    }
+    return ret;
+}
+
+/* Create the context of a thread, its publishers and its subscribers */
+static int quicrq_load_thread_init(quicrq_load_thread_ctx_t* thread_ctx, quicrq_load_config_t* config, int thread_index)
+{
+    int ret = 0;
+    size_t nb_threads = (size_t)config->nb_threads;
+    size_t nb_sources = (config->nb_publishers + nb_threads - 1 - thread_index) / nb_threads;
+    size_t nb_subscribers = (config->max_subscribers + nb_threads - 1 - thread_index) / nb_threads;
+
+    memset(thread_ctx, 0, sizeof(quicrq_load_thread_ctx_t));
+    thread_ctx->config = config;
+    thread_ctx->thread_index = thread_index;
+    thread_ctx->end_time = config->start_time + config->steps[config->nb_steps - 1].step_time + QUICRQ_LOAD_DRAIN_TIME;
+
+    if ((thread_ctx->qr_ctx = quicrq_create_ex(QUICRQ_ALPN, NULL, NULL, NULL, NULL, NULL, NULL, 0, NULL,
+        (uint32_t)(nb_sources + nb_subscribers + 1))) == NULL) {
+        ret = -1;
+    }
+    else {
+        picoquic_set_null_verifier(quicrq_get_quic_ctx(thread_ctx->qr_ctx));
+        if (nb_sources > 0) {
+            thread_ctx->sources = (test_media_object_source_context_t**)malloc(nb_sources * sizeof(test_media_object_source_context_t*));
+            if (thread_ctx->sources == NULL) {
+                ret = -1;
+            }
+            else {
+                memset(thread_ctx->sources, 0, nb_sources * sizeof(test_media_object_source_context_t*));
+            }
+        }
+        if (ret == 0 && nb_subscribers > 0) {
+            thread_ctx->subscribers = (quicrq_load_subscriber_t*)malloc(nb_subscribers * sizeof(quicrq_load_subscriber_t));
+            if (thread_ctx->subscribers == NULL) {
+                ret = -1;
+            }
+            else {
+                memset(thread_ctx->subscribers, 0, nb_subscribers * sizeof(quicrq_load_subscriber_t));
+                thread_ctx->nb_subscribers = nb_subscribers;
+                for (size_t i = 0; i < nb_subscribers; i++) {
+                    thread_ctx->subscribers[i].subscriber_index = thread_index + i * nb_threads;
+                    thread_ctx->subscribers[i].publisher_index = thread_ctx->subscribers[i].subscriber_index % config->nb_publishers;
+                }
+            }
+        }
+    }
+
+    for (size_t i = 0; ret == 0 && i < nb_sources; i++) {
+        /* Each publisher posts its media on its own connection */
+        char url[QUICRQ_LOAD_URL_MAX];
+        size_t url_length;
+        quicrq_cnx_ctx_t* cnx_ctx;
+
+        quicrq_load_media_url(config, thread_index + i * nb_threads, url, &url_length);
+        if ((thread_ctx->sources[i] = test_media_object_source_publish(thread_ctx->qr_ctx, (uint8_t*)url, url_length,
+            url, &config->generation, 1, config->start_time)) == NULL ||
+            (cnx_ctx = quicrq_create_client_cnx(thread_ctx->qr_ctx, config->sni, (struct sockaddr*)&config->server_addr)) == NULL) {
+            fprintf(stderr, "Cannot create publisher %s\n", url);
+            ret = -1;
+        }
+        else {
+            thread_ctx->nb_sources++;
+            ret = quicrq_cnx_post_media(cnx_ctx, (uint8_t*)url, url_length, config->transport_mode);
+        }
+    }
+    return ret;
+}
+
+static void quicrq_load_thread_release(quicrq_load_thread_ctx_t* thread_ctx)
+{
+    for (size_t i = 0; i < thread_ctx->nb_sources; i++) {
+        test_media_object_source_delete(thread_ctx->sources[i]);
+    }
+    if (thread_ctx->qr_ctx != NULL) {
+        quicrq_delete(thread_ctx->qr_ctx);
+        thread_ctx->qr_ctx = NULL;
+    }
+    if (thread_ctx->sources != NULL) {
+        free(thread_ctx->sources);
+        thread_ctx->sources = NULL;
+    }
+    if (thread_ctx->subscribers != NULL) {
+        for (size_t i = 0; i < thread_ctx->nb_subscribers; i++) {
+            if (thread_ctx->subscribers[i].object_stream_ctx != NULL) {
+                test_object_stream_consumer_close(thread_ctx->subscribers[i].object_stream_ctx);
+            }
+        }
+        free(thread_ctx->subscribers);
+        thread_ctx->subscribers = NULL;
+    }
+}
+
+#ifdef _WINDOWS
+static DWORD WINAPI quicrq_load_thread_fn(LPVOID v_thread_ctx)
+#else
+static void* quicrq_load_thread_fn(void* v_thread_ctx)
+#endif
+{
+    quicrq_load_thread_ctx_t* thread_ctx = (quicrq_load_thread_ctx_t*)v_thread_ctx;
+
+#ifdef _WINDOWS
+    thread_ctx->ret = picoquic_packet_loop_win(quicrq_get_quic_ctx(thread_ctx->qr_ctx), 0, 0, 0, 0,
+        quicrq_load_loop_cb, thread_ctx);
+#else
+    thread_ctx->ret = picoquic_packet_loop(quicrq_get_quic_ctx(thread_ctx->qr_ctx), 0, 0, 0, 0, 0,
+        quicrq_load_loop_cb, thread_ctx);
+#endif
+    if (thread_ctx->ret == PICOQUIC_NO_ERROR_TERMINATE_PACKET_LOOP) {
+        thread_ctx->ret = 0;
+    }
+#ifdef _WINDOWS
+    return 0;
+#else
+    return NULL;
+#endif
+}
+
+static int quicrq_load_thread_start(quicrq_load_thread_t* thread_id, quicrq_load_thread_ctx_t* thread_ctx)
+{
+    int ret = 0;
+#ifdef _WINDOWS
+    if ((*thread_id = CreateThread(NULL, 0, quicrq_load_thread_fn, thread_ctx, 0, NULL)) == NULL) {
+        ret = -1;
+    }
+#else
+    if (pthread_create(thread_id, NULL, quicrq_load_thread_fn, thread_ctx) != 0) {
+        ret = -1;
+    }
+#endif
+    return ret;
+}
+
+static void quicrq_load_thread_wait(quicrq_load_thread_t thread_id)
+{
+#ifdef _WINDOWS
+    (void)WaitForSingleObject(thread_id, INFINITE);
+    (void)CloseHandle(thread_id);
+#else
+    (void)pthread_join(thread_id, NULL);
+#endif
+}
+
+/* Write the results of each subscriber, and print a summary */
+static int quicrq_load_report(quicrq_load_config_t* config, quicrq_load_thread_ctx_t* threads)
+{
+    int ret = 0;
+    FILE* F = NULL;
+    size_t nb_joined = 0;
+    size_t nb_received = 0;
+    uint64_t join_delay_sum = 0;
+    uint64_t join_delay_max = 0;
+    uint64_t delay_sum = 0;
+    uint64_t delay_max = 0;
+    uint64_t nb_delays = 0;
+    uint64_t nb_objects = 0;
+    uint64_t nb_skipped = 0;
+    uint64_t nb_gaps = 0;
+    uint64_t nb_skipped_ahead = 0;
+    uint64_t nb_bytes = 0;
+
+    if (config->result_file != NULL) {
+        if ((F = picoquic_file_open(config->result_file, "w")) == NULL) {
+            fprintf(stderr, "Cannot open %s\n", config->result_file);
+            ret = -1;
+        }
+        else {
+            fprintf(F, "subscriber,thread,media,join_time,join_delay,nb_objects,nb_skipped,nb_gaps,nb_skipped_ahead,nb_bytes,delay_average,delay_max,throughput_kbps\n");
+        }
+    }
+
+    for (int t = 0; t < config->nb_threads; t++) {
+        for (size_t i = 0; i < threads[t].nb_subscribers; i++) {
+            quicrq_load_subscriber_t* subscriber = &threads[t].subscribers[i];
+            test_object_stream_stats_t* stats = (subscriber->object_stream_ctx == NULL) ? NULL : &subscriber->object_stream_ctx->stats;
+
+            if (subscriber->has_joined) {
+                uint64_t join_delay = 0;
+                uint64_t delay_average = 0;
+                uint64_t throughput_kbps = 0;
+
+                nb_joined++;
+                if (stats != NULL && stats->nb_objects > 0) {
+                    nb_received++;
+                    join_delay = stats->first_object_time - subscriber->join_time;
+                    join_delay_sum += join_delay;
+                    if (join_delay > join_delay_max) {
+                        join_delay_max = join_delay;
+                    }
+                    if (stats->nb_delays > 0) {
+                        delay_average = stats->delay_sum / stats->nb_delays;
+                    }
+                    if (stats->last_object_time > stats->first_object_time) {
+                        throughput_kbps = (stats->nb_bytes * 8000) / (stats->last_object_time - stats->first_object_time);
+                    }
+                    delay_sum += stats->delay_sum;
+                    nb_delays += stats->nb_delays;
+                    if (stats->delay_max > delay_max) {
+                        delay_max = stats->delay_max;
+                    }
+                    nb_objects += stats->nb_objects;
+                    nb_skipped += stats->nb_skipped;
+                    nb_gaps += stats->nb_gaps;
+                    nb_skipped_ahead += stats->nb_skipped_ahead;
+                    nb_bytes += stats->nb_bytes;
+                }
+                if (F != NULL) {
+                    fprintf(F, "%zu,%d,%zu,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 "\n",
+                        subscriber->subscriber_index, t, subscriber->publisher_index, subscriber->join_time - config->start_time,
+                        join_delay, (stats == NULL) ? 0 : stats->nb_objects, (stats == NULL) ? 0 : stats->nb_skipped,
+                        (stats == NULL) ? 0 : stats->nb_gaps, (stats == NULL) ? 0 : stats->nb_skipped_ahead,
+                        (stats == NULL) ? 0 : stats->nb_bytes, delay_average,
+                        (stats == NULL) ? 0 : stats->delay_max, throughput_kbps);
+                }
+            }
+        }
+    }
+    if (F != NULL) {
+        (void)picoquic_file_close(F);
+    }
+
+    fprintf(stdout, "Subscribers joined: %zu, received media: %zu\n", nb_joined, nb_received);
+    fprintf(stdout, "Join delay (us): average %" PRIu64 ", max %" PRIu64 "\n",
+        (nb_received > 0) ? join_delay_sum / nb_received : 0, join_delay_max);
+    fprintf(stdout, "End to end delay (us): average %" PRIu64 ", max %" PRIu64 "\n",
+        (nb_delays > 0) ? delay_sum / nb_delays : 0, delay_max);
+    fprintf(stdout, "Objects: %" PRIu64 ", skipped: %" PRIu64 ", missing: %" PRIu64 ", skipped ahead: %" PRIu64 ", bytes: %" PRIu64 "\n",
+        nb_objects, nb_skipped, nb_gaps, nb_skipped_ahead, nb_bytes);
+    if (nb_joined > nb_received) {
+        ret = -1;
+    }
+    return ret;
+}
+
+/* Parse the profile: <nb_subscribers>@<seconds>[,<nb_subscribers>@<seconds>]* */
+static int quicrq_load_parse_profile(quicrq_load_config_t* config, char const* profile)
+{
+    int ret = 0;
+    char const* next_char = profile;
+
+    config->nb_steps = 0;
+    config->max_subscribers = 0;
+    while (ret == 0 && next_char != NULL && *next_char != 0) {
+        char* end_char = NULL;
+        unsigned long nb_subscribers = strtoul(next_char, &end_char, 10);
+        double seconds = 0;
+
+        if (end_char == next_char || *end_char != '@' || config->nb_steps >= QUICRQ_LOAD_PROFILE_MAX) {
+            ret = -1;
+        }
+        else {
+            next_char = end_char + 1;
+            seconds = strtod(next_char, &end_char);
+            if (end_char == next_char || seconds < 0 || (*end_char != 0 && *end_char != ',')) {
+                ret = -1;
+            }
+            else {
+                quicrq_load_step_t* step = &config->steps[config->nb_steps];
+                step->step_time = (uint64_t)(seconds * 1000000.0);
+                step->nb_subscribers = (size_t)nb_subscribers;
+                if (config->nb_steps > 0 && step->step_time <= config->steps[config->nb_steps - 1].step_time) {
+                    ret = -1;
+                }
+                else {
+                    config->nb_steps++;
+                    if (step->nb_subscribers > config->max_subscribers) {
+                        config->max_subscribers = step->nb_subscribers;
+                    }
+                    next_char = (*end_char == ',') ? end_char + 1 : end_char;
+                }
+            }
+        }
+    }
+    if (ret == 0 && config->nb_steps < 2) {
+        ret = -1;
+    }
+    if (ret != 0) {
+        fprintf(stderr, "Invalid profile: %s\n", profile);
+    }
+    return ret;
+}
+
+static int quicrq_load_run(quicrq_load_config_t* config)
+{
+    int ret = 0;
+    int nb_started = 0;
+    quicrq_load_thread_ctx_t* threads = (quicrq_load_thread_ctx_t*)malloc(config->nb_threads * sizeof(quicrq_load_thread_ctx_t));
+    quicrq_load_thread_t* thread_ids = (quicrq_load_thread_t*)malloc(config->nb_threads * sizeof(quicrq_load_thread_t));
+
+    /* The media ends with the profile */
+    config->start_time = picoquic_current_time();
+    config->generation.target_duration = config->steps[config->nb_steps - 1].step_time;
+
+    if (threads == NULL || thread_ids == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        ret = -1;
+    }
+    else {
+        memset(threads, 0, config->nb_threads * sizeof(quicrq_load_thread_ctx_t));
+        for (int t = 0; ret == 0 && t < config->nb_threads; t++) {
+            ret = quicrq_load_thread_init(&threads[t], config, t);
+        }
+    }
+    while (ret == 0 && nb_started < config->nb_threads) {
+        if ((ret = quicrq_load_thread_start(&thread_ids[nb_started], &threads[nb_started])) != 0) {
+            fprintf(stderr, "Cannot start thread %d\n", nb_started);
+        }
+        else {
+            nb_started++;
+        }
+    }
+    for (int t = 0; t < nb_started; t++) {
+        quicrq_load_thread_wait(thread_ids[t]);
+        if (threads[t].ret != 0) {
+            fprintf(stderr, "Thread %d loop exit, ret = %d (0x%x)\n", t, threads[t].ret, threads[t].ret);
+            ret = -1;
+        }
+    }
+    if (threads != NULL) {
+        if (nb_started == config->nb_threads && quicrq_load_report(config, threads) != 0) {
+            ret = -1;
+        }
+        for (int t = 0; t < config->nb_threads; t++) {
+            quicrq_load_thread_release(&threads[t]);
+        }
+        free(threads);
+    }
+    if (thread_ids != NULL) {
+        free(thread_ids);
+    }
+    return ret;
+}
+
+void usage()
+{
+    fprintf(stderr, "QUICRQ load generator\n");
+    fprintf(stderr, "Usage: quicrq_load <options> server_name ['d'|'s'|'r'|'w'] port\n");
+    fprintf(stderr, "  Use 'd', 's', 'r' or 'w' for datagram, stream, rush or warp mode.\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -t nb_threads         Number of client threads (default 1).\n");
+    fprintf(stderr, "  -n nb_publishers      Number of published media (default 1).\n");
+    fprintf(stderr, "  -l profile            Number of subscribers over time, as\n");
+    fprintf(stderr, "                        <nb>@<seconds>[,<nb>@<seconds>]*, for example\n");
+    fprintf(stderr, "                        0@0,1000@30,1000@60 (default 10@0,10@10).\n");
+    fprintf(stderr, "  -a                    Publish audio instead of video.\n");
+    fprintf(stderr, "  -u subscribe_order    1: in order (default), 2: skip ahead to last group.\n");
+    fprintf(stderr, "  -o result_file        CSV file with the results of each subscriber.\n");
+    exit(1);
+}
+
+int main(int argc, char** argv)
+{
+    int ret = 0;
+    int opt;
+    int server_port = -1;
+    int is_name = 0;
+    int subscribe_order = 1;
+    char const* profile = "10@0,10@10";
+    char const* a_d_s = NULL;
+    quicrq_load_config_t config;
+#ifdef _WINDOWS
+    WSADATA wsaData = { 0 };
+    (void)WSA_START(MAKEWORD(2, 2), &wsaData);
+#endif
+
+    memset(&config, 0, sizeof(config));
+    config.nb_threads = 1;
+    config.nb_publishers = 1;
+    config.transport_mode = quicrq_transport_mode_single_stream;
+    fprintf(stdout, "QUICRQ Version %s, Picoquic Version %s\n", QUICRQ_VERSION, PICOQUIC_VERSION);
+
+    while ((opt = getopt(argc, argv, "t:n:l:au:o:h")) != -1) {
+        switch (opt) {
+        case 't':
+            if ((config.nb_threads = atoi(optarg)) <= 0) {
+                fprintf(stderr, "Invalid number of threads: %s\n", optarg);
+                usage();
+            }
+            break;
+        case 'n':
+            if (atoi(optarg) <= 0) {
+                fprintf(stderr, "Invalid number of publishers: %s\n", optarg);
+                usage();
+            }
+            config.nb_publishers = (size_t)atoi(optarg);
+            break;
+        case 'l':
+            profile = optarg;
+            break;
+        case 'a':
+            config.is_audio = 1;
+            break;
+        case 'u':
+            subscribe_order = atoi(optarg);
+            if (subscribe_order <= 0 || subscribe_order >= quicrq_subscribe_order_max) {
+                fprintf(stderr, "Invalid subscribe order: %s\n", optarg);
+                usage();
+            }
+            break;
+        case 'o':
+            config.result_file = optarg;
+            break;
+        case 'h':
+        default:
+            usage();
+            break;
+        }
+    }
+    if (optind + 3 != argc) {
+        usage();
+    }
+    config.server_name = argv[optind++];
+    a_d_s = argv[optind++];
+    server_port = atoi(argv[optind++]);
+    config.subscribe_order = (quicrq_subscribe_order_enum)subscribe_order;
+    if (strcmp(a_d_s, "d") == 0) {
+        config.transport_mode = quicrq_transport_mode_datagram;
+    }
+    else if (strcmp(a_d_s, "r") == 0) {
+        config.transport_mode = quicrq_transport_mode_rush;
+    }
+    else if (strcmp(a_d_s, "w") == 0) {
+        config.transport_mode = quicrq_transport_mode_warp;
+    }
+    else if (strcmp(a_d_s, "s") != 0) {
+        usage();
+    }
+    if (server_port <= 0) {
+        fprintf(stderr, "Invalid server port: %s\n", argv[optind - 1]);
+        usage();
+    }
+    memcpy(&config.generation, (config.is_audio) ? &audio_18kbps : &video_1mps, sizeof(generation_parameters_t));
+
+    if ((ret = quicrq_load_parse_profile(&config, profile)) == 0) {
+        if ((ret = picoquic_get_server_address(config.server_name, server_port, &config.server_addr, &is_name)) != 0) {
+            fprintf(stderr, "Cannot find address of %s\n", config.server_name);
+        }
+        else {
+            if (is_name != 0) {
+                config.sni = config.server_name;
+            }
+            ret = quicrq_load_run(&config);
+        }
+    }
+    printf("Quicrq_load exit, ret = %d\n", ret);
+    exit(ret);
+}
@@ -135,7 +135,58 @@ static const quicrq_test_def_t test_table[] =
     { "congestion_rush", quicrq_congestion_rush_test },
     { "congestion_rush_g", quicrq_congestion_rush_g_test },
     { "congestion_rush_gs", quicrq_congestion_rush_gs_test },
-    { "congestion_rush_zero_s", quicrq_congestion_rush_zero_s_test }
+    { "congestion_rush_zero_s", quicrq_congestion_rush_zero_s_test },
+    { "source_index", quicrq_source_index_test },
+    { "media_id", quicrq_media_id_test },
+    { "fragment_buffer", quicrq_fragment_buffer_test },
+    { "memory_pool", quicrq_pool_test },
+    { "fragment_object_index", quicrq_fragment_object_index_test },
+    { "subscribe_trie", quicrq_subscribe_trie_test },
+    { "datagram_scheduler", quicrq_datagram_scheduler_test },
+    { "datagram_coalescing", quicrq_datagram_coalescing_test },
+    { "source_wakeup", quicrq_source_wakeup_test },
+    { "congestion_rate_epoch", quicrq_congestion_rate_epoch_test },
+    { "timer", quicrq_timer_test },
+    { "cache_memory_limit", quicrq_cache_memory_limit_test },
+    { "shard", quicrq_shard_test },
+    { "publish_queue", quicrq_publish_queue_test },
+    { "publish_object_ex", quicrq_publish_object_ex_test },
+    { "fragment_views", quicrq_fragment_views_test },
+    { "reassembly_in_place", quicrq_reassembly_in_place_test },
+    { "datagram_ack_ring", quicrq_datagram_ack_ring_test },
+    { "datagram_fec", quicrq_datagram_fec_test },
+    { "fragment_publisher_next", quicrq_fragment_publisher_next_test },
+    { "uni_stream_pool", quicrq_uni_stream_pool_test },
+    { "bench_fanout", quicrq_bench_fanout_test },
+    { "delay_histogram", quicrq_delay_histogram_test },
+    { "stats", quicrq_stats_test },
+    { "relay_failover", quicrq_relay_failover_test },
+    { "fragment_group_index", quicrq_fragment_group_index_test },
+    { "fragment_catch_up", quicrq_fragment_catch_up_test },
+    { "cache_spill", quicrq_cache_spill_test },
+    { "datagram_compact_header", quicrq_datagram_compact_header_test },
+    { "batch_msg", quicrq_batch_msg_test },
+    { "twomedia_datagram_batch", quicrq_twomedia_datagram_batch_test },
+    { "cnx_count", quicrq_cnx_count_test },
+    { "feedback", quicrq_feedback_test },
+    { "relay_warm", quicrq_relay_warm_test },
+    { "fragment_size", quicrq_fragment_size_test },
+    { "arrival_cursor", quicrq_arrival_cursor_test },
+    { "publish_object_ex_null", quicrq_publish_object_ex_null_test },
+    { "shard_thread", quicrq_shard_thread_test },
+    { "shard_peers", quicrq_shard_peers_test },
+    { "twomedia_batch_partial", quicrq_twomedia_batch_partial_test },
+    { "twomedia_batch_unsubscribe", quicrq_twomedia_batch_unsubscribe_test },
+    { "relay_failover_post", quicrq_relay_failover_post_test },
+    { "cache_spill_retry", quicrq_cache_spill_retry_test },
+    { "relay_warm_resume", quicrq_relay_warm_resume_test },
+    { "relay_feedback", quicrq_relay_feedback_test },
+    { "consumer_stats", quicrq_consumer_stats_test },
+    { "track_warp_header", quicrq_track_warp_header_test },
+    { "congestion_basic_r", quicrq_congestion_basic_r_test },
+    { "congestion_datagram_r", quicrq_congestion_datagram_r_test },
+    { "reassembly_in_place_budget", quicrq_reassembly_in_place_budget_test },
+    { "datagram_compact_ack_lag", quicrq_datagram_compact_ack_lag_test }
 };
 
 static size_t const nb_tests = sizeof(test_table) / sizeof(quicrq_test_def_t);
@@ -171,6 +222,7 @@ int usage(char const* argv0)
 {
     fprintf(stderr, "QUICRQ test execution\n");
     fprintf(stderr, "\nUsage: %s [test1 [test2 ..[testN]]]\n\n", argv0);
+    fprintf(stderr, "   Or: %s -b [scenario1 [scenario2 ..[scenarioN]]]\n", argv0);
     fprintf(stderr, "   Or: %s [-x test]*", argv0);
     fprintf(stderr, "Valid test names are: \n");
     for (size_t x = 0; x < nb_tests; x++) {
@@ -183,11 +235,13 @@ int usage(char const* argv0)
     }
     fprintf(stderr, "Options: \n");
     fprintf(stderr, "  -x test           Do not run the specified test.\n");
+    fprintf(stderr, "  -b                Run the relay fan-out benchmark instead of the tests.\n");
     fprintf(stderr, "  -n                Disable debug prints.\n");
     fprintf(stderr, "  -r                Retry failed tests with debug print enabled.\n");
     fprintf(stderr, "  -h                Print this help message\n");
     fprintf(stderr, "  -S solution_dir   Set the path to the source files to find the default files\n");
     fprintf(stderr, "  -P picoquic_dir   Obsolete, not used anymore.\n");
+    quicrq_bench_fanout_usage(stderr);
 
     return -1;
 }
@@ -214,6 +268,7 @@ int main(int argc, char** argv)
     int opt;
     int disable_debug = 0;
     int retry_failed_test = 0;
+    int run_benchmark = 0;
 
     fprintf(stdout, "Testing QUICRQ Version %s, Picoquic version %s\n", QUICRQ_VERSION, PICOQUIC_VERSION);
 
@@ -224,7 +279,7 @@ int main(int argc, char** argv)
     }
     else
     {
-        while (ret == 0 && (opt = getopt(argc, argv, "P:S:x:nrh")) != -1) {
+        while (ret == 0 && (opt = getopt(argc, argv, "P:S:x:bnrh")) != -1) {
             switch (opt) {
             case 'x': {
                 int test_number = get_test_number(optarg);
@@ -243,6 +298,9 @@ int main(int argc, char** argv)
             case 'S':
                 quicrq_test_solution_dir = optarg;
                 break;
+            case 'b':
+                run_benchmark = 1;
+                break;
             case 'n':
                 disable_debug = 1;
                 break;
@@ -267,7 +325,11 @@ int main(int argc, char** argv)
             DBG_PRINTF("%s", "Debug print enabled");
         }
 
-        if (ret == 0)
+        if (ret == 0 && run_benchmark) {
+            /* Benchmark results are printed as CSV on stdout */
+            ret = quicrq_bench_fanout(stdout, (char const**)(argv + optind), argc - optind);
+        }
+        else if (ret == 0)
         {
             if (optind >= argc) {
                 for (size_t i = 0; i < nb_tests; i++) {
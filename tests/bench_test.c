@@ -0,0 +1,519 @@
+/* Relay fan-out benchmark.
+ *
+ * The benchmark runs media from N publishers through an origin and a chain of K
+ * relays to M subscribers, over the simulated links of the test configuration.
+ * The publishers are connected to the origin, node 0. The relays are nodes 1 to K,
+ * each one connected to the previous one. The subscribers are connected to the
+ * last relay, or to the origin if K is 0, and subscribe to all the publishers.
+ *
+ * Each subscription counts the objects and bytes received, and records the
+ * end to end latency of each object, i.e., the simulated time of arrival
+ * minus the time at which the publisher made the object available. The
+ * CPU time is measured around the simulation loop. The memory is reported
+ * as the peak of data held in the caches of all nodes during the run, the sum
+ * of the peak pool usage of all nodes, and on systems that support it the
+ * maximum resident set size of the process, which never decreases between
+ * scenarios.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <inttypes.h>
+#ifndef _WINDOWS
+#include <sys/resource.h>
+#endif
+#include "quicrq.h"
+#include "quicrq_relay.h"
+#include "quicrq_internal.h"
+#include "quicrq_tests.h"
+#include "quicrq_test_internal.h"
+
+typedef struct st_quicrq_bench_scenario_t {
+    char const* name;
+    int nb_publishers;
+    int nb_subscribers;
+    int nb_tiers;
+    quicrq_transport_mode_enum transport_mode;
+    uint64_t simulate_loss;
+} quicrq_bench_scenario_t;
+
+typedef struct st_quicrq_bench_result_t {
+    uint64_t nb_objects;
+    uint64_t nb_bytes;
+    int nb_closed;
+    int nb_closed_error;
+    uint64_t simulated_time;
+    double cpu_seconds;
+    size_t peak_cache_bytes;
+    size_t peak_pool_bytes;
+    long max_rss_kb;
+    uint64_t latency_p50;
+    uint64_t latency_p99;
+    uint64_t latency_p999;
+    size_t nb_latencies;
+    size_t latency_alloc;
+    uint64_t* latencies;
+} quicrq_bench_result_t;
+
+typedef struct st_quicrq_bench_consumer_t {
+    quicrq_bench_result_t* result;
+    quicrq_object_stream_consumer_ctx* media_ctx;
+    uint64_t start_time;
+    int is_closed;
+} quicrq_bench_consumer_t;
+
+static const quicrq_bench_scenario_t quicrq_bench_scenarios[] = {
+    { "1x1x0s", 1, 1, 0, quicrq_transport_mode_single_stream, 0 },
+    { "1x1x0d", 1, 1, 0, quicrq_transport_mode_datagram, 0 },
+    { "1x16x1s", 1, 16, 1, quicrq_transport_mode_single_stream, 0 },
+    { "1x16x1w", 1, 16, 1, quicrq_transport_mode_warp, 0 },
+    { "1x16x1r", 1, 16, 1, quicrq_transport_mode_rush, 0 },
+    { "1x16x1d", 1, 16, 1, quicrq_transport_mode_datagram, 0 },
+    { "1x16x1d_loss", 1, 16, 1, quicrq_transport_mode_datagram, 0x7080 },
+    { "4x16x2s", 4, 16, 2, quicrq_transport_mode_single_stream, 0 },
+    { "4x16x2d", 4, 16, 2, quicrq_transport_mode_datagram, 0 },
+    { "4x16x2d_loss", 4, 16, 2, quicrq_transport_mode_datagram, 0x7080 },
+    { "1x64x3d", 1, 64, 3, quicrq_transport_mode_datagram, 0 },
+    { "1x64x3r_loss", 1, 64, 3, quicrq_transport_mode_rush, 0x7080 }
+};
+
+static const size_t nb_quicrq_bench_scenarios = sizeof(quicrq_bench_scenarios) / sizeof(quicrq_bench_scenario_t);
+
+static int quicrq_bench_record_latency(quicrq_bench_result_t* result, uint64_t latency)
+{
+    int ret = 0;
+
+    if (result->nb_latencies >= result->latency_alloc) {
+        size_t new_alloc = (result->latency_alloc == 0) ? 1024 : 2 * result->latency_alloc;
+        uint64_t* new_latencies = (uint64_t*)malloc(new_alloc * sizeof(uint64_t));
+        if (new_latencies == NULL) {
+            ret = -1;
+        }
+        else {
+            if (result->nb_latencies > 0) {
+                memcpy(new_latencies, result->latencies, result->nb_latencies * sizeof(uint64_t));
+            }
+            if (result->latencies != NULL) {
+                free(result->latencies);
+            }
+            result->latencies = new_latencies;
+            result->latency_alloc = new_alloc;
+        }
+    }
+    if (ret == 0) {
+        result->latencies[result->nb_latencies] = latency;
+        result->nb_latencies++;
+    }
+    return ret;
+}
+
+static int quicrq_bench_consumer_cb(
+    quicrq_media_consumer_enum action,
+    void* object_consumer_ctx,
+    uint64_t current_time,
+    uint64_t group_id,
+    uint64_t object_id,
+    const uint8_t* data,
+    size_t data_length,
+    quicrq_object_stream_consumer_properties_t* properties,
+    quicrq_media_close_reason_enum close_reason,
+    uint64_t close_error_number)
+{
+    int ret = 0;
+    quicrq_bench_consumer_t* consumer = (quicrq_bench_consumer_t*)object_consumer_ctx;
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(group_id);
+    UNREFERENCED_PARAMETER(object_id);
+    UNREFERENCED_PARAMETER(properties);
+    UNREFERENCED_PARAMETER(close_error_number);
+#endif
+
+    switch (action) {
+    case quicrq_media_datagram_ready:
+        consumer->result->nb_objects++;
+        consumer->result->nb_bytes += data_length;
+        if (data_length >= QUIRRQ_MEDIA_TEST_HEADER_SIZE) {
+            /* The test media header carries the time at which the publisher produced the object */
+            quicrq_media_object_header_t current_header;
+            if (quicr_decode_object_header(data, data + QUIRRQ_MEDIA_TEST_HEADER_SIZE, &current_header) != NULL) {
+                uint64_t produced = consumer->start_time + current_header.timestamp;
+                ret = quicrq_bench_record_latency(consumer->result, (current_time > produced) ? current_time - produced : 0);
+            }
+        }
+        break;
+    case quicrq_media_close:
+        /* The caller frees the media context */
+        consumer->media_ctx = NULL;
+        consumer->is_closed = 1;
+        consumer->result->nb_closed++;
+        if (close_reason != quicrq_media_close_finished) {
+            consumer->result->nb_closed_error++;
+        }
+        break;
+    default:
+        ret = -1;
+        break;
+    }
+    return ret;
+}
+
+/* Create the fan out network: origin, relay tiers, publishers, subscribers.
+ * Each pair of connected nodes uses two links, the even link delivering to
+ * the server and the odd link to the client. */
+static quicrq_test_config_t* quicrq_bench_config_create(const quicrq_bench_scenario_t* scenario)
+{
+    int nb_nodes = 1 + scenario->nb_tiers + scenario->nb_publishers + scenario->nb_subscribers;
+    int nb_pairs = nb_nodes - 1;
+    quicrq_test_config_t* config = quicrq_test_config_create(nb_nodes, 2 * nb_pairs, 2 * nb_pairs, scenario->nb_publishers);
+
+    if (config != NULL) {
+        int is_ok = 1;
+        for (int i = 0; is_ok && i < nb_nodes; i++) {
+            if (i <= scenario->nb_tiers) {
+                /* Origin and relays */
+                config->nodes[i] = quicrq_create(QUICRQ_ALPN,
+                    config->test_server_cert_file, config->test_server_key_file, NULL, NULL, NULL,
+                    config->ticket_encryption_key, sizeof(config->ticket_encryption_key),
+                    &config->simulated_time);
+            }
+            else {
+                config->nodes[i] = quicrq_create(QUICRQ_ALPN,
+                    NULL, NULL, config->test_server_cert_store_file, NULL, NULL,
+                    NULL, 0, &config->simulated_time);
+            }
+            is_ok = (config->nodes[i] != NULL);
+        }
+        if (!is_ok) {
+            quicrq_test_config_delete(config);
+            config = NULL;
+        }
+    }
+    if (config != NULL) {
+        for (int node_id = 1; node_id < nb_nodes; node_id++) {
+            int pair = node_id - 1;
+            int server_id = 0;
+
+            if (node_id <= scenario->nb_tiers) {
+                server_id = node_id - 1;
+            }
+            else if (node_id > scenario->nb_tiers + scenario->nb_publishers) {
+                server_id = scenario->nb_tiers;
+            }
+            config->return_links[2 * pair] = 2 * pair + 1;
+            config->attachments[2 * pair].link_id = 2 * pair;
+            config->attachments[2 * pair].node_id = server_id;
+            config->return_links[2 * pair + 1] = 2 * pair;
+            config->attachments[2 * pair + 1].link_id = 2 * pair + 1;
+            config->attachments[2 * pair + 1].node_id = node_id;
+        }
+        config->simulate_loss = scenario->simulate_loss;
+    }
+    return config;
+}
+
+static int quicrq_bench_compare_latency(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+
+    return (x < y) ? -1 : ((x > y) ? 1 : 0);
+}
+
+static uint64_t quicrq_bench_percentile(const quicrq_bench_result_t* result, size_t per_thousand)
+{
+    uint64_t latency = 0;
+
+    if (result->nb_latencies > 0) {
+        size_t rank = (result->nb_latencies * per_thousand) / 1000;
+        if (rank >= result->nb_latencies) {
+            rank = result->nb_latencies - 1;
+        }
+        latency = result->latencies[rank];
+    }
+    return latency;
+}
+
+static void quicrq_bench_memory_sample(quicrq_test_config_t* config, quicrq_bench_result_t* result)
+{
+    size_t cache_bytes = 0;
+
+    for (int i = 0; i < config->nb_nodes; i++) {
+        quicrq_cache_memory_stats_t stats;
+        quicrq_get_cache_memory_stats(config->nodes[i], &stats);
+        cache_bytes += stats.cache_bytes;
+    }
+    if (cache_bytes > result->peak_cache_bytes) {
+        result->peak_cache_bytes = cache_bytes;
+    }
+}
+
+static void quicrq_bench_memory_final(quicrq_test_config_t* config, quicrq_bench_result_t* result)
+{
+    result->peak_pool_bytes = 0;
+    for (int i = 0; i < config->nb_nodes; i++) {
+        for (size_t p = 0; p < quicrq_get_nb_pools(); p++) {
+            quicrq_pool_stats_t stats;
+            if (quicrq_get_pool_stats(config->nodes[i], p, &stats) == 0) {
+                result->peak_pool_bytes += stats.max_in_use * stats.item_size;
+            }
+        }
+    }
+#ifndef _WINDOWS
+    {
+        struct rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) == 0) {
+            result->max_rss_kb = usage.ru_maxrss;
+        }
+    }
+#endif
+}
+
+/* Run one scenario. The result must be initialized to zero, and its latency
+ * array freed by the caller. */
+static int quicrq_bench_run(const quicrq_bench_scenario_t* scenario, quicrq_bench_result_t* result)
+{
+    int ret = 0;
+    int nb_inactive = 0;
+    const uint64_t max_time = 360000000;
+    const int max_inactive = 128;
+    int nb_consumers = scenario->nb_publishers * scenario->nb_subscribers;
+    quicrq_test_config_t* config = NULL;
+    quicrq_bench_consumer_t* consumers = NULL;
+    char media_source_path[512];
+    clock_t cpu_start;
+
+    if (scenario->nb_publishers <= 0 || scenario->nb_subscribers <= 0 || scenario->nb_tiers < 0 ||
+        picoquic_get_input_path(media_source_path, sizeof(media_source_path),
+            quicrq_test_solution_dir, QUICRQ_TEST_BASIC_SOURCE) != 0 ||
+        (config = quicrq_bench_config_create(scenario)) == NULL ||
+        (consumers = (quicrq_bench_consumer_t*)malloc(nb_consumers * sizeof(quicrq_bench_consumer_t))) == NULL) {
+        ret = -1;
+    }
+    else {
+        memset(consumers, 0, nb_consumers * sizeof(quicrq_bench_consumer_t));
+        ret = quicrq_enable_origin(config->nodes[0], scenario->transport_mode);
+    }
+
+    for (int tier = 1; ret == 0 && tier <= scenario->nb_tiers; tier++) {
+        ret = quicrq_enable_relay(config->nodes[tier], NULL, quicrq_test_find_send_addr(config, tier, tier - 1),
+            scenario->transport_mode);
+    }
+
+    for (int p = 0; ret == 0 && p < scenario->nb_publishers; p++) {
+        /* Each publisher posts its own copy of the test media to the origin */
+        int node_id = 1 + scenario->nb_tiers + p;
+        char url[64];
+        size_t url_length;
+        quicrq_cnx_ctx_t* cnx_ctx;
+
+        if (picoquic_sprintf(url, sizeof(url), &url_length, "bench_media_%d", p) != 0 ||
+            (config->object_sources[p] = test_media_object_source_publish(config->nodes[node_id], (uint8_t*)url,
+                url_length, media_source_path, NULL, 1, config->simulated_time)) == NULL ||
+            (cnx_ctx = quicrq_test_create_client_cnx(config, node_id, 0)) == NULL) {
+            ret = -1;
+        }
+        else {
+            ret = quicrq_cnx_post_media(cnx_ctx, (uint8_t*)url, url_length, scenario->transport_mode);
+        }
+    }
+
+    for (int s = 0; ret == 0 && s < scenario->nb_subscribers; s++) {
+        int node_id = 1 + scenario->nb_tiers + scenario->nb_publishers + s;
+        quicrq_cnx_ctx_t* cnx_ctx = quicrq_test_create_client_cnx(config, node_id, scenario->nb_tiers);
+
+        if (cnx_ctx == NULL) {
+            ret = -1;
+        }
+        for (int p = 0; ret == 0 && p < scenario->nb_publishers; p++) {
+            quicrq_bench_consumer_t* consumer = &consumers[s * scenario->nb_publishers + p];
+            char url[64];
+            size_t url_length;
+
+            consumer->result = result;
+            consumer->start_time = config->simulated_time;
+            if (picoquic_sprintf(url, sizeof(url), &url_length, "bench_media_%d", p) != 0 ||
+                (consumer->media_ctx = quicrq_subscribe_object_stream(cnx_ctx, (uint8_t*)url, url_length,
+                    scenario->transport_mode, quicrq_subscribe_in_order, NULL, quicrq_bench_consumer_cb, consumer)) == NULL) {
+                ret = -1;
+            }
+        }
+    }
+
+    cpu_start = clock();
+    while (ret == 0 && nb_inactive < max_inactive && config->simulated_time < max_time &&
+        result->nb_closed < nb_consumers) {
+        int is_active = 0;
+
+        ret = quicrq_test_loop_step(config, &is_active, max_time);
+        if (is_active) {
+            nb_inactive = 0;
+        }
+        else {
+            nb_inactive++;
+        }
+        quicrq_bench_memory_sample(config, result);
+    }
+    result->cpu_seconds = ((double)(clock() - cpu_start)) / CLOCKS_PER_SEC;
+
+    if (config != NULL) {
+        result->simulated_time = config->simulated_time;
+        quicrq_bench_memory_final(config, result);
+        quicrq_test_config_delete(config);
+    }
+    if (consumers != NULL) {
+        free(consumers);
+    }
+    if (ret == 0 && result->nb_closed < nb_consumers) {
+        DBG_PRINTF("Benchmark %s: only %d of %d subscriptions completed", scenario->name, result->nb_closed, nb_consumers);
+        ret = -1;
+    }
+    if (result->nb_latencies > 0) {
+        qsort(result->latencies, result->nb_latencies, sizeof(uint64_t), quicrq_bench_compare_latency);
+        result->latency_p50 = quicrq_bench_percentile(result, 500);
+        result->latency_p99 = quicrq_bench_percentile(result, 990);
+        result->latency_p999 = quicrq_bench_percentile(result, 999);
+    }
+
+    return ret;
+}
+
+static void quicrq_bench_report(FILE* F, const quicrq_bench_scenario_t* scenario, const quicrq_bench_result_t* result, int ret)
+{
+    double cpu_seconds = (result->cpu_seconds > 0) ? result->cpu_seconds : 1e-9;
+
+    fprintf(F, "%s,%d,%d,%d,%c,0x%" PRIx64 ",%d,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%.3f,%.0f,%.0f,%.3f,%zu,%zu,%ld,%" PRIu64 ",%" PRIu64 ",%" PRIu64 "\n",
+        scenario->name, scenario->nb_publishers, scenario->nb_subscribers, scenario->nb_tiers,
+        quicrq_transport_mode_to_letter(scenario->transport_mode), scenario->simulate_loss, ret,
+        result->nb_objects, result->nb_bytes, result->simulated_time, result->cpu_seconds * 1000.0,
+        ((double)result->nb_objects) / cpu_seconds, ((double)result->nb_bytes) / cpu_seconds,
+        (result->nb_objects > 0) ? (result->cpu_seconds * 1000000.0) / ((double)result->nb_objects) : 0.0,
+        result->peak_cache_bytes, result->peak_pool_bytes, result->max_rss_kb,
+        result->latency_p50, result->latency_p99, result->latency_p999);
+    fflush(F);
+}
+
+/* Parse a scenario definition "publishers:subscribers:tiers:mode[:loss]", in
+ * which the mode is one of the letters s, w, r or d, and the loss pattern is
+ * in hexadecimal. */
+static int quicrq_bench_parse_scenario(char const* spec, quicrq_bench_scenario_t* scenario)
+{
+    int ret = 0;
+    char mode = 0;
+    unsigned long long loss = 0;
+    int nb_fields = sscanf(spec, "%d:%d:%d:%c:%llx", &scenario->nb_publishers, &scenario->nb_subscribers,
+        &scenario->nb_tiers, &mode, &loss);
+
+    scenario->name = spec;
+    scenario->simulate_loss = (uint64_t)loss;
+    if (nb_fields < 4) {
+        ret = -1;
+    }
+    else {
+        switch (mode) {
+        case 's':
+            scenario->transport_mode = quicrq_transport_mode_single_stream;
+            break;
+        case 'w':
+            scenario->transport_mode = quicrq_transport_mode_warp;
+            break;
+        case 'r':
+            scenario->transport_mode = quicrq_transport_mode_rush;
+            break;
+        case 'd':
+            scenario->transport_mode = quicrq_transport_mode_datagram;
+            break;
+        default:
+            ret = -1;
+            break;
+        }
+    }
+    return ret;
+}
+
+static int quicrq_bench_run_one(FILE* F, const quicrq_bench_scenario_t* scenario)
+{
+    quicrq_bench_result_t result;
+    int ret;
+
+    memset(&result, 0, sizeof(result));
+    ret = quicrq_bench_run(scenario, &result);
+    quicrq_bench_report(F, scenario, &result, ret);
+    if (result.latencies != NULL) {
+        free(result.latencies);
+    }
+    return ret;
+}
+
+void quicrq_bench_fanout_usage(FILE* F)
+{
+    fprintf(F, "Benchmark scenarios are either \"publishers:subscribers:tiers:mode[:loss]\",\n");
+    fprintf(F, "with mode one of s, w, r, d and loss a hexadecimal pattern, or one of:\n");
+    for (size_t i = 0; i < nb_quicrq_bench_scenarios; i++) {
+        fprintf(F, "    %s\n", quicrq_bench_scenarios[i].name);
+    }
+}
+
+int quicrq_bench_fanout(FILE* F, char const** scenario_ids, int nb_scenario_ids)
+{
+    int ret = 0;
+
+    fprintf(F, "scenario,publishers,subscribers,tiers,mode,loss,ret,objects,bytes,sim_time_us,cpu_ms,objects_per_s,bytes_per_s,cpu_us_per_object,peak_cache_bytes,peak_pool_bytes,max_rss_kb,latency_p50_us,latency_p99_us,latency_p999_us\n");
+    if (nb_scenario_ids <= 0) {
+        for (size_t i = 0; i < nb_quicrq_bench_scenarios; i++) {
+            if (quicrq_bench_run_one(F, &quicrq_bench_scenarios[i]) != 0) {
+                ret = -1;
+            }
+        }
+    }
+    for (int x = 0; x < nb_scenario_ids; x++) {
+        quicrq_bench_scenario_t scenario;
+        size_t i = 0;
+
+        memset(&scenario, 0, sizeof(scenario));
+        while (i < nb_quicrq_bench_scenarios && strcmp(scenario_ids[x], quicrq_bench_scenarios[i].name) != 0) {
+            i++;
+        }
+        if (i < nb_quicrq_bench_scenarios) {
+            scenario = quicrq_bench_scenarios[i];
+        }
+        if (i >= nb_quicrq_bench_scenarios && quicrq_bench_parse_scenario(scenario_ids[x], &scenario) != 0) {
+            fprintf(stderr, "Incorrect benchmark scenario: %s\n", scenario_ids[x]);
+            quicrq_bench_fanout_usage(stderr);
+            ret = -1;
+        }
+        else if (quicrq_bench_run_one(F, &scenario) != 0) {
+            ret = -1;
+        }
+    }
+    return ret;
+}
+
+/* Run a small fan out, and verify that the benchmark counts all objects and
+ * measures latencies */
+int quicrq_bench_fanout_test()
+{
+    int ret = 0;
+    quicrq_bench_scenario_t scenario = { "bench_test", 2, 3, 1, quicrq_transport_mode_datagram, 0 };
+    quicrq_bench_result_t result;
+
+    memset(&result, 0, sizeof(result));
+    ret = quicrq_bench_run(&scenario, &result);
+    if (ret == 0 && (result.nb_closed != 6 || result.nb_closed_error != 0)) {
+        DBG_PRINTF("Expected 6 subscriptions finished, got %d, %d errors", result.nb_closed, result.nb_closed_error);
+        ret = -1;
+    }
+    if (ret == 0 && (result.nb_objects == 0 || result.nb_objects % 6 != 0 || result.nb_latencies != result.nb_objects)) {
+        DBG_PRINTF("Unexpected count, %" PRIu64 " objects, %zu latencies", result.nb_objects, result.nb_latencies);
+        ret = -1;
+    }
+    if (ret == 0 && (result.latency_p50 == 0 || result.latency_p50 > result.latency_p99 ||
+        result.latency_p99 > result.latency_p999)) {
+        DBG_PRINTF("Unexpected latencies, %" PRIu64 ", %" PRIu64 ", %" PRIu64,
+            result.latency_p50, result.latency_p99, result.latency_p999);
+        ret = -1;
+    }
+    if (result.latencies != NULL) {
+        free(result.latencies);
+    }
+    return ret;
+}
@@ -0,0 +1,159 @@
+#include <string.h>
+#include <stdlib.h>
+#include <picoquic.h>
+#include <picoquic_utils.h>
+#include "quicrq.h"
+#include "quicrq_internal.h"
+#include "quicrq_test_internal.h"
+
+/* Unit test of the connection management.
+ * Create more connections than the former limit of 256, delete them in
+ * an arbitrary order, and verify that the list of connections and the
+ * count of connections stay consistent.
+ */
+#define CNX_TEST_MAX_CONNECTIONS 1024
+#define CNX_TEST_NB_CONNECTIONS 300
+
+static int quicrq_cnx_test_check_list(quicrq_ctx_t* qr_ctx, size_t nb_expected)
+{
+    int ret = 0;
+    size_t nb_found = 0;
+    quicrq_cnx_ctx_t* cnx_ctx = qr_ctx->first_cnx;
+    quicrq_cnx_ctx_t* previous = NULL;
+
+    while (cnx_ctx != NULL && ret == 0) {
+        if (cnx_ctx->previous_cnx != previous) {
+            ret = -1;
+        }
+        nb_found++;
+        previous = cnx_ctx;
+        cnx_ctx = cnx_ctx->next_cnx;
+    }
+    if (ret == 0 && (previous != qr_ctx->last_cnx || nb_found != nb_expected ||
+        quicrq_get_nb_connections(qr_ctx) != nb_expected)) {
+        DBG_PRINTF("Found %zu connections, count %zu, expected %zu", nb_found, quicrq_get_nb_connections(qr_ctx), nb_expected);
+        ret = -1;
+    }
+    return ret;
+}
+
+int quicrq_cnx_count_test()
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    quicrq_ctx_t* qr_ctx = quicrq_create(QUICRQ_ALPN, NULL, NULL, NULL, NULL, NULL, NULL, 0, &simulated_time);
+    quicrq_cnx_ctx_t* cnx_list[CNX_TEST_NB_CONNECTIONS];
+    struct sockaddr_in addr;
+    size_t nb_connections = 0;
+
+    memset(&addr, 0, sizeof(struct sockaddr_in));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(QUICRQ_PORT);
+
+    /* The default context keeps the former limit */
+    if (qr_ctx == NULL || qr_ctx->max_nb_connections != QUICRQ_MAX_CONNECTIONS) {
+        ret = -1;
+    }
+    if (qr_ctx != NULL) {
+        quicrq_delete(qr_ctx);
+    }
+    qr_ctx = NULL;
+
+    if (ret == 0 && ((qr_ctx = quicrq_create_ex(QUICRQ_ALPN, NULL, NULL, NULL, NULL, NULL, NULL, 0, &simulated_time,
+        CNX_TEST_MAX_CONNECTIONS)) == NULL || qr_ctx->max_nb_connections != CNX_TEST_MAX_CONNECTIONS)) {
+        ret = -1;
+    }
+
+    while (ret == 0 && nb_connections < CNX_TEST_NB_CONNECTIONS) {
+        if ((cnx_list[nb_connections] = quicrq_create_client_cnx(qr_ctx, "test", (struct sockaddr*)&addr)) == NULL) {
+            DBG_PRINTF("Cannot create connection %zu", nb_connections);
+            ret = -1;
+        }
+        else {
+            nb_connections++;
+        }
+    }
+    if (ret == 0) {
+        ret = quicrq_cnx_test_check_list(qr_ctx, CNX_TEST_NB_CONNECTIONS);
+    }
+    /* Delete every third connection, then the others in reverse order */
+    for (size_t i = 0; ret == 0 && i < CNX_TEST_NB_CONNECTIONS; i += 3) {
+        quicrq_delete_cnx_context(cnx_list[i], quicrq_media_close_local_application, 0);
+        cnx_list[i] = NULL;
+        nb_connections--;
+        ret = quicrq_cnx_test_check_list(qr_ctx, nb_connections);
+    }
+    for (size_t i = CNX_TEST_NB_CONNECTIONS; ret == 0 && i > 0; i--) {
+        if (cnx_list[i - 1] != NULL) {
+            quicrq_delete_cnx_context(cnx_list[i - 1], quicrq_media_close_local_application, 0);
+            cnx_list[i - 1] = NULL;
+            nb_connections--;
+            ret = quicrq_cnx_test_check_list(qr_ctx, nb_connections);
+        }
+    }
+    if (ret == 0 && (qr_ctx->first_cnx != NULL || qr_ctx->last_cnx != NULL)) {
+        ret = -1;
+    }
+
+    if (qr_ctx != NULL) {
+        quicrq_delete(qr_ctx);
+    }
+
+    return ret;
+}
+
+/* The tracks of a batch carry the media id of a datagram flow, but no
+ * warp or rush uni stream. A uni stream whose header names the media id
+ * of a track must be rejected, not chained to the track.
+ */
+int quicrq_track_warp_header_test()
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    quicrq_ctx_t* qr_ctx = quicrq_create(QUICRQ_ALPN, NULL, NULL, NULL, NULL, NULL, NULL, 0, &simulated_time);
+    quicrq_cnx_ctx_t* cnx_ctx = NULL;
+    quicrq_stream_ctx_t* batch_ctx = NULL;
+    quicrq_stream_ctx_t* track_ctx = NULL;
+    quicrq_uni_stream_ctx_t* uni_stream_ctx = NULL;
+    struct sockaddr_in addr;
+    uint8_t bytes[256];
+    uint8_t* bytes_next = NULL;
+
+    memset(&addr, 0, sizeof(struct sockaddr_in));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(QUICRQ_PORT);
+
+    if (qr_ctx == NULL || (cnx_ctx = quicrq_create_client_cnx(qr_ctx, "test", (struct sockaddr*)&addr)) == NULL ||
+        (batch_ctx = quicrq_create_stream_context(cnx_ctx, 4)) == NULL ||
+        (track_ctx = quicrq_create_track_context(batch_ctx, 7)) == NULL ||
+        (uni_stream_ctx = quicrq_find_or_create_uni_stream(3, cnx_ctx, NULL, 1)) == NULL) {
+        ret = -1;
+    }
+    else if (quicrq_get_control_stream_for_media_id(cnx_ctx, 7) != NULL) {
+        DBG_PRINTF("%s", "Track found as control stream");
+        ret = -1;
+    }
+    else if ((bytes_next = quicrq_warp_header_msg_encode(bytes + 2, bytes + sizeof(bytes), QUICRQ_ACTION_WARP_HEADER, 7, 0)) == NULL) {
+        ret = -1;
+    }
+    else {
+        size_t message_size = bytes_next - (bytes + 2);
+
+        bytes[0] = (uint8_t)(message_size >> 8);
+        bytes[1] = (uint8_t)message_size;
+        if (quicrq_receive_warp_or_rush_stream_data(cnx_ctx, uni_stream_ctx, bytes, bytes_next - bytes, 0) == 0) {
+            DBG_PRINTF("%s", "Warp header for a track accepted");
+            ret = -1;
+        }
+        else if (uni_stream_ctx->control_stream_ctx != NULL || track_ctx->first_uni_stream != NULL) {
+            DBG_PRINTF("%s", "Uni stream chained to a track");
+            ret = -1;
+        }
+    }
+
+    if (qr_ctx != NULL) {
+        quicrq_delete(qr_ctx);
+    }
+
+    return ret;
+}
@@ -1,4 +1,5 @@
 #include <string.h>
+#include <stdlib.h>
 #include "picoquic_set_textlog.h"
 #include "picoquic_set_binlog.h"
 #include "quicrq.h"
@@ -617,6 +618,46 @@ int quicrq_congestion_datagram_g_test()
     return ret;
 }
 
+/* Rate based congestion control, in single stream and datagram modes.
+ * The test media has objects of several fragments, which must be counted
+ * for their full length when estimating the bytes per level.
+ */
+int quicrq_congestion_basic_r_test()
+{
+    quicrq_congestion_test_t spec = congestion_test_default;
+    int ret = 0;
+
+    spec.simulate_losses = 0;
+    spec.congested_receiver = 0;
+    spec.max_drops = 100;
+    spec.min_loss_flag = 0x82;
+    spec.average_delay_target = 350000;
+    spec.max_delay_target = 900000;
+    spec.congestion_control_mode = quicrq_congestion_control_rate;
+
+    ret = quicrq_congestion_test_one(1, quicrq_transport_mode_single_stream, &spec);
+
+    return ret;
+}
+
+int quicrq_congestion_datagram_r_test()
+{
+    quicrq_congestion_test_t spec = congestion_test_default;
+    int ret = 0;
+
+    spec.simulate_losses = 0;
+    spec.congested_receiver = 0;
+    spec.max_drops = 100;
+    spec.min_loss_flag = 0x82;
+    spec.average_delay_target = 350000;
+    spec.max_delay_target = 900000;
+    spec.congestion_control_mode = quicrq_congestion_control_rate;
+
+    ret = quicrq_congestion_test_one(1, quicrq_transport_mode_datagram, &spec);
+
+    return ret;
+}
+
 int quicrq_congestion_warp_test()
 {
     quicrq_congestion_test_t spec = congestion_test_default;
@@ -767,3 +808,237 @@ int quicrq_congestion_rush_zero_s_test()
 
     return ret;
 }
+
+/* Unit test of the rate based congestion epochs.
+ * Fill the per level byte counts of a congestion state, then verify that
+ * the threshold is set directly to the first level that does not fit in
+ * the pacing rate, that the epochs follow the RTT within bounds, and that
+ * the congestion ends when all levels fit and there is no backlog.
+ */
+typedef struct st_congestion_rate_test_case_t {
+    int has_backlog;
+    uint64_t rtt;
+    uint64_t pacing_rate;
+    int is_congested;
+    uint8_t priority_threshold;
+    uint64_t epoch_duration;
+} congestion_rate_test_case_t;
+
+static const congestion_rate_test_case_t congestion_rate_test_cases[] = {
+    /* 25000 bytes per epoch, only the first two levels fit */
+    { 1, 100000, 250000, 1, 0x82, 100000 },
+    /* All levels fit, but the backlog still has to drain */
+    { 1, 100000, 1000000, 1, 0x83, 100000 },
+    /* Nothing fits, the most urgent level is still sent */
+    { 1, 100000, 1000, 1, 0x81, 100000 },
+    /* Short RTT, epoch set to the minimum */
+    { 1, 1000, 250000, 1, 0x82, 10000 },
+    /* Long RTT, epoch set to the maximum */
+    { 1, 5000000, 250000, 1, 0x82, 1000000 },
+    /* All levels fit and no backlog, congestion ends */
+    { 0, 0, 1000000, 0, 0x83, 50000 }
+};
+
+static const size_t nb_congestion_rate_test_cases = sizeof(congestion_rate_test_cases) / sizeof(congestion_rate_test_case_t);
+
+int quicrq_congestion_rate_epoch_test()
+{
+    int ret = 0;
+    quicrq_cnx_congestion_state_t congestion = { 0 };
+    quicrq_cnx_ctx_t cnx_ctx = { 0 };
+    uint64_t current_time = 0;
+
+    congestion.max_flags = 0x83;
+    for (size_t i = 0; ret == 0 && i < nb_congestion_rate_test_cases; i++) {
+        const congestion_rate_test_case_t* test = &congestion_rate_test_cases[i];
+        uint64_t epoch_duration = (i == 0) ? 100000 : congestion.congestion_check_time - congestion.epoch_start_time;
+
+        current_time += epoch_duration;
+        congestion.has_backlog = test->has_backlog;
+        congestion.bytes_per_level[0] = epoch_duration / 10;
+        congestion.bytes_per_level[1] = epoch_duration / 10;
+        congestion.bytes_per_level[2] = epoch_duration / 5;
+        congestion.bytes_per_level[3] = (epoch_duration * 2) / 5;
+        quicrq_congestion_rate_epoch(&congestion, test->rtt, test->pacing_rate, current_time);
+        if (congestion.is_congested != test->is_congested ||
+            (congestion.is_congested && congestion.priority_threshold != test->priority_threshold) ||
+            congestion.congestion_check_time != current_time + test->epoch_duration ||
+            congestion.has_backlog || congestion.bytes_per_level[3] != 0) {
+            DBG_PRINTF("Rate epoch case %zu: congested %d, threshold 0x%x, epoch %" PRIu64, i,
+                congestion.is_congested, congestion.priority_threshold, congestion.congestion_check_time - current_time);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        /* Without a pacing rate estimate, skip the least urgent level when backlog is reported */
+        int should_skip_first = quicrq_congestion_check_rate_per_cnx(&cnx_ctx, 0x82, 1000, 0, current_time);
+        int should_skip_low = quicrq_congestion_check_rate_per_cnx(&cnx_ctx, 0x82, 1000, 1, current_time + 1000);
+        int should_skip_high = quicrq_congestion_check_rate_per_cnx(&cnx_ctx, 0x80, 1000, 0, current_time + 2000);
+
+        if (should_skip_first || !should_skip_low || should_skip_high || !cnx_ctx.congestion.is_congested ||
+            cnx_ctx.congestion.priority_threshold != 0x82) {
+            DBG_PRINTF("Rate check per cnx: skip %d, %d, %d, threshold 0x%x", should_skip_first, should_skip_low,
+                should_skip_high, cnx_ctx.congestion.priority_threshold);
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
+
+/* Unit test of the subscriber feedback.
+ * Verify that objects above the requested layer are skipped, except the first
+ * object of a group and the objects already skipped upstream, that the target
+ * bitrate sets the threshold at the first layer that does not fit, and that
+ * the feedback of the subscribers of a source is aggregated before being
+ * forwarded upstream.
+ */
+static int feedback_test_nb_forwarded = 0;
+static uint8_t feedback_test_max_flags = 0;
+static uint64_t feedback_test_target_bitrate = 0;
+
+static void quicrq_feedback_test_forward(quicrq_ctx_t* qr_ctx, quicrq_media_source_ctx_t* srce_ctx, uint8_t max_flags, uint64_t target_bitrate)
+{
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(qr_ctx);
+    UNREFERENCED_PARAMETER(srce_ctx);
+#endif
+    feedback_test_nb_forwarded++;
+    feedback_test_max_flags = max_flags;
+    feedback_test_target_bitrate = target_bitrate;
+}
+
+static int quicrq_feedback_test_check_forward(int nb_expected, uint8_t max_flags, uint64_t target_bitrate)
+{
+    int ret = 0;
+
+    if (feedback_test_nb_forwarded != nb_expected ||
+        (nb_expected > 0 && (feedback_test_max_flags != max_flags || feedback_test_target_bitrate != target_bitrate))) {
+        DBG_PRINTF("Forwarded %d times, 0x%x, %" PRIu64 ", expected %d, 0x%x, %" PRIu64,
+            feedback_test_nb_forwarded, feedback_test_max_flags, feedback_test_target_bitrate,
+            nb_expected, max_flags, target_bitrate);
+        ret = -1;
+    }
+    return ret;
+}
+
+int quicrq_feedback_test()
+{
+    int ret = 0;
+    quicrq_stream_ctx_t stream_ctx = { 0 };
+    quicrq_stream_ctx_t other_ctx = { 0 };
+    quicrq_media_source_ctx_t srce_ctx = { 0 };
+    quicrq_ctx_t* qr_ctx = (quicrq_ctx_t*)malloc(sizeof(quicrq_ctx_t));
+    uint64_t current_time = 1000000;
+
+    /* Without feedback, nothing is skipped */
+    if (quicrq_feedback_should_skip(&stream_ctx, 1, 0x87, 1000, current_time)) {
+        ret = -1;
+    }
+    /* Maximum layer */
+    if (ret == 0) {
+        quicrq_feedback_set(&stream_ctx, 0x81, 0, current_time);
+        if (!quicrq_feedback_should_skip(&stream_ctx, 1, 0x82, 1000, current_time) ||
+            quicrq_feedback_should_skip(&stream_ctx, 1, 0x81, 1000, current_time) ||
+            quicrq_feedback_should_skip(&stream_ctx, 0, 0x82, 1000, current_time) ||
+            quicrq_feedback_should_skip(&stream_ctx, 1, 0xff, 0, current_time)) {
+            DBG_PRINTF("%s", "Unexpected skip decision with max layer");
+            ret = -1;
+        }
+    }
+    /* Target bitrate of 800 kbps, i.e., 10000 bytes per epoch of 100 ms. Offer
+     * 3000 bytes of layers 0 and 1, and 6000 bytes of layer 2 per epoch */
+    if (ret == 0) {
+        quicrq_feedback_set(&stream_ctx, 0x83, 800000, current_time);
+        for (int epoch = 0; ret == 0 && epoch < 3; epoch++) {
+            for (int i = 0; ret == 0 && i < 10; i++) {
+                int skip_0 = quicrq_feedback_should_skip(&stream_ctx, 1, 0x80, 300, current_time);
+                int skip_1 = quicrq_feedback_should_skip(&stream_ctx, 1, 0x81, 300, current_time);
+                int skip_2 = quicrq_feedback_should_skip(&stream_ctx, 1, 0x82, 600, current_time);
+
+                if (skip_0 || skip_1 || skip_2 != (epoch > 0)) {
+                    DBG_PRINTF("Epoch %d, step %d, skip %d, %d, %d", epoch, i, skip_0, skip_1, skip_2);
+                    ret = -1;
+                }
+                current_time += 10000;
+            }
+        }
+    }
+
+    /* Aggregation of the feedback of two subscribers */
+    if (qr_ctx == NULL) {
+        ret = -1;
+    }
+    else {
+        memset(qr_ctx, 0, sizeof(quicrq_ctx_t));
+        qr_ctx->manage_relay_feedback_fn = quicrq_feedback_test_forward;
+    }
+    if (ret == 0) {
+        memset(&stream_ctx, 0, sizeof(stream_ctx));
+        srce_ctx.qr_ctx = qr_ctx;
+        srce_ctx.first_stream = &stream_ctx;
+        srce_ctx.last_stream = &other_ctx;
+        stream_ctx.media_source = &srce_ctx;
+        stream_ctx.next_stream_for_source = &other_ctx;
+        other_ctx.media_source = &srce_ctx;
+        other_ctx.previous_stream_for_source = &stream_ctx;
+        /* Counted as by quicrq_subscribe_local_media */
+        quicrq_source_feedback_count(&srce_ctx, &stream_ctx, 1);
+        quicrq_source_feedback_count(&srce_ctx, &other_ctx, 1);
+
+        /* One subscriber is not limited, nothing is forwarded */
+        quicrq_feedback_set(&stream_ctx, 0x81, 500000, current_time);
+        quicrq_source_feedback_update(&srce_ctx);
+        ret = quicrq_feedback_test_check_forward(0, 0, 0);
+    }
+    if (ret == 0) {
+        /* Highest layer, no rate limit if one subscriber has none */
+        quicrq_feedback_set(&other_ctx, 0x82, 0, current_time);
+        quicrq_source_feedback_update(&srce_ctx);
+        ret = quicrq_feedback_test_check_forward(1, 0x82, 0);
+    }
+    if (ret == 0) {
+        quicrq_feedback_set(&other_ctx, 0x82, 1000000, current_time);
+        quicrq_source_feedback_update(&srce_ctx);
+        ret = quicrq_feedback_test_check_forward(2, 0x82, 1000000);
+    }
+    if (ret == 0) {
+        /* No change, nothing forwarded */
+        quicrq_source_feedback_update(&srce_ctx);
+        ret = quicrq_feedback_test_check_forward(2, 0x82, 1000000);
+    }
+    if (ret == 0) {
+        /* The only subscriber at the highest values lowers them */
+        quicrq_feedback_set(&other_ctx, 0x80, 200000, current_time);
+        quicrq_source_feedback_update(&srce_ctx);
+        ret = quicrq_feedback_test_check_forward(3, 0x81, 500000);
+    }
+    if (ret == 0) {
+        /* Raising them again does not need a scan */
+        quicrq_feedback_set(&other_ctx, 0x82, 1000000, current_time);
+        if (srce_ctx.is_feedback_highest_stale) {
+            DBG_PRINTF("%s", "Highest feedback stale after raising it");
+            ret = -1;
+        }
+        else {
+            quicrq_source_feedback_update(&srce_ctx);
+            ret = quicrq_feedback_test_check_forward(4, 0x82, 1000000);
+        }
+    }
+    if (ret == 0) {
+        /* Removing a subscriber updates the aggregate */
+        quicrq_unsubscribe_local_media(&other_ctx);
+        ret = quicrq_feedback_test_check_forward(5, 0x81, 500000);
+    }
+    if (ret == 0) {
+        /* The last subscriber leaves, the upstream is not limited anymore */
+        quicrq_unsubscribe_local_media(&stream_ctx);
+        ret = quicrq_feedback_test_check_forward(6, 0xff, 0);
+    }
+
+    if (qr_ctx != NULL) {
+        free(qr_ctx);
+    }
+    return ret;
+}
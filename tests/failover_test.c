@@ -0,0 +1,408 @@
+#include <string.h>
+#include <stdlib.h>
+#include <picoquic.h>
+#include <picoquic_utils.h>
+#include "quicrq.h"
+#include "quicrq_relay.h"
+#include "quicrq_internal.h"
+#include "quicrq_fragment.h"
+#include "quicrq_relay_internal.h"
+#include "quicrq_test_internal.h"
+
+/* Unit test of the relay upstream selection and failover.
+ * A relay is configured with three upstreams and two connections per upstream.
+ * Verify that URLs are spread over the upstreams, and that the loss of an
+ * upstream connection moves the subscription to another upstream, starting
+ * at the next object expected in the cache, without closing the cache.
+ * When no upstream is left, the cache feed is closed as before.
+ */
+#define FAILOVER_TEST_NB_UPSTREAMS 3
+#define FAILOVER_TEST_NB_URLS 16
+#define FAILOVER_TEST_NB_OBJECTS 3
+
+static int quicrq_failover_test_check_subscribe(quicrq_cnx_ctx_t* cnx_ctx, quicrq_fragment_cache_t* cache_ctx,
+    uint64_t start_group_id, uint64_t start_object_id)
+{
+    int ret = 0;
+    quicrq_stream_ctx_t* stream_ctx = cnx_ctx->last_stream;
+
+    if (stream_ctx == NULL || stream_ctx->stream_id != cache_ctx->subscribe_stream_id) {
+        DBG_PRINTF("%s", "Subscription not found on upstream connection");
+        ret = -1;
+    }
+    else {
+        uint64_t message_type = 0;
+        size_t url_length = 0;
+        const uint8_t* url = NULL;
+        uint64_t media_id = 0;
+        quicrq_transport_mode_enum transport_mode = quicrq_transport_mode_unspecified;
+        quicrq_subscribe_intent_enum intent_mode = quicrq_subscribe_intent_current_group;
+        uint64_t group_id = UINT64_MAX;
+        uint64_t object_id = UINT64_MAX;
+        quicrq_datagram_header_format_enum header_format = quicrq_datagram_header_full;
+        size_t fragment_size = 0;
+        size_t fec_window = 0;
+
+        if (quicrq_rq_msg_decode(stream_ctx->message_sent.buffer, stream_ctx->message_sent.buffer + stream_ctx->message_sent.message_size,
+            &message_type, &url_length, &url, &media_id, &transport_mode, &intent_mode, &group_id, &object_id, &header_format,
+            &fragment_size, &fec_window) == NULL) {
+            DBG_PRINTF("%s", "Cannot decode the subscribe message");
+            ret = -1;
+        }
+        else if (intent_mode != quicrq_subscribe_intent_start_point || group_id != start_group_id || object_id != start_object_id) {
+            DBG_PRINTF("Subscribe intent %d at %" PRIu64 "/%" PRIu64 ", expected %" PRIu64 "/%" PRIu64,
+                intent_mode, group_id, object_id, start_group_id, start_object_id);
+            ret = -1;
+        }
+    }
+    return ret;
+}
+
+int quicrq_relay_failover_test()
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    quicrq_ctx_t* qr_ctx = quicrq_create(QUICRQ_ALPN, NULL, NULL, NULL, NULL, NULL, NULL, 0, &simulated_time);
+    struct sockaddr_in upstream_addr[FAILOVER_TEST_NB_UPSTREAMS];
+    const struct sockaddr* addr_list[FAILOVER_TEST_NB_UPSTREAMS];
+    const char* sni_list[FAILOVER_TEST_NB_UPSTREAMS] = { "origin1", "origin2", "origin3" };
+    const uint8_t url[] = { 'f', 'a', 'i', 'l', 'o', 'v', 'e', 'r' };
+    quicrq_relay_context_t* relay_ctx = NULL;
+    quicrq_media_source_ctx_t* srce_ctx = NULL;
+    quicrq_fragment_cache_t* cache_ctx = NULL;
+    quicrq_cnx_ctx_t* cnx_ctx = NULL;
+    size_t upstream_index = 0;
+    uint8_t data[16];
+
+    memset(data, 0x55, sizeof(data));
+    for (int i = 0; i < FAILOVER_TEST_NB_UPSTREAMS; i++) {
+        memset(&upstream_addr[i], 0, sizeof(struct sockaddr_in));
+        upstream_addr[i].sin_family = AF_INET;
+        upstream_addr[i].sin_port = htons((uint16_t)(QUICRQ_PORT + i));
+        addr_list[i] = (struct sockaddr*)&upstream_addr[i];
+    }
+
+    if (qr_ctx == NULL) {
+        ret = -1;
+    }
+    else if (quicrq_enable_relay_ex(qr_ctx, FAILOVER_TEST_NB_UPSTREAMS, sni_list, addr_list, 2, quicrq_transport_mode_single_stream) != 0) {
+        DBG_PRINTF("%s", "Cannot enable relay");
+        ret = -1;
+    }
+    else {
+        relay_ctx = qr_ctx->relay_ctx;
+    }
+
+    if (ret == 0) {
+        /* Check that URLs are spread on several upstreams, always on the same connection */
+        int upstream_used[FAILOVER_TEST_NB_UPSTREAMS] = { 0 };
+        int nb_upstreams_used = 0;
+
+        for (int i = 0; ret == 0 && i < FAILOVER_TEST_NB_URLS; i++) {
+            uint8_t test_url[7] = { 'm', 'e', 'd', 'i', 'a', '-', 0 };
+            size_t test_url_length = sizeof(test_url);
+            size_t second_index = 0;
+            quicrq_cnx_ctx_t* first_cnx = NULL;
+            quicrq_cnx_ctx_t* second_cnx = NULL;
+
+            test_url[6] = (uint8_t)('a' + i);
+            first_cnx = quicrq_relay_get_upstream_cnx(relay_ctx, test_url, test_url_length, SIZE_MAX, simulated_time, &upstream_index);
+            second_cnx = quicrq_relay_get_upstream_cnx(relay_ctx, test_url, test_url_length, SIZE_MAX, simulated_time, &second_index);
+
+            if (first_cnx == NULL || first_cnx != second_cnx || upstream_index != second_index) {
+                DBG_PRINTF("Unstable upstream selection for URL %d", i);
+                ret = -1;
+            }
+            else if (!upstream_used[upstream_index]) {
+                upstream_used[upstream_index] = 1;
+                nb_upstreams_used++;
+            }
+        }
+        if (ret == 0 && nb_upstreams_used < 2) {
+            DBG_PRINTF("Only %d upstreams used for %d URLs", nb_upstreams_used, FAILOVER_TEST_NB_URLS);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        /* Create the relay cache as if a client subscribed to the URL */
+        if (qr_ctx->default_source_fn(qr_ctx->default_source_ctx, qr_ctx, url, sizeof(url)) != 0 ||
+            (srce_ctx = quicrq_find_local_media_source(qr_ctx, url, sizeof(url))) == NULL ||
+            (cache_ctx = srce_ctx->cache_ctx) == NULL) {
+            DBG_PRINTF("%s", "Cannot create the relay cache");
+            ret = -1;
+        }
+        else if ((cnx_ctx = quicrq_relay_get_upstream_cnx(relay_ctx, url, sizeof(url), SIZE_MAX, simulated_time, &upstream_index)) == NULL) {
+            ret = -1;
+        }
+        else {
+            ret = quicrq_failover_test_check_subscribe(cnx_ctx, cache_ctx, 0, 0);
+        }
+    }
+
+    /* Receive the first objects */
+    for (uint64_t object_id = 0; ret == 0 && object_id < FAILOVER_TEST_NB_OBJECTS; object_id++) {
+        ret = quicrq_relay_consumer_cb(quicrq_media_datagram_ready, cnx_ctx->last_stream->media_ctx, simulated_time,
+            data, 0, object_id, 0, 0, 0, 0, sizeof(data), sizeof(data));
+    }
+
+    /* Lose the upstream connections one at a time */
+    for (int nb_lost = 1; ret == 0 && nb_lost <= FAILOVER_TEST_NB_UPSTREAMS; nb_lost++) {
+        size_t lost_index = upstream_index;
+
+        simulated_time += 1000;
+        quicrq_delete_cnx_context(cnx_ctx, quicrq_media_close_quic_connection, 0);
+        cnx_ctx = NULL;
+
+        if (relay_ctx->upstreams[lost_index].down_until <= simulated_time) {
+            DBG_PRINTF("Upstream %zu not marked down", lost_index);
+            ret = -1;
+        }
+        else if (nb_lost < FAILOVER_TEST_NB_UPSTREAMS) {
+            if (cache_ctx->is_feed_closed || relay_ctx->upstreams[lost_index].nb_failovers != 1) {
+                DBG_PRINTF("No failover after loss of upstream %zu", lost_index);
+                ret = -1;
+            }
+            else if ((cnx_ctx = quicrq_relay_get_upstream_cnx(relay_ctx, url, sizeof(url), SIZE_MAX, simulated_time, &upstream_index)) == NULL ||
+                upstream_index == lost_index) {
+                DBG_PRINTF("Subscription not moved from upstream %zu", lost_index);
+                ret = -1;
+            }
+            else {
+                ret = quicrq_failover_test_check_subscribe(cnx_ctx, cache_ctx, 0, FAILOVER_TEST_NB_OBJECTS);
+            }
+            if (ret == 0) {
+                /* The new upstream confirms the start point, the cached objects shall be kept */
+                ret = quicrq_relay_consumer_cb(quicrq_media_start_point, cnx_ctx->last_stream->media_ctx, simulated_time,
+                    NULL, 0, FAILOVER_TEST_NB_OBJECTS, 0, 0, 0, 0, 0, 0);
+                if (ret == 0 && (cache_ctx->first_object_id != 0 || cache_ctx->fragment_tree.size != FAILOVER_TEST_NB_OBJECTS)) {
+                    DBG_PRINTF("Cache purged after failover, %d fragments left", cache_ctx->fragment_tree.size);
+                    ret = -1;
+                }
+            }
+        }
+        else if (!cache_ctx->is_feed_closed) {
+            DBG_PRINTF("%s", "Cache not closed after loss of all upstreams");
+            ret = -1;
+        }
+    }
+
+    if (qr_ctx != NULL) {
+        quicrq_delete(qr_ctx);
+    }
+
+    return ret;
+}
+
+/* Unit test of a post received after a failover.
+ * The subscription that fed the relay cache moved to another upstream. Once the
+ * first upstream is back, the post is sent to that upstream, and the relay
+ * shall abandon the subscription on the upstream to which it moved.
+ */
+int quicrq_relay_failover_post_test()
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    quicrq_ctx_t* qr_ctx = quicrq_create(QUICRQ_ALPN, NULL, NULL, NULL, NULL, NULL, NULL, 0, &simulated_time);
+    struct sockaddr_in upstream_addr[FAILOVER_TEST_NB_UPSTREAMS];
+    const struct sockaddr* addr_list[FAILOVER_TEST_NB_UPSTREAMS];
+    const char* sni_list[FAILOVER_TEST_NB_UPSTREAMS] = { "origin1", "origin2", "origin3" };
+    const uint8_t url[] = { 'f', 'a', 'i', 'l', 'o', 'v', 'e', 'r' };
+    struct sockaddr_storage client_addr = { 0 };
+    quicrq_relay_context_t* relay_ctx = NULL;
+    quicrq_fragment_cache_t* cache_ctx = NULL;
+    quicrq_media_source_ctx_t* srce_ctx = NULL;
+    quicrq_cnx_ctx_t* cnx_ctx = NULL;
+    quicrq_cnx_ctx_t* client_cnx_ctx = NULL;
+    quicrq_stream_ctx_t* subscribe_ctx = NULL;
+    quicrq_stream_ctx_t* post_ctx = NULL;
+    size_t first_index = 0;
+    size_t upstream_index = 0;
+
+    for (int i = 0; i < FAILOVER_TEST_NB_UPSTREAMS; i++) {
+        memset(&upstream_addr[i], 0, sizeof(struct sockaddr_in));
+        upstream_addr[i].sin_family = AF_INET;
+        upstream_addr[i].sin_port = htons((uint16_t)(QUICRQ_PORT + i));
+        addr_list[i] = (struct sockaddr*)&upstream_addr[i];
+    }
+
+    if (qr_ctx == NULL) {
+        ret = -1;
+    }
+    else if (quicrq_enable_relay_ex(qr_ctx, FAILOVER_TEST_NB_UPSTREAMS, sni_list, addr_list, 2, quicrq_transport_mode_single_stream) != 0) {
+        DBG_PRINTF("%s", "Cannot enable relay");
+        ret = -1;
+    }
+    else {
+        relay_ctx = qr_ctx->relay_ctx;
+    }
+
+    if (ret == 0) {
+        /* Create the relay cache as if a client subscribed to the URL, then lose the upstream */
+        if (qr_ctx->default_source_fn(qr_ctx->default_source_ctx, qr_ctx, url, sizeof(url)) != 0 ||
+            (srce_ctx = quicrq_find_local_media_source(qr_ctx, url, sizeof(url))) == NULL ||
+            (cache_ctx = srce_ctx->cache_ctx) == NULL ||
+            (cnx_ctx = quicrq_relay_get_upstream_cnx(relay_ctx, url, sizeof(url), SIZE_MAX, simulated_time, &first_index)) == NULL) {
+            DBG_PRINTF("%s", "Cannot create the relay cache");
+            ret = -1;
+        }
+        else {
+            simulated_time += 1000;
+            quicrq_delete_cnx_context(cnx_ctx, quicrq_media_close_quic_connection, 0);
+            if ((cnx_ctx = quicrq_relay_get_upstream_cnx(relay_ctx, url, sizeof(url), SIZE_MAX, simulated_time, &upstream_index)) == NULL ||
+                upstream_index == first_index ||
+                (subscribe_ctx = quicrq_find_or_create_stream(cache_ctx->subscribe_stream_id, cnx_ctx, 0)) == NULL) {
+                DBG_PRINTF("Subscription not moved from upstream %zu", first_index);
+                ret = -1;
+            }
+        }
+    }
+
+    if (ret == 0) {
+        /* After the retry delay, a client posts the URL to the relay */
+        simulated_time += QUICRQ_RELAY_UPSTREAM_RETRY_DELAY;
+        if ((client_cnx_ctx = quicrq_create_client_cnx(qr_ctx, NULL, (struct sockaddr*)&client_addr)) == NULL ||
+            (post_ctx = quicrq_create_stream_context(client_cnx_ctx, 4)) == NULL) {
+            ret = -1;
+        }
+        else if (qr_ctx->consumer_media_init_fn(post_ctx, url, sizeof(url)) != 0) {
+            DBG_PRINTF("%s", "Cannot accept the post");
+            ret = -1;
+        }
+        else if (quicrq_relay_get_upstream_cnx(relay_ctx, url, sizeof(url), SIZE_MAX, simulated_time, &upstream_index) == cnx_ctx ||
+            upstream_index != first_index) {
+            DBG_PRINTF("Post not sent to upstream %zu", first_index);
+            ret = -1;
+        }
+        else if (subscribe_ctx->send_state != quicrq_sending_fin) {
+            DBG_PRINTF("%s", "Subscription not abandoned after failover");
+            ret = -1;
+        }
+    }
+
+    if (qr_ctx != NULL) {
+        quicrq_delete(qr_ctx);
+    }
+
+    return ret;
+}
+
+/* Unit test of the warm upstream connections.
+ * Verify that the connections to all upstreams are opened when the option
+ * is set, that a connection closed by the application is opened again at
+ * once, and that a lost connection is opened again after the retry delay.
+ */
+#define WARM_TEST_NB_UPSTREAMS 2
+
+static int quicrq_warm_test_check(quicrq_relay_context_t* relay_ctx, size_t nb_expected, uint64_t nb_warm_expected)
+{
+    int ret = 0;
+    size_t nb_connected = 0;
+    uint64_t nb_warm = 0;
+
+    for (size_t i = 0; i < relay_ctx->nb_upstreams; i++) {
+        for (size_t j = 0; j < relay_ctx->nb_cnx_per_upstream; j++) {
+            if (relay_ctx->upstreams[i].cnx_ctx[j] != NULL) {
+                nb_connected++;
+            }
+        }
+        nb_warm += relay_ctx->upstreams[i].nb_warm_connections;
+    }
+    if (nb_connected != nb_expected || nb_warm != nb_warm_expected ||
+        quicrq_get_nb_connections(relay_ctx->qr_ctx) != nb_expected) {
+        DBG_PRINTF("Connected %zu, warm %" PRIu64 ", expected %zu, %" PRIu64,
+            nb_connected, nb_warm, nb_expected, nb_warm_expected);
+        ret = -1;
+    }
+    return ret;
+}
+
+int quicrq_relay_warm_test()
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    quicrq_ctx_t* qr_ctx = quicrq_create(QUICRQ_ALPN, NULL, NULL, NULL, NULL, NULL, NULL, 0, &simulated_time);
+    struct sockaddr_in upstream_addr[WARM_TEST_NB_UPSTREAMS];
+    const struct sockaddr* addr_list[WARM_TEST_NB_UPSTREAMS];
+    const char* sni_list[WARM_TEST_NB_UPSTREAMS] = { "origin1", "origin2" };
+    quicrq_relay_context_t* relay_ctx = NULL;
+
+    for (int i = 0; i < WARM_TEST_NB_UPSTREAMS; i++) {
+        memset(&upstream_addr[i], 0, sizeof(struct sockaddr_in));
+        upstream_addr[i].sin_family = AF_INET;
+        upstream_addr[i].sin_port = htons((uint16_t)(QUICRQ_PORT + i));
+        addr_list[i] = (struct sockaddr*)&upstream_addr[i];
+    }
+
+    if (qr_ctx == NULL) {
+        ret = -1;
+    }
+    else if (quicrq_relay_set_warm_upstreams(qr_ctx, 1) == 0) {
+        DBG_PRINTF("%s", "Warm upstreams accepted before enabling the relay");
+        ret = -1;
+    }
+    else if (quicrq_enable_relay_ex(qr_ctx, WARM_TEST_NB_UPSTREAMS, sni_list, addr_list, 2, quicrq_transport_mode_datagram) != 0 ||
+        quicrq_relay_set_warm_upstreams(qr_ctx, 1) != 0) {
+        DBG_PRINTF("%s", "Cannot enable warm upstreams");
+        ret = -1;
+    }
+    else {
+        relay_ctx = qr_ctx->relay_ctx;
+        /* Nothing is connected until the timers run */
+        ret = quicrq_warm_test_check(relay_ctx, 0, 0);
+    }
+
+    if (ret == 0) {
+        (void)quicrq_handle_extra_repeat(qr_ctx, simulated_time);
+        ret = quicrq_warm_test_check(relay_ctx, 2 * WARM_TEST_NB_UPSTREAMS, 2 * WARM_TEST_NB_UPSTREAMS);
+    }
+
+    if (ret == 0) {
+        /* Closed by the application, opened again at once */
+        simulated_time += 1000;
+        quicrq_delete_cnx_context(relay_ctx->upstreams[0].cnx_ctx[0], quicrq_media_close_local_application, 0);
+        ret = quicrq_warm_test_check(relay_ctx, 2 * WARM_TEST_NB_UPSTREAMS - 1, 2 * WARM_TEST_NB_UPSTREAMS);
+        if (ret == 0) {
+            (void)quicrq_handle_extra_repeat(qr_ctx, simulated_time);
+            ret = quicrq_warm_test_check(relay_ctx, 2 * WARM_TEST_NB_UPSTREAMS, 2 * WARM_TEST_NB_UPSTREAMS + 1);
+        }
+    }
+
+    if (ret == 0) {
+        /* Lost, opened again after the retry delay */
+        uint64_t next_time;
+
+        simulated_time += 1000;
+        quicrq_delete_cnx_context(relay_ctx->upstreams[1].cnx_ctx[1], quicrq_media_close_quic_connection, 0);
+        next_time = quicrq_handle_extra_repeat(qr_ctx, simulated_time);
+        ret = quicrq_warm_test_check(relay_ctx, 2 * WARM_TEST_NB_UPSTREAMS - 1, 2 * WARM_TEST_NB_UPSTREAMS + 1);
+        if (ret == 0 && next_time != relay_ctx->upstreams[1].down_until) {
+            DBG_PRINTF("Next warm check at %" PRIu64 ", expected %" PRIu64, next_time, relay_ctx->upstreams[1].down_until);
+            ret = -1;
+        }
+        if (ret == 0) {
+            simulated_time = next_time;
+            (void)quicrq_handle_extra_repeat(qr_ctx, simulated_time);
+            ret = quicrq_warm_test_check(relay_ctx, 2 * WARM_TEST_NB_UPSTREAMS, 2 * WARM_TEST_NB_UPSTREAMS + 2);
+        }
+    }
+
+    if (ret == 0) {
+        /* When disabled, closed connections stay closed */
+        simulated_time += 1000;
+        if (quicrq_relay_set_warm_upstreams(qr_ctx, 0) != 0) {
+            ret = -1;
+        }
+        else {
+            quicrq_delete_cnx_context(relay_ctx->upstreams[0].cnx_ctx[1], quicrq_media_close_local_application, 0);
+            (void)quicrq_handle_extra_repeat(qr_ctx, simulated_time);
+            ret = quicrq_warm_test_check(relay_ctx, 2 * WARM_TEST_NB_UPSTREAMS - 1, 2 * WARM_TEST_NB_UPSTREAMS + 2);
+        }
+    }
+
+    if (qr_ctx != NULL) {
+        quicrq_delete(qr_ctx);
+    }
+
+    return ret;
+}
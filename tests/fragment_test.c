@@ -271,7 +271,7 @@ int quicrq_fragment_cache_publish_simulate(quicrq_fragment_publisher_context_t*
             d_context.bytes_max = &data[0] + 1024;
             d_context.allowed_space = 1023;
             /* Call the prepare function */
-            ret = quicrq_fragment_datagram_publisher_prepare(NULL, pub_ctx, 0, &d_context, d_context.allowed_space,
+            ret = quicrq_fragment_datagram_publisher_prepare(NULL, pub_ctx, 0, &d_context, d_context.allowed_space, NULL,
                 &media_was_sent, &at_least_one_active, &not_ready, current_time);
             /* Decode the datagram header to find the coded_fragment */
             if (ret == 0 && d_context.after_data > d_context.bytes0) {
@@ -561,3 +561,1133 @@ int quicrq_fragment_cache_fill_test()
 
     return ret;
 }
+
+/* Test of the object index and of the copy cursor.
+ * An object is received in fragments arriving out of order. The contiguous
+ * length tracked in the object index shall only progress when the holes are
+ * filled, and the copy with a cursor shall return the same bytes as the
+ * original object, read in small chunks. The cursor shall be ignored after
+ * fragments are deleted from the cache.
+ */
+#define FRAGMENT_INDEX_TEST_OBJECT_SIZE 1000
+#define FRAGMENT_INDEX_TEST_FRAGMENT_SIZE 100
+#define FRAGMENT_INDEX_TEST_CHUNK_SIZE 37
+
+static int quicrq_fragment_index_test_read(quicrq_fragment_cache_t* cache_ctx, quicrq_fragment_cursor_t* cursor,
+    const uint8_t* data)
+{
+    int ret = 0;
+    uint8_t buffer[FRAGMENT_INDEX_TEST_OBJECT_SIZE];
+    size_t offset = 0;
+
+    while (offset < FRAGMENT_INDEX_TEST_OBJECT_SIZE) {
+        size_t copied = quicrq_fragment_object_copy_available_data(cache_ctx, cursor, 1, 2, offset,
+            FRAGMENT_INDEX_TEST_CHUNK_SIZE, buffer + offset);
+        if (copied == 0) {
+            break;
+        }
+        offset += copied;
+    }
+    if (offset != FRAGMENT_INDEX_TEST_OBJECT_SIZE || memcmp(buffer, data, offset) != 0) {
+        DBG_PRINTF("Read %zu bytes, data %s", offset, (memcmp(buffer, data, offset) == 0) ? "matches" : "differs");
+        ret = -1;
+    }
+    return ret;
+}
+
+int quicrq_fragment_object_index_test()
+{
+    int ret = 0;
+    uint8_t data[FRAGMENT_INDEX_TEST_OBJECT_SIZE];
+    size_t nb_fragments = FRAGMENT_INDEX_TEST_OBJECT_SIZE / FRAGMENT_INDEX_TEST_FRAGMENT_SIZE;
+    quicrq_fragment_cursor_t cursor = { 0 };
+    quicrq_media_source_ctx_t srce_ctx = { 0 };
+    quicrq_fragment_cache_t* cache_ctx = quicrq_fragment_cache_create_ctx(NULL);
+
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = (uint8_t)(i * 7 + 1);
+    }
+
+    if (cache_ctx == NULL) {
+        ret = -1;
+    }
+    else {
+        cache_ctx->srce_ctx = &srce_ctx;
+    }
+
+    for (int pass = 0; ret == 0 && pass < 2; pass++) {
+        /* Even fragments in the first pass, odd fragments in the second */
+        for (size_t i = pass; ret == 0 && i < nb_fragments; i += 2) {
+            size_t offset = i * FRAGMENT_INDEX_TEST_FRAGMENT_SIZE;
+            quicrq_cached_object_t* object;
+            uint64_t expected = (pass == 0) ? FRAGMENT_INDEX_TEST_FRAGMENT_SIZE : offset + 2 * FRAGMENT_INDEX_TEST_FRAGMENT_SIZE;
+
+            if (expected > FRAGMENT_INDEX_TEST_OBJECT_SIZE) {
+                expected = FRAGMENT_INDEX_TEST_OBJECT_SIZE;
+            }
+            ret = quicrq_fragment_propose_to_cache(cache_ctx, data + offset, 1, 2, offset, 0, 0, 3,
+                FRAGMENT_INDEX_TEST_OBJECT_SIZE, FRAGMENT_INDEX_TEST_FRAGMENT_SIZE, 0);
+            if (ret == 0 && ((object = quicrq_fragment_cache_get_object(cache_ctx, 1, 2)) == NULL ||
+                object->contiguous_length != expected ||
+                object->is_complete != (expected == FRAGMENT_INDEX_TEST_OBJECT_SIZE))) {
+                DBG_PRINTF("Fragment %zu, pass %d, unexpected object state", i, pass);
+                ret = -1;
+            }
+        }
+        if (ret == 0 && pass == 0) {
+            /* Only the first fragment can be read in sequence */
+            size_t copied = quicrq_fragment_object_copy_available_data(cache_ctx, &cursor, 1, 2, 0,
+                FRAGMENT_INDEX_TEST_OBJECT_SIZE, NULL);
+            if (copied != FRAGMENT_INDEX_TEST_FRAGMENT_SIZE) {
+                DBG_PRINTF("Copied %zu bytes before holes are filled", copied);
+                ret = -1;
+            }
+        }
+    }
+
+    if (ret == 0) {
+        size_t object_length = 0;
+        uint64_t nb_objects_previous_group = 0;
+        uint8_t flags = 0xff;
+
+        if (quicrq_fragment_get_object_properties(cache_ctx, 1, 2, &object_length, &nb_objects_previous_group, &flags) != 0 ||
+            object_length != FRAGMENT_INDEX_TEST_OBJECT_SIZE || nb_objects_previous_group != 3 || flags != 0 ||
+            cache_ctx->nb_object_received != 1 || quicrq_fragment_cache_get_object(cache_ctx, 1, 3) != NULL) {
+            DBG_PRINTF("%s", "Unexpected object properties");
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        ret = quicrq_fragment_index_test_read(cache_ctx, &cursor, data);
+    }
+
+    if (ret == 0) {
+        /* Delete the object and receive it again in a single fragment. The cursor
+         * points to a deleted fragment, and shall not be used. */
+        quicrq_fragment_cache_media_clear(cache_ctx);
+        if (quicrq_fragment_cache_get_object(cache_ctx, 1, 2) != NULL) {
+            DBG_PRINTF("%s", "Object still indexed after clear");
+            ret = -1;
+        }
+        else {
+            ret = quicrq_fragment_propose_to_cache(cache_ctx, data, 1, 2, 0, 0, 0, 3,
+                FRAGMENT_INDEX_TEST_OBJECT_SIZE, FRAGMENT_INDEX_TEST_OBJECT_SIZE, 0);
+        }
+        if (ret == 0) {
+            ret = quicrq_fragment_index_test_read(cache_ctx, &cursor, data);
+        }
+    }
+
+    if (cache_ctx != NULL) {
+        quicrq_fragment_cache_delete_ctx(cache_ctx);
+    }
+
+    return ret;
+}
+
+/* Unit test of the cache memory limit.
+ * Fill two sources with 6 groups of 2 objects. The first source has no reader,
+ * the second one has a single stream reader at group 2, and was read more
+ * recently. Verify that the groups of the first source are evicted first, that
+ * the group being received is kept, and that the groups from the reader's
+ * cursor on are never evicted.
+ */
+#define CACHE_MEMORY_TEST_OBJECT_SIZE 100
+#define CACHE_MEMORY_TEST_NB_GROUPS 6
+
+static int quicrq_cache_memory_test_check(quicrq_ctx_t* qr_ctx, quicrq_fragment_cache_t* cache_a, quicrq_fragment_cache_t* cache_b,
+    uint64_t first_group_a, uint64_t first_group_b, uint64_t evicted_groups)
+{
+    int ret = 0;
+    quicrq_cache_memory_stats_t stats;
+    uint64_t evicted_bytes = evicted_groups * 2 * CACHE_MEMORY_TEST_OBJECT_SIZE;
+
+    quicrq_get_cache_memory_stats(qr_ctx, &stats);
+
+    if (cache_a->first_group_id != first_group_a || cache_b->first_group_id != first_group_b ||
+        cache_a->first_object_id != 0 || cache_b->first_object_id != 0) {
+        DBG_PRINTF("First groups %" PRIu64 ", %" PRIu64 " instead of %" PRIu64 ", %" PRIu64,
+            cache_a->first_group_id, cache_b->first_group_id, first_group_a, first_group_b);
+        ret = -1;
+    }
+    else if (stats.evicted_groups != evicted_groups || stats.evicted_bytes != evicted_bytes ||
+        cache_a->evicted_bytes + cache_b->evicted_bytes != evicted_bytes) {
+        DBG_PRINTF("Evicted %" PRIu64 " groups, %" PRIu64 " bytes instead of %" PRIu64,
+            stats.evicted_groups, stats.evicted_bytes, evicted_groups);
+        ret = -1;
+    }
+    else if (stats.cache_bytes != cache_a->cache_bytes + cache_b->cache_bytes ||
+        stats.cache_bytes + evicted_bytes != 2 * 2 * CACHE_MEMORY_TEST_NB_GROUPS * CACHE_MEMORY_TEST_OBJECT_SIZE) {
+        DBG_PRINTF("Cache holds %zu bytes, unexpected", stats.cache_bytes);
+        ret = -1;
+    }
+    else if (quicrq_fragment_cache_get_object(cache_a, first_group_a, 0) == NULL ||
+        quicrq_fragment_cache_get_object(cache_b, first_group_b, 0) == NULL ||
+        (first_group_a > 0 && quicrq_fragment_cache_get_object(cache_a, first_group_a - 1, 1) != NULL) ||
+        (first_group_b > 0 && quicrq_fragment_cache_get_object(cache_b, first_group_b - 1, 1) != NULL)) {
+        DBG_PRINTF("%s", "Unexpected objects in cache after eviction");
+        ret = -1;
+    }
+    return ret;
+}
+
+int quicrq_cache_memory_limit_test()
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    struct sockaddr_storage addr = { 0 };
+    char const* url_a = "cache_memory_a";
+    char const* url_b = "cache_memory_b";
+    uint8_t data[CACHE_MEMORY_TEST_OBJECT_SIZE];
+    quicrq_media_object_properties_t properties = { 0 };
+    quicrq_ctx_t* qr_ctx = quicrq_create(QUICRQ_ALPN, NULL, NULL, NULL, NULL, NULL, NULL, 0, &simulated_time);
+    quicrq_cnx_ctx_t* cnx_ctx = (qr_ctx == NULL) ? NULL : quicrq_create_client_cnx(qr_ctx, NULL, (struct sockaddr*)&addr);
+    quicrq_stream_ctx_t* stream_ctx = (cnx_ctx == NULL) ? NULL : quicrq_create_stream_context(cnx_ctx, 0);
+    quicrq_media_object_source_ctx_t* source_a = (qr_ctx == NULL) ? NULL :
+        quicrq_publish_object_source(qr_ctx, (const uint8_t*)url_a, strlen(url_a), NULL);
+    quicrq_media_object_source_ctx_t* source_b = (qr_ctx == NULL) ? NULL :
+        quicrq_publish_object_source(qr_ctx, (const uint8_t*)url_b, strlen(url_b), NULL);
+
+    if (stream_ctx == NULL || source_a == NULL || source_b == NULL) {
+        ret = -1;
+    }
+
+    for (uint64_t group_id = 0; ret == 0 && group_id < CACHE_MEMORY_TEST_NB_GROUPS; group_id++) {
+        for (uint64_t object_id = 0; ret == 0 && object_id < 2; object_id++) {
+            memset(data, (int)(16 * group_id + object_id), sizeof(data));
+            ret = quicrq_publish_object(source_a, data, sizeof(data), &properties, group_id, object_id);
+            if (ret == 0) {
+                ret = quicrq_publish_object(source_b, data, sizeof(data), &properties, group_id, object_id);
+            }
+        }
+    }
+
+    if (ret == 0) {
+        /* Add a reader of source B, positioned at group 2 */
+        stream_ctx->is_sender = 1;
+        stream_ctx->transport_mode = quicrq_transport_mode_single_stream;
+        ret = quicrq_subscribe_local_media(stream_ctx, (const uint8_t*)url_b, strlen(url_b));
+        if (ret == 0) {
+            stream_ctx->media_ctx->current_group_id = 2;
+            source_b->cache_ctx->last_read_time = 1000;
+        }
+    }
+
+    if (ret == 0) {
+        /* No limit, no eviction */
+        quicrq_fragment_cache_enforce_memory_limit(qr_ctx);
+        ret = quicrq_cache_memory_test_check(qr_ctx, source_a->cache_ctx, source_b->cache_ctx, 0, 0, 0);
+    }
+
+    if (ret == 0) {
+        /* Evict from the unread source, down to 1500 bytes */
+        quicrq_set_cache_memory_limit(qr_ctx, 1500);
+        quicrq_fragment_cache_enforce_memory_limit(qr_ctx);
+        ret = quicrq_cache_memory_test_check(qr_ctx, source_a->cache_ctx, source_b->cache_ctx, 5, 0, 5);
+    }
+
+    if (ret == 0) {
+        /* The last group of A is still receiving, and B is read from group 2:
+         * the budget cannot be met, evict what can be evicted. */
+        quicrq_set_cache_memory_limit(qr_ctx, 200);
+        (void)quicrq_time_check(qr_ctx, 0);
+        ret = quicrq_cache_memory_test_check(qr_ctx, source_a->cache_ctx, source_b->cache_ctx, 5, 2, 7);
+    }
+
+    if (ret == 0) {
+        /* Publishing continues after the eviction */
+        memset(data, 0xaa, sizeof(data));
+        ret = quicrq_publish_object(source_a, data, sizeof(data), &properties, CACHE_MEMORY_TEST_NB_GROUPS, 0);
+        if (ret == 0 && quicrq_fragment_cache_get_object(source_a->cache_ctx, CACHE_MEMORY_TEST_NB_GROUPS, 0) == NULL) {
+            DBG_PRINTF("%s", "Cannot publish after eviction");
+            ret = -1;
+        }
+    }
+
+    if (qr_ctx != NULL) {
+        /* This will also delete the sources, stream_ctx and cnx_ctx */
+        quicrq_delete(qr_ctx);
+    }
+    return ret;
+}
+
+/* Test of the stream publisher resuming at the next fragment.
+ * Group 1 holds an object of three fragments and an object of two, group 2
+ * a single object. Read them in small chunks, as successive packets would.
+ * At the end of each fragment of a group, the publisher shall already point
+ * to the next fragment of the group, and search the cache at the group
+ * change. After fragments are evicted from the cache, the saved next
+ * fragment shall not be used.
+ */
+#define PUBLISHER_NEXT_TEST_FRAGMENT_SIZE 100
+#define PUBLISHER_NEXT_TEST_CHUNK_SIZE 64
+#define PUBLISHER_NEXT_TEST_NB_FRAGMENTS 6
+
+int quicrq_fragment_publisher_next_test()
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    struct sockaddr_storage addr = { 0 };
+    /* group, object, offset, object length of each fragment, in read order */
+    const uint64_t fragments[PUBLISHER_NEXT_TEST_NB_FRAGMENTS][4] = {
+        { 1, 0, 0, 300 }, { 1, 0, 100, 300 }, { 1, 0, 200, 300 }, { 1, 1, 0, 200 }, { 1, 1, 100, 200 }, { 2, 0, 0, 100 } };
+    uint8_t data[PUBLISHER_NEXT_TEST_FRAGMENT_SIZE];
+    uint8_t buffer[PUBLISHER_NEXT_TEST_FRAGMENT_SIZE];
+    quicrq_ctx_t* qr_ctx = quicrq_create(QUICRQ_ALPN, NULL, NULL, NULL, NULL, NULL, NULL, 0, &simulated_time);
+    quicrq_cnx_ctx_t* cnx_ctx = (qr_ctx == NULL) ? NULL : quicrq_create_client_cnx(qr_ctx, NULL, (struct sockaddr*)&addr);
+    quicrq_stream_ctx_t* stream_ctx = (cnx_ctx == NULL) ? NULL : quicrq_create_stream_context(cnx_ctx, 0);
+    quicrq_media_source_ctx_t srce_ctx = { 0 };
+    quicrq_fragment_cache_t* cache_ctx = quicrq_fragment_cache_create_ctx(NULL);
+    quicrq_fragment_publisher_context_t* pub_ctx = NULL;
+
+    if (stream_ctx == NULL || cache_ctx == NULL) {
+        ret = -1;
+    }
+    else {
+        cache_ctx->srce_ctx = &srce_ctx;
+        /* A fragment of group 0, which the publisher does not read, is evicted during the test */
+        memset(data, 0, sizeof(data));
+        ret = quicrq_fragment_propose_to_cache(cache_ctx, data, 0, 0, 0, 0, 0, 0, 1, 1, 0);
+    }
+    for (size_t i = 0; ret == 0 && i < PUBLISHER_NEXT_TEST_NB_FRAGMENTS; i++) {
+        memset(data, (int)i + 1, sizeof(data));
+        ret = quicrq_fragment_propose_to_cache(cache_ctx, data, fragments[i][0], fragments[i][1], fragments[i][2], 0, 0,
+            (fragments[i][1] == 0 && fragments[i][2] == 0) ? fragments[i][0] : 0, fragments[i][3], PUBLISHER_NEXT_TEST_FRAGMENT_SIZE, 0);
+    }
+    if (ret == 0) {
+        if ((pub_ctx = (quicrq_fragment_publisher_context_t*)quicrq_fragment_publisher_subscribe(cache_ctx, stream_ctx)) == NULL) {
+            ret = -1;
+        }
+        else {
+            pub_ctx->current_group_id = 1;
+        }
+    }
+
+    for (size_t i = 0; ret == 0 && i < PUBLISHER_NEXT_TEST_NB_FRAGMENTS; i++) {
+        size_t length = 0;
+
+        if (i == 3) {
+            /* The saved fragment shall not be used after the eviction */
+            (void)quicrq_fragment_cache_evict_group(cache_ctx, 1);
+        }
+        while (ret == 0 && length < PUBLISHER_NEXT_TEST_FRAGMENT_SIZE) {
+            size_t data_length = 0;
+            size_t copied = 0;
+            uint8_t flags = 0;
+            int is_new_group = 0;
+            uint64_t object_length = 0;
+            int is_media_finished = 0;
+            int is_still_active = 0;
+            int should_skip = 0;
+
+            ret = quicrq_fragment_publisher_fn(quicrq_media_source_get_data, pub_ctx, NULL, PUBLISHER_NEXT_TEST_CHUNK_SIZE, &data_length,
+                &flags, &is_new_group, &object_length, &is_media_finished, &is_still_active, &should_skip, simulated_time);
+            if (ret == 0 && (data_length == 0 || is_new_group != (i == 5 && length == 0) || object_length != fragments[i][3] ||
+                pub_ctx->current_fragment->group_id != fragments[i][0] || pub_ctx->current_fragment->object_id != fragments[i][1] ||
+                pub_ctx->current_fragment->offset != fragments[i][2])) {
+                DBG_PRINTF("Fragment %zu, offset %zu, unexpected state", i, length);
+                ret = -1;
+            }
+            else if (ret == 0) {
+                ret = quicrq_fragment_publisher_fn(quicrq_media_source_get_data, pub_ctx, buffer + length, data_length, &copied,
+                    &flags, &is_new_group, &object_length, &is_media_finished, &is_still_active, &should_skip, simulated_time);
+                length += copied;
+            }
+        }
+        for (size_t j = 0; ret == 0 && j < PUBLISHER_NEXT_TEST_FRAGMENT_SIZE; j++) {
+            if (buffer[j] != (uint8_t)(i + 1)) {
+                DBG_PRINTF("Fragment %zu, byte %zu does not match", i, j);
+                ret = -1;
+            }
+        }
+        if (ret == 0 && (pub_ctx->current_fragment == NULL) != (i >= 4)) {
+            DBG_PRINTF("Fragment %zu, next fragment %s", i, (pub_ctx->current_fragment == NULL) ? "not set" : "set");
+            ret = -1;
+        }
+    }
+
+    if (pub_ctx != NULL) {
+        quicrq_fragment_publisher_close(pub_ctx);
+    }
+    if (cache_ctx != NULL) {
+        quicrq_fragment_cache_delete_ctx(cache_ctx);
+    }
+    if (qr_ctx != NULL) {
+        quicrq_delete(qr_ctx);
+    }
+    return ret;
+}
+
+/* Unit test of the group index.
+ * Groups 0 and 1 have 4 objects each, all received. Group 2 misses its second
+ * object, and group 3 only has its second object. Verify the join points for
+ * the live edge and for the latest complete group as objects arrive, the
+ * completion of groups, and the seek in arrival order after an eviction.
+ */
+#define GROUP_INDEX_TEST_OBJECT_SIZE 16
+#define GROUP_INDEX_TEST_NB_OBJECTS 4
+
+static int quicrq_group_index_test_add(quicrq_fragment_cache_t* cache_ctx, const uint8_t* data, uint64_t group_id, uint64_t object_id, uint64_t current_time)
+{
+    return quicrq_fragment_propose_to_cache(cache_ctx, data, group_id, object_id, 0, 0, 0,
+        (object_id == 0 && group_id > 0) ? GROUP_INDEX_TEST_NB_OBJECTS : 0,
+        GROUP_INDEX_TEST_OBJECT_SIZE, GROUP_INDEX_TEST_OBJECT_SIZE, current_time);
+}
+
+static int quicrq_group_index_test_check(quicrq_fragment_cache_t* cache_ctx, uint64_t live_edge, uint64_t complete_group)
+{
+    int ret = 0;
+    uint64_t live_edge_found = quicrq_fragment_cache_join_group_id(cache_ctx, 0);
+    uint64_t complete_group_found = quicrq_fragment_cache_join_group_id(cache_ctx, 1);
+
+    if (live_edge_found != live_edge || complete_group_found != complete_group) {
+        DBG_PRINTF("Join at %" PRIu64 " / %" PRIu64 " instead of %" PRIu64 " / %" PRIu64,
+            live_edge_found, complete_group_found, live_edge, complete_group);
+        ret = -1;
+    }
+    return ret;
+}
+
+int quicrq_fragment_group_index_test()
+{
+    int ret = 0;
+    uint8_t data[GROUP_INDEX_TEST_OBJECT_SIZE];
+    uint64_t current_time = 0;
+    quicrq_media_source_ctx_t srce_ctx = { 0 };
+    quicrq_fragment_cache_t* cache_ctx = quicrq_fragment_cache_create_ctx(NULL);
+    quicrq_cached_group_t* group = NULL;
+
+    memset(data, 0x5a, sizeof(data));
+    if (cache_ctx == NULL) {
+        ret = -1;
+    }
+    else {
+        cache_ctx->srce_ctx = &srce_ctx;
+    }
+
+    for (uint64_t group_id = 0; ret == 0 && group_id < 2; group_id++) {
+        for (uint64_t object_id = 0; ret == 0 && object_id < GROUP_INDEX_TEST_NB_OBJECTS; object_id++) {
+            current_time += 1000;
+            ret = quicrq_group_index_test_add(cache_ctx, data, group_id, object_id, current_time);
+        }
+    }
+
+    if (ret == 0) {
+        /* The size of group 1 is not known until group 2 starts */
+        group = quicrq_fragment_cache_get_group(cache_ctx, 0);
+        if (cache_ctx->group_tree.size != 2 || group == NULL || !group->is_complete ||
+            (group = quicrq_fragment_cache_get_group(cache_ctx, 1)) == NULL || group->is_complete ||
+            group->nb_objects_complete != GROUP_INDEX_TEST_NB_OBJECTS) {
+            DBG_PRINTF("%s", "Unexpected state of groups 0 and 1");
+            ret = -1;
+        }
+        else {
+            ret = quicrq_group_index_test_check(cache_ctx, 1, 0);
+        }
+    }
+
+    if (ret == 0) {
+        /* Group 3 starts with its second object, group 2 misses its second object.
+         * The first object of group 2 arrives in the same tick as group 3. */
+        current_time += 1000;
+        ret = quicrq_group_index_test_add(cache_ctx, data, 3, 1, current_time);
+        for (uint64_t object_id = 0; ret == 0 && object_id < GROUP_INDEX_TEST_NB_OBJECTS; object_id++) {
+            if (object_id != 1) {
+                if (object_id > 0) {
+                    current_time += 1000;
+                }
+                ret = quicrq_group_index_test_add(cache_ctx, data, 2, object_id, current_time);
+            }
+        }
+        if (ret == 0 && (cache_ctx->next_group_id != 2 || cache_ctx->next_object_id != 1)) {
+            DBG_PRINTF("Next object %" PRIu64 "/%" PRIu64, cache_ctx->next_group_id, cache_ctx->next_object_id);
+            ret = -1;
+        }
+        if (ret == 0) {
+            ret = quicrq_group_index_test_check(cache_ctx, 2, 1);
+        }
+    }
+
+    if (ret == 0) {
+        /* The start of group 3 arrives: live edge moves to group 3, group 2 is not complete */
+        current_time += 1000;
+        ret = quicrq_group_index_test_add(cache_ctx, data, 3, 0, current_time);
+        if (ret == 0) {
+            ret = quicrq_group_index_test_check(cache_ctx, 3, 1);
+        }
+    }
+
+    if (ret == 0) {
+        /* The missing object of group 2 is repaired */
+        current_time += 1000;
+        ret = quicrq_group_index_test_add(cache_ctx, data, 2, 1, current_time);
+        if (ret == 0) {
+            ret = quicrq_group_index_test_check(cache_ctx, 3, 2);
+        }
+    }
+
+    if (ret == 0) {
+        /* The first fragment of group 3 arrived before those of group 2 */
+        quicrq_cached_fragment_t* fragment_2 = quicrq_fragment_cache_seek_arrival(cache_ctx, 2);
+        quicrq_cached_fragment_t* fragment_4 = quicrq_fragment_cache_seek_arrival(cache_ctx, 4);
+
+        if (fragment_2 == NULL || fragment_2->group_id != 3 || fragment_2->object_id != 1 || fragment_4 != NULL) {
+            DBG_PRINTF("%s", "Unexpected seek in arrival order");
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        /* Evict group 0, then check that the groups are seeked and deleted */
+        quicrq_cached_fragment_t* fragment_1 = NULL;
+
+        (void)quicrq_fragment_cache_evict_group(cache_ctx, 1);
+        fragment_1 = quicrq_fragment_cache_seek_arrival(cache_ctx, 0);
+        if (cache_ctx->group_tree.size != 3 || quicrq_fragment_cache_get_group(cache_ctx, 0) != NULL ||
+            fragment_1 == NULL || fragment_1 != cache_ctx->first_fragment || fragment_1->group_id != 1) {
+            DBG_PRINTF("%s", "Unexpected group index after eviction");
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        quicrq_fragment_cache_media_clear(cache_ctx);
+        if (cache_ctx->group_tree.size != 0 || quicrq_fragment_cache_join_group_id(cache_ctx, 1) != cache_ctx->next_group_id) {
+            DBG_PRINTF("%s", "Group index not empty after clear");
+            ret = -1;
+        }
+    }
+
+    if (cache_ctx != NULL) {
+        quicrq_fragment_cache_delete_ctx(cache_ctx);
+    }
+
+    return ret;
+}
+
+/* Unit test of the catch up pacing.
+ * Objects arrive in cache every 10ms. A subscriber joins after 5 objects,
+ * with a catch up speed of 200%. The cached objects shall be sent every 5ms,
+ * with the catch up timer set to the release time of the next object, until
+ * the subscriber reaches the live edge at object 10. The next objects shall
+ * then be sent as soon as they arrive.
+ */
+#define CATCH_UP_TEST_OBJECT_SIZE 100
+#define CATCH_UP_TEST_INTERVAL 10000
+#define CATCH_UP_TEST_NB_CACHED 5
+#define CATCH_UP_TEST_NB_OBJECTS 14
+#define CATCH_UP_TEST_LIVE_EDGE 10
+
+int quicrq_fragment_catch_up_test()
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    struct sockaddr_storage addr = { 0 };
+    uint8_t data[CATCH_UP_TEST_OBJECT_SIZE];
+    uint8_t buffer[CATCH_UP_TEST_OBJECT_SIZE];
+    uint64_t nb_objects_sent = 0;
+    quicrq_ctx_t* qr_ctx = quicrq_create(QUICRQ_ALPN, NULL, NULL, NULL, NULL, NULL, NULL, 0, &simulated_time);
+    quicrq_cnx_ctx_t* cnx_ctx = (qr_ctx == NULL) ? NULL : quicrq_create_client_cnx(qr_ctx, NULL, (struct sockaddr*)&addr);
+    quicrq_stream_ctx_t* stream_ctx = (cnx_ctx == NULL) ? NULL : quicrq_create_stream_context(cnx_ctx, 0);
+    quicrq_media_source_ctx_t srce_ctx = { 0 };
+    quicrq_fragment_cache_t* cache_ctx = quicrq_fragment_cache_create_ctx(NULL);
+    quicrq_fragment_publisher_context_t* pub_ctx = NULL;
+
+    memset(data, 0x5a, sizeof(data));
+    if (stream_ctx == NULL || cache_ctx == NULL) {
+        ret = -1;
+    }
+    else {
+        cache_ctx->srce_ctx = &srce_ctx;
+        quicrq_set_catch_up_speed(qr_ctx, 200);
+        if ((pub_ctx = (quicrq_fragment_publisher_context_t*)quicrq_fragment_publisher_subscribe(cache_ctx, stream_ctx)) == NULL) {
+            ret = -1;
+        }
+    }
+
+    while (ret == 0 && nb_objects_sent < CATCH_UP_TEST_NB_OBJECTS) {
+        uint64_t object_id = simulated_time / CATCH_UP_TEST_INTERVAL;
+        size_t data_length = 0;
+        size_t copied = 0;
+        uint8_t flags = 0;
+        int is_new_group = 0;
+        uint64_t object_length = 0;
+        int is_media_finished = 0;
+        int is_still_active = 0;
+        int should_skip = 0;
+
+        if (simulated_time % CATCH_UP_TEST_INTERVAL == 0 && object_id < CATCH_UP_TEST_NB_OBJECTS) {
+            ret = quicrq_fragment_propose_to_cache(cache_ctx, data, 0, object_id, 0, 0, 0, 0,
+                CATCH_UP_TEST_OBJECT_SIZE, CATCH_UP_TEST_OBJECT_SIZE, simulated_time);
+        }
+        if (ret == 0 && simulated_time >= CATCH_UP_TEST_NB_CACHED * CATCH_UP_TEST_INTERVAL) {
+            ret = quicrq_fragment_publisher_fn(quicrq_media_source_get_data, pub_ctx, NULL, sizeof(buffer), &data_length,
+                &flags, &is_new_group, &object_length, &is_media_finished, &is_still_active, &should_skip, simulated_time);
+        }
+        if (ret == 0 && data_length > 0) {
+            /* Object N is sent at its release time during catch up, then as soon as it arrives */
+            uint64_t expected_time = (nb_objects_sent < CATCH_UP_TEST_LIVE_EDGE) ?
+                CATCH_UP_TEST_NB_CACHED * CATCH_UP_TEST_INTERVAL + nb_objects_sent * CATCH_UP_TEST_INTERVAL / 2 :
+                nb_objects_sent * CATCH_UP_TEST_INTERVAL;
+
+            if (simulated_time != expected_time) {
+                DBG_PRINTF("Object %" PRIu64 " sent at %" PRIu64 " instead of %" PRIu64, nb_objects_sent, simulated_time, expected_time);
+                ret = -1;
+            }
+            else {
+                ret = quicrq_fragment_publisher_fn(quicrq_media_source_get_data, pub_ctx, buffer, data_length, &copied,
+                    &flags, &is_new_group, &object_length, &is_media_finished, &is_still_active, &should_skip, simulated_time);
+                nb_objects_sent++;
+            }
+        }
+        else if (ret == 0 && nb_objects_sent > 0 && nb_objects_sent < CATCH_UP_TEST_LIVE_EDGE &&
+            simulated_time < nb_objects_sent * CATCH_UP_TEST_INTERVAL) {
+            /* The next object is in cache, but held until its release time */
+            if (!pub_ctx->is_catching_up || pub_ctx->catch_up_timer.heap_index == 0 ||
+                pub_ctx->catch_up_timer.deadline != CATCH_UP_TEST_NB_CACHED * CATCH_UP_TEST_INTERVAL +
+                nb_objects_sent * CATCH_UP_TEST_INTERVAL / 2) {
+                DBG_PRINTF("Object %" PRIu64 " held at %" PRIu64 " without timer", nb_objects_sent, simulated_time);
+                ret = -1;
+            }
+        }
+        simulated_time += 1000;
+    }
+
+    if (ret == 0 && pub_ctx->is_catching_up) {
+        DBG_PRINTF("%s", "Still catching up at the live edge");
+        ret = -1;
+    }
+
+    if (pub_ctx != NULL) {
+        quicrq_fragment_publisher_close(pub_ctx);
+    }
+    if (cache_ctx != NULL) {
+        quicrq_fragment_cache_delete_ctx(cache_ctx);
+    }
+    if (qr_ctx != NULL) {
+        quicrq_delete(qr_ctx);
+    }
+    return ret;
+}
+
+/* Unit test of the cache spill.
+ * Six groups of two objects are published, the last group is still being
+ * received. With a hot limit of 500 bytes, the four oldest groups shall be
+ * moved to spill segments of 500 bytes, two groups per segment, and the data
+ * shall be served back from the segments. Then, evict the spilled groups.
+ */
+#define CACHE_SPILL_TEST_OBJECT_SIZE 100
+#define CACHE_SPILL_TEST_NB_GROUPS 6
+#define CACHE_SPILL_TEST_NB_SPILLED 4
+
+int quicrq_cache_spill_test()
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    char const* url = "cache_spill";
+    uint8_t data[CACHE_SPILL_TEST_OBJECT_SIZE];
+    uint8_t buffer[CACHE_SPILL_TEST_OBJECT_SIZE];
+    quicrq_media_object_properties_t properties = { 0 };
+    quicrq_cache_memory_stats_t stats;
+    quicrq_ctx_t* qr_ctx = quicrq_create(QUICRQ_ALPN, NULL, NULL, NULL, NULL, NULL, NULL, 0, &simulated_time);
+    quicrq_media_object_source_ctx_t* source = (qr_ctx == NULL) ? NULL :
+        quicrq_publish_object_source(qr_ctx, (const uint8_t*)url, strlen(url), NULL);
+    quicrq_fragment_cache_t* cache_ctx = (source == NULL) ? NULL : source->cache_ctx;
+
+    if (cache_ctx == NULL) {
+        ret = -1;
+    }
+
+    for (uint64_t group_id = 0; ret == 0 && group_id < CACHE_SPILL_TEST_NB_GROUPS; group_id++) {
+        for (uint64_t object_id = 0; ret == 0 && object_id < 2; object_id++) {
+            memset(data, (int)(16 * group_id + object_id), sizeof(data));
+            ret = quicrq_publish_object(source, data, sizeof(data), &properties, group_id, object_id);
+        }
+    }
+
+    if (ret == 0) {
+        ret = quicrq_set_cache_spill(qr_ctx, ".", 5 * CACHE_SPILL_TEST_OBJECT_SIZE, 5 * CACHE_SPILL_TEST_OBJECT_SIZE);
+    }
+
+    if (ret == 0) {
+        (void)quicrq_time_check(qr_ctx, 0);
+        quicrq_get_cache_memory_stats(qr_ctx, &stats);
+        if (stats.spilled_groups != CACHE_SPILL_TEST_NB_SPILLED ||
+            stats.spilled_bytes != CACHE_SPILL_TEST_NB_SPILLED * 2 * CACHE_SPILL_TEST_OBJECT_SIZE ||
+            stats.cache_bytes != (CACHE_SPILL_TEST_NB_GROUPS - CACHE_SPILL_TEST_NB_SPILLED) * 2 * CACHE_SPILL_TEST_OBJECT_SIZE ||
+            cache_ctx->spilled_bytes != stats.spilled_bytes || cache_ctx->cache_bytes != stats.cache_bytes) {
+            DBG_PRINTF("Spilled %" PRIu64 " groups, %zu bytes, %zu in memory", stats.spilled_groups, stats.spilled_bytes, stats.cache_bytes);
+            ret = -1;
+        }
+    }
+
+    for (uint64_t group_id = 0; ret == 0 && group_id < CACHE_SPILL_TEST_NB_GROUPS; group_id++) {
+        quicrq_cached_group_t* group = quicrq_fragment_cache_get_group(cache_ctx, group_id);
+
+        if (group == NULL || group->is_spilled != (group_id < CACHE_SPILL_TEST_NB_SPILLED)) {
+            DBG_PRINTF("Group %" PRIu64 " is not in the expected tier", group_id);
+            ret = -1;
+        }
+        for (uint64_t object_id = 0; ret == 0 && object_id < 2; object_id++) {
+            quicrq_cached_fragment_t* fragment = quicrq_fragment_cache_get_fragment(cache_ctx, group_id, object_id, 0);
+            /* Two groups per segment */
+            size_t spill_offset = (size_t)(((group_id % 2) * 2 + object_id) * CACHE_SPILL_TEST_OBJECT_SIZE);
+            size_t copied = quicrq_fragment_object_copy_available_data(cache_ctx, NULL, group_id, object_id, 0, sizeof(buffer), buffer);
+
+            memset(data, (int)(16 * group_id + object_id), sizeof(data));
+            if (fragment == NULL || fragment->is_spilled != group->is_spilled ||
+                (fragment->is_spilled && fragment->spill_offset != spill_offset)) {
+                DBG_PRINTF("Fragment %" PRIu64 "/%" PRIu64 " is not at the expected place", group_id, object_id);
+                ret = -1;
+            }
+            else if (copied != sizeof(buffer) || memcmp(buffer, data, sizeof(data)) != 0) {
+                DBG_PRINTF("Data of object %" PRIu64 "/%" PRIu64 " does not match", group_id, object_id);
+                ret = -1;
+            }
+        }
+    }
+
+    if (ret == 0) {
+        /* Evicting the spilled groups releases their data */
+        for (uint64_t group_id = 1; group_id <= CACHE_SPILL_TEST_NB_SPILLED; group_id++) {
+            (void)quicrq_fragment_cache_evict_group(cache_ctx, group_id);
+        }
+        quicrq_get_cache_memory_stats(qr_ctx, &stats);
+        if (stats.spilled_bytes != 0 || cache_ctx->spilled_bytes != 0 || cache_ctx->first_group_id != CACHE_SPILL_TEST_NB_SPILLED) {
+            DBG_PRINTF("%zu bytes spilled after eviction", stats.spilled_bytes);
+            ret = -1;
+        }
+    }
+
+    if (qr_ctx != NULL) {
+        /* This will also delete the source, and close the spill segments */
+        quicrq_delete(qr_ctx);
+    }
+    return ret;
+}
+
+/* Unit test of the cache spill retry.
+ * The spill directory does not exist, so no segment can be created. The
+ * groups shall stay in memory, and the spill shall not be tried again before
+ * the retry delay, which doubles at the next failure. Once the directory is
+ * fixed, the oldest groups shall be spilled, starting with the first one.
+ */
+int quicrq_cache_spill_retry_test()
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    uint64_t retry_delay = 0;
+    char const* url = "cache_spill_retry";
+    uint8_t data[CACHE_SPILL_TEST_OBJECT_SIZE];
+    quicrq_media_object_properties_t properties = { 0 };
+    quicrq_cache_memory_stats_t stats;
+    quicrq_ctx_t* qr_ctx = quicrq_create(QUICRQ_ALPN, NULL, NULL, NULL, NULL, NULL, NULL, 0, &simulated_time);
+    quicrq_media_object_source_ctx_t* source = (qr_ctx == NULL) ? NULL :
+        quicrq_publish_object_source(qr_ctx, (const uint8_t*)url, strlen(url), NULL);
+    quicrq_fragment_cache_t* cache_ctx = (source == NULL) ? NULL : source->cache_ctx;
+
+    if (cache_ctx == NULL) {
+        ret = -1;
+    }
+
+    for (uint64_t group_id = 0; ret == 0 && group_id < CACHE_SPILL_TEST_NB_GROUPS; group_id++) {
+        for (uint64_t object_id = 0; ret == 0 && object_id < 2; object_id++) {
+            memset(data, (int)(16 * group_id + object_id), sizeof(data));
+            ret = quicrq_publish_object(source, data, sizeof(data), &properties, group_id, object_id);
+        }
+    }
+
+    if (ret == 0) {
+        ret = quicrq_set_cache_spill(qr_ctx, "./no_such_spill_directory", 5 * CACHE_SPILL_TEST_OBJECT_SIZE, 5 * CACHE_SPILL_TEST_OBJECT_SIZE);
+    }
+
+    if (ret == 0) {
+        (void)quicrq_time_check(qr_ctx, simulated_time);
+        quicrq_get_cache_memory_stats(qr_ctx, &stats);
+        retry_delay = qr_ctx->spill_retry_delay;
+        if (stats.spilled_groups != 0 || cache_ctx->next_spill_group_id != 0 ||
+            retry_delay == 0 || qr_ctx->spill_retry_time != simulated_time + retry_delay) {
+            DBG_PRINTF("Spilled %" PRIu64 " groups, next %" PRIu64 ", retry delay %" PRIu64,
+                stats.spilled_groups, cache_ctx->next_spill_group_id, retry_delay);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        /* No new attempt before the retry time */
+        simulated_time += retry_delay - 1;
+        (void)quicrq_time_check(qr_ctx, simulated_time);
+        if (qr_ctx->spill_retry_delay != retry_delay) {
+            DBG_PRINTF("Spill tried again after %" PRIu64 "us", simulated_time);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        /* The next failure doubles the delay */
+        simulated_time += 1;
+        (void)quicrq_time_check(qr_ctx, simulated_time);
+        if (qr_ctx->spill_retry_delay != 2 * retry_delay ||
+            qr_ctx->spill_retry_time != simulated_time + 2 * retry_delay) {
+            DBG_PRINTF("Retry delay %" PRIu64 " after second failure", qr_ctx->spill_retry_delay);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        ret = quicrq_set_cache_spill(qr_ctx, ".", 5 * CACHE_SPILL_TEST_OBJECT_SIZE, 5 * CACHE_SPILL_TEST_OBJECT_SIZE);
+    }
+
+    if (ret == 0) {
+        (void)quicrq_time_check(qr_ctx, simulated_time);
+        quicrq_get_cache_memory_stats(qr_ctx, &stats);
+        if (stats.spilled_groups != CACHE_SPILL_TEST_NB_SPILLED || qr_ctx->spill_retry_delay != 0) {
+            DBG_PRINTF("Spilled %" PRIu64 " groups after fixing the directory", stats.spilled_groups);
+            ret = -1;
+        }
+    }
+
+    for (uint64_t group_id = 0; ret == 0 && group_id < CACHE_SPILL_TEST_NB_GROUPS; group_id++) {
+        quicrq_cached_group_t* group = quicrq_fragment_cache_get_group(cache_ctx, group_id);
+
+        if (group == NULL || group->is_spilled != (group_id < CACHE_SPILL_TEST_NB_SPILLED)) {
+            DBG_PRINTF("Group %" PRIu64 " is not in the expected tier", group_id);
+            ret = -1;
+        }
+    }
+
+    if (qr_ctx != NULL) {
+        quicrq_delete(qr_ctx);
+    }
+    return ret;
+}
+
+/* Unit test of the fragment size.
+ * An object source cuts the objects that it publishes at the fragment size.
+ * A datagram sender forwards the cached fragments that are aligned on the
+ * fragment size unchanged, and cuts the others at the fragment boundaries,
+ * using the smaller of its own size and the size asked by the receiver.
+ */
+#define FRAGMENT_SIZE_TEST_SIZE 100
+#define FRAGMENT_SIZE_TEST_OBJECT_SIZE 350
+#define FRAGMENT_SIZE_TEST_NB_SENT 6
+
+static int quicrq_fragment_size_test_source(quicrq_ctx_t* qr_ctx)
+{
+    int ret = 0;
+    char const* url = "/fragment_size/";
+    uint8_t data[FRAGMENT_SIZE_TEST_OBJECT_SIZE];
+    quicrq_media_object_properties_t properties = { 0 };
+    quicrq_media_object_source_ctx_t* object_source_ctx =
+        quicrq_publish_object_source(qr_ctx, (const uint8_t*)url, strlen(url), NULL);
+
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = (uint8_t)i;
+    }
+    if (object_source_ctx == NULL || object_source_ctx->properties.fragment_size != FRAGMENT_SIZE_TEST_SIZE) {
+        ret = -1;
+    }
+    else if ((ret = quicrq_publish_object(object_source_ctx, data, sizeof(data), &properties, 0, 0)) == 0) {
+        quicrq_cached_fragment_t* fragment = object_source_ctx->cache_ctx->first_fragment;
+        size_t offset = 0;
+
+        while (ret == 0 && fragment != NULL) {
+            size_t expected = (sizeof(data) - offset > FRAGMENT_SIZE_TEST_SIZE) ? FRAGMENT_SIZE_TEST_SIZE : sizeof(data) - offset;
+            if (fragment->offset != offset || fragment->data_length != expected ||
+                fragment->object_length != sizeof(data) || memcmp(fragment->data, data + offset, expected) != 0 ||
+                fragment->buffer != object_source_ctx->cache_ctx->first_fragment->buffer) {
+                DBG_PRINTF("Unexpected fragment at offset %zu", offset);
+                ret = -1;
+            }
+            offset += fragment->data_length;
+            fragment = fragment->next_in_order;
+        }
+        if (ret == 0 && offset != sizeof(data)) {
+            DBG_PRINTF("Cached %zu bytes instead of %zu", offset, sizeof(data));
+            ret = -1;
+        }
+    }
+    return ret;
+}
+
+int quicrq_fragment_size_test()
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    struct sockaddr_storage addr = { 0 };
+    /* object, offset and length of the datagrams sent, in order */
+    const size_t sent[FRAGMENT_SIZE_TEST_NB_SENT][3] = {
+        { 0, 0, 100 }, { 0, 100, 100 }, { 0, 200, 100 }, { 0, 300, 50 }, { 1, 0, 100 }, { 1, 100, 100 } };
+    uint8_t data[FRAGMENT_SIZE_TEST_OBJECT_SIZE];
+    quicrq_ctx_t* qr_ctx = quicrq_create(QUICRQ_ALPN, NULL, NULL, NULL, NULL, NULL, NULL, 0, &simulated_time);
+    quicrq_cnx_ctx_t* cnx_ctx = (qr_ctx == NULL) ? NULL : quicrq_create_client_cnx(qr_ctx, NULL, (struct sockaddr*)&addr);
+    quicrq_stream_ctx_t* stream_ctx = (cnx_ctx == NULL) ? NULL : quicrq_create_stream_context(cnx_ctx, 0);
+    quicrq_media_source_ctx_t srce_ctx = { 0 };
+    quicrq_fragment_cache_t* cache_ctx = quicrq_fragment_cache_create_ctx(NULL);
+    quicrq_fragment_publisher_context_t* pub_ctx = NULL;
+
+    memset(data, 0x5a, sizeof(data));
+    if (stream_ctx == NULL || cache_ctx == NULL) {
+        ret = -1;
+    }
+    else {
+        quicrq_set_fragment_size(qr_ctx, FRAGMENT_SIZE_TEST_SIZE);
+        ret = quicrq_fragment_size_test_source(qr_ctx);
+    }
+
+    if (ret == 0) {
+        /* Object 0 is cached in one piece, object 1 is aligned on the fragment size */
+        cache_ctx->srce_ctx = &srce_ctx;
+        if ((ret = quicrq_fragment_propose_to_cache(cache_ctx, data, 0, 0, 0, 0, 0, 0,
+            FRAGMENT_SIZE_TEST_OBJECT_SIZE, FRAGMENT_SIZE_TEST_OBJECT_SIZE, simulated_time)) == 0 &&
+            (ret = quicrq_fragment_propose_to_cache(cache_ctx, data, 0, 1, 0, 0, 0, 0,
+                2 * FRAGMENT_SIZE_TEST_SIZE, FRAGMENT_SIZE_TEST_SIZE, simulated_time)) == 0) {
+            ret = quicrq_fragment_propose_to_cache(cache_ctx, data, 0, 1, FRAGMENT_SIZE_TEST_SIZE, 0, 0, 0,
+                2 * FRAGMENT_SIZE_TEST_SIZE, FRAGMENT_SIZE_TEST_SIZE, simulated_time);
+        }
+    }
+    if (ret == 0) {
+        /* The receiver asks for a larger size, the sender uses its own */
+        stream_ctx->transport_mode = quicrq_transport_mode_datagram;
+        stream_ctx->is_sender = 1;
+        stream_ctx->fragment_size = FRAGMENT_SIZE_TEST_SIZE + 20;
+        if ((pub_ctx = (quicrq_fragment_publisher_context_t*)quicrq_fragment_publisher_subscribe(cache_ctx, stream_ctx)) == NULL) {
+            ret = -1;
+        }
+    }
+
+    for (size_t i = 0; ret == 0 && i < FRAGMENT_SIZE_TEST_NB_SENT; i++) {
+        uint8_t packet[1024];
+        int media_was_sent = 0;
+        int at_least_one_active = 0;
+        int not_ready = 0;
+        fragment_test_datagram_buffer_argument_t d_context = { 0 };
+        quicrq_datagram_ack_state_t* das = NULL;
+
+        packet[0] = 0x30;
+        d_context.bytes0 = &packet[0];
+        d_context.bytes = &packet[1];
+        d_context.after_data = &packet[0];
+        d_context.bytes_max = &packet[0] + sizeof(packet);
+        d_context.allowed_space = sizeof(packet) - 1;
+        ret = quicrq_fragment_datagram_publisher_prepare(stream_ctx, pub_ctx, 0, &d_context, d_context.allowed_space, NULL,
+            &media_was_sent, &at_least_one_active, &not_ready, simulated_time);
+        if (ret == 0 && (!media_was_sent ||
+            (das = quicrq_datagram_ack_find(stream_ctx, 0, sent[i][0], sent[i][1])) == NULL || das->length != sent[i][2])) {
+            DBG_PRINTF("Datagram %zu, fragment %zu/%zu not sent", i, sent[i][0], sent[i][1]);
+            ret = -1;
+        }
+        else if (ret == 0 && sent[i][0] == 1 && das->data != pub_ctx->current_fragment->data) {
+            /* Aligned fragments are sent from the cached data, unchanged */
+            DBG_PRINTF("Datagram %zu, aligned fragment not forwarded as cached", i);
+            ret = -1;
+        }
+    }
+
+    if (pub_ctx != NULL) {
+        quicrq_fragment_publisher_close(pub_ctx);
+    }
+    if (cache_ctx != NULL) {
+        quicrq_fragment_cache_delete_ctx(cache_ctx);
+    }
+    if (qr_ctx != NULL) {
+        quicrq_delete(qr_ctx);
+    }
+    return ret;
+}
+
+/* Unit test of the arrival cursor.
+ * Cache a series of objects, one of them with flags above the maximum asked by
+ * the subscriber feedback, and serve them to two subscribers of the same
+ * cache: one using the arrival cursor, and one created with the option off,
+ * which keeps its publisher object tree. Verify that both send the same
+ * datagrams, that the subscriber on the arrival cursor keeps no object state
+ * while it sends every object, that it falls back to its own object states
+ * when the object is dropped, and that it joins the arrival cursor again once
+ * it has sent the last cached object. Then interleave the two halves of an
+ * object with a dropped object, and verify that the subscriber that detaches
+ * carries over the bytes of the first half, read from the shared state of the
+ * cache, so that the object is complete after the second half.
+ */
+#define ARRIVAL_CURSOR_TEST_NB_OBJECTS 6
+#define ARRIVAL_CURSOR_TEST_DROPPED 2
+#define ARRIVAL_CURSOR_TEST_OBJECT_SIZE 100
+
+static int quicrq_arrival_cursor_test_send(quicrq_stream_ctx_t* stream_ctx, quicrq_fragment_publisher_context_t* pub_ctx,
+    uint64_t object_id, size_t expected_length, uint64_t current_time, size_t* datagram_length)
+{
+    int ret = 0;
+    uint8_t packet[1024];
+    int media_was_sent = 0;
+    int at_least_one_active = 0;
+    int not_ready = 0;
+    fragment_test_datagram_buffer_argument_t d_context = { 0 };
+    quicrq_datagram_ack_state_t* das = NULL;
+
+    packet[0] = 0x30;
+    d_context.bytes0 = &packet[0];
+    d_context.bytes = &packet[1];
+    d_context.after_data = &packet[0];
+    d_context.bytes_max = &packet[0] + sizeof(packet);
+    d_context.allowed_space = sizeof(packet) - 1;
+    ret = quicrq_fragment_datagram_publisher_prepare(stream_ctx, pub_ctx, 0, &d_context, d_context.allowed_space, NULL,
+        &media_was_sent, &at_least_one_active, &not_ready, current_time);
+    if (ret == 0 && (!media_was_sent ||
+        (das = quicrq_datagram_ack_find(stream_ctx, 0, object_id, 0)) == NULL || das->length != expected_length)) {
+        DBG_PRINTF("Object %" PRIu64 " not sent as expected", object_id);
+        ret = -1;
+    }
+    *datagram_length = (size_t)(d_context.after_data - d_context.bytes0);
+    return ret;
+}
+
+static int quicrq_arrival_cursor_test_check(quicrq_fragment_cache_t* cache_ctx, quicrq_fragment_publisher_context_t* pub_ctx,
+    int is_cursor_expected, uint64_t nb_exits_expected)
+{
+    int ret = 0;
+
+    if (pub_ctx->is_arrival_cursor != is_cursor_expected ||
+        cache_ctx->nb_arrival_cursors != (uint64_t)is_cursor_expected ||
+        cache_ctx->nb_arrival_cursor_exits != nb_exits_expected ||
+        (is_cursor_expected && picosplay_first(&pub_ctx->publisher_object_tree) != NULL)) {
+        DBG_PRINTF("Arrival cursor: %d, count %" PRIu64 ", exits %" PRIu64 ", expected %d, %" PRIu64,
+            pub_ctx->is_arrival_cursor, cache_ctx->nb_arrival_cursors, cache_ctx->nb_arrival_cursor_exits,
+            is_cursor_expected, nb_exits_expected);
+        ret = -1;
+    }
+    return ret;
+}
+
+/* Send the next object from both subscribers, and compare the datagrams */
+static int quicrq_arrival_cursor_test_send_both(quicrq_stream_ctx_t** stream_ctx, quicrq_fragment_publisher_context_t** pub_ctx,
+    uint64_t object_id, size_t expected_length, uint64_t current_time)
+{
+    int ret = 0;
+    size_t datagram_length[2] = { 0, 0 };
+
+    for (int i = 0; ret == 0 && i < 2; i++) {
+        ret = quicrq_arrival_cursor_test_send(stream_ctx[i], pub_ctx[i], object_id, expected_length, current_time,
+            &datagram_length[i]);
+    }
+    if (ret == 0 && datagram_length[0] != datagram_length[1]) {
+        DBG_PRINTF("Object %" PRIu64 ", datagram length %zu with the arrival cursor, %zu without",
+            object_id, datagram_length[0], datagram_length[1]);
+        ret = -1;
+    }
+    if (ret == 0 && picosplay_first(&pub_ctx[1]->publisher_object_tree) == NULL) {
+        DBG_PRINTF("Object %" PRIu64 ", no object state without the arrival cursor", object_id);
+        ret = -1;
+    }
+    return ret;
+}
+
+int quicrq_arrival_cursor_test()
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    struct sockaddr_storage addr = { 0 };
+    uint8_t data[ARRIVAL_CURSOR_TEST_OBJECT_SIZE];
+    quicrq_ctx_t* qr_ctx = quicrq_create(QUICRQ_ALPN, NULL, NULL, NULL, NULL, NULL, NULL, 0, &simulated_time);
+    quicrq_cnx_ctx_t* cnx_ctx = (qr_ctx == NULL) ? NULL : quicrq_create_client_cnx(qr_ctx, NULL, (struct sockaddr*)&addr);
+    quicrq_stream_ctx_t* stream_ctx[2] = { NULL, NULL };
+    quicrq_media_source_ctx_t srce_ctx = { 0 };
+    quicrq_fragment_cache_t* cache_ctx = quicrq_fragment_cache_create_ctx(NULL);
+    quicrq_fragment_publisher_context_t* pub_ctx[2] = { NULL, NULL };
+
+    memset(data, 0x5a, sizeof(data));
+    if (cnx_ctx == NULL || cache_ctx == NULL ||
+        (stream_ctx[0] = quicrq_create_stream_context(cnx_ctx, 0)) == NULL ||
+        (stream_ctx[1] = quicrq_create_stream_context(cnx_ctx, 4)) == NULL) {
+        ret = -1;
+    }
+    else {
+        cache_ctx->srce_ctx = &srce_ctx;
+        for (uint64_t i = 0; ret == 0 && i < ARRIVAL_CURSOR_TEST_NB_OBJECTS; i++) {
+            ret = quicrq_fragment_propose_to_cache(cache_ctx, data, 0, i, 0, 0,
+                (i == ARRIVAL_CURSOR_TEST_DROPPED) ? 0x82 : 0x80, 0, sizeof(data), sizeof(data), simulated_time);
+        }
+    }
+    for (int i = 0; ret == 0 && i < 2; i++) {
+        /* The first subscriber uses the arrival cursor, the second its object tree */
+        quicrq_set_arrival_cursor(qr_ctx, i == 0);
+        stream_ctx[i]->transport_mode = quicrq_transport_mode_datagram;
+        stream_ctx[i]->is_sender = 1;
+        quicrq_feedback_set(stream_ctx[i], 0x81, 0, simulated_time);
+        if ((pub_ctx[i] = (quicrq_fragment_publisher_context_t*)quicrq_fragment_publisher_subscribe(cache_ctx, stream_ctx[i])) == NULL) {
+            ret = -1;
+        }
+    }
+    if (ret == 0) {
+        ret = quicrq_arrival_cursor_test_check(cache_ctx, pub_ctx[0], 1, 0);
+    }
+
+    for (uint64_t i = 0; ret == 0 && i < ARRIVAL_CURSOR_TEST_NB_OBJECTS; i++) {
+        int is_dropped = (i == ARRIVAL_CURSOR_TEST_DROPPED);
+        if ((ret = quicrq_arrival_cursor_test_send_both(stream_ctx, pub_ctx, i, (is_dropped) ? 0 : sizeof(data), simulated_time)) == 0) {
+            /* Private states from the dropped object until the last cached object is sent */
+            ret = quicrq_arrival_cursor_test_check(cache_ctx, pub_ctx[0],
+                i < ARRIVAL_CURSOR_TEST_DROPPED || i == ARRIVAL_CURSOR_TEST_NB_OBJECTS - 1, (i < ARRIVAL_CURSOR_TEST_DROPPED) ? 0 : 1);
+        }
+    }
+
+    if (ret == 0) {
+        /* A new object is sent from the arrival cursor */
+        if ((ret = quicrq_fragment_propose_to_cache(cache_ctx, data, 0, ARRIVAL_CURSOR_TEST_NB_OBJECTS, 0, 0, 0x80, 0,
+            sizeof(data), sizeof(data), simulated_time)) == 0 &&
+            (ret = quicrq_arrival_cursor_test_send_both(stream_ctx, pub_ctx, ARRIVAL_CURSOR_TEST_NB_OBJECTS, sizeof(data), simulated_time)) == 0) {
+            ret = quicrq_arrival_cursor_test_check(cache_ctx, pub_ctx[0], 1, 1);
+        }
+    }
+
+    if (ret == 0) {
+        /* First half of an object, then a dropped object */
+        uint64_t split_id = ARRIVAL_CURSOR_TEST_NB_OBJECTS + 1;
+        size_t half = sizeof(data) / 2;
+        quicrq_fragment_publisher_object_state_t* first_object = NULL;
+
+        if ((ret = quicrq_fragment_propose_to_cache(cache_ctx, data, 0, split_id, 0, 0, 0x80, 0,
+            sizeof(data), half, simulated_time)) == 0 &&
+            (ret = quicrq_arrival_cursor_test_send_both(stream_ctx, pub_ctx, split_id, half, simulated_time)) == 0 &&
+            (ret = quicrq_arrival_cursor_test_check(cache_ctx, pub_ctx[0], 1, 1)) == 0 &&
+            (ret = quicrq_fragment_propose_to_cache(cache_ctx, data, 0, split_id + 1, 0, 0, 0x82, 0,
+                sizeof(data), sizeof(data), simulated_time)) == 0 &&
+            (ret = quicrq_arrival_cursor_test_send_both(stream_ctx, pub_ctx, split_id + 1, 0, simulated_time)) == 0 &&
+            (ret = quicrq_arrival_cursor_test_check(cache_ctx, pub_ctx[0], 0, 2)) == 0 &&
+            (ret = quicrq_fragment_propose_to_cache(cache_ctx, data + half, 0, split_id, half, 0, 0x80, 0,
+                sizeof(data), sizeof(data) - half, simulated_time)) == 0 &&
+            (ret = quicrq_arrival_cursor_test_send_both(stream_ctx, pub_ctx, split_id, half, simulated_time)) == 0) {
+            /* The split object is complete, only the dropped one is left */
+            first_object = (quicrq_fragment_publisher_object_state_t*)
+                quicrq_fragment_cache_node_value(picosplay_first(&pub_ctx[0]->publisher_object_tree));
+            if (first_object == NULL || first_object->object_id != split_id + 1) {
+                DBG_PRINTF("First object %" PRIu64 ", expected %" PRIu64,
+                    (first_object == NULL) ? UINT64_MAX : first_object->object_id, split_id + 1);
+                ret = -1;
+            }
+        }
+        /* The next object is sent from the arrival cursor again */
+        if (ret == 0 && (ret = quicrq_fragment_propose_to_cache(cache_ctx, data, 0, split_id + 2, 0, 0, 0x80, 0,
+            sizeof(data), sizeof(data), simulated_time)) == 0 &&
+            (ret = quicrq_arrival_cursor_test_send_both(stream_ctx, pub_ctx, split_id + 2, sizeof(data), simulated_time)) == 0) {
+            ret = quicrq_arrival_cursor_test_check(cache_ctx, pub_ctx[0], 1, 2);
+        }
+    }
+
+    for (int i = 0; i < 2; i++) {
+        if (pub_ctx[i] != NULL) {
+            quicrq_fragment_publisher_close(pub_ctx[i]);
+        }
+    }
+    if (ret == 0 && cache_ctx->nb_arrival_cursors != 0) {
+        DBG_PRINTF("%s", "Arrival cursor count not decremented on close");
+        ret = -1;
+    }
+    if (cache_ctx != NULL) {
+        quicrq_fragment_cache_delete_ctx(cache_ctx);
+    }
+    if (qr_ctx != NULL) {
+        quicrq_delete(qr_ctx);
+    }
+    return ret;
+}
@@ -0,0 +1,265 @@
+#include <string.h>
+#include <stdlib.h>
+#include "quicrq.h"
+#include "quicrq_internal.h"
+#include "quicrq_fragment.h"
+#include "quicrq_reassembly.h"
+#include "quicrq_test_internal.h"
+
+/* Unit tests of the memory pools.
+ * Fill a fragment cache and a reassembly context attached to a quicrq context,
+ * then verify that the items are accounted, reused after being freed, and
+ * released when the free lists exceed the max free limit.
+ */
+#define POOL_TEST_NB_FRAGMENTS 100
+#define POOL_TEST_FRAGMENT_SIZE 1000
+#define POOL_TEST_OVERSIZE 4096
+#define POOL_TEST_MAX_FREE 10
+
+static size_t pool_test_data_in_use(quicrq_ctx_t* qr_ctx)
+{
+    size_t nb_in_use = 0;
+    quicrq_pool_stats_t stats;
+
+    for (size_t i = quicrq_pool_data_128; i < quicrq_pool_max; i++) {
+        if (quicrq_get_pool_stats(qr_ctx, i, &stats) == 0) {
+            nb_in_use += stats.nb_in_use;
+        }
+    }
+    return nb_in_use;
+}
+
+static int pool_test_fill(quicrq_fragment_cache_t* cache_ctx, uint64_t group_id, const uint8_t* data)
+{
+    int ret = 0;
+
+    for (uint64_t i = 0; ret == 0 && i < POOL_TEST_NB_FRAGMENTS; i++) {
+        ret = quicrq_fragment_propose_to_cache(cache_ctx, data, group_id, i, 0, 0, 0, 0,
+            POOL_TEST_FRAGMENT_SIZE, POOL_TEST_FRAGMENT_SIZE, 0);
+    }
+    return ret;
+}
+
+static int pool_test_ready_fn(void* media_ctx, uint64_t current_time, uint64_t group_id, uint64_t object_id,
+    uint8_t flags, const uint8_t* data, size_t data_length, quicrq_reassembly_object_mode_enum object_mode)
+{
+    int* nb_ready = (int*)media_ctx;
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(current_time);
+    UNREFERENCED_PARAMETER(group_id);
+    UNREFERENCED_PARAMETER(object_id);
+    UNREFERENCED_PARAMETER(flags);
+    UNREFERENCED_PARAMETER(data);
+    UNREFERENCED_PARAMETER(object_mode);
+#endif
+    if (data_length == 2 * POOL_TEST_FRAGMENT_SIZE) {
+        *nb_ready += 1;
+    }
+    return 0;
+}
+
+int quicrq_pool_test()
+{
+    int ret = 0;
+    uint8_t data[POOL_TEST_OVERSIZE];
+    quicrq_media_source_ctx_t srce_ctx = { 0 };
+    quicrq_fragment_cache_t* cache_ctx = NULL;
+    quicrq_pool_stats_t stats;
+    quicrq_ctx_t* qr_ctx = quicrq_create_empty();
+
+    memset(data, 0x5a, sizeof(data));
+
+    if (qr_ctx == NULL || (cache_ctx = quicrq_fragment_cache_create_ctx(qr_ctx)) == NULL) {
+        ret = -1;
+    }
+    else {
+        cache_ctx->srce_ctx = &srce_ctx;
+        ret = pool_test_fill(cache_ctx, 0, data);
+    }
+
+    if (ret == 0) {
+        if (quicrq_get_pool_stats(qr_ctx, quicrq_pool_cached_fragment, &stats) != 0 ||
+            stats.nb_in_use != POOL_TEST_NB_FRAGMENTS || stats.item_size != sizeof(quicrq_cached_fragment_t) ||
+            pool_test_data_in_use(qr_ctx) != POOL_TEST_NB_FRAGMENTS) {
+            DBG_PRINTF("%s", "Fragments not accounted in pools");
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        /* After clearing the cache, the items are kept for reuse */
+        quicrq_fragment_cache_media_clear(cache_ctx);
+        if (quicrq_get_pool_stats(qr_ctx, quicrq_pool_cached_fragment, &stats) != 0 ||
+            stats.nb_in_use != 0 || stats.nb_free != POOL_TEST_NB_FRAGMENTS ||
+            stats.max_in_use != POOL_TEST_NB_FRAGMENTS || pool_test_data_in_use(qr_ctx) != 0) {
+            DBG_PRINTF("%s", "Fragments not returned to pools");
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        /* Lowering the limit returns the extra items to the system */
+        quicrq_set_pool_max_free(qr_ctx, POOL_TEST_MAX_FREE);
+        if (quicrq_get_pool_stats(qr_ctx, quicrq_pool_cached_fragment, &stats) != 0 ||
+            stats.nb_free != POOL_TEST_MAX_FREE || stats.nb_released != POOL_TEST_NB_FRAGMENTS - POOL_TEST_MAX_FREE) {
+            DBG_PRINTF("%s", "Free list not trimmed");
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        ret = pool_test_fill(cache_ctx, 1, data);
+        if (ret == 0 && (quicrq_get_pool_stats(qr_ctx, quicrq_pool_cached_fragment, &stats) != 0 ||
+            stats.nb_reused != POOL_TEST_MAX_FREE || stats.nb_alloc != 2 * POOL_TEST_NB_FRAGMENTS)) {
+            DBG_PRINTF("%s", "Free items not reused");
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        /* Large data is allocated directly */
+        ret = quicrq_fragment_propose_to_cache(cache_ctx, data, 2, 0, 0, 0, 0, 0, sizeof(data), sizeof(data), 0);
+        if (ret == 0 && (quicrq_get_pool_stats(qr_ctx, quicrq_pool_data_oversize, &stats) != 0 ||
+            stats.item_size != 0 || stats.nb_in_use != 1)) {
+            DBG_PRINTF("%s", "Oversize data not accounted");
+            ret = -1;
+        }
+    }
+
+    if (ret == 0 && quicrq_get_pool_stats(qr_ctx, quicrq_get_nb_pools(), &stats) == 0) {
+        DBG_PRINTF("%s", "Stats returned for invalid pool index");
+        ret = -1;
+    }
+
+    if (cache_ctx != NULL) {
+        quicrq_fragment_cache_delete_ctx(cache_ctx);
+    }
+
+    if (ret == 0) {
+        /* Reassembly of an object received in two packets, plus an incomplete object left at the end */
+        quicrq_reassembly_context_t reassembly_ctx = { 0 };
+        int nb_ready = 0;
+
+        quicrq_reassembly_init(&reassembly_ctx);
+        reassembly_ctx.qr_ctx = qr_ctx;
+        ret = quicrq_reassembly_input(&reassembly_ctx, 0, data, 0, 0, POOL_TEST_FRAGMENT_SIZE, 0, 0, 0,
+            2 * POOL_TEST_FRAGMENT_SIZE, POOL_TEST_FRAGMENT_SIZE, pool_test_ready_fn, &nb_ready);
+        if (ret == 0) {
+            ret = quicrq_reassembly_input(&reassembly_ctx, 0, data, 0, 0, 0, 0, 0, 0,
+                2 * POOL_TEST_FRAGMENT_SIZE, POOL_TEST_FRAGMENT_SIZE, pool_test_ready_fn, &nb_ready);
+        }
+        if (ret == 0) {
+            ret = quicrq_reassembly_input(&reassembly_ctx, 0, data, 0, 2, 0, 0, 0, 0,
+                2 * POOL_TEST_FRAGMENT_SIZE, POOL_TEST_FRAGMENT_SIZE, pool_test_ready_fn, &nb_ready);
+        }
+        if (ret == 0 && (nb_ready != 1 || pool_test_data_in_use(qr_ctx) == 0)) {
+            DBG_PRINTF("Reassembly, %d objects ready, %zu data items in use", nb_ready, pool_test_data_in_use(qr_ctx));
+            ret = -1;
+        }
+        reassembly_ctx.is_finished = 1;
+        quicrq_reassembly_release(&reassembly_ctx);
+        if (ret == 0 && pool_test_data_in_use(qr_ctx) != 0) {
+            DBG_PRINTF("%s", "Reassembly data not freed");
+            ret = -1;
+        }
+    }
+
+    if (qr_ctx != NULL) {
+        quicrq_delete(qr_ctx);
+    }
+
+    return ret;
+}
+
+/* Unit test of the uni stream contexts in warp mode.
+ * The cache holds several groups; waking up the media creates one uni stream
+ * per group, from the pool. With the "group based + priorities" congestion
+ * control, the newest group has the priority class of its flags, and the older
+ * ones are moved down one class per group of age, up to 3 classes. After the
+ * streams are deleted, the contexts created for the next groups are reused.
+ */
+#define UNI_STREAM_TEST_NB_GROUPS 5
+#define UNI_STREAM_TEST_FLAGS 0x10
+
+int quicrq_uni_stream_pool_test()
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    struct sockaddr_storage addr = { 0 };
+    uint8_t data[POOL_TEST_FRAGMENT_SIZE];
+    quicrq_pool_stats_t stats;
+    quicrq_media_source_ctx_t srce_ctx = { 0 };
+    quicrq_ctx_t* qr_ctx = quicrq_create(QUICRQ_ALPN, NULL, NULL, NULL, NULL, NULL, NULL, 0, &simulated_time);
+    quicrq_cnx_ctx_t* cnx_ctx = (qr_ctx == NULL) ? NULL : quicrq_create_client_cnx(qr_ctx, NULL, (struct sockaddr*)&addr);
+    quicrq_stream_ctx_t* stream_ctx = (cnx_ctx == NULL) ? NULL : quicrq_create_stream_context(cnx_ctx, 0);
+    quicrq_fragment_cache_t* cache_ctx = quicrq_fragment_cache_create_ctx(NULL);
+
+    memset(data, 0x5a, sizeof(data));
+
+    if (stream_ctx == NULL || cache_ctx == NULL) {
+        ret = -1;
+    }
+    else {
+        quicrq_enable_congestion_control(qr_ctx, quicrq_congestion_control_group_p);
+        cache_ctx->srce_ctx = &srce_ctx;
+        stream_ctx->transport_mode = quicrq_transport_mode_warp;
+        stream_ctx->is_sender = 1;
+    }
+    for (uint64_t group_id = 0; ret == 0 && group_id < UNI_STREAM_TEST_NB_GROUPS; group_id++) {
+        ret = quicrq_fragment_propose_to_cache(cache_ctx, data, group_id, 0, 0, 0, UNI_STREAM_TEST_FLAGS,
+            (group_id > 0) ? 1 : 0, sizeof(data), sizeof(data), 0);
+    }
+    if (ret == 0 && (stream_ctx->media_ctx = quicrq_fragment_publisher_subscribe(cache_ctx, stream_ctx)) == NULL) {
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        const uint8_t expected[UNI_STREAM_TEST_NB_GROUPS] = { 0x26, 0x26, 0x24, 0x22, 0x20 };
+        size_t nb_uni_streams = 0;
+
+        quicrq_wakeup_media_uni_stream(stream_ctx);
+        for (quicrq_uni_stream_ctx_t* uni_stream_ctx = stream_ctx->first_uni_stream; ret == 0 && uni_stream_ctx != NULL;
+            uni_stream_ctx = uni_stream_ctx->next_uni_stream_for_control_stream) {
+            if (uni_stream_ctx->current_group_id >= UNI_STREAM_TEST_NB_GROUPS ||
+                uni_stream_ctx->stream_priority != expected[uni_stream_ctx->current_group_id]) {
+                DBG_PRINTF("Group %" PRIu64 ", priority 0x%x", uni_stream_ctx->current_group_id, uni_stream_ctx->stream_priority);
+                ret = -1;
+            }
+            nb_uni_streams++;
+        }
+        if (ret == 0 && (nb_uni_streams != UNI_STREAM_TEST_NB_GROUPS ||
+            quicrq_get_pool_stats(qr_ctx, quicrq_pool_uni_stream, &stats) != 0 ||
+            stats.nb_in_use != UNI_STREAM_TEST_NB_GROUPS || stats.item_size != sizeof(quicrq_uni_stream_ctx_t))) {
+            DBG_PRINTF("%zu uni streams created", nb_uni_streams);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        while (stream_ctx->first_uni_stream != NULL) {
+            quicrq_delete_uni_stream_ctx(cnx_ctx, stream_ctx->first_uni_stream);
+        }
+        ret = quicrq_fragment_propose_to_cache(cache_ctx, data, UNI_STREAM_TEST_NB_GROUPS, 0, 0, 0, UNI_STREAM_TEST_FLAGS,
+            1, sizeof(data), sizeof(data), 0);
+        if (ret == 0) {
+            quicrq_wakeup_media_uni_stream(stream_ctx);
+            if (stream_ctx->first_uni_stream == NULL ||
+                stream_ctx->first_uni_stream->current_group_id != UNI_STREAM_TEST_NB_GROUPS ||
+                stream_ctx->first_uni_stream->stream_priority != 0x20 ||
+                quicrq_get_pool_stats(qr_ctx, quicrq_pool_uni_stream, &stats) != 0 ||
+                stats.nb_in_use != 1 || stats.nb_reused != 1 || stats.nb_free != UNI_STREAM_TEST_NB_GROUPS - 1) {
+                DBG_PRINTF("%s", "Uni stream context not reused");
+                ret = -1;
+            }
+        }
+    }
+
+    if (qr_ctx != NULL) {
+        /* This will also delete the streams and close the publisher */
+        quicrq_delete(qr_ctx);
+    }
+    if (cache_ctx != NULL) {
+        quicrq_fragment_cache_delete_ctx(cache_ctx);
+    }
+    return ret;
+}
@@ -129,6 +129,105 @@ static uint8_t datagram_rq_start_point_bytes[] = {
     0x09,
 };
 
+static quicrq_message_t datagram_rq_complete_group = {
+    QUICRQ_ACTION_REQUEST,
+    sizeof(url1),
+    url1,
+    1234,
+    0,
+    0,
+    0,
+    0,
+    0,
+    0,
+    0,
+    NULL,
+    quicrq_transport_mode_datagram,
+    0,
+    quicrq_subscribe_intent_latest_complete_group
+};
+
+static uint8_t datagram_rq_complete_group_bytes[] = {
+    QUICRQ_ACTION_REQUEST,
+    sizeof(url1),
+    URL1_BYTES,
+    0x44, 0xd2,
+    quicrq_transport_mode_datagram,
+    0x03
+};
+
+static quicrq_message_t datagram_rq_fragment_size = {
+    QUICRQ_ACTION_REQUEST,
+    sizeof(url1),
+    url1,
+    1234,
+    0,
+    0,
+    0,
+    0,
+    0,
+    0,
+    0,
+    NULL,
+    quicrq_transport_mode_datagram,
+    0,
+    quicrq_subscribe_intent_current_group,
+    quicrq_datagram_header_full,
+    0,
+    NULL,
+    0,
+    0,
+    1200
+};
+
+static uint8_t datagram_rq_fragment_size_bytes[] = {
+    QUICRQ_ACTION_REQUEST,
+    sizeof(url1),
+    URL1_BYTES,
+    0x44, 0xd2,
+    quicrq_transport_mode_datagram,
+    0x00,
+    quicrq_datagram_header_full,
+    0x44, 0xb0
+};
+
+static quicrq_message_t datagram_rq_fec = {
+    QUICRQ_ACTION_REQUEST,
+    sizeof(url1),
+    url1,
+    1234,
+    0,
+    0,
+    0,
+    0,
+    0,
+    0,
+    0,
+    NULL,
+    quicrq_transport_mode_datagram,
+    0,
+    quicrq_subscribe_intent_current_group,
+    quicrq_datagram_header_full,
+    0,
+    NULL,
+    0,
+    0,
+    0,
+    5
+};
+
+static uint8_t datagram_rq_fec_bytes[] = {
+    QUICRQ_ACTION_REQUEST,
+    sizeof(url1),
+    URL1_BYTES,
+    0x44, 0xd2,
+    quicrq_transport_mode_datagram,
+    0x00,
+    quicrq_datagram_header_full,
+    0x00,
+    0x05
+};
+
 static quicrq_message_t fin_msg = {
     QUICRQ_ACTION_FIN_DATAGRAM,
     0,
@@ -268,6 +367,72 @@ static uint8_t accept_dg_bytes[] = {
 };
 
 
+static quicrq_message_t accept_dg_fragment_size = {
+    QUICRQ_ACTION_ACCEPT,
+    0,
+    NULL,
+    17,
+    0,
+    0,
+    0,
+    0,
+    0,
+    0,
+    0,
+    NULL,
+    quicrq_transport_mode_datagram,
+    0,
+    quicrq_subscribe_intent_current_group,
+    quicrq_datagram_header_compact,
+    0,
+    NULL,
+    0,
+    0,
+    1000
+};
+
+static uint8_t accept_dg_fragment_size_bytes[] = {
+    QUICRQ_ACTION_ACCEPT,
+    quicrq_transport_mode_datagram,
+    17,
+    quicrq_datagram_header_compact,
+    0x43, 0xe8
+};
+
+static quicrq_message_t accept_dg_fec = {
+    QUICRQ_ACTION_ACCEPT,
+    0,
+    NULL,
+    17,
+    0,
+    0,
+    0,
+    0,
+    0,
+    0,
+    0,
+    NULL,
+    quicrq_transport_mode_datagram,
+    0,
+    quicrq_subscribe_intent_current_group,
+    quicrq_datagram_header_compact,
+    0,
+    NULL,
+    0,
+    0,
+    1000,
+    4
+};
+
+static uint8_t accept_dg_fec_bytes[] = {
+    QUICRQ_ACTION_ACCEPT,
+    quicrq_transport_mode_datagram,
+    17,
+    quicrq_datagram_header_compact,
+    0x43, 0xe8,
+    0x04
+};
+
 static quicrq_message_t accept_st = {
     QUICRQ_ACTION_ACCEPT,
     0,
@@ -463,6 +628,38 @@ static uint8_t warp_object0_bytes[] = {
     (uint8_t)sizeof(fragment_bytes)
 };
 
+static quicrq_message_t feedback_msg = {
+    QUICRQ_ACTION_FEEDBACK,
+    0,
+    NULL,
+    0,
+    0,
+    0,
+    0,
+    0,
+    0x82,
+    0,
+    0,
+    NULL,
+    0,
+    0,
+    0,
+    0,
+    0,
+    NULL,
+    0,
+    1000000
+};
+
+static uint8_t feedback_bytes[] = {
+    QUICRQ_ACTION_FEEDBACK,
+    0x82,
+    0x80,
+    0x0f,
+    0x42,
+    0x40
+};
+
 
 typedef struct st_proto_test_case_t {
     uint8_t* const data;
@@ -476,6 +673,7 @@ static proto_test_case_t proto_cases[] = {
     PROTO_TEST_ITEM(datagram_rq, datagram_rq_bytes),
     PROTO_TEST_ITEM(datagram_rq_next_group, datagram_rq_next_group_bytes),
     PROTO_TEST_ITEM(datagram_rq_start_point, datagram_rq_start_point_bytes),
+    PROTO_TEST_ITEM(datagram_rq_complete_group, datagram_rq_complete_group_bytes),
     PROTO_TEST_ITEM(fin_msg, fin_msg_bytes),
     PROTO_TEST_ITEM(fragment_msg, fragment_msg_bytes),
     PROTO_TEST_ITEM(fragment_msg2, fragment_msg2_bytes),
@@ -488,7 +686,17 @@ static proto_test_case_t proto_cases[] = {
     PROTO_TEST_ITEM(cache_policy_msg, cache_policy_bytes),
     PROTO_TEST_ITEM(warp_header, warp_header_bytes),
     PROTO_TEST_ITEM(warp_object, warp_object_bytes),
-    PROTO_TEST_ITEM(warp_object0, warp_object0_bytes)
+    PROTO_TEST_ITEM(warp_object0, warp_object0_bytes),
+    PROTO_TEST_ITEM(feedback_msg, feedback_bytes)
+};
+
+/* Messages with optional fields at the end. They remain valid if these
+ * fields are removed, so they are not part of the bad length tests. */
+static proto_test_case_t proto_optional_cases[] = {
+    PROTO_TEST_ITEM(datagram_rq_fragment_size, datagram_rq_fragment_size_bytes),
+    PROTO_TEST_ITEM(accept_dg_fragment_size, accept_dg_fragment_size_bytes),
+    PROTO_TEST_ITEM(datagram_rq_fec, datagram_rq_fec_bytes),
+    PROTO_TEST_ITEM(accept_dg_fec, accept_dg_fec_bytes)
 };
 
 static uint8_t bad_bytes1[] = {
@@ -685,6 +893,84 @@ static uint8_t bad_bytes25[] = {
     (uint8_t)sizeof(fragment_bytes),
 };
 
+/* Track message nested in a track message */
+static uint8_t bad_bytes26[] = {
+    QUICRQ_ACTION_TRACK,
+    1,
+    QUICRQ_ACTION_TRACK,
+    2,
+    QUICRQ_ACTION_START_POINT,
+    1,
+    2
+};
+
+/* Batch request with too many tracks */
+static uint8_t bad_bytes27[] = {
+    QUICRQ_ACTION_REQUEST_BATCH,
+    0,
+    quicrq_subscribe_intent_current_group,
+    quicrq_datagram_header_full,
+    0x44,
+    0x01
+};
+
+/* Batch request with a truncated URL */
+static uint8_t bad_bytes28[] = {
+    QUICRQ_ACTION_REQUEST_BATCH,
+    0,
+    quicrq_subscribe_intent_current_group,
+    quicrq_datagram_header_full,
+    2,
+    1,
+    'a',
+    4,
+    'b'
+};
+
+/* Request with a zero fragment size */
+static uint8_t bad_bytes29[] = {
+    QUICRQ_ACTION_REQUEST,
+    sizeof(url1),
+    URL1_BYTES,
+    0x44, 0xd2,
+    quicrq_transport_mode_datagram,
+    0x00,
+    quicrq_datagram_header_full,
+    0x00
+};
+
+/* Accept with a fragment size above the maximum */
+static uint8_t bad_bytes30[] = {
+    QUICRQ_ACTION_ACCEPT,
+    quicrq_transport_mode_datagram,
+    17,
+    quicrq_datagram_header_full,
+    0x80, 0x00, 0x40, 0x00
+};
+
+/* Request with a zero FEC window */
+static uint8_t bad_bytes31[] = {
+    QUICRQ_ACTION_REQUEST,
+    sizeof(url1),
+    URL1_BYTES,
+    0x44, 0xd2,
+    quicrq_transport_mode_datagram,
+    0x00,
+    quicrq_datagram_header_full,
+    0x00,
+    0x00
+};
+
+/* Accept with a FEC window above the maximum */
+static uint8_t bad_bytes32[] = {
+    QUICRQ_ACTION_ACCEPT,
+    quicrq_transport_mode_datagram,
+    17,
+    quicrq_datagram_header_full,
+    0x43, 0xe8,
+    QUICRQ_FEC_WINDOW_MAX + 1
+};
+
 typedef struct st_proto_test_bad_case_t {
     uint8_t* const data;
     size_t data_length;
@@ -719,7 +1005,14 @@ static proto_test_bad_case_t proto_bad_cases[] = {
     PROTO_TEST_BAD_ITEM(bad_bytes22),
     PROTO_TEST_BAD_ITEM(bad_bytes23),
     PROTO_TEST_BAD_ITEM(bad_bytes24),
-    PROTO_TEST_BAD_ITEM(bad_bytes25)
+    PROTO_TEST_BAD_ITEM(bad_bytes25),
+    PROTO_TEST_BAD_ITEM(bad_bytes26),
+    PROTO_TEST_BAD_ITEM(bad_bytes27),
+    PROTO_TEST_BAD_ITEM(bad_bytes28),
+    PROTO_TEST_BAD_ITEM(bad_bytes29),
+    PROTO_TEST_BAD_ITEM(bad_bytes30),
+    PROTO_TEST_BAD_ITEM(bad_bytes31),
+    PROTO_TEST_BAD_ITEM(bad_bytes32)
 };
 
 int proto_msg_test()
@@ -782,6 +1075,18 @@ int proto_msg_test()
         else if (result.fragment_length != proto_cases[i].result->fragment_length) {
             ret = -1;
         }
+        else if (result.target_bitrate != proto_cases[i].result->target_bitrate) {
+            ret = -1;
+        }
+        else if (result.datagram_header_format != proto_cases[i].result->datagram_header_format) {
+            ret = -1;
+        }
+        else if (result.fragment_size != proto_cases[i].result->fragment_size) {
+            ret = -1;
+        }
+        else if (result.fec_window != proto_cases[i].result->fec_window) {
+            ret = -1;
+        }
     }
 
     /* Encoding tests */
@@ -826,5 +1131,161 @@ int proto_msg_test()
         }
     }
 
+    /* Optional fields tests */
+    for (size_t i = 0; ret == 0 && i < sizeof(proto_optional_cases) / sizeof(proto_test_case_t); i++) {
+        uint8_t msg[512];
+        const uint8_t* bytes_max = proto_optional_cases[i].data + proto_optional_cases[i].data_length;
+        quicrq_message_t result = { 0 };
+        const uint8_t* bytes = quicrq_msg_decode(proto_optional_cases[i].data, bytes_max, &result);
+        uint8_t* encoded = quicrq_msg_encode(msg, msg + sizeof(msg), proto_optional_cases[i].result);
+
+        if (bytes != bytes_max || result.message_type != proto_optional_cases[i].result->message_type ||
+            result.media_id != proto_optional_cases[i].result->media_id ||
+            result.transport_mode != proto_optional_cases[i].result->transport_mode ||
+            result.datagram_header_format != proto_optional_cases[i].result->datagram_header_format ||
+            result.fragment_size != proto_optional_cases[i].result->fragment_size ||
+            result.fec_window != proto_optional_cases[i].result->fec_window) {
+            ret = -1;
+        }
+        else if (encoded == NULL || (size_t)(encoded - msg) != proto_optional_cases[i].data_length ||
+            memcmp(msg, proto_optional_cases[i].data, proto_optional_cases[i].data_length) != 0) {
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
+
+/* Test the encoding and decoding of the batch messages.
+ * These messages carry lists, which are verified by the generic decoder
+ * and then read one item at a time.
+ */
+int quicrq_batch_msg_test()
+{
+    int ret = 0;
+    uint8_t msg[512];
+    uint8_t* bytes = NULL;
+    const uint8_t* url[3] = { (const uint8_t*)"audio", (const uint8_t*)"video1", (const uint8_t*)"video2" };
+    size_t url_length[3] = { 5, 6, 6 };
+    uint64_t accepted[2] = { 17, 19 };
+    quicrq_message_t result = { 0 };
+
+    /* Batch request */
+    bytes = quicrq_batch_rq_msg_encode(msg, msg + sizeof(msg), QUICRQ_ACTION_REQUEST_BATCH, 17,
+        quicrq_subscribe_intent_start_point, 5, 7, quicrq_datagram_header_compact, 3, url, url_length);
+    if (bytes == NULL || (size_t)(bytes - msg) > quicrq_batch_rq_msg_reserve(3, url_length, quicrq_subscribe_intent_start_point)) {
+        ret = -1;
+    }
+    else if (quicrq_msg_decode(msg, bytes, &result) != bytes) {
+        ret = -1;
+    }
+    else if (result.message_type != QUICRQ_ACTION_REQUEST_BATCH || result.media_id != 17 ||
+        result.subscribe_intent != quicrq_subscribe_intent_start_point || result.group_id != 5 || result.object_id != 7 ||
+        result.datagram_header_format != quicrq_datagram_header_compact || result.nb_tracks != 3 ||
+        result.transport_mode != quicrq_transport_mode_datagram) {
+        ret = -1;
+    }
+    else {
+        const uint8_t* track_bytes = result.track_list;
+        for (size_t i = 0; ret == 0 && i < 3; i++) {
+            size_t decoded_length = 0;
+            const uint8_t* decoded_url = NULL;
+
+            if ((track_bytes = quicrq_batch_url_decode(track_bytes, bytes, &decoded_length, &decoded_url)) == NULL ||
+                decoded_length != url_length[i] || memcmp(decoded_url, url[i], decoded_length) != 0) {
+                ret = -1;
+            }
+        }
+    }
+
+    /* Batch accept */
+    if (ret == 0) {
+        bytes = quicrq_batch_accept_msg_encode(msg, msg + sizeof(msg), QUICRQ_ACTION_ACCEPT_BATCH, 2, accepted);
+        if (bytes == NULL || (size_t)(bytes - msg) > quicrq_batch_accept_msg_reserve(2)) {
+            ret = -1;
+        }
+        else if (quicrq_msg_decode(msg, bytes, &result) != bytes) {
+            ret = -1;
+        }
+        else if (result.message_type != QUICRQ_ACTION_ACCEPT_BATCH || result.nb_tracks != 2) {
+            ret = -1;
+        }
+        else {
+            const uint8_t* track_bytes = result.track_list;
+            for (size_t i = 0; ret == 0 && i < 2; i++) {
+                uint64_t media_id = 0;
+                if ((track_bytes = picoquic_frames_varint_decode(track_bytes, bytes, &media_id)) == NULL ||
+                    media_id != accepted[i]) {
+                    ret = -1;
+                }
+            }
+        }
+    }
+
+    /* Track messages */
+    for (int i = 0; ret == 0 && i < 3; i++) {
+        bytes = quicrq_track_msg_encode(msg, msg + sizeof(msg), QUICRQ_ACTION_TRACK, 19);
+        if (bytes != NULL) {
+            switch (i) {
+            case 0:
+                bytes = quicrq_start_point_msg_encode(bytes, msg + sizeof(msg), QUICRQ_ACTION_START_POINT, 5, 7);
+                break;
+            case 1:
+                bytes = quicrq_cache_policy_msg_encode(bytes, msg + sizeof(msg), QUICRQ_ACTION_CACHE_POLICY, 1);
+                break;
+            default:
+                bytes = quicrq_fin_msg_encode(bytes, msg + sizeof(msg), QUICRQ_ACTION_FIN_DATAGRAM, 6, 3);
+                break;
+            }
+        }
+        if (bytes == NULL) {
+            ret = -1;
+        }
+        else if (quicrq_msg_decode(msg, bytes, &result) != bytes) {
+            ret = -1;
+        }
+        else if (result.message_type != QUICRQ_ACTION_TRACK || result.media_id != 19) {
+            ret = -1;
+        }
+        else {
+            switch (i) {
+            case 0:
+                if (result.track_message_type != QUICRQ_ACTION_START_POINT || result.group_id != 5 || result.object_id != 7) {
+                    ret = -1;
+                }
+                break;
+            case 1:
+                if (result.track_message_type != QUICRQ_ACTION_CACHE_POLICY || result.cache_policy != 1) {
+                    ret = -1;
+                }
+                break;
+            default:
+                if (result.track_message_type != QUICRQ_ACTION_FIN_DATAGRAM || result.group_id != 6 || result.object_id != 3) {
+                    ret = -1;
+                }
+                break;
+            }
+        }
+    }
+
+    /* Unsubscribe track message, only valid inside a track message */
+    if (ret == 0) {
+        bytes = quicrq_unsubscribe_track_msg_encode(msg, msg + sizeof(msg), 21);
+        if (bytes == NULL || (size_t)(bytes - msg) > quicrq_unsubscribe_track_msg_reserve(21)) {
+            ret = -1;
+        }
+        else if (quicrq_msg_decode(msg, bytes, &result) != bytes) {
+            ret = -1;
+        }
+        else if (result.message_type != QUICRQ_ACTION_TRACK || result.media_id != 21 ||
+            result.track_message_type != QUICRQ_ACTION_UNSUBSCRIBE_TRACK) {
+            ret = -1;
+        }
+        else if ((bytes = picoquic_frames_varint_encode(msg, msg + sizeof(msg), QUICRQ_ACTION_UNSUBSCRIBE_TRACK)) == NULL ||
+            quicrq_msg_decode(msg, bytes, &result) != NULL) {
+            ret = -1;
+        }
+    }
+
     return ret;
 }
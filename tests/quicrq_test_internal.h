@@ -139,6 +139,7 @@ void quicrq_test_config_target_free(quicrq_test_config_target_t* target);
 int quicrq_test_find_send_link(quicrq_test_config_t* config, int srce_node_id, const struct sockaddr* dest_addr, struct sockaddr_storage* srce_addr);
 
 extern const generation_parameters_t video_1mps;
+extern const generation_parameters_t audio_18kbps;
 
 int quicrq_compare_media_file(char const* media_result_file, char const* media_reference_file);
 int quicrq_compare_media_file_ex(char const* media_result_file, char const* media_reference_file,
@@ -147,6 +148,29 @@ int quicrq_log_file_statistics(char const* media_result_log, int* nb_frames, int
     uint64_t* delay_average, uint64_t* delay_min, uint64_t* delay_max);
 int test_media_is_audio(const uint8_t* url, size_t url_length);
 
+/* Statistics of an object stream consumer, kept whether or not result files
+ * are written. The delays are only computed if the start time of the media
+ * source is known, i.e., if the source runs with the same clock.
+ * Objects missing from the sequence are counted in nb_gaps, unless the jump
+ * happens at the start of a new group, as when the consumer skips ahead to
+ * the latest group; these are counted in nb_skipped_ahead.
+ */
+typedef struct st_test_object_stream_stats_t {
+    uint64_t media_start_time;
+    uint64_t first_object_time;
+    uint64_t last_object_time;
+    uint64_t nb_objects;
+    uint64_t nb_skipped;
+    uint64_t nb_gaps;
+    uint64_t nb_skipped_ahead;
+    uint64_t nb_bytes;
+    uint64_t next_number;
+    uint64_t current_group_id;
+    uint64_t delay_sum;
+    uint64_t delay_max;
+    uint64_t nb_delays;
+} test_object_stream_stats_t;
+
 typedef struct st_test_object_stream_ctx_t {
     FILE* Res;
     FILE* Log;
@@ -156,6 +180,7 @@ typedef struct st_test_object_stream_ctx_t {
     size_t target_size;
     void* media_ctx;
     int is_closed;
+    test_object_stream_stats_t stats;
 } test_object_stream_ctx_t;
 
 int test_media_object_consumer_cb(
@@ -175,12 +200,20 @@ void* test_media_publisher_init(char const* media_source_path, const generation_
 
 void* test_media_consumer_init(char const* media_result_file, char const* media_result_log);
 int test_media_consumer_init_callback(quicrq_stream_ctx_t* stream_ctx, const uint8_t* url, size_t url_length);
+int test_object_stream_consumer_cb(quicrq_media_consumer_enum action, void* object_consumer_ctx, uint64_t current_time,
+    uint64_t group_id, uint64_t object_id, const uint8_t* data, size_t data_length,
+    quicrq_object_stream_consumer_properties_t* properties, quicrq_media_close_reason_enum close_reason,
+    uint64_t close_error_number);
 test_object_stream_ctx_t* test_object_stream_subscribe(quicrq_cnx_ctx_t* cnx_ctx, const uint8_t* url, size_t url_length, 
     quicrq_transport_mode_enum transport_mode, char const* media_result_file, char const* media_result_log);
 test_object_stream_ctx_t* test_object_stream_subscribe_ex(quicrq_cnx_ctx_t* cnx_ctx, const uint8_t* url, size_t url_length,
     quicrq_transport_mode_enum transport_mode, quicrq_subscribe_order_enum order_required,
     quicrq_subscribe_intent_t* intent, char const* media_result_file, char const* media_result_log);
+#define TEST_OBJECT_STREAM_BATCH_MAX 8
+int test_object_stream_subscribe_batch(quicrq_cnx_ctx_t* cnx_ctx, size_t nb_media, const uint8_t** url, const size_t* url_length,
+    char const** media_result_file, char const** media_result_log, test_object_stream_ctx_t** cons_ctx);
 void test_object_stream_unsubscribe(test_object_stream_ctx_t* cons_ctx);
+void test_object_stream_consumer_close(void* v_cons_ctx);
 int test_media_object_source_iterate(test_media_object_source_context_t* object_pub_ctx, uint64_t current_time, int * is_active);
 uint64_t test_media_object_source_next_time(test_media_object_source_context_t* object_pub_ctx, uint64_t current_time);
 void test_media_object_source_delete(test_media_object_source_context_t* object_pub_ctx);
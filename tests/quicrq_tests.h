@@ -3,6 +3,8 @@
 #ifndef QUICRQ_TEST_H
 #define QUICRQ_TEST_H
 
+#include <stdio.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -121,6 +123,62 @@ extern "C" {
     int quicrq_triangle_intent_rush_nc_test();
     int quicrq_triangle_intent_rush_loss_test();
     int quicrq_triangle_intent_rush_next_test();
+    int quicrq_source_index_test();
+    int quicrq_media_id_test();
+    int quicrq_fragment_buffer_test();
+    int quicrq_pool_test();
+    int quicrq_fragment_object_index_test();
+    int quicrq_subscribe_trie_test();
+    int quicrq_datagram_scheduler_test();
+    int quicrq_datagram_coalescing_test();
+    int quicrq_source_wakeup_test();
+    int quicrq_congestion_rate_epoch_test();
+    int quicrq_timer_test();
+    int quicrq_cache_memory_limit_test();
+    int quicrq_shard_test();
+    int quicrq_publish_queue_test();
+    int quicrq_publish_object_ex_test();
+    int quicrq_fragment_views_test();
+    int quicrq_reassembly_in_place_test();
+    int quicrq_datagram_ack_ring_test();
+    int quicrq_datagram_fec_test();
+    int quicrq_fragment_publisher_next_test();
+    int quicrq_uni_stream_pool_test();
+    int quicrq_bench_fanout_test();
+
+    /* Relay fan-out benchmark, run by "quicrq_t -b". If no scenario is
+     * specified, all the predefined scenarios are run. */
+    int quicrq_bench_fanout(FILE* F, char const** scenario_ids, int nb_scenario_ids);
+    void quicrq_bench_fanout_usage(FILE* F);
+    int quicrq_delay_histogram_test();
+    int quicrq_stats_test();
+    int quicrq_relay_failover_test();
+    int quicrq_fragment_group_index_test();
+    int quicrq_fragment_catch_up_test();
+    int quicrq_cache_spill_test();
+    int quicrq_datagram_compact_header_test();
+    int quicrq_batch_msg_test();
+    int quicrq_twomedia_datagram_batch_test();
+    int quicrq_cnx_count_test();
+    int quicrq_feedback_test();
+    int quicrq_relay_warm_test();
+    int quicrq_fragment_size_test();
+    int quicrq_arrival_cursor_test();
+    int quicrq_publish_object_ex_null_test();
+    int quicrq_shard_thread_test();
+    int quicrq_shard_peers_test();
+    int quicrq_twomedia_batch_partial_test();
+    int quicrq_twomedia_batch_unsubscribe_test();
+    int quicrq_relay_failover_post_test();
+    int quicrq_cache_spill_retry_test();
+    int quicrq_relay_warm_resume_test();
+    int quicrq_relay_feedback_test();
+    int quicrq_consumer_stats_test();
+    int quicrq_track_warp_header_test();
+    int quicrq_congestion_basic_r_test();
+    int quicrq_congestion_datagram_r_test();
+    int quicrq_reassembly_in_place_budget_test();
+    int quicrq_datagram_compact_ack_lag_test();
 
 #ifdef __cplusplus
 }
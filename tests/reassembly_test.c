@@ -0,0 +1,337 @@
+#include <string.h>
+#include <stdlib.h>
+#include "quicrq.h"
+#include "quicrq_internal.h"
+#include "quicrq_reassembly.h"
+#include "quicrq_test_internal.h"
+
+/* Unit test of the fragment views.
+ * Subscribe to an object stream with fragment views enabled, then pass to the
+ * bridge an object received in three fragments, out of order, followed by an
+ * object received in a single fragment. Verify that the consumer receives views
+ * of the fragments in place, without a contiguous copy, and the contiguous data
+ * of the single fragment object.
+ */
+#define FRAGMENT_VIEWS_TEST_FRAGMENT_SIZE 100
+#define FRAGMENT_VIEWS_TEST_NB_FRAGMENTS 3
+
+typedef struct st_fragment_views_test_ctx_t {
+    int nb_objects;
+    int nb_errors;
+    int is_closed;
+} fragment_views_test_ctx_t;
+
+static int fragment_views_test_check(const uint8_t* data, size_t data_length, size_t offset)
+{
+    int ret = 0;
+
+    for (size_t i = 0; ret == 0 && i < data_length; i++) {
+        if (data[i] != (uint8_t)(offset + i)) {
+            ret = -1;
+        }
+    }
+    return ret;
+}
+
+static int fragment_views_test_consumer(
+    quicrq_media_consumer_enum action,
+    void* object_consumer_ctx,
+    uint64_t current_time,
+    uint64_t group_id,
+    uint64_t object_id,
+    const uint8_t* data,
+    size_t data_length,
+    quicrq_object_stream_consumer_properties_t* properties,
+    quicrq_media_close_reason_enum close_reason,
+    uint64_t close_error_number)
+{
+    fragment_views_test_ctx_t* test_ctx = (fragment_views_test_ctx_t*)object_consumer_ctx;
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(current_time);
+    UNREFERENCED_PARAMETER(group_id);
+    UNREFERENCED_PARAMETER(close_reason);
+    UNREFERENCED_PARAMETER(close_error_number);
+#endif
+
+    if (action == quicrq_media_close) {
+        test_ctx->is_closed = 1;
+    }
+    else if (action == quicrq_media_datagram_ready) {
+        size_t expected_fragments = (object_id == 0) ? FRAGMENT_VIEWS_TEST_NB_FRAGMENTS : 1;
+        size_t offset = 0;
+
+        if (properties->nb_fragments != expected_fragments ||
+            data_length != expected_fragments * FRAGMENT_VIEWS_TEST_FRAGMENT_SIZE ||
+            (expected_fragments > 1 && data != NULL) ||
+            (expected_fragments == 1 && data != properties->fragments[0].data)) {
+            test_ctx->nb_errors++;
+        }
+        else {
+            for (size_t i = 0; i < properties->nb_fragments; i++) {
+                if (fragment_views_test_check(properties->fragments[i].data, properties->fragments[i].data_length, offset) != 0) {
+                    test_ctx->nb_errors++;
+                }
+                offset += properties->fragments[i].data_length;
+            }
+        }
+        test_ctx->nb_objects++;
+    }
+    return 0;
+}
+
+int quicrq_fragment_views_test()
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    struct sockaddr_storage addr = { 0 };
+    char const* url = "fragment_views_test";
+    uint8_t data[FRAGMENT_VIEWS_TEST_NB_FRAGMENTS * FRAGMENT_VIEWS_TEST_FRAGMENT_SIZE];
+    size_t fragment_order[FRAGMENT_VIEWS_TEST_NB_FRAGMENTS] = { 2, 0, 1 };
+    fragment_views_test_ctx_t test_ctx = { 0 };
+    quicrq_ctx_t* qr_ctx = quicrq_create(QUICRQ_ALPN, NULL, NULL, NULL, NULL, NULL, NULL, 0, &simulated_time);
+    quicrq_cnx_ctx_t* cnx_ctx = (qr_ctx == NULL) ? NULL : quicrq_create_client_cnx(qr_ctx, NULL, (struct sockaddr*)&addr);
+    quicrq_object_stream_consumer_ctx* consumer_ctx = (cnx_ctx == NULL) ? NULL :
+        quicrq_subscribe_object_stream(cnx_ctx, (const uint8_t*)url, strlen(url), quicrq_transport_mode_datagram,
+            quicrq_subscribe_in_order, NULL, fragment_views_test_consumer, &test_ctx);
+
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = (uint8_t)i;
+    }
+
+    if (consumer_ctx == NULL) {
+        ret = -1;
+    }
+    else {
+        quicrq_object_stream_set_fragment_views(consumer_ctx, 1);
+    }
+
+    for (size_t i = 0; ret == 0 && i < FRAGMENT_VIEWS_TEST_NB_FRAGMENTS; i++) {
+        size_t offset = fragment_order[i] * FRAGMENT_VIEWS_TEST_FRAGMENT_SIZE;
+
+        ret = quicrq_media_object_bridge_fn(quicrq_media_datagram_ready, consumer_ctx, simulated_time,
+            data + offset, 0, 0, offset, 0, 0, 0, sizeof(data), FRAGMENT_VIEWS_TEST_FRAGMENT_SIZE);
+        if (ret == 0 && test_ctx.nb_objects != ((i + 1 < FRAGMENT_VIEWS_TEST_NB_FRAGMENTS) ? 0 : 1)) {
+            DBG_PRINTF("Fragment %zu, %d objects delivered", i, test_ctx.nb_objects);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        ret = quicrq_media_object_bridge_fn(quicrq_media_datagram_ready, consumer_ctx, simulated_time,
+            data, 0, 1, 0, 0, 0, 0, FRAGMENT_VIEWS_TEST_FRAGMENT_SIZE, FRAGMENT_VIEWS_TEST_FRAGMENT_SIZE);
+    }
+
+    if (ret == 0 && (test_ctx.nb_objects != 2 || test_ctx.nb_errors != 0)) {
+        DBG_PRINTF("%d objects delivered, %d errors", test_ctx.nb_objects, test_ctx.nb_errors);
+        ret = -1;
+    }
+
+    if (qr_ctx != NULL) {
+        quicrq_delete(qr_ctx);
+        if (ret == 0 && !test_ctx.is_closed) {
+            DBG_PRINTF("%s", "Consumer not closed");
+            ret = -1;
+        }
+    }
+    return ret;
+}
+
+/* Unit test of the in place reassembly.
+ * Submit the fragments of an object out of order, with overlaps and duplicates,
+ * and verify that the object is delivered once, with the right content, and that
+ * it uses the same number of data items from the pools whatever the number of
+ * fragments received so far.
+ */
+#define IN_PLACE_TEST_OBJECT_SIZE 1000
+
+typedef struct st_in_place_test_ctx_t {
+    int nb_ready;
+    int nb_errors;
+} in_place_test_ctx_t;
+
+static int in_place_test_ready_fn(void* media_ctx, uint64_t current_time, uint64_t group_id, uint64_t object_id,
+    uint8_t flags, const uint8_t* data, size_t data_length, quicrq_reassembly_object_mode_enum object_mode)
+{
+    in_place_test_ctx_t* test_ctx = (in_place_test_ctx_t*)media_ctx;
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(current_time);
+    UNREFERENCED_PARAMETER(flags);
+#endif
+    test_ctx->nb_ready++;
+    if (group_id != 0 || object_id != 0 || object_mode != quicrq_reassembly_object_in_sequence ||
+        data_length != IN_PLACE_TEST_OBJECT_SIZE || fragment_views_test_check(data, data_length, 0) != 0) {
+        test_ctx->nb_errors++;
+    }
+    return 0;
+}
+
+static size_t in_place_test_data_in_use(quicrq_ctx_t* qr_ctx)
+{
+    size_t nb_in_use = 0;
+    quicrq_pool_stats_t stats;
+
+    for (size_t i = quicrq_pool_data_128; i < quicrq_pool_max; i++) {
+        if (quicrq_get_pool_stats(qr_ctx, i, &stats) == 0) {
+            nb_in_use += stats.nb_in_use;
+        }
+    }
+    return nb_in_use;
+}
+
+int quicrq_reassembly_in_place_test()
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    uint8_t data[IN_PLACE_TEST_OBJECT_SIZE];
+    /* Offset and length of the fragments, in order of arrival */
+    size_t fragments[][2] = { { 900, 100 }, { 100, 200 }, { 150, 300 }, { 100, 200 }, { 700, 250 }, { 0, 120 }, { 440, 270 } };
+    size_t nb_fragments = sizeof(fragments) / sizeof(fragments[0]);
+    size_t nb_in_use = 0;
+    in_place_test_ctx_t test_ctx = { 0 };
+    quicrq_reassembly_context_t reassembly_ctx = { 0 };
+    quicrq_ctx_t* qr_ctx = quicrq_create(QUICRQ_ALPN, NULL, NULL, NULL, NULL, NULL, NULL, 0, &simulated_time);
+
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = (uint8_t)i;
+    }
+
+    if (qr_ctx == NULL) {
+        ret = -1;
+    }
+    else {
+        quicrq_reassembly_init(&reassembly_ctx);
+        reassembly_ctx.qr_ctx = qr_ctx;
+    }
+
+    for (size_t i = 0; ret == 0 && i < nb_fragments; i++) {
+        ret = quicrq_reassembly_input(&reassembly_ctx, simulated_time, data + fragments[i][0], 0, 0, fragments[i][0], 0, 0, 0,
+            sizeof(data), fragments[i][1], in_place_test_ready_fn, &test_ctx);
+        if (ret == 0 && i + 1 < nb_fragments) {
+            if (test_ctx.nb_ready != 0) {
+                DBG_PRINTF("Object delivered after %zu fragments", i + 1);
+                ret = -1;
+            }
+            else if (i == 0) {
+                nb_in_use = in_place_test_data_in_use(qr_ctx);
+            }
+            else if (in_place_test_data_in_use(qr_ctx) != nb_in_use) {
+                DBG_PRINTF("Fragment %zu, %zu data items in use instead of %zu", i, in_place_test_data_in_use(qr_ctx), nb_in_use);
+                ret = -1;
+            }
+        }
+    }
+
+    if (ret == 0 && (test_ctx.nb_ready != 1 || test_ctx.nb_errors != 0 || in_place_test_data_in_use(qr_ctx) != 0)) {
+        DBG_PRINTF("%d objects ready, %d errors", test_ctx.nb_ready, test_ctx.nb_errors);
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        /* A late duplicate is ignored */
+        ret = quicrq_reassembly_input(&reassembly_ctx, simulated_time, data, 0, 0, 0, 0, 0, 0,
+            sizeof(data), 100, in_place_test_ready_fn, &test_ctx);
+        if (ret == 0 && test_ctx.nb_ready != 1) {
+            DBG_PRINTF("%s", "Duplicate delivered");
+            ret = -1;
+        }
+    }
+
+    if (qr_ctx != NULL) {
+        reassembly_ctx.is_finished = 1;
+        quicrq_reassembly_release(&reassembly_ctx);
+        quicrq_delete(qr_ctx);
+    }
+    return ret;
+}
+
+/* Unit test of the in place budget.
+ * Start several objects with their first half, with a budget that only allows
+ * two buffers in place. Verify that the next objects are kept as packets
+ * instead of being refused, that they are all delivered once complete, and that
+ * the budget is returned when the objects are delivered.
+ */
+#define IN_PLACE_BUDGET_TEST_NB_OBJECTS 4
+#define IN_PLACE_BUDGET_TEST_NB_IN_PLACE 2
+
+static int in_place_budget_test_ready_fn(void* media_ctx, uint64_t current_time, uint64_t group_id, uint64_t object_id,
+    uint8_t flags, const uint8_t* data, size_t data_length, quicrq_reassembly_object_mode_enum object_mode)
+{
+    in_place_test_ctx_t* test_ctx = (in_place_test_ctx_t*)media_ctx;
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(current_time);
+    UNREFERENCED_PARAMETER(flags);
+#endif
+    if (group_id != 0 || object_id != (uint64_t)test_ctx->nb_ready || object_mode != quicrq_reassembly_object_in_sequence ||
+        data_length != IN_PLACE_TEST_OBJECT_SIZE || fragment_views_test_check(data, data_length, 0) != 0) {
+        test_ctx->nb_errors++;
+    }
+    test_ctx->nb_ready++;
+    return 0;
+}
+
+int quicrq_reassembly_in_place_budget_test()
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    uint8_t data[IN_PLACE_TEST_OBJECT_SIZE];
+    size_t half = sizeof(data) / 2;
+    size_t in_place_size = 0;
+    in_place_test_ctx_t test_ctx = { 0 };
+    quicrq_reassembly_context_t reassembly_ctx = { 0 };
+    quicrq_ctx_t* qr_ctx = quicrq_create(QUICRQ_ALPN, NULL, NULL, NULL, NULL, NULL, NULL, 0, &simulated_time);
+
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = (uint8_t)i;
+    }
+
+    if (qr_ctx == NULL) {
+        ret = -1;
+    }
+    else {
+        quicrq_reassembly_init(&reassembly_ctx);
+        reassembly_ctx.qr_ctx = qr_ctx;
+    }
+
+    /* Measure the size of one buffer in place, then set the budget */
+    if (ret == 0 && (ret = quicrq_reassembly_input(&reassembly_ctx, simulated_time, data, 0, 0, 0, 0, 0, 0,
+        sizeof(data), half, in_place_budget_test_ready_fn, &test_ctx)) == 0) {
+        in_place_size = reassembly_ctx.in_place_bytes;
+        reassembly_ctx.in_place_budget = IN_PLACE_BUDGET_TEST_NB_IN_PLACE * in_place_size;
+        if (in_place_size < sizeof(data)) {
+            DBG_PRINTF("In place bytes %zu, expected at least %zu", in_place_size, sizeof(data));
+            ret = -1;
+        }
+    }
+    for (uint64_t i = 1; ret == 0 && i < IN_PLACE_BUDGET_TEST_NB_OBJECTS; i++) {
+        ret = quicrq_reassembly_input(&reassembly_ctx, simulated_time, data, 0, i, 0, 0, 0, 0,
+            sizeof(data), half, in_place_budget_test_ready_fn, &test_ctx);
+        if (ret == 0 && reassembly_ctx.in_place_bytes > reassembly_ctx.in_place_budget) {
+            DBG_PRINTF("Object %" PRIu64 ", in place bytes %zu above budget %zu", i,
+                reassembly_ctx.in_place_bytes, reassembly_ctx.in_place_budget);
+            ret = -1;
+        }
+    }
+    if (ret == 0 && (test_ctx.nb_ready != 0 || reassembly_ctx.in_place_bytes != IN_PLACE_BUDGET_TEST_NB_IN_PLACE * in_place_size)) {
+        DBG_PRINTF("%d objects ready, in place bytes %zu", test_ctx.nb_ready, reassembly_ctx.in_place_bytes);
+        ret = -1;
+    }
+    /* Complete the objects in sequence */
+    for (uint64_t i = 0; ret == 0 && i < IN_PLACE_BUDGET_TEST_NB_OBJECTS; i++) {
+        ret = quicrq_reassembly_input(&reassembly_ctx, simulated_time, data + half, 0, i, half, 0, 0, 0,
+            sizeof(data), sizeof(data) - half, in_place_budget_test_ready_fn, &test_ctx);
+    }
+
+    if (ret == 0 && (test_ctx.nb_ready != IN_PLACE_BUDGET_TEST_NB_OBJECTS || test_ctx.nb_errors != 0 ||
+        reassembly_ctx.in_place_bytes != 0 || in_place_test_data_in_use(qr_ctx) != 0)) {
+        DBG_PRINTF("%d objects ready, %d errors, in place bytes %zu", test_ctx.nb_ready, test_ctx.nb_errors,
+            reassembly_ctx.in_place_bytes);
+        ret = -1;
+    }
+
+    if (qr_ctx != NULL) {
+        reassembly_ctx.is_finished = 1;
+        quicrq_reassembly_release(&reassembly_ctx);
+        quicrq_delete(qr_ctx);
+    }
+    return ret;
+}
@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include "picoquic_set_textlog.h"
 #include "picoquic_set_binlog.h"
+#include "picoquic_internal.h"
 #include "quicrq.h"
 #include "quicrq_relay.h"
 #include "quicrq_internal.h"
@@ -249,3 +250,199 @@ int quicrq_warp_relay_loss_test()
 
     return ret;
 }
+
+/* Test of the warm upstream connection resumption.
+ * The relay opens its upstream connection in advance, and receives a session
+ * ticket from the origin. When that connection is closed, it is opened again
+ * after the retry delay. The new connection shall use the ticket, so that the
+ * first requests can be sent as 0-RTT data, and shall reach the ready state.
+ */
+#define RELAY_WARM_RESUME_TEST_SNI "test.example.com"
+
+int quicrq_relay_warm_resume_test()
+{
+    int ret = 0;
+    int nb_steps = 0;
+    int is_closed = 0;
+    int is_resumed = 0;
+    uint64_t nb_checked = 0;
+    const uint64_t max_time = 10000000;
+    quicrq_test_config_t* config = quicrq_test_relay_config_create(0);
+    quicrq_relay_upstream_t* upstream = NULL;
+
+    if (config == NULL) {
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        /* The tickets are stored by server name */
+        struct sockaddr* addr_to = quicrq_test_find_send_addr(config, 1, 0);
+        ret = quicrq_enable_relay(config->nodes[1], RELAY_WARM_RESUME_TEST_SNI, addr_to, quicrq_transport_mode_single_stream);
+        if (ret == 0) {
+            ret = quicrq_relay_set_warm_upstreams(config->nodes[1], 1);
+        }
+        if (ret != 0) {
+            DBG_PRINTF("Cannot enable warm relay, ret = %d", ret);
+        }
+        else {
+            upstream = &config->nodes[1]->relay_ctx->upstreams[0];
+        }
+    }
+
+    while (ret == 0 && !is_resumed && config->simulated_time < max_time) {
+        int is_active = 0;
+        quicrq_cnx_ctx_t* cnx_ctx = NULL;
+
+        ret = quicrq_test_loop_step(config, &is_active, UINT64_MAX);
+        if (ret != 0) {
+            DBG_PRINTF("Fail on loop step %d, %d, active: ret=%d", nb_steps, is_active, ret);
+            break;
+        }
+        nb_steps++;
+        cnx_ctx = upstream->cnx_ctx[0];
+
+        if (cnx_ctx == NULL || cnx_ctx->cnx == NULL) {
+            /* Not connected yet, or waiting for the retry delay */
+        }
+        else if (nb_checked < upstream->nb_warm_connections) {
+            /* New connection: 0-RTT is only available if a ticket was stored */
+            nb_checked = upstream->nb_warm_connections;
+            if (picoquic_is_0rtt_available(cnx_ctx->cnx) != (nb_checked > 1)) {
+                DBG_PRINTF("0-RTT %savailable on warm connection %" PRIu64,
+                    picoquic_is_0rtt_available(cnx_ctx->cnx) ? "" : "not ", nb_checked);
+                ret = -1;
+            }
+        }
+        else if (picoquic_get_cnx_state(cnx_ctx->cnx) != picoquic_state_ready) {
+            /* Handshake in progress */
+        }
+        else if (nb_checked > 1) {
+            is_resumed = 1;
+        }
+        else if (!is_closed && config->nodes[1]->quic->p_first_ticket != NULL) {
+            /* The ticket is stored, close the first connection */
+            ret = quicrq_close_cnx(cnx_ctx);
+            is_closed = 1;
+        }
+    }
+
+    if (ret == 0 && (!is_resumed || upstream->nb_warm_connections != 2)) {
+        DBG_PRINTF("Resumed: %d, warm connections: %" PRIu64 ", time: %" PRIu64, is_resumed,
+            nb_checked, config->simulated_time);
+        ret = -1;
+    }
+
+    if (config != NULL) {
+        quicrq_test_config_delete(config);
+    }
+
+    return ret;
+}
+
+/* Test of the feedback forwarding through a relay.
+ * The client subscribes to a media published by the origin, through the relay,
+ * and sends feedback once the media flows. The relay shall aggregate it in its
+ * source, and forward it upstream, so the sender stream at the origin shall
+ * receive the same max flags and target bitrate.
+ */
+#define RELAY_FEEDBACK_TEST_FLAGS 0x81
+#define RELAY_FEEDBACK_TEST_BITRATE 500000
+
+int quicrq_relay_feedback_test()
+{
+    int ret = 0;
+    int nb_steps = 0;
+    int is_feedback_sent = 0;
+    int is_feedback_received = 0;
+    const uint64_t max_time = 10000000;
+    quicrq_test_config_t* config = quicrq_test_relay_config_create(0);
+    quicrq_cnx_ctx_t* cnx_ctx = NULL;
+    char media_source_path[512];
+    char result_file_name[512];
+    char result_log_name[512];
+
+    ret = test_media_derive_file_names((uint8_t*)QUICRQ_TEST_BASIC_SOURCE, strlen(QUICRQ_TEST_BASIC_SOURCE),
+        quicrq_transport_mode_single_stream, 1, 0, result_file_name, result_log_name, sizeof(result_file_name));
+
+    if (config == NULL) {
+        ret = -1;
+    }
+
+    if (ret == 0 && picoquic_get_input_path(media_source_path, sizeof(media_source_path),
+        quicrq_test_solution_dir, QUICRQ_TEST_BASIC_SOURCE) != 0) {
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        config->object_sources[0] = test_media_object_source_publish(config->nodes[0], (uint8_t*)QUICRQ_TEST_BASIC_SOURCE,
+            strlen(QUICRQ_TEST_BASIC_SOURCE), media_source_path, NULL, 1, config->simulated_time);
+        if (config->object_sources[0] == NULL) {
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        struct sockaddr* addr_to = quicrq_test_find_send_addr(config, 1, 0);
+        ret = quicrq_enable_relay(config->nodes[1], NULL, addr_to, quicrq_transport_mode_single_stream);
+    }
+
+    if (ret == 0 && (cnx_ctx = quicrq_test_create_client_cnx(config, 2, 1)) == NULL) {
+        ret = -1;
+    }
+
+    if (ret == 0 && test_object_stream_subscribe(cnx_ctx, (const uint8_t*)QUICRQ_TEST_BASIC_SOURCE,
+        strlen(QUICRQ_TEST_BASIC_SOURCE), quicrq_transport_mode_single_stream, result_file_name, result_log_name) == NULL) {
+        ret = -1;
+    }
+
+    while (ret == 0 && !is_feedback_received && config->simulated_time < max_time) {
+        int is_active = 0;
+        quicrq_stream_ctx_t* origin_stream = (config->nodes[0]->first_cnx == NULL) ? NULL : config->nodes[0]->first_cnx->first_stream;
+
+        ret = quicrq_test_loop_step(config, &is_active, UINT64_MAX);
+        if (ret != 0) {
+            DBG_PRINTF("Fail on loop step %d, %d, active: ret=%d", nb_steps, is_active, ret);
+            break;
+        }
+        nb_steps++;
+
+        if (origin_stream == NULL || origin_stream->media_ctx == NULL || cnx_ctx->first_stream == NULL) {
+            /* The media does not flow yet */
+        }
+        else if (!is_feedback_sent) {
+            /* The client asks for the lower layers at a lower rate */
+            ret = quicrq_stream_set_feedback(cnx_ctx->first_stream, RELAY_FEEDBACK_TEST_FLAGS, RELAY_FEEDBACK_TEST_BITRATE);
+            is_feedback_sent = 1;
+            if (ret != 0) {
+                DBG_PRINTF("Cannot set the feedback, ret = %d", ret);
+            }
+        }
+        else if (origin_stream->is_feedback_set) {
+            quicrq_media_source_ctx_t* relay_source = config->nodes[1]->first_source;
+
+            is_feedback_received = 1;
+            if (origin_stream->feedback.max_flags != RELAY_FEEDBACK_TEST_FLAGS ||
+                origin_stream->feedback.target_bitrate != RELAY_FEEDBACK_TEST_BITRATE) {
+                DBG_PRINTF("Origin received feedback 0x%x, %" PRIu64, origin_stream->feedback.max_flags,
+                    origin_stream->feedback.target_bitrate);
+                ret = -1;
+            }
+            else if (relay_source == NULL || relay_source->feedback_max_flags != RELAY_FEEDBACK_TEST_FLAGS ||
+                relay_source->feedback_target_bitrate != RELAY_FEEDBACK_TEST_BITRATE) {
+                DBG_PRINTF("%s", "Feedback not aggregated at the relay");
+                ret = -1;
+            }
+        }
+    }
+
+    if (ret == 0 && !is_feedback_received) {
+        DBG_PRINTF("Feedback %s, not received at the origin after %d steps", (is_feedback_sent) ? "sent" : "not sent", nb_steps);
+        ret = -1;
+    }
+
+    if (config != NULL) {
+        quicrq_test_config_delete(config);
+    }
+
+    return ret;
+}
@@ -0,0 +1,524 @@
+#include <string.h>
+#include <stdlib.h>
+#ifdef _WINDOWS
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+#include "quicrq.h"
+#include "quicrq_internal.h"
+#include "quicrq_fragment.h"
+#include "quicrq_test_internal.h"
+
+/* Unit test of the relay shard feeds.
+ * Publish a few objects in the source context, then mirror the source in a
+ * shard context with a small ring, so that most entries go through the
+ * backlog. The mirror is created at the next time check of the shard.
+ * Alternate the time checks of the source and the shard, as the two
+ * threads would, and verify that the mirror receives all the objects, the
+ * end point, and the closure of the source, and that the feed is freed
+ * once both sides have released it.
+ */
+#define SHARD_TEST_NB_OBJECTS 16
+#define SHARD_TEST_NB_BEFORE_FEED 3
+#define SHARD_TEST_OBJECT_SIZE 64
+#define SHARD_TEST_RING_SIZE 3
+
+static int shard_test_check_mirror(quicrq_fragment_cache_t* cache_ctx, size_t nb_objects)
+{
+    int ret = 0;
+    uint8_t data[SHARD_TEST_OBJECT_SIZE];
+
+    for (size_t i = 0; ret == 0 && i < nb_objects; i++) {
+        uint64_t nb_objects_previous_group = 0;
+        uint8_t flags = 0xff;
+        size_t length = quicrq_fragment_object_copy(cache_ctx, i / 4, i % 4, &nb_objects_previous_group, &flags, data);
+
+        if (length != SHARD_TEST_OBJECT_SIZE || flags != (uint8_t)i ||
+            nb_objects_previous_group != ((i % 4 == 0 && i > 0) ? 4 : 0)) {
+            DBG_PRINTF("Object %zu not mirrored, length %zu", i, length);
+            ret = -1;
+        }
+        for (size_t j = 0; ret == 0 && j < SHARD_TEST_OBJECT_SIZE; j++) {
+            if (data[j] != (uint8_t)(i + j)) {
+                DBG_PRINTF("Object %zu, byte %zu does not match", i, j);
+                ret = -1;
+            }
+        }
+    }
+    if (ret == 0 && quicrq_fragment_cache_get_object(cache_ctx, nb_objects / 4, nb_objects % 4) != NULL) {
+        DBG_PRINTF("Object %zu mirrored too early", nb_objects);
+        ret = -1;
+    }
+    return ret;
+}
+
+int quicrq_shard_test()
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    char const* url = "shard_test";
+    size_t url_length = strlen(url);
+    uint8_t data[SHARD_TEST_OBJECT_SIZE];
+    quicrq_ctx_t* source_ctx = quicrq_create(QUICRQ_ALPN, NULL, NULL, NULL, NULL, NULL, NULL, 0, &simulated_time);
+    quicrq_ctx_t* shard_ctx = quicrq_create(QUICRQ_ALPN, NULL, NULL, NULL, NULL, NULL, NULL, 0, &simulated_time);
+    quicrq_media_object_source_ctx_t* object_source_ctx = (source_ctx == NULL) ? NULL :
+        quicrq_publish_object_source(source_ctx, (const uint8_t*)url, url_length, NULL);
+    quicrq_shard_feed_t* feed = NULL;
+    quicrq_media_source_ctx_t* mirror_srce_ctx = NULL;
+
+    if (shard_ctx == NULL || object_source_ctx == NULL) {
+        ret = -1;
+    }
+
+    for (size_t i = 0; ret == 0 && i < SHARD_TEST_NB_OBJECTS; i++) {
+        quicrq_media_object_properties_t properties = { 0 };
+
+        if (i == SHARD_TEST_NB_BEFORE_FEED) {
+            /* Objects published so far are copied when the feed is created */
+            feed = quicrq_shard_feed_create(source_ctx, (const uint8_t*)url, url_length, shard_ctx, SHARD_TEST_RING_SIZE);
+            if (feed == NULL || quicrq_find_local_media_source(shard_ctx, (const uint8_t*)url, url_length) != NULL ||
+                quicrq_shard_feed_create(source_ctx, (const uint8_t*)url, url_length, shard_ctx, 0) != NULL) {
+                DBG_PRINTF("%s", "Cannot create the shard feed");
+                ret = -1;
+                break;
+            }
+        }
+        properties.flags = (uint8_t)i;
+        for (size_t j = 0; j < SHARD_TEST_OBJECT_SIZE; j++) {
+            data[j] = (uint8_t)(i + j);
+        }
+        ret = quicrq_publish_object(object_source_ctx, data, SHARD_TEST_OBJECT_SIZE, &properties, i / 4, i % 4);
+    }
+
+    if (ret == 0) {
+        /* The ring holds 4 entries, the others wait in the backlog */
+        if (feed->first_backlog == NULL || feed->ring_mask != 3) {
+            DBG_PRINTF("%s", "Expected entries in the backlog");
+            ret = -1;
+        }
+        else {
+            (void)quicrq_time_check(shard_ctx, simulated_time);
+            mirror_srce_ctx = quicrq_find_local_media_source(shard_ctx, (const uint8_t*)url, url_length);
+            if (mirror_srce_ctx == NULL || !feed->is_attached) {
+                DBG_PRINTF("%s", "Mirror not created by the shard");
+                ret = -1;
+            }
+            else {
+                ret = shard_test_check_mirror(mirror_srce_ctx->cache_ctx, 4);
+            }
+        }
+    }
+
+    for (int nb_rounds = 0; ret == 0 && feed->first_backlog != NULL; nb_rounds++) {
+        if (nb_rounds > SHARD_TEST_NB_OBJECTS) {
+            DBG_PRINTF("%s", "The backlog is not flushed");
+            ret = -1;
+        }
+        else {
+            simulated_time += 1000;
+            (void)quicrq_time_check(source_ctx, simulated_time);
+            (void)quicrq_time_check(shard_ctx, simulated_time);
+        }
+    }
+
+    if (ret == 0) {
+        ret = shard_test_check_mirror(mirror_srce_ctx->cache_ctx, SHARD_TEST_NB_OBJECTS);
+    }
+
+    if (ret == 0) {
+        /* Close the source, verify that the closure reaches the mirror */
+        quicrq_publish_object_fin(object_source_ctx);
+        quicrq_delete_object_source(object_source_ctx);
+        object_source_ctx = NULL;
+        if (feed->source_cache_ctx != NULL) {
+            DBG_PRINTF("%s", "Feed still attached to the deleted source");
+            ret = -1;
+        }
+        else {
+            (void)quicrq_shard_feeds_process(shard_ctx, simulated_time);
+            if (!mirror_srce_ctx->cache_ctx->is_feed_closed ||
+                mirror_srce_ctx->cache_ctx->final_group_id != (SHARD_TEST_NB_OBJECTS - 1) / 4 ||
+                mirror_srce_ctx->cache_ctx->final_object_id != 4) {
+                DBG_PRINTF("%s", "Closure not mirrored");
+                ret = -1;
+            }
+        }
+    }
+
+    if (feed != NULL) {
+        /* The shard still uses the feed, it frees it at its next time check */
+        quicrq_shard_feed_delete(feed);
+        if (ret == 0 && (source_ctx->first_shard_feed_out != NULL || shard_ctx->first_shard_feed_in == NULL)) {
+            DBG_PRINTF("%s", "Feed not unlinked from the source");
+            ret = -1;
+        }
+        (void)quicrq_time_check(shard_ctx, simulated_time);
+        if (ret == 0 && shard_ctx->first_shard_feed_in != NULL) {
+            DBG_PRINTF("%s", "Feed not released by the shard");
+            ret = -1;
+        }
+    }
+
+    if (shard_ctx != NULL) {
+        quicrq_delete(shard_ctx);
+    }
+    if (source_ctx != NULL) {
+        quicrq_delete(source_ctx);
+    }
+    return ret;
+}
+
+/* Test of the shard peers, as used by the workers of quicrq_app in server mode.
+ * Context A publishes two media and is set as peer of B and C. Context B
+ * already has an empty source for the first URL, as an origin creates when a
+ * subscription arrives before the media is posted: the feed fills that source.
+ * The other mirrors are created by the shards, and are not mirrored again.
+ */
+#define SHARD_PEERS_TEST_NB_CTX 3
+
+int quicrq_shard_peers_test()
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    char const* url[2] = { "shard_peers_test_1", "shard_peers_test_2" };
+    uint8_t data[SHARD_TEST_OBJECT_SIZE];
+    quicrq_ctx_t* qr_ctx[SHARD_PEERS_TEST_NB_CTX] = { NULL, NULL, NULL };
+    quicrq_media_object_source_ctx_t* object_source_ctx[2] = { NULL, NULL };
+    quicrq_fragment_cache_t* subscribed_cache_ctx = NULL;
+
+    for (int i = 0; ret == 0 && i < SHARD_PEERS_TEST_NB_CTX; i++) {
+        if ((qr_ctx[i] = quicrq_create(QUICRQ_ALPN, NULL, NULL, NULL, NULL, NULL, NULL, 0, &simulated_time)) == NULL) {
+            ret = -1;
+        }
+    }
+    for (int i = 1; ret == 0 && i < SHARD_PEERS_TEST_NB_CTX; i++) {
+        ret = quicrq_set_shard_peers(qr_ctx[i], qr_ctx, SHARD_PEERS_TEST_NB_CTX, 0);
+    }
+    if (ret == 0) {
+        /* Empty source, as created by a subscription on the origin */
+        if ((subscribed_cache_ctx = quicrq_fragment_cache_create_ctx(qr_ctx[1])) == NULL) {
+            ret = -1;
+        }
+        else if ((ret = quicrq_publish_fragment_cached_media(qr_ctx[1], subscribed_cache_ctx,
+            (const uint8_t*)url[0], strlen(url[0]), 0, 0)) != 0) {
+            quicrq_fragment_cache_delete_ctx(subscribed_cache_ctx);
+            subscribed_cache_ctx = NULL;
+        }
+    }
+    for (int m = 0; ret == 0 && m < 2; m++) {
+        if ((object_source_ctx[m] = quicrq_publish_object_source(qr_ctx[0], (const uint8_t*)url[m], strlen(url[m]), NULL)) == NULL) {
+            ret = -1;
+        }
+        for (size_t i = 0; ret == 0 && i < SHARD_TEST_NB_OBJECTS; i++) {
+            quicrq_media_object_properties_t properties = { 0 };
+
+            properties.flags = (uint8_t)i;
+            for (size_t j = 0; j < SHARD_TEST_OBJECT_SIZE; j++) {
+                data[j] = (uint8_t)(i + j);
+            }
+            ret = quicrq_publish_object(object_source_ctx[m], data, SHARD_TEST_OBJECT_SIZE, &properties, i / 4, i % 4);
+        }
+    }
+
+    if (ret == 0 && (ret = quicrq_set_shard_peers(qr_ctx[0], qr_ctx, SHARD_PEERS_TEST_NB_CTX, 0)) == 0) {
+        /* Only the sources of A are fed, once to each other peer */
+        if (qr_ctx[1]->first_shard_feed_out != NULL || qr_ctx[2]->first_shard_feed_out != NULL) {
+            DBG_PRINTF("%s", "Unexpected feeds from the empty peers");
+            ret = -1;
+        }
+        for (int m = 0; ret == 0 && m < 2; m++) {
+            quicrq_media_source_ctx_t* srce_ctx = quicrq_find_local_media_source(qr_ctx[0], (const uint8_t*)url[m], strlen(url[m]));
+            if (srce_ctx == NULL || srce_ctx->cache_ctx->first_shard_feed == NULL ||
+                srce_ctx->cache_ctx->first_shard_feed->next_feed_for_cache == NULL ||
+                srce_ctx->cache_ctx->first_shard_feed->next_feed_for_cache->next_feed_for_cache != NULL) {
+                DBG_PRINTF("Media %d not fed to the two peers", m);
+                ret = -1;
+            }
+        }
+    }
+
+    if (ret == 0) {
+        for (int i = 1; i < SHARD_PEERS_TEST_NB_CTX; i++) {
+            (void)quicrq_time_check(qr_ctx[i], simulated_time);
+        }
+        for (int i = 1; ret == 0 && i < SHARD_PEERS_TEST_NB_CTX; i++) {
+            for (int m = 0; ret == 0 && m < 2; m++) {
+                quicrq_media_source_ctx_t* mirror_srce_ctx = quicrq_find_local_media_source(qr_ctx[i],
+                    (const uint8_t*)url[m], strlen(url[m]));
+                if (mirror_srce_ctx == NULL || mirror_srce_ctx->cache_ctx->shard_feed_in == NULL ||
+                    mirror_srce_ctx->cache_ctx->first_shard_feed != NULL) {
+                    DBG_PRINTF("Media %d not mirrored in context %d", m, i);
+                    ret = -1;
+                }
+                else if (i == 1 && m == 0 && mirror_srce_ctx->cache_ctx != subscribed_cache_ctx) {
+                    DBG_PRINTF("%s", "The subscribed source is not fed");
+                    ret = -1;
+                }
+                else {
+                    ret = shard_test_check_mirror(mirror_srce_ctx->cache_ctx, SHARD_TEST_NB_OBJECTS);
+                }
+            }
+        }
+    }
+
+    for (int m = 0; m < 2; m++) {
+        if (object_source_ctx[m] != NULL) {
+            quicrq_delete_object_source(object_source_ctx[m]);
+        }
+    }
+    for (int i = 0; i < SHARD_PEERS_TEST_NB_CTX; i++) {
+        if (qr_ctx[i] != NULL) {
+            quicrq_delete(qr_ctx[i]);
+        }
+    }
+    return ret;
+}
+
+/* Test of the shard feeds with a source thread and a shard thread running
+ * concurrently. The source thread publishes objects, creates the feed
+ * while both threads run, finishes the media, waits until the shard thread
+ * reports that the mirror is complete, and deletes the feed. The shard
+ * thread only calls its time check when the wakeup function was called, or
+ * when the time check asked for it, so the test also verifies that the
+ * shard is woken up when entries and requests are pushed.
+ */
+#define SHARD_THREAD_TEST_NB_OBJECTS 256
+#define SHARD_THREAD_TEST_NB_BEFORE_FEED 40
+#define SHARD_THREAD_TEST_RING_SIZE 8
+#define SHARD_THREAD_TEST_MAX_WAIT 200000
+#define SHARD_THREAD_TEST_TICK 100
+
+#ifdef _WINDOWS
+typedef HANDLE shard_thread_test_thread_t;
+#else
+typedef pthread_t shard_thread_test_thread_t;
+#endif
+
+typedef struct st_shard_thread_test_ctx_t {
+    char const* url;
+    quicrq_ctx_t* source_ctx;
+    quicrq_ctx_t* shard_ctx;
+    quicrq_media_object_source_ctx_t* object_source_ctx;
+    uint64_t is_shard_woken;
+    uint64_t is_mirror_complete;
+    uint64_t is_stopping;
+    uint64_t shard_time;
+    int source_ret;
+    int shard_ret;
+} shard_thread_test_ctx_t;
+
+static void shard_thread_test_sleep()
+{
+#ifdef _WINDOWS
+    Sleep(0);
+#else
+    (void)usleep(SHARD_THREAD_TEST_TICK);
+#endif
+}
+
+static void shard_thread_test_wakeup(void* wakeup_ctx)
+{
+    shard_thread_test_ctx_t* test_ctx = (shard_thread_test_ctx_t*)wakeup_ctx;
+
+    quicrq_atomic_store(&test_ctx->is_shard_woken, 1);
+}
+
+static void shard_thread_test_source(shard_thread_test_ctx_t* test_ctx)
+{
+    int ret = 0;
+    uint64_t current_time = 0;
+    uint8_t data[SHARD_TEST_OBJECT_SIZE];
+    quicrq_shard_feed_t* feed = NULL;
+
+    for (size_t i = 0; ret == 0 && i < SHARD_THREAD_TEST_NB_OBJECTS; i++) {
+        quicrq_media_object_properties_t properties = { 0 };
+
+        if (i == SHARD_THREAD_TEST_NB_BEFORE_FEED) {
+            feed = quicrq_shard_feed_create(test_ctx->source_ctx, (const uint8_t*)test_ctx->url, strlen(test_ctx->url),
+                test_ctx->shard_ctx, SHARD_THREAD_TEST_RING_SIZE);
+            if (feed == NULL) {
+                ret = -1;
+                break;
+            }
+        }
+        properties.flags = (uint8_t)i;
+        for (size_t j = 0; j < SHARD_TEST_OBJECT_SIZE; j++) {
+            data[j] = (uint8_t)(i + j);
+        }
+        ret = quicrq_publish_object(test_ctx->object_source_ctx, data, SHARD_TEST_OBJECT_SIZE, &properties, i / 4, i % 4);
+        current_time += SHARD_THREAD_TEST_TICK;
+        (void)quicrq_time_check(test_ctx->source_ctx, current_time);
+    }
+    if (ret == 0) {
+        int nb_waits = 0;
+
+        quicrq_publish_object_fin(test_ctx->object_source_ctx);
+        while (quicrq_atomic_load(&test_ctx->is_mirror_complete) == 0 && nb_waits < SHARD_THREAD_TEST_MAX_WAIT) {
+            /* Keep flushing the backlog as the shard empties the ring */
+            current_time += SHARD_THREAD_TEST_TICK;
+            (void)quicrq_time_check(test_ctx->source_ctx, current_time);
+            shard_thread_test_sleep();
+            nb_waits++;
+        }
+        if (quicrq_atomic_load(&test_ctx->is_mirror_complete) == 0) {
+            ret = -1;
+        }
+    }
+    if (feed != NULL) {
+        /* The shard thread still runs, and will find the feed detached */
+        quicrq_shard_feed_delete(feed);
+        if (test_ctx->source_ctx->first_shard_feed_out != NULL) {
+            ret = -1;
+        }
+    }
+    test_ctx->source_ret = ret;
+    quicrq_atomic_store(&test_ctx->is_stopping, 1);
+}
+
+static void shard_thread_test_shard(shard_thread_test_ctx_t* test_ctx)
+{
+    uint64_t current_time = 0;
+    uint64_t next_time = UINT64_MAX;
+    quicrq_media_source_ctx_t* mirror_srce_ctx = NULL;
+    int nb_waits = 0;
+
+    while (quicrq_atomic_load(&test_ctx->is_stopping) == 0 && nb_waits < 2 * SHARD_THREAD_TEST_MAX_WAIT) {
+        current_time += SHARD_THREAD_TEST_TICK;
+        if (quicrq_atomic_exchange(&test_ctx->is_shard_woken, 0) != 0 || current_time >= next_time) {
+            next_time = quicrq_time_check(test_ctx->shard_ctx, current_time);
+            if (mirror_srce_ctx == NULL) {
+                mirror_srce_ctx = quicrq_find_local_media_source(test_ctx->shard_ctx,
+                    (const uint8_t*)test_ctx->url, strlen(test_ctx->url));
+            }
+            if (mirror_srce_ctx != NULL && mirror_srce_ctx->cache_ctx->final_group_id != 0 &&
+                quicrq_fragment_cache_get_object(mirror_srce_ctx->cache_ctx,
+                (SHARD_THREAD_TEST_NB_OBJECTS - 1) / 4, (SHARD_THREAD_TEST_NB_OBJECTS - 1) % 4) != NULL) {
+                quicrq_atomic_store(&test_ctx->is_mirror_complete, 1);
+            }
+        }
+        shard_thread_test_sleep();
+        nb_waits++;
+    }
+    test_ctx->shard_time = current_time;
+    test_ctx->shard_ret = (mirror_srce_ctx == NULL) ? -1 : 0;
+}
+
+#ifdef _WINDOWS
+static DWORD WINAPI shard_thread_test_source_fn(LPVOID v_test_ctx)
+{
+    shard_thread_test_source((shard_thread_test_ctx_t*)v_test_ctx);
+    return 0;
+}
+
+static DWORD WINAPI shard_thread_test_shard_fn(LPVOID v_test_ctx)
+{
+    shard_thread_test_shard((shard_thread_test_ctx_t*)v_test_ctx);
+    return 0;
+}
+#else
+static void* shard_thread_test_source_fn(void* v_test_ctx)
+{
+    shard_thread_test_source((shard_thread_test_ctx_t*)v_test_ctx);
+    return NULL;
+}
+
+static void* shard_thread_test_shard_fn(void* v_test_ctx)
+{
+    shard_thread_test_shard((shard_thread_test_ctx_t*)v_test_ctx);
+    return NULL;
+}
+#endif
+
+static int shard_thread_test_start(shard_thread_test_thread_t* thread_id, int is_shard, shard_thread_test_ctx_t* test_ctx)
+{
+    int ret = 0;
+#ifdef _WINDOWS
+    if ((*thread_id = CreateThread(NULL, 0, (is_shard) ? shard_thread_test_shard_fn : shard_thread_test_source_fn,
+        test_ctx, 0, NULL)) == NULL) {
+        ret = -1;
+    }
+#else
+    if (pthread_create(thread_id, NULL, (is_shard) ? shard_thread_test_shard_fn : shard_thread_test_source_fn,
+        test_ctx) != 0) {
+        ret = -1;
+    }
+#endif
+    return ret;
+}
+
+static void shard_thread_test_wait(shard_thread_test_thread_t thread_id)
+{
+#ifdef _WINDOWS
+    (void)WaitForSingleObject(thread_id, INFINITE);
+    (void)CloseHandle(thread_id);
+#else
+    (void)pthread_join(thread_id, NULL);
+#endif
+}
+
+int quicrq_shard_thread_test()
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    shard_thread_test_ctx_t test_ctx;
+    shard_thread_test_thread_t shard_thread;
+    shard_thread_test_thread_t source_thread;
+    int is_shard_started = 0;
+
+    memset(&test_ctx, 0, sizeof(test_ctx));
+    test_ctx.url = "shard_thread_test";
+    test_ctx.source_ctx = quicrq_create(QUICRQ_ALPN, NULL, NULL, NULL, NULL, NULL, NULL, 0, &simulated_time);
+    test_ctx.shard_ctx = quicrq_create(QUICRQ_ALPN, NULL, NULL, NULL, NULL, NULL, NULL, 0, &simulated_time);
+    test_ctx.object_source_ctx = (test_ctx.source_ctx == NULL) ? NULL :
+        quicrq_publish_object_source(test_ctx.source_ctx, (const uint8_t*)test_ctx.url, strlen(test_ctx.url), NULL);
+
+    if (test_ctx.shard_ctx == NULL || test_ctx.object_source_ctx == NULL) {
+        ret = -1;
+    }
+    else {
+        /* The wakeup function is set before the threads start */
+        quicrq_set_publish_wakeup_fn(test_ctx.shard_ctx, shard_thread_test_wakeup, &test_ctx);
+        if ((ret = shard_thread_test_start(&shard_thread, 1, &test_ctx)) == 0) {
+            is_shard_started = 1;
+            if ((ret = shard_thread_test_start(&source_thread, 0, &test_ctx)) == 0) {
+                shard_thread_test_wait(source_thread);
+            }
+            else {
+                quicrq_atomic_store(&test_ctx.is_stopping, 1);
+            }
+        }
+    }
+    if (is_shard_started) {
+        shard_thread_test_wait(shard_thread);
+    }
+
+    if (ret == 0 && (test_ctx.source_ret != 0 || test_ctx.shard_ret != 0)) {
+        DBG_PRINTF("Thread error, source %d, shard %d", test_ctx.source_ret, test_ctx.shard_ret);
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        /* Both threads stopped: verify the mirror, and let the shard release the deleted feed */
+        quicrq_media_source_ctx_t* mirror_srce_ctx = quicrq_find_local_media_source(test_ctx.shard_ctx,
+            (const uint8_t*)test_ctx.url, strlen(test_ctx.url));
+
+        (void)quicrq_time_check(test_ctx.shard_ctx, test_ctx.shard_time + SHARD_THREAD_TEST_TICK);
+        if (mirror_srce_ctx == NULL || test_ctx.shard_ctx->first_shard_feed_in != NULL ||
+            !mirror_srce_ctx->cache_ctx->is_feed_closed ||
+            shard_test_check_mirror(mirror_srce_ctx->cache_ctx, SHARD_THREAD_TEST_NB_OBJECTS) != 0) {
+            DBG_PRINTF("%s", "Mirror incomplete, or feed not released");
+            ret = -1;
+        }
+    }
+
+    if (test_ctx.shard_ctx != NULL) {
+        quicrq_delete(test_ctx.shard_ctx);
+    }
+    if (test_ctx.source_ctx != NULL) {
+        quicrq_delete(test_ctx.source_ctx);
+    }
+    return ret;
+}
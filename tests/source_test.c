@@ -0,0 +1,563 @@
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "quicrq.h"
+#include "quicrq_internal.h"
+#include "quicrq_fragment.h"
+#include "quicrq_test_internal.h"
+
+/* Unit tests of the index of local media sources.
+ * Publish a large set of sources, verify that exact lookups and prefix
+ * iterations find exactly the expected sources, then delete half of the
+ * sources and verify again.
+ */
+#define SOURCE_TEST_NB_URL 300
+#define SOURCE_TEST_NB_PREFIX 3
+
+static const char* source_test_prefix[SOURCE_TEST_NB_PREFIX] = {
+    "/conf/a/", "/conf/b/", "/live/"
+};
+
+static size_t source_test_url(char* buffer, size_t buffer_size, int i)
+{
+    return (size_t)snprintf(buffer, buffer_size, "%s%d", source_test_prefix[i % SOURCE_TEST_NB_PREFIX], i);
+}
+
+static int source_test_count_prefix(quicrq_ctx_t* qr_ctx, const char* prefix, int* nb_found)
+{
+    int ret = 0;
+    size_t prefix_length = strlen(prefix);
+    quicrq_media_source_ctx_t* srce_ctx = quicrq_first_source_with_prefix(qr_ctx, (const uint8_t*)prefix, prefix_length);
+    const uint8_t* previous_url = NULL;
+    size_t previous_length = 0;
+
+    *nb_found = 0;
+    while (ret == 0 && srce_ctx != NULL) {
+        if (srce_ctx->media_url_length < prefix_length ||
+            memcmp(srce_ctx->media_url, prefix, prefix_length) != 0) {
+            DBG_PRINTF("Source does not match prefix %s", prefix);
+            ret = -1;
+        }
+        else if (previous_url != NULL && previous_length == srce_ctx->media_url_length &&
+            memcmp(previous_url, srce_ctx->media_url, previous_length) == 0) {
+            DBG_PRINTF("Duplicate source for prefix %s", prefix);
+            ret = -1;
+        }
+        else {
+            *nb_found += 1;
+            previous_url = srce_ctx->media_url;
+            previous_length = srce_ctx->media_url_length;
+            srce_ctx = quicrq_next_source_with_prefix(srce_ctx, (const uint8_t*)prefix, prefix_length);
+        }
+    }
+    return ret;
+}
+
+static int source_test_verify(quicrq_ctx_t* qr_ctx, quicrq_media_source_ctx_t** sources)
+{
+    int ret = 0;
+    char url[64];
+    int nb_expected[SOURCE_TEST_NB_PREFIX] = { 0 };
+    int nb_expected_total = 0;
+
+    for (int i = 0; ret == 0 && i < SOURCE_TEST_NB_URL; i++) {
+        size_t url_length = source_test_url(url, sizeof(url), i);
+        quicrq_media_source_ctx_t* srce_ctx = quicrq_find_local_media_source(qr_ctx, (uint8_t*)url, url_length);
+        if (srce_ctx != sources[i]) {
+            DBG_PRINTF("Lookup of %s returns %p instead of %p", url, srce_ctx, sources[i]);
+            ret = -1;
+        }
+        else if (srce_ctx != NULL) {
+            nb_expected[i % SOURCE_TEST_NB_PREFIX] += 1;
+            nb_expected_total++;
+        }
+    }
+
+    if (ret == 0 && quicrq_find_local_media_source(qr_ctx, (uint8_t*)"/conf/a/", 8) != NULL) {
+        DBG_PRINTF("%s", "Prefix should not match as a source");
+        ret = -1;
+    }
+
+    for (int p = 0; ret == 0 && p < SOURCE_TEST_NB_PREFIX; p++) {
+        int nb_found = 0;
+        ret = source_test_count_prefix(qr_ctx, source_test_prefix[p], &nb_found);
+        if (ret == 0 && nb_found != nb_expected[p]) {
+            DBG_PRINTF("Prefix %s, found %d instead of %d", source_test_prefix[p], nb_found, nb_expected[p]);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        /* Shorter prefixes cover several branches, the empty prefix covers everything */
+        int nb_found = 0;
+        ret = source_test_count_prefix(qr_ctx, "/conf/", &nb_found);
+        if (ret == 0 && nb_found != nb_expected[0] + nb_expected[1]) {
+            DBG_PRINTF("Prefix /conf/, found %d instead of %d", nb_found, nb_expected[0] + nb_expected[1]);
+            ret = -1;
+        }
+        if (ret == 0) {
+            ret = source_test_count_prefix(qr_ctx, "", &nb_found);
+            if (ret == 0 && nb_found != nb_expected_total) {
+                DBG_PRINTF("Empty prefix, found %d instead of %d", nb_found, nb_expected_total);
+                ret = -1;
+            }
+        }
+        if (ret == 0) {
+            ret = source_test_count_prefix(qr_ctx, "/none/", &nb_found);
+            if (ret == 0 && nb_found != 0) {
+                DBG_PRINTF("Prefix /none/, found %d instead of 0", nb_found);
+                ret = -1;
+            }
+        }
+    }
+
+    if (ret == 0 && qr_ctx->nb_sources != (size_t)nb_expected_total) {
+        DBG_PRINTF("Index has %zu sources instead of %d", qr_ctx->nb_sources, nb_expected_total);
+        ret = -1;
+    }
+
+    return ret;
+}
+
+int quicrq_source_index_test()
+{
+    int ret = 0;
+    char url[64];
+    quicrq_media_source_ctx_t* sources[SOURCE_TEST_NB_URL] = { 0 };
+    quicrq_ctx_t* qr_ctx = quicrq_create_empty();
+
+    if (qr_ctx == NULL) {
+        ret = -1;
+    }
+
+    for (int i = 0; ret == 0 && i < SOURCE_TEST_NB_URL; i++) {
+        size_t url_length = source_test_url(url, sizeof(url), i);
+        quicrq_fragment_cache_t* cache_ctx = quicrq_fragment_cache_create_ctx(qr_ctx);
+
+        if (cache_ctx == NULL) {
+            ret = -1;
+        }
+        else if (quicrq_publish_fragment_cached_media(qr_ctx, cache_ctx, (uint8_t*)url, url_length, 0, 0) != 0) {
+            DBG_PRINTF("Cannot publish %s", url);
+            free(cache_ctx);
+            ret = -1;
+        }
+        else {
+            sources[i] = cache_ctx->srce_ctx;
+        }
+    }
+
+    if (ret == 0) {
+        ret = source_test_verify(qr_ctx, sources);
+    }
+
+    /* Delete one source out of two, check that the index is updated */
+    for (int i = 0; ret == 0 && i < SOURCE_TEST_NB_URL; i += 2) {
+        quicrq_delete_source(sources[i], qr_ctx);
+        sources[i] = NULL;
+    }
+
+    if (ret == 0) {
+        ret = source_test_verify(qr_ctx, sources);
+    }
+
+    if (qr_ctx != NULL) {
+        quicrq_delete(qr_ctx);
+    }
+
+    return ret;
+}
+
+/* Unit test of the batched wakeup of the streams of a source.
+ * Add many fragments to a source with many subscribers, and verify
+ * that the source is queued only once, that the streams are only
+ * woken up when the queue is flushed, and that deleting a source
+ * removes it from the queue, in the middle or at the end.
+ */
+#define SOURCE_WAKEUP_TEST_NB_STREAMS 20
+#define SOURCE_WAKEUP_TEST_NB_FRAGMENTS 10
+#define SOURCE_WAKEUP_TEST_NB_SOURCES 3
+
+static int source_wakeup_test_nb_pending(quicrq_ctx_t* qr_ctx)
+{
+    int nb_pending = 0;
+    quicrq_media_source_ctx_t* srce_ctx = qr_ctx->first_pending_wakeup;
+
+    while (srce_ctx != NULL) {
+        nb_pending++;
+        srce_ctx = srce_ctx->next_pending_wakeup;
+    }
+    return nb_pending;
+}
+
+static int source_wakeup_test_nb_active(quicrq_stream_ctx_t** streams)
+{
+    int nb_active = 0;
+
+    for (int i = 0; i < SOURCE_WAKEUP_TEST_NB_STREAMS; i++) {
+        nb_active += streams[i]->is_active_datagram;
+    }
+    return nb_active;
+}
+
+int quicrq_source_wakeup_test()
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    struct sockaddr_storage addr = { 0 };
+    uint8_t data[256];
+    char url[SOURCE_WAKEUP_TEST_NB_SOURCES][16] = { "/wakeup/0", "/wakeup/1", "/wakeup/2" };
+    quicrq_fragment_cache_t* cache_ctx[SOURCE_WAKEUP_TEST_NB_SOURCES] = { 0 };
+    quicrq_stream_ctx_t* streams[SOURCE_WAKEUP_TEST_NB_STREAMS] = { 0 };
+    quicrq_ctx_t* qr_ctx = quicrq_create(QUICRQ_ALPN, NULL, NULL, NULL, NULL, NULL, NULL, 0, &simulated_time);
+    quicrq_cnx_ctx_t* cnx_ctx = (qr_ctx == NULL) ? NULL : quicrq_create_client_cnx(qr_ctx, NULL, (struct sockaddr*)&addr);
+
+    memset(data, 0x5a, sizeof(data));
+
+    if (cnx_ctx == NULL) {
+        ret = -1;
+    }
+
+    for (int i = 0; ret == 0 && i < SOURCE_WAKEUP_TEST_NB_SOURCES; i++) {
+        if ((cache_ctx[i] = quicrq_fragment_cache_create_ctx(qr_ctx)) == NULL) {
+            ret = -1;
+        }
+        else if (quicrq_publish_fragment_cached_media(qr_ctx, cache_ctx[i], (uint8_t*)url[i], strlen(url[i]), 0, 0) != 0) {
+            free(cache_ctx[i]);
+            ret = -1;
+        }
+    }
+
+    for (int i = 0; ret == 0 && i < SOURCE_WAKEUP_TEST_NB_STREAMS; i++) {
+        if ((streams[i] = quicrq_create_stream_context(cnx_ctx, 4 * (uint64_t)i)) == NULL) {
+            ret = -1;
+        }
+        else {
+            streams[i]->transport_mode = quicrq_transport_mode_datagram;
+            streams[i]->is_sender = 1;
+            streams[i]->media_id = i;
+            ret = quicrq_subscribe_local_media(streams[i], (uint8_t*)url[0], strlen(url[0]));
+        }
+    }
+
+    for (uint64_t i = 0; ret == 0 && i < SOURCE_WAKEUP_TEST_NB_FRAGMENTS; i++) {
+        ret = quicrq_fragment_propose_to_cache(cache_ctx[0], data, 0, i, 0, 0, 0, 0, sizeof(data), sizeof(data), simulated_time);
+    }
+
+    for (int i = 1; ret == 0 && i < SOURCE_WAKEUP_TEST_NB_SOURCES; i++) {
+        ret = quicrq_fragment_propose_to_cache(cache_ctx[i], data, 0, 0, 0, 0, 0, 0, sizeof(data), sizeof(data), simulated_time);
+    }
+
+    if (ret == 0 && (source_wakeup_test_nb_pending(qr_ctx) != SOURCE_WAKEUP_TEST_NB_SOURCES ||
+        source_wakeup_test_nb_active(streams) != 0)) {
+        DBG_PRINTF("%d sources pending, %d streams active before flush",
+            source_wakeup_test_nb_pending(qr_ctx), source_wakeup_test_nb_active(streams));
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        /* Deleting the source in the middle of the queue links its neighbors */
+        quicrq_delete_source(cache_ctx[1]->srce_ctx, qr_ctx);
+        cache_ctx[1] = NULL;
+        if (source_wakeup_test_nb_pending(qr_ctx) != 2 ||
+            cache_ctx[0]->srce_ctx->next_pending_wakeup != cache_ctx[2]->srce_ctx ||
+            cache_ctx[2]->srce_ctx->previous_pending_wakeup != cache_ctx[0]->srce_ctx) {
+            DBG_PRINTF("%s", "Deleted source not removed from the middle of the wakeup queue");
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        /* Deleting the last source of the queue updates the end of the queue */
+        quicrq_delete_source(cache_ctx[2]->srce_ctx, qr_ctx);
+        cache_ctx[2] = NULL;
+        if (source_wakeup_test_nb_pending(qr_ctx) != 1 || qr_ctx->last_pending_wakeup != cache_ctx[0]->srce_ctx ||
+            cache_ctx[0]->srce_ctx->next_pending_wakeup != NULL) {
+            DBG_PRINTF("%s", "Deleted source not removed from wakeup queue");
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        quicrq_source_wakeup_flush(qr_ctx);
+        if (source_wakeup_test_nb_pending(qr_ctx) != 0 || qr_ctx->last_pending_wakeup != NULL ||
+            cache_ctx[0]->srce_ctx->is_wakeup_pending ||
+            source_wakeup_test_nb_active(streams) != SOURCE_WAKEUP_TEST_NB_STREAMS) {
+            DBG_PRINTF("%d sources pending, %d streams active after flush",
+                source_wakeup_test_nb_pending(qr_ctx), source_wakeup_test_nb_active(streams));
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        /* New data after the flush queues the source again */
+        ret = quicrq_fragment_propose_to_cache(cache_ctx[0], data, 1, 0, 0, 0, 0, 0, sizeof(data), sizeof(data), simulated_time);
+        if (ret == 0 && source_wakeup_test_nb_pending(qr_ctx) != 1) {
+            DBG_PRINTF("%s", "Source not queued after flush");
+            ret = -1;
+        }
+    }
+
+    if (qr_ctx != NULL) {
+        /* This will also delete the streams and the remaining source */
+        quicrq_delete(qr_ctx);
+    }
+
+    return ret;
+}
+
+/* Unit test of the publish queue.
+ * Queue objects for a media object source, as a thread of the encoder would,
+ * and verify that the wakeup function is only called when the queue was idle,
+ * that nothing is published before the time check, and that the objects, the
+ * out of order object and the end point are processed when the queue is drained.
+ * Then queue an object that is never drained, and delete the source.
+ */
+#define PUBLISH_QUEUE_TEST_NB_OBJECTS 6
+#define PUBLISH_QUEUE_TEST_OBJECT_SIZE 32
+
+static void publish_queue_test_wakeup(void* publish_wakeup_ctx)
+{
+    (*(int*)publish_wakeup_ctx)++;
+}
+
+int quicrq_publish_queue_test()
+{
+    int ret = 0;
+    int nb_wakeups = 0;
+    uint64_t simulated_time = 0;
+    char const* url = "publish_queue_test";
+    uint8_t data[PUBLISH_QUEUE_TEST_OBJECT_SIZE];
+    quicrq_ctx_t* qr_ctx = quicrq_create(QUICRQ_ALPN, NULL, NULL, NULL, NULL, NULL, NULL, 0, &simulated_time);
+    quicrq_media_object_source_ctx_t* object_source_ctx = (qr_ctx == NULL) ? NULL :
+        quicrq_publish_object_source(qr_ctx, (const uint8_t*)url, strlen(url), NULL);
+
+    if (object_source_ctx == NULL) {
+        ret = -1;
+    }
+    else {
+        quicrq_set_publish_wakeup_fn(qr_ctx, publish_queue_test_wakeup, &nb_wakeups);
+    }
+
+    for (int pass = 0; ret == 0 && pass < 2; pass++) {
+        for (size_t i = 0; ret == 0 && i < PUBLISH_QUEUE_TEST_NB_OBJECTS; i++) {
+            quicrq_media_object_properties_t properties = { 0 };
+            size_t rank = pass * PUBLISH_QUEUE_TEST_NB_OBJECTS + i;
+
+            properties.flags = (uint8_t)rank;
+            memset(data, (int)rank, sizeof(data));
+            ret = quicrq_publish_object_queued(object_source_ctx, data, sizeof(data), &properties, rank / 4, rank % 4);
+        }
+        if (ret == 0 && pass == 1) {
+            /* Out of order object, dropped when the queue is drained */
+            ret = quicrq_publish_object_queued(object_source_ctx, data, sizeof(data), NULL, 7, 0);
+            if (ret == 0) {
+                ret = quicrq_publish_object_fin_queued(object_source_ctx);
+            }
+        }
+        if (ret == 0 && (nb_wakeups != pass + 1 ||
+            quicrq_fragment_cache_get_object(object_source_ctx->cache_ctx,
+                (pass * PUBLISH_QUEUE_TEST_NB_OBJECTS) / 4, (pass * PUBLISH_QUEUE_TEST_NB_OBJECTS) % 4) != NULL ||
+            object_source_ctx->next_group_id != (uint64_t)pass)) {
+            DBG_PRINTF("Pass %d, unexpected state before drain, %d wakeups", pass, nb_wakeups);
+            ret = -1;
+        }
+        if (ret == 0) {
+            (void)quicrq_time_check(qr_ctx, simulated_time);
+            if (qr_ctx->is_publish_queue_pending != 0 ||
+                object_source_ctx->publish_queue.queue.tail != object_source_ctx->publish_queue.queue.head) {
+                DBG_PRINTF("Pass %d, queue not drained", pass);
+                ret = -1;
+            }
+        }
+    }
+
+    for (size_t rank = 0; ret == 0 && rank < 2 * PUBLISH_QUEUE_TEST_NB_OBJECTS; rank++) {
+        uint64_t nb_objects_previous_group = 0;
+        uint8_t flags = 0xff;
+        size_t length = quicrq_fragment_object_copy(object_source_ctx->cache_ctx, rank / 4, rank % 4,
+            &nb_objects_previous_group, &flags, data);
+
+        if (length != sizeof(data) || flags != (uint8_t)rank || data[0] != (uint8_t)rank ||
+            data[sizeof(data) - 1] != (uint8_t)rank) {
+            DBG_PRINTF("Queued object %zu not published", rank);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0 && (quicrq_get_publish_queue_errors(object_source_ctx) != 1 ||
+        object_source_ctx->cache_ctx->final_group_id != 2 ||
+        object_source_ctx->cache_ctx->final_object_id != 4)) {
+        DBG_PRINTF("%s", "Out of order object or end point not processed");
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        /* Leave an object in the queue, it is freed with the source */
+        ret = quicrq_publish_object_queued(object_source_ctx, data, sizeof(data), NULL, 3, 0);
+    }
+
+    if (qr_ctx != NULL) {
+        quicrq_delete(qr_ctx);
+    }
+    return ret;
+}
+
+/* Unit test of the publication without copy.
+ * Publish objects allocated by the application, verify that the cache points
+ * to them instead of copying them, that an object rejected by the numbering
+ * rules is released immediately, and that all objects are released once
+ * the source is deleted.
+ */
+#define PUBLISH_EX_TEST_NB_OBJECTS 5
+#define PUBLISH_EX_TEST_OBJECT_SIZE 1000
+
+typedef struct st_publish_ex_test_release_t {
+    int nb_released;
+    size_t bytes_released;
+} publish_ex_test_release_t;
+
+static void publish_ex_test_release(void* release_ctx, uint8_t* object, size_t object_length)
+{
+    publish_ex_test_release_t* release = (publish_ex_test_release_t*)release_ctx;
+
+    release->nb_released++;
+    release->bytes_released += object_length;
+    free(object);
+}
+
+int quicrq_publish_object_ex_test()
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    char const* url = "publish_ex_test";
+    publish_ex_test_release_t release = { 0 };
+    quicrq_ctx_t* qr_ctx = quicrq_create(QUICRQ_ALPN, NULL, NULL, NULL, NULL, NULL, NULL, 0, &simulated_time);
+    quicrq_media_object_source_ctx_t* object_source_ctx = (qr_ctx == NULL) ? NULL :
+        quicrq_publish_object_source(qr_ctx, (const uint8_t*)url, strlen(url), NULL);
+
+    if (object_source_ctx == NULL) {
+        ret = -1;
+    }
+
+    for (int i = 0; ret == 0 && i <= PUBLISH_EX_TEST_NB_OBJECTS; i++) {
+        quicrq_media_object_properties_t properties = { 0 };
+        uint8_t* object = (uint8_t*)malloc(PUBLISH_EX_TEST_OBJECT_SIZE);
+
+        if (object == NULL) {
+            ret = -1;
+            break;
+        }
+        memset(object, i, PUBLISH_EX_TEST_OBJECT_SIZE);
+        if (i < PUBLISH_EX_TEST_NB_OBJECTS) {
+            quicrq_cached_fragment_t* fragment;
+
+            ret = quicrq_publish_object_ex(object_source_ctx, object, PUBLISH_EX_TEST_OBJECT_SIZE, &properties,
+                0, i, publish_ex_test_release, &release);
+            fragment = object_source_ctx->cache_ctx->last_fragment;
+            if (ret == 0 && (fragment == NULL || fragment->data != object || fragment->object_id != (uint64_t)i ||
+                release.nb_released != 0)) {
+                DBG_PRINTF("Object %d was copied or released", i);
+                ret = -1;
+            }
+        }
+        else if (quicrq_publish_object_ex(object_source_ctx, object, PUBLISH_EX_TEST_OBJECT_SIZE, &properties,
+            0, i + 1, publish_ex_test_release, &release) == 0 || release.nb_released != 1) {
+            /* Object out of order, rejected and released */
+            DBG_PRINTF("%s", "Rejected object not released");
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        uint8_t data[PUBLISH_EX_TEST_OBJECT_SIZE];
+        uint64_t nb_objects_previous_group = 0;
+        uint8_t flags = 0;
+
+        if (quicrq_fragment_object_copy(object_source_ctx->cache_ctx, 0, 2, &nb_objects_previous_group, &flags, data) !=
+            PUBLISH_EX_TEST_OBJECT_SIZE || data[0] != 2 || data[PUBLISH_EX_TEST_OBJECT_SIZE - 1] != 2) {
+            DBG_PRINTF("%s", "Cannot read object from the cache");
+            ret = -1;
+        }
+    }
+
+    if (object_source_ctx != NULL) {
+        quicrq_delete_object_source(object_source_ctx);
+    }
+    if (ret == 0 && (release.nb_released != PUBLISH_EX_TEST_NB_OBJECTS + 1 ||
+        release.bytes_released != (PUBLISH_EX_TEST_NB_OBJECTS + 1) * PUBLISH_EX_TEST_OBJECT_SIZE)) {
+        DBG_PRINTF("Released %d objects after deleting the source", release.nb_released);
+        ret = -1;
+    }
+
+    if (qr_ctx != NULL) {
+        quicrq_delete(qr_ctx);
+    }
+    return ret;
+}
+
+/* Publishing without a release function is rejected, and the object stays
+ * owned by the application. External buffers without a release function
+ * only free their header, from the pool of the header size.
+ */
+int quicrq_publish_object_ex_null_test()
+{
+    int ret = 0;
+    uint64_t simulated_time = 0;
+    char const* url = "publish_ex_null_test";
+    uint8_t object[PUBLISH_EX_TEST_OBJECT_SIZE];
+    quicrq_ctx_t* qr_ctx = quicrq_create(QUICRQ_ALPN, NULL, NULL, NULL, NULL, NULL, NULL, 0, &simulated_time);
+    quicrq_media_object_source_ctx_t* object_source_ctx = (qr_ctx == NULL) ? NULL :
+        quicrq_publish_object_source(qr_ctx, (const uint8_t*)url, strlen(url), NULL);
+
+    memset(object, 0x5a, sizeof(object));
+    if (object_source_ctx == NULL) {
+        ret = -1;
+    }
+    else {
+        quicrq_media_object_properties_t properties = { 0 };
+
+        if (quicrq_publish_object_ex(object_source_ctx, object, sizeof(object), &properties,
+            0, 0, NULL, NULL) == 0 || object_source_ctx->cache_ctx->last_fragment != NULL) {
+            DBG_PRINTF("%s", "Object published without release function");
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        quicrq_pool_stats_t header_before;
+        quicrq_pool_stats_t data_before;
+        quicrq_pool_stats_t header_stats;
+        quicrq_pool_stats_t data_stats;
+        quicrq_fragment_buffer_t* buffer = NULL;
+
+        if (quicrq_get_pool_stats(qr_ctx, quicrq_pool_data_128, &header_before) != 0 ||
+            quicrq_get_pool_stats(qr_ctx, quicrq_pool_data_2048, &data_before) != 0 ||
+            (buffer = quicrq_fragment_buffer_create_external(qr_ctx, object, sizeof(object), NULL, NULL)) == NULL) {
+            ret = -1;
+        }
+        else {
+            quicrq_fragment_buffer_hold(buffer);
+            quicrq_fragment_buffer_release(buffer);
+            quicrq_fragment_buffer_release(buffer);
+            if (quicrq_get_pool_stats(qr_ctx, quicrq_pool_data_128, &header_stats) != 0 ||
+                quicrq_get_pool_stats(qr_ctx, quicrq_pool_data_2048, &data_stats) != 0 ||
+                header_stats.nb_in_use != header_before.nb_in_use ||
+                header_stats.nb_alloc != header_before.nb_alloc + 1 ||
+                data_stats.nb_alloc != data_before.nb_alloc ||
+                data_stats.nb_free != data_before.nb_free ||
+                data_stats.nb_released != data_before.nb_released || object[0] != 0x5a) {
+                DBG_PRINTF("%s", "External buffer without release function not freed as header");
+                ret = -1;
+            }
+        }
+    }
+
+    if (object_source_ctx != NULL) {
+        quicrq_delete_object_source(object_source_ctx);
+    }
+    if (qr_ctx != NULL) {
+        quicrq_delete(qr_ctx);
+    }
+    return ret;
+}
@@ -0,0 +1,342 @@
+#include <string.h>
+#include <stdlib.h>
+#include <picoquic.h>
+#include <picoquic_utils.h>
+#include "quicrq.h"
+#include "quicrq_internal.h"
+#include "quicrq_fragment.h"
+#include "quicrq_test_internal.h"
+
+/* Unit test of the delay histogram.
+ * Verify that values are placed in a bucket that contains them, that the
+ * buckets are within 1/8th of their values, and that the percentiles
+ * of a uniform distribution are found within that precision.
+ */
+#define DELAY_HISTOGRAM_TEST_NB_VALUES 10000
+
+int quicrq_delay_histogram_test()
+{
+    int ret = 0;
+    uint64_t value = 0;
+    quicrq_delay_histogram_t* histogram = (quicrq_delay_histogram_t*)malloc(sizeof(quicrq_delay_histogram_t));
+    quicrq_delay_histogram_t* merged = (quicrq_delay_histogram_t*)malloc(sizeof(quicrq_delay_histogram_t));
+
+    if (histogram == NULL || merged == NULL) {
+        ret = -1;
+    }
+    else {
+        memset(histogram, 0, sizeof(quicrq_delay_histogram_t));
+        memset(merged, 0, sizeof(quicrq_delay_histogram_t));
+    }
+
+    /* The last bucket is open ended */
+    while (ret == 0 && value < ((uint64_t)15 << 32)) {
+        size_t index = quicrq_delay_histogram_index(value);
+        uint64_t bucket_max = quicrq_delay_histogram_bucket_max(index);
+        uint64_t bucket_min = (index == 0) ? 0 : quicrq_delay_histogram_bucket_max(index - 1) + 1;
+
+        if (index >= QUICRQ_DELAY_HISTOGRAM_BUCKETS || value < bucket_min || value > bucket_max ||
+            (bucket_max - bucket_min) * 8 > bucket_min) {
+            DBG_PRINTF("Value %" PRIu64 " in bucket %zu, [%" PRIu64 ", %" PRIu64 "]", value, index, bucket_min, bucket_max);
+            ret = -1;
+        }
+        value += (value < 1000) ? 1 : value / 7;
+    }
+
+    if (ret == 0 && quicrq_delay_histogram_index(UINT64_MAX) != QUICRQ_DELAY_HISTOGRAM_BUCKETS - 1) {
+        DBG_PRINTF("%s", "Large values not in the last bucket");
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        for (uint64_t i = 1; i <= DELAY_HISTOGRAM_TEST_NB_VALUES; i++) {
+            quicrq_delay_histogram_record((i % 2 == 0) ? histogram : merged, i * 10);
+        }
+        quicrq_delay_histogram_merge(histogram, merged);
+        if (histogram->nb_samples != DELAY_HISTOGRAM_TEST_NB_VALUES ||
+            histogram->max_value != 10 * DELAY_HISTOGRAM_TEST_NB_VALUES ||
+            quicrq_delay_histogram_percentile(histogram, 100.0) != 10 * DELAY_HISTOGRAM_TEST_NB_VALUES) {
+            DBG_PRINTF("%s", "Merge failed");
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        double percentiles[4] = { 10.0, 50.0, 90.0, 99.0 };
+
+        for (int i = 0; ret == 0 && i < 4; i++) {
+            uint64_t expected = (uint64_t)(percentiles[i] * DELAY_HISTOGRAM_TEST_NB_VALUES / 10.0);
+            uint64_t found = quicrq_delay_histogram_percentile(histogram, percentiles[i]);
+
+            if (found < expected || found > expected + expected / 8) {
+                DBG_PRINTF("Percentile %f: found %" PRIu64 " instead of %" PRIu64, percentiles[i], found, expected);
+                ret = -1;
+            }
+        }
+    }
+
+    if (histogram != NULL) {
+        free(histogram);
+    }
+    if (merged != NULL) {
+        free(merged);
+    }
+    return ret;
+}
+
+/* Test of the statistics API.
+ * Receive datagrams on a stream, and verify the counters and the queue delays
+ * of the stream. Verify that the connection statistics keep the counters
+ * after the stream is closed. Publish objects on a local source and verify
+ * the cache statistics. Add an object received in two fragments to the cache,
+ * and verify the per hop latencies of the cache and of the context.
+ */
+#define STATS_TEST_NB_OBJECTS 10
+#define STATS_TEST_OBJECT_SIZE 100
+
+static int stats_test_consumer_fn(
+    quicrq_media_consumer_enum action,
+    void* media_ctx,
+    uint64_t current_time,
+    const uint8_t* data,
+    uint64_t group_id,
+    uint64_t object_id,
+    uint64_t offset,
+    uint64_t queue_delay,
+    uint8_t flags,
+    uint64_t nb_objects_previous_group,
+    uint64_t object_length,
+    size_t data_length)
+{
+#ifdef _WINDOWS
+    UNREFERENCED_PARAMETER(current_time);
+    UNREFERENCED_PARAMETER(data);
+    UNREFERENCED_PARAMETER(group_id);
+    UNREFERENCED_PARAMETER(object_id);
+    UNREFERENCED_PARAMETER(offset);
+    UNREFERENCED_PARAMETER(queue_delay);
+    UNREFERENCED_PARAMETER(flags);
+    UNREFERENCED_PARAMETER(nb_objects_previous_group);
+    UNREFERENCED_PARAMETER(object_length);
+    UNREFERENCED_PARAMETER(data_length);
+#endif
+    if (action == quicrq_media_datagram_ready) {
+        (*(int*)media_ctx)++;
+    }
+    return 0;
+}
+
+static int stats_test_check_received(const quicrq_media_stats_t* media)
+{
+    int ret = 0;
+
+    /* The last object is a placeholder for an object skipped upstream,
+     * the others are sent in two fragments */
+    if (media->fragments_received != 2 * (STATS_TEST_NB_OBJECTS - 1) + 1 ||
+        media->objects_received != STATS_TEST_NB_OBJECTS - 1 ||
+        media->objects_dropped != 1 ||
+        media->bytes_received != (STATS_TEST_NB_OBJECTS - 1) * STATS_TEST_OBJECT_SIZE ||
+        media->fragments_sent != 0 || media->bytes_sent != 0 ||
+        media->queue_delay.nb_samples != media->fragments_received) {
+        DBG_PRINTF("Unexpected counters, %" PRIu64 " fragments, %" PRIu64 " objects received",
+            media->fragments_received, media->objects_received);
+        ret = -1;
+    }
+    else if (media->queue_delay.delay_max != 1000000 * (STATS_TEST_NB_OBJECTS - 1) ||
+        media->queue_delay.delay_p50 > media->queue_delay.delay_p90 ||
+        media->queue_delay.delay_p90 > media->queue_delay.delay_p99 ||
+        media->queue_delay.delay_p99 > media->queue_delay.delay_max ||
+        media->queue_delay.delay_p50 < 4000000 || media->queue_delay.delay_p50 > 5000000 + 5000000 / 8) {
+        DBG_PRINTF("Unexpected queue delays, p50: %" PRIu64 ", max: %" PRIu64,
+            media->queue_delay.delay_p50, media->queue_delay.delay_max);
+        ret = -1;
+    }
+    return ret;
+}
+
+int quicrq_stats_test()
+{
+    int ret = 0;
+    int nb_delivered = 0;
+    uint64_t simulated_time = 0;
+    struct sockaddr_storage addr = { 0 };
+    char const* url = "stats_test";
+    uint8_t data[STATS_TEST_OBJECT_SIZE];
+    quicrq_stream_ctx_t* stream_ctx = NULL;
+    quicrq_media_object_source_ctx_t* object_source_ctx = NULL;
+    quicrq_stream_stats_t stream_stats;
+    quicrq_cnx_stats_t cnx_stats;
+    quicrq_cache_stats_t cache_stats;
+    quicrq_hop_latency_stats_t latency_stats;
+    quicrq_ctx_t* qr_ctx = quicrq_create(QUICRQ_ALPN, NULL, NULL, NULL, NULL, NULL, NULL, 0, &simulated_time);
+    quicrq_cnx_ctx_t* cnx_ctx = (qr_ctx == NULL) ? NULL : quicrq_create_client_cnx(qr_ctx, NULL, (struct sockaddr*)&addr);
+
+    if (cnx_ctx == NULL || (stream_ctx = quicrq_create_stream_context(cnx_ctx, 4)) == NULL) {
+        ret = -1;
+    }
+    else {
+        stream_ctx->transport_mode = quicrq_transport_mode_datagram;
+        stream_ctx->media_id = 1;
+        stream_ctx->consumer_fn = stats_test_consumer_fn;
+        stream_ctx->media_ctx = (void*)&nb_delivered;
+        memset(data, 0x5a, sizeof(data));
+    }
+
+    /* Receive each object in two datagrams, with increasing queue delays */
+    for (uint64_t i = 0; ret == 0 && i < STATS_TEST_NB_OBJECTS; i++) {
+        for (uint64_t offset = 0; ret == 0 && offset < STATS_TEST_OBJECT_SIZE; offset += STATS_TEST_OBJECT_SIZE / 2) {
+            uint8_t datagram[PICOQUIC_MAX_PACKET_SIZE];
+            int is_skipped = (i == STATS_TEST_NB_OBJECTS - 1);
+            size_t length = (is_skipped) ? 0 : STATS_TEST_OBJECT_SIZE / 2;
+            uint8_t* bytes = quicrq_datagram_header_encode(datagram, datagram + sizeof(datagram), 1, 0, i, (is_skipped) ? 0 : offset,
+                1000 * i, (is_skipped) ? 0xff : 0, 0, (is_skipped) ? 0 : STATS_TEST_OBJECT_SIZE);
+
+            if (bytes == NULL) {
+                ret = -1;
+            }
+            else if (!is_skipped || offset == 0) {
+                memcpy(bytes, data, length);
+                ret = quicrq_receive_datagram(cnx_ctx, datagram, (bytes - datagram) + length, simulated_time);
+            }
+        }
+    }
+
+    if (ret == 0) {
+        quicrq_get_stream_stats(stream_ctx, &stream_stats);
+        if (quicrq_first_stream(cnx_ctx) != stream_ctx || quicrq_next_stream(stream_ctx) != NULL ||
+            stream_stats.stream_id != 4 || stream_stats.is_sender ||
+            stream_stats.transport_mode != quicrq_transport_mode_datagram ||
+            nb_delivered != 2 * (STATS_TEST_NB_OBJECTS - 1) + 1) {
+            DBG_PRINTF("Unexpected stream stats, %d delivered", nb_delivered);
+            ret = -1;
+        }
+        else {
+            ret = stats_test_check_received(&stream_stats.media);
+        }
+    }
+
+    if (ret == 0) {
+        /* The counters of the closed stream remain in the connection statistics */
+        stream_ctx->media_ctx = NULL;
+        quicrq_delete_stream_ctx(cnx_ctx, stream_ctx);
+        quicrq_get_cnx_stats(cnx_ctx, &cnx_stats);
+        if (cnx_stats.nb_streams != 0 || cnx_ctx->closed_counters.queue_delay == NULL) {
+            DBG_PRINTF("Unexpected connection stats, %zu streams", cnx_stats.nb_streams);
+            ret = -1;
+        }
+        else {
+            ret = stats_test_check_received(&cnx_stats.media);
+        }
+    }
+
+    if (ret == 0) {
+        object_source_ctx = quicrq_publish_object_source(qr_ctx, (const uint8_t*)url, strlen(url), NULL);
+        if (object_source_ctx == NULL) {
+            ret = -1;
+        }
+        for (uint64_t i = 0; ret == 0 && i < STATS_TEST_NB_OBJECTS; i++) {
+            quicrq_media_object_properties_t properties = { 0 };
+            ret = quicrq_publish_object(object_source_ctx, data, sizeof(data), &properties, i / 4, i % 4);
+        }
+    }
+
+    if (ret == 0) {
+        if (quicrq_get_cache_stats(qr_ctx, (const uint8_t*)"no_such_url", 11, &cache_stats) == 0 ||
+            quicrq_get_cache_stats(qr_ctx, (const uint8_t*)url, strlen(url), &cache_stats) != 0) {
+            DBG_PRINTF("%s", "Cache not found by URL");
+            ret = -1;
+        }
+        else if (cache_stats.cache_bytes != STATS_TEST_NB_OBJECTS * STATS_TEST_OBJECT_SIZE ||
+            cache_stats.nb_objects != STATS_TEST_NB_OBJECTS || cache_stats.nb_fragments != STATS_TEST_NB_OBJECTS ||
+            cache_stats.highest_group_id != (STATS_TEST_NB_OBJECTS - 1) / 4 ||
+            cache_stats.highest_object_id != (STATS_TEST_NB_OBJECTS - 1) % 4 ||
+            cache_stats.nb_readers != 0 || cache_stats.is_feed_closed) {
+            DBG_PRINTF("Unexpected cache stats, %zu bytes, %zu objects", cache_stats.cache_bytes, cache_stats.nb_objects);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        /* The first object of the next group arrives in two fragments, 2ms apart */
+        uint64_t group_id = (STATS_TEST_NB_OBJECTS - 1) / 4 + 1;
+        uint64_t nb_objects_previous_group = (STATS_TEST_NB_OBJECTS - 1) % 4 + 1;
+
+        simulated_time = 1000;
+        ret = quicrq_fragment_propose_to_cache(object_source_ctx->cache_ctx, data, group_id, 0, 0, 7, 0,
+            nb_objects_previous_group, STATS_TEST_OBJECT_SIZE, STATS_TEST_OBJECT_SIZE / 2, simulated_time);
+        if (ret == 0) {
+            simulated_time = 3000;
+            ret = quicrq_fragment_propose_to_cache(object_source_ctx->cache_ctx, data, group_id, 0, STATS_TEST_OBJECT_SIZE / 2, 9, 0,
+                0, STATS_TEST_OBJECT_SIZE, STATS_TEST_OBJECT_SIZE / 2, simulated_time);
+        }
+    }
+
+    if (ret == 0) {
+        quicrq_get_hop_latency_stats(qr_ctx, &latency_stats);
+        if (quicrq_get_cache_stats(qr_ctx, (const uint8_t*)url, strlen(url), &cache_stats) != 0 ||
+            memcmp(&cache_stats.latency, &latency_stats, sizeof(quicrq_hop_latency_stats_t)) != 0) {
+            DBG_PRINTF("%s", "Cache and context latency differ");
+            ret = -1;
+        }
+        else if (latency_stats.upstream_queue_delay.nb_samples != STATS_TEST_NB_OBJECTS + 2 ||
+            latency_stats.upstream_queue_delay.delay_max != 9000 ||
+            latency_stats.receive_to_cache.nb_samples != STATS_TEST_NB_OBJECTS + 1 ||
+            latency_stats.receive_to_cache.delay_max != 2000 ||
+            latency_stats.receive_to_cache.delay_p50 != 0 ||
+            latency_stats.cache_to_send.nb_samples != 0) {
+            DBG_PRINTF("Unexpected latency, %" PRIu64 " upstream samples, receive to cache max %" PRIu64,
+                latency_stats.upstream_queue_delay.nb_samples, latency_stats.receive_to_cache.delay_max);
+            ret = -1;
+        }
+    }
+
+    if (qr_ctx != NULL) {
+        quicrq_delete(qr_ctx);
+    }
+    return ret;
+}
+
+/* Unit test of the object stream consumer statistics.
+ * Objects 1 and 2 of group 0 are received, then the consumer skips ahead to
+ * group 2, starting at object 10, and object 12 is received after object 10.
+ * The 7 objects skipped at the start of group 2 shall be counted as skipped
+ * ahead, and only object 11 as missing.
+ */
+static int quicrq_consumer_stats_test_object(test_object_stream_ctx_t* cons_ctx, uint64_t group_id, uint64_t object_id, uint64_t number)
+{
+    uint8_t data[QUIRRQ_MEDIA_TEST_HEADER_SIZE + 16];
+    quicrq_media_object_header_t header = { 0 };
+
+    memset(data, 0, sizeof(data));
+    header.timestamp = number * 33333;
+    header.number = number;
+    header.length = sizeof(data) - QUIRRQ_MEDIA_TEST_HEADER_SIZE;
+
+    return (quicr_encode_object_header(data, data + QUIRRQ_MEDIA_TEST_HEADER_SIZE, &header) == NULL) ? -1 :
+        test_object_stream_consumer_cb(quicrq_media_datagram_ready, cons_ctx, number * 33333, group_id, object_id,
+            data, sizeof(data), NULL, 0, 0);
+}
+
+int quicrq_consumer_stats_test()
+{
+    int ret = 0;
+    test_object_stream_ctx_t cons_ctx;
+
+    memset(&cons_ctx, 0, sizeof(cons_ctx));
+    ret = quicrq_consumer_stats_test_object(&cons_ctx, 0, 0, 1);
+    if (ret == 0) {
+        ret = quicrq_consumer_stats_test_object(&cons_ctx, 0, 1, 2);
+    }
+    if (ret == 0) {
+        ret = quicrq_consumer_stats_test_object(&cons_ctx, 2, 0, 10);
+    }
+    if (ret == 0) {
+        ret = quicrq_consumer_stats_test_object(&cons_ctx, 2, 2, 12);
+    }
+    if (ret == 0 && (cons_ctx.stats.nb_objects != 4 || cons_ctx.stats.nb_skipped_ahead != 7 || cons_ctx.stats.nb_gaps != 1)) {
+        DBG_PRINTF("Objects %" PRIu64 ", skipped ahead %" PRIu64 ", gaps %" PRIu64,
+            cons_ctx.stats.nb_objects, cons_ctx.stats.nb_skipped_ahead, cons_ctx.stats.nb_gaps);
+        ret = -1;
+    }
+    return ret;
+}
@@ -446,3 +446,105 @@ int quicrq_subscribe_relay3_test()
 
     return ret;
 }
+
+/* Unit test of the prefix trie of subscribe patterns.
+ * Register streams subscribed to nested prefixes, verify that a new URL
+ * is only notified to the streams whose prefix matches, and that the
+ * nodes of the trie are deleted when the last subscriber leaves.
+ */
+#define SUBSCRIBE_TRIE_TEST_NB_STREAMS 6
+
+static int quicrq_subscribe_trie_test_count(quicrq_stream_ctx_t* stream_ctx)
+{
+    int nb_notified = 0;
+
+    while (stream_ctx->first_notify_url != NULL) {
+        quicrq_notify_url_t* next = stream_ctx->first_notify_url->next_notify_url;
+        free(stream_ctx->first_notify_url);
+        stream_ctx->first_notify_url = next;
+        nb_notified++;
+    }
+    return nb_notified;
+}
+
+int quicrq_subscribe_trie_test()
+{
+    int ret = 0;
+    char const* prefixes[SUBSCRIBE_TRIE_TEST_NB_STREAMS] = { "", "media/", "media/video", "media/video", "media/audio", "other" };
+    int expected[SUBSCRIBE_TRIE_TEST_NB_STREAMS] = { 1, 1, 1, 1, 0, 0 };
+    char const* url = "media/video1";
+    quicrq_cnx_ctx_t cnx_ctx = { 0 };
+    quicrq_stream_ctx_t stream_ctx[SUBSCRIBE_TRIE_TEST_NB_STREAMS] = { 0 };
+    quicrq_subscribe_node_t* node = NULL;
+    quicrq_ctx_t* qr_ctx = quicrq_create_empty();
+
+    if (qr_ctx == NULL) {
+        ret = -1;
+    }
+    else {
+        cnx_ctx.qr_ctx = qr_ctx;
+    }
+
+    for (int i = 0; ret == 0 && i < SUBSCRIBE_TRIE_TEST_NB_STREAMS; i++) {
+        stream_ctx[i].cnx_ctx = &cnx_ctx;
+        stream_ctx[i].subscribe_prefix = (uint8_t*)prefixes[i];
+        stream_ctx[i].subscribe_prefix_length = strlen(prefixes[i]);
+        ret = quicrq_subscribe_trie_add(&stream_ctx[i]);
+    }
+
+    if (ret == 0) {
+        node = quicrq_subscribe_trie_find(qr_ctx, (const uint8_t*)"media/video", strlen("media/video"));
+        if (node == NULL || node->nb_subscribers != 2 ||
+            quicrq_subscribe_trie_find(qr_ctx, (const uint8_t*)"media/v", strlen("media/v")) == NULL ||
+            quicrq_subscribe_trie_find(qr_ctx, (const uint8_t*)"media/x", strlen("media/x")) != NULL) {
+            DBG_PRINTF("%s", "Unexpected trie content");
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        ret = quicrq_notify_url_to_all(qr_ctx, (const uint8_t*)url, strlen(url));
+        for (int i = 0; ret == 0 && i < SUBSCRIBE_TRIE_TEST_NB_STREAMS; i++) {
+            int nb_notified = quicrq_subscribe_trie_test_count(&stream_ctx[i]);
+            if (nb_notified != expected[i]) {
+                DBG_PRINTF("Stream %d, prefix <%s>, notified %d times instead of %d", i, prefixes[i], nb_notified, expected[i]);
+                ret = -1;
+            }
+        }
+    }
+
+    if (ret == 0) {
+        /* Removing one of two subscribers keeps the node, removing both deletes the branch */
+        quicrq_subscribe_trie_remove(&stream_ctx[2]);
+        if ((node = quicrq_subscribe_trie_find(qr_ctx, (const uint8_t*)"media/video", strlen("media/video"))) == NULL ||
+            node->nb_subscribers != 1 || node->first_subscriber != &stream_ctx[3]) {
+            DBG_PRINTF("%s", "Node not kept after first removal");
+            ret = -1;
+        }
+        else {
+            quicrq_subscribe_trie_remove(&stream_ctx[3]);
+            if (quicrq_subscribe_trie_find(qr_ctx, (const uint8_t*)"media/v", strlen("media/v")) != NULL ||
+                quicrq_subscribe_trie_find(qr_ctx, (const uint8_t*)"media/", strlen("media/")) == NULL) {
+                DBG_PRINTF("%s", "Branch not pruned after last removal");
+                ret = -1;
+            }
+        }
+    }
+
+    for (int i = 0; i < SUBSCRIBE_TRIE_TEST_NB_STREAMS; i++) {
+        if (stream_ctx[i].cnx_ctx != NULL) {
+            quicrq_subscribe_trie_remove(&stream_ctx[i]);
+        }
+    }
+
+    if (ret == 0 && qr_ctx->subscribe_root.first_child != NULL) {
+        DBG_PRINTF("%s", "Trie not empty after removing all subscribers");
+        ret = -1;
+    }
+
+    if (qr_ctx != NULL) {
+        quicrq_delete(qr_ctx);
+    }
+
+    return ret;
+}
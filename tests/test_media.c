@@ -919,17 +919,27 @@ int test_object_stream_consumer_cb(
 
     switch (action) {
     case quicrq_media_datagram_ready:
+        if (cons_ctx->stats.nb_objects == 0) {
+            cons_ctx->stats.first_object_time = current_time;
+        }
+        cons_ctx->stats.last_object_time = current_time;
+        cons_ctx->stats.nb_objects++;
+        cons_ctx->stats.nb_bytes += data_length;
         /* Special case for zero length objects */
         if (data_length == 0) {
             /* Create a fake header */
             quicrq_media_object_header_t current_header = { 0 };
             uint8_t flags = 0xff;
+            /* Skipped objects still use a number, they are not counted as gaps */
+            cons_ctx->stats.nb_skipped++;
+            cons_ctx->stats.next_number++;
+            cons_ctx->stats.current_group_id = group_id;
             /* Create log entry */
-            if (fprintf(cons_ctx->Log, "%" PRIu64 ",%" PRIu64 ",%" PRIu64  ",%" PRIu64 ",%" PRIu64 ",%zu,%d\n",
+            if (cons_ctx->Log != NULL && fprintf(cons_ctx->Log, "%" PRIu64 ",%" PRIu64 ",%" PRIu64  ",%" PRIu64 ",%" PRIu64 ",%zu,%d\n",
                 group_id, object_id, current_time, current_header.timestamp, current_header.number, current_header.length, flags) <= 0) {
                 ret = -1;
             }
-            if (ret == 0) {
+            if (ret == 0 && cons_ctx->Res != NULL) {
                 uint8_t header_buf[256];
                 uint8_t* fh = quicr_encode_object_header(header_buf, header_buf + sizeof(header_buf), &current_header);
                 if (fh == NULL) {
@@ -956,6 +966,30 @@ int test_object_stream_consumer_cb(
                 ret = -1;
             }
             if (ret == 0) {
+                /* Objects missing from the sequence of numbers after the first one are gaps,
+                 * unless the consumer skipped ahead to a new group */
+                if (cons_ctx->stats.nb_objects > cons_ctx->stats.nb_skipped + 1 &&
+                    current_header.number > cons_ctx->stats.next_number) {
+                    if (group_id > cons_ctx->stats.current_group_id) {
+                        cons_ctx->stats.nb_skipped_ahead += current_header.number - cons_ctx->stats.next_number;
+                    }
+                    else {
+                        cons_ctx->stats.nb_gaps += current_header.number - cons_ctx->stats.next_number;
+                    }
+                }
+                cons_ctx->stats.next_number = current_header.number + 1;
+                cons_ctx->stats.current_group_id = group_id;
+                if (cons_ctx->stats.media_start_time != 0) {
+                    uint64_t produced = cons_ctx->stats.media_start_time + current_header.timestamp;
+                    uint64_t delay = (current_time > produced) ? current_time - produced : 0;
+                    cons_ctx->stats.delay_sum += delay;
+                    cons_ctx->stats.nb_delays++;
+                    if (delay > cons_ctx->stats.delay_max) {
+                        cons_ctx->stats.delay_max = delay;
+                    }
+                }
+            }
+            if (ret == 0 && cons_ctx->Log != NULL) {
                 /* in sequence, document the delivery in the log */
                 uint8_t flags = (properties == NULL) ? 0 : properties->flags;
                 if (fprintf(cons_ctx->Log, "%" PRIu64 ",%" PRIu64 ",%" PRIu64  ",%" PRIu64 ",%" PRIu64 ",%zu,%d\n",
@@ -963,7 +997,7 @@ int test_object_stream_consumer_cb(
                     ret = -1;
                 }
             }
-            if (ret == 0) {
+            if (ret == 0 && cons_ctx->Res != NULL) {
                 /* in sequence, write the data to the file. */
                 if (fwrite(data, 1, data_length, cons_ctx->Res) != data_length) {
                     ret = -1;
@@ -985,35 +1019,42 @@ int test_object_stream_consumer_cb(
     return ret;
 }
 
-test_object_stream_ctx_t* test_object_stream_subscribe_ex(quicrq_cnx_ctx_t* cnx_ctx, const uint8_t* url, size_t url_length,
-    quicrq_transport_mode_enum transport_mode, quicrq_subscribe_order_enum order_required, quicrq_subscribe_intent_t * intent,
-    char const* media_result_file, char const* media_result_log)
+/* Open and initialize result file and log file.
+ * If both names are NULL, no file is written and only the statistics are kept.
+ */
+static test_object_stream_ctx_t* test_object_stream_ctx_create(char const* media_result_file, char const* media_result_log)
 {
-    int ret = 0;
-    /* Open and initialize result file and log file */
     test_object_stream_ctx_t* cons_ctx = (test_object_stream_ctx_t*)malloc(sizeof(test_object_stream_ctx_t));
 
     if (cons_ctx != NULL) {
         int last_err;
         memset(cons_ctx, 0, sizeof(test_object_stream_ctx_t));
 
-        if ((cons_ctx->Res = picoquic_file_open_ex(media_result_file, "wb", &last_err)) == NULL) {
+        if (media_result_file != NULL && (cons_ctx->Res = picoquic_file_open_ex(media_result_file, "wb", &last_err)) == NULL) {
             DBG_PRINTF("Cannot open %s, error: %d (0x%x)", media_result_file, last_err, last_err);
         }
-        if ((cons_ctx->Log = picoquic_file_open_ex(media_result_log, "w", &last_err)) == NULL) {
+        if (media_result_log != NULL && (cons_ctx->Log = picoquic_file_open_ex(media_result_log, "w", &last_err)) == NULL) {
             DBG_PRINTF("Cannot open %s, error: %d (0x%x)", media_result_log, last_err, last_err);
         }
-        if (cons_ctx->Res == NULL || cons_ctx->Log == NULL) {
-            ret = -1;
-        }
-        else {
-            cons_ctx->media_ctx = quicrq_subscribe_object_stream(cnx_ctx, url, url_length, transport_mode, 
-                order_required, intent, test_object_stream_consumer_cb, cons_ctx);
-            if (cons_ctx->media_ctx == NULL) {
-                ret = -1;
-            }
+        if ((cons_ctx->Res == NULL && media_result_file != NULL) || (cons_ctx->Log == NULL && media_result_log != NULL)) {
+            test_object_stream_consumer_close(cons_ctx);
+            cons_ctx = NULL;
         }
-        if (ret != 0){
+    }
+
+    return cons_ctx;
+}
+
+test_object_stream_ctx_t* test_object_stream_subscribe_ex(quicrq_cnx_ctx_t* cnx_ctx, const uint8_t* url, size_t url_length,
+    quicrq_transport_mode_enum transport_mode, quicrq_subscribe_order_enum order_required, quicrq_subscribe_intent_t * intent,
+    char const* media_result_file, char const* media_result_log)
+{
+    test_object_stream_ctx_t* cons_ctx = test_object_stream_ctx_create(media_result_file, media_result_log);
+
+    if (cons_ctx != NULL) {
+        cons_ctx->media_ctx = quicrq_subscribe_object_stream(cnx_ctx, url, url_length, transport_mode, 
+            order_required, intent, test_object_stream_consumer_cb, cons_ctx);
+        if (cons_ctx->media_ctx == NULL) {
             test_object_stream_consumer_close(cons_ctx);
             cons_ctx = NULL;
         }
@@ -1022,6 +1063,44 @@ test_object_stream_ctx_t* test_object_stream_subscribe_ex(quicrq_cnx_ctx_t* cnx_
     return cons_ctx;
 }
 
+/* Subscribe to several media in a single batch, receiving them in order as datagrams. */
+int test_object_stream_subscribe_batch(quicrq_cnx_ctx_t* cnx_ctx, size_t nb_media, const uint8_t** url, const size_t* url_length,
+    char const** media_result_file, char const** media_result_log, test_object_stream_ctx_t** cons_ctx)
+{
+    int ret = 0;
+    void* object_stream_ctx[TEST_OBJECT_STREAM_BATCH_MAX];
+    quicrq_object_stream_consumer_ctx* subscribe_ctx[TEST_OBJECT_STREAM_BATCH_MAX];
+    size_t nb_created = 0;
+
+    if (nb_media > TEST_OBJECT_STREAM_BATCH_MAX) {
+        ret = -1;
+    }
+    while (ret == 0 && nb_created < nb_media) {
+        if ((cons_ctx[nb_created] = test_object_stream_ctx_create(media_result_file[nb_created], media_result_log[nb_created])) == NULL) {
+            ret = -1;
+        }
+        else {
+            object_stream_ctx[nb_created] = cons_ctx[nb_created];
+            nb_created++;
+        }
+    }
+    if (ret == 0) {
+        ret = quicrq_subscribe_object_stream_batch(cnx_ctx, nb_media, url, url_length, quicrq_subscribe_in_order, NULL,
+            test_object_stream_consumer_cb, object_stream_ctx, subscribe_ctx);
+    }
+    for (size_t i = 0; i < nb_created; i++) {
+        if (ret == 0) {
+            cons_ctx[i]->media_ctx = subscribe_ctx[i];
+        }
+        else {
+            test_object_stream_consumer_close(cons_ctx[i]);
+            cons_ctx[i] = NULL;
+        }
+    }
+
+    return ret;
+}
+
 test_object_stream_ctx_t* test_object_stream_subscribe(quicrq_cnx_ctx_t* cnx_ctx, const uint8_t* url, size_t url_length,
     quicrq_transport_mode_enum transport_mode, char const* media_result_file, char const* media_result_log)
 {
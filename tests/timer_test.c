@@ -0,0 +1,102 @@
+#include <string.h>
+#include <stdlib.h>
+#include "quicrq.h"
+#include "quicrq_internal.h"
+#include "quicrq_test_internal.h"
+
+/* Unit tests of the timer heap.
+ * Set a large number of timers in pseudo random order, move and cancel
+ * some of them, then verify that the due timers are returned in order of
+ * deadline, and only when they are due.
+ */
+#define TIMER_TEST_NB_TIMERS 500
+
+static int timer_test_check_heap(quicrq_ctx_t* qr_ctx)
+{
+    int ret = 0;
+
+    for (size_t i = 0; ret == 0 && i < qr_ctx->timers.nb_timers; i++) {
+        if (qr_ctx->timers.heap[i]->heap_index != i + 1 ||
+            (i > 0 && qr_ctx->timers.heap[(i - 1) / 2]->deadline > qr_ctx->timers.heap[i]->deadline)) {
+            DBG_PRINTF("Heap order broken at index %zu", i);
+            ret = -1;
+        }
+    }
+    return ret;
+}
+
+int quicrq_timer_test()
+{
+    int ret = 0;
+    quicrq_timer_t timers[TIMER_TEST_NB_TIMERS];
+    quicrq_timer_t* timer;
+    uint64_t random_state = 0xdeadbeef;
+    uint64_t last_deadline = 0;
+    size_t nb_set = 0;
+    size_t nb_popped = 0;
+    quicrq_ctx_t* qr_ctx = quicrq_create_empty();
+
+    if (qr_ctx == NULL) {
+        ret = -1;
+    }
+
+    for (int i = 0; ret == 0 && i < TIMER_TEST_NB_TIMERS; i++) {
+        random_state = random_state * 6364136223846793005ull + 1442695040888963407ull;
+        quicrq_timer_init(&timers[i], quicrq_timer_extra_repeat);
+        ret = quicrq_timer_set(qr_ctx, &timers[i], 1000 + (random_state >> 40) % 1000000);
+    }
+    nb_set = TIMER_TEST_NB_TIMERS;
+
+    if (ret == 0) {
+        /* Move one timer out of three, cancel one out of five */
+        for (int i = 0; ret == 0 && i < TIMER_TEST_NB_TIMERS; i += 3) {
+            ret = quicrq_timer_set(qr_ctx, &timers[i], timers[i].deadline / 2 + (uint64_t)i * 7);
+        }
+        for (int i = 0; ret == 0 && i < TIMER_TEST_NB_TIMERS; i += 5) {
+            quicrq_timer_cancel(qr_ctx, &timers[i]);
+            quicrq_timer_cancel(qr_ctx, &timers[i]);
+            nb_set--;
+        }
+        if (ret == 0 && (qr_ctx->timers.nb_timers != nb_set || timers[0].heap_index != 0)) {
+            DBG_PRINTF("%zu timers in heap instead of %zu", qr_ctx->timers.nb_timers, nb_set);
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        ret = timer_test_check_heap(qr_ctx);
+    }
+
+    if (ret == 0 && quicrq_timer_pop_due(qr_ctx, quicrq_timer_next_deadline(qr_ctx) - 1) != NULL) {
+        DBG_PRINTF("%s", "Timer returned before its deadline");
+        ret = -1;
+    }
+
+    while (ret == 0 && (timer = quicrq_timer_pop_due(qr_ctx, UINT64_MAX - 1)) != NULL) {
+        if (timer->deadline < last_deadline || timer->heap_index != 0) {
+            DBG_PRINTF("Timer %zu returned out of order", nb_popped);
+            ret = -1;
+        }
+        last_deadline = timer->deadline;
+        nb_popped++;
+        if (nb_popped % 50 == 0) {
+            ret = timer_test_check_heap(qr_ctx);
+        }
+    }
+
+    if (ret == 0 && (nb_popped != nb_set || quicrq_timer_next_deadline(qr_ctx) != UINT64_MAX)) {
+        DBG_PRINTF("%zu timers popped instead of %zu", nb_popped, nb_set);
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        /* Timers left in the heap are released with the context */
+        ret = quicrq_timer_set(qr_ctx, &timers[1], 1);
+    }
+
+    if (qr_ctx != NULL) {
+        quicrq_delete(qr_ctx);
+    }
+
+    return ret;
+}
@@ -52,7 +52,7 @@ quicrq_test_config_t* quicrq_test_two_media_config_create(uint64_t simulate_loss
 }
 
 /* two test */
-int quicrq_twomedia_test_one(int is_real_time, quicrq_transport_mode_enum transport_mode, uint64_t simulate_losses, int is_from_client, size_t min_packet_size, uint64_t extra_delay)
+int quicrq_twomedia_test_one(int is_real_time, quicrq_transport_mode_enum transport_mode, uint64_t simulate_losses, int is_from_client, size_t min_packet_size, uint64_t extra_delay, int is_batch)
 {
     int ret = 0;
     int nb_steps = 0;
@@ -140,6 +140,16 @@ int quicrq_twomedia_test_one(int is_real_time, quicrq_transport_mode_enum transp
                 ret = quicrq_cnx_post_media(cnx_ctx, (uint8_t*)QUICRQ_TEST_AUDIO_SOURCE, strlen(QUICRQ_TEST_AUDIO_SOURCE), transport_mode);
             }
         }
+        else if (is_batch) {
+            /* Subscribe to both sources with a single batch request */
+            const uint8_t* url[2] = { (const uint8_t*)QUICRQ_TEST_BASIC_SOURCE, (const uint8_t*)QUICRQ_TEST_AUDIO_SOURCE };
+            size_t url_length[2] = { strlen(QUICRQ_TEST_BASIC_SOURCE), strlen(QUICRQ_TEST_AUDIO_SOURCE) };
+            char const* media_result_file[2] = { result_file_name, audio_file_name };
+            char const* media_result_log[2] = { result_log_name, audio_log_name };
+            test_object_stream_ctx_t* object_stream_ctx[2] = { NULL, NULL };
+
+            ret = test_object_stream_subscribe_batch(cnx_ctx, 2, url, url_length, media_result_file, media_result_log, object_stream_ctx);
+        }
         else {
             /* Create a subscription to the test source on client */
             if (ret == 0) {
@@ -227,35 +237,253 @@ int quicrq_twomedia_test_one(int is_real_time, quicrq_transport_mode_enum transp
 /* Two medias connection test, using streams, real time. */
 int quicrq_twomedia_test()
 {
-    return quicrq_twomedia_test_one(1, quicrq_transport_mode_single_stream, 0, 0, 0, 0);
+    return quicrq_twomedia_test_one(1, quicrq_transport_mode_single_stream, 0, 0, 0, 0, 0);
 }
 
 /* Two medias  datagram test. Same as the basic test, but using datagrams instead of streams. */
 int quicrq_twomedia_datagram_test()
 {
-    return quicrq_twomedia_test_one(1, quicrq_transport_mode_datagram, 0, 0, 0, 0);
+    return quicrq_twomedia_test_one(1, quicrq_transport_mode_datagram, 0, 0, 0, 0, 0);
 }
 
 /* Datagram test, with forced packet losses. */
 int quicrq_twomedia_datagram_loss_test()
 {
-    return quicrq_twomedia_test_one(1, quicrq_transport_mode_datagram, 0x7080, 0, 0, 0);
+    return quicrq_twomedia_test_one(1, quicrq_transport_mode_datagram, 0x7080, 0, 0, 0, 0);
 }
 
 /* Two medias client posting data test, using streams, real time. */
 int quicrq_twomedia_client_test()
 {
-    return quicrq_twomedia_test_one(1, quicrq_transport_mode_single_stream, 0, 1, 0, 0);
+    return quicrq_twomedia_test_one(1, quicrq_transport_mode_single_stream, 0, 1, 0, 0, 0);
 }
 
 /* Two medias client posting data test, using datagrams, real time. */
 int quicrq_twomedia_datagram_client_test()
 {
-    return quicrq_twomedia_test_one(1, quicrq_transport_mode_datagram, 0, 1, 0, 0);
+    return quicrq_twomedia_test_one(1, quicrq_transport_mode_datagram, 0, 1, 0, 0, 0);
 }
 
 /* Two medias client posting data test, using datagrams, real time, with loss. */
 int quicrq_twomedia_datagram_client_loss_test()
 {
-    return quicrq_twomedia_test_one(1, quicrq_transport_mode_datagram, 0xf080, 1, 0, 0);
+    return quicrq_twomedia_test_one(1, quicrq_transport_mode_datagram, 0xf080, 1, 0, 0, 0);
+}
+
+/* Two medias datagram test, subscribing to both media with a single batch request. */
+int quicrq_twomedia_datagram_batch_test()
+{
+    return quicrq_twomedia_test_one(1, quicrq_transport_mode_datagram, 0, 0, 0, 0, 1);
+}
+
+/* Count the tracks of batches on the server connection of the two media test */
+static size_t quicrq_twomedia_server_tracks(quicrq_test_config_t* config)
+{
+    size_t nb_tracks = 0;
+
+    if (config->nodes[0]->first_cnx != NULL) {
+        quicrq_stream_ctx_t* stream_ctx = config->nodes[0]->first_cnx->first_stream;
+
+        while (stream_ctx != NULL) {
+            if (stream_ctx->batch_ctx != NULL) {
+                nb_tracks++;
+            }
+            stream_ctx = stream_ctx->next_stream;
+        }
+    }
+    return nb_tracks;
+}
+
+/* Batch test with a track that the server does not accept, or with a track
+ * that the client unsubscribes before the end. In both cases, the other
+ * media shall be received completely. After the client unsubscribes, the
+ * server shall delete the context of the track, while the other track
+ * is still being sent.
+ */
+int quicrq_twomedia_batch_track_test_one(int is_partial, int is_unsubscribe)
+{
+    int ret = 0;
+    int nb_steps = 0;
+    int nb_inactive = 0;
+    int is_closed = 0;
+    int is_unsubscribed = 0;
+    int is_server_track_closed = 0;
+    const uint64_t max_time = 360000000;
+    const int max_inactive = 128;
+    const uint64_t unsubscribe_after = 10;
+    quicrq_test_config_t* config = quicrq_test_two_media_config_create(0, 0);
+    quicrq_cnx_ctx_t* cnx_ctx = NULL;
+    char media_source_path[512];
+    char result_file_name[512];
+    char result_log_name[512];
+    char audio_source_path[512];
+    char audio_file_name[512];
+    char audio_log_name[512];
+    test_object_stream_ctx_t* object_stream_ctx[3] = { NULL, NULL, NULL };
+    size_t nb_media = (is_partial) ? 3 : 2;
+
+    ret = test_media_derive_file_names((uint8_t*)QUICRQ_TEST_BASIC_SOURCE, strlen(QUICRQ_TEST_BASIC_SOURCE),
+        quicrq_transport_mode_datagram, 1, 0,
+        result_file_name, result_log_name, sizeof(result_file_name));
+    ret = test_media_derive_file_names((uint8_t*)QUICRQ_TEST_AUDIO_SOURCE, strlen(QUICRQ_TEST_AUDIO_SOURCE),
+        quicrq_transport_mode_datagram, 1, 0,
+        audio_file_name, audio_log_name, sizeof(audio_file_name));
+
+    if (config == NULL) {
+        ret = -1;
+    }
+
+    /* Locate the source and reference file */
+    if (picoquic_get_input_path(media_source_path, sizeof(media_source_path),
+        quicrq_test_solution_dir, QUICRQ_TEST_BASIC_SOURCE) != 0) {
+        ret = -1;
+    }
+    else if (picoquic_get_input_path(audio_source_path, sizeof(media_source_path),
+        quicrq_test_solution_dir, QUICRQ_TEST_AUDIO_SOURCE) != 0) {
+        ret = -1;
+    }
+
+    if (ret == 0) {
+        /* Publish both sources on the server */
+        config->object_sources[0] = test_media_object_source_publish(config->nodes[0], (uint8_t*)QUICRQ_TEST_BASIC_SOURCE,
+            strlen(QUICRQ_TEST_BASIC_SOURCE), media_source_path, NULL, 1, config->simulated_time);
+        config->object_sources[1] = test_media_object_source_publish(config->nodes[0], (uint8_t*)QUICRQ_TEST_AUDIO_SOURCE,
+            strlen(QUICRQ_TEST_AUDIO_SOURCE), audio_source_path, NULL, 1, config->simulated_time);
+        if (config->object_sources[0] == NULL || config->object_sources[1] == NULL) {
+            ret = -1;
+        }
+    }
+
+    if (ret == 0) {
+        /* Create a quirq connection context on client */
+        cnx_ctx = quicrq_test_create_client_cnx(config, 1, 0);
+        if (cnx_ctx == NULL) {
+            ret = -1;
+            DBG_PRINTF("Cannot create client connection, ret = %d", ret);
+        }
+    }
+
+    if (ret == 0) {
+        /* Subscribe to both sources, and in the partial test to a media that is not published */
+        const uint8_t* url[3] = { (const uint8_t*)QUICRQ_TEST_BASIC_SOURCE, (const uint8_t*)QUICRQ_TEST_AUDIO_SOURCE,
+            (const uint8_t*)"not_published" };
+        size_t url_length[3] = { strlen(QUICRQ_TEST_BASIC_SOURCE), strlen(QUICRQ_TEST_AUDIO_SOURCE), strlen("not_published") };
+        char const* media_result_file[3] = { result_file_name, audio_file_name, NULL };
+        char const* media_result_log[3] = { result_log_name, audio_log_name, NULL };
+
+        ret = test_object_stream_subscribe_batch(cnx_ctx, nb_media, url, url_length, media_result_file, media_result_log, object_stream_ctx);
+    }
+
+    while (ret == 0 && nb_inactive < max_inactive && config->simulated_time < max_time) {
+        /* Run the simulation. Monitor the connection. Monitor the media. */
+        int is_active = 0;
+
+        ret = quicrq_test_loop_step(config, &is_active, UINT64_MAX);
+        if (ret != 0) {
+            DBG_PRINTF("Fail on loop step %d, %d, active: ret=%d", nb_steps, is_active, ret);
+        }
+
+        nb_steps++;
+
+        if (is_active) {
+            nb_inactive = 0;
+        }
+        else {
+            nb_inactive++;
+            if (nb_inactive >= max_inactive) {
+                DBG_PRINTF("Exit loop after too many inactive: %d", nb_inactive);
+            }
+        }
+
+        if (is_unsubscribe && !is_unsubscribed && object_stream_ctx[0]->stats.nb_objects >= unsubscribe_after) {
+            /* Unsubscribe the video track, while both tracks are being sent */
+            if (quicrq_twomedia_server_tracks(config) != 2 || object_stream_ctx[1]->is_closed) {
+                DBG_PRINTF("%s", "Unexpected state of the tracks before unsubscribe");
+                ret = -1;
+            }
+            else {
+                test_object_stream_unsubscribe(object_stream_ctx[0]);
+                is_unsubscribed = 1;
+            }
+        }
+        else if (is_unsubscribed && !is_server_track_closed && quicrq_twomedia_server_tracks(config) == 1) {
+            /* The server shall delete the track before the other media is finished */
+            if (object_stream_ctx[1]->is_closed) {
+                DBG_PRINTF("%s", "Track closed on the server after the end of the other track");
+                ret = -1;
+            }
+            is_server_track_closed = 1;
+        }
+
+        /* if the media is received, exit the loop */
+        if (config->nodes[1]->first_cnx == NULL) {
+            DBG_PRINTF("%s", "Exit loop after client connection closed.");
+            break;
+        }
+        else {
+            int client_stream_closed = config->nodes[1]->first_cnx->first_stream == NULL;
+            int server_stream_closed = config->nodes[0]->first_cnx != NULL && config->nodes[0]->first_cnx->first_stream == NULL;
+
+            if (!is_closed && client_stream_closed && server_stream_closed) {
+                /* Client is done. Close connection without waiting for timer */
+                ret = picoquic_close(config->nodes[1]->first_cnx->cnx, 0);
+                is_closed = 1;
+                if (ret != 0) {
+                    DBG_PRINTF("Cannot close client connection, ret = %d", ret);
+                }
+            }
+        }
+    }
+
+    if (ret == 0 && (!is_closed || config->simulated_time > 12000000)) {
+        DBG_PRINTF("Session was not properly closed, time = %" PRIu64, config->simulated_time);
+        ret = -1;
+    }
+
+    if (ret == 0 && is_unsubscribe && !is_server_track_closed) {
+        DBG_PRINTF("%s", "The server did not close the unsubscribed track");
+        ret = -1;
+    }
+
+    if (ret == 0 && is_partial && (!object_stream_ctx[2]->is_closed || object_stream_ctx[2]->stats.nb_objects != 0)) {
+        DBG_PRINTF("Track not accepted, closed: %d, objects: %" PRIu64, object_stream_ctx[2]->is_closed,
+            object_stream_ctx[2]->stats.nb_objects);
+        ret = -1;
+    }
+
+    /* Clear everything. */
+    if (config != NULL) {
+        quicrq_test_config_delete(config);
+    }
+    for (size_t i = 0; i < nb_media; i++) {
+        if (object_stream_ctx[i] != NULL) {
+            test_object_stream_consumer_close(object_stream_ctx[i]);
+        }
+    }
+    /* Verify that media files were received correctly */
+    if (ret == 0) {
+        if (!is_unsubscribe) {
+            ret = quicrq_compare_media_file(result_file_name, media_source_path);
+        }
+        if (ret == 0) {
+            ret = quicrq_compare_media_file(audio_file_name, audio_source_path);
+        }
+    }
+    else {
+        DBG_PRINTF("Test failed before getting results, ret = %d", ret);
+    }
+
+    return ret;
+}
+
+/* Batch request in which the server does not accept one of the tracks. */
+int quicrq_twomedia_batch_partial_test()
+{
+    return quicrq_twomedia_batch_track_test_one(1, 0);
+}
+
+/* Batch request in which the client unsubscribes one of the tracks. */
+int quicrq_twomedia_batch_unsubscribe_test()
+{
+    return quicrq_twomedia_batch_track_test_one(0, 1);
 }